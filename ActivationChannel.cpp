@@ -0,0 +1,328 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ActivationChannel.h"
+
+static const LPCWSTR c_windowClass = L"WebViewBrowserAppActivation";
+
+// A client and its request, then the pipe and the reply to write
+struct ActivationServer::Connection
+{
+    wil::unique_hfile pipe;
+    HWND hWnd = nullptr;
+    ActivationRequest request;
+    std::vector<BYTE> frame;
+};
+
+ActivationServer::~ActivationServer()
+{
+    Stop();
+}
+
+HRESULT ActivationServer::Start(HINSTANCE hInstance, RequestHandler handler)
+{
+    RETURN_IF_FAILED(CreatePipe(true, m_firstPipe));
+    m_handler = std::move(handler);
+
+    WNDCLASSEXW wcex = {};
+    wcex.cbSize = sizeof(WNDCLASSEX);
+    wcex.lpfnWndProc = WndProcStatic;
+    wcex.hInstance = hInstance;
+    wcex.lpszClassName = c_windowClass;
+    if (!RegisterClassExW(&wcex) && GetLastError() != ERROR_CLASS_ALREADY_EXISTS)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Stop();
+        return hr;
+    }
+
+    m_hWnd = CreateWindowExW(0, c_windowClass, nullptr, 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, hInstance, nullptr);
+    if (!m_hWnd)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Stop();
+        return hr;
+    }
+    SetWindowLongPtr(m_hWnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
+
+    m_thread.reset(CreateThread(nullptr, 0, ListenStatic, this, 0, nullptr));
+    if (!m_thread)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Stop();
+        return hr;
+    }
+    return S_OK;
+}
+
+void ActivationServer::Stop()
+{
+    if (m_thread)
+    {
+        m_stopping = true;
+        // The thread may only get to ConnectNamedPipe after the first try
+        while (WaitForSingleObject(m_thread.get(), 10) == WAIT_TIMEOUT)
+        {
+            CancelSynchronousIo(m_thread.get());
+        }
+        m_thread.reset();
+    }
+
+    // Requests still on their way to the window are dropped with it, their
+    // clients see the pipe break
+    if (m_hWnd)
+    {
+        DestroyWindow(m_hWnd);
+        m_hWnd = nullptr;
+    }
+    m_firstPipe.reset();
+}
+
+HRESULT ActivationServer::Send(const ActivationRequest& request, ActivationReply& reply)
+{
+    std::vector<BYTE> frame;
+    RETURN_IF_FAILED(ActivationCodec::EncodeRequest(request, frame));
+
+    std::wstring const name = GetPipeName();
+    wil::unique_hfile pipe;
+    for (;;)
+    {
+        pipe.reset(CreateFileW(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+            SECURITY_SQOS_PRESENT | SECURITY_IDENTIFICATION, nullptr));
+        if (pipe)
+        {
+            break;
+        }
+
+        DWORD const error = GetLastError();
+        if (error != ERROR_PIPE_BUSY)
+        {
+            return HRESULT_FROM_WIN32(error);
+        }
+        if (!WaitNamedPipeW(name.c_str(), c_connectTimeout))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    // Lets the running instance bring its window to the front, which only
+    // the process the user just started may do
+    ULONG serverProcessId = 0;
+    if (GetNamedPipeServerProcessId(pipe.get(), &serverProcessId))
+    {
+        AllowSetForegroundWindow(serverProcessId);
+    }
+
+    RETURN_IF_FAILED(WriteAll(pipe.get(), frame));
+    // An instance which hangs must not take this one with it
+    std::vector<BYTE> payload;
+    RETURN_IF_FAILED(ReadFrame(pipe.get(), c_readTimeout, payload));
+    return ActivationCodec::DecodeReply(payload, reply);
+}
+
+// Per user and session, the instances of other users don't see each other
+std::wstring ActivationServer::GetPipeName()
+{
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+    WCHAR user[257] = L"";
+    DWORD userLength = _countof(user);
+    GetUserNameW(user, &userLength);
+
+    WCHAR name[MAX_PATH];
+    StringCchPrintfW(name, _countof(name), L"\\\\.\\pipe\\WebViewBrowserApp-%lu-%s", sessionId, user);
+    return name;
+}
+
+HRESULT ActivationServer::CreatePipe(bool first, wil::unique_hfile& pipe)
+{
+    pipe.reset(CreateNamedPipeW(GetPipeName().c_str(),
+        PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        PIPE_UNLIMITED_INSTANCES, 4096, 4096, 0, nullptr));
+    return pipe ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+}
+
+HRESULT ActivationServer::ReadFrame(HANDLE pipe, std::vector<BYTE>& payload)
+{
+    FrameReader reader;
+    BYTE buffer[4096];
+    HRESULT hr;
+    while ((hr = reader.Take(payload)) == S_FALSE)
+    {
+        DWORD read = 0;
+        if (!ReadFile(pipe, buffer, sizeof(buffer), &read, nullptr))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        if (read == 0)
+        {
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        }
+        RETURN_IF_FAILED(reader.Append(buffer, read));
+    }
+    return hr;
+}
+
+// The pipe is synchronous, a read only returns once the client has written.
+// A timer cancels the reads of this thread once timeout has passed, and
+// keeps trying every c_cancelInterval: CancelSynchronousIo misses a read
+// which hasn't started yet.
+HRESULT ActivationServer::ReadFrame(HANDLE pipe, DWORD timeout, std::vector<BYTE>& payload)
+{
+    static const DWORD c_cancelInterval = 10;
+
+    wil::unique_handle thread(OpenThread(THREAD_TERMINATE, FALSE, GetCurrentThreadId()));
+    if (!thread)
+    {
+        RETURN_LAST_ERROR();
+    }
+    wil::unique_threadpool_timer timer(CreateThreadpoolTimer([](PTP_CALLBACK_INSTANCE, PVOID context, PTP_TIMER)
+    {
+        CancelSynchronousIo(static_cast<HANDLE>(context));
+    }, thread.get(), nullptr));
+    if (!timer)
+    {
+        RETURN_LAST_ERROR();
+    }
+
+    ULARGE_INTEGER dueTime;
+    dueTime.QuadPart = static_cast<ULONGLONG>(-static_cast<LONGLONG>(timeout) * 10000);  // Relative, in 100 ns
+    FILETIME due = { dueTime.LowPart, dueTime.HighPart };
+    SetThreadpoolTimer(timer.get(), &due, c_cancelInterval, 0);
+
+    HRESULT const hr = ReadFrame(pipe, payload);
+    // Waits for a callback in progress, none runs after this
+    timer.reset();
+    return hr == HRESULT_FROM_WIN32(ERROR_OPERATION_ABORTED) ? HRESULT_FROM_WIN32(ERROR_TIMEOUT) : hr;
+}
+
+HRESULT ActivationServer::WriteAll(HANDLE pipe, const std::vector<BYTE>& data)
+{
+    size_t offset = 0;
+    while (offset < data.size())
+    {
+        DWORD written = 0;
+        DWORD const size = static_cast<DWORD>(std::min<size_t>(data.size() - offset, MAXDWORD));
+        if (!WriteFile(pipe, data.data() + offset, size, &written, nullptr))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        offset += written;
+    }
+    return S_OK;
+}
+
+DWORD WINAPI ActivationServer::ListenStatic(LPVOID context)
+{
+    static_cast<ActivationServer*>(context)->Listen();
+    return 0;
+}
+
+// A new instance of the pipe is created as soon as a client is connected,
+// so later clients find the pipe busy instead of gone while one is handled
+void ActivationServer::Listen()
+{
+    auto read = [](PTP_CALLBACK_INSTANCE, PVOID context)
+    {
+        // A client which is too slow is dropped, the pipe closes with the
+        // connection
+        std::unique_ptr<Connection> connection(static_cast<Connection*>(context));
+        std::vector<BYTE> payload;
+        if (FAILED(ReadFrame(connection->pipe.get(), c_readTimeout, payload)) ||
+            FAILED(ActivationCodec::DecodeRequest(payload, connection->request)))
+        {
+            return;
+        }
+
+        // The window deletes it, unless it is gone
+        if (PostMessage(connection->hWnd, WM_ACTIVATION_REQUEST, 0, reinterpret_cast<LPARAM>(connection.get())))
+        {
+            connection.release();
+        }
+    };
+
+    wil::unique_hfile pipe = std::move(m_firstPipe);
+    while (!m_stopping)
+    {
+        if (!ConnectNamedPipe(pipe.get(), nullptr) && GetLastError() != ERROR_PIPE_CONNECTED)
+        {
+            DWORD const error = GetLastError();
+            if (m_stopping || (error != ERROR_NO_DATA && error != ERROR_OPERATION_ABORTED))
+            {
+                break;
+            }
+            // The client is gone already
+            DisconnectNamedPipe(pipe.get());
+            continue;
+        }
+
+        wil::unique_hfile next;
+        HRESULT hr = CreatePipe(false, next);
+
+        std::unique_ptr<Connection> connection(new Connection());
+        connection->pipe = std::move(pipe);
+        connection->hWnd = m_hWnd;
+        if (TrySubmitThreadpoolCallback(read, connection.get(), nullptr))
+        {
+            connection.release();
+        }
+
+        if (FAILED(hr))
+        {
+            OutputDebugString(L"Can't accept more activation requests\n");
+            break;
+        }
+        pipe = std::move(next);
+    }
+}
+
+LRESULT CALLBACK ActivationServer::WndProcStatic(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+    if (message == WM_ACTIVATION_REQUEST)
+    {
+        std::unique_ptr<Connection> connection(reinterpret_cast<Connection*>(lParam));
+        if (ActivationServer* server = reinterpret_cast<ActivationServer*>(GetWindowLongPtr(hWnd, GWLP_USERDATA)))
+        {
+            server->HandleRequest(std::move(connection));
+        }
+        return 0;
+    }
+    return DefWindowProc(hWnd, message, wParam, lParam);
+}
+
+// The reply is written on the thread pool, the client may be slow to read
+// it. A reply after the first is ignored.
+void ActivationServer::HandleRequest(std::unique_ptr<Connection> connection)
+{
+    ActivationRequest request = std::move(connection->request);
+    std::shared_ptr<Connection> client(std::move(connection));
+    m_handler(std::move(request), [client](const ActivationReply& reply)
+    {
+        if (!client->pipe)
+        {
+            return;
+        }
+
+        std::unique_ptr<Connection> writing(new Connection());
+        writing->pipe = std::move(client->pipe);
+        if (FAILED(ActivationCodec::EncodeReply(reply, writing->frame)))
+        {
+            return;
+        }
+
+        auto write = [](PTP_CALLBACK_INSTANCE, PVOID context)
+        {
+            std::unique_ptr<Connection> connection(static_cast<Connection*>(context));
+            if (SUCCEEDED(WriteAll(connection->pipe.get(), connection->frame)))
+            {
+                FlushFileBuffers(connection->pipe.get());
+            }
+        };
+        if (TrySubmitThreadpoolCallback(write, writing.get(), nullptr))
+        {
+            writing.release();
+        }
+    });
+}
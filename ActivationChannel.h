@@ -0,0 +1,62 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+#include "ActivationProtocol.h"
+
+// Keeps a single instance of the app per user and session. The first
+// instance owns a named pipe, the pipe is created with
+// FILE_FLAG_FIRST_PIPE_INSTANCE so only one instance can ever own it. Later
+// instances send their request through it with Send() and quit once the
+// reply arrives.
+//
+// A thread waits for connections and hands every connected client to the
+// thread pool, which reads its request. The request is handled on the UI
+// thread, and the reply is written from the thread pool again, so neither a
+// slow client nor a request which waits for the first window blocks the
+// others. A client which doesn't send its whole request within
+// c_readTimeout is dropped, and a client gives up on a reply which doesn't
+// come within c_readTimeout.
+class ActivationServer
+{
+public:
+    // Called on the UI thread. reply may be called later, once.
+    typedef std::function<void(ActivationRequest request, ActivationQueue::ReplyCallback reply)> RequestHandler;
+
+    static const DWORD c_connectTimeout = 5000;  // Milliseconds Send() waits for a free pipe
+    static const DWORD c_readTimeout = 5000;     // Milliseconds to send a whole request or reply
+
+    ~ActivationServer();
+
+    // Fails with HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) if another instance
+    // owns the pipe
+    HRESULT Start(HINSTANCE hInstance, RequestHandler handler);
+    void Stop();
+
+    // Returns HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) if no instance is
+    // running, e.g. because it just quit, and HRESULT_FROM_WIN32(ERROR_TIMEOUT)
+    // if the running instance doesn't reply in time
+    static HRESULT Send(const ActivationRequest& request, ActivationReply& reply);
+
+private:
+    struct Connection;
+
+    HWND m_hWnd = nullptr;  // Message only, receives the requests
+    wil::unique_hfile m_firstPipe;
+    wil::unique_handle m_thread;
+    std::atomic<bool> m_stopping{ false };
+    RequestHandler m_handler;
+
+    static std::wstring GetPipeName();
+    static HRESULT CreatePipe(bool first, wil::unique_hfile& pipe);
+    static HRESULT ReadFrame(HANDLE pipe, std::vector<BYTE>& payload);
+    static HRESULT ReadFrame(HANDLE pipe, DWORD timeout, std::vector<BYTE>& payload);
+    static HRESULT WriteAll(HANDLE pipe, const std::vector<BYTE>& data);
+    static DWORD WINAPI ListenStatic(LPVOID context);
+    static LRESULT CALLBACK WndProcStatic(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
+    void Listen();
+    void HandleRequest(std::unique_ptr<Connection> connection);
+};
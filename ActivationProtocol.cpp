@@ -0,0 +1,303 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ActivationProtocol.h"
+#include "Utf.h"
+
+static void AppendUInt32(std::vector<BYTE>& buffer, UINT32 value)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        buffer.push_back(static_cast<BYTE>(value >> shift));
+    }
+}
+
+static void AppendUInt64(std::vector<BYTE>& buffer, UINT64 value)
+{
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        buffer.push_back(static_cast<BYTE>(value >> shift));
+    }
+}
+
+static bool ReadUInt32(const std::vector<BYTE>& buffer, size_t& offset, UINT32& value)
+{
+    if (buffer.size() - offset < 4)
+    {
+        return false;
+    }
+
+    value = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        value |= static_cast<UINT32>(buffer[offset++]) << (8 * i);
+    }
+    return true;
+}
+
+static bool ReadUInt64(const std::vector<BYTE>& buffer, size_t& offset, UINT64& value)
+{
+    if (buffer.size() - offset < 8)
+    {
+        return false;
+    }
+
+    value = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        value |= static_cast<UINT64>(buffer[offset++]) << (8 * i);
+    }
+    return true;
+}
+
+// Reserves the length of the frame, FinishFrame() fills it in
+static size_t BeginFrame(std::vector<BYTE>& frame)
+{
+    size_t const begin = frame.size();
+    AppendUInt32(frame, 0);
+    return begin;
+}
+
+static HRESULT FinishFrame(std::vector<BYTE>& frame, size_t begin)
+{
+    size_t const size = frame.size() - begin - 4;
+    if (size > ActivationCodec::c_maxFrameSize)
+    {
+        frame.resize(begin);
+        return HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW);
+    }
+
+    for (int i = 0; i < 4; ++i)
+    {
+        frame[begin + i] = static_cast<BYTE>(size >> (8 * i));
+    }
+    return S_OK;
+}
+
+HRESULT ActivationCodec::EncodeRequest(const ActivationRequest& request, std::vector<BYTE>& frame)
+{
+    size_t const begin = BeginFrame(frame);
+    AppendUInt32(frame, c_requestMagic);
+    AppendUInt32(frame, static_cast<UINT32>(std::min<size_t>(request.uris.size(), UINT32_MAX)));
+
+    std::string utf8;
+    for (const std::wstring& uri : request.uris)
+    {
+        utf8.clear();
+        HRESULT hr = AppendUtf8(uri.c_str(), uri.size(), utf8);
+        if (FAILED(hr) || utf8.size() > c_maxFrameSize)
+        {
+            frame.resize(begin);
+            return FAILED(hr) ? hr : HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW);
+        }
+        AppendUInt32(frame, static_cast<UINT32>(utf8.size()));
+        frame.insert(frame.end(), utf8.begin(), utf8.end());
+    }
+    return FinishFrame(frame, begin);
+}
+
+HRESULT ActivationCodec::EncodeReply(const ActivationReply& reply, std::vector<BYTE>& frame)
+{
+    size_t const begin = BeginFrame(frame);
+    AppendUInt32(frame, c_replyMagic);
+    AppendUInt32(frame, static_cast<UINT32>(reply.result));
+    AppendUInt32(frame, static_cast<UINT32>(std::min<size_t>(reply.tabIds.size(), UINT32_MAX)));
+    for (size_t tabId : reply.tabIds)
+    {
+        AppendUInt64(frame, tabId);
+    }
+    return FinishFrame(frame, begin);
+}
+
+HRESULT ActivationCodec::DecodeRequest(const std::vector<BYTE>& payload, ActivationRequest& request)
+{
+    size_t offset = 0;
+    UINT32 magic = 0;
+    UINT32 count = 0;
+    if (!ReadUInt32(payload, offset, magic) || magic != c_requestMagic ||
+        !ReadUInt32(payload, offset, count))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    request.uris.clear();
+    for (UINT32 i = 0; i < count; ++i)
+    {
+        UINT32 length = 0;
+        if (!ReadUInt32(payload, offset, length) || payload.size() - offset < length)
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        request.uris.emplace_back();
+        RETURN_IF_FAILED(AppendUtf16(reinterpret_cast<const char*>(payload.data() + offset), length, request.uris.back()));
+        offset += length;
+    }
+    return offset == payload.size() ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+}
+
+HRESULT ActivationCodec::DecodeReply(const std::vector<BYTE>& payload, ActivationReply& reply)
+{
+    size_t offset = 0;
+    UINT32 magic = 0;
+    UINT32 result = 0;
+    UINT32 count = 0;
+    if (!ReadUInt32(payload, offset, magic) || magic != c_replyMagic ||
+        !ReadUInt32(payload, offset, result) || !ReadUInt32(payload, offset, count) ||
+        (payload.size() - offset) / 8 < count)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    reply.result = static_cast<HRESULT>(result);
+    reply.tabIds.clear();
+    reply.tabIds.reserve(count);
+    for (UINT32 i = 0; i < count; ++i)
+    {
+        UINT64 tabId = 0;
+        ReadUInt64(payload, offset, tabId);
+        reply.tabIds.push_back(static_cast<size_t>(tabId));
+    }
+    return offset == payload.size() ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+}
+
+HRESULT FrameReader::Append(const BYTE* data, size_t size)
+{
+    // Drop the frames taken already before the buffer grows
+    if (m_begin == m_buffer.size())
+    {
+        m_buffer.clear();
+        m_begin = 0;
+    }
+    else if (m_begin > m_buffer.size() / 2)
+    {
+        m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_begin);
+        m_begin = 0;
+    }
+
+    m_buffer.insert(m_buffer.end(), data, data + size);
+    return S_OK;
+}
+
+HRESULT FrameReader::Take(std::vector<BYTE>& payload)
+{
+    size_t offset = m_begin;
+    UINT32 size = 0;
+    if (!ReadUInt32(m_buffer, offset, size))
+    {
+        return S_FALSE;
+    }
+    if (size > ActivationCodec::c_maxFrameSize)
+    {
+        return HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW);
+    }
+    if (m_buffer.size() - offset < size)
+    {
+        return S_FALSE;
+    }
+
+    payload.assign(m_buffer.begin() + offset, m_buffer.begin() + offset + size);
+    m_begin = offset + size;
+    return S_OK;
+}
+
+size_t ActivationQueue::Submit(ActivationRequest request, ReplyCallback reply)
+{
+    Pending pending;
+    pending.requestId = m_nextRequestId++;
+    pending.target = 0;
+    pending.request = std::move(request);
+    pending.reply = std::move(reply);
+    m_waiting.push_back(std::move(pending));
+    return m_waiting.back().requestId;
+}
+
+bool ActivationQueue::Take(size_t target, size_t& requestId, ActivationRequest& request)
+{
+    if (m_waiting.empty())
+    {
+        return false;
+    }
+
+    Pending pending = std::move(m_waiting.front());
+    m_waiting.pop_front();
+    pending.target = target;
+    requestId = pending.requestId;
+    request = pending.request;
+    m_taken.emplace(requestId, std::move(pending));
+    return true;
+}
+
+void ActivationQueue::Complete(size_t requestId, const ActivationReply& reply)
+{
+    auto it = m_taken.find(requestId);
+    if (it == m_taken.end())
+    {
+        return;
+    }
+
+    // The callback may submit or complete other requests
+    ReplyCallback callback = std::move(it->second.reply);
+    m_taken.erase(it);
+    callback(reply);
+}
+
+void ActivationQueue::Cancel(size_t target, HRESULT result)
+{
+    std::vector<Pending> cancelled;
+    for (auto it = m_taken.begin(); it != m_taken.end();)
+    {
+        if (it->second.target == target)
+        {
+            cancelled.push_back(std::move(it->second));
+            it = m_taken.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    for (Pending& pending : cancelled)
+    {
+        Fail(pending, result);
+    }
+}
+
+void ActivationQueue::CancelAll(HRESULT result)
+{
+    std::vector<Pending> cancelled;
+    for (auto& taken : m_taken)
+    {
+        cancelled.push_back(std::move(taken.second));
+    }
+    for (Pending& waiting : m_waiting)
+    {
+        cancelled.push_back(std::move(waiting));
+    }
+    m_taken.clear();
+    m_waiting.clear();
+
+    for (Pending& pending : cancelled)
+    {
+        Fail(pending, result);
+    }
+}
+
+size_t ActivationQueue::GetWaitingUriCount() const
+{
+    size_t count = 0;
+    for (const Pending& pending : m_waiting)
+    {
+        count += pending.request.uris.size();
+    }
+    return count;
+}
+
+void ActivationQueue::Fail(Pending& pending, HRESULT result)
+{
+    ActivationReply reply;
+    reply.result = result;
+    pending.reply(reply);
+}
@@ -0,0 +1,99 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// What a second instance of the app asks the running one for. No URIs only
+// brings the running instance to the front.
+struct ActivationRequest
+{
+    std::vector<std::wstring> uris;
+};
+
+// The tabs opened for the URIs, in the order of the request
+struct ActivationReply
+{
+    HRESULT result = S_OK;
+    std::vector<size_t> tabIds;
+};
+
+// The wire format between the instances, the same on any stream transport.
+// Every message is one frame: its length as a uint32, then that many bytes.
+// All integers are little endian.
+//   request  magic, URI count                  2 x uint32
+//            per URI: UTF-8 length, the bytes  uint32, bytes
+//   reply    magic, HRESULT, tab count         3 x uint32
+//            the tab ids                       tab count x uint64
+class ActivationCodec
+{
+public:
+    static const UINT32 c_requestMagic = 0x31515257;  // "WRQ1"
+    static const UINT32 c_replyMagic = 0x31505257;  // "WRP1"
+    // Larger frames are refused before anything is allocated for them
+    static const UINT32 c_maxFrameSize = 4 * 1024 * 1024;
+
+    // Append a whole frame to the buffer
+    static HRESULT EncodeRequest(const ActivationRequest& request, std::vector<BYTE>& frame);
+    static HRESULT EncodeReply(const ActivationReply& reply, std::vector<BYTE>& frame);
+    // Decode the payload of a frame, as FrameReader hands it out
+    static HRESULT DecodeRequest(const std::vector<BYTE>& payload, ActivationRequest& request);
+    static HRESULT DecodeReply(const std::vector<BYTE>& payload, ActivationReply& reply);
+};
+
+// Collects the bytes of a stream, however they are split up, and hands out
+// the payloads of the complete frames
+class FrameReader
+{
+public:
+    HRESULT Append(const BYTE* data, size_t size);
+    // S_FALSE until a whole frame has arrived
+    HRESULT Take(std::vector<BYTE>& payload);
+
+private:
+    std::vector<BYTE> m_buffer;
+    size_t m_begin = 0;  // Start of the first frame not taken yet
+};
+
+// The requests of other instances, from when they arrive until the tabs for
+// them are open. They wait until a window can open tabs, and are then taken
+// in the order they arrived by the window which opens them, the target. A
+// request is answered exactly once: when it completes, or when its target
+// goes away.
+class ActivationQueue
+{
+public:
+    typedef std::function<void(const ActivationReply&)> ReplyCallback;
+
+    // Returns the id the request completes with
+    size_t Submit(ActivationRequest request, ReplyCallback reply);
+    // False if there is no waiting request
+    bool Take(size_t target, size_t& requestId, ActivationRequest& request);
+    // Unknown requests are ignored, e.g. those cancelled already
+    void Complete(size_t requestId, const ActivationReply& reply);
+    // Answers the requests taken by the target with result
+    void Cancel(size_t target, HRESULT result);
+    // Answers all requests with result, waiting or taken
+    void CancelAll(HRESULT result);
+
+    size_t GetWaitingCount() const { return m_waiting.size(); }
+    size_t GetWaitingUriCount() const;
+    size_t GetTakenCount() const { return m_taken.size(); }
+
+private:
+    struct Pending
+    {
+        size_t requestId;
+        size_t target;
+        ActivationRequest request;
+        ReplyCallback reply;
+    };
+
+    std::deque<Pending> m_waiting;  // Oldest first
+    std::map<size_t, Pending> m_taken;  // By request id
+    size_t m_nextRequestId = 1;
+
+    static void Fail(Pending& pending, HRESULT result);
+};
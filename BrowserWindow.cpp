@@ -7,7 +7,12 @@
 #include <WebView2EnvironmentOptions.h>
 #include <Urlmon.h>
 #pragma comment (lib, "Urlmon.lib")
+#include <Shlwapi.h>
+#pragma comment (lib, "Shlwapi.lib")
 #include <wincrypt.h>
+#include <winhttp.h>
+#pragma comment (lib, "Winhttp.lib")
+#include "Utf.h"
 
 using namespace Microsoft::WRL;
 
@@ -26,30 +31,347 @@ static struct user32_dll {
 
 WCHAR BrowserWindow::s_windowClass[] = { 0 };
 WCHAR BrowserWindow::s_title[] = { 0 };
+HWND BrowserWindow::s_errorWindow = nullptr;
+ErrorReporter BrowserWindow::s_errorReporter(
+    []()
+    {
+        LONGLONG timestamp;
+        int day;
+        GetVisitTime(&timestamp, &day);
+        return static_cast<ULONGLONG>(timestamp);
+    },
+    []()
+    {
+        PostMessage(s_errorWindow, WM_REPORT_ERRORS, 0, 0);
+    });
+
+// Handed from the worker which fetched a favicon to the UI thread
+struct FetchedFavicon
+{
+    HWND hWnd = nullptr;
+    std::wstring folder;
+    std::wstring source;
+    HRESULT result = E_FAIL;
+    std::vector<BYTE> data;  // As the tab loaded it
+    FaviconCache::Icon icon;
+};
+
+// Handed from the worker which compiled the filter list to the UI thread
+struct CompiledFilter
+{
+    HWND hWnd = nullptr;
+    std::wstring listPath;
+    std::wstring snapshotPath;
+    UINT64 sourceTime = 0;
+    UINT64 sourceSize = 0;
+    HRESULT result = E_FAIL;
+};
+
+// Lists larger than this are taken for something else
+static const LONGLONG c_maxFilterListSize = 64 * 1024 * 1024;
+
+// Writes the snapshot next to the one in use, if any, and replaces it
+static HRESULT CompileFilterList(const CompiledFilter& compile)
+{
+    TRACE_SPAN(L"CompileFilterList", 0);
+
+    std::string text;
+    {
+        wil::unique_hfile list(CreateFileW(compile.listPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!list)
+        {
+            RETURN_LAST_ERROR();
+        }
+        LARGE_INTEGER size;
+        RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(list.get(), &size));
+        if (size.QuadPart > c_maxFilterListSize)
+        {
+            return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+        }
+
+        text.resize(static_cast<size_t>(size.QuadPart));
+        DWORD read = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(ReadFile(list.get(), &text[0], static_cast<DWORD>(text.size()), &read, nullptr));
+        text.resize(read);
+    }
+
+    FilterCompiler compiler;
+    compiler.AddRules(text.data(), text.size());
+    std::vector<BYTE> snapshot;
+    RETURN_IF_FAILED(compiler.Build(compile.sourceTime, compile.sourceSize, snapshot));
+
+    std::wstring const temporaryPath = compile.snapshotPath + L".tmp";
+    {
+        wil::unique_hfile file(CreateFileW(temporaryPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file)
+        {
+            RETURN_LAST_ERROR();
+        }
+
+        DWORD written = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(WriteFile(file.get(), snapshot.data(), static_cast<DWORD>(snapshot.size()), &written, nullptr));
+        if (written != snapshot.size())
+        {
+            return E_FAIL;
+        }
+    }
+    RETURN_IF_WIN32_BOOL_FALSE(MoveFileExW(temporaryPath.c_str(), compile.snapshotPath.c_str(), MOVEFILE_REPLACE_EXISTING));
+    return S_OK;
+}
+
+// Handed from the worker which revalidated a cached response to the UI thread
+struct CacheRevalidation
+{
+    HWND hWnd = nullptr;
+    size_t revalidationId = 0;
+    std::wstring uri;
+    std::wstring headers;  // Of the conditional request
+    HRESULT result = E_FAIL;
+    int status = 0;
+    std::wstring responseHeaders;  // Without the status line
+};
+
+typedef wil::unique_any<HINTERNET, decltype(&::WinHttpCloseHandle), ::WinHttpCloseHandle> unique_hinternet;
+
+// Milliseconds a revalidation takes at most as a whole, the page waits as
+// long. A server which doesn't accept the connection fails it sooner.
+static const int c_revalidationTimeout = 5000;
+static const int c_revalidationConnectTimeout = 2000;
+
+// Sends the request and reads the status and the headers of the answer
+static HRESULT ExchangeConditionalRequest(HINTERNET request, CacheRevalidation& revalidation)
+{
+    RETURN_IF_WIN32_BOOL_FALSE(WinHttpSendRequest(request, revalidation.headers.c_str(),
+        static_cast<DWORD>(revalidation.headers.size()), WINHTTP_NO_REQUEST_DATA, 0, 0, 0));
+    RETURN_IF_WIN32_BOOL_FALSE(WinHttpReceiveResponse(request, nullptr));
+
+    DWORD status = 0;
+    DWORD size = sizeof(status);
+    RETURN_IF_WIN32_BOOL_FALSE(WinHttpQueryHeaders(request, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+        WINHTTP_HEADER_NAME_BY_INDEX, &status, &size, WINHTTP_NO_HEADER_INDEX));
+    revalidation.status = static_cast<int>(status);
+
+    size = 0;
+    if (!WinHttpQueryHeaders(request, WINHTTP_QUERY_RAW_HEADERS_CRLF, WINHTTP_HEADER_NAME_BY_INDEX,
+        WINHTTP_NO_OUTPUT_BUFFER, &size, WINHTTP_NO_HEADER_INDEX) && GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+    {
+        RETURN_LAST_ERROR();
+    }
+    std::wstring headers(size / sizeof(WCHAR), L'\0');
+    RETURN_IF_WIN32_BOOL_FALSE(WinHttpQueryHeaders(request, WINHTTP_QUERY_RAW_HEADERS_CRLF, WINHTTP_HEADER_NAME_BY_INDEX,
+        &headers[0], &size, WINHTTP_NO_HEADER_INDEX));
+    headers.resize(size / sizeof(WCHAR));
+    size_t const statusLineEnd = headers.find(L"\r\n");
+    revalidation.responseHeaders = statusLineEnd == std::wstring::npos ? std::wstring() : headers.substr(statusLineEnd + 2);
+    return S_OK;
+}
+
+// Only the status and the headers of the answer are read. The body of a
+// changed response isn't, the page loads it itself. A timer closes the
+// request handle once c_revalidationTimeout is up, which aborts whichever
+// WinHttp call is waiting, so the timeouts of the phases don't add up.
+static HRESULT SendConditionalRequest(CacheRevalidation& revalidation)
+{
+    TRACE_SPAN(L"SendConditionalRequest", revalidation.revalidationId);
+
+    URL_COMPONENTS components = { sizeof(components) };
+    components.dwHostNameLength = static_cast<DWORD>(-1);
+    components.dwUrlPathLength = static_cast<DWORD>(-1);
+    components.dwExtraInfoLength = static_cast<DWORD>(-1);
+    RETURN_IF_WIN32_BOOL_FALSE(WinHttpCrackUrl(revalidation.uri.c_str(), 0, 0, &components));
+    std::wstring const host(components.lpszHostName, components.dwHostNameLength);
+    // The query follows the path
+    std::wstring path(components.lpszUrlPath, components.dwUrlPathLength + components.dwExtraInfoLength);
+    if (path.empty())
+    {
+        path = L"/";
+    }
+
+    unique_hinternet session(WinHttpOpen(nullptr, WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0));
+    if (!session)
+    {
+        RETURN_LAST_ERROR();
+    }
+    RETURN_IF_WIN32_BOOL_FALSE(WinHttpSetTimeouts(session.get(), c_revalidationConnectTimeout, c_revalidationConnectTimeout,
+        c_revalidationTimeout, c_revalidationTimeout));
+    unique_hinternet connection(WinHttpConnect(session.get(), host.c_str(), components.nPort, 0));
+    if (!connection)
+    {
+        RETURN_LAST_ERROR();
+    }
+    unique_hinternet request(WinHttpOpenRequest(connection.get(), L"GET", path.c_str(), nullptr, WINHTTP_NO_REFERER,
+        WINHTTP_DEFAULT_ACCEPT_TYPES, components.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0));
+    if (!request)
+    {
+        RETURN_LAST_ERROR();
+    }
+
+    // A redirect is an answer of its own. The headers carry the page's
+    // cookies, WinHttp's own are neither sent nor stored.
+    DWORD features = WINHTTP_DISABLE_REDIRECTS | WINHTTP_DISABLE_COOKIES;
+    RETURN_IF_WIN32_BOOL_FALSE(WinHttpSetOption(request.get(), WINHTTP_OPTION_DISABLE_FEATURE, &features, sizeof(features)));
+
+    struct Deadline
+    {
+        HINTERNET request;
+        bool expired;
+    } deadline = { request.get(), false };
+    wil::unique_threadpool_timer timer(CreateThreadpoolTimer([](PTP_CALLBACK_INSTANCE, PVOID context, PTP_TIMER)
+    {
+        Deadline* const deadline = static_cast<Deadline*>(context);
+        deadline->expired = true;
+        WinHttpCloseHandle(deadline->request);
+    }, &deadline, nullptr));
+    if (!timer)
+    {
+        RETURN_LAST_ERROR();
+    }
+
+    ULARGE_INTEGER dueTime;
+    dueTime.QuadPart = static_cast<ULONGLONG>(-static_cast<LONGLONG>(c_revalidationTimeout) * 10000);  // Relative, in 100 ns
+    FILETIME due = { dueTime.LowPart, dueTime.HighPart };
+    SetThreadpoolTimer(timer.get(), &due, 0, 0);
+
+    HRESULT const hr = ExchangeConditionalRequest(request.get(), revalidation);
+    // Waits for a callback in progress, none runs after this
+    timer.reset();
+    if (deadline.expired)
+    {
+        // The timer closed it, an answer which came just in time still counts
+        request.release();
+        return SUCCEEDED(hr) ? hr : HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+    }
+    return hr;
+}
 
-// encoding function
-static std::wstring_convert<std::codecvt_utf8<wchar_t>> utf8;
-static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> utf8_utf16; 
+// As a Cookie header, none without cookies
+static HRESULT AppendCookieHeader(ICoreWebView2CookieList* cookies, std::string& headers)
+{
+    UINT count = 0;
+    RETURN_IF_FAILED(cookies->get_Count(&count));
+    std::string value;
+    for (UINT i = 0; i < count; ++i)
+    {
+        wil::com_ptr<ICoreWebView2Cookie> cookie;
+        RETURN_IF_FAILED(cookies->GetValueAtIndex(i, &cookie));
+        wil::unique_cotaskmem_string name;
+        wil::unique_cotaskmem_string cookieValue;
+        RETURN_IF_FAILED(cookie->get_Name(&name));
+        RETURN_IF_FAILED(cookie->get_Value(&cookieValue));
+        if (!value.empty())
+        {
+            value.append("; ");
+        }
+        RETURN_IF_FAILED(AppendUtf8(name.get(), wcslen(name.get()), value));
+        value.append("=");
+        RETURN_IF_FAILED(AppendUtf8(cookieValue.get(), wcslen(cookieValue.get()), value));
+    }
+
+    if (!value.empty())
+    {
+        headers.append("Cookie: ");
+        headers.append(value);
+        headers.append("\r\n");
+    }
+    return S_OK;
+}
+
+// As "Name: value\r\n" lines
+static HRESULT AppendHeaders(ICoreWebView2HttpHeadersCollectionIterator* iterator, std::string& headers)
+{
+    BOOL hasHeader = FALSE;
+    RETURN_IF_FAILED(iterator->get_HasCurrentHeader(&hasHeader));
+    while (hasHeader)
+    {
+        wil::unique_cotaskmem_string name;
+        wil::unique_cotaskmem_string value;
+        RETURN_IF_FAILED(iterator->GetCurrentHeader(&name, &value));
+        RETURN_IF_FAILED(AppendUtf8(name.get(), wcslen(name.get()), headers));
+        headers.append(": ");
+        RETURN_IF_FAILED(AppendUtf8(value.get(), wcslen(value.get()), headers));
+        headers.append("\r\n");
+        RETURN_IF_FAILED(iterator->MoveNext(&hasHeader));
+    }
+    return S_OK;
+}
 
-static std::string to_utf8(std::wstring& wide_string) { return utf8.to_bytes(wide_string); }
-static std::wstring to_wstring(std::string &string) { return utf8_utf16.from_bytes(string); }
+// The method and the headers, the URI is set already
+static HRESULT GetCacheRequest(ICoreWebView2WebResourceRequest* webRequest, ResponseCache::Request& request)
+{
+    wil::unique_cotaskmem_string method;
+    RETURN_IF_FAILED(webRequest->get_Method(&method));
+    RETURN_IF_FAILED(AppendUtf8(method.get(), wcslen(method.get()), request.method));
+
+    wil::com_ptr<ICoreWebView2HttpRequestHeaders> headers;
+    RETURN_IF_FAILED(webRequest->get_Headers(&headers));
+    wil::com_ptr<ICoreWebView2HttpHeadersCollectionIterator> iterator;
+    RETURN_IF_FAILED(headers->GetIterator(&iterator));
+    return AppendHeaders(iterator.get(), request.headers);
+}
+
+// Larger bodies than maxSize fail, the buffer only grows with what arrives
+static HRESULT ReadResponseBody(IStream* stream, UINT64 maxSize, std::vector<BYTE>& data)
+{
+    BYTE buffer[16 * 1024];
+    for (;;)
+    {
+        ULONG read = 0;
+        HRESULT hr = stream->Read(buffer, sizeof(buffer), &read);
+        RETURN_IF_FAILED(hr);
+        if (data.size() + read > maxSize)
+        {
+            return E_INVALIDARG;
+        }
+        data.insert(data.end(), buffer, buffer + read);
+        if (hr == S_FALSE || read == 0)
+        {
+            break;
+        }
+    }
+    return S_OK;
+}
 
-static BYTE const *MD5(BYTE const *data, DWORD len, BYTE *hash = static_cast<BYTE *>(_alloca(17)))
+// Decodes on the thread pool, the window gets the icon through
+// WM_FAVICON_FETCHED unless it is gone
+static void ProcessFavicon(std::unique_ptr<FetchedFavicon> fetch)
 {
-    DWORD cbHash = 17;
-    HCRYPTPROV hProv = 0;
-    if (CryptAcquireContext(&hProv, nullptr, nullptr, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
+    auto work = [](PTP_CALLBACK_INSTANCE, PVOID context)
+    {
+        std::unique_ptr<FetchedFavicon> fetch(static_cast<FetchedFavicon*>(context));
+        if (SUCCEEDED(fetch->result))
+        {
+            TRACE_SPAN(L"ProcessFavicon", 0);
+            fetch->result = FaviconCache::Process(fetch->folder, fetch->data.data(), fetch->data.size(), fetch->icon);
+        }
+        if (PostMessage(fetch->hWnd, WM_FAVICON_FETCHED, 0, reinterpret_cast<LPARAM>(fetch.get())))
+        {
+            fetch.release();
+        }
+    };
+
+    if (!TrySubmitThreadpoolCallback(work, fetch.get(), nullptr))
     {
-        HCRYPTPROV hHash = 0;
-        if (CryptCreateHash(hProv, CALG_MD5, 0, 0, &hHash))
+        fetch->result = HRESULT_FROM_WIN32(GetLastError());
+        if (PostMessage(fetch->hWnd, WM_FAVICON_FETCHED, 0, reinterpret_cast<LPARAM>(fetch.get())))
         {
-            CryptHashData(hHash, data, len, 0);
-            CryptGetHashParam(hHash, HP_HASHVAL, hash, &cbHash, 0);
-            CryptDestroyHash(hHash);
+            fetch.release();
         }
-        CryptReleaseContext(hProv, 0);
+        return;
     }
-    return cbHash == 16 ? hash : nullptr;
+    fetch.release();
+}
+
+// The window registers with the manager right away, the shared stores are
+// opened by the first window's startup
+BrowserWindow::BrowserWindow(WindowManager& manager) :
+    m_manager(manager),
+    m_windowId(manager.Add(this)),
+    m_history(manager.GetHistory()),
+    m_favorites(manager.GetFavorites()),
+    m_search(manager.GetSearch()),
+    m_session(manager.GetSession())
+{
 }
 
 //
@@ -57,16 +379,10 @@ static BYTE const *MD5(BYTE const *data, DWORD len, BYTE *hash = static_cast<BYT
 //
 //  PURPOSE: Registers the window class.
 //
-ATOM BrowserWindow::RegisterClass(HINSTANCE hInstance, COPYDATASTRUCT const &cds)
+ATOM BrowserWindow::RegisterClass(HINSTANCE hInstance)
 {
     // Initialize window class string
-    if (int const len = LoadStringW(hInstance, IDC_WEBVIEWBROWSERAPP, s_windowClass, MAX_LOADSTRING - 40))
-    {
-        if (BYTE const *const hash = cds.cbData ? MD5(static_cast<BYTE *>(cds.lpData), cds.cbData) : nullptr)
-        {
-            StringFromGUID2(*reinterpret_cast<GUID const *>(hash), s_windowClass + len, 40);
-        }
-    }
+    LoadStringW(hInstance, IDC_WEBVIEWBROWSERAPP, s_windowClass, MAX_LOADSTRING);
 
     WNDCLASSEXW wcex;
 
@@ -147,20 +463,64 @@ LRESULT CALLBACK BrowserWindow::WndProc(HWND hWnd, UINT message, WPARAM wParam,
         }
     }
     break;
+    case WM_ACTIVATE:
+    {
+        if (LOWORD(wParam) != WA_INACTIVE)
+        {
+            m_manager.GetRegistry().Activate(m_windowId);
+        }
+        return DefWindowProc(hWnd, message, wParam, lParam);
+    }
     case WM_CLOSE:
     {
-        nlohmann::json jsonObj;
-        jsonObj["message"] = MG_CLOSE_WINDOW;
-        jsonObj["args"] = nullptr;
-
-        CheckFailure(PostJsonToWebView(jsonObj, m_controlsWebView.Get()), L"Try again.");
+        CloseWindowMessage closeMessage;
+        PostMessageToControls(closeMessage);
+    }
+    break;
+    case WM_DESTROY:
+    {
+        CloseWebViews();
     }
     break;
     case WM_NCDESTROY:
     {
         SetWindowLongPtr(hWnd, GWLP_USERDATA, NULL);
+        bool const lastWindow = m_manager.Remove(m_windowId);
+
+        // The changes collected so far can't wait for the timer anymore
+        if (KillTimer(hWnd, c_sessionTimer))
+        {
+            WriteSession();
+        }
+        if (KillTimer(hWnd, c_cacheTimer))
+        {
+            CheckFailure(m_manager.GetResponseCache().WriteIndex(), L"Can't save the response cache.");
+        }
+        if (!m_loadReport.empty())
+        {
+            WriteLoadReport();
+        }
+
+        // Another window drains the errors from now on
+        if (s_errorWindow == hWnd)
+        {
+            BrowserWindow* next = m_manager.GetActiveWindow();
+            if (next)
+            {
+                s_errorWindow = next->m_hWnd;
+                PostMessage(s_errorWindow, WM_REPORT_ERRORS, 0, 0);
+            }
+            else
+            {
+                s_errorReporter.Flush();
+                s_errorWindow = nullptr;
+            }
+        }
         delete this;
-        PostQuitMessage(0);
+        if (lastWindow)
+        {
+            PostQuitMessage(0);
+        }
     }
     case WM_PAINT:
     {
@@ -169,16 +529,128 @@ LRESULT CALLBACK BrowserWindow::WndProc(HWND hWnd, UINT message, WPARAM wParam,
         EndPaint(hWnd, &ps);
     }
     break;
-    case WM_COPYDATA:
+    case WM_FLUSH_MESSAGES:
+    {
+        // Until the controls page asks for its tabs, messages would go to the
+        // document it replaces, so they stay queued
+        CheckFailure(m_controlsQueue.Flush(m_controlsReady ? m_controlsWebView.Get() : nullptr), L"Can't update the browser controls.");
+    }
+    break;
+    case WM_TIMER:
+    {
+        if (wParam == c_evictionTimer)
+        {
+            for (const auto& tab : m_tabs)
+            {
+                if (tab.first != m_activeTabId && m_tabLoader.GetState(tab.first) == TabState::Ready)
+                {
+                    MeasureTab(tab.first);
+                }
+            }
+            EvictTabs();
+            ExpireFaviconFetches();
+
+            if (!m_loadScheduler.IsIdle())
+            {
+                CheckFailure(m_loadScheduler.Expire(), L"Can't load the tab.");
+                UpdateLoadProgress();
+            }
+
+            // Summarizes the repeats of errors which stopped occurring
+            if (s_errorWindow == hWnd)
+            {
+                ReportErrors();
+            }
+        }
+        else if (wParam == c_poolTimer)
+        {
+            // Wait until no tab is loading
+            KillTimer(hWnd, c_poolTimer);
+            if (m_tabLoader.GetInFlightCount() != 0 || m_tabLoader.GetQueuedCount() != 0)
+            {
+                SetTimer(hWnd, c_poolTimer, m_poolRefillDelay, nullptr);
+            }
+            else
+            {
+                CheckFailure(m_controllerPool.Refill(), L"Can't prepare a tab.");
+            }
+        }
+        else if (wParam == c_sessionTimer)
+        {
+            KillTimer(hWnd, c_sessionTimer);
+            WriteSession();
+        }
+        else if (wParam == c_cacheTimer)
+        {
+            KillTimer(hWnd, c_cacheTimer);
+            CheckFailure(m_manager.GetResponseCache().WriteIndex(), L"Can't save the response cache.");
+        }
+    }
+    break;
+    case WM_EVICT_TABS:
     {
-        COPYDATASTRUCT *const pcds = reinterpret_cast<COPYDATASTRUCT *>(lParam);
-        if (pcds->dwData == 1)
+        EvictTabs();
+    }
+    break;
+    case WM_REPORT_ERRORS:
+    {
+        ReportErrors();
+    }
+    break;
+    case WM_FAVICON_FETCHED:
+    {
+        std::unique_ptr<FetchedFavicon> fetch(reinterpret_cast<FetchedFavicon*>(lParam));
+        HandleFaviconFetched(fetch->source, fetch->result, fetch->icon);
+    }
+    break;
+    case WM_FILTER_COMPILED:
+    {
+        std::unique_ptr<CompiledFilter> compile(reinterpret_cast<CompiledFilter*>(lParam));
+        HRESULT hr = compile->result;
+        if (SUCCEEDED(hr))
         {
-            if (m_tabs.count(m_activeTabId) == 0)
-                return IDRETRY;
-            m_tabs.at(m_activeTabId)->m_contentWebView->Navigate(static_cast<LPWSTR>(pcds->lpData));
-            return IDOK;
+            hr = m_manager.LoadRequestFilter(compile->snapshotPath, compile->sourceTime, compile->sourceSize);
         }
+        CheckFailure(hr, L"Can't load the request filter.");
+    }
+    break;
+    case WM_CACHE_REVALIDATED:
+    {
+        std::unique_ptr<CacheRevalidation> revalidation(reinterpret_cast<CacheRevalidation*>(lParam));
+        HandleCacheRevalidated(revalidation->revalidationId, revalidation->result, revalidation->status, revalidation->responseHeaders);
+    }
+    break;
+    case WM_EXPORT_TRACE:
+    {
+        CheckFailure(Trace::Export(), L"Can't export the trace.");
+    }
+    break;
+    case WM_DUMP_MESSAGE_STATISTICS:
+    {
+        m_uiDispatcher.DumpStatistics(L"UI");
+        m_tabDispatcher.DumpStatistics(L"Tab");
+        m_controllerPool.DumpStatistics();
+
+        ErrorReporter::Statistics errors = s_errorReporter.GetStatistics();
+        WCHAR line[256];
+        StringCchPrintfW(line, _countof(line), L"Errors: posted %llu, dropped %llu, reported %llu, suppressed %llu\n",
+            errors.posted, errors.dropped, errors.reported, errors.suppressed);
+        OutputDebugString(line);
+
+        FaviconCache::Statistics favicons = m_favicons.GetStatistics();
+        StringCchPrintfW(line, _countof(line), L"Favicons: memory hits %llu, folder hits %llu, misses %llu, fetched %llu, failed %llu, %zu bytes in memory\n",
+            favicons.memoryHits, favicons.folderHits, favicons.misses, favicons.fetched, favicons.failed, favicons.memoryUsed);
+        OutputDebugString(line);
+
+        SessionJournal::Statistics session = m_session.GetStatistics();
+        StringCchPrintfW(line, _countof(line), L"Session: records %llu, writes %llu, bytes written %llu, compactions %llu, dropped bytes %llu\n",
+            session.records, session.writes, session.bytesWritten, session.compactions, session.droppedBytes);
+        OutputDebugString(line);
+
+        ResponseCache::Statistics cache = m_manager.GetResponseCache().GetStatistics();
+        StringCchPrintfW(line, _countof(line), L"Response cache: hits %llu, revalidated %llu, stale hits %llu, misses %llu, stored %llu, evicted %llu, bytes saved %llu, %zu entries, %llu bytes\n",
+            cache.hits, cache.revalidated, cache.staleHits, cache.misses, cache.stored, cache.evicted, cache.bytesSaved, cache.entries, cache.size);
+        OutputDebugString(line);
     }
     break;
     default:
@@ -191,17 +663,18 @@ LRESULT CALLBACK BrowserWindow::WndProc(HWND hWnd, UINT message, WPARAM wParam,
 }
 
 
-BOOL BrowserWindow::LaunchWindow(_In_ HINSTANCE hInstance, LPCWSTR lpCmdLine, _In_ int nCmdShow)
+BrowserWindow* BrowserWindow::LaunchWindow(WindowManager& manager, _In_ HINSTANCE hInstance, _In_ int nCmdShow)
 {
     // BrowserWindow keeps a reference to itself in its host window and will
     // delete itself when the window is destroyed.
-    BrowserWindow* window = new BrowserWindow();
-    if (!window->InitInstance(hInstance, lpCmdLine, nCmdShow))
+    BrowserWindow* window = new BrowserWindow(manager);
+    if (!window->InitInstance(hInstance, nCmdShow))
     {
+        manager.Remove(window->m_windowId);
         delete window;
-        return FALSE;
+        return nullptr;
     }
-    return TRUE;
+    return window;
 }
 
 //
@@ -214,12 +687,19 @@ BOOL BrowserWindow::LaunchWindow(_In_ HINSTANCE hInstance, LPCWSTR lpCmdLine, _I
 //        In this function, we save the instance handle in a global variable and
 //        create and display the main program window.
 //
-BOOL BrowserWindow::InitInstance(HINSTANCE hInstance, LPCWSTR lpCmdLine, int nCmdShow)
+BOOL BrowserWindow::InitInstance(HINSTANCE hInstance, int nCmdShow)
 {
+    TRACE_SPAN(L"InitInstance", 0);
+
     m_hInst = hInstance; // Store app instance handle
-    m_lpCmdLine = lpCmdLine;
     LoadStringW(m_hInst, IDS_APP_TITLE, s_title, MAX_LOADSTRING);
 
+    CheckFailure(m_internalPages.Initialize(
+        [this](LPCWSTR relativePath) { return GetFullPathFor(relativePath); },
+        [this](const std::wstring& fullPath) { return GetFilePathAsURI(fullPath); }),
+        L"Can't resolve browser pages.");
+
+    RegisterMessageHandlers();
     SetUIMessageBroker();
 
     m_hWnd = CreateWindowW(s_windowClass, s_title, WS_OVERLAPPEDWINDOW,
@@ -233,7 +713,22 @@ BOOL BrowserWindow::InitInstance(HINSTANCE hInstance, LPCWSTR lpCmdLine, int nCm
     // Make the BrowserWindow instance ptr available through the hWnd
     SetWindowLongPtr(m_hWnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
 
+    // Errors reported before the window existed are waiting to be drained
+    if (!s_errorWindow)
+    {
+        s_errorWindow = m_hWnd;
+        std::wstring errorLogPath = GetAppDataDirectory();
+        SHCreateDirectoryExW(nullptr, errorLogPath.c_str(), nullptr);
+        errorLogPath.append(L"\\Errors.log");
+        if (FAILED(s_errorReporter.OpenLog(errorLogPath.c_str())))
+        {
+            OutputDebugString(L"Can't open the error log\n");
+        }
+        PostMessage(m_hWnd, WM_REPORT_ERRORS, 0, 0);
+    }
+
     UpdateMinWindowSize();
+    SetTimer(m_hWnd, c_evictionTimer, c_evictionInterval, nullptr);
     ShowWindow(m_hWnd, nCmdShow);
     UpdateWindow(m_hWnd);
 
@@ -257,67 +752,224 @@ BOOL BrowserWindow::InitInstance(HINSTANCE hInstance, LPCWSTR lpCmdLine, int nCm
         browserExecutableFolder, _countof(browserExecutableFolder), executingFile);
     GetPrivateProfileStringW(executingFileName, L"AdditionalBrowserArguments", nullptr,
         additionalBrowserArguments, _countof(additionalBrowserArguments), executingFile);
+    m_poolSize = GetPrivateProfileIntW(executingFileName, L"ControllerPoolSize", 1, executingFile);
+    m_poolRefillDelay = GetPrivateProfileIntW(executingFileName, L"ControllerPoolRefillDelay", 1000, executingFile);
+    m_showErrors = GetPrivateProfileIntW(executingFileName, L"ShowErrors", 1, executingFile) != 0;
+    WCHAR filterList[MAX_PATH] = { 0 };
+    GetPrivateProfileStringW(executingFileName, L"FilterList", nullptr, filterList, _countof(filterList), executingFile);
+    WCHAR cachedOrigins[4096] = { 0 };
+    GetPrivateProfileStringW(executingFileName, L"CachedOrigins", nullptr, cachedOrigins, _countof(cachedOrigins), executingFile);
+    UINT const cacheSize = GetPrivateProfileIntW(executingFileName, L"CacheSize", static_cast<INT>(ResponseCache::c_defaultMaxSize >> 20), executingFile);
 
     if (*browserExecutableFolder && PathIsRelativeW(browserExecutableFolder))
     {
         *executingFileName = L'\0';
         PathCombineW(browserExecutableFolder, executingFileFull, browserExecutableFolder);
     }
+    if (*filterList && PathIsRelativeW(filterList))
+    {
+        *executingFileName = L'\0';
+        PathCombineW(filterList, executingFileFull, filterList);
+    }
+
+    // Startup runs as a graph of stages. Both environments are created at
+    // once, the history is loaded while they start, and the controls are
+    // created as soon as the UI environment exists. Tabs wait for the content
+    // environment and the controls, the options dropdown until it is shown.
+    // Windows opened later get the environments and the stores which exist
+    // already.
+    std::wstring executableFolder = browserExecutableFolder;
+    std::wstring arguments = additionalBrowserArguments;
+    m_contentEnvStage = m_startup.AddAsync(L"Content environment", {},
+        [this, executableFolder, userDataDirectory, arguments]() -> HRESULT
+    {
+        return CreateContentEnvironment(executableFolder.c_str(), userDataDirectory.c_str(), arguments.c_str());
+    });
+    m_uiEnvStage = m_startup.AddAsync(L"UI environment", {}, [this, executableFolder]() -> HRESULT
+    {
+        return CreateUIEnvironment(executableFolder.c_str());
+    });
+    if (m_manager.TakeStoresOpening())
+    {
+        m_startup.Add(L"History", {}, [this]() -> HRESULT
+        {
+            std::wstring historyPath = GetAppDataDirectory();
+            SHCreateDirectoryExW(nullptr, historyPath.c_str(), nullptr);
+            historyPath.append(L"\\History");
+            CheckFailure(m_history.Open(historyPath.c_str()), L"Can't open the browsing history.");
+            m_search.AddHistory(m_history);
+            return S_OK;
+        });
+        m_startup.Add(L"Session", {}, [this]() -> HRESULT
+        {
+            std::wstring sessionPath = GetAppDataDirectory();
+            SHCreateDirectoryExW(nullptr, sessionPath.c_str(), nullptr);
+            sessionPath.append(L"\\Session");
+            CheckFailure(m_session.Open(sessionPath.c_str()), L"Can't restore the session.");
+
+            // New windows hand out ids above those of the restored tabs
+            for (const SessionTab& tab : m_session.GetTabs())
+            {
+                m_manager.GetRegistry().ReserveTabIds(tab.tabId);
+            }
+            return S_OK;
+        });
+        m_startup.Add(L"Favorites", {}, [this]() -> HRESULT
+        {
+            std::wstring favoritesPath = GetAppDataDirectory();
+            SHCreateDirectoryExW(nullptr, favoritesPath.c_str(), nullptr);
+            favoritesPath.append(L"\\Favorites.json");
+            CheckFailure(m_favorites.Open(favoritesPath.c_str()), L"Can't open the favorites.");
+            return S_OK;
+        });
+        std::wstring filterListPath = filterList;
+        m_startup.Add(L"Request filter", {}, [this, filterListPath]() -> HRESULT
+        {
+            if (!filterListPath.empty())
+            {
+                CheckFailure(LoadRequestFilter(filterListPath), L"Can't load the request filter.");
+            }
+            return S_OK;
+        });
+        // Origins are separated by spaces, commas or semicolons, the size is
+        // in megabytes
+        std::vector<std::wstring> origins;
+        for (LPCWSTR begin = cachedOrigins; *begin;)
+        {
+            size_t const length = wcscspn(begin, L" ,;");
+            if (length != 0)
+            {
+                origins.emplace_back(begin, length);
+            }
+            begin += length;
+            begin += wcsspn(begin, L" ,;");
+        }
+        m_startup.Add(L"Response cache", {}, [this, origins, cacheSize]() -> HRESULT
+        {
+            if (!origins.empty() && cacheSize != 0)
+            {
+                std::wstring cachePath = GetAppDataDirectory();
+                cachePath.append(L"\\Cache");
+                SHCreateDirectoryExW(nullptr, cachePath.c_str(), nullptr);
+                CheckFailure(m_manager.OpenResponseCache(cachePath, static_cast<UINT64>(cacheSize) << 20, origins),
+                    L"Can't open the response cache.");
+            }
+            return S_OK;
+        });
+    }
+    m_startup.Add(L"Favicons", {}, [this]() -> HRESULT
+    {
+        std::wstring faviconPath = GetAppDataDirectory();
+        faviconPath.append(L"\\Favicons");
+        int result = SHCreateDirectoryExW(nullptr, faviconPath.c_str(), nullptr);
+        if (result == ERROR_SUCCESS || result == ERROR_ALREADY_EXISTS)
+        {
+            m_favicons.SetFolder(faviconPath);
+        }
+        return S_OK;
+    });
+    m_controlsStage = m_startup.AddAsync(L"Controls WebView", { m_uiEnvStage }, [this]() -> HRESULT
+    {
+        return CreateBrowserControlsWebView();
+    });
+    m_optionsStage = m_startup.AddAsync(L"Options WebView", { m_uiEnvStage }, [this]() -> HRESULT
+    {
+        return CreateBrowserOptionsWebView();
+    }, true);
+    m_startup.Add(L"Controller pool", { m_contentEnvStage }, [this]() -> HRESULT
+    {
+        m_controllerFactory.Initialize(m_hWnd, m_contentEnv.Get());
+        m_controllerPool.SetSize(m_poolSize);
+        return S_OK;
+    });
+    m_startup.Add(L"Tabs", { m_contentEnvStage, m_controlsStage }, [this]() -> HRESULT
+    {
+        CheckFailure(m_tabLoader.SetPaused(false), L"Can't create the tab.");
+        return S_OK;
+    });
 
-    auto environmentOptions = Microsoft::WRL::Make<CoreWebView2EnvironmentOptions>();
-    environmentOptions->put_AdditionalBrowserArguments(additionalBrowserArguments);
+    // The controls request tabs as soon as they are loaded
+    m_tabLoader.SetPaused(true);
+    m_startup.Run();
 
-    // Create WebView environment for web content requested by the user. All
-    // tabs will be created from this environment and kept isolated from the
-    // browser UI. This enviroment is created first so the UI can request new
-    // tabs when it's ready.
-    HRESULT hr = CreateCoreWebView2EnvironmentWithOptions(browserExecutableFolder,
-        userDataDirectory.c_str(), environmentOptions.Get(),
-        Callback<ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler>(
-            [this, browserExecutableFolder](HRESULT result, ICoreWebView2Environment* env) -> HRESULT
+    // Nothing is in flight when both environments failed right away
+    if (m_startup.GetRecord(m_contentEnvStage).state == StageState::Failed &&
+        m_startup.GetRecord(m_uiEnvStage).state == StageState::Failed)
     {
-        RETURN_IF_FAILED(result);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Create WebView environment for web content requested by the user. All tabs
+// will be created from this environment and kept isolated from the browser UI.
+// The environment is shared by all windows, the window may be closed before
+// it is created.
+HRESULT BrowserWindow::CreateContentEnvironment(LPCWSTR browserExecutableFolder, LPCWSTR userDataDirectory, LPCWSTR additionalBrowserArguments)
+{
+    TRACE_SPAN(L"CreateContentEnvironment", 0);
 
-        m_contentEnv = env;
-        HRESULT hr = InitUIWebViews(browserExecutableFolder);
+    HWND hWnd = m_hWnd;
+    HRESULT hr = m_manager.GetContentEnvironment(
+        [browserExecutableFolder, userDataDirectory, additionalBrowserArguments](ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler* handler) -> HRESULT
+    {
+        auto environmentOptions = Microsoft::WRL::Make<CoreWebView2EnvironmentOptions>();
+        environmentOptions->put_AdditionalBrowserArguments(additionalBrowserArguments);
 
-        if (!SUCCEEDED(hr))
+        return CreateCoreWebView2EnvironmentWithOptions(browserExecutableFolder,
+            userDataDirectory, environmentOptions.Get(), handler);
+    },
+        [hWnd](HRESULT result, ICoreWebView2Environment* env)
+    {
+        BrowserWindow* browserWindow = reinterpret_cast<BrowserWindow*>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
+        if (browserWindow)
         {
-            OutputDebugString(L"UI WebViews environment creation failed\n");
+            browserWindow->m_contentEnv = env;
+            browserWindow->m_startup.Complete(browserWindow->m_contentEnvStage, result);
         }
-
-        return hr;
-    }).Get());
+    });
 
     if (!SUCCEEDED(hr))
     {
         OutputDebugString(L"Content WebViews environment creation failed\n");
-        return FALSE;
     }
 
-    return TRUE;
+    return hr;
 }
 
-HRESULT BrowserWindow::InitUIWebViews(LPCWSTR browserExecutableFolder)
+HRESULT BrowserWindow::CreateUIEnvironment(LPCWSTR browserExecutableFolder)
 {
+    TRACE_SPAN(L"CreateUIEnvironment", 0);
+
     // Get data directory for browser UI data
     std::wstring browserDataDirectory = GetAppDataDirectory();
     browserDataDirectory.append(L"\\Browser Data");
 
     // Create WebView environment for browser UI. A separate data directory is
     // used to isolate the browser UI from web content requested by the user.
-    return CreateCoreWebView2EnvironmentWithOptions(browserExecutableFolder, browserDataDirectory.c_str(),
-        nullptr, Callback<ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler>(
-            [this](HRESULT result, ICoreWebView2Environment* env) -> HRESULT
+    HWND hWnd = m_hWnd;
+    HRESULT hr = m_manager.GetUIEnvironment(
+        [browserExecutableFolder, &browserDataDirectory](ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler* handler) -> HRESULT
     {
-        // Environment is ready, create the WebView
-        m_uiEnv = env;
+        return CreateCoreWebView2EnvironmentWithOptions(browserExecutableFolder, browserDataDirectory.c_str(), nullptr, handler);
+    },
+        [hWnd](HRESULT result, ICoreWebView2Environment* env)
+    {
+        BrowserWindow* browserWindow = reinterpret_cast<BrowserWindow*>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
+        if (browserWindow)
+        {
+            browserWindow->m_uiEnv = env;
+            browserWindow->m_startup.Complete(browserWindow->m_uiEnvStage, result);
+        }
+    });
 
-        RETURN_IF_FAILED(CreateBrowserControlsWebView());
-        RETURN_IF_FAILED(CreateBrowserOptionsWebView());
+    if (!SUCCEEDED(hr))
+    {
+        OutputDebugString(L"UI WebViews environment creation failed\n");
+    }
 
-        return S_OK;
-    }).Get());
+    return hr;
 }
 
 HRESULT BrowserWindow::CreateBrowserControlsWebView()
@@ -325,35 +977,57 @@ HRESULT BrowserWindow::CreateBrowserControlsWebView()
     return m_uiEnv->CreateCoreWebView2Controller(m_hWnd, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
         [this](HRESULT result, ICoreWebView2Controller* host) -> HRESULT
     {
-        if (!SUCCEEDED(result))
+        HRESULT hr = result;
+        if (SUCCEEDED(hr))
+        {
+            hr = InitBrowserControlsWebView(host);
+        }
+        else
         {
             OutputDebugString(L"Controls WebView creation failed\n");
-            return result;
         }
-        // WebView created
-        m_controlsController = host;
-        CheckFailure(m_controlsController->get_CoreWebView2(&m_controlsWebView), L"");
 
-        wil::com_ptr<ICoreWebView2Settings> settings;
-        RETURN_IF_FAILED(m_controlsWebView->get_Settings(&settings));
-        RETURN_IF_FAILED(settings->put_AreDevToolsEnabled(FALSE));
+        m_startup.Complete(m_controlsStage, hr);
+        return hr;
+    }).Get());
+}
 
-        RETURN_IF_FAILED(m_controlsController->add_ZoomFactorChanged(Callback<ICoreWebView2ZoomFactorChangedEventHandler>(
-            [](ICoreWebView2Controller* host, IUnknown* args) -> HRESULT
-        {
-            host->put_ZoomFactor(1.0);
-            return S_OK;
-        }
-        ).Get(), &m_controlsZoomToken));
+HRESULT BrowserWindow::InitBrowserControlsWebView(ICoreWebView2Controller* host)
+{
+    // WebView created
+    m_controlsController = host;
+    CheckFailure(m_controlsController->get_CoreWebView2(&m_controlsWebView), L"");
+
+    wil::com_ptr<ICoreWebView2Settings> settings;
+    RETURN_IF_FAILED(m_controlsWebView->get_Settings(&settings));
+    RETURN_IF_FAILED(settings->put_AreDevToolsEnabled(FALSE));
 
-        RETURN_IF_FAILED(m_controlsWebView->add_WebMessageReceived(m_uiMessageBroker.Get(), &m_controlsUIMessageBrokerToken));
-        RETURN_IF_FAILED(ResizeUIWebViews());
+    RETURN_IF_FAILED(m_controlsController->add_ZoomFactorChanged(Callback<ICoreWebView2ZoomFactorChangedEventHandler>(
+        [](ICoreWebView2Controller* host, IUnknown* args) -> HRESULT
+    {
+        host->put_ZoomFactor(1.0);
+        return S_OK;
+    }
+    ).Get(), &m_controlsZoomToken));
 
-        std::wstring controlsPath = GetFullPathFor(L"wvbrowser_ui\\controls_ui\\default.html");
-        RETURN_IF_FAILED(m_controlsWebView->Navigate(controlsPath.c_str()));
+    RETURN_IF_FAILED(m_controlsWebView->add_WebMessageReceived(m_uiMessageBroker.Get(), &m_controlsUIMessageBrokerToken));
 
+    // Tabs, history and favorites show the favicons from the cache
+    std::wstring faviconFilter = std::wstring(FaviconCache::c_uriPrefix) + L"*";
+    RETURN_IF_FAILED(m_controlsWebView->AddWebResourceRequestedFilter(faviconFilter.c_str(), COREWEBVIEW2_WEB_RESOURCE_CONTEXT_IMAGE));
+    RETURN_IF_FAILED(m_controlsWebView->add_WebResourceRequested(Callback<ICoreWebView2WebResourceRequestedEventHandler>(
+        [this](ICoreWebView2* webview, ICoreWebView2WebResourceRequestedEventArgs* args) -> HRESULT
+    {
+        CheckFailure(ServeFavicon(m_uiEnv.Get(), args), L"Can't show a favicon.");
         return S_OK;
-    }).Get());
+    }).Get(), &m_controlsFaviconToken));
+
+    RETURN_IF_FAILED(ResizeUIWebViews());
+
+    std::wstring controlsPath = GetFullPathFor(L"wvbrowser_ui\\controls_ui\\default.html");
+    RETURN_IF_FAILED(m_controlsWebView->Navigate(controlsPath.c_str()));
+
+    return S_OK;
 }
 
 HRESULT BrowserWindow::CreateBrowserOptionsWebView()
@@ -361,51 +1035,59 @@ HRESULT BrowserWindow::CreateBrowserOptionsWebView()
     return m_uiEnv->CreateCoreWebView2Controller(m_hWnd, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
         [this](HRESULT result, ICoreWebView2Controller* host) -> HRESULT
     {
-        if (!SUCCEEDED(result))
+        HRESULT hr = result;
+        if (SUCCEEDED(hr))
         {
-            OutputDebugString(L"Options WebView creation failed\n");
-            return result;
+            hr = InitBrowserOptionsWebView(host);
         }
-        // WebView created
-        m_optionsController = host;
-        CheckFailure(m_optionsController->get_CoreWebView2(&m_optionsWebView), L"");
-
-        wil::com_ptr<ICoreWebView2Settings> settings;
-        RETURN_IF_FAILED(m_optionsWebView->get_Settings(&settings));
-        RETURN_IF_FAILED(settings->put_AreDevToolsEnabled(FALSE));
-
-        RETURN_IF_FAILED(m_optionsController->add_ZoomFactorChanged(Callback<ICoreWebView2ZoomFactorChangedEventHandler>(
-            [](ICoreWebView2Controller* host, IUnknown* args) -> HRESULT
+        else
         {
-            host->put_ZoomFactor(1.0);
-            return S_OK;
+            OutputDebugString(L"Options WebView creation failed\n");
         }
-        ).Get(), &m_optionsZoomToken));
 
-        // Hide by default
-        RETURN_IF_FAILED(m_optionsController->put_IsVisible(FALSE));
-        RETURN_IF_FAILED(m_optionsWebView->add_WebMessageReceived(m_uiMessageBroker.Get(), &m_optionsUIMessageBrokerToken));
+        m_startup.Complete(m_optionsStage, hr);
+        return hr;
+    }).Get());
+}
 
-        // Hide menu when focus is lost
-        RETURN_IF_FAILED(m_optionsController->add_LostFocus(Callback<ICoreWebView2FocusChangedEventHandler>(
-            [this](ICoreWebView2Controller* sender, IUnknown* args) -> HRESULT
-        {
-            nlohmann::json jsonObj;
-            jsonObj["message"] = MG_OPTIONS_LOST_FOCUS;
-            jsonObj["args"] = nullptr;
+HRESULT BrowserWindow::InitBrowserOptionsWebView(ICoreWebView2Controller* host)
+{
+    // WebView created
+    m_optionsController = host;
+    CheckFailure(m_optionsController->get_CoreWebView2(&m_optionsWebView), L"");
 
-            PostJsonToWebView(jsonObj, m_controlsWebView.Get());
+    wil::com_ptr<ICoreWebView2Settings> settings;
+    RETURN_IF_FAILED(m_optionsWebView->get_Settings(&settings));
+    RETURN_IF_FAILED(settings->put_AreDevToolsEnabled(FALSE));
 
-            return S_OK;
-        }).Get(), &m_lostOptionsFocus));
+    RETURN_IF_FAILED(m_optionsController->add_ZoomFactorChanged(Callback<ICoreWebView2ZoomFactorChangedEventHandler>(
+        [](ICoreWebView2Controller* host, IUnknown* args) -> HRESULT
+    {
+        host->put_ZoomFactor(1.0);
+        return S_OK;
+    }
+    ).Get(), &m_optionsZoomToken));
 
-        RETURN_IF_FAILED(ResizeUIWebViews());
+    // Hide by default
+    RETURN_IF_FAILED(m_optionsController->put_IsVisible(FALSE));
+    RETURN_IF_FAILED(m_optionsWebView->add_WebMessageReceived(m_uiMessageBroker.Get(), &m_optionsUIMessageBrokerToken));
 
-        std::wstring optionsPath = GetFullPathFor(L"wvbrowser_ui\\controls_ui\\options.html");
-        RETURN_IF_FAILED(m_optionsWebView->Navigate(optionsPath.c_str()));
+    // Hide menu when focus is lost
+    RETURN_IF_FAILED(m_optionsController->add_LostFocus(Callback<ICoreWebView2FocusChangedEventHandler>(
+        [this](ICoreWebView2Controller* sender, IUnknown* args) -> HRESULT
+    {
+        OptionsLostFocusMessage message;
+        PostMessageToControls(message);
 
         return S_OK;
-    }).Get());
+    }).Get(), &m_lostOptionsFocus));
+
+    RETURN_IF_FAILED(ResizeUIWebViews());
+
+    std::wstring optionsPath = GetFullPathFor(L"wvbrowser_ui\\controls_ui\\options.html");
+    RETURN_IF_FAILED(m_optionsWebView->Navigate(optionsPath.c_str()));
+
+    return S_OK;
 }
 
 // Set the message broker for the UI webview. This will capture messages from ui web content.
@@ -415,163 +1097,536 @@ void BrowserWindow::SetUIMessageBroker()
     m_uiMessageBroker = Callback<ICoreWebView2WebMessageReceivedEventHandler>(
         [this](ICoreWebView2* webview, ICoreWebView2WebMessageReceivedEventArgs* eventArgs) -> HRESULT
     {
-        LPWSTR jsonString;
+        wil::unique_cotaskmem_string jsonString;
         CheckFailure(eventArgs->get_WebMessageAsJson(&jsonString), L"");  // Get the message from the UI WebView as JSON formatted string
-        std::wstring stirngEvent(jsonString);
 
-        nlohmann::json jsonObj = nlohmann::json::parse(stirngEvent);
-
-        if (!jsonObj.contains("message"))
+        MessageReader reader;
+        if (FAILED(reader.Parse(jsonString.get())))
         {
-            OutputDebugString(L"No message code provided\n");
             return S_OK;
         }
 
-        if (!jsonObj.contains("args"))
+        MessageContext context = { reader, jsonString.get(), INVALID_TAB_ID };
+        return m_uiDispatcher.Dispatch(context, InternalPage::None);
+    });
+}
+
+// Messages from the controls and options UI are handled by m_uiDispatcher,
+// messages from the pages shown in tabs by m_tabDispatcher. The latter only
+// accepts requests from the internal page they are meant for.
+void BrowserWindow::RegisterMessageHandlers()
+{
+    m_uiDispatcher.Register<CreateTabMessage>(InternalPage::None,
+        [this](const CreateTabMessage& args, const MessageContext&) -> HRESULT
+    {
+        size_t id = args.tabId;
+
+        const std::wstring& uri = args.uri;
+        std::unique_ptr<Tab> newTab = Tab::CreateNewTab(m_hWnd, id, uri);
+        m_session.Create(id, uri);
+        m_manager.GetRegistry().AddTab(m_windowId, id);
+
+        std::map<size_t, std::unique_ptr<Tab>>::iterator it = m_tabs.find(id);
+        if (it == m_tabs.end())
         {
-            OutputDebugString(L"The message has no args field\n");
-            return S_OK;
+            m_tabs.insert(std::pair<size_t,std::unique_ptr<Tab>>(id, std::move(newTab)));
         }
+        else
+        {
+            m_tabLoader.Remove(id);
+            m_loadScheduler.Remove(id);
+            m_evictionPolicy.Remove(id);
+            it->second->Close();
+            it->second = std::move(newTab);
+        }
+        m_tabLoader.Add(id);
 
-        int message = jsonObj["message"];
+        // The tabs of a list of URIs load in the background, a few at a time
+        if (args.batchIndex >= 0)
+        {
+            CheckFailure(m_loadScheduler.Add(id, uri, static_cast<size_t>(args.batchIndex)), L"Can't load the tab.");
+            UpdateLoadProgress();
+        }
 
-        switch (message)
+        // Background tabs get their controller when they are first shown
+        if (args.active)
+        {
+            m_session.Switch(id);
+            CheckFailure(SwitchToTab(id), L"Can't create the tab.");
+        }
+        return S_OK;
+    });
+    // The tabs of the previous session are created like background tabs,
+    // only the active one is loaded. Windows opened later start with the tabs
+    // moved to them, or a new one. URIs which wait for the controls, like
+    // those from the command line, open in new tabs of their own.
+    m_uiDispatcher.Register(MG_RESTORE_SESSION, InternalPage::None, [this](const MessageContext&) -> HRESULT
+    {
+        SessionMessage message;
+        message.tabIdBase = m_manager.GetRegistry().GetTabIdBase(m_windowId);
+        if (m_manager.TakeSessionRestore())
+        {
+            message.tabs = m_session.GetTabs();
+            message.activeTabId = m_session.GetActiveTabId();
+        }
+        else
         {
-        case MG_CREATE_TAB:
+            message.tabs = m_adoptedTabs;
+            message.activeTabId = m_adoptedTabs.empty() ? INVALID_TAB_ID : m_adoptedTabs.back().tabId;
+        }
+        bool const opensTabs = m_manager.HasWaitingUris();
+        message.openTab = message.tabs.empty() && !opensTabs;
+        if (opensTabs)
         {
-            size_t id = jsonObj["args"]["tabId"];
-            bool shouldBeActive = jsonObj["args"]["active"];
+            message.activeTabId = INVALID_TAB_ID;
+        }
 
-            std::unique_ptr<Tab> newTab = Tab::CreateNewTab(m_hWnd, m_contentEnv.Get(), id, shouldBeActive);
+        for (const SessionTab& tab : message.tabs)
+        {
+            if (m_tabs.find(tab.tabId) == m_tabs.end())
+            {
+                m_tabs.insert(std::pair<size_t, std::unique_ptr<Tab>>(tab.tabId, Tab::CreateNewTab(m_hWnd, tab.tabId, tab.uri)));
+                m_tabLoader.Add(tab.tabId);
+                m_manager.GetRegistry().AddTab(m_windowId, tab.tabId);
+            }
+        }
+        if (message.activeTabId != INVALID_TAB_ID)
+        {
+            m_session.Switch(message.activeTabId);
+            CheckFailure(SwitchToTab(message.activeTabId), L"Can't restore the session.");
+        }
+        PostMessageToControls(message);
 
-            std::map<size_t, std::unique_ptr<Tab>>::iterator it = m_tabs.find(id);
-            if (it == m_tabs.end())
+        // Moved tabs keep their page, the controls only need to hear about it
+        for (const SessionTab& tab : m_adoptedTabs)
+        {
+            PageMetadataMessage metadata;
+            if (m_pageMetadata.GetLast(tab.tabId, metadata))
             {
-                m_tabs.insert(std::pair<size_t,std::unique_ptr<Tab>>(id, std::move(newTab)));
+                PostPageMetadata(metadata);
             }
-            else
+            if (m_tabLoader.GetState(tab.tabId) == TabState::Ready)
             {
-                m_tabs.at(id)->m_contentController->Close();
-                it->second = std::move(newTab);
+                CheckFailure(HandleTabURIUpdate(tab.tabId, m_tabs.at(tab.tabId)->m_contentWebView.Get()), L"Can't move the tab.");
             }
         }
-        break;
-        case MG_NAVIGATE:
+        m_adoptedTabs.clear();
+
+        // Requests of other instances may have waited for the controls, as
+        // did the messages queued since the window opened
+        m_controlsReady = true;
+        m_manager.DispatchActivations();
+        CheckFailure(m_controlsQueue.Flush(m_controlsWebView.Get()), L"Can't update the browser controls.");
+        return S_OK;
+    });
+    m_uiDispatcher.Register<NavigateMessage>(InternalPage::None,
+        [this](const NavigateMessage& args, const MessageContext&) -> HRESULT
+    {
+        const std::wstring &uri = args.uri;
+        auto tab = m_tabs.find(m_activeTabId);
+        if (tab == m_tabs.end())
         {
-            std::string string = jsonObj["args"]["uri"].get<std::string>().c_str();
-            std::wstring uri = to_wstring(string);
-            std::wstring browserScheme(L"browser://");
+            return S_OK;
+        }
+        ICoreWebView2* webview = tab->second->m_contentWebView.Get();
 
-            if (uri.substr(0, browserScheme.size()).compare(browserScheme) == 0)
+        if (uri.compare(0, wcslen(L"browser://"), L"browser://") == 0)
+        {
+            // No encoded search URI
+            InternalPage page = m_internalPages.FromAlias(uri);
+            if (page == InternalPage::None)
             {
-                // No encoded search URI
-                std::wstring path = uri.substr(browserScheme.size());
-                if (path.compare(L"favorites") == 0 ||
-                    path.compare(L"settings") == 0 ||
-                    path.compare(L"history") == 0)
-                {
-                    std::wstring filePath(L"wvbrowser_ui\\content_ui\\");
-                    filePath.append(path);
-                    filePath.append(L".html");
-                    std::wstring fullPath = GetFullPathFor(filePath.c_str());
-                    CheckFailure(m_tabs.at(m_activeTabId)->m_contentWebView->Navigate(fullPath.c_str()), L"Can't navigate to browser page.");
-                }
-                else
-                {
-                    OutputDebugString(L"Requested unknown browser page\n");
-                }
+                OutputDebugString(L"Requested unknown browser page\n");
+            }
+            else if (!webview)
+            {
+                tab->second->m_uri = m_internalPages.GetFilePath(page);
             }
-            else if (!SUCCEEDED(m_tabs.at(m_activeTabId)->m_contentWebView->Navigate(uri.c_str())))
+            else
             {
-                std::string string = jsonObj["args"]["encodedSearchURI"].get<std::string>().c_str();
-                std::wstring uri = to_wstring(string);
-                CheckFailure(m_tabs.at(m_activeTabId)->m_contentWebView->Navigate(uri.c_str()), L"Can't navigate to requested page.");
+                CheckFailure(webview->Navigate(m_internalPages.GetFilePath(page).c_str()), L"Can't navigate to browser page.");
             }
         }
-        break;
-        case MG_GO_FORWARD:
+        else if (!webview)
         {
-            CheckFailure(m_tabs.at(m_activeTabId)->m_contentWebView->GoForward(), L"");
+            // Loaded once the controller is created
+            tab->second->m_uri = uri;
         }
-        break;
-        case MG_GO_BACK:
+        else if (!SUCCEEDED(webview->Navigate(uri.c_str())))
         {
-            CheckFailure(m_tabs.at(m_activeTabId)->m_contentWebView->GoBack(), L"");
+            CheckFailure(webview->Navigate(args.encodedSearchURI.c_str()), L"Can't navigate to requested page.");
         }
-        break;
-        case MG_RELOAD:
+        return S_OK;
+    });
+    m_uiDispatcher.Register(MG_GO_FORWARD, InternalPage::None, [this](const MessageContext&) -> HRESULT
+    {
+        if (ICoreWebView2* webview = GetActiveWebView())
         {
-            CheckFailure(m_tabs.at(m_activeTabId)->m_contentWebView->Reload(), L"");
+            CheckFailure(webview->GoForward(), L"");
         }
-        break;
-        case MG_CANCEL:
+        return S_OK;
+    });
+    m_uiDispatcher.Register(MG_GO_BACK, InternalPage::None, [this](const MessageContext&) -> HRESULT
+    {
+        if (ICoreWebView2* webview = GetActiveWebView())
         {
-            CheckFailure(m_tabs.at(m_activeTabId)->m_contentWebView->CallDevToolsProtocolMethod(L"Page.stopLoading", L"{}", nullptr), L"");
+            CheckFailure(webview->GoBack(), L"");
         }
-        break;
-        case MG_SWITCH_TAB:
+        return S_OK;
+    });
+    m_uiDispatcher.Register(MG_RELOAD, InternalPage::None, [this](const MessageContext&) -> HRESULT
+    {
+        if (ICoreWebView2* webview = GetActiveWebView())
         {
-            size_t tabId = jsonObj["args"]["tabId"];
-            SwitchToTab(tabId);
+            CheckFailure(webview->Reload(), L"");
         }
-        break;
-        case MG_CLOSE_TAB:
+        return S_OK;
+    });
+    m_uiDispatcher.Register(MG_CANCEL, InternalPage::None, [this](const MessageContext&) -> HRESULT
+    {
+        if (ICoreWebView2* webview = GetActiveWebView())
         {
-            size_t id = jsonObj["args"]["tabId"];
-            m_tabs.at(id)->m_contentController->Close();
-            m_tabs.erase(id);
+            CheckFailure(webview->CallDevToolsProtocolMethod(L"Page.stopLoading", L"{}", nullptr), L"");
         }
-        break;
-        case MG_CLOSE_WINDOW:
+        return S_OK;
+    });
+    m_uiDispatcher.Register<SwitchTabMessage>(InternalPage::None,
+        [this](const SwitchTabMessage& args, const MessageContext&) -> HRESULT
+    {
+        m_session.Switch(args.tabId);
+        SwitchToTab(args.tabId);
+        return S_OK;
+    });
+    m_uiDispatcher.Register<CloseTabMessage>(InternalPage::None,
+        [this](const CloseTabMessage& args, const MessageContext&) -> HRESULT
+    {
+        size_t id = args.tabId;
+        m_session.Close(id);
+        m_manager.GetRegistry().RemoveTab(id);
+        m_tabLoader.Remove(id);
+        if (m_loadScheduler.IsScheduled(id))
         {
-            DestroyWindow(m_hWnd);
+            CheckFailure(m_loadScheduler.Remove(id), L"Can't load the tab.");
+            UpdateLoadProgress();
         }
-        break;
-        case MG_SHOW_OPTIONS:
+        m_evictionPolicy.Remove(id);
+        m_pageMetadata.Forget(id);
+        m_tabs.at(id)->Close();
+        m_tabs.erase(id);
+        if (m_pendingActiveTabId == id)
         {
-            CheckFailure(m_optionsController->put_IsVisible(TRUE), L"");
-            m_optionsController->MoveFocus(COREWEBVIEW2_MOVE_FOCUS_REASON_PROGRAMMATIC);
+            m_pendingActiveTabId = INVALID_TAB_ID;
         }
-        break;
-        case MG_HIDE_OPTIONS:
+        return S_OK;
+    });
+    m_uiDispatcher.Register(MG_CLOSE_WINDOW, InternalPage::None, [this](const MessageContext&) -> HRESULT
+    {
+        DestroyWindow(m_hWnd);
+        return S_OK;
+    });
+    m_uiDispatcher.Register<NewWindowMessage>(InternalPage::None,
+        [this](const NewWindowMessage& args, const MessageContext&) -> HRESULT
+    {
+        if (!args.moveTab)
+        {
+            if (!m_manager.OpenWindow(SW_SHOWNORMAL))
+            {
+                CheckFailure(E_FAIL, L"Can't open a new window.");
+            }
+        }
+        else if (m_tabs.size() > 1 && m_tabs.find(m_activeTabId) != m_tabs.end())
+        {
+            // The controls give the tab up first, and hand it back with
+            // MG_MOVE_TAB
+            MoveTabMessage message;
+            message.tabId = m_activeTabId;
+            PostMessageToControls(message);
+        }
+        return S_OK;
+    });
+    // The controls have removed the tab from the strip, and switched away
+    // from it
+    m_uiDispatcher.Register<MoveTabMessage>(InternalPage::None,
+        [this](const MoveTabMessage& args, const MessageContext&) -> HRESULT
+    {
+        CheckFailure(MoveTabToNewWindow(args.tabId), L"Can't move the tab.");
+        return S_OK;
+    });
+    m_uiDispatcher.Register<OpenTabsMessage>(InternalPage::None,
+        [this](const OpenTabsMessage& args, const MessageContext&) -> HRESULT
+    {
+        ActivationReply reply;
+        reply.tabIds = args.tabIds;
+        m_manager.CompleteActivation(args.requestId, reply);
+        return S_OK;
+    });
+    m_uiDispatcher.Register(MG_SHOW_OPTIONS, InternalPage::None, [this](const MessageContext&) -> HRESULT
+    {
+        // The dropdown is created the first time it is shown, it may have
+        // been hidden again by the time it exists
+        m_showOptions = true;
+        m_startup.Request(m_optionsStage);
+        m_startup.WhenDone(m_optionsStage, [this](HRESULT result)
+        {
+            if (FAILED(result))
+            {
+                // Let the controls reset the options button
+                OptionsLostFocusMessage message;
+                PostMessageToControls(message);
+            }
+            else if (m_showOptions)
+            {
+                CheckFailure(m_optionsController->put_IsVisible(TRUE), L"");
+                m_optionsController->MoveFocus(COREWEBVIEW2_MOVE_FOCUS_REASON_PROGRAMMATIC);
+            }
+        });
+        return S_OK;
+    });
+    m_uiDispatcher.Register(MG_HIDE_OPTIONS, InternalPage::None, [this](const MessageContext&) -> HRESULT
+    {
+        m_showOptions = false;
+        if (m_optionsController)
         {
             CheckFailure(m_optionsController->put_IsVisible(FALSE), L"Something went wrong when trying to close the options dropdown.");
         }
-        break;
-        case MG_OPTION_SELECTED:
+        return S_OK;
+    });
+    m_uiDispatcher.Register(MG_OPTION_SELECTED, InternalPage::None, [this](const MessageContext&) -> HRESULT
+    {
+        auto tab = m_tabs.find(m_activeTabId);
+        if (tab != m_tabs.end() && tab->second->m_contentController)
         {
-            m_tabs.at(m_activeTabId)->m_contentController->MoveFocus(COREWEBVIEW2_MOVE_FOCUS_REASON_PROGRAMMATIC);
+            tab->second->m_contentController->MoveFocus(COREWEBVIEW2_MOVE_FOCUS_REASON_PROGRAMMATIC);
         }
-        break;
-        case MG_GET_FAVORITES:
-        case MG_GET_SETTINGS:
-        case MG_GET_HISTORY:
+        return S_OK;
+    });
+
+    m_uiDispatcher.Register<AddHistoryItemMessage>(InternalPage::None,
+        [this](const AddHistoryItemMessage& args, const MessageContext&) -> HRESULT
+    {
+        auto it = m_tabs.find(args.tabId);
+        if (it != m_tabs.end())
         {
-            // Forward back to requesting tab
-            size_t tabId = jsonObj["args"]["tabId"];
-            jsonObj.erase("tabId");
-            CheckFailure(PostJsonToWebView(jsonObj, m_tabs.at(tabId)->m_contentWebView.Get()), L"Requesting history failed.");
+            LONGLONG timestamp;
+            int day;
+            GetVisitTime(&timestamp, &day);
+            size_t count = m_history.GetCount();
+            HRESULT hr = m_history.Add(args.uri, args.title, args.favicon, timestamp, day, &it->second->m_historyItemId);
+            CheckFailure(hr, L"Can't update the browsing history.");
+            if (SUCCEEDED(hr))
+            {
+                // The count stays the same when an entry of today was moved
+                m_search.AddVisit(args.uri, args.title, timestamp, m_history.GetCount() != count);
+            }
         }
-        break;
-        default:
+        return S_OK;
+    });
+    m_uiDispatcher.Register<UpdateHistoryItemMessage>(InternalPage::None,
+        [this](const UpdateHistoryItemMessage& args, const MessageContext&) -> HRESULT
+    {
+        auto it = m_tabs.find(args.tabId);
+        if (it != m_tabs.end() && it->second->m_historyItemId != INVALID_HISTORY_ID)
         {
-            OutputDebugString(L"Unexpected message\n");
+            HistoryItemFields item;
+            if (SUCCEEDED(m_history.GetItem(it->second->m_historyItemId, item)) &&
+                SUCCEEDED(m_history.Update(it->second->m_historyItemId, args.title, args.favicon)))
+            {
+                m_search.SetTitle(item.uri, args.title);
+            }
         }
-        break;
+        return S_OK;
+    });
+    // The history of the controls UI, once, when it drops its IndexedDB store
+    m_uiDispatcher.Register<ImportHistoryMessage>(InternalPage::None,
+        [this](const ImportHistoryMessage& args, const MessageContext&) -> HRESULT
+    {
+        HRESULT hr = m_history.Import(args.visits);
+        CheckFailure(hr, L"Can't import the browsing history.");
+        if (SUCCEEDED(hr))
+        {
+            // Rebuilt in time order, so the latest titles win
+            m_search.ClearHistory();
+            m_search.AddHistory(m_history);
+        }
+        return S_OK;
+    });
+    m_uiDispatcher.Register<UpdateFavoriteMessage>(InternalPage::None,
+        [this](const UpdateFavoriteMessage& args, const MessageContext&) -> HRESULT
+    {
+        LONGLONG timestamp;
+        int day;
+        GetVisitTime(&timestamp, &day);
+        m_search.SetFavorite(args.favorite.uri, args.favorite.title, args.isFavorite, timestamp);
+        CheckFailure(args.isFavorite ? m_favorites.Set(args.favorite) : m_favorites.Remove(args.favorite.uri),
+            L"Can't save the favorites.");
+        return S_OK;
+    });
+    // All favorites, once the controls UI has started
+    m_uiDispatcher.Register<FavoritesMessage>(InternalPage::None,
+        [this](const FavoritesMessage& args, const MessageContext&) -> HRESULT
+    {
+        LONGLONG timestamp;
+        int day;
+        GetVisitTime(&timestamp, &day);
+        for (const Favorite& favorite : args.favorites)
+        {
+            m_search.SetFavorite(favorite.uri, favorite.title, true, timestamp);
+        }
+
+        std::vector<std::wstring> removed;
+        CheckFailure(m_favorites.Replace(args.favorites, removed), L"Can't save the favorites.");
+        for (const std::wstring& uri : removed)
+        {
+            m_search.SetFavorite(uri, std::wstring(), false, timestamp);
+        }
+        return S_OK;
+    });
+    m_uiDispatcher.Register<GetSuggestionsMessage>(InternalPage::None,
+        [this](const GetSuggestionsMessage& args, const MessageContext&) -> HRESULT
+    {
+        SuggestionsMessage message;
+        message.query = args.query;
+        CheckFailure(m_search.Query(args.query, message.suggestions), L"Can't search the history.");
+        return PostMessageToWebView(message, m_controlsWebView.Get());
+    });
+
+    // Every page reports its metadata, see PageMetadataTracker
+    m_tabDispatcher.RegisterForAnyPage<PageMetadataMessage>(
+        [this](const PageMetadataMessage& args, const MessageContext& context) -> HRESULT
+    {
+        TRACE_INSTANT(L"Metadata", context.tabId);
+
+        PageMetadataMessage message = args;
+        if (m_pageMetadata.Update(context.tabId, message))
+        {
+            m_session.SetTitle(context.tabId, message.title);
+            PostPageMetadata(message);
+        }
+        return S_OK;
+    });
+
+    // Only the favorites UI can request favorites, which are served by the
+    // host. The controls UI hears about a removal to update its store.
+    m_tabDispatcher.Register(MG_GET_FAVORITES, InternalPage::Favorites, [this](const MessageContext& context) -> HRESULT
+    {
+        FavoritesBulkMessage message;
+        message.bulk = m_bulkTransfer.Add(m_favorites.GetBulk());
+        message.count = static_cast<int>(m_favorites.GetAll().size());
+        return PostMessageToWebView(message, m_tabs.at(context.tabId)->m_contentWebView.Get());
+    });
+    m_tabDispatcher.Register<RemoveFavoriteMessage>(InternalPage::Favorites,
+        [this](const RemoveFavoriteMessage& args, const MessageContext& context) -> HRESULT
+    {
+        LONGLONG timestamp;
+        int day;
+        GetVisitTime(&timestamp, &day);
+        m_search.SetFavorite(args.uri, std::wstring(), false, timestamp);
+        CheckFailure(m_favorites.Remove(args.uri), L"Can't save the favorites.");
+        ForwardMessageToControls(context.reader, context.tabId);
+        return S_OK;
+    });
+    // Only the settings UI can request settings
+    m_tabDispatcher.Register<SettingsMessage>(InternalPage::Settings,
+        [this](const SettingsMessage&, const MessageContext& context) -> HRESULT
+    {
+        SettingsMessage message;
+        message.settings = m_settings;
+        ResponseCache& cache = m_manager.GetResponseCache();
+        if (cache.IsOpen())
+        {
+            ResponseCache::Statistics statistics = cache.GetStatistics();
+            message.responseCache.enabled = true;
+            message.responseCache.hits = statistics.hits + statistics.revalidated + statistics.staleHits;
+            message.responseCache.misses = statistics.misses;
+            message.responseCache.bytesSaved = statistics.bytesSaved;
+            message.responseCache.size = statistics.size;
+        }
+        return PostMessageToWebView(message, m_tabs.at(context.tabId)->m_contentWebView.Get());
+    });
+
+    // Only the history UI can request history, which is served by the host
+    m_tabDispatcher.Register<GetHistoryMessage>(InternalPage::History,
+        [this](const GetHistoryMessage& args, const MessageContext& context) -> HRESULT
+    {
+        TRACE_SPAN(L"GetHistory", args.count);
+        HistoryPageMessage message;
+        message.from = args.before != 0 ? static_cast<int>(m_history.GetCountSince(args.before)) : args.from;
+        message.count = args.count;
+        message.total = static_cast<int>(m_history.GetCount());
+        if (message.from >= 0 && args.count > 0)
+        {
+            CheckFailure(m_history.GetPage(message.from, args.count, message.items), L"Can't read the browsing history.");
+        }
+
+        return PostMessageToWebView(message, m_tabs.at(context.tabId)->m_contentWebView.Get());
+    });
+    m_tabDispatcher.Register<RemoveHistoryItemMessage>(InternalPage::History,
+        [this](const RemoveHistoryItemMessage& args, const MessageContext&) -> HRESULT
+    {
+        HistoryItemFields item;
+        if (SUCCEEDED(m_history.GetItem(args.id, item)) && SUCCEEDED(m_history.Remove(args.id)))
+        {
+            m_search.RemoveVisit(item.uri, item.timestamp);
         }
+        return S_OK;
+    });
+    m_tabDispatcher.Register(MG_CLEAR_HISTORY, InternalPage::History, [this](const MessageContext&) -> HRESULT
+    {
+        CheckFailure(m_history.Clear(), L"Can't clear the browsing history.");
+        m_search.ClearHistory();
+        return S_OK;
+    });
+
+    // Only the settings UI can request cache and cookies clearing
+    m_tabDispatcher.Register(MG_CLEAR_CACHE, InternalPage::Settings, [this](const MessageContext& context) -> HRESULT
+    {
+        // The settings page shares the content profile
+        ICoreWebView2* webview = m_tabs.at(context.tabId)->m_contentWebView.Get();
+        ClearCacheMessage message;
+        message.content = SUCCEEDED(ClearContentCache(webview));
+        message.controls = SUCCEEDED(ClearControlsCache());
+        CheckFailure(m_manager.GetResponseCache().Clear(), L"Can't clear the response cache.");
+
+        CheckFailure(PostMessageToWebView(message, webview), L"");
+        return S_OK;
+    });
+    m_tabDispatcher.Register(MG_CLEAR_COOKIES, InternalPage::Settings, [this](const MessageContext& context) -> HRESULT
+    {
+        ICoreWebView2* webview = m_tabs.at(context.tabId)->m_contentWebView.Get();
+        ClearCookiesMessage message;
+        message.content = SUCCEEDED(ClearContentCookies(webview));
+        message.controls = SUCCEEDED(ClearControlsCookies());
 
+        CheckFailure(PostMessageToWebView(message, webview), L"");
         return S_OK;
     });
 }
 
+// The tab becomes the active one, which the controls show, right away. One
+// without a controller is loaded first and shown by HandleTabCreated, the
+// previous tab is hidden meanwhile.
 HRESULT BrowserWindow::SwitchToTab(size_t tabId)
 {
-    size_t previousActiveTab = m_activeTabId;
+    // A tab of a list of URIs doesn't wait for its turn once it's shown
+    RETURN_IF_FAILED(m_loadScheduler.Prioritize(tabId));
 
-    RETURN_IF_FAILED(m_tabs.at(tabId)->ResizeWebView());
-    RETURN_IF_FAILED(m_tabs.at(tabId)->m_contentController->put_IsVisible(TRUE));
+    size_t previousActiveTab = m_activeTabId;
     m_activeTabId = tabId;
 
+    HRESULT result = S_OK;
+    if (m_tabLoader.GetState(tabId) != TabState::Ready)
+    {
+        m_pendingActiveTabId = tabId;
+        result = m_tabLoader.Load(tabId, true);
+    }
+    else
+    {
+        m_pendingActiveTabId = INVALID_TAB_ID;
+        RETURN_IF_FAILED(m_tabs.at(tabId)->ResizeWebView());
+        RETURN_IF_FAILED(m_tabs.at(tabId)->m_contentController->put_IsVisible(TRUE));
+        m_evictionPolicy.Activate(tabId);
+    }
+
     if (previousActiveTab != INVALID_TAB_ID && previousActiveTab != m_activeTabId) {
         auto previousTabIterator = m_tabs.find(previousActiveTab);
         if (previousTabIterator != m_tabs.end() && previousTabIterator->second &&
@@ -579,330 +1634,813 @@ HRESULT BrowserWindow::SwitchToTab(size_t tabId)
         {
             auto hr = m_tabs.at(previousActiveTab)->m_contentController->put_IsVisible(FALSE);
             if (hr == HRESULT_FROM_WIN32(ERROR_INVALID_STATE)) {
-                nlohmann::json jsonObj;
-                jsonObj["message"] = MG_CLOSE_TAB;
-                jsonObj["args"]["tabId"] = previousActiveTab;
+                CloseTabMessage message;
+                message.tabId = previousActiveTab;
 
-                PostJsonToWebView(jsonObj, m_controlsWebView.Get());
+                PostMessageToControls(message);
             }
             RETURN_IF_FAILED(hr);
+
+            m_evictionPolicy.Deactivate(previousActiveTab, GetTickCount64());
+            MeasureTab(previousActiveTab);
         }
     }
 
+    return result;
+}
+
+// Null while the active tab has no controller, or there is no active tab
+ICoreWebView2* BrowserWindow::GetActiveWebView()
+{
+    auto it = m_tabs.find(m_activeTabId);
+    return it == m_tabs.end() ? nullptr : it->second->m_contentWebView.Get();
+}
+
+// The tab goes to a new window along with its controller, so the page is
+// neither reloaded nor loses its back and forward list. A tab which hasn't
+// got a controller yet is loaded by the new window, a creation in flight here
+// is abandoned.
+HRESULT BrowserWindow::MoveTabToNewWindow(size_t tabId)
+{
+    auto it = m_tabs.find(tabId);
+    if (it == m_tabs.end())
+    {
+        return S_FALSE;
+    }
+
+    MovedTab moved;
+    moved.ready = m_tabLoader.GetState(tabId) == TabState::Ready;
+    moved.session.tabId = tabId;
+    moved.session.uri = it->second->m_uri;
+    for (const SessionTab& tab : m_session.GetTabs())
+    {
+        if (tab.tabId == tabId)
+        {
+            moved.session = tab;
+            break;
+        }
+    }
+    moved.tab = std::move(it->second);
+    m_tabs.erase(it);
+    m_tabLoader.Remove(tabId);
+    if (m_loadScheduler.IsScheduled(tabId))
+    {
+        CheckFailure(m_loadScheduler.Remove(tabId), L"Can't load the tab.");
+        UpdateLoadProgress();
+    }
+    m_evictionPolicy.Remove(tabId);
+
+    PageMetadataMessage metadata;
+    bool const hasMetadata = m_pageMetadata.GetLast(tabId, metadata);
+    m_pageMetadata.Forget(tabId);
+
+    // The controls have switched to another tab, which may still be loading
+    if (m_pendingActiveTabId == tabId)
+    {
+        m_pendingActiveTabId = INVALID_TAB_ID;
+    }
+    if (m_activeTabId == tabId)
+    {
+        m_activeTabId = INVALID_TAB_ID;
+    }
+    if (moved.ready)
+    {
+        CheckFailure(moved.tab->m_contentController->put_IsVisible(FALSE), L"");
+    }
+
+    BrowserWindow* target = m_manager.OpenWindow(SW_SHOWNORMAL);
+    if (!target)
+    {
+        moved.tab->Close();
+        m_session.Close(tabId);
+        m_manager.GetRegistry().RemoveTab(tabId);
+        return E_FAIL;
+    }
+
+    m_manager.GetRegistry().MoveTab(tabId, target->m_windowId);
+    if (hasMetadata)
+    {
+        target->m_pageMetadata.Update(tabId, metadata);
+    }
+    target->AdoptTab(std::move(moved));
     return S_OK;
 }
 
+// The controls of the new window don't exist yet, they get the tab with
+// their session
+void BrowserWindow::AdoptTab(MovedTab moved)
+{
+    size_t const tabId = moved.session.tabId;
+    CheckFailure(moved.tab->MoveToWindow(m_hWnd), L"Can't move the tab.");
+    m_tabs.insert(std::pair<size_t, std::unique_ptr<Tab>>(tabId, std::move(moved.tab)));
+    if (moved.ready)
+    {
+        m_tabLoader.Adopt(tabId);
+        m_evictionPolicy.Add(tabId, GetTickCount64());
+    }
+    else
+    {
+        m_tabLoader.Add(tabId);
+    }
+    m_adoptedTabs.push_back(std::move(moved.session));
+}
+
+// The browser processes outlive the window when other windows are open
+void BrowserWindow::CloseWebViews()
+{
+    for (const auto& tab : m_tabs)
+    {
+        tab.second->Close();
+    }
+    if (m_controlsController)
+    {
+        m_controlsController->Close();
+    }
+    if (m_optionsController)
+    {
+        m_optionsController->Close();
+    }
+}
+
+// Takes a controller from the pool when there is one, it completes the tab
+// right away
+HRESULT BrowserWindow::CreateTabController(size_t tabId)
+{
+    TRACE_ASYNC_BEGIN(L"Tab creation", tabId);
+
+    Microsoft::WRL::ComPtr<ICoreWebView2Controller> controller;
+    if (m_controllerPool.Claim(controller))
+    {
+        // The creation is done either way, don't let the loader count it twice
+        CheckFailure(HandleTabCreated(tabId, S_OK, controller.Get()), L"Can't create the tab.");
+        return S_OK;
+    }
+    return m_tabs.at(tabId)->Init(m_contentEnv.Get());
+}
+
+// Estimates arrive asynchronously, the window may be gone by then
+void BrowserWindow::MeasureTab(size_t tabId)
+{
+    HWND hWnd = m_hWnd;
+    m_tabs.at(tabId)->GetMemoryEstimate([hWnd, tabId](ULONGLONG bytes)
+    {
+        BrowserWindow* browserWindow = reinterpret_cast<BrowserWindow*>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
+        if (browserWindow)
+        {
+            browserWindow->m_evictionPolicy.SetEstimate(tabId, bytes);
+            PostMessage(hWnd, WM_EVICT_TABS, 0, 0);
+        }
+    });
+}
+
+// Suspends or discards background tabs while the tabs with a controller use
+// more than the budget. A discarded tab is loaded again when it is shown.
+void BrowserWindow::EvictTabs()
+{
+    std::vector<TabEvictionPolicy::Decision> decisions;
+    m_evictionPolicy.Evaluate(GetTickCount64(), decisions);
+
+    HWND hWnd = m_hWnd;
+    for (const TabEvictionPolicy::Decision& decision : decisions)
+    {
+        size_t tabId = decision.tabId;
+        if (decision.action == TabEvictionPolicy::Action::Suspend)
+        {
+            m_tabs.at(tabId)->TrySuspend([hWnd, tabId](bool succeeded)
+            {
+                BrowserWindow* browserWindow = reinterpret_cast<BrowserWindow*>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
+                if (browserWindow)
+                {
+                    browserWindow->m_evictionPolicy.Suspended(tabId, succeeded);
+                    if (!succeeded)
+                    {
+                        PostMessage(hWnd, WM_EVICT_TABS, 0, 0);
+                    }
+                }
+            });
+        }
+        else
+        {
+            m_tabs.at(tabId)->Discard();
+            m_tabLoader.Unload(tabId);
+        }
+    }
+}
+
+// The tab calls this for both SourceChanged and HistoryChanged
 HRESULT BrowserWindow::HandleTabURIUpdate(size_t tabId, ICoreWebView2* webview)
+{
+    TRACE_SPAN(L"HandleTabURIUpdate", tabId);
+
+    UpdateUriMessage message;
+    RETURN_IF_FAILED(GetTabNavigationState(tabId, webview, message));
+    m_session.SetUri(tabId, message.uri);
+
+    PostMessageToControls(message);
+
+    return S_OK;
+}
+
+// Both SourceChanged and HistoryChanged report the complete navigation state,
+// so that neither update clears what the other one has set in the controls UI.
+HRESULT BrowserWindow::GetTabNavigationState(size_t tabId, ICoreWebView2* webview, UpdateUriMessage& message)
+{
+    wil::unique_cotaskmem_string source;
+    RETURN_IF_FAILED(webview->get_Source(&source));
+
+    message.tabId = tabId;
+    message.uri = source.get();
+
+    InternalPage page = m_internalPages.FromUri(source.get());
+    if (page != InternalPage::None)
+    {
+        message.uriToShow = m_internalPages.GetAlias(page);
+    }
+
+    BOOL canGoForward = FALSE;
+    RETURN_IF_FAILED(webview->get_CanGoForward(&canGoForward));
+    message.canGoForward = !!canGoForward;
+
+    BOOL canGoBack = FALSE;
+    RETURN_IF_FAILED(webview->get_CanGoBack(&canGoBack));
+    message.canGoBack = !!canGoBack;
+
+    return S_OK;
+}
+
+HRESULT BrowserWindow::HandleTabNavStarting(size_t tabId, ICoreWebView2* webview, ICoreWebView2NavigationStartingEventArgs* args)
+{
+    TRACE_SPAN(L"HandleTabNavStarting", tabId);
+    TRACE_ASYNC_BEGIN(L"Navigation", tabId);
+
+    // The new document reports its metadata even if it is the same
+    m_pageMetadata.Forget(tabId);
+
+    // The filter counts the blocked requests of the new document, and never
+    // blocks the document itself
+    Tab* tab = m_tabs.at(tabId).get();
+    wil::unique_cotaskmem_string uri;
+    RETURN_IF_FAILED(args->get_Uri(&uri));
+    tab->m_navigationUri = uri.get();
+    if (tab->m_blockedCount != 0)
+    {
+        tab->m_blockedCount = 0;
+        BlockedCountMessage blocked;
+        blocked.tabId = tabId;
+        PostMessageToControls(blocked);
+    }
+
+    NavStartingMessage message;
+    message.tabId = tabId;
+
+    PostMessageToControls(message);
+
+    return S_OK;
+}
+
+HRESULT BrowserWindow::HandleTabNavCompleted(size_t tabId, ICoreWebView2* webview, ICoreWebView2NavigationCompletedEventArgs* args)
+{
+    TRACE_SPAN(L"HandleTabNavCompleted", tabId);
+    TRACE_ASYNC_END(L"Navigation", tabId);
+
+    NavCompletedMessage message;
+    message.tabId = tabId;
+
+    BOOL navigationSucceeded = FALSE;
+    if (SUCCEEDED(args->get_IsSuccess(&navigationSucceeded)))
+    {
+        message.isError = !navigationSucceeded;
+    }
+
+    PostMessageToControls(message);
+
+    if (m_loadScheduler.IsScheduled(tabId))
+    {
+        CheckFailure(m_loadScheduler.Completed(tabId, !message.isError), L"Can't load the tab.");
+        UpdateLoadProgress();
+    }
+
+    return S_OK;
+}
+
+HRESULT BrowserWindow::HandleTabSecurityUpdate(size_t tabId, ICoreWebView2* webview, ICoreWebView2DevToolsProtocolEventReceivedEventArgs* args)
+{
+    TRACE_SPAN(L"HandleTabSecurityUpdate", tabId);
+
+    wil::unique_cotaskmem_string jsonArgs;
+    RETURN_IF_FAILED(args->get_ParameterObjectAsJson(&jsonArgs));
+
+    VisibleSecurityStateChangedEvent securityEvent;
+    RETURN_IF_FAILED(MessageReader::ReadObject(jsonArgs.get(), securityEvent));
+
+    SecurityUpdateMessage message;
+    message.tabId = tabId;
+    message.state = std::move(securityEvent.visibleSecurityState);
+
+    PostMessageToControls(message);
+
+    return S_OK;
+}
+
+// A tab playing audio isn't suspended or discarded, once it stops it may be
+HRESULT BrowserWindow::HandleTabAudioChanged(size_t tabId, ICoreWebView2* webview)
+{
+    Microsoft::WRL::ComPtr<ICoreWebView2_8> webview8;
+    RETURN_IF_FAILED(webview->QueryInterface(IID_PPV_ARGS(&webview8)));
+    BOOL playing = FALSE;
+    RETURN_IF_FAILED(webview8->get_IsDocumentPlayingAudio(&playing));
+
+    m_evictionPolicy.SetAudible(tabId, !!playing);
+    if (!playing)
+    {
+        PostMessage(m_hWnd, WM_EVICT_TABS, 0, 0);
+    }
+    return S_OK;
+}
+
+HRESULT BrowserWindow::HandleTabCreated(size_t tabId, HRESULT result, ICoreWebView2Controller* host)
+{
+    TRACE_SPAN(L"HandleTabCreated", tabId);
+    TRACE_ASYNC_END(L"Tab creation", tabId);
+
+    if (SUCCEEDED(result) && (m_tabLoader.GetState(tabId) != TabState::Creating || m_tabLoader.IsAbandoned(tabId)))
+    {
+        // The tab was closed meanwhile
+        m_tabLoader.Created(tabId, false);
+        return host->Close();
+    }
+
+    // The tab is only ready once it is attached, a failed one is a
+    // placeholder again and loaded the next time it's shown
+    if (SUCCEEDED(result))
+    {
+        result = m_tabs.at(tabId)->Attach(host);
+    }
+    m_tabLoader.Created(tabId, SUCCEEDED(result));
+    if (FAILED(result))
+    {
+        OutputDebugString(L"Tab WebView creation failed\n");
+        if (m_pendingActiveTabId == tabId)
+        {
+            m_pendingActiveTabId = INVALID_TAB_ID;
+        }
+        if (m_loadScheduler.IsScheduled(tabId))
+        {
+            CheckFailure(m_loadScheduler.Completed(tabId, false), L"Can't load the tab.");
+            UpdateLoadProgress();
+        }
+        return result;
+    }
+    m_evictionPolicy.Add(tabId, GetTickCount64());
+    if (m_manager.GetRequestFilter().IsLoaded())
+    {
+        CheckFailure(m_tabs.at(tabId)->FilterRequests(), L"Can't filter the requests of the tab.");
+    }
+    if (m_manager.GetResponseCache().IsOpen())
+    {
+        CheckFailure(m_tabs.at(tabId)->CacheResponses(m_manager.GetCachedOrigins()), L"Can't cache the responses of the tab.");
+    }
+
+    if (tabId == m_pendingActiveTabId)
+    {
+        CheckFailure(SwitchToTab(tabId), L"");
+    }
+    return S_OK;
+}
+
+HRESULT BrowserWindow::HandleTabMessageReceived(size_t tabId, ICoreWebView2* webview, ICoreWebView2WebMessageReceivedEventArgs* eventArgs)
+{
+    TRACE_SPAN(L"HandleTabMessageReceived", tabId);
+
+    wil::unique_cotaskmem_string jsonArgs;
+    RETURN_IF_FAILED(eventArgs->get_WebMessageAsJson(&jsonArgs));
+
+    MessageReader reader;
+    RETURN_IF_FAILED(reader.Parse(jsonArgs.get()));
+
+    // A document the tab has navigated away from may still have messages on
+    // the way. They would be answered to, or describe, the new document.
+    wil::unique_cotaskmem_string sender;
+    RETURN_IF_FAILED(eventArgs->get_Source(&sender));
+    wil::unique_cotaskmem_string source;
+    RETURN_IF_FAILED(webview->get_Source(&source));
+    if (wcscmp(sender.get(), source.get()) != 0)
+    {
+        return S_FALSE;
+    }
+
+    MessageContext context = { reader, jsonArgs.get(), tabId };
+    return m_tabDispatcher.Dispatch(context, m_internalPages.FromUri(sender.get()));
+}
+
+HRESULT BrowserWindow::HandleTabWebResourceRequested(size_t tabId, ICoreWebView2* webview, ICoreWebView2WebResourceRequestedEventArgs* args)
 {
     wil::unique_cotaskmem_string source;
     RETURN_IF_FAILED(webview->get_Source(&source));
-    std::wstring uri(source.get());
-
-    nlohmann::json jsonObj;
-    jsonObj["message"] = MG_UPDATE_URI;
-    jsonObj["args"]["tabId"] = tabId;
-    jsonObj["args"]["uri"] = to_utf8(uri);
-
-    std::wstring favoritesURI = GetFilePathAsURI(GetFullPathFor(L"wvbrowser_ui\\content_ui\\favorites.html"));
-    std::wstring settingsURI = GetFilePathAsURI(GetFullPathFor(L"wvbrowser_ui\\content_ui\\settings.html"));
-    std::wstring historyURI = GetFilePathAsURI(GetFullPathFor(L"wvbrowser_ui\\content_ui\\history.html"));
+    wil::com_ptr<ICoreWebView2WebResourceRequest> request;
+    RETURN_IF_FAILED(args->get_Request(&request));
+    wil::unique_cotaskmem_string uri;
+    RETURN_IF_FAILED(request->get_Uri(&uri));
 
-    if (uri.compare(favoritesURI) == 0)
+    // Web pages could tell from the cache which sites were visited. With the
+    // request filter or the response cache, other requests of the browser
+    // pages get here too.
+    if (m_internalPages.FromUri(source.get()) != InternalPage::None)
     {
-        jsonObj["args"]["uriToShow"] = "browser://favorites";
+        if (wcsncmp(uri.get(), BulkTransfer::c_uriPrefix, wcslen(BulkTransfer::c_uriPrefix)) == 0)
+        {
+            return ServeBulk(m_contentEnv.Get(), uri.get(), args);
+        }
+        if (wcsncmp(uri.get(), FaviconCache::c_uriPrefix, wcslen(FaviconCache::c_uriPrefix)) == 0)
+        {
+            return ServeFavicon(m_contentEnv.Get(), args);
+        }
+        return S_OK;
     }
-    else if (uri.compare(settingsURI) == 0)
+
+    // Blocked requests don't get to the cache
+    if (m_manager.GetRequestFilter().IsLoaded())
     {
-        jsonObj["args"]["uriToShow"] = "browser://settings";
+        HRESULT const hr = FilterTabRequest(tabId, source.get(), uri.get(), args);
+        if (hr != S_OK)
+        {
+            return SUCCEEDED(hr) ? S_OK : hr;
+        }
     }
-    else if (uri.compare(historyURI) == 0)
+    if (!m_manager.GetResponseCache().IsOpen())
     {
-        jsonObj["args"]["uriToShow"] = "browser://history";
+        return S_OK;
     }
-
-    RETURN_IF_FAILED(PostJsonToWebView(jsonObj, m_controlsWebView.Get()));
-
-    return S_OK;
+    return ServeCachedResponse(webview, uri.get(), request.get(), args);
 }
 
-HRESULT BrowserWindow::HandleTabHistoryUpdate(size_t tabId, ICoreWebView2* webview)
+// Blocked requests fail as if the server refused them, and are counted for
+// the controls. S_FALSE if the request was blocked.
+HRESULT BrowserWindow::FilterTabRequest(size_t tabId, LPCWSTR source, LPCWSTR uri, ICoreWebView2WebResourceRequestedEventArgs* args)
 {
-    wil::unique_cotaskmem_string source;
-    RETURN_IF_FAILED(webview->get_Source(&source));
-    std::wstring uri(source.get());
-
-    nlohmann::json jsonObj;
-    jsonObj["message"] = MG_UPDATE_URI;
-    jsonObj["args"]["tabId"] = tabId;
-    jsonObj["args"]["uri"] = to_utf8(uri);
+    auto it = m_tabs.find(tabId);
+    if (it == m_tabs.end())
+    {
+        return S_OK;
+    }
+    Tab* tab = it->second.get();
 
-    BOOL canGoForward = FALSE;
-    RETURN_IF_FAILED(webview->get_CanGoForward(&canGoForward));
-    jsonObj["args"]["canGoForward"] = canGoForward;
+    COREWEBVIEW2_WEB_RESOURCE_CONTEXT context;
+    RETURN_IF_FAILED(args->get_ResourceContext(&context));
+    ResourceType type = ResourceType::Other;
+    switch (context)
+    {
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_DOCUMENT:
+        if (tab->m_navigationUri == uri)
+        {
+            return S_OK;
+        }
+        type = ResourceType::Subdocument;
+        break;
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_STYLESHEET:
+        type = ResourceType::Stylesheet;
+        break;
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_IMAGE:
+        type = ResourceType::Image;
+        break;
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_MEDIA:
+        type = ResourceType::Media;
+        break;
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_FONT:
+        type = ResourceType::Font;
+        break;
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_SCRIPT:
+        type = ResourceType::Script;
+        break;
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_XML_HTTP_REQUEST:
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_FETCH:
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_EVENT_SOURCE:
+        type = ResourceType::XmlHttpRequest;
+        break;
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_WEBSOCKET:
+        type = ResourceType::WebSocket;
+        break;
+    case COREWEBVIEW2_WEB_RESOURCE_CONTEXT_PING:
+        type = ResourceType::Ping;
+        break;
+    }
 
-    BOOL canGoBack = FALSE;
-    RETURN_IF_FAILED(webview->get_CanGoBack(&canGoBack));
-    jsonObj["args"]["canGoBack"] = canGoBack;
+    // The page which is loading, the source only changes once it commits
+    LPCWSTR const document = tab->m_navigationUri.empty() ? source : tab->m_navigationUri.c_str();
+    m_filterUri.clear();
+    m_filterDocumentUri.clear();
+    RETURN_IF_FAILED(AppendUtf8(uri, wcslen(uri), m_filterUri));
+    RETURN_IF_FAILED(AppendUtf8(document, wcslen(document), m_filterDocumentUri));
+    m_filterRequest.Set(m_filterUri, m_filterDocumentUri, type);
+    if (!m_manager.GetRequestFilter().Match(m_filterRequest))
+    {
+        return S_OK;
+    }
 
-    RETURN_IF_FAILED(PostJsonToWebView(jsonObj, m_controlsWebView.Get()));
+    wil::com_ptr<ICoreWebView2WebResourceResponse> response;
+    RETURN_IF_FAILED(m_contentEnv->CreateWebResourceResponse(nullptr, 403, L"Blocked", L"", &response));
+    RETURN_IF_FAILED(args->put_Response(response.get()));
 
-    return S_OK;
+    BlockedCountMessage message;
+    message.tabId = tabId;
+    message.blocked = ++tab->m_blockedCount;
+    PostMessageToControls(message);
+    return S_FALSE;
 }
 
-HRESULT BrowserWindow::HandleTabNavStarting(size_t tabId, ICoreWebView2* webview)
+// Fresh responses are served from their body file without going to the
+// network, stale ones once the server said they didn't change. Everything
+// else loads as usual and comes back through
+// HandleTabWebResourceResponseReceived.
+HRESULT BrowserWindow::ServeCachedResponse(ICoreWebView2* webview, LPCWSTR uri, ICoreWebView2WebResourceRequest* webRequest,
+    ICoreWebView2WebResourceRequestedEventArgs* args)
 {
-    nlohmann::json jsonObj;
-    jsonObj["message"] = MG_NAV_STARTING;
-    jsonObj["args"]["tabId"] = tabId;
-
-    return PostJsonToWebView(jsonObj, m_controlsWebView.Get());
-}
+    ResponseCache& cache = m_manager.GetResponseCache();
+    ResponseCache::Request request;
+    RETURN_IF_FAILED(AppendUtf8(uri, wcslen(uri), request.uri));
+    // With the request filter, every request gets here
+    if (!cache.IsCachedOrigin(request.uri))
+    {
+        return S_OK;
+    }
+    RETURN_IF_FAILED(GetCacheRequest(webRequest, request));
 
-HRESULT BrowserWindow::HandleTabNavCompleted(size_t tabId, ICoreWebView2* webview, ICoreWebView2NavigationCompletedEventArgs* args)
-{
-    std::wstring getTitleScript(
-        // Look for a title tag
-        L"(() => {"
-        L"    const titleTag = document.getElementsByTagName('title')[0];"
-        L"    if (titleTag) {"
-        L"        return titleTag.innerHTML;"
-        L"    }"
-        // No title tag, look for the file name
-        L"    pathname = window.location.pathname;"
-        L"    var filename = pathname.split('/').pop();"
-        L"    if (filename) {"
-        L"        return filename;"
-        L"    }"
-        // No file name, look for the hostname
-        L"    const hostname =  window.location.hostname;"
-        L"    if (hostname) {"
-        L"        return hostname;"
-        L"    }"
-        // Fallback: let the UI use a generic title
-        L"    return '';"
-        L"})();"
-    );
-
-    std::wstring getFaviconURI(
-        L"(() => {"
-        // Let the UI use a fallback favicon
-        L"    let faviconURI = '';"
-        L"    let links = document.getElementsByTagName('link');"
-        // Test each link for a favicon
-        L"    Array.from(links).map(element => {"
-        L"        let rel = element.rel;"
-        // Favicon is declared, try to get the href
-        L"        if (rel && (rel == 'shortcut icon' || rel == 'icon')) {"
-        L"            if (!element.href) {"
-        L"                return;"
-        L"            }"
-        // href to icon found, check it's full URI
-        L"            try {"
-        L"                let urlParser = new URL(element.href);"
-        L"                faviconURI = urlParser.href;"
-        L"            } catch(e) {"
-        // Try prepending origin
-        L"                let origin = window.location.origin;"
-        L"                let faviconLocation = `${origin}/${element.href}`;"
-        L"                try {"
-        L"                    urlParser = new URL(faviconLocation);"
-        L"                    faviconURI = urlParser.href;"
-        L"                } catch (e2) {"
-        L"                    return;"
-        L"                }"
-        L"            }"
-        L"        }"
-        L"    });"
-        L"    return faviconURI;"
-        L"})();"
-    );
-
-    CheckFailure(webview->ExecuteScript(getTitleScript.c_str(), Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
-        [this, tabId](HRESULT error, PCWSTR result) -> HRESULT
-    {
-        RETURN_IF_FAILED(error);
-
-        std::wstring title(result);
-
-        nlohmann::json jsonObj;
-        jsonObj["message"] = MG_UPDATE_TAB;
-        jsonObj["args"]["title"] = to_utf8(title);
-        jsonObj["args"]["tabId"] = tabId;
-
-        CheckFailure(PostJsonToWebView(jsonObj, m_controlsWebView.Get()), L"Can't update title.");
+    ResponseCache::Response response;
+    std::string revalidationHeaders;
+    switch (cache.Lookup(request, response, revalidationHeaders))
+    {
+    case ResponseCache::Action::Serve:
+        return PutCachedResponse(request.uri, response, args);
+    case ResponseCache::Action::Revalidate:
+        break;
+    default:
         return S_OK;
-    }).Get()), L"Can't update title.");
+    }
 
-    CheckFailure(webview->ExecuteScript(getFaviconURI.c_str(), Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
-        [this, tabId](HRESULT error, PCWSTR result) -> HRESULT
+    // The server answers the conditional request as it would the page, so
+    // the page's cookies go with it. Credentials of HTTP authentication
+    // can't be read, a server which asks for them gets its 401 and the page
+    // then loads the response itself.
+    wil::com_ptr<ICoreWebView2_2> webview2;
+    RETURN_IF_FAILED(webview->QueryInterface(IID_PPV_ARGS(&webview2)));
+    wil::com_ptr<ICoreWebView2CookieManager> cookieManager;
+    RETURN_IF_FAILED(webview2->get_CookieManager(&cookieManager));
+
+    // The page waits for the answer
+    PendingRevalidation pending;
+    pending.request = std::move(request);
+    pending.headers = std::move(revalidationHeaders);
+    pending.args = args;
+    RETURN_IF_FAILED(args->GetDeferral(&pending.deferral));
+    size_t const revalidationId = m_nextRevalidationId++;
+    m_revalidations.emplace(revalidationId, std::move(pending));
+
+    HRESULT const hr = cookieManager->GetCookies(uri, Callback<ICoreWebView2GetCookiesCompletedHandler>(
+        [this, revalidationId](HRESULT errorCode, ICoreWebView2CookieList* cookies) -> HRESULT
+    {
+        HRESULT hr = errorCode;
+        if (SUCCEEDED(hr))
+        {
+            hr = SendRevalidation(revalidationId, cookies);
+        }
+        if (FAILED(hr))
+        {
+            CancelRevalidation(revalidationId);
+            CheckFailure(hr, L"Can't revalidate a cached response.");
+        }
+        return S_OK;
+    }).Get());
+    if (FAILED(hr))
     {
-        RETURN_IF_FAILED(error);
+        CancelRevalidation(revalidationId);
+    }
+    return hr;
+}
 
-        std::wstring uri(result);
+// Asks the server on the thread pool, the answer comes back as
+// WM_CACHE_REVALIDATED
+HRESULT BrowserWindow::SendRevalidation(size_t revalidationId, ICoreWebView2CookieList* cookies)
+{
+    auto it = m_revalidations.find(revalidationId);
+    if (it == m_revalidations.end())
+    {
+        return S_OK;
+    }
 
-        nlohmann::json jsonObj;
-        jsonObj["message"] = MG_UPDATE_FAVICON;
-        jsonObj["args"]["uri"] = to_utf8(uri);
-        jsonObj["args"]["tabId"] = tabId;
+    std::string headers = it->second.headers;
+    RETURN_IF_FAILED(AppendCookieHeader(cookies, headers));
+    std::unique_ptr<CacheRevalidation> revalidation(new CacheRevalidation());
+    revalidation->hWnd = m_hWnd;
+    revalidation->revalidationId = revalidationId;
+    RETURN_IF_FAILED(AppendUtf16(it->second.request.uri.data(), it->second.request.uri.size(), revalidation->uri));
+    RETURN_IF_FAILED(AppendUtf16(headers.data(), headers.size(), revalidation->headers));
 
-        CheckFailure(PostJsonToWebView(jsonObj, m_controlsWebView.Get()), L"Can't update favicon.");
-        return S_OK;
-    }).Get()), L"Can't update favicon");
+    auto work = [](PTP_CALLBACK_INSTANCE, PVOID context)
+    {
+        std::unique_ptr<CacheRevalidation> revalidation(static_cast<CacheRevalidation*>(context));
+        revalidation->result = SendConditionalRequest(*revalidation);
 
-    nlohmann::json jsonObj;
-    jsonObj["message"] = MG_NAV_COMPLETED;
-    jsonObj["args"]["tabId"] = tabId;
+        // The window deletes it, unless it is gone
+        if (PostMessage(revalidation->hWnd, WM_CACHE_REVALIDATED, 0, reinterpret_cast<LPARAM>(revalidation.get())))
+        {
+            revalidation.release();
+        }
+    };
 
-    BOOL navigationSucceeded = FALSE;
-    if (SUCCEEDED(args->get_IsSuccess(&navigationSucceeded)))
+    if (!TrySubmitThreadpoolCallback(work, revalidation.get(), nullptr))
     {
-        jsonObj["args"]["isError"] = !navigationSucceeded;
+        RETURN_LAST_ERROR();
     }
-
-    return PostJsonToWebView(jsonObj, m_controlsWebView.Get());
+    revalidation.release();
+    return S_OK;
 }
 
-HRESULT BrowserWindow::HandleTabSecurityUpdate(size_t tabId, ICoreWebView2* webview, ICoreWebView2DevToolsProtocolEventReceivedEventArgs* args)
+// The request loads as if nothing were cached
+void BrowserWindow::CancelRevalidation(size_t revalidationId)
 {
-    LPWSTR jsonArgs;
-    RETURN_IF_FAILED(args->get_ParameterObjectAsJson(&jsonArgs));
-    std::wstring jsonString(jsonArgs);
-    nlohmann::json jsonEvent = nlohmann::json::parse(jsonString);
+    auto it = m_revalidations.find(revalidationId);
+    if (it != m_revalidations.end())
+    {
+        PendingRevalidation pending = std::move(it->second);
+        m_revalidations.erase(it);
+        CheckFailure(pending.deferral->Complete(), L"Can't serve a cached response.");
+    }
+}
 
-    nlohmann::json jsonObj;
-    jsonObj["message"] = MG_SECURITY_UPDATE;
-    jsonObj["args"]["tabId"] = tabId;
-    jsonObj["args"]["state"] = jsonEvent["visibleSecurityState"];
+// A body file which can't be opened anymore takes its response out of the
+// cache, the request goes to the network then
+HRESULT BrowserWindow::PutCachedResponse(const std::string& uri, const ResponseCache::Response& response, ICoreWebView2WebResourceRequestedEventArgs* args)
+{
+    wil::com_ptr<IStream> stream;
+    if (FAILED(SHCreateStreamOnFileEx(m_manager.GetCachedBodyPath(response.blob).c_str(), STGM_READ | STGM_SHARE_DENY_NONE,
+        FILE_ATTRIBUTE_NORMAL, FALSE, nullptr, &stream)))
+    {
+        m_manager.GetResponseCache().Remove(uri);
+        return S_OK;
+    }
 
-    return PostJsonToWebView(jsonObj, m_controlsWebView.Get());
+    std::wstring reason;
+    std::wstring headers;
+    RETURN_IF_FAILED(AppendUtf16(response.reason.data(), response.reason.size(), reason));
+    RETURN_IF_FAILED(AppendUtf16(response.headers.data(), response.headers.size(), headers));
+    wil::com_ptr<ICoreWebView2WebResourceResponse> webResponse;
+    RETURN_IF_FAILED(m_contentEnv->CreateWebResourceResponse(stream.get(), response.status, reason.c_str(), headers.c_str(), &webResponse));
+    return args->put_Response(webResponse.get());
 }
 
-void BrowserWindow::HandleTabCreated(size_t tabId, bool shouldBeActive)
+// The request loads as usual unless the cached response is served
+void BrowserWindow::HandleCacheRevalidated(size_t revalidationId, HRESULT result, int status, const std::wstring& headers)
 {
-    if (shouldBeActive)
+    auto it = m_revalidations.find(revalidationId);
+    if (it == m_revalidations.end())
     {
-        if (m_lpCmdLine)
-        {
-            m_tabs.at(tabId)->m_contentWebView->Navigate(m_lpCmdLine);
-            m_lpCmdLine = nullptr;
-        }
-        CheckFailure(SwitchToTab(tabId), L"");
+        return;
     }
+    PendingRevalidation pending = std::move(it->second);
+    m_revalidations.erase(it);
+
+    std::string utf8Headers;
+    if (SUCCEEDED(result))
+    {
+        result = AppendUtf8(headers.c_str(), headers.size(), utf8Headers);
+    }
+    ResponseCache::Response response;
+    if (m_manager.GetResponseCache().Revalidated(pending.request, result, status, utf8Headers, response) == ResponseCache::Action::Serve)
+    {
+        CheckFailure(PutCachedResponse(pending.request.uri, response, pending.args.get()), L"Can't serve a cached response.");
+    }
+    CheckFailure(pending.deferral->Complete(), L"Can't serve a cached response.");
 }
 
-HRESULT BrowserWindow::HandleTabMessageReceived(size_t tabId, ICoreWebView2* webview, ICoreWebView2WebMessageReceivedEventArgs* eventArgs)
+// Favicons the cache is waiting for, and responses the response cache wants,
+// are read once the page has them, the one it served itself included, see
+// ResponseCache::ShouldStore
+HRESULT BrowserWindow::HandleTabWebResourceResponseReceived(size_t tabId, ICoreWebView2WebResourceResponseReceivedEventArgs* args)
 {
-    LPWSTR jsonArgs;
-    RETURN_IF_FAILED(eventArgs->get_WebMessageAsJson(&jsonArgs));
-    std::wstring jsonString(jsonArgs);
-    nlohmann::json jsonObj = nlohmann::json::parse(jsonString);
-
+    ResponseCache& cache = m_manager.GetResponseCache();
+    wil::com_ptr<ICoreWebView2WebResourceRequest> webRequest;
+    RETURN_IF_FAILED(args->get_Request(&webRequest));
     wil::unique_cotaskmem_string uri;
-    RETURN_IF_FAILED(webview->get_Source(&uri));
+    RETURN_IF_FAILED(webRequest->get_Uri(&uri));
 
-    int message = jsonObj["message"];
-
-    wil::unique_cotaskmem_string source;
-    RETURN_IF_FAILED(webview->get_Source(&source));
-
-    switch (message)
-    {
-    case MG_GET_FAVORITES:
-    case MG_REMOVE_FAVORITE:
+    // Any tab's response will do, the one asked to load it or another
+    auto fetch = m_faviconFetches.find(uri.get());
+    if (fetch != m_faviconFetches.end())
     {
-        std::wstring fileURI = GetFilePathAsURI(GetFullPathFor(L"wvbrowser_ui\\content_ui\\favorites.html"));
-        // Only the favorites UI can request favorites
-        if (fileURI.compare(source.get()) == 0)
+        m_faviconFetches.erase(fetch);
+        wil::com_ptr<ICoreWebView2WebResourceResponseView> view;
+        HRESULT hr = args->get_Response(&view);
+        if (SUCCEEDED(hr))
         {
-            jsonObj["args"]["tabId"] = tabId;
-            CheckFailure(PostJsonToWebView(jsonObj, m_controlsWebView.Get()), L"Couldn't perform favorites operation.");
+            hr = ReadFavicon(uri.get(), view.get());
         }
-    }
-    break;
-    case MG_GET_SETTINGS:
-    {
-        std::wstring fileURI = GetFilePathAsURI(GetFullPathFor(L"wvbrowser_ui\\content_ui\\settings.html"));
-        // Only the settings UI can request settings
-        if (fileURI.compare(source.get()) == 0)
+        if (FAILED(hr))
         {
-            jsonObj["args"]["tabId"] = tabId;
-            CheckFailure(PostJsonToWebView(jsonObj, m_controlsWebView.Get()), L"Couldn't retrieve settings.");
+            FaviconCache::Icon icon;
+            HandleFaviconFetched(uri.get(), hr, icon);
         }
     }
-    break;
-    case MG_CLEAR_CACHE:
-    {
-        std::wstring fileURI = GetFilePathAsURI(GetFullPathFor(L"wvbrowser_ui\\content_ui\\settings.html"));
-        // Only the settings UI can request cache clearing
-        if (fileURI.compare(uri.get()) == 0)
-        {
-            jsonObj["args"]["content"] = false;
-            jsonObj["args"]["controls"] = false;
-
-            if (SUCCEEDED(ClearContentCache()))
-            {
-                jsonObj["args"]["content"] = true;
-            }
-
-            if (SUCCEEDED(ClearControlsCache()))
-            {
-                jsonObj["args"]["controls"] = true;
-            }
 
-            CheckFailure(PostJsonToWebView(jsonObj, m_tabs.at(tabId)->m_contentWebView.Get()), L"");
-        }
+    ResponseCache::Request request;
+    RETURN_IF_FAILED(AppendUtf8(uri.get(), wcslen(uri.get()), request.uri));
+    if (!cache.IsCachedOrigin(request.uri))
+    {
+        return S_OK;
     }
-    break;
-    case MG_CLEAR_COOKIES:
+    RETURN_IF_FAILED(GetCacheRequest(webRequest.get(), request));
+
+    wil::com_ptr<ICoreWebView2WebResourceResponseView> view;
+    RETURN_IF_FAILED(args->get_Response(&view));
+    int status = 0;
+    RETURN_IF_FAILED(view->get_StatusCode(&status));
+    wil::com_ptr<ICoreWebView2HttpResponseHeaders> webHeaders;
+    RETURN_IF_FAILED(view->get_Headers(&webHeaders));
+    wil::com_ptr<ICoreWebView2HttpHeadersCollectionIterator> iterator;
+    RETURN_IF_FAILED(webHeaders->GetIterator(&iterator));
+    std::string headers;
+    RETURN_IF_FAILED(AppendHeaders(iterator.get(), headers));
+    if (!cache.ShouldStore(request, status, headers))
     {
-        std::wstring fileURI = GetFilePathAsURI(GetFullPathFor(L"wvbrowser_ui\\content_ui\\settings.html"));
-        // Only the settings UI can request cookies clearing
-        if (fileURI.compare(uri.get()) == 0)
-        {
-            jsonObj["args"]["content"] = false;
-            jsonObj["args"]["controls"] = false;
-
-            if (SUCCEEDED(ClearContentCookies()))
-            {
-                jsonObj["args"]["content"] = true;
-            }
-
+        return S_OK;
+    }
 
-            if (SUCCEEDED(ClearControlsCookies()))
-            {
-                jsonObj["args"]["controls"] = true;
-            }
+    wil::unique_cotaskmem_string reasonPhrase;
+    RETURN_IF_FAILED(view->get_ReasonPhrase(&reasonPhrase));
+    std::string reason;
+    RETURN_IF_FAILED(AppendUtf8(reasonPhrase.get(), wcslen(reasonPhrase.get()), reason));
 
-            CheckFailure(PostJsonToWebView(jsonObj, m_tabs.at(tabId)->m_contentWebView.Get()), L"");
+    // The manager outlives the window, which may be gone once the body is read
+    return view->GetContent(Callback<ICoreWebView2WebResourceResponseViewGetContentCompletedHandler>(
+        [&cache, request, status, reason, headers](HRESULT errorCode, IStream* content) -> HRESULT
+    {
+        std::vector<BYTE> body;
+        if (SUCCEEDED(errorCode) && content && SUCCEEDED(ReadResponseBody(content, cache.GetMaxBodySize(), body)))
+        {
+            CheckFailure(cache.Store(request, status, reason, headers, body.data(), body.size()), L"Can't cache a response.");
         }
+        return S_OK;
+    }).Get());
+}
+
+// Maps the compiled snapshot right away if it is current, compiles the list
+// on the thread pool first otherwise. Tabs load unfiltered meanwhile.
+HRESULT BrowserWindow::LoadRequestFilter(const std::wstring& listPath)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    RETURN_IF_WIN32_BOOL_FALSE(GetFileAttributesExW(listPath.c_str(), GetFileExInfoStandard, &attributes));
+
+    std::unique_ptr<CompiledFilter> compile(new CompiledFilter());
+    compile->hWnd = m_hWnd;
+    compile->listPath = listPath;
+    compile->snapshotPath = GetAppDataDirectory() + L"\\Filters.bin";
+    compile->sourceTime = (static_cast<UINT64>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+    compile->sourceSize = (static_cast<UINT64>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+    if (m_manager.LoadRequestFilter(compile->snapshotPath, compile->sourceTime, compile->sourceSize) == S_OK)
+    {
+        return S_OK;
     }
-    break;
-    case MG_GET_HISTORY:
-    case MG_REMOVE_HISTORY_ITEM:
-    case MG_CLEAR_HISTORY:
+
+    auto work = [](PTP_CALLBACK_INSTANCE, PVOID context)
     {
-        std::wstring fileURI = GetFilePathAsURI(GetFullPathFor(L"wvbrowser_ui\\content_ui\\history.html"));
-        // Only the history UI can request history
-        if (fileURI.compare(uri.get()) == 0)
+        std::unique_ptr<CompiledFilter> compile(static_cast<CompiledFilter*>(context));
+        compile->result = CompileFilterList(*compile);
+
+        // The window deletes it, unless it is gone
+        if (PostMessage(compile->hWnd, WM_FILTER_COMPILED, 0, reinterpret_cast<LPARAM>(compile.get())))
         {
-            jsonObj["args"]["tabId"] = tabId;
-            CheckFailure(PostJsonToWebView(jsonObj, m_controlsWebView.Get()), L"Couldn't perform history operation");
+            compile.release();
         }
-    }
-    break;
-    default:
+    };
+
+    if (!TrySubmitThreadpoolCallback(work, compile.get(), nullptr))
     {
-        OutputDebugString(L"Unexpected message\n");
+        return HRESULT_FROM_WIN32(GetLastError());
     }
-    break;
+    compile.release();
+    return S_OK;
+}
+
+// Tabs created before the filter was loaded filter their requests from now on
+void BrowserWindow::FilterRequests()
+{
+    for (auto& tab : m_tabs)
+    {
+        CheckFailure(tab.second->FilterRequests(), L"Can't filter the requests of the tab.");
     }
+}
 
-    return S_OK;
+// The same for the response cache
+void BrowserWindow::CacheResponses()
+{
+    for (auto& tab : m_tabs)
+    {
+        CheckFailure(tab.second->CacheResponses(m_manager.GetCachedOrigins()), L"Can't cache the responses of the tab.");
+    }
 }
 
-HRESULT BrowserWindow::ClearContentCache()
+HRESULT BrowserWindow::ClearContentCache(ICoreWebView2* webview)
 {
-    return m_tabs.at(m_activeTabId)->m_contentWebView->CallDevToolsProtocolMethod(L"Network.clearBrowserCache", L"{}", nullptr);
+    return webview->CallDevToolsProtocolMethod(L"Network.clearBrowserCache", L"{}", nullptr);
 }
 
 HRESULT BrowserWindow::ClearControlsCache()
@@ -910,9 +2448,9 @@ HRESULT BrowserWindow::ClearControlsCache()
     return m_controlsWebView->CallDevToolsProtocolMethod(L"Network.clearBrowserCache", L"{}", nullptr);
 }
 
-HRESULT BrowserWindow::ClearContentCookies()
+HRESULT BrowserWindow::ClearContentCookies(ICoreWebView2* webview)
 {
-    return m_tabs.at(m_activeTabId)->m_contentWebView->CallDevToolsProtocolMethod(L"Network.clearBrowserCookies", L"{}", nullptr);
+    return webview->CallDevToolsProtocolMethod(L"Network.clearBrowserCookies", L"{}", nullptr);
 }
 
 HRESULT BrowserWindow::ClearControlsCookies()
@@ -973,18 +2511,275 @@ void BrowserWindow::CheckFailure(HRESULT hr, LPCWSTR errorMessage)
 {
     if (FAILED(hr))
     {
-        std::wstring message;
+        TRACE_INSTANT(L"Failure", static_cast<ULONG>(hr));
+
+        // Callbacks of every tab keep running, the error is reported later
         if (!errorMessage || !errorMessage[0])
         {
-            message = std::wstring(L"Something went wrong.");
+            errorMessage = L"Something went wrong.";
         }
-        else
+        s_errorReporter.Post(hr, errorMessage);
+    }
+}
+
+// Writes the errors to the log and shows the new ones in the controls
+void BrowserWindow::ReportErrors()
+{
+    s_errorReporter.Drain([this](const ErrorReporter::Report& report)
+    {
+        if (m_showErrors)
+        {
+            WCHAR code[16];
+            StringCchPrintfW(code, _countof(code), L"0x%08X", report.hr);
+
+            ErrorMessage message;
+            message.code = code;
+            message.message = report.site;
+            PostMessageToControls(message);
+        }
+    });
+}
+
+// The controls UI gets the favicon from the cache, or none until it is
+// fetched. Icons which can't be cached are loaded from the page.
+void BrowserWindow::PostPageMetadata(PageMetadataMessage message)
+{
+    std::wstring uri;
+    m_faviconTabId = message.tabId;
+    HRESULT hr = m_favicons.Resolve(message.favicon, GetDPIAwareBound(16) > 16 ? 32 : 16, uri);
+    m_faviconTabId = INVALID_TAB_ID;
+    if (hr == S_OK)
+    {
+        message.favicon = uri;
+    }
+    else if (hr == S_FALSE)
+    {
+        message.favicon.clear();
+    }
+    PostMessageToControls(message);
+}
+
+// The tab which reported the icon loads it, with its cookies. The page has
+// usually loaded it already, so it comes from the tab's cache.
+void BrowserWindow::FetchFavicon(const std::wstring& source)
+{
+    TRACE_INSTANT(L"FetchFavicon", 0);
+
+    auto tab = m_tabs.find(m_faviconTabId);
+    HRESULT const hr = tab != m_tabs.end() ? tab->second->LoadFavicon(source) : E_NOT_VALID_STATE;
+    if (FAILED(hr))
+    {
+        FaviconCache::Icon icon;
+        m_favicons.Complete(source, hr, icon);
+        return;
+    }
+    m_faviconFetches[source] = GetTickCount64();
+}
+
+// The body is read, then decoded on the thread pool
+HRESULT BrowserWindow::ReadFavicon(const std::wstring& source, ICoreWebView2WebResourceResponseView* view)
+{
+    int status = 0;
+    RETURN_IF_FAILED(view->get_StatusCode(&status));
+    RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND), status != 200);
+
+    // The window may be gone once the body is read
+    HWND const hWnd = m_hWnd;
+    std::wstring const folder = m_favicons.GetFolder();
+    return view->GetContent(Callback<ICoreWebView2WebResourceResponseViewGetContentCompletedHandler>(
+        [hWnd, folder, source](HRESULT errorCode, IStream* content) -> HRESULT
+    {
+        std::unique_ptr<FetchedFavicon> fetch(new FetchedFavicon());
+        fetch->hWnd = hWnd;
+        fetch->folder = folder;
+        fetch->source = source;
+        fetch->result = FAILED(errorCode) ? errorCode : content ? ReadResponseBody(content, FaviconCache::c_maxIconSize, fetch->data) : E_FAIL;
+        ProcessFavicon(std::move(fetch));
+        return S_OK;
+    }).Get());
+}
+
+// Icons whose response never came, e.g. the page's Content Security Policy
+// blocked the fetch or the tab was closed, are loaded from the page from then
+// on
+void BrowserWindow::ExpireFaviconFetches()
+{
+    ULONGLONG const now = GetTickCount64();
+    for (auto it = m_faviconFetches.begin(); it != m_faviconFetches.end();)
+    {
+        if (now - it->second < c_faviconFetchTimeout)
+        {
+            ++it;
+            continue;
+        }
+        std::wstring const source = it->first;
+        it = m_faviconFetches.erase(it);
+        FaviconCache::Icon icon;
+        HandleFaviconFetched(source, HRESULT_FROM_WIN32(ERROR_TIMEOUT), icon);
+    }
+}
+
+// For a request of another instance of the app, the controls open the tabs
+// and answer with their ids
+void BrowserWindow::OpenTabs(size_t requestId, std::vector<std::wstring> uris)
+{
+    if (IsIconic(m_hWnd))
+    {
+        ShowWindow(m_hWnd, SW_RESTORE);
+    }
+    SetForegroundWindow(m_hWnd);
+
+    if (uris.empty())
+    {
+        m_manager.CompleteActivation(requestId, ActivationReply());
+        return;
+    }
+
+    OpenTabsMessage message;
+    message.requestId = requestId;
+    message.uris = std::move(uris);
+    PostMessageToControls(message);
+}
+
+void BrowserWindow::ScheduleSessionWrite()
+{
+    SetTimer(m_hWnd, c_sessionTimer, c_sessionWriteDelay, nullptr);
+}
+
+void BrowserWindow::ScheduleCacheWrite()
+{
+    SetTimer(m_hWnd, c_cacheTimer, c_cacheWriteDelay, nullptr);
+}
+
+// The changes collected since the last write go to the file on the thread
+// pool, the task outlives the window if it has to
+void BrowserWindow::WriteSession()
+{
+    std::unique_ptr<std::function<HRESULT()>> write(new std::function<HRESULT()>(m_session.TakeWrite()));
+    auto work = [](PTP_CALLBACK_INSTANCE, PVOID context)
+    {
+        std::unique_ptr<std::function<HRESULT()>> write(static_cast<std::function<HRESULT()>*>(context));
+        TRACE_SPAN(L"WriteSession", 0);
+        CheckFailure((*write)(), L"Can't save the session.");
+    };
+
+    if (!TrySubmitThreadpoolCallback(work, write.get(), nullptr))
+    {
+        CheckFailure((*write)(), L"Can't save the session.");
+        return;
+    }
+    write.release();
+}
+
+// Tells the controls how far the lists of URIs got. The load times are
+// collected while they load, and written once none is left.
+void BrowserWindow::UpdateLoadProgress()
+{
+    LoadScheduler::Progress progress = m_loadScheduler.GetProgress();
+    LoadProgressMessage message;
+    message.total = progress.total;
+    message.finished = progress.finished;
+    message.failed = progress.failed;
+    message.loading = progress.loading;
+    message.queued = progress.queued;
+    PostMessageToControls(message);
+
+    std::vector<LoadScheduler::Result> results = m_loadScheduler.TakeResults();
+    if (Tab::m_loadReportPath)
+    {
+        LoadScheduler::AppendReport(results, m_loadReport);
+        if (m_loadScheduler.IsIdle() && !m_loadReport.empty())
+        {
+            WriteLoadReport();
+        }
+    }
+}
+
+// Appended on the thread pool, the windows may share the file
+void BrowserWindow::WriteLoadReport()
+{
+    std::unique_ptr<std::string> report(new std::string());
+    report->swap(m_loadReport);
+    auto work = [](PTP_CALLBACK_INSTANCE, PVOID context)
+    {
+        std::unique_ptr<std::string> report(static_cast<std::string*>(context));
+        wil::unique_hfile file(CreateFileW(Tab::m_loadReportPath, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE,
+            nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+        DWORD written = 0;
+        if (!file || !WriteFile(file.get(), report->data(), static_cast<DWORD>(report->size()), &written, nullptr))
+        {
+            CheckFailure(HRESULT_FROM_WIN32(GetLastError()), L"Can't write the load report.");
+        }
+    };
+
+    if (!TrySubmitThreadpoolCallback(work, report.get(), nullptr))
+    {
+        CheckFailure(HRESULT_FROM_WIN32(GetLastError()), L"Can't write the load report.");
+        return;
+    }
+    report.release();
+}
+
+// Tabs still showing the icon get it from the cache now, or keep the page's
+// URI when it can't be cached
+void BrowserWindow::HandleFaviconFetched(const std::wstring& source, HRESULT result, FaviconCache::Icon& icon)
+{
+    TRACE_INSTANT(L"FaviconFetched", 0);
+    m_favicons.Complete(source, result, icon);
+
+    for (const auto& tab : m_tabs)
+    {
+        PageMetadataMessage message;
+        if (m_pageMetadata.GetLast(tab.first, message) && message.favicon == source)
         {
-            message = std::wstring(errorMessage);
+            PostPageMetadata(message);
         }
+    }
+}
+
+HRESULT BrowserWindow::ServeFavicon(ICoreWebView2Environment* env, ICoreWebView2WebResourceRequestedEventArgs* args)
+{
+    wil::com_ptr<ICoreWebView2WebResourceRequest> request;
+    RETURN_IF_FAILED(args->get_Request(&request));
+    wil::unique_cotaskmem_string uri;
+    RETURN_IF_FAILED(request->get_Uri(&uri));
 
-        MessageBoxW(nullptr, message.c_str(), nullptr, MB_OK);
+    std::vector<BYTE> png;
+    HRESULT hr = m_favicons.Get(uri.get(), png);
+    wil::com_ptr<ICoreWebView2WebResourceResponse> response;
+    if (FAILED(hr))
+    {
+        // Makes the image fail to load, so the UI shows its default
+        RETURN_IF_FAILED(env->CreateWebResourceResponse(nullptr, 404, L"Not Found", L"", &response));
+        return args->put_Response(response.get());
+    }
+
+    wil::com_ptr<IStream> stream;
+    stream.attach(SHCreateMemStream(png.data(), static_cast<UINT>(png.size())));
+    RETURN_IF_NULL_ALLOC(stream);
+    // The name holds a hash of the icon, so it never changes
+    RETURN_IF_FAILED(env->CreateWebResourceResponse(stream.get(), 200, L"OK",
+        L"Content-Type: image/png\r\nCache-Control: max-age=31536000, immutable", &response));
+    return args->put_Response(response.get());
+}
+
+HRESULT BrowserWindow::ServeBulk(ICoreWebView2Environment* env, LPCWSTR uri, ICoreWebView2WebResourceRequestedEventArgs* args)
+{
+    std::vector<BYTE> buffer;
+    wil::com_ptr<ICoreWebView2WebResourceResponse> response;
+    if (FAILED(m_bulkTransfer.Take(uri, buffer)))
+    {
+        RETURN_IF_FAILED(env->CreateWebResourceResponse(nullptr, 404, L"Not Found", L"", &response));
+        return args->put_Response(response.get());
     }
+
+    wil::com_ptr<IStream> stream;
+    stream.attach(SHCreateMemStream(buffer.data(), static_cast<UINT>(buffer.size())));
+    RETURN_IF_NULL_ALLOC(stream);
+    // The browser pages are file URIs, so the fetch is cross origin
+    RETURN_IF_FAILED(env->CreateWebResourceResponse(stream.get(), 200, L"OK",
+        L"Content-Type: application/octet-stream\r\nCache-Control: no-store\r\nAccess-Control-Allow-Origin: *", &response));
+    return args->put_Response(response.get());
 }
 
 int BrowserWindow::GetDPIAwareBound(int bound)
@@ -1034,6 +2829,22 @@ std::wstring BrowserWindow::GetFullPathFor(LPCWSTR relativePath)
     return pathName;
 }
 
+// Returns the current time in milliseconds since 1970 and the local date as
+// yyyymmdd, which tells visits on the same calendar day apart
+void BrowserWindow::GetVisitTime(LONGLONG* timestamp, int* day)
+{
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    ULARGE_INTEGER ticks;
+    ticks.LowPart = now.dwLowDateTime;
+    ticks.HighPart = now.dwHighDateTime;
+    *timestamp = static_cast<LONGLONG>((ticks.QuadPart - 116444736000000000ULL) / 10000);
+
+    SYSTEMTIME localTime;
+    GetLocalTime(&localTime);
+    *day = localTime.wYear * 10000 + localTime.wMonth * 100 + localTime.wDay;
+}
+
 std::wstring BrowserWindow::GetFilePathAsURI(std::wstring fullPath)
 {
     std::wstring fileURI;
@@ -1050,11 +2861,3 @@ std::wstring BrowserWindow::GetFilePathAsURI(std::wstring fullPath)
 
     return fileURI;
 }
-
-HRESULT BrowserWindow::PostJsonToWebView(const nlohmann::json jsonObj, ICoreWebView2* webview)
-{
-    std::string dump = jsonObj.dump().c_str();
-    std::wstring jsonString = to_wstring(dump);
-
-    return webview->PostWebMessageAsJson(jsonString.c_str());
-}
@@ -5,34 +5,97 @@
 #pragma once
 
 #include "framework.h"
+#include "BulkTransfer.h"
+#include "ErrorReporter.h"
+#include "FaviconCache.h"
+#include "FavoritesStore.h"
+#include "HistoryStore.h"
+#include "InternalPages.h"
+#include "LoadScheduler.h"
+#include "MessageCodec.h"
+#include "MessageDispatcher.h"
+#include "MessageQueue.h"
+#include "PageMetadataTracker.h"
+#include "RequestFilter.h"
+#include "SearchIndex.h"
+#include "SessionJournal.h"
+#include "StartupScheduler.h"
 #include "Tab.h"
+#include "TabEvictionPolicy.h"
+#include "TabLoader.h"
+#include "Trace.h"
+#include "WindowManager.h"
 
 class BrowserWindow
 {
 public:
     static const int c_uiBarHeight = 70;
-    static const int c_optionsDropdownHeight = 108;
+    static const int c_optionsDropdownHeight = 180;
     static const int c_optionsDropdownWidth = 200;
 
-    static ATOM RegisterClass(HINSTANCE hInstance, COPYDATASTRUCT const &cds);
+    explicit BrowserWindow(WindowManager& manager);
+
+    static ATOM RegisterClass(HINSTANCE hInstance);
     static LRESULT CALLBACK WndProcStatic(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
     LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
 
-    static BOOL LaunchWindow(_In_ HINSTANCE hInstance, _In_ LPCWSTR lpCmdLine, _In_ int nCmdShow);
+    static BrowserWindow* LaunchWindow(WindowManager& manager, _In_ HINSTANCE hInstance, _In_ int nCmdShow);
     static std::wstring GetAppDataDirectory();
     std::wstring GetFullPathFor(LPCWSTR relativePath);
     HRESULT HandleTabURIUpdate(size_t tabId, ICoreWebView2* webview);
-    HRESULT HandleTabHistoryUpdate(size_t tabId, ICoreWebView2* webview);
-    HRESULT HandleTabNavStarting(size_t tabId, ICoreWebView2* webview);
+    HRESULT HandleTabNavStarting(size_t tabId, ICoreWebView2* webview, ICoreWebView2NavigationStartingEventArgs* args);
     HRESULT HandleTabNavCompleted(size_t tabId, ICoreWebView2* webview, ICoreWebView2NavigationCompletedEventArgs* args);
     HRESULT HandleTabSecurityUpdate(size_t tabId, ICoreWebView2* webview, ICoreWebView2DevToolsProtocolEventReceivedEventArgs* args);
-    void HandleTabCreated(size_t tabId, bool shouldBeActive);
+    HRESULT HandleTabAudioChanged(size_t tabId, ICoreWebView2* webview);
+    HRESULT HandleTabCreated(size_t tabId, HRESULT result, ICoreWebView2Controller* host);
     HRESULT HandleTabMessageReceived(size_t tabId, ICoreWebView2* webview, ICoreWebView2WebMessageReceivedEventArgs* eventArgs);
+    HRESULT HandleTabWebResourceRequested(size_t tabId, ICoreWebView2* webview, ICoreWebView2WebResourceRequestedEventArgs* args);
+    HRESULT HandleTabWebResourceResponseReceived(size_t tabId, ICoreWebView2WebResourceResponseReceivedEventArgs* args);
     int GetDPIAwareBound(int bound);
+    void ScheduleSessionWrite();
+    void ScheduleCacheWrite();
+    // Once the controls show the tabs, see WindowManager::DispatchActivations
+    bool CanOpenTabs() const { return m_controlsReady; }
+    void OpenTabs(size_t requestId, std::vector<std::wstring> uris);
+    // Once the request filter is loaded, see WindowManager::LoadRequestFilter
+    void FilterRequests();
+    // Once the response cache is open, see WindowManager::OpenResponseCache
+    void CacheResponses();
+    // Never blocks, errorMessage has to be a string literal
     static void CheckFailure(HRESULT hr, LPCWSTR errorMessage);
 protected:
+    static const UINT_PTR c_evictionTimer = 1;
+    static const UINT c_evictionInterval = 60 * 1000;  // Milliseconds between tab measurements
+    static const UINT_PTR c_poolTimer = 2;
+    static const UINT_PTR c_sessionTimer = 3;
+    static const UINT c_sessionWriteDelay = 1000;  // Milliseconds the session changes are collected for
+    static const UINT_PTR c_cacheTimer = 4;
+    static const UINT c_cacheWriteDelay = 5000;  // Milliseconds the response cache changes are collected for
+    static const ULONGLONG c_faviconFetchTimeout = 30 * 1000;  // Milliseconds a tab gets to load an icon
+
+    // A request which waits for the server to revalidate its cached response
+    struct PendingRevalidation
+    {
+        ResponseCache::Request request;
+        std::string headers;  // Of the conditional request, without the cookies
+        wil::com_ptr<ICoreWebView2WebResourceRequestedEventArgs> args;
+        wil::com_ptr<ICoreWebView2Deferral> deferral;
+    };
+
+    // A tab on its way to another window
+    struct MovedTab
+    {
+        std::unique_ptr<Tab> tab;
+        SessionTab session;
+        bool ready = false;  // Has a controller
+    };
+
+    static ErrorReporter s_errorReporter;
+    static HWND s_errorWindow;  // Drains the reported errors
+
+    WindowManager& m_manager;
+    size_t const m_windowId;
     HINSTANCE m_hInst = nullptr;  // Current app instance
-    LPCWSTR m_lpCmdLine = nullptr;
     HWND m_hWnd = nullptr;
 
     static WCHAR s_windowClass[MAX_LOADSTRING];  // The window class name
@@ -48,28 +111,111 @@ protected:
     Microsoft::WRL::ComPtr<ICoreWebView2> m_controlsWebView;
     Microsoft::WRL::ComPtr<ICoreWebView2> m_optionsWebView;
     std::map<size_t,std::unique_ptr<Tab>> m_tabs;
-    size_t m_activeTabId = 0;
+    size_t m_activeTabId = 0;  // The tab the controls show, it may have no controller yet
+    size_t m_pendingActiveTabId = INVALID_TAB_ID;  // Shown once its controller is created
 
     EventRegistrationToken m_controlsUIMessageBrokerToken = {};  // Token for the UI message handler in controls WebView
     EventRegistrationToken m_controlsZoomToken = {};
+    EventRegistrationToken m_controlsFaviconToken = {};  // Serves the cached favicons
     EventRegistrationToken m_optionsUIMessageBrokerToken = {};  // Token for the UI message handler in options WebView
     EventRegistrationToken m_optionsZoomToken = {};
     EventRegistrationToken m_lostOptionsFocus = {};  // Token for the lost focus handler in options WebView
     Microsoft::WRL::ComPtr<ICoreWebView2WebMessageReceivedEventHandler> m_uiMessageBroker;
+    InternalPages m_internalPages;
+    HistoryStore& m_history;  // Shared by the windows, see WindowManager
+    FavoritesStore& m_favorites;
+    SearchIndex& m_search;
+    SessionJournal& m_session;
+    std::vector<SessionTab> m_adoptedTabs;  // Moved here, shown once the controls ask for their tabs
+    bool m_controlsReady = false;  // The controls asked for their tabs, messages are delivered from then on
+    BulkTransfer m_bulkTransfer;
+    Settings m_settings;
+    PageMetadataTracker m_pageMetadata;
+    FaviconCache m_favicons{ [this](const std::wstring& source) { FetchFavicon(source); } };
+    size_t m_faviconTabId = INVALID_TAB_ID;  // Whose metadata is resolved, it loads the icons the cache lacks
+    std::unordered_map<std::wstring, ULONGLONG> m_faviconFetches;  // Source URI to the time the tab was asked
+    MessageWriter m_messageWriter;
+    MessageDispatcher m_uiDispatcher;
+    MessageDispatcher m_tabDispatcher;
+    MessageQueue m_controlsQueue{ [this]() { PostMessage(m_hWnd, WM_FLUSH_MESSAGES, 0, 0); } };
+    TabLoader m_tabLoader{ Tab::m_maxConcurrentLoads, [this](size_t tabId) { return CreateTabController(tabId); } };
+    FilterRequest m_filterRequest;  // Reused for every request
+    std::string m_filterUri;
+    std::string m_filterDocumentUri;
+    std::map<size_t, PendingRevalidation> m_revalidations;  // By id
+    size_t m_nextRevalidationId = 1;
+    LoadScheduler m_loadScheduler{ Tab::m_maxBatchLoads, []() { return GetTickCount64(); }, [this](size_t tabId) { return m_tabLoader.Load(tabId, false); } };
+    std::string m_loadReport;  // Not written yet, see Tab::m_loadReportPath
+    TabControllerFactory m_controllerFactory;
+    TabControllerPool m_controllerPool{ m_controllerFactory, [this]() { SetTimer(m_hWnd, c_poolTimer, m_poolRefillDelay, nullptr); } };
+    size_t m_poolSize = 0;
+    UINT m_poolRefillDelay = 0;  // Milliseconds without tab creations before the pool is refilled
+    TabEvictionPolicy m_evictionPolicy{ static_cast<ULONGLONG>(Tab::m_memoryBudget) << 20 };
+    StartupScheduler m_startup{ &Trace::GetMicroseconds };
+    StartupScheduler::Stage m_contentEnvStage = 0;
+    StartupScheduler::Stage m_uiEnvStage = 0;
+    StartupScheduler::Stage m_controlsStage = 0;
+    StartupScheduler::Stage m_optionsStage = 0;
+    bool m_showOptions = false;  // Shown once the options WebView is created
+    bool m_showErrors = true;
 
-    BOOL InitInstance(HINSTANCE hInstance, LPCWSTR lpCmdLine, int nCmdShow);
-    HRESULT InitUIWebViews(LPCWSTR browserExecutableFolder);
+    BOOL InitInstance(HINSTANCE hInstance, int nCmdShow);
+    HRESULT CreateContentEnvironment(LPCWSTR browserExecutableFolder, LPCWSTR userDataDirectory, LPCWSTR additionalBrowserArguments);
+    HRESULT CreateUIEnvironment(LPCWSTR browserExecutableFolder);
     HRESULT CreateBrowserControlsWebView();
+    HRESULT InitBrowserControlsWebView(ICoreWebView2Controller* host);
     HRESULT CreateBrowserOptionsWebView();
-    HRESULT ClearContentCache();
+    HRESULT InitBrowserOptionsWebView(ICoreWebView2Controller* host);
+    HRESULT ClearContentCache(ICoreWebView2* webview);
     HRESULT ClearControlsCache();
-    HRESULT ClearContentCookies();
+    HRESULT ClearContentCookies(ICoreWebView2* webview);
     HRESULT ClearControlsCookies();
 
     void SetUIMessageBroker();
+    void RegisterMessageHandlers();
     HRESULT ResizeUIWebViews();
     void UpdateMinWindowSize();
-    HRESULT PostJsonToWebView(const nlohmann::json jsonData, ICoreWebView2* webview);
+    template<typename T> HRESULT PostMessageToWebView(const T& message, ICoreWebView2* webview)
+    {
+        TRACE_SPAN(L"PostMessageToWebView", T::c_message);
+        return webview->PostWebMessageAsJson(m_messageWriter.Write(message));
+    }
+    template<typename T> void PostMessageToControls(const T& message)
+    {
+        m_controlsQueue.Enqueue(T::c_message, GetTabId(message), m_messageWriter.Write(message));
+    }
+    void ForwardMessageToControls(const MessageReader& reader, size_t tabId)
+    {
+        m_controlsQueue.Enqueue(reader.GetMessageCode(), tabId, m_messageWriter.WriteForwarded(reader, tabId));
+    }
+    HRESULT GetTabNavigationState(size_t tabId, ICoreWebView2* webview, UpdateUriMessage& message);
+    void ReportErrors();
+    void PostPageMetadata(PageMetadataMessage message);
+    void FetchFavicon(const std::wstring& source);
+    HRESULT ReadFavicon(const std::wstring& source, ICoreWebView2WebResourceResponseView* view);
+    void ExpireFaviconFetches();
+    void WriteSession();
+    void UpdateLoadProgress();
+    void WriteLoadReport();
+    void HandleFaviconFetched(const std::wstring& source, HRESULT result, FaviconCache::Icon& icon);
+    HRESULT ServeFavicon(ICoreWebView2Environment* env, ICoreWebView2WebResourceRequestedEventArgs* args);
+    HRESULT ServeBulk(ICoreWebView2Environment* env, LPCWSTR uri, ICoreWebView2WebResourceRequestedEventArgs* args);
+    HRESULT LoadRequestFilter(const std::wstring& listPath);
+    HRESULT FilterTabRequest(size_t tabId, LPCWSTR source, LPCWSTR uri, ICoreWebView2WebResourceRequestedEventArgs* args);
+    HRESULT ServeCachedResponse(ICoreWebView2* webview, LPCWSTR uri, ICoreWebView2WebResourceRequest* request,
+        ICoreWebView2WebResourceRequestedEventArgs* args);
+    HRESULT SendRevalidation(size_t revalidationId, ICoreWebView2CookieList* cookies);
+    void CancelRevalidation(size_t revalidationId);
+    HRESULT PutCachedResponse(const std::string& uri, const ResponseCache::Response& response, ICoreWebView2WebResourceRequestedEventArgs* args);
+    void HandleCacheRevalidated(size_t revalidationId, HRESULT result, int status, const std::wstring& headers);
     HRESULT SwitchToTab(size_t tabId);
+    ICoreWebView2* GetActiveWebView();
+    HRESULT MoveTabToNewWindow(size_t tabId);
+    void AdoptTab(MovedTab moved);
+    void CloseWebViews();
+    HRESULT CreateTabController(size_t tabId);
+    void MeasureTab(size_t tabId);
+    void EvictTabs();
     std::wstring GetFilePathAsURI(std::wstring fullPath);
+    static void GetVisitTime(LONGLONG* timestamp, int* day);
 };
@@ -0,0 +1,154 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "BulkTransfer.h"
+#include "Utf.h"
+
+// The .invalid domain never resolves, a request which isn't served fails
+const LPCWSTR BulkTransfer::c_uriPrefix = L"https://bulk.invalid/";
+
+static const size_t c_headerSize = 16;
+static const size_t c_columnEntrySize = 16;
+
+static size_t AlignTo8(size_t offset)
+{
+    return (offset + 7) & ~static_cast<size_t>(7);
+}
+
+static void Store32(std::vector<BYTE>& buffer, size_t offset, UINT32 value)
+{
+    buffer[offset] = static_cast<BYTE>(value);
+    buffer[offset + 1] = static_cast<BYTE>(value >> 8);
+    buffer[offset + 2] = static_cast<BYTE>(value >> 16);
+    buffer[offset + 3] = static_cast<BYTE>(value >> 24);
+}
+
+// Every record visits its fields in the same order, the first one declares
+// the columns
+HRESULT BulkEncoder::GetColumn(size_t index, LPCWSTR name, UINT32 type, Column*& column)
+{
+    if (index == m_columns.size() && m_count == 0)
+    {
+        Column added;
+        added.type = type;
+        RETURN_IF_FAILED(AppendUtf8(name, wcslen(name), added.name));
+        added.offsets.push_back(0);
+        m_columns.push_back(std::move(added));
+    }
+    if (index >= m_columns.size() || m_columns[index].type != type)
+    {
+        return E_INVALIDARG;
+    }
+
+    column = &m_columns[index];
+    return S_OK;
+}
+
+HRESULT BulkEncoder::AppendValue(size_t index, LPCWSTR name, const std::wstring& value)
+{
+    Column* column = nullptr;
+    RETURN_IF_FAILED(GetColumn(index, name, c_string, column));
+    RETURN_IF_FAILED(AppendUtf8(value.c_str(), value.size(), column->strings));
+    if (column->strings.size() >= UINT32_MAX)
+    {
+        return E_OUTOFMEMORY;
+    }
+    column->offsets.push_back(static_cast<UINT32>(column->strings.size()));
+    return S_OK;
+}
+
+HRESULT BulkEncoder::AppendValue(size_t index, LPCWSTR name, double value)
+{
+    Column* column = nullptr;
+    RETURN_IF_FAILED(GetColumn(index, name, c_number, column));
+    column->numbers.push_back(value);
+    return S_OK;
+}
+
+HRESULT BulkEncoder::Finish(std::vector<BYTE>& buffer)
+{
+    size_t offset = c_headerSize + m_columns.size() * c_columnEntrySize;
+    for (const Column& column : m_columns)
+    {
+        offset += column.name.size();
+    }
+
+    std::vector<size_t> dataOffsets;
+    std::vector<size_t> dataSizes;
+    for (const Column& column : m_columns)
+    {
+        offset = AlignTo8(offset);
+        size_t const size = column.type == c_number ?
+            column.numbers.size() * sizeof(double) :
+            column.offsets.size() * sizeof(UINT32) + column.strings.size();
+        dataOffsets.push_back(offset);
+        dataSizes.push_back(size);
+        offset += size;
+    }
+    if (offset >= UINT32_MAX)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // Everything is written in place, the numbers and offsets are copied as
+    // they are on this little endian machine
+    buffer.assign(AlignTo8(offset), 0);
+    Store32(buffer, 0, c_magic);
+    Store32(buffer, 4, static_cast<UINT32>(m_count));
+    Store32(buffer, 8, static_cast<UINT32>(m_columns.size()));
+
+    size_t nameOffset = c_headerSize + m_columns.size() * c_columnEntrySize;
+    for (size_t i = 0; i < m_columns.size(); ++i)
+    {
+        const Column& column = m_columns[i];
+        size_t const entry = c_headerSize + i * c_columnEntrySize;
+        Store32(buffer, entry, column.type);
+        Store32(buffer, entry + 4, static_cast<UINT32>(column.name.size()));
+        Store32(buffer, entry + 8, static_cast<UINT32>(dataOffsets[i]));
+        Store32(buffer, entry + 12, static_cast<UINT32>(dataSizes[i]));
+        memcpy(buffer.data() + nameOffset, column.name.data(), column.name.size());
+        nameOffset += column.name.size();
+
+        BYTE* const data = buffer.data() + dataOffsets[i];
+        if (column.type == c_number)
+        {
+            memcpy(data, column.numbers.data(), column.numbers.size() * sizeof(double));
+        }
+        else
+        {
+            size_t const offsetsSize = column.offsets.size() * sizeof(UINT32);
+            memcpy(data, column.offsets.data(), offsetsSize);
+            memcpy(data + offsetsSize, column.strings.data(), column.strings.size());
+        }
+    }
+
+    m_columns.clear();
+    return S_OK;
+}
+
+std::wstring BulkTransfer::Add(std::vector<BYTE> buffer)
+{
+    if (m_buffers.size() >= c_maxBuffers)
+    {
+        m_buffers.pop_front();
+    }
+
+    std::wstring uri = c_uriPrefix + std::to_wstring(m_nextId++);
+    m_buffers.emplace_back(uri, std::move(buffer));
+    return uri;
+}
+
+HRESULT BulkTransfer::Take(LPCWSTR uri, std::vector<BYTE>& buffer)
+{
+    for (auto it = m_buffers.begin(); it != m_buffers.end(); ++it)
+    {
+        if (it->first == uri)
+        {
+            buffer = std::move(it->second);
+            m_buffers.erase(it);
+            return S_OK;
+        }
+    }
+    return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+}
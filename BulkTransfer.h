@@ -0,0 +1,121 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Large lists go to the browser pages as one binary buffer instead of a JSON
+// string. BulkEncoder lays the records out column by column, and
+// wvbrowser_ui/bulk.js reads them in place, decoding a record only when it is
+// asked for. The buffer waits in BulkTransfer until the page fetches it from
+// its URI, the web message only carries that URI.
+//
+// Layout, little endian, every section starts at a multiple of 8 bytes:
+//   header   magic, record count, column count, 0           4 x uint32
+//   columns  type, name length, data offset, data length    4 x uint32 each
+//   names    UTF-8, one after the other
+//   data     c_number  record count x float64, true and false as 1 and 0
+//            c_string  record count + 1 x uint32 offsets, then the UTF-8
+//                      bytes they point into
+class BulkEncoder
+{
+public:
+    static const UINT32 c_magic = 0x31425657;  // "WVB1"
+    static const UINT32 c_number = 1;
+    static const UINT32 c_string = 2;
+
+    // T describes its fields with a Visit() like the messages do, nested
+    // objects and arrays aren't supported
+    template<typename T> HRESULT Encode(const std::vector<T>& records, std::vector<BYTE>& buffer)
+    {
+        if (records.size() >= UINT32_MAX)
+        {
+            return E_INVALIDARG;
+        }
+
+        m_columns.clear();
+        m_count = 0;
+        for (const T& record : records)
+        {
+            RETURN_IF_FAILED(Append(record));
+        }
+        if (records.empty())
+        {
+            // Declares the columns
+            RETURN_IF_FAILED(Append(T()));
+            m_count = 0;
+            for (Column& column : m_columns)
+            {
+                column.numbers.clear();
+                column.strings.clear();
+                column.offsets.resize(1);
+            }
+        }
+        return Finish(buffer);
+    }
+
+private:
+    struct Column
+    {
+        UINT32 type;
+        std::string name;
+        std::vector<double> numbers;
+        std::string strings;
+        std::vector<UINT32> offsets;
+    };
+
+    struct FieldWriter
+    {
+        BulkEncoder* m_encoder;
+        size_t m_index;
+        HRESULT m_hr;
+
+        template<typename F> void operator()(LPCWSTR name, const F& value)
+        {
+            if (SUCCEEDED(m_hr))
+            {
+                m_hr = m_encoder->AppendValue(m_index++, name, value);
+            }
+        }
+    };
+
+    std::vector<Column> m_columns;
+    size_t m_count = 0;
+
+    template<typename T> HRESULT Append(const T& record)
+    {
+        FieldWriter writer = { this, 0, S_OK };
+        T::Visit(record, writer);
+        ++m_count;
+        return writer.m_hr;
+    }
+
+    HRESULT GetColumn(size_t index, LPCWSTR name, UINT32 type, Column*& column);
+    HRESULT AppendValue(size_t index, LPCWSTR name, const std::wstring& value);
+    HRESULT AppendValue(size_t index, LPCWSTR name, double value);
+    HRESULT AppendValue(size_t index, LPCWSTR name, int value) { return AppendValue(index, name, static_cast<double>(value)); }
+    HRESULT AppendValue(size_t index, LPCWSTR name, long long value) { return AppendValue(index, name, static_cast<double>(value)); }
+    HRESULT AppendValue(size_t index, LPCWSTR name, size_t value) { return AppendValue(index, name, static_cast<double>(value)); }
+    HRESULT AppendValue(size_t index, LPCWSTR name, bool value) { return AppendValue(index, name, value ? 1.0 : 0.0); }
+    HRESULT Finish(std::vector<BYTE>& buffer);
+};
+
+// Buffers waiting for a browser page to fetch them. A buffer is handed out
+// once, and only the most recent c_maxBuffers are kept in case a page never
+// fetches its buffer.
+class BulkTransfer
+{
+public:
+    static const LPCWSTR c_uriPrefix;  // Followed by the buffer's number
+    static const size_t c_maxBuffers = 8;
+
+    // Returns the URI to fetch the buffer from
+    std::wstring Add(std::vector<BYTE> buffer);
+    HRESULT Take(LPCWSTR uri, std::vector<BYTE>& buffer);
+
+private:
+    std::deque<std::pair<std::wstring, std::vector<BYTE>>> m_buffers;  // Oldest first
+    ULONGLONG m_nextId = 1;
+};
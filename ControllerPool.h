@@ -0,0 +1,165 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Keeps a few hidden controllers created ahead of time, so a tab can claim
+// one synchronously instead of waiting for CreateCoreWebView2Controller.
+// Taken controllers are replaced one at a time once scheduleRefill has
+// decided the browser is idle and calls Refill().
+//
+// Controllers are only created through the Factory, the pool itself knows
+// nothing about WebView2.
+template<typename Controller>
+class ControllerPool
+{
+public:
+    class Factory
+    {
+    public:
+        virtual ~Factory() {}
+
+        // Calls done with a hidden controller, or the error. done must not
+        // be called anymore once the pool is destroyed.
+        virtual HRESULT Create(std::function<void(HRESULT, const Controller&)> done) = 0;
+        virtual void Destroy(const Controller& controller) = 0;
+        virtual ULONGLONG GetTime() = 0;  // Milliseconds
+    };
+
+    struct Statistics
+    {
+        ULONGLONG claims = 0;
+        ULONGLONG hits = 0;
+        ULONGLONG created = 0;
+        ULONGLONG failed = 0;
+        ULONGLONG creationMilliseconds = 0;  // Total of all creations
+    };
+
+    // scheduleRefill is called whenever the pool has room for another
+    // controller and nothing is being created
+    ControllerPool(Factory& factory, std::function<void()> scheduleRefill) :
+        m_factory(factory), m_scheduleRefill(std::move(scheduleRefill))
+    {
+    }
+
+    // Creations still in flight are the Factory's to clean up
+    ~ControllerPool()
+    {
+        for (const Controller& controller : m_controllers)
+        {
+            m_factory.Destroy(controller);
+        }
+    }
+
+    void SetSize(size_t size)
+    {
+        m_size = size;
+        while (m_controllers.size() > m_size)
+        {
+            m_factory.Destroy(m_controllers.back());
+            m_controllers.pop_back();
+        }
+        ScheduleRefill();
+    }
+
+    bool Claim(Controller& controller)
+    {
+        ++m_statistics.claims;
+        if (m_controllers.empty())
+        {
+            // Also retries after a failed creation
+            ScheduleRefill();
+            return false;
+        }
+
+        ++m_statistics.hits;
+        controller = std::move(m_controllers.front());
+        m_controllers.pop_front();
+        ScheduleRefill();
+        return true;
+    }
+
+    HRESULT Refill()
+    {
+        if (m_creating || m_controllers.size() >= m_size)
+        {
+            return S_OK;
+        }
+
+        m_creating = true;
+        ULONGLONG const start = m_factory.GetTime();
+        HRESULT hr = m_factory.Create([this, start](HRESULT result, const Controller& controller)
+        {
+            m_creating = false;
+            if (FAILED(result))
+            {
+                // Don't retry right away, the next claim schedules a refill
+                ++m_statistics.failed;
+                return;
+            }
+
+            ++m_statistics.created;
+            m_statistics.creationMilliseconds += m_factory.GetTime() - start;
+            if (m_controllers.size() < m_size)
+            {
+                m_controllers.push_back(controller);
+                ScheduleRefill();
+            }
+            else
+            {
+                m_factory.Destroy(controller);
+            }
+        });
+        if (FAILED(hr))
+        {
+            m_creating = false;
+            ++m_statistics.failed;
+        }
+        return hr;
+    }
+
+    size_t GetCount() const { return m_controllers.size(); }
+    const Statistics& GetStatistics() const { return m_statistics; }
+
+    // Each hit saves about as long as creating a controller takes
+    ULONGLONG GetSavedMilliseconds() const
+    {
+        if (m_statistics.created == 0)
+        {
+            return 0;
+        }
+        return m_statistics.hits * (m_statistics.creationMilliseconds / m_statistics.created);
+    }
+
+    void DumpStatistics() const
+    {
+        WCHAR line[256];
+        StringCchPrintfW(line, _countof(line),
+            L"Controller pool: size %zu, claims %llu, hits %llu (%llu%%), created %llu, failed %llu, mean creation %llu ms, saved %llu ms\n",
+            m_size, m_statistics.claims, m_statistics.hits,
+            m_statistics.claims ? m_statistics.hits * 100 / m_statistics.claims : 0,
+            m_statistics.created, m_statistics.failed,
+            m_statistics.created ? m_statistics.creationMilliseconds / m_statistics.created : 0,
+            GetSavedMilliseconds());
+        OutputDebugString(line);
+    }
+
+private:
+    Factory& m_factory;
+    std::function<void()> m_scheduleRefill;
+    std::deque<Controller> m_controllers;
+    size_t m_size = 0;
+    bool m_creating = false;
+    Statistics m_statistics;
+
+    void ScheduleRefill()
+    {
+        if (!m_creating && m_controllers.size() < m_size)
+        {
+            m_scheduleRefill();
+        }
+    }
+};
@@ -0,0 +1,288 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ErrorReporter.h"
+#include "Utf.h"
+
+ErrorReporter::ErrorReporter(std::function<ULONGLONG()> getTime, std::function<void()> scheduleDrain) :
+    m_getTime(std::move(getTime)), m_scheduleDrain(std::move(scheduleDrain)),
+    m_enqueuePosition(0), m_drainScheduled(false), m_posted(0), m_dropped(0)
+{
+    static_assert((c_queueSize & (c_queueSize - 1)) == 0, "The queue size must be a power of two");
+    for (size_t i = 0; i < c_queueSize; ++i)
+    {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+HRESULT ErrorReporter::OpenLog(LPCWSTR path)
+{
+    m_logPath = path;
+    m_log.reset(CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!m_log)
+    {
+        RETURN_LAST_ERROR();
+    }
+
+    LARGE_INTEGER size;
+    LARGE_INTEGER zero = {};
+    RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(m_log.get(), zero, &size, FILE_END));
+    m_logSize = size.QuadPart;
+    return S_OK;
+}
+
+void ErrorReporter::Post(HRESULT hr, LPCWSTR site)
+{
+    m_posted.fetch_add(1, std::memory_order_relaxed);
+
+    size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;)
+    {
+        cell = &m_cells[position & (c_queueSize - 1)];
+        size_t const sequence = cell->sequence.load(std::memory_order_acquire);
+        if (sequence == position)
+        {
+            if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (sequence < position)
+        {
+            // Still filled from the previous round
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            position = m_enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->hr = hr;
+    cell->site = site;
+    cell->time = m_getTime();
+    cell->sequence.store(position + 1, std::memory_order_release);
+
+    if (!m_drainScheduled.exchange(true, std::memory_order_acq_rel))
+    {
+        m_scheduleDrain();
+    }
+}
+
+void ErrorReporter::Drain(const std::function<void(const Report&)>& notify)
+{
+    // Errors posted from now on schedule another drain
+    m_drainScheduled.store(false, std::memory_order_release);
+
+    for (;;)
+    {
+        Cell& cell = m_cells[m_dequeuePosition & (c_queueSize - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != m_dequeuePosition + 1)
+        {
+            break;
+        }
+
+        HRESULT const hr = cell.hr;
+        LPCWSTR const site = cell.site;
+        ULONGLONG const time = cell.time;
+        cell.sequence.store(m_dequeuePosition + c_queueSize, std::memory_order_release);
+        ++m_dequeuePosition;
+
+        Process(hr, site, time, notify);
+    }
+
+    ULONGLONG const now = m_getTime();
+    ULONGLONG const dropped = m_dropped.load(std::memory_order_relaxed);
+    if (dropped != m_loggedDropped && TakeToken(now))
+    {
+        WriteDropped(now, dropped - m_loggedDropped);
+        m_loggedDropped = dropped;
+    }
+
+    // Summarize the errors whose window is over
+    for (auto it = m_errors.begin(); it != m_errors.end();)
+    {
+        Error& error = it->second;
+        if (now < error.windowStart + c_repeatWindow)
+        {
+            ++it;
+        }
+        else if (error.pending == 0)
+        {
+            it = m_errors.erase(it);
+        }
+        else if (TakeToken(now))
+        {
+            Write({ it->first.hr, it->first.site, error.last, error.pending, true });
+            it = m_errors.erase(it);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+void ErrorReporter::Flush()
+{
+    Drain([](const Report&) {});
+
+    for (const auto& entry : m_errors)
+    {
+        if (entry.second.pending != 0)
+        {
+            Write({ entry.first.hr, entry.first.site, entry.second.last, entry.second.pending, true });
+        }
+    }
+    m_errors.clear();
+
+    ULONGLONG const dropped = m_dropped.load(std::memory_order_relaxed);
+    if (dropped != m_loggedDropped)
+    {
+        WriteDropped(m_getTime(), dropped - m_loggedDropped);
+        m_loggedDropped = dropped;
+    }
+}
+
+ErrorReporter::Statistics ErrorReporter::GetStatistics() const
+{
+    Statistics statistics;
+    statistics.posted = m_posted.load(std::memory_order_relaxed);
+    statistics.dropped = m_dropped.load(std::memory_order_relaxed);
+    statistics.reported = m_reported;
+    statistics.suppressed = m_suppressed;
+    return statistics;
+}
+
+void ErrorReporter::Process(HRESULT hr, LPCWSTR site, ULONGLONG time, const std::function<void(const Report&)>& notify)
+{
+    auto it = m_errors.find({ hr, site });
+    if (it != m_errors.end())
+    {
+        Error& error = it->second;
+        if (time < error.windowStart + c_repeatWindow || !TakeToken(time))
+        {
+            ++error.pending;
+            error.last = time;
+            ++m_suppressed;
+            return;
+        }
+
+        // The window is over, the summary goes first and a new one starts
+        if (error.pending != 0)
+        {
+            Write({ hr, site, error.last, error.pending, true });
+        }
+        error.windowStart = time;
+        error.last = time;
+        error.pending = 0;
+    }
+    else
+    {
+        Error& error = m_errors[{ hr, site }];
+        error.windowStart = time;
+        error.last = time;
+        error.pending = 0;
+        if (!TakeToken(time))
+        {
+            error.pending = 1;
+            ++m_suppressed;
+            return;
+        }
+    }
+
+    Report const report = { hr, site, time, 1, false };
+    Write(report);
+    notify(report);
+}
+
+// Token bucket, a token is added every c_reportInterval up to c_burst
+bool ErrorReporter::TakeToken(ULONGLONG now)
+{
+    if (now > m_tokenTime)
+    {
+        ULONGLONG const added = (now - m_tokenTime) / c_reportInterval;
+        if (m_tokens + added >= c_burst)
+        {
+            m_tokens = c_burst;
+            m_tokenTime = now;
+        }
+        else
+        {
+            m_tokens += added;
+            m_tokenTime += added * c_reportInterval;
+        }
+    }
+
+    if (m_tokens == 0)
+    {
+        return false;
+    }
+    --m_tokens;
+    return true;
+}
+
+void ErrorReporter::Write(const Report& report)
+{
+    ++m_reported;
+
+    WCHAR line[256];
+    StringCchPrintfW(line, _countof(line), L"Error 0x%08X %s (%llu)\n", report.hr, report.site, report.count);
+    OutputDebugString(line);
+
+    char fields[128];
+    StringCchPrintfA(fields, _countof(fields), "{\"time\":%llu,\"hr\":\"0x%08X\",\"count\":%llu,\"repeat\":%s,\"site\":\"",
+        report.time, static_cast<unsigned int>(report.hr), report.count, report.isRepeat ? "true" : "false");
+    m_line = fields;
+
+    // Quotes and backslashes are ASCII, so they can be escaped in UTF-8
+    std::string site;
+    AppendUtf8(report.site, wcslen(report.site), site);
+    for (char c : site)
+    {
+        if (c == '"' || c == '\\')
+        {
+            m_line += '\\';
+        }
+        m_line += c;
+    }
+    m_line += "\"}\n";
+    AppendLine();
+}
+
+void ErrorReporter::WriteDropped(ULONGLONG now, ULONGLONG dropped)
+{
+    char fields[128];
+    StringCchPrintfA(fields, _countof(fields), "{\"time\":%llu,\"dropped\":%llu}\n", now, dropped);
+    m_line = fields;
+    AppendLine();
+}
+
+// The log is best effort, failing to write it is not reported
+void ErrorReporter::AppendLine()
+{
+    if (!m_log)
+    {
+        return;
+    }
+
+    if (m_logSize + m_line.size() > c_maxLogSize)
+    {
+        m_log.reset();
+        std::wstring oldPath = m_logPath + L".old";
+        MoveFileExW(m_logPath.c_str(), oldPath.c_str(), MOVEFILE_REPLACE_EXISTING);
+        if (FAILED(OpenLog(m_logPath.c_str())))
+        {
+            return;
+        }
+    }
+
+    DWORD written = 0;
+    if (WriteFile(m_log.get(), m_line.data(), static_cast<DWORD>(m_line.size()), &written, nullptr))
+    {
+        m_logSize += written;
+    }
+}
@@ -0,0 +1,117 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Collects failures without ever blocking the thread they happen on. Post()
+// puts the error into a bounded lock-free queue, and drops it when the queue
+// is full. Drain() runs later on one thread, writes the errors to a log file
+// with one JSON object per line, and passes them on to be shown.
+//
+// An error is identified by its HRESULT and site. It is reported once, then
+// its repeats are only counted for c_repeatWindow and reported as a single
+// summary. At most c_burst reports are written at once and one more every
+// c_reportInterval, what is held back is included in the next summary.
+class ErrorReporter
+{
+public:
+    struct Report
+    {
+        HRESULT hr;
+        LPCWSTR site;     // What failed, a string literal
+        ULONGLONG time;   // Milliseconds since 1970 of the last occurrence
+        ULONGLONG count;  // Occurrences covered by this report
+        bool isRepeat;    // Summarizes occurrences after the first one
+    };
+
+    struct Statistics
+    {
+        ULONGLONG posted = 0;
+        ULONGLONG dropped = 0;     // The queue was full
+        ULONGLONG reported = 0;    // Lines written, first occurrences and summaries
+        ULONGLONG suppressed = 0;  // Only counted in a summary, repeats or over the rate limit
+    };
+
+    static const size_t c_queueSize = 1024;  // A power of two
+    static const ULONGLONG c_repeatWindow = 10 * 1000;  // Milliseconds
+    static const ULONGLONG c_burst = 20;
+    static const ULONGLONG c_reportInterval = 100;  // Milliseconds
+    static const ULONGLONG c_maxLogSize = 1 << 20;  // The log is rotated beyond this size
+
+    // getTime returns milliseconds since 1970 and is called on any thread.
+    // scheduleDrain is called on the posting thread when the first error is
+    // queued after a drain.
+    ErrorReporter(std::function<ULONGLONG()> getTime, std::function<void()> scheduleDrain);
+
+    HRESULT OpenLog(LPCWSTR path);
+
+    // Thread safe, never blocks
+    void Post(HRESULT hr, LPCWSTR site);
+
+    // notify gets the first occurrence of every error which is reported
+    void Drain(const std::function<void(const Report&)>& notify);
+    // Reports the pending repeats, regardless of the window and the rate limit
+    void Flush();
+
+    Statistics GetStatistics() const;
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        HRESULT hr;
+        LPCWSTR site;
+        ULONGLONG time;
+    };
+
+    struct Key
+    {
+        HRESULT hr;
+        LPCWSTR site;
+
+        bool operator<(const Key& other) const
+        {
+            return hr != other.hr ? hr < other.hr : wcscmp(site, other.site) < 0;
+        }
+    };
+
+    struct Error
+    {
+        ULONGLONG windowStart;
+        ULONGLONG last;
+        ULONGLONG pending;  // Occurrences not reported yet
+    };
+
+    std::function<ULONGLONG()> m_getTime;
+    std::function<void()> m_scheduleDrain;
+
+    // Bounded multi-producer queue, every cell's sequence tells whether it
+    // is free or filled for the current round
+    Cell m_cells[c_queueSize];
+    std::atomic<size_t> m_enqueuePosition;
+    size_t m_dequeuePosition = 0;
+    std::atomic<bool> m_drainScheduled;
+    std::atomic<ULONGLONG> m_posted;
+    std::atomic<ULONGLONG> m_dropped;
+
+    std::map<Key, Error> m_errors;
+    ULONGLONG m_tokens = c_burst;
+    ULONGLONG m_tokenTime = 0;
+    ULONGLONG m_loggedDropped = 0;
+    ULONGLONG m_reported = 0;
+    ULONGLONG m_suppressed = 0;
+
+    std::wstring m_logPath;
+    wil::unique_hfile m_log;
+    ULONGLONG m_logSize = 0;
+    std::string m_line;
+
+    void Process(HRESULT hr, LPCWSTR site, ULONGLONG time, const std::function<void(const Report&)>& notify);
+    bool TakeToken(ULONGLONG now);
+    void Write(const Report& report);
+    void WriteDropped(ULONGLONG now, ULONGLONG dropped);
+    void AppendLine();
+};
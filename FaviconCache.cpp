@@ -0,0 +1,250 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "FaviconCache.h"
+#include "FaviconCodec.h"
+
+const UINT FaviconCache::c_sizes[FaviconCache::c_sizeCount] = { 16, 32 };
+// The .invalid domain never resolves, a request which isn't served fails
+const LPCWSTR FaviconCache::c_uriPrefix = L"https://favicon.invalid/";
+
+static const size_t c_hashLength = 16;
+static const size_t c_maxFileSize = 1 << 20;
+
+FaviconCache::FaviconCache(std::function<void(const std::wstring& source)> fetch) :
+    m_fetch(std::move(fetch))
+{
+}
+
+HRESULT FaviconCache::Process(const std::wstring& folder, const BYTE* data, size_t size, Icon& icon)
+{
+    // 64 bit FNV-1a of the fetched bytes
+    ULONGLONG hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    }
+    WCHAR hex[c_hashLength + 1];
+    StringCchPrintfW(hex, _countof(hex), L"%016llx", hash);
+    icon.hash = hex;
+
+    IconBitmap decoded;
+    for (size_t i = 0; i < c_sizeCount; ++i)
+    {
+        // ICO files may hold a separate image for every size
+        IconBitmap resized;
+        if (i == 0 || !FaviconCodec::IsPng(data, size))
+        {
+            RETURN_IF_FAILED(FaviconCodec::Decode(data, size, c_sizes[i], decoded));
+        }
+        FaviconCodec::Resize(decoded, c_sizes[i], resized);
+        FaviconCodec::EncodePng(resized, icon.png[i]);
+
+        if (!folder.empty())
+        {
+            RETURN_IF_FAILED(SaveFile(folder + L"\\" + GetName(icon.hash, c_sizes[i]), icon.png[i]));
+        }
+    }
+    return S_OK;
+}
+
+HRESULT FaviconCache::Resolve(const std::wstring& source, UINT size, std::wstring& uri)
+{
+    if (source.compare(0, 7, L"http://") != 0 && source.compare(0, 8, L"https://") != 0)
+    {
+        return E_NOTIMPL;
+    }
+
+    auto it = m_sources.find(source);
+    if (it == m_sources.end())
+    {
+        // Forgets what is done rather than growing without bound
+        if (m_sources.size() >= c_maxSources)
+        {
+            for (auto entry = m_sources.begin(); entry != m_sources.end();)
+            {
+                entry = entry->second.state == State::Fetching ? std::next(entry) : m_sources.erase(entry);
+            }
+        }
+
+        m_sources[source].state = State::Fetching;
+        m_fetch(source);
+        // The fetch may have completed right away
+        it = m_sources.find(source);
+    }
+
+    switch (it->second.state)
+    {
+    case State::Fetching:
+        return S_FALSE;
+    case State::Failed:
+        return E_FAIL;
+    case State::Ready:
+        break;
+    }
+
+    UINT keptSize = c_sizes[c_sizeCount - 1];
+    for (UINT candidate : c_sizes)
+    {
+        if (candidate >= size)
+        {
+            keptSize = candidate;
+            break;
+        }
+    }
+    uri = c_uriPrefix + GetName(it->second.hash, keptSize);
+    return S_OK;
+}
+
+void FaviconCache::Complete(const std::wstring& source, HRESULT result, Icon& icon)
+{
+    Source& entry = m_sources[source];
+    if (FAILED(result))
+    {
+        entry.state = State::Failed;
+        ++m_statistics.failed;
+        return;
+    }
+
+    entry.state = State::Ready;
+    entry.hash = icon.hash;
+    ++m_statistics.fetched;
+    for (size_t i = 0; i < c_sizeCount; ++i)
+    {
+        Remember(GetName(icon.hash, c_sizes[i]), std::move(icon.png[i]));
+    }
+}
+
+HRESULT FaviconCache::Get(LPCWSTR uri, std::vector<BYTE>& png)
+{
+    size_t const prefixLength = wcslen(c_uriPrefix);
+    if (wcsncmp(uri, c_uriPrefix, prefixLength) != 0)
+    {
+        return E_INVALIDARG;
+    }
+    std::wstring const name = uri + prefixLength;
+    if (!IsValidName(name))
+    {
+        return E_INVALIDARG;
+    }
+
+    auto it = m_recentByName.find(name);
+    if (it != m_recentByName.end())
+    {
+        m_recent.splice(m_recent.begin(), m_recent, it->second);
+        png = it->second->second;
+        ++m_statistics.memoryHits;
+        return S_OK;
+    }
+
+    if (m_folder.empty() || FAILED(LoadFile(m_folder + L"\\" + name, png)))
+    {
+        ++m_statistics.misses;
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
+    ++m_statistics.folderHits;
+    Remember(name, png);
+    return S_OK;
+}
+
+FaviconCache::Statistics FaviconCache::GetStatistics() const
+{
+    return m_statistics;
+}
+
+std::wstring FaviconCache::GetName(const std::wstring& hash, UINT size)
+{
+    return hash + L"-" + std::to_wstring(size) + L".png";
+}
+
+// Only names this cache makes can be requested, so a URI can't reach
+// another file
+bool FaviconCache::IsValidName(const std::wstring& name)
+{
+    if (name.size() <= c_hashLength || name[c_hashLength] != L'-')
+    {
+        return false;
+    }
+    for (size_t i = 0; i < c_hashLength; ++i)
+    {
+        if (!((name[i] >= L'0' && name[i] <= L'9') || (name[i] >= L'a' && name[i] <= L'f')))
+        {
+            return false;
+        }
+    }
+    for (UINT size : c_sizes)
+    {
+        if (name.compare(c_hashLength, std::wstring::npos, GetName(std::wstring(), size)) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Concurrent writers of the same icon write the same bytes, each through its
+// own temporary file
+HRESULT FaviconCache::SaveFile(const std::wstring& path, const std::vector<BYTE>& data)
+{
+    std::wstring const temporaryPath = path + L"." + std::to_wstring(GetCurrentThreadId()) + L".tmp";
+    {
+        wil::unique_hfile file(CreateFileW(temporaryPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file)
+        {
+            RETURN_LAST_ERROR();
+        }
+
+        DWORD written = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(::WriteFile(file.get(), data.data(), static_cast<DWORD>(data.size()), &written, nullptr));
+        if (written != data.size())
+        {
+            return E_FAIL;
+        }
+    }
+    RETURN_IF_WIN32_BOOL_FALSE(MoveFileExW(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING));
+    return S_OK;
+}
+
+HRESULT FaviconCache::LoadFile(const std::wstring& path, std::vector<BYTE>& data)
+{
+    wil::unique_hfile file(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file)
+    {
+        RETURN_LAST_ERROR();
+    }
+
+    LARGE_INTEGER size;
+    RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(file.get(), &size));
+    if (size.QuadPart > static_cast<LONGLONG>(c_maxFileSize))
+    {
+        return E_INVALIDARG;
+    }
+
+    data.resize(static_cast<size_t>(size.QuadPart));
+    DWORD read = 0;
+    RETURN_IF_WIN32_BOOL_FALSE(::ReadFile(file.get(), data.data(), static_cast<DWORD>(data.size()), &read, nullptr));
+    return read == data.size() ? S_OK : E_FAIL;
+}
+
+void FaviconCache::Remember(const std::wstring& name, std::vector<BYTE> png)
+{
+    auto it = m_recentByName.find(name);
+    if (it != m_recentByName.end())
+    {
+        m_statistics.memoryUsed -= it->second->second.size();
+        m_recent.erase(it->second);
+        m_recentByName.erase(it);
+    }
+
+    m_statistics.memoryUsed += png.size();
+    m_recent.emplace_front(name, std::move(png));
+    m_recentByName[name] = m_recent.begin();
+
+    while (m_statistics.memoryUsed > c_memoryBudget && m_recent.size() > 1)
+    {
+        m_statistics.memoryUsed -= m_recent.back().second.size();
+        m_recentByName.erase(m_recent.back().first);
+        m_recent.pop_back();
+    }
+}
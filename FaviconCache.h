@@ -0,0 +1,96 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Fetches every favicon once and keeps it at the sizes the UI shows, so the
+// tab strip, history and favorites share one copy instead of loading the
+// page's icon again each. Icons are named after a hash of the fetched bytes,
+// so the same icon under several URIs is stored once and a cache URI stays
+// valid across sessions. The PNGs live in a folder, and the most recently
+// used ones also in memory, up to c_memoryBudget bytes.
+//
+// Resolve() and everything but Process() run on the UI thread. Process() is
+// meant to run on a worker thread once the icon is fetched, Complete() then
+// hands the result back.
+class FaviconCache
+{
+public:
+    static const size_t c_sizeCount = 2;
+    static const UINT c_sizes[c_sizeCount];  // Pixels, ascending
+    static const LPCWSTR c_uriPrefix;        // Followed by <hash>-<size>.png
+
+    static const size_t c_maxIconSize = 256 * 1024;  // Fetched bytes
+    static const size_t c_memoryBudget = 4 << 20;
+    static const size_t c_maxSources = 4096;  // Remembered source URIs
+
+    struct Icon
+    {
+        std::wstring hash;
+        std::vector<BYTE> png[c_sizeCount];
+    };
+
+    struct Statistics
+    {
+        ULONGLONG memoryHits = 0;
+        ULONGLONG folderHits = 0;
+        ULONGLONG misses = 0;
+        ULONGLONG fetched = 0;
+        ULONGLONG failed = 0;
+        size_t memoryUsed = 0;
+    };
+
+    // Thread safe. Decodes the fetched bytes and writes the PNG of every
+    // size to folder, unless folder is empty.
+    static HRESULT Process(const std::wstring& folder, const BYTE* data, size_t size, Icon& icon);
+
+    // fetch is called once per source URI, its outcome goes to Complete()
+    explicit FaviconCache(std::function<void(const std::wstring& source)> fetch);
+
+    // Icons are only kept in memory until a folder is set
+    void SetFolder(const std::wstring& folder) { m_folder = folder; }
+    const std::wstring& GetFolder() const { return m_folder; }
+
+    // Returns S_OK and the cache URI of the icon at source, S_FALSE while it
+    // is fetched, or an error when it can't be cached and source has to be
+    // used as is. size is rounded up to the next size kept.
+    HRESULT Resolve(const std::wstring& source, UINT size, std::wstring& uri);
+    void Complete(const std::wstring& source, HRESULT result, Icon& icon);
+
+    // Returns the PNG behind a cache URI
+    HRESULT Get(LPCWSTR uri, std::vector<BYTE>& png);
+
+    Statistics GetStatistics() const;
+
+private:
+    enum class State
+    {
+        Fetching,
+        Ready,
+        Failed,
+    };
+
+    struct Source
+    {
+        State state;
+        std::wstring hash;
+    };
+
+    typedef std::list<std::pair<std::wstring, std::vector<BYTE>>> RecentList;
+
+    std::function<void(const std::wstring&)> m_fetch;
+    std::wstring m_folder;
+    std::unordered_map<std::wstring, Source> m_sources;
+    RecentList m_recent;  // Most recently used first
+    std::unordered_map<std::wstring, RecentList::iterator> m_recentByName;
+    Statistics m_statistics;
+
+    static std::wstring GetName(const std::wstring& hash, UINT size);
+    static bool IsValidName(const std::wstring& name);
+    static HRESULT SaveFile(const std::wstring& path, const std::vector<BYTE>& data);
+    static HRESULT LoadFile(const std::wstring& path, std::vector<BYTE>& data);
+    void Remember(const std::wstring& name, std::vector<BYTE> png);
+};
@@ -0,0 +1,1085 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "FaviconCodec.h"
+
+static const BYTE c_pngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+static UINT ReadBigEndian32(const BYTE* p)
+{
+    return (static_cast<UINT>(p[0]) << 24) | (static_cast<UINT>(p[1]) << 16) | (static_cast<UINT>(p[2]) << 8) | p[3];
+}
+
+static UINT ReadLittleEndian16(const BYTE* p)
+{
+    return p[0] | (static_cast<UINT>(p[1]) << 8);
+}
+
+static UINT ReadLittleEndian32(const BYTE* p)
+{
+    return ReadLittleEndian16(p) | (ReadLittleEndian16(p + 2) << 16);
+}
+
+static void AppendBigEndian32(std::vector<BYTE>& out, UINT value)
+{
+    out.push_back(static_cast<BYTE>(value >> 24));
+    out.push_back(static_cast<BYTE>(value >> 16));
+    out.push_back(static_cast<BYTE>(value >> 8));
+    out.push_back(static_cast<BYTE>(value));
+}
+
+static UINT UpdateCrc32(UINT crc, const BYTE* data, size_t size)
+{
+    struct Table
+    {
+        UINT entries[256];
+        Table()
+        {
+            for (UINT n = 0; n < 256; ++n)
+            {
+                UINT c = n;
+                for (int k = 0; k < 8; ++k)
+                {
+                    c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                entries[n] = c;
+            }
+        }
+    };
+    static const Table table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static UINT UpdateAdler32(UINT adler, const BYTE* data, size_t size)
+{
+    UINT a = adler & 0xFFFF;
+    UINT b = adler >> 16;
+    while (size > 0)
+    {
+        // Sums stay below 2^32 for 5552 bytes
+        size_t const block = std::min<size_t>(size, 5552);
+        for (size_t i = 0; i < block; ++i)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += block;
+        size -= block;
+    }
+    return (b << 16) | a;
+}
+
+// Decompresses a zlib stream (RFC 1950 and 1951), at most maxSize bytes
+class Inflater
+{
+public:
+    Inflater(const BYTE* data, size_t size) : m_data(data), m_size(size) {}
+
+    HRESULT Run(size_t maxSize, std::vector<BYTE>& out)
+    {
+        if (m_size < 6)
+        {
+            return E_INVALIDARG;
+        }
+        // Deflate, no preset dictionary
+        UINT const cmf = m_data[0];
+        UINT const flags = m_data[1];
+        if ((cmf & 0x0F) != 8 || (cmf >> 4) > 7 || ((cmf << 8) | flags) % 31 != 0 || (flags & 0x20))
+        {
+            return E_INVALIDARG;
+        }
+        m_position = 2;
+
+        out.clear();
+        out.reserve(maxSize);
+        m_out = &out;
+        m_maxSize = maxSize;
+
+        bool last = false;
+        while (!last)
+        {
+            UINT header;
+            RETURN_IF_FAILED(ReadBits(3, header));
+            last = (header & 1) != 0;
+            switch (header >> 1)
+            {
+            case 0:
+                RETURN_IF_FAILED(Stored());
+                break;
+            case 1:
+                RETURN_IF_FAILED(Fixed());
+                break;
+            case 2:
+                RETURN_IF_FAILED(Dynamic());
+                break;
+            default:
+                return E_INVALIDARG;
+            }
+        }
+
+        // The checksum follows on the next byte boundary
+        AlignToByte();
+        if (m_position + 4 > m_size || ReadBigEndian32(m_data + m_position) != UpdateAdler32(1, out.data(), out.size()))
+        {
+            return E_INVALIDARG;
+        }
+        return S_OK;
+    }
+
+private:
+    static const int c_maxBits = 15;
+    static const int c_maxLengthCodes = 286;
+    static const int c_maxDistanceCodes = 30;
+
+    static const int c_fastBits = 9;
+
+    // Canonical Huffman code, the number of codes of every length and the
+    // symbols ordered by code. Codes up to c_fastBits long are also looked
+    // up directly by the next c_fastBits input bits, an entry holds the
+    // symbol shifted by 4 and the code length, or 0.
+    struct Huffman
+    {
+        short count[c_maxBits + 1];
+        short symbol[288];
+        unsigned short fast[1 << c_fastBits];
+    };
+
+    const BYTE* m_data;
+    size_t m_size;
+    size_t m_position = 0;
+    UINT m_bitBuffer = 0;
+    int m_bitCount = 0;
+    std::vector<BYTE>* m_out = nullptr;
+    size_t m_maxSize = 0;
+
+    HRESULT ReadBits(int count, UINT& value)
+    {
+        UINT bits = m_bitBuffer;
+        while (m_bitCount < count)
+        {
+            if (m_position >= m_size)
+            {
+                return E_INVALIDARG;
+            }
+            bits |= static_cast<UINT>(m_data[m_position++]) << m_bitCount;
+            m_bitCount += 8;
+        }
+        value = bits & ((1u << count) - 1);
+        m_bitBuffer = bits >> count;
+        m_bitCount -= count;
+        return S_OK;
+    }
+
+    // Drops the bits left of the current byte, and gives back the whole
+    // bytes fetched ahead
+    void AlignToByte()
+    {
+        m_position -= m_bitCount / 8;
+        m_bitBuffer = 0;
+        m_bitCount = 0;
+    }
+
+    HRESULT Stored()
+    {
+        AlignToByte();
+        if (m_position + 4 > m_size)
+        {
+            return E_INVALIDARG;
+        }
+        UINT const length = ReadLittleEndian16(m_data + m_position);
+        if ((~ReadLittleEndian16(m_data + m_position + 2) & 0xFFFF) != length)
+        {
+            return E_INVALIDARG;
+        }
+        m_position += 4;
+        if (m_position + length > m_size || m_out->size() + length > m_maxSize)
+        {
+            return E_INVALIDARG;
+        }
+        m_out->insert(m_out->end(), m_data + m_position, m_data + m_position + length);
+        m_position += length;
+        return S_OK;
+    }
+
+    static HRESULT Build(Huffman& huffman, const short* lengths, int count)
+    {
+        memset(huffman.count, 0, sizeof(huffman.count));
+        memset(huffman.fast, 0, sizeof(huffman.fast));
+        for (int symbol = 0; symbol < count; ++symbol)
+        {
+            ++huffman.count[lengths[symbol]];
+        }
+        if (huffman.count[0] == count)
+        {
+            return S_OK;  // No codes, decoding fails if one is needed
+        }
+
+        // Over-subscribed lengths can't form a prefix code
+        int left = 1;
+        for (int length = 1; length <= c_maxBits; ++length)
+        {
+            left <<= 1;
+            left -= huffman.count[length];
+            if (left < 0)
+            {
+                return E_INVALIDARG;
+            }
+        }
+
+        short offsets[c_maxBits + 1];
+        offsets[1] = 0;
+        for (int length = 1; length < c_maxBits; ++length)
+        {
+            offsets[length + 1] = offsets[length] + huffman.count[length];
+        }
+        for (int symbol = 0; symbol < count; ++symbol)
+        {
+            if (lengths[symbol] != 0)
+            {
+                huffman.symbol[offsets[lengths[symbol]]++] = static_cast<short>(symbol);
+            }
+        }
+
+        // Codes are read starting from their first bit, which is the lowest
+        // bit of the input
+        int nextCode[c_maxBits + 1];
+        int code = 0;
+        nextCode[0] = 0;
+        for (int length = 1; length <= c_maxBits; ++length)
+        {
+            code = (code + (length > 1 ? huffman.count[length - 1] : 0)) << 1;
+            nextCode[length] = code;
+        }
+        for (int symbol = 0; symbol < count; ++symbol)
+        {
+            int const length = lengths[symbol];
+            if (length == 0 || length > c_fastBits)
+            {
+                continue;
+            }
+            int const value = nextCode[length]++;
+            int reversed = 0;
+            for (int bit = 0; bit < length; ++bit)
+            {
+                reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+            }
+            for (int index = reversed; index < (1 << c_fastBits); index += 1 << length)
+            {
+                huffman.fast[index] = static_cast<unsigned short>((symbol << 4) | length);
+            }
+        }
+        return S_OK;
+    }
+
+    // Longer codes are walked one bit at a time over the bits fetched
+    // ahead, the longest code fits into the buffer
+    HRESULT Decode(const Huffman& huffman, int& symbol)
+    {
+        while (m_bitCount < c_maxBits && m_position < m_size)
+        {
+            m_bitBuffer |= static_cast<UINT>(m_data[m_position++]) << m_bitCount;
+            m_bitCount += 8;
+        }
+
+        UINT const entry = huffman.fast[m_bitBuffer & ((1 << c_fastBits) - 1)];
+        if (entry != 0 && static_cast<int>(entry & 15) <= m_bitCount)
+        {
+            m_bitBuffer >>= entry & 15;
+            m_bitCount -= entry & 15;
+            symbol = entry >> 4;
+            return S_OK;
+        }
+
+        UINT bits = m_bitBuffer;
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (int length = 1; length <= c_maxBits && length <= m_bitCount; ++length)
+        {
+            code |= bits & 1;
+            bits >>= 1;
+            int const count = huffman.count[length];
+            if (code - count < first)
+            {
+                m_bitBuffer >>= length;
+                m_bitCount -= length;
+                symbol = huffman.symbol[index + (code - first)];
+                return S_OK;
+            }
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return E_INVALIDARG;
+    }
+
+    HRESULT Codes(const Huffman& lengthCode, const Huffman& distanceCode)
+    {
+        static const short c_lengthBase[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const short c_lengthExtra[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const short c_distanceBase[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        static const short c_distanceExtra[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+        std::vector<BYTE>& out = *m_out;
+        for (;;)
+        {
+            int symbol;
+            RETURN_IF_FAILED(Decode(lengthCode, symbol));
+            if (symbol < 256)
+            {
+                if (out.size() >= m_maxSize)
+                {
+                    return E_INVALIDARG;
+                }
+                out.push_back(static_cast<BYTE>(symbol));
+            }
+            else if (symbol == 256)
+            {
+                return S_OK;
+            }
+            else
+            {
+                symbol -= 257;
+                if (symbol >= 29)
+                {
+                    return E_INVALIDARG;
+                }
+                UINT extra;
+                RETURN_IF_FAILED(ReadBits(c_lengthExtra[symbol], extra));
+                size_t const length = c_lengthBase[symbol] + extra;
+
+                RETURN_IF_FAILED(Decode(distanceCode, symbol));
+                if (symbol >= 30)
+                {
+                    return E_INVALIDARG;
+                }
+                RETURN_IF_FAILED(ReadBits(c_distanceExtra[symbol], extra));
+                size_t const distance = c_distanceBase[symbol] + extra;
+
+                if (distance > out.size() || out.size() + length > m_maxSize)
+                {
+                    return E_INVALIDARG;
+                }
+                // The copy may overlap what it writes
+                size_t from = out.size() - distance;
+                for (size_t i = 0; i < length; ++i)
+                {
+                    out.push_back(out[from + i]);
+                }
+            }
+        }
+    }
+
+    HRESULT Fixed()
+    {
+        static const struct Tables
+        {
+            Huffman lengthCode;
+            Huffman distanceCode;
+            Tables()
+            {
+                short lengths[288];
+                int symbol = 0;
+                for (; symbol < 144; ++symbol) lengths[symbol] = 8;
+                for (; symbol < 256; ++symbol) lengths[symbol] = 9;
+                for (; symbol < 280; ++symbol) lengths[symbol] = 7;
+                for (; symbol < 288; ++symbol) lengths[symbol] = 8;
+                Build(lengthCode, lengths, 288);
+                for (symbol = 0; symbol < c_maxDistanceCodes; ++symbol) lengths[symbol] = 5;
+                Build(distanceCode, lengths, c_maxDistanceCodes);
+            }
+        } tables;
+        return Codes(tables.lengthCode, tables.distanceCode);
+    }
+
+    HRESULT Dynamic()
+    {
+        static const BYTE c_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+        UINT lengthCount, distanceCount, codeCount;
+        RETURN_IF_FAILED(ReadBits(5, lengthCount));
+        RETURN_IF_FAILED(ReadBits(5, distanceCount));
+        RETURN_IF_FAILED(ReadBits(4, codeCount));
+        lengthCount += 257;
+        distanceCount += 1;
+        codeCount += 4;
+        if (lengthCount > c_maxLengthCodes || distanceCount > c_maxDistanceCodes)
+        {
+            return E_INVALIDARG;
+        }
+
+        short lengths[c_maxLengthCodes + c_maxDistanceCodes] = {};
+        for (UINT i = 0; i < codeCount; ++i)
+        {
+            UINT length;
+            RETURN_IF_FAILED(ReadBits(3, length));
+            lengths[c_order[i]] = static_cast<short>(length);
+        }
+
+        Huffman lengthCode;
+        Huffman distanceCode;
+        RETURN_IF_FAILED(Build(lengthCode, lengths, 19));
+
+        // Code lengths of both codes, with runs of repeats and zeros
+        UINT index = 0;
+        while (index < lengthCount + distanceCount)
+        {
+            int symbol;
+            RETURN_IF_FAILED(Decode(lengthCode, symbol));
+            if (symbol < 16)
+            {
+                lengths[index++] = static_cast<short>(symbol);
+                continue;
+            }
+
+            short repeated = 0;
+            UINT count;
+            if (symbol == 16)
+            {
+                if (index == 0)
+                {
+                    return E_INVALIDARG;
+                }
+                repeated = lengths[index - 1];
+                RETURN_IF_FAILED(ReadBits(2, count));
+                count += 3;
+            }
+            else if (symbol == 17)
+            {
+                RETURN_IF_FAILED(ReadBits(3, count));
+                count += 3;
+            }
+            else
+            {
+                RETURN_IF_FAILED(ReadBits(7, count));
+                count += 11;
+            }
+            if (index + count > lengthCount + distanceCount)
+            {
+                return E_INVALIDARG;
+            }
+            while (count-- > 0)
+            {
+                lengths[index++] = repeated;
+            }
+        }
+
+        // A block without an end code can't be decoded
+        if (lengths[256] == 0)
+        {
+            return E_INVALIDARG;
+        }
+        RETURN_IF_FAILED(Build(lengthCode, lengths, lengthCount));
+        RETURN_IF_FAILED(Build(distanceCode, lengths + lengthCount, distanceCount));
+        return Codes(lengthCode, distanceCode);
+    }
+};
+
+HRESULT FaviconCodec::Decode(const BYTE* data, size_t size, UINT preferredSize, IconBitmap& bitmap)
+{
+    if (IsPng(data, size))
+    {
+        return DecodePng(data, size, bitmap);
+    }
+    // ICO header: reserved 0, type 1
+    if (size >= 6 && ReadLittleEndian16(data) == 0 && ReadLittleEndian16(data + 2) == 1)
+    {
+        return DecodeIco(data, size, preferredSize, bitmap);
+    }
+    return E_NOTIMPL;
+}
+
+bool FaviconCodec::IsPng(const BYTE* data, size_t size)
+{
+    return size >= sizeof(c_pngSignature) && memcmp(data, c_pngSignature, sizeof(c_pngSignature)) == 0;
+}
+
+HRESULT FaviconCodec::DecodeIco(const BYTE* data, size_t size, UINT preferredSize, IconBitmap& bitmap)
+{
+    UINT const count = ReadLittleEndian16(data + 4);
+    if (count == 0 || 6 + count * 16 > size)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Prefers the smallest image which needs no upscaling, then more colors
+    const BYTE* best = nullptr;
+    UINT bestWidth = 0;
+    UINT bestBits = 0;
+    for (UINT i = 0; i < count; ++i)
+    {
+        const BYTE* entry = data + 6 + i * 16;
+        UINT const width = entry[0] == 0 ? 256 : entry[0];
+        UINT const bits = ReadLittleEndian16(entry + 6);
+
+        bool better;
+        if (!best)
+        {
+            better = true;
+        }
+        else if ((width >= preferredSize) != (bestWidth >= preferredSize))
+        {
+            better = width >= preferredSize;
+        }
+        else if (width != bestWidth)
+        {
+            better = width >= preferredSize ? width < bestWidth : width > bestWidth;
+        }
+        else
+        {
+            better = bits > bestBits;
+        }
+
+        if (better)
+        {
+            best = entry;
+            bestWidth = width;
+            bestBits = bits;
+        }
+    }
+
+    UINT const imageSize = ReadLittleEndian32(best + 8);
+    UINT const offset = ReadLittleEndian32(best + 12);
+    if (offset > size || imageSize > size - offset)
+    {
+        return E_INVALIDARG;
+    }
+
+    const BYTE* image = data + offset;
+    if (IsPng(image, imageSize))
+    {
+        return DecodePng(image, imageSize, bitmap);
+    }
+    return DecodeDib(image, imageSize, bitmap);
+}
+
+HRESULT FaviconCodec::DecodePng(const BYTE* data, size_t size, IconBitmap& bitmap)
+{
+    UINT width = 0;
+    UINT height = 0;
+    UINT depth = 0;
+    UINT colorType = 0;
+    BYTE palette[256][4];
+    UINT paletteSize = 0;
+    bool hasTransparentColor = false;
+    UINT transparentColor[3] = {};
+    std::vector<BYTE> compressed;
+
+    size_t position = sizeof(c_pngSignature);
+    bool first = true;
+    for (;;)
+    {
+        if (size - position < 12)
+        {
+            return E_INVALIDARG;
+        }
+        UINT const length = ReadBigEndian32(data + position);
+        const BYTE* type = data + position + 4;
+        const BYTE* chunk = type + 4;
+        if (length > size - position - 12)
+        {
+            return E_INVALIDARG;
+        }
+        position += 12 + static_cast<size_t>(length);
+
+        if (first)
+        {
+            if (memcmp(type, "IHDR", 4) != 0 || length < 13)
+            {
+                return E_INVALIDARG;
+            }
+            first = false;
+            width = ReadBigEndian32(chunk);
+            height = ReadBigEndian32(chunk + 4);
+            depth = chunk[8];
+            colorType = chunk[9];
+            if (width == 0 || height == 0 || width > c_maxDimension || height > c_maxDimension ||
+                chunk[10] != 0 || chunk[11] != 0)
+            {
+                return E_INVALIDARG;
+            }
+            // Interlacing is rare in favicons
+            if (chunk[12] != 0)
+            {
+                return E_NOTIMPL;
+            }
+
+            bool valid;
+            switch (colorType)
+            {
+            case 0:
+                valid = depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16;
+                break;
+            case 3:
+                valid = depth == 1 || depth == 2 || depth == 4 || depth == 8;
+                break;
+            case 2:
+            case 4:
+            case 6:
+                valid = depth == 8 || depth == 16;
+                break;
+            default:
+                valid = false;
+                break;
+            }
+            if (!valid)
+            {
+                return E_INVALIDARG;
+            }
+        }
+        else if (memcmp(type, "PLTE", 4) == 0)
+        {
+            paletteSize = std::min<UINT>(length / 3, 256);
+            for (UINT i = 0; i < paletteSize; ++i)
+            {
+                palette[i][0] = chunk[i * 3];
+                palette[i][1] = chunk[i * 3 + 1];
+                palette[i][2] = chunk[i * 3 + 2];
+                palette[i][3] = 255;
+            }
+        }
+        else if (memcmp(type, "tRNS", 4) == 0)
+        {
+            if (colorType == 3)
+            {
+                for (UINT i = 0; i < length && i < paletteSize; ++i)
+                {
+                    palette[i][3] = chunk[i];
+                }
+            }
+            else if (colorType == 0 && length >= 2)
+            {
+                hasTransparentColor = true;
+                transparentColor[0] = (chunk[0] << 8) | chunk[1];
+            }
+            else if (colorType == 2 && length >= 6)
+            {
+                hasTransparentColor = true;
+                for (int i = 0; i < 3; ++i)
+                {
+                    transparentColor[i] = (chunk[i * 2] << 8) | chunk[i * 2 + 1];
+                }
+            }
+        }
+        else if (memcmp(type, "IDAT", 4) == 0)
+        {
+            compressed.insert(compressed.end(), chunk, chunk + length);
+        }
+        else if (memcmp(type, "IEND", 4) == 0)
+        {
+            break;
+        }
+    }
+    if (colorType == 3 && paletteSize == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    static const UINT c_channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    UINT const channels = c_channels[colorType];
+    UINT const bitsPerPixel = channels * depth;
+    size_t const rowSize = (static_cast<size_t>(width) * bitsPerPixel + 7) / 8;
+    size_t const pixelSize = std::max<UINT>(1, bitsPerPixel / 8);  // Distance of the bytes the filters compare
+
+    std::vector<BYTE> raw;
+    Inflater inflater(compressed.data(), compressed.size());
+    RETURN_IF_FAILED(inflater.Run(height * (rowSize + 1), raw));
+    if (raw.size() != height * (rowSize + 1))
+    {
+        return E_INVALIDARG;
+    }
+
+    // Undoes the filter of every row in place, the filter byte stays. Bytes
+    // before the first pixel and above the first row count as 0.
+    std::vector<BYTE> const zeros(rowSize);
+    for (UINT y = 0; y < height; ++y)
+    {
+        BYTE* row = raw.data() + y * (rowSize + 1) + 1;
+        const BYTE* up = y > 0 ? row - (rowSize + 1) : zeros.data();
+        size_t const first = std::min(pixelSize, rowSize);
+        switch (row[-1])
+        {
+        case 0:
+            break;
+        case 1:
+            for (size_t i = pixelSize; i < rowSize; ++i)
+            {
+                row[i] = static_cast<BYTE>(row[i] + row[i - pixelSize]);
+            }
+            break;
+        case 2:
+            for (size_t i = 0; i < rowSize; ++i)
+            {
+                row[i] = static_cast<BYTE>(row[i] + up[i]);
+            }
+            break;
+        case 3:
+            for (size_t i = 0; i < first; ++i)
+            {
+                row[i] = static_cast<BYTE>(row[i] + up[i] / 2);
+            }
+            for (size_t i = first; i < rowSize; ++i)
+            {
+                row[i] = static_cast<BYTE>(row[i] + (row[i - pixelSize] + up[i]) / 2);
+            }
+            break;
+        case 4:
+            // Paeth, with left and upper left 0 it predicts up
+            for (size_t i = 0; i < first; ++i)
+            {
+                row[i] = static_cast<BYTE>(row[i] + up[i]);
+            }
+            for (size_t i = first; i < rowSize; ++i)
+            {
+                int const left = row[i - pixelSize];
+                int const above = up[i];
+                int const upLeft = up[i - pixelSize];
+                int const pa = abs(above - upLeft);
+                int const pb = abs(left - upLeft);
+                int const pc = abs(left + above - 2 * upLeft);
+                row[i] = static_cast<BYTE>(row[i] + (pa <= pb && pa <= pc ? left : pb <= pc ? above : upLeft));
+            }
+            break;
+        default:
+            return E_INVALIDARG;
+        }
+    }
+
+    bitmap.width = width;
+    bitmap.height = height;
+    bitmap.pixels.resize(static_cast<size_t>(width) * height * 4);
+    UINT const maxSample = (1u << depth) - 1;
+    for (UINT y = 0; y < height; ++y)
+    {
+        const BYTE* row = raw.data() + y * (rowSize + 1) + 1;
+        BYTE* out = bitmap.pixels.data() + static_cast<size_t>(y) * width * 4;
+        if (colorType == 6 && depth == 8)
+        {
+            memcpy(out, row, rowSize);
+            continue;
+        }
+
+        // Returns channel c of pixel x at its full depth
+        auto sample = [row, depth, channels, maxSample](UINT x, UINT c) -> UINT
+        {
+            if (depth == 8)
+            {
+                return row[x * channels + c];
+            }
+            if (depth == 16)
+            {
+                return (row[(x * channels + c) * 2] << 8) | row[(x * channels + c) * 2 + 1];
+            }
+            UINT const bit = x * depth;
+            return (row[bit / 8] >> (8 - depth - bit % 8)) & maxSample;
+        };
+        auto scale = [depth, maxSample](UINT value) -> BYTE
+        {
+            return static_cast<BYTE>(depth == 16 ? value >> 8 : value * 255 / maxSample);
+        };
+
+        for (UINT x = 0; x < width; ++x, out += 4)
+        {
+            switch (colorType)
+            {
+            case 0:
+            {
+                UINT const gray = sample(x, 0);
+                out[0] = out[1] = out[2] = scale(gray);
+                out[3] = hasTransparentColor && gray == transparentColor[0] ? 0 : 255;
+                break;
+            }
+            case 2:
+            {
+                UINT const r = sample(x, 0);
+                UINT const g = sample(x, 1);
+                UINT const b = sample(x, 2);
+                out[0] = scale(r);
+                out[1] = scale(g);
+                out[2] = scale(b);
+                out[3] = hasTransparentColor && r == transparentColor[0] && g == transparentColor[1] &&
+                    b == transparentColor[2] ? 0 : 255;
+                break;
+            }
+            case 3:
+            {
+                UINT const index = sample(x, 0);
+                if (index >= paletteSize)
+                {
+                    return E_INVALIDARG;
+                }
+                memcpy(out, palette[index], 4);
+                break;
+            }
+            case 4:
+                out[0] = out[1] = out[2] = scale(sample(x, 0));
+                out[3] = scale(sample(x, 1));
+                break;
+            case 6:
+                for (UINT c = 0; c < 4; ++c)
+                {
+                    out[c] = scale(sample(x, c));
+                }
+                break;
+            }
+        }
+    }
+    return S_OK;
+}
+
+// A BITMAPINFOHEADER followed by the palette, the color rows and the 1 bit
+// transparency mask rows, both bottom-up. The header counts the height of
+// both.
+HRESULT FaviconCodec::DecodeDib(const BYTE* data, size_t size, IconBitmap& bitmap)
+{
+    if (size < 40)
+    {
+        return E_INVALIDARG;
+    }
+    UINT const headerSize = ReadLittleEndian32(data);
+    int const width = static_cast<int>(ReadLittleEndian32(data + 4));
+    int const height = static_cast<int>(ReadLittleEndian32(data + 8)) / 2;
+    UINT const bitCount = ReadLittleEndian16(data + 14);
+    UINT const compression = ReadLittleEndian32(data + 16);
+    UINT const colorsUsed = ReadLittleEndian32(data + 32);
+    if (headerSize < 40 || headerSize > size || width <= 0 || height <= 0 ||
+        static_cast<UINT>(width) > c_maxDimension || static_cast<UINT>(height) > c_maxDimension)
+    {
+        return E_INVALIDARG;
+    }
+    if (compression != BI_RGB)
+    {
+        return E_NOTIMPL;
+    }
+    if (bitCount != 1 && bitCount != 4 && bitCount != 8 && bitCount != 24 && bitCount != 32)
+    {
+        return E_NOTIMPL;
+    }
+
+    UINT const paletteSize = bitCount <= 8 ? (colorsUsed != 0 ? colorsUsed : 1u << bitCount) : 0;
+    if (paletteSize > 256 || paletteSize * 4 > size - headerSize)
+    {
+        return E_INVALIDARG;
+    }
+    const BYTE* palette = data + headerSize;
+    size_t const colorStride = (static_cast<size_t>(width) * bitCount + 31) / 32 * 4;
+    size_t const maskStride = (static_cast<size_t>(width) + 31) / 32 * 4;
+    size_t const colorOffset = headerSize + paletteSize * 4;
+    size_t const maskOffset = colorOffset + colorStride * height;
+    if (maskOffset > size)
+    {
+        return E_INVALIDARG;
+    }
+    // Some encoders leave the mask out when the colors have alpha
+    bool const hasMask = maskOffset + maskStride * height <= size;
+
+    bitmap.width = width;
+    bitmap.height = height;
+    bitmap.pixels.resize(static_cast<size_t>(width) * height * 4);
+    bool hasAlpha = false;
+    for (int y = 0; y < height; ++y)
+    {
+        const BYTE* row = data + colorOffset + colorStride * (height - 1 - y);
+        BYTE* out = bitmap.pixels.data() + static_cast<size_t>(y) * width * 4;
+        for (int x = 0; x < width; ++x, out += 4)
+        {
+            const BYTE* color;
+            if (bitCount >= 24)
+            {
+                color = row + x * (bitCount / 8);
+            }
+            else
+            {
+                UINT const bit = x * bitCount;
+                UINT const index = (row[bit / 8] >> (8 - bitCount - bit % 8)) & ((1u << bitCount) - 1);
+                if (index >= paletteSize)
+                {
+                    return E_INVALIDARG;
+                }
+                color = palette + index * 4;
+            }
+            out[0] = color[2];
+            out[1] = color[1];
+            out[2] = color[0];
+            out[3] = bitCount == 32 ? color[3] : 255;
+            hasAlpha = hasAlpha || out[3] != 0;
+        }
+    }
+
+    // Without alpha in the colors, the mask tells which pixels are transparent
+    if (bitCount == 32 && hasAlpha)
+    {
+        return S_OK;
+    }
+    for (int y = 0; y < height; ++y)
+    {
+        const BYTE* row = data + maskOffset + maskStride * (height - 1 - y);
+        BYTE* out = bitmap.pixels.data() + static_cast<size_t>(y) * width * 4;
+        for (int x = 0; x < width; ++x, out += 4)
+        {
+            bool const transparent = hasMask && ((row[x / 8] >> (7 - x % 8)) & 1);
+            out[3] = transparent ? 0 : 255;
+        }
+    }
+    return S_OK;
+}
+
+void FaviconCodec::Resize(const IconBitmap& source, UINT size, IconBitmap& target)
+{
+    target.width = size;
+    target.height = size;
+    target.pixels.assign(static_cast<size_t>(size) * size * 4, 0);
+    if (source.width == 0 || source.height == 0 || size == 0)
+    {
+        return;
+    }
+
+    // Keeps the aspect ratio, the longer side fills the square
+    UINT const longer = std::max(source.width, source.height);
+    UINT const fittedWidth = std::max<UINT>(1, (source.width * size + longer / 2) / longer);
+    UINT const fittedHeight = std::max<UINT>(1, (source.height * size + longer / 2) / longer);
+
+    // Source pixels and weights covered by every target pixel on one axis
+    struct Weight
+    {
+        UINT index;
+        float weight;
+    };
+    auto getWeights = [](UINT sourceSize, UINT targetSize)
+    {
+        std::vector<std::vector<Weight>> weights(targetSize);
+        double const step = static_cast<double>(sourceSize) / targetSize;
+        for (UINT i = 0; i < targetSize; ++i)
+        {
+            double const begin = i * step;
+            double const end = begin + step;
+            for (UINT s = static_cast<UINT>(begin); s < sourceSize && s < end; ++s)
+            {
+                double const covered = std::min<double>(end, s + 1) - std::max<double>(begin, s);
+                if (covered > 0)
+                {
+                    weights[i].push_back({ s, static_cast<float>(covered / step) });
+                }
+            }
+        }
+        return weights;
+    };
+    std::vector<std::vector<Weight>> const columns = getWeights(source.width, fittedWidth);
+    std::vector<std::vector<Weight>> const rows = getWeights(source.height, fittedHeight);
+
+    // Horizontal pass into premultiplied floats, then the vertical pass
+    std::vector<float> horizontal(static_cast<size_t>(fittedWidth) * source.height * 4, 0.0f);
+    for (UINT y = 0; y < source.height; ++y)
+    {
+        const BYTE* in = source.pixels.data() + static_cast<size_t>(y) * source.width * 4;
+        float* out = horizontal.data() + static_cast<size_t>(y) * fittedWidth * 4;
+        for (UINT x = 0; x < fittedWidth; ++x, out += 4)
+        {
+            for (const Weight& w : columns[x])
+            {
+                const BYTE* pixel = in + w.index * 4;
+                float const alpha = pixel[3] * w.weight;
+                out[0] += pixel[0] * alpha;
+                out[1] += pixel[1] * alpha;
+                out[2] += pixel[2] * alpha;
+                out[3] += alpha;
+            }
+        }
+    }
+
+    UINT const left = (size - fittedWidth) / 2;
+    UINT const top = (size - fittedHeight) / 2;
+    for (UINT y = 0; y < fittedHeight; ++y)
+    {
+        BYTE* out = target.pixels.data() + (static_cast<size_t>(y + top) * size + left) * 4;
+        for (UINT x = 0; x < fittedWidth; ++x, out += 4)
+        {
+            float sum[4] = {};
+            for (const Weight& w : rows[y])
+            {
+                const float* pixel = horizontal.data() + (static_cast<size_t>(w.index) * fittedWidth + x) * 4;
+                for (int c = 0; c < 4; ++c)
+                {
+                    sum[c] += pixel[c] * w.weight;
+                }
+            }
+            if (sum[3] <= 0.0f)
+            {
+                continue;
+            }
+            for (int c = 0; c < 3; ++c)
+            {
+                out[c] = static_cast<BYTE>(std::min(255.0f, sum[c] / sum[3] + 0.5f));
+            }
+            out[3] = static_cast<BYTE>(std::min(255.0f, sum[3] + 0.5f));
+        }
+    }
+}
+
+void FaviconCodec::EncodePng(const IconBitmap& bitmap, std::vector<BYTE>& png)
+{
+    auto appendChunk = [&png](const char* type, const std::vector<BYTE>& data)
+    {
+        AppendBigEndian32(png, static_cast<UINT>(data.size()));
+        size_t const start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data.begin(), data.end());
+        AppendBigEndian32(png, UpdateCrc32(0, png.data() + start, png.size() - start));
+    };
+
+    png.assign(c_pngSignature, c_pngSignature + sizeof(c_pngSignature));
+
+    // 8 bit RGBA, not interlaced
+    std::vector<BYTE> header;
+    AppendBigEndian32(header, bitmap.width);
+    AppendBigEndian32(header, bitmap.height);
+    header.insert(header.end(), { 8, 6, 0, 0, 0 });
+    appendChunk("IHDR", header);
+
+    // Rows without filter, in stored deflate blocks of at most 65535 bytes
+    size_t const rowSize = static_cast<size_t>(bitmap.width) * 4;
+    std::vector<BYTE> raw;
+    raw.reserve((rowSize + 1) * bitmap.height);
+    for (UINT y = 0; y < bitmap.height; ++y)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), bitmap.pixels.begin() + y * rowSize, bitmap.pixels.begin() + (y + 1) * rowSize);
+    }
+
+    std::vector<BYTE> data = { 0x78, 0x01 };
+    size_t position = 0;
+    do
+    {
+        size_t const length = std::min<size_t>(raw.size() - position, 65535);
+        bool const last = position + length == raw.size();
+        data.push_back(last ? 1 : 0);
+        data.push_back(static_cast<BYTE>(length));
+        data.push_back(static_cast<BYTE>(length >> 8));
+        data.push_back(static_cast<BYTE>(~length));
+        data.push_back(static_cast<BYTE>(~length >> 8));
+        data.insert(data.end(), raw.begin() + position, raw.begin() + position + length);
+        position += length;
+    } while (position < raw.size());
+    AppendBigEndian32(data, UpdateAdler32(1, raw.data(), raw.size()));
+    appendChunk("IDAT", data);
+
+    appendChunk("IEND", {});
+}
@@ -0,0 +1,47 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Pixels in RGBA order with 8 bits per channel, not premultiplied
+struct IconBitmap
+{
+    UINT width = 0;
+    UINT height = 0;
+    std::vector<BYTE> pixels;
+};
+
+// Decodes, resizes and encodes favicons without any system codec, so the
+// same results come out on every machine. Decode() reads PNG files and ICO
+// files holding PNG or BMP images, which covers nearly every favicon, and
+// returns E_NOTIMPL for anything else like SVG or interlaced PNG. Malformed
+// input fails with an error rather than reading out of bounds.
+class FaviconCodec
+{
+public:
+    static const UINT c_maxDimension = 1024;
+
+    // For an ICO, the smallest image at least preferredSize wide is picked,
+    // or the largest one if there is none
+    static HRESULT Decode(const BYTE* data, size_t size, UINT preferredSize, IconBitmap& bitmap);
+
+    // Fits the bitmap into a size x size square, centered on a transparent
+    // background. Every target pixel is the area weighted average of the
+    // source pixels it covers, in premultiplied alpha.
+    static void Resize(const IconBitmap& source, UINT size, IconBitmap& target);
+
+    // Writes an RGBA PNG. The image data is stored without compression, it
+    // is only a few KB for the sizes the UI uses.
+    static void EncodePng(const IconBitmap& bitmap, std::vector<BYTE>& png);
+
+    // A PNG holds a single image, Decode() gives the same result for any size
+    static bool IsPng(const BYTE* data, size_t size);
+
+private:
+    static HRESULT DecodeIco(const BYTE* data, size_t size, UINT preferredSize, IconBitmap& bitmap);
+    static HRESULT DecodePng(const BYTE* data, size_t size, IconBitmap& bitmap);
+    static HRESULT DecodeDib(const BYTE* data, size_t size, IconBitmap& bitmap);
+};
@@ -0,0 +1,166 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "FavoritesStore.h"
+#include "Utf.h"
+
+static const size_t c_maxFileSize = 16 << 20;
+
+static bool IsSameFavorite(const Favorite& a, const Favorite& b)
+{
+    return a.uri == b.uri && a.uriToShow == b.uriToShow && a.title == b.title && a.favicon == b.favicon;
+}
+
+HRESULT FavoritesStore::Open(LPCWSTR path)
+{
+    m_path = path;
+    m_favorites.clear();
+    RETURN_IF_FAILED(Encode());
+
+    wil::unique_hfile file(CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file)
+    {
+        DWORD error = GetLastError();
+        return error == ERROR_FILE_NOT_FOUND ? S_OK : HRESULT_FROM_WIN32(error);
+    }
+
+    LARGE_INTEGER size;
+    RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(file.get(), &size));
+    if (size.QuadPart > static_cast<LONGLONG>(c_maxFileSize))
+    {
+        return E_INVALIDARG;
+    }
+
+    std::string data(static_cast<size_t>(size.QuadPart), '\0');
+    DWORD read = 0;
+    RETURN_IF_WIN32_BOOL_FALSE(ReadFile(file.get(), &data[0], static_cast<DWORD>(data.size()), &read, nullptr));
+    data.resize(read);
+
+    // The file holds the encoded FavoritesMessage
+    std::wstring json;
+    RETURN_IF_FAILED(AppendUtf16(data.data(), data.size(), json));
+    MessageReader reader;
+    RETURN_IF_FAILED(reader.Parse(json.c_str()));
+    if (reader.GetMessageCode() != FavoritesMessage::c_message)
+    {
+        return E_INVALIDARG;
+    }
+    FavoritesMessage message;
+    RETURN_IF_FAILED(reader.ReadArgs(message));
+
+    Sort(message.favorites);
+    m_favorites = std::move(message.favorites);
+    return Encode();
+}
+
+HRESULT FavoritesStore::Set(const Favorite& favorite)
+{
+    auto it = Find(favorite.uri);
+    if (it != m_favorites.end() && it->uri == favorite.uri)
+    {
+        if (IsSameFavorite(*it, favorite))
+        {
+            return S_FALSE;
+        }
+        *it = favorite;
+    }
+    else
+    {
+        m_favorites.insert(it, favorite);
+    }
+    return Save();
+}
+
+HRESULT FavoritesStore::Remove(const std::wstring& uri)
+{
+    auto it = Find(uri);
+    if (it == m_favorites.end() || it->uri != uri)
+    {
+        return S_FALSE;
+    }
+    m_favorites.erase(it);
+    return Save();
+}
+
+HRESULT FavoritesStore::Replace(std::vector<Favorite> favorites, std::vector<std::wstring>& removed)
+{
+    Sort(favorites);
+
+    // Both lists are sorted, walk them together
+    removed.clear();
+    auto it = favorites.begin();
+    for (const Favorite& favorite : m_favorites)
+    {
+        while (it != favorites.end() && it->uri < favorite.uri)
+        {
+            ++it;
+        }
+        if (it == favorites.end() || it->uri != favorite.uri)
+        {
+            removed.push_back(favorite.uri);
+        }
+    }
+
+    if (favorites.size() == m_favorites.size() &&
+        std::equal(favorites.begin(), favorites.end(), m_favorites.begin(), IsSameFavorite))
+    {
+        return S_FALSE;
+    }
+    m_favorites = std::move(favorites);
+    return Save();
+}
+
+// Orders by URI and drops duplicates
+void FavoritesStore::Sort(std::vector<Favorite>& favorites)
+{
+    std::sort(favorites.begin(), favorites.end(),
+        [](const Favorite& a, const Favorite& b) { return a.uri < b.uri; });
+    favorites.erase(std::unique(favorites.begin(), favorites.end(),
+        [](const Favorite& a, const Favorite& b) { return a.uri == b.uri; }), favorites.end());
+}
+
+HRESULT FavoritesStore::Encode()
+{
+    FavoritesMessage message;
+    message.favorites = m_favorites;
+    m_json = m_writer.Write(message);
+    return m_encoder.Encode(m_favorites, m_bulk);
+}
+
+std::vector<Favorite>::iterator FavoritesStore::Find(const std::wstring& uri)
+{
+    return std::lower_bound(m_favorites.begin(), m_favorites.end(), uri,
+        [](const Favorite& favorite, const std::wstring& key) { return favorite.uri < key; });
+}
+
+// Written to a temporary file first, so a crash leaves the old favorites
+HRESULT FavoritesStore::Save()
+{
+    RETURN_IF_FAILED(Encode());
+    if (m_path.empty())
+    {
+        return S_OK;
+    }
+
+    std::string data;
+    RETURN_IF_FAILED(AppendUtf8(m_json.data(), m_json.size(), data));
+
+    std::wstring const temporaryPath = m_path + L".tmp";
+    {
+        wil::unique_hfile file(CreateFileW(temporaryPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file)
+        {
+            RETURN_LAST_ERROR();
+        }
+
+        DWORD written = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(WriteFile(file.get(), data.data(), static_cast<DWORD>(data.size()), &written, nullptr));
+        if (written != data.size())
+        {
+            return E_FAIL;
+        }
+    }
+    RETURN_IF_WIN32_BOOL_FALSE(MoveFileExW(temporaryPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING));
+    return S_OK;
+}
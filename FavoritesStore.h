@@ -0,0 +1,46 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+#include "BulkTransfer.h"
+#include "MessageCodec.h"
+
+// Favorites as the host knows them, so that the favorites page is answered
+// in one round trip instead of through the controls UI. The controls UI still
+// adds and removes favorites, and reports every change and, when it starts,
+// the whole list. The favorites are encoded for the favorites page once per
+// change rather than once per request, and saved to a file so the favorites
+// page works before the controls UI has reported anything.
+//
+// Favorites are ordered by URI like the controls UI stores them. Changes
+// return S_FALSE when nothing changed, and an error if saving failed.
+class FavoritesStore
+{
+public:
+    HRESULT Open(LPCWSTR path);
+
+    HRESULT Set(const Favorite& favorite);
+    HRESULT Remove(const std::wstring& uri);
+    // removed gets the URIs which aren't favorites anymore
+    HRESULT Replace(std::vector<Favorite> favorites, std::vector<std::wstring>& removed);
+
+    const std::vector<Favorite>& GetAll() const { return m_favorites; }
+    // The favorites for the favorites page, see BulkEncoder
+    const std::vector<BYTE>& GetBulk() const { return m_bulk; }
+
+private:
+    std::wstring m_path;
+    std::vector<Favorite> m_favorites;
+    std::wstring m_json;  // The encoded FavoritesMessage, as saved
+    std::vector<BYTE> m_bulk;
+    MessageWriter m_writer;
+    BulkEncoder m_encoder;
+
+    static void Sort(std::vector<Favorite>& favorites);
+    HRESULT Encode();
+    std::vector<Favorite>::iterator Find(const std::wstring& uri);
+    HRESULT Save();
+};
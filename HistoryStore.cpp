@@ -0,0 +1,797 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "HistoryStore.h"
+#include "Utf.h"
+
+// The log is a header followed by records of the form
+// [payload length:4][kind:1][payload], integers are little endian and
+// strings are stored as [length:4][UTF-8 bytes].
+static const char s_logHeader[8] = { 'W', 'V', 'B', 'H', 'S', 'T', '0', '1' };
+
+enum RecordKind
+{
+    c_recordAdd = 1,      // id, timestamp, day, uri, title, favicon
+    c_recordTouch = 2,    // id, timestamp
+    c_recordUpdate = 3,   // id, title, favicon
+    c_recordRemove = 4,   // id
+    c_recordImport = 5,   // first id, count, then timestamp, day, uri, title, favicon of each
+};
+
+// Compact the log on startup once it holds this many more records than live
+// entries
+static const size_t c_compactSlack = 4096;
+static const size_t c_minDeadSlotsToRebuild = 1024;
+// Longer runs of dead slots are jumped over with the tree
+static const size_t c_maxDeadSlotScan = 64;
+
+static void PutInt32(std::string& out, UINT32 value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+static void PutInt64(std::string& out, ULONGLONG value)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+static void PutString(std::string& out, const std::string& value)
+{
+    PutInt32(out, static_cast<UINT32>(value.size()));
+    out.append(value);
+}
+
+static void BeginRecord(std::string& out, RecordKind kind)
+{
+    out.clear();
+    PutInt32(out, 0);  // Patched by EndRecord
+    out.push_back(static_cast<char>(kind));
+}
+
+static void EndRecord(std::string& out)
+{
+    UINT32 length = static_cast<UINT32>(out.size() - 4);
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = static_cast<char>(length >> (8 * i));
+    }
+}
+
+struct LogReader
+{
+    const char* p;
+    const char* end;
+    bool ok;
+
+    ULONGLONG GetInteger(int bytes)
+    {
+        ULONGLONG value = 0;
+        if (end - p < bytes)
+        {
+            ok = false;
+            return 0;
+        }
+        for (int i = 0; i < bytes; ++i)
+        {
+            value |= static_cast<ULONGLONG>(static_cast<unsigned char>(*p++)) << (8 * i);
+        }
+        return value;
+    }
+
+    int GetInt32() { return static_cast<int>(GetInteger(4)); }
+    LONGLONG GetInt64() { return static_cast<LONGLONG>(GetInteger(8)); }
+
+    std::string GetString()
+    {
+        size_t length = static_cast<size_t>(GetInteger(4));
+        if (!ok || static_cast<size_t>(end - p) < length)
+        {
+            ok = false;
+            return std::string();
+        }
+        std::string value(p, length);
+        p += length;
+        return value;
+    }
+};
+
+static HRESULT ToUtf8(const std::wstring& value, std::string& out)
+{
+    out.clear();
+    return AppendUtf8(value.c_str(), value.size(), out);
+}
+
+HRESULT HistoryStore::Open(LPCWSTR path)
+{
+    Reset();
+    m_path = path;
+    m_file.reset(CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!m_file)
+    {
+        RETURN_LAST_ERROR();
+    }
+
+    LARGE_INTEGER size;
+    RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(m_file.get(), &size));
+
+    std::string log(static_cast<size_t>(size.QuadPart), '\0');
+    size_t read = 0;
+    while (read < log.size())
+    {
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(log.size() - read, 1 << 30));
+        DWORD bytesRead = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(ReadFile(m_file.get(), &log[read], chunk, &bytesRead, nullptr));
+        if (bytesRead == 0)
+        {
+            break;
+        }
+        read += bytesRead;
+    }
+    log.resize(read);
+
+    size_t valid = Replay(log);
+    if (valid == 0)
+    {
+        // New or unreadable log, start over
+        return Clear();
+    }
+
+    // Drop a record which was only partially written
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(valid);
+    RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(m_file.get(), position, nullptr, FILE_BEGIN));
+    RETURN_IF_WIN32_BOOL_FALSE(SetEndOfFile(m_file.get()));
+
+    if (m_logRecords > 2 * m_liveCount + c_compactSlack)
+    {
+        RETURN_IF_FAILED(Compact());
+    }
+
+    return S_OK;
+}
+
+HRESULT HistoryStore::Add(const std::wstring& uri, const std::wstring& title, const std::wstring& favicon, LONGLONG timestamp, int day, int* id)
+{
+    *id = INVALID_HISTORY_ID;
+
+    std::string uri8;
+    std::string title8;
+    std::string favicon8;
+    RETURN_IF_FAILED(ToUtf8(uri, uri8));
+    RETURN_IF_FAILED(ToUtf8(title, title8));
+    RETURN_IF_FAILED(ToUtf8(favicon, favicon8));
+
+    if (day != m_dedupDay)
+    {
+        RebuildDedup(day);
+    }
+
+    ULONGLONG key = GetDedupKey(uri8, day);
+    auto it = m_dedup.find(key);
+    if (it != m_dedup.end())
+    {
+        Record* record = FindRecord(it->second);
+        if (record && record->day == day && record->uri == uri8)
+        {
+            // Visited earlier today, move the entry to the front
+            ApplyTouch(it->second, timestamp);
+
+            BeginRecord(m_buffer, c_recordTouch);
+            PutInt32(m_buffer, it->second);
+            PutInt64(m_buffer, timestamp);
+            *id = it->second;
+            return AppendRecord();
+        }
+    }
+
+    int newId = static_cast<int>(m_records.size()) + 1;
+    BeginRecord(m_buffer, c_recordAdd);
+    PutInt32(m_buffer, newId);
+    PutInt64(m_buffer, timestamp);
+    PutInt32(m_buffer, day);
+    PutString(m_buffer, uri8);
+    PutString(m_buffer, title8);
+    PutString(m_buffer, favicon8);
+
+    ApplyAdd(newId, timestamp, day, std::move(uri8), std::move(title8), std::move(favicon8));
+    *id = newId;
+    return AppendRecord();
+}
+
+HRESULT HistoryStore::Update(int id, const std::wstring& title, const std::wstring& favicon)
+{
+    std::string title8;
+    std::string favicon8;
+    RETURN_IF_FAILED(ToUtf8(title, title8));
+    RETURN_IF_FAILED(ToUtf8(favicon, favicon8));
+
+    Record* record = FindRecord(id);
+    if (!record)
+    {
+        return E_INVALIDARG;
+    }
+    if (record->title == title8 && record->favicon == favicon8)
+    {
+        return S_OK;
+    }
+
+    BeginRecord(m_buffer, c_recordUpdate);
+    PutInt32(m_buffer, id);
+    PutString(m_buffer, title8);
+    PutString(m_buffer, favicon8);
+
+    ApplyUpdate(id, std::move(title8), std::move(favicon8));
+    return AppendRecord();
+}
+
+HRESULT HistoryStore::Remove(int id)
+{
+    if (!ApplyRemove(id))
+    {
+        return E_INVALIDARG;
+    }
+
+    BeginRecord(m_buffer, c_recordRemove);
+    PutInt32(m_buffer, id);
+    return AppendRecord();
+}
+
+HRESULT HistoryStore::Clear()
+{
+    Reset();
+
+    LARGE_INTEGER start = {};
+    RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(m_file.get(), start, nullptr, FILE_BEGIN));
+    RETURN_IF_FAILED(WriteLog(m_file.get(), std::string(s_logHeader, sizeof(s_logHeader))));
+    RETURN_IF_WIN32_BOOL_FALSE(SetEndOfFile(m_file.get()));
+    return S_OK;
+}
+
+// The visits are added in one record and the slots sorted once, so ids of
+// the existing entries stay the same
+HRESULT HistoryStore::Import(const std::vector<ImportedVisit>& visits)
+{
+    if (visits.empty())
+    {
+        return S_OK;
+    }
+
+    std::vector<Record> records(visits.size());
+    for (size_t i = 0; i < visits.size(); ++i)
+    {
+        records[i].timestamp = visits[i].timestamp;
+        records[i].day = visits[i].day;
+        RETURN_IF_FAILED(ToUtf8(visits[i].uri, records[i].uri));
+        RETURN_IF_FAILED(ToUtf8(visits[i].title, records[i].title));
+        RETURN_IF_FAILED(ToUtf8(visits[i].favicon, records[i].favicon));
+    }
+
+    int firstId = static_cast<int>(m_records.size()) + 1;
+    BeginRecord(m_buffer, c_recordImport);
+    PutInt32(m_buffer, firstId);
+    PutInt32(m_buffer, static_cast<UINT32>(records.size()));
+    for (const Record& record : records)
+    {
+        PutInt64(m_buffer, record.timestamp);
+        PutInt32(m_buffer, record.day);
+        PutString(m_buffer, record.uri);
+        PutString(m_buffer, record.title);
+        PutString(m_buffer, record.favicon);
+    }
+
+    ApplyImport(firstId, records);
+    return AppendRecord();
+}
+
+HRESULT HistoryStore::GetPage(size_t from, size_t count, std::vector<HistoryEntry>& entries) const
+{
+    entries.clear();
+    if (from >= m_liveCount)
+    {
+        return S_OK;
+    }
+
+    if (count > c_maxPageCount)
+    {
+        count = c_maxPageCount;
+    }
+    size_t last = std::min(m_liveCount, from + count);
+    entries.resize(last - from);
+
+    // The most recent visit has the highest rank, the next older visit is
+    // usually in the slot before
+    size_t slot = FindSlot(m_liveCount - from);
+    for (size_t i = from; i < last; ++i)
+    {
+        if (i != from)
+        {
+            size_t scanned = 0;
+            do
+            {
+                --slot;
+            } while (m_slots[slot] == 0 && ++scanned < c_maxDeadSlotScan);
+            if (m_slots[slot] == 0)
+            {
+                slot = FindSlot(m_liveCount - i);
+            }
+        }
+
+        int id = m_slots[slot];
+        const Record& record = m_records[id - 1];
+
+        HistoryEntry& entry = entries[i - from];
+        entry.id = id;
+        entry.item.timestamp = record.timestamp;
+        RETURN_IF_FAILED(AppendUtf16(record.uri.data(), record.uri.size(), entry.item.uri));
+        RETURN_IF_FAILED(AppendUtf16(record.title.data(), record.title.size(), entry.item.title));
+        RETURN_IF_FAILED(AppendUtf16(record.favicon.data(), record.favicon.size(), entry.item.favicon));
+    }
+
+    return S_OK;
+}
+
+// Binary search over the ranks, the visits are in time order
+size_t HistoryStore::GetCountSince(LONGLONG timestamp) const
+{
+    size_t low = 0;
+    size_t high = m_liveCount;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        int id = m_slots[FindSlot(m_liveCount - middle)];
+        if (m_records[id - 1].timestamp >= timestamp)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+HRESULT HistoryStore::GetItem(int id, HistoryItemFields& item) const
+{
+    if (id < 1 || id > static_cast<int>(m_records.size()) || !m_records[id - 1].live)
+    {
+        return E_INVALIDARG;
+    }
+
+    const Record& record = m_records[id - 1];
+    item.timestamp = record.timestamp;
+    RETURN_IF_FAILED(AppendUtf16(record.uri.data(), record.uri.size(), item.uri));
+    RETURN_IF_FAILED(AppendUtf16(record.title.data(), record.title.size(), item.title));
+    RETURN_IF_FAILED(AppendUtf16(record.favicon.data(), record.favicon.size(), item.favicon));
+    return S_OK;
+}
+
+// Applies the records of a log and returns the length of the part which was
+// read successfully, 0 if the header is missing.
+size_t HistoryStore::Replay(const std::string& log)
+{
+    if (log.size() < sizeof(s_logHeader) || memcmp(log.data(), s_logHeader, sizeof(s_logHeader)) != 0)
+    {
+        return 0;
+    }
+
+    size_t valid = sizeof(s_logHeader);
+    while (log.size() - valid >= 5)
+    {
+        LogReader header = { log.data() + valid, log.data() + log.size(), true };
+        size_t length = static_cast<size_t>(header.GetInteger(4));
+        if (length == 0 || static_cast<size_t>(header.end - header.p) < length)
+        {
+            break;
+        }
+
+        LogReader reader = { header.p + 1, header.p + length, true };
+        bool applied = false;
+        switch (*header.p)
+        {
+        case c_recordAdd:
+        {
+            int id = reader.GetInt32();
+            LONGLONG timestamp = reader.GetInt64();
+            int day = reader.GetInt32();
+            std::string uri = reader.GetString();
+            std::string title = reader.GetString();
+            std::string favicon = reader.GetString();
+            applied = reader.ok && ApplyAdd(id, timestamp, day, std::move(uri), std::move(title), std::move(favicon));
+        }
+        break;
+        case c_recordTouch:
+        {
+            int id = reader.GetInt32();
+            LONGLONG timestamp = reader.GetInt64();
+            applied = reader.ok && ApplyTouch(id, timestamp);
+        }
+        break;
+        case c_recordUpdate:
+        {
+            int id = reader.GetInt32();
+            std::string title = reader.GetString();
+            std::string favicon = reader.GetString();
+            applied = reader.ok && ApplyUpdate(id, std::move(title), std::move(favicon));
+        }
+        break;
+        case c_recordRemove:
+        {
+            int id = reader.GetInt32();
+            applied = reader.ok && ApplyRemove(id);
+        }
+        break;
+        case c_recordImport:
+        {
+            int id = reader.GetInt32();
+            size_t count = static_cast<size_t>(reader.GetInteger(4));
+            // Each visit takes at least 24 bytes
+            std::vector<Record> records(reader.ok ? std::min<size_t>(count, (reader.end - reader.p) / 24) : 0);
+            for (Record& record : records)
+            {
+                record.timestamp = reader.GetInt64();
+                record.day = reader.GetInt32();
+                record.uri = reader.GetString();
+                record.title = reader.GetString();
+                record.favicon = reader.GetString();
+            }
+            applied = reader.ok && records.size() == count && ApplyImport(id, records);
+        }
+        break;
+        }
+
+        if (!applied)
+        {
+            break;
+        }
+        ++m_logRecords;
+        valid += 4 + length;
+    }
+
+    return valid;
+}
+
+bool HistoryStore::ApplyAdd(int id, LONGLONG timestamp, int day, std::string uri, std::string title, std::string favicon)
+{
+    if (id != static_cast<int>(m_records.size()) + 1)
+    {
+        return false;
+    }
+
+    Record record;
+    record.timestamp = timestamp;
+    record.day = day;
+    record.slot = AppendSlot(id);
+    record.live = true;
+    record.uri = std::move(uri);
+    record.title = std::move(title);
+    record.favicon = std::move(favicon);
+
+    if (day == m_dedupDay)
+    {
+        m_dedup[GetDedupKey(record.uri, day)] = id;
+    }
+
+    m_records.push_back(std::move(record));
+    ++m_liveCount;
+    return true;
+}
+
+bool HistoryStore::ApplyTouch(int id, LONGLONG timestamp)
+{
+    Record* record = FindRecord(id);
+    if (!record)
+    {
+        return false;
+    }
+
+    KillSlot(record->slot);
+    record->slot = AppendSlot(id);
+    record->timestamp = timestamp;
+    return true;
+}
+
+bool HistoryStore::ApplyUpdate(int id, std::string title, std::string favicon)
+{
+    Record* record = FindRecord(id);
+    if (!record)
+    {
+        return false;
+    }
+
+    record->title = std::move(title);
+    record->favicon = std::move(favicon);
+    return true;
+}
+
+bool HistoryStore::ApplyRemove(int id)
+{
+    Record* record = FindRecord(id);
+    if (!record)
+    {
+        return false;
+    }
+
+    record->live = false;
+    std::string().swap(record->uri);
+    std::string().swap(record->title);
+    std::string().swap(record->favicon);
+    --m_liveCount;
+    KillSlot(record->slot);
+    return true;
+}
+
+// Adds the visits and sorts the slots by time. Visits of the same time keep
+// their order.
+bool HistoryStore::ApplyImport(int firstId, std::vector<Record>& records)
+{
+    if (firstId != static_cast<int>(m_records.size()) + 1)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        Record& record = records[i];
+        ApplyAdd(firstId + static_cast<int>(i), record.timestamp, record.day, std::move(record.uri), std::move(record.title), std::move(record.favicon));
+    }
+
+    std::vector<int> ids;
+    ids.reserve(m_liveCount);
+    for (int id : m_slots)
+    {
+        if (id != 0)
+        {
+            ids.push_back(id);
+        }
+    }
+    std::stable_sort(ids.begin(), ids.end(), [this](int a, int b)
+    {
+        return m_records[a - 1].timestamp < m_records[b - 1].timestamp;
+    });
+
+    m_slots.swap(ids);
+    RebuildSlots();
+    // The visits of the current day may no longer be the last ones
+    m_dedup.clear();
+    m_dedupDay = -1;
+    return true;
+}
+
+void HistoryStore::Reset()
+{
+    m_records.clear();
+    m_liveCount = 0;
+    m_slots.clear();
+    m_tree.clear();
+    m_deadSlots = 0;
+    m_dedup.clear();
+    m_dedupDay = -1;
+    m_logRecords = 0;
+}
+
+HistoryStore::Record* HistoryStore::FindRecord(int id)
+{
+    if (id < 1 || id > static_cast<int>(m_records.size()) || !m_records[id - 1].live)
+    {
+        return nullptr;
+    }
+    return &m_records[id - 1];
+}
+
+HRESULT HistoryStore::AppendRecord()
+{
+    EndRecord(m_buffer);
+    ++m_logRecords;
+    return WriteLog(m_file.get(), m_buffer);
+}
+
+// Rewrites the log with one record per live entry. Ids are renumbered, which
+// is fine as long as no page holds on to them, i.e. during startup.
+HRESULT HistoryStore::Compact()
+{
+    std::vector<Record> records;
+    records.swap(m_records);
+    std::vector<int> slots;
+    slots.swap(m_slots);
+    Reset();
+
+    std::string log(s_logHeader, sizeof(s_logHeader));
+    for (int oldId : slots)
+    {
+        if (oldId == 0)
+        {
+            continue;
+        }
+
+        Record& record = records[oldId - 1];
+        int id = static_cast<int>(m_records.size()) + 1;
+        BeginRecord(m_buffer, c_recordAdd);
+        PutInt32(m_buffer, id);
+        PutInt64(m_buffer, record.timestamp);
+        PutInt32(m_buffer, record.day);
+        PutString(m_buffer, record.uri);
+        PutString(m_buffer, record.title);
+        PutString(m_buffer, record.favicon);
+        EndRecord(m_buffer);
+        log.append(m_buffer);
+
+        ApplyAdd(id, record.timestamp, record.day, std::move(record.uri), std::move(record.title), std::move(record.favicon));
+    }
+    m_logRecords = m_liveCount;
+
+    // Write the new log next to the old one and swap them, so that a crash
+    // leaves one of the two intact
+    std::wstring tempPath = m_path + L".tmp";
+    {
+        wil::unique_hfile tempFile(CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr,
+            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!tempFile)
+        {
+            RETURN_LAST_ERROR();
+        }
+        RETURN_IF_FAILED(WriteLog(tempFile.get(), log));
+        RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(tempFile.get()));
+    }
+
+    m_file.reset();
+    RETURN_IF_WIN32_BOOL_FALSE(MoveFileExW(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING));
+
+    m_file.reset(CreateFileW(m_path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!m_file)
+    {
+        RETURN_LAST_ERROR();
+    }
+
+    LARGE_INTEGER end = {};
+    RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(m_file.get(), end, nullptr, FILE_END));
+    return S_OK;
+}
+
+HRESULT HistoryStore::WriteLog(HANDLE file, const std::string& data)
+{
+    if (file == nullptr || file == INVALID_HANDLE_VALUE)
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    size_t written = 0;
+    while (written < data.size())
+    {
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(data.size() - written, 1 << 30));
+        DWORD bytesWritten = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(WriteFile(file, data.data() + written, chunk, &bytesWritten, nullptr));
+        written += bytesWritten;
+    }
+    return S_OK;
+}
+
+// Appends a live slot and returns its index. Node i of the tree covers the
+// slots (i - lowbit(i), i], so the new node is the sum of the slots before it
+// in its range plus one.
+size_t HistoryStore::AppendSlot(int id)
+{
+    m_slots.push_back(id);
+    size_t node = m_slots.size();
+    size_t first = node - (node & (0 - node));
+
+    int value = 1;
+    for (size_t i = node - 1; i > first; i -= i & (0 - i))
+    {
+        value += m_tree[i - 1];
+    }
+    m_tree.push_back(value);
+
+    return node - 1;
+}
+
+void HistoryStore::KillSlot(size_t slot)
+{
+    m_slots[slot] = 0;
+    for (size_t node = slot + 1; node <= m_tree.size(); node += node & (0 - node))
+    {
+        --m_tree[node - 1];
+    }
+
+    ++m_deadSlots;
+    if (m_deadSlots >= c_minDeadSlotsToRebuild && m_deadSlots > m_slots.size() / 2)
+    {
+        RebuildSlots();
+    }
+}
+
+// Drops the dead slots and rebuilds the tree in linear time
+void HistoryStore::RebuildSlots()
+{
+    size_t live = 0;
+    for (size_t slot = 0; slot < m_slots.size(); ++slot)
+    {
+        int id = m_slots[slot];
+        if (id != 0)
+        {
+            m_records[id - 1].slot = live;
+            m_slots[live++] = id;
+        }
+    }
+    m_slots.resize(live);
+    m_deadSlots = 0;
+
+    m_tree.assign(live, 1);
+    for (size_t node = 1; node <= live; ++node)
+    {
+        size_t parent = node + (node & (0 - node));
+        if (parent <= live)
+        {
+            m_tree[parent - 1] += m_tree[node - 1];
+        }
+    }
+}
+
+// Returns the slot of the live visit with the given 1-based rank in time order
+size_t HistoryStore::FindSlot(size_t rank) const
+{
+    size_t node = 0;
+    size_t step = 1;
+    while (step * 2 <= m_tree.size())
+    {
+        step *= 2;
+    }
+
+    for (; step != 0; step /= 2)
+    {
+        size_t next = node + step;
+        if (next <= m_tree.size() && static_cast<size_t>(m_tree[next - 1]) < rank)
+        {
+            node = next;
+            rank -= m_tree[next - 1];
+        }
+    }
+    return node;
+}
+
+// Visits are in time order, so the visits of the current day are at the end
+void HistoryStore::RebuildDedup(int day)
+{
+    m_dedup.clear();
+    m_dedupDay = day;
+
+    for (size_t slot = m_slots.size(); slot-- > 0;)
+    {
+        int id = m_slots[slot];
+        if (id == 0)
+        {
+            continue;
+        }
+
+        const Record& record = m_records[id - 1];
+        if (record.day != day)
+        {
+            break;
+        }
+        m_dedup.insert(std::make_pair(GetDedupKey(record.uri, day), id));
+    }
+}
+
+ULONGLONG HistoryStore::GetDedupKey(const std::string& uri, int day)
+{
+    // FNV-1a over the day and the URI
+    ULONGLONG hash = 14695981039346656037ULL;
+    for (int i = 0; i < 4; ++i)
+    {
+        hash = (hash ^ static_cast<unsigned char>(day >> (8 * i))) * 1099511628211ULL;
+    }
+    for (char c : uri)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,107 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+#include "Messages.h"
+
+// Browsing history kept by the host. Every change is appended to a log file
+// which is replayed on startup and compacted when most of it is obsolete.
+//
+// Visits are kept in a sequence of slots ordered by time. A Fenwick tree over
+// the live slots finds the n-th most recent visit in O(log n), so a page of
+// history costs the same no matter how far down the list it is. A URI which
+// is visited again on the same day reuses its entry, which then moves to the
+// front of the list.
+class HistoryStore
+{
+public:
+    HRESULT Open(LPCWSTR path);
+
+    // timestamp is in milliseconds since 1970, day identifies the local
+    // calendar day of the visit
+    HRESULT Add(const std::wstring& uri, const std::wstring& title, const std::wstring& favicon, LONGLONG timestamp, int day, int* id);
+    HRESULT Update(int id, const std::wstring& title, const std::wstring& favicon);
+    HRESULT Remove(int id);
+    HRESULT Clear();
+    // Adds visits from before the host kept the history, which may be older
+    // than the visits in the store
+    HRESULT Import(const std::vector<ImportedVisit>& visits);
+
+    size_t GetCount() const { return m_liveCount; }
+
+    static const size_t c_maxPageCount = 500;  // Entries returned at once
+
+    // Returns up to count entries, most recent first, skipping the first from
+    HRESULT GetPage(size_t from, size_t count, std::vector<HistoryEntry>& entries) const;
+    // Returns the number of visits at or after timestamp, which is where the
+    // older visits start in GetPage(). Takes O(log^2 n).
+    size_t GetCountSince(LONGLONG timestamp) const;
+    HRESULT GetItem(int id, HistoryItemFields& item) const;
+
+    // Calls f(uri, title, timestamp) with the UTF-8 strings of every entry,
+    // oldest first
+    template<typename F> void ForEach(F f) const
+    {
+        for (int id : m_slots)
+        {
+            if (id != 0)
+            {
+                const Record& record = m_records[id - 1];
+                f(record.uri, record.title, record.timestamp);
+            }
+        }
+    }
+
+private:
+    struct Record
+    {
+        LONGLONG timestamp;
+        int day;
+        size_t slot;
+        bool live;
+        std::string uri;    // UTF-8
+        std::string title;
+        std::string favicon;
+    };
+
+    std::wstring m_path;
+    wil::unique_hfile m_file;
+    std::string m_buffer;  // Record being encoded
+    size_t m_logRecords = 0;
+
+    std::vector<Record> m_records;  // Indexed by id - 1
+    size_t m_liveCount = 0;
+
+    // Slot -> id, 0 for a slot whose visit was moved or removed
+    std::vector<int> m_slots;
+    std::vector<int> m_tree;  // Fenwick tree of live slots, 1-based
+    size_t m_deadSlots = 0;
+
+    // (uri, day) -> id for the visits of m_dedupDay
+    std::unordered_map<ULONGLONG, int> m_dedup;
+    int m_dedupDay = -1;
+
+    size_t Replay(const std::string& log);
+    bool ApplyAdd(int id, LONGLONG timestamp, int day, std::string uri, std::string title, std::string favicon);
+    bool ApplyTouch(int id, LONGLONG timestamp);
+    bool ApplyUpdate(int id, std::string title, std::string favicon);
+    bool ApplyRemove(int id);
+    bool ApplyImport(int firstId, std::vector<Record>& records);
+    void Reset();
+
+    Record* FindRecord(int id);
+    HRESULT AppendRecord();
+    HRESULT Compact();
+    HRESULT WriteLog(HANDLE file, const std::string& data);
+
+    size_t AppendSlot(int id);
+    void KillSlot(size_t slot);
+    void RebuildSlots();
+    size_t FindSlot(size_t rank) const;
+
+    void RebuildDedup(int day);
+    static ULONGLONG GetDedupKey(const std::string& uri, int day);
+};
@@ -0,0 +1,67 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "InternalPages.h"
+
+static const LPCWSTR s_browserScheme = L"browser://";
+
+static const struct
+{
+    InternalPage page;
+    LPCWSTR name;
+    LPCWSTR relativePath;
+} s_pages[] =
+{
+    { InternalPage::Favorites, L"favorites", L"wvbrowser_ui\\content_ui\\favorites.html" },
+    { InternalPage::Settings, L"settings", L"wvbrowser_ui\\content_ui\\settings.html" },
+    { InternalPage::History, L"history", L"wvbrowser_ui\\content_ui\\history.html" },
+};
+
+HRESULT InternalPages::Initialize(std::function<std::wstring(LPCWSTR)> resolvePath, std::function<std::wstring(const std::wstring&)> pathToUri)
+{
+    m_byUri.clear();
+    m_byAlias.clear();
+    m_minUriLength = SIZE_MAX;
+    m_maxUriLength = 0;
+
+    for (const auto& page : s_pages)
+    {
+        Entry& entry = m_entries[static_cast<size_t>(page.page)];
+        entry.filePath = resolvePath(page.relativePath);
+        entry.fileUri = pathToUri(entry.filePath);
+        entry.alias = s_browserScheme;
+        entry.alias.append(page.name);
+
+        if (entry.fileUri.empty())
+        {
+            return E_FAIL;
+        }
+
+        m_byUri[entry.fileUri] = page.page;
+        m_byAlias[entry.alias] = page.page;
+        m_minUriLength = std::min(m_minUriLength, entry.fileUri.length());
+        m_maxUriLength = std::max(m_maxUriLength, entry.fileUri.length());
+    }
+
+    return S_OK;
+}
+
+InternalPage InternalPages::FromUri(LPCWSTR uri) const
+{
+    // Most sources are web pages, reject them by length before hashing
+    size_t length = wcsnlen(uri, m_maxUriLength + 1);
+    if (length < m_minUriLength || length > m_maxUriLength)
+    {
+        return InternalPage::None;
+    }
+
+    auto it = m_byUri.find(std::wstring(uri, length));
+    return it == m_byUri.end() ? InternalPage::None : it->second;
+}
+
+InternalPage InternalPages::FromAlias(const std::wstring& uri) const
+{
+    auto it = m_byAlias.find(uri);
+    return it == m_byAlias.end() ? InternalPage::None : it->second;
+}
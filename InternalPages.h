@@ -0,0 +1,51 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+enum class InternalPage
+{
+    None,
+    Favorites,
+    Settings,
+    History,
+    Count
+};
+
+// The browser pages in wvbrowser_ui\content_ui. Their file paths and file://
+// URIs are resolved once at startup, so that classifying the source of a tab
+// is a single hash lookup rather than rebuilding the paths on every event.
+class InternalPages
+{
+public:
+    // resolvePath maps a path relative to the executable to a full path,
+    // pathToUri turns that full path into the URI WebView2 reports as source.
+    HRESULT Initialize(std::function<std::wstring(LPCWSTR)> resolvePath, std::function<std::wstring(const std::wstring&)> pathToUri);
+
+    // Returns the page a WebView source URI belongs to, or InternalPage::None
+    InternalPage FromUri(LPCWSTR uri) const;
+    // Returns the page for a browser://name alias, or InternalPage::None
+    InternalPage FromAlias(const std::wstring& uri) const;
+
+    const std::wstring& GetFilePath(InternalPage page) const { return GetEntry(page).filePath; }
+    const std::wstring& GetAlias(InternalPage page) const { return GetEntry(page).alias; }
+
+private:
+    struct Entry
+    {
+        std::wstring filePath;
+        std::wstring fileUri;
+        std::wstring alias;
+    };
+
+    Entry m_entries[static_cast<size_t>(InternalPage::Count)];
+    std::unordered_map<std::wstring, InternalPage> m_byUri;
+    std::unordered_map<std::wstring, InternalPage> m_byAlias;
+    size_t m_minUriLength = 0;
+    size_t m_maxUriLength = 0;
+
+    const Entry& GetEntry(InternalPage page) const { return m_entries[static_cast<size_t>(page)]; }
+};
@@ -0,0 +1,209 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "LoadScheduler.h"
+#include "Utf.h"
+
+static void AppendJsonString(const std::wstring& value, std::string& json)
+{
+    std::string utf8;
+    AppendUtf8(value.c_str(), value.size(), utf8);
+    json += '"';
+    for (char c : utf8)
+    {
+        if (c == '"' || c == '\\')
+        {
+            json += '\\';
+            json += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            StringCchPrintfA(escaped, _countof(escaped), "\\u%04x", c);
+            json += escaped;
+        }
+        else
+        {
+            json += c;
+        }
+    }
+    json += '"';
+}
+
+LoadScheduler::LoadScheduler(size_t maxLoading, std::function<ULONGLONG()> clock, std::function<HRESULT(size_t tabId)> start) :
+    m_maxLoading(std::max<size_t>(maxLoading, 1)), m_clock(std::move(clock)), m_start(std::move(start))
+{
+}
+
+HRESULT LoadScheduler::Add(size_t tabId, const std::wstring& uri, size_t priority)
+{
+    Remove(tabId);
+    if (IsIdle())
+    {
+        m_progress = Progress();
+    }
+
+    Entry& entry = m_entries[tabId];
+    entry.uri = uri;
+    entry.priority = priority;
+    entry.sequence = m_nextSequence++;
+    entry.added = m_clock();
+    m_queue.emplace(std::make_pair(entry.priority, entry.sequence), tabId);
+    ++m_progress.total;
+    return Pump();
+}
+
+HRESULT LoadScheduler::Prioritize(size_t tabId)
+{
+    auto it = m_entries.find(tabId);
+    if (it == m_entries.end() || it->second.loading)
+    {
+        return S_OK;
+    }
+
+    m_queue.erase(std::make_pair(it->second.priority, it->second.sequence));
+    return Start(tabId, it->second);
+}
+
+HRESULT LoadScheduler::Completed(size_t tabId, bool succeeded)
+{
+    auto it = m_entries.find(tabId);
+    if (it == m_entries.end() || !it->second.loading)
+    {
+        return S_OK;
+    }
+
+    Finish(tabId, succeeded ? Outcome::Succeeded : Outcome::Failed);
+    return Pump();
+}
+
+HRESULT LoadScheduler::Remove(size_t tabId)
+{
+    auto it = m_entries.find(tabId);
+    if (it == m_entries.end())
+    {
+        return S_OK;
+    }
+
+    if (it->second.loading)
+    {
+        --m_loading;
+    }
+    else
+    {
+        m_queue.erase(std::make_pair(it->second.priority, it->second.sequence));
+    }
+    m_entries.erase(it);
+    --m_progress.total;
+    return Pump();
+}
+
+HRESULT LoadScheduler::Expire()
+{
+    ULONGLONG const now = m_clock();
+    std::vector<size_t> expired;
+    for (const auto& entry : m_entries)
+    {
+        if (entry.second.loading && now - entry.second.started >= c_loadTimeout)
+        {
+            expired.push_back(entry.first);
+        }
+    }
+
+    for (size_t tabId : expired)
+    {
+        Finish(tabId, Outcome::TimedOut);
+    }
+    return Pump();
+}
+
+LoadScheduler::Progress LoadScheduler::GetProgress() const
+{
+    Progress progress = m_progress;
+    progress.loading = m_loading;
+    progress.queued = m_queue.size();
+    return progress;
+}
+
+std::vector<LoadScheduler::Result> LoadScheduler::TakeResults()
+{
+    std::vector<Result> results;
+    results.swap(m_results);
+    return results;
+}
+
+void LoadScheduler::AppendReport(const std::vector<Result>& results, std::string& utf8)
+{
+    static const char* const s_outcomes[] = { "succeeded", "failed", "timedOut" };
+    for (const Result& result : results)
+    {
+        utf8 += "{\"uri\":";
+        AppendJsonString(result.uri, utf8);
+
+        char fields[160];
+        StringCchPrintfA(fields, _countof(fields), ",\"tabId\":%zu,\"outcome\":\"%s\",\"waited\":%llu,\"loaded\":%llu}\n",
+            result.tabId, s_outcomes[static_cast<int>(result.outcome)],
+            result.started - result.added, result.finished - result.started);
+        utf8 += fields;
+    }
+}
+
+// The state is updated before start is called, a failed start may well be
+// reported through Completed() before start returns
+HRESULT LoadScheduler::Start(size_t tabId, Entry& entry)
+{
+    entry.loading = true;
+    entry.started = m_clock();
+    ++m_loading;
+
+    HRESULT hr = m_start(tabId);
+    if (FAILED(hr))
+    {
+        auto it = m_entries.find(tabId);
+        if (it != m_entries.end() && it->second.loading)
+        {
+            Finish(tabId, Outcome::Failed);
+        }
+    }
+    return hr;
+}
+
+void LoadScheduler::Finish(size_t tabId, Outcome outcome)
+{
+    auto it = m_entries.find(tabId);
+
+    Result result;
+    result.tabId = tabId;
+    result.uri = std::move(it->second.uri);
+    result.outcome = outcome;
+    result.added = it->second.added;
+    result.started = it->second.started;
+    result.finished = m_clock();
+    m_results.push_back(std::move(result));
+
+    m_entries.erase(it);
+    --m_loading;
+    ++m_progress.finished;
+    if (outcome != Outcome::Succeeded)
+    {
+        ++m_progress.failed;
+    }
+}
+
+HRESULT LoadScheduler::Pump()
+{
+    HRESULT result = S_OK;
+    while (m_loading < m_maxLoading && !m_queue.empty())
+    {
+        size_t const tabId = m_queue.begin()->second;
+        m_queue.erase(m_queue.begin());
+
+        HRESULT hr = Start(tabId, m_entries.at(tabId));
+        if (FAILED(hr))
+        {
+            result = hr;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,99 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Loads the tabs opened from a list of URLs in the background, at most
+// maxLoading at once, and keeps when each one was added, started and
+// finished. The other tabs wait in priority order, lower first, and in the
+// order they were added for equal priorities. The tabs of a list get their
+// position in it as priority, so lists which load at the same time take
+// turns. A tab which is shown starts right away, even if every slot is
+// taken.
+//
+// A load ends when Completed() reports its navigation, or times out after
+// c_loadTimeout once Expire() is called. The progress counts the tabs added
+// since the scheduler was last idle.
+//
+// Knows nothing about WebView2 or the time, start is called for a tab which
+// is let in and clock returns milliseconds.
+class LoadScheduler
+{
+public:
+    enum class Outcome
+    {
+        Succeeded,
+        Failed,
+        TimedOut,
+    };
+
+    struct Result
+    {
+        size_t tabId = 0;
+        std::wstring uri;
+        Outcome outcome = Outcome::Succeeded;
+        ULONGLONG added = 0;
+        ULONGLONG started = 0;
+        ULONGLONG finished = 0;
+    };
+
+    struct Progress
+    {
+        size_t total = 0;
+        size_t finished = 0;  // Whatever the outcome
+        size_t failed = 0;    // Failed or timed out
+        size_t loading = 0;
+        size_t queued = 0;
+    };
+
+    static const ULONGLONG c_loadTimeout = 60 * 1000;
+
+    LoadScheduler(size_t maxLoading, std::function<ULONGLONG()> clock, std::function<HRESULT(size_t tabId)> start);
+
+    HRESULT Add(size_t tabId, const std::wstring& uri, size_t priority);
+    // Starts a queued tab now, other tabs are ignored
+    HRESULT Prioritize(size_t tabId);
+    // Tabs which aren't loading are ignored
+    HRESULT Completed(size_t tabId, bool succeeded);
+    // A closed tab frees its slot and leaves no result
+    HRESULT Remove(size_t tabId);
+    HRESULT Expire();
+
+    bool IsScheduled(size_t tabId) const { return m_entries.count(tabId) != 0; }
+    bool IsIdle() const { return m_entries.empty(); }
+    Progress GetProgress() const;
+    // In the order the tabs finished
+    std::vector<Result> TakeResults();
+
+    // One JSON object per line: uri, tabId, outcome, waited and loaded in
+    // milliseconds
+    static void AppendReport(const std::vector<Result>& results, std::string& utf8);
+
+private:
+    struct Entry
+    {
+        std::wstring uri;
+        size_t priority = 0;
+        ULONGLONG sequence = 0;
+        ULONGLONG added = 0;
+        ULONGLONG started = 0;
+        bool loading = false;
+    };
+
+    size_t m_maxLoading;
+    std::function<ULONGLONG()> m_clock;
+    std::function<HRESULT(size_t tabId)> m_start;
+    std::unordered_map<size_t, Entry> m_entries;
+    std::map<std::pair<size_t, ULONGLONG>, size_t> m_queue;  // Tab ids by priority and sequence
+    ULONGLONG m_nextSequence = 0;
+    size_t m_loading = 0;
+    Progress m_progress;  // Total, finished and failed
+    std::vector<Result> m_results;
+
+    HRESULT Start(size_t tabId, Entry& entry);
+    void Finish(size_t tabId, Outcome outcome);
+    HRESULT Pump();
+};
@@ -0,0 +1,607 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "MessageCodec.h"
+
+// Messages may come from arbitrary web content, bound the nesting we accept
+static const int c_maxNestingDepth = 64;
+
+static void SkipWhitespace(LPCWSTR &p, LPCWSTR end)
+{
+    while (p < end && (*p == L' ' || *p == L'\t' || *p == L'\n' || *p == L'\r'))
+    {
+        ++p;
+    }
+}
+
+static bool SkipString(LPCWSTR &p, LPCWSTR end)
+{
+    // p points at the opening quote
+    for (++p; p < end; ++p)
+    {
+        if (*p == L'"')
+        {
+            ++p;
+            return true;
+        }
+        if (*p == L'\\' && ++p == end)
+        {
+            break;
+        }
+    }
+    return false;
+}
+
+static bool SkipLiteral(LPCWSTR &p, LPCWSTR end, LPCWSTR literal)
+{
+    size_t const len = wcslen(literal);
+    if (static_cast<size_t>(end - p) < len || wcsncmp(p, literal, len) != 0)
+    {
+        return false;
+    }
+    p += len;
+    return true;
+}
+
+static bool SkipNested(LPCWSTR &p, LPCWSTR end, int depth)
+{
+    SkipWhitespace(p, end);
+    if (p == end)
+    {
+        return false;
+    }
+
+    switch (*p)
+    {
+    case L'{':
+    case L'[':
+    {
+        if (depth == c_maxNestingDepth)
+        {
+            return false;
+        }
+        WCHAR const close = *p == L'{' ? L'}' : L']';
+        bool const isObject = close == L'}';
+        ++p;
+        SkipWhitespace(p, end);
+        if (p < end && *p == close)
+        {
+            ++p;
+            return true;
+        }
+        for (;;)
+        {
+            if (isObject)
+            {
+                SkipWhitespace(p, end);
+                if (p == end || *p != L'"' || !SkipString(p, end))
+                {
+                    return false;
+                }
+                SkipWhitespace(p, end);
+                if (p == end || *p++ != L':')
+                {
+                    return false;
+                }
+            }
+            if (!SkipNested(p, end, depth + 1))
+            {
+                return false;
+            }
+            SkipWhitespace(p, end);
+            if (p == end)
+            {
+                return false;
+            }
+            if (*p == close)
+            {
+                ++p;
+                return true;
+            }
+            if (*p++ != L',')
+            {
+                return false;
+            }
+        }
+    }
+    case L'"':
+        return SkipString(p, end);
+    case L't':
+        return SkipLiteral(p, end, L"true");
+    case L'f':
+        return SkipLiteral(p, end, L"false");
+    case L'n':
+        return SkipLiteral(p, end, L"null");
+    default:
+    {
+        LPCWSTR const start = p;
+        while (p < end && ((*p >= L'0' && *p <= L'9') || *p == L'-' || *p == L'+' || *p == L'.' || *p == L'e' || *p == L'E'))
+        {
+            ++p;
+        }
+        return p != start;
+    }
+    }
+}
+
+static HRESULT DecodeNumber(LPCWSTR begin, LPCWSTR end, double &value)
+{
+    // The input buffer is zero terminated, so wcstod stops within it
+    LPWSTR stop = nullptr;
+    value = wcstod(begin, &stop);
+    return stop == end && begin != end ? S_OK : E_INVALIDARG;
+}
+
+// Integers have to be whole and within [min, limit), so a number a page posts
+// can't overflow the cast to the field. NaN fails every comparison, and the
+// limits are powers of two, which a double holds exactly.
+static HRESULT DecodeInteger(LPCWSTR begin, LPCWSTR end, double min, double limit, double &value)
+{
+    RETURN_IF_FAILED(DecodeNumber(begin, end, value));
+    if (!(value >= min && value < limit) || std::floor(value) != value)
+    {
+        return E_INVALIDARG;
+    }
+    return S_OK;
+}
+
+static bool KeyEquals(LPCWSTR begin, LPCWSTR end, LPCWSTR name)
+{
+    // begin and end exclude the quotes
+    size_t const len = wcslen(name);
+    return static_cast<size_t>(end - begin) == len && wcsncmp(begin, name, len) == 0;
+}
+
+LPCWSTR MessageWriter::WriteForwarded(const MessageReader &reader, size_t tabId)
+{
+    BeginMessage(reader.m_message);
+
+    LPCWSTR begin = reader.m_argsBegin;
+    LPCWSTR end = reader.m_argsEnd;
+    if (begin != end && *begin == L'{')
+    {
+        // Copy the members of the args object verbatim
+        ++begin;
+        --end;
+        SkipWhitespace(begin, end);
+        if (begin != end)
+        {
+            m_buffer.append(begin, end);
+            m_firstField = false;
+        }
+    }
+
+    WriteName(L"tabId");
+    WriteValue(tabId);
+
+    return EndMessage();
+}
+
+void MessageWriter::BeginMessage(int message)
+{
+    m_buffer.clear();
+    m_buffer.append(L"{\"message\":");
+    WriteValue(message);
+    m_buffer.append(L",\"args\":{");
+    m_firstField = true;
+}
+
+LPCWSTR MessageWriter::EndMessage()
+{
+    m_buffer.append(L"}}");
+    return m_buffer.c_str();
+}
+
+void MessageWriter::WriteName(LPCWSTR name)
+{
+    if (!m_firstField)
+    {
+        m_buffer.push_back(L',');
+    }
+    m_firstField = false;
+
+    m_buffer.push_back(L'"');
+    m_buffer.append(name);
+    m_buffer.append(L"\":");
+}
+
+void MessageWriter::WriteValue(size_t value)
+{
+    WriteNumber(value, false);
+}
+
+void MessageWriter::WriteValue(int value)
+{
+    WriteNumber(value < 0 ? 0ULL - static_cast<unsigned long long>(value) : value, value < 0);
+}
+
+void MessageWriter::WriteValue(bool value)
+{
+    m_buffer.append(value ? L"true" : L"false");
+}
+
+void MessageWriter::WriteValue(const std::wstring &value)
+{
+    static WCHAR const hex[] = L"0123456789abcdef";
+
+    m_buffer.push_back(L'"');
+
+    // Append runs of characters which need no escaping in one go
+    LPCWSTR run = value.c_str();
+    LPCWSTR const end = run + value.size();
+    for (LPCWSTR p = run; p < end; ++p)
+    {
+        WCHAR const c = *p;
+        if (c >= 0x20 && c != L'"' && c != L'\\')
+        {
+            continue;
+        }
+
+        m_buffer.append(run, p);
+        run = p + 1;
+
+        m_buffer.push_back(L'\\');
+        switch (c)
+        {
+        case L'"': m_buffer.push_back(L'"'); break;
+        case L'\\': m_buffer.push_back(L'\\'); break;
+        case L'\b': m_buffer.push_back(L'b'); break;
+        case L'\f': m_buffer.push_back(L'f'); break;
+        case L'\n': m_buffer.push_back(L'n'); break;
+        case L'\r': m_buffer.push_back(L'r'); break;
+        case L'\t': m_buffer.push_back(L't'); break;
+        default:
+            m_buffer.append(L"u00");
+            m_buffer.push_back(hex[c >> 4]);
+            m_buffer.push_back(hex[c & 0xF]);
+            break;
+        }
+    }
+    m_buffer.append(run, end);
+
+    m_buffer.push_back(L'"');
+}
+
+void MessageWriter::WriteValue(const JsonValue &value)
+{
+    if (value.json.empty())
+    {
+        m_buffer.append(L"null");
+    }
+    else
+    {
+        m_buffer.append(value.json);
+    }
+}
+
+void MessageWriter::WriteValue(long long value)
+{
+    WriteNumber(value < 0 ? 0ULL - static_cast<unsigned long long>(value) : value, value < 0);
+}
+
+void MessageWriter::WriteNumber(unsigned long long value, bool negative)
+{
+    WCHAR digits[24];
+    WCHAR *p = digits + _countof(digits);
+    do
+    {
+        *--p = static_cast<WCHAR>(L'0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    if (negative)
+    {
+        *--p = L'-';
+    }
+    m_buffer.append(p, digits + _countof(digits));
+}
+
+HRESULT MessageReader::Parse(LPCWSTR json)
+{
+    m_message = 0;
+    m_argsBegin = m_argsEnd = nullptr;
+
+    LPCWSTR p = json;
+    LPCWSTR const end = json + wcslen(json);
+    bool hasMessage = false;
+
+    SkipWhitespace(p, end);
+    if (p == end || *p++ != L'{')
+    {
+        return E_INVALIDARG;
+    }
+
+    SkipWhitespace(p, end);
+    if (p < end && *p == L'}')
+    {
+        return E_INVALIDARG;
+    }
+
+    for (;;)
+    {
+        SkipWhitespace(p, end);
+        LPCWSTR const keyBegin = p + 1;
+        if (p == end || *p != L'"' || !SkipString(p, end))
+        {
+            return E_INVALIDARG;
+        }
+        LPCWSTR const keyEnd = p - 1;
+
+        SkipWhitespace(p, end);
+        if (p == end || *p++ != L':')
+        {
+            return E_INVALIDARG;
+        }
+
+        SkipWhitespace(p, end);
+        LPCWSTR const valueBegin = p;
+        if (!SkipNested(p, end, 1))
+        {
+            return E_INVALIDARG;
+        }
+
+        if (KeyEquals(keyBegin, keyEnd, L"message"))
+        {
+            RETURN_IF_FAILED(DecodeValue(valueBegin, p, m_message));
+            hasMessage = true;
+        }
+        else if (KeyEquals(keyBegin, keyEnd, L"args"))
+        {
+            m_argsBegin = valueBegin;
+            m_argsEnd = p;
+        }
+
+        SkipWhitespace(p, end);
+        if (p == end)
+        {
+            return E_INVALIDARG;
+        }
+        if (*p == L'}')
+        {
+            break;
+        }
+        if (*p++ != L',')
+        {
+            return E_INVALIDARG;
+        }
+    }
+
+    if (!hasMessage)
+    {
+        OutputDebugString(L"No message code provided\n");
+        return E_INVALIDARG;
+    }
+
+    if (!m_argsBegin)
+    {
+        OutputDebugString(L"The message has no args field\n");
+        return E_INVALIDARG;
+    }
+
+    return S_OK;
+}
+
+HRESULT MessageReader::SkipValue(LPCWSTR &p, LPCWSTR end, ValueKind kind)
+{
+    SkipWhitespace(p, end);
+    if (kind == object_only && (p == end || *p != L'{'))
+    {
+        return E_INVALIDARG;
+    }
+    return SkipNested(p, end, 0) ? S_OK : E_INVALIDARG;
+}
+
+bool MessageReader::FindMember(LPCWSTR begin, LPCWSTR end, LPCWSTR name, LPCWSTR &valueBegin, LPCWSTR &valueEnd)
+{
+    // The range has been validated by Parse() or ReadObject() already
+    LPCWSTR p = begin;
+    SkipWhitespace(p, end);
+    if (p == end || *p++ != L'{')
+    {
+        return false;
+    }
+
+    std::wstring key;
+    for (;;)
+    {
+        SkipWhitespace(p, end);
+        if (p == end || *p != L'"')
+        {
+            return false;
+        }
+
+        LPCWSTR const keyBegin = p;
+        if (!SkipString(p, end))
+        {
+            return false;
+        }
+
+        bool matches;
+        if (std::find(keyBegin, p, L'\\') == p)
+        {
+            matches = KeyEquals(keyBegin + 1, p - 1, name);
+        }
+        else
+        {
+            // Rare escaped key, compare its decoded form
+            matches = SUCCEEDED(DecodeValue(keyBegin, p, key)) && key.compare(name) == 0;
+        }
+
+        SkipWhitespace(p, end);
+        if (p == end || *p++ != L':')
+        {
+            return false;
+        }
+
+        SkipWhitespace(p, end);
+        valueBegin = p;
+        if (!SkipNested(p, end, 1))
+        {
+            return false;
+        }
+        valueEnd = p;
+
+        if (matches)
+        {
+            return true;
+        }
+
+        SkipWhitespace(p, end);
+        if (p == end || *p++ != L',')
+        {
+            return false;
+        }
+    }
+}
+
+// Steps through an array, p starts at its '['. Returns S_FALSE after the
+// last element.
+HRESULT MessageReader::NextElement(LPCWSTR &p, LPCWSTR end, LPCWSTR &elementBegin, LPCWSTR &elementEnd)
+{
+    SkipWhitespace(p, end);
+    if (p == end)
+    {
+        return E_INVALIDARG;
+    }
+    if (*p == L'[')
+    {
+        ++p;
+        SkipWhitespace(p, end);
+        if (p < end && *p == L']')
+        {
+            ++p;
+            return S_FALSE;
+        }
+    }
+    else if (*p == L']')
+    {
+        ++p;
+        return S_FALSE;
+    }
+    else if (*p++ != L',')
+    {
+        return E_INVALIDARG;
+    }
+
+    SkipWhitespace(p, end);
+    elementBegin = p;
+    if (!SkipNested(p, end, 1))
+    {
+        return E_INVALIDARG;
+    }
+    elementEnd = p;
+    return S_OK;
+}
+
+HRESULT MessageReader::DecodeValue(LPCWSTR begin, LPCWSTR end, size_t &value)
+{
+    double number = 0;
+    RETURN_IF_FAILED(DecodeInteger(begin, end, 0, std::ldexp(1.0, sizeof(size_t) * 8), number));
+    value = static_cast<size_t>(number);
+    return S_OK;
+}
+
+HRESULT MessageReader::DecodeValue(LPCWSTR begin, LPCWSTR end, int &value)
+{
+    double number = 0;
+    RETURN_IF_FAILED(DecodeInteger(begin, end, -std::ldexp(1.0, 31), std::ldexp(1.0, 31), number));
+    value = static_cast<int>(number);
+    return S_OK;
+}
+
+// Timestamps in milliseconds fit the 53 bits a double holds exactly
+HRESULT MessageReader::DecodeValue(LPCWSTR begin, LPCWSTR end, long long &value)
+{
+    double number = 0;
+    RETURN_IF_FAILED(DecodeInteger(begin, end, -std::ldexp(1.0, 63), std::ldexp(1.0, 63), number));
+    value = static_cast<long long>(number);
+    return S_OK;
+}
+
+HRESULT MessageReader::DecodeValue(LPCWSTR begin, LPCWSTR end, bool &value)
+{
+    if (KeyEquals(begin, end, L"true"))
+    {
+        value = true;
+    }
+    else if (KeyEquals(begin, end, L"false"))
+    {
+        value = false;
+    }
+    else
+    {
+        return E_INVALIDARG;
+    }
+    return S_OK;
+}
+
+HRESULT MessageReader::DecodeValue(LPCWSTR begin, LPCWSTR end, std::wstring &value)
+{
+    if (end - begin < 2 || *begin != L'"' || end[-1] != L'"')
+    {
+        return E_INVALIDARG;
+    }
+
+    value.clear();
+    value.reserve(end - begin - 2);
+
+    LPCWSTR run = ++begin;
+    --end;
+    for (LPCWSTR p = begin; p < end; ++p)
+    {
+        if (*p != L'\\')
+        {
+            continue;
+        }
+
+        value.append(run, p);
+        if (++p == end)
+        {
+            return E_INVALIDARG;
+        }
+
+        switch (*p)
+        {
+        case L'b': value.push_back(L'\b'); break;
+        case L'f': value.push_back(L'\f'); break;
+        case L'n': value.push_back(L'\n'); break;
+        case L'r': value.push_back(L'\r'); break;
+        case L't': value.push_back(L'\t'); break;
+        case L'u':
+        {
+            // JSON escapes are UTF-16 code units, which is our string type
+            if (end - p < 5)
+            {
+                return E_INVALIDARG;
+            }
+            WCHAR c = 0;
+            for (int i = 1; i <= 4; ++i)
+            {
+                WCHAR const h = p[i];
+                c <<= 4;
+                if (h >= L'0' && h <= L'9') c |= h - L'0';
+                else if (h >= L'a' && h <= L'f') c |= h - L'a' + 10;
+                else if (h >= L'A' && h <= L'F') c |= h - L'A' + 10;
+                else return E_INVALIDARG;
+            }
+            value.push_back(c);
+            p += 4;
+        }
+        break;
+        default:
+            value.push_back(*p);
+            break;
+        }
+        run = p + 1;
+    }
+    value.append(run, end);
+
+    return S_OK;
+}
+
+HRESULT MessageReader::DecodeValue(LPCWSTR begin, LPCWSTR end, JsonValue &value)
+{
+    value.json.assign(begin, end);
+    return S_OK;
+}
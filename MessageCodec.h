@@ -0,0 +1,172 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+#include "Messages.h"
+
+class MessageReader;
+
+// Encodes typed messages into the JSON wire format used by
+// PostWebMessageAsJson. The UTF-16 output is written straight into a buffer
+// which is reused for every message, so the returned string is only valid
+// until the next call.
+class MessageWriter
+{
+public:
+    template<typename T> LPCWSTR Write(const T &message)
+    {
+        BeginMessage(T::c_message);
+        FieldWriter writer = { this };
+        T::Visit(message, writer);
+        return EndMessage();
+    }
+
+    // Re-encodes a received message with a tabId added to its args, keeping
+    // all other args verbatim.
+    LPCWSTR WriteForwarded(const MessageReader &reader, size_t tabId);
+
+private:
+    std::wstring m_buffer;
+    bool m_firstField = true;
+
+    struct FieldWriter
+    {
+        MessageWriter *m_writer;
+
+        template<typename F> void operator()(LPCWSTR name, const F &value)
+        {
+            m_writer->WriteName(name);
+            m_writer->WriteValue(value);
+        }
+    };
+
+    void BeginMessage(int message);
+    LPCWSTR EndMessage();
+    void WriteName(LPCWSTR name);
+    void WriteValue(size_t value);
+    void WriteValue(int value);
+    void WriteValue(bool value);
+    void WriteValue(const std::wstring &value);
+    void WriteValue(const JsonValue &value);
+    void WriteValue(long long value);
+
+    template<typename T> void WriteValue(const std::vector<T> &values)
+    {
+        m_buffer.push_back(L'[');
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            if (i != 0)
+            {
+                m_buffer.push_back(L',');
+            }
+            WriteValue(values[i]);
+        }
+        m_buffer.push_back(L']');
+    }
+
+    // Nested objects are described by a Visit() like messages are
+    template<typename T> void WriteValue(const T &object)
+    {
+        m_buffer.push_back(L'{');
+        m_firstField = true;
+        FieldWriter writer = { this };
+        T::Visit(object, writer);
+        m_buffer.push_back(L'}');
+        m_firstField = false;
+    }
+    void WriteNumber(unsigned long long value, bool negative);
+};
+
+// Decodes messages received through WebMessageReceived. Parse() locates the
+// message code and the args object, ReadArgs() then decodes only the fields
+// the typed message declares. Unknown fields are skipped, missing fields keep
+// their default value.
+class MessageReader
+{
+public:
+    HRESULT Parse(LPCWSTR json);
+    int GetMessageCode() const { return m_message; }
+
+    template<typename T> HRESULT ReadArgs(T &args) const
+    {
+        return DecodeValue(m_argsBegin, m_argsEnd, args);
+    }
+
+    // Decodes the members of a plain JSON object, e.g. DevTools event params
+    template<typename T> static HRESULT ReadObject(LPCWSTR json, T &object)
+    {
+        LPCWSTR begin = json;
+        LPCWSTR end = json + wcslen(json);
+        RETURN_IF_FAILED(SkipValue(begin, end, object_only));
+        return ReadFields(json, begin, object);
+    }
+
+private:
+    friend class MessageWriter;
+
+    int m_message = 0;
+    LPCWSTR m_argsBegin = nullptr;
+    LPCWSTR m_argsEnd = nullptr;
+
+    enum ValueKind { any_value, object_only };
+
+    struct FieldReader
+    {
+        LPCWSTR m_begin;
+        LPCWSTR m_end;
+        HRESULT m_hr;
+
+        template<typename F> void operator()(LPCWSTR name, F &field)
+        {
+            LPCWSTR valueBegin = nullptr;
+            LPCWSTR valueEnd = nullptr;
+            if (SUCCEEDED(m_hr) && FindMember(m_begin, m_end, name, valueBegin, valueEnd))
+            {
+                m_hr = DecodeValue(valueBegin, valueEnd, field);
+            }
+        }
+    };
+
+    template<typename T> static HRESULT ReadFields(LPCWSTR begin, LPCWSTR end, T &object)
+    {
+        FieldReader reader = { begin, end, S_OK };
+        T::Visit(object, reader);
+        return reader.m_hr;
+    }
+
+    static HRESULT SkipValue(LPCWSTR &p, LPCWSTR end, ValueKind kind = any_value);
+    static bool FindMember(LPCWSTR begin, LPCWSTR end, LPCWSTR name, LPCWSTR &valueBegin, LPCWSTR &valueEnd);
+    static HRESULT DecodeValue(LPCWSTR begin, LPCWSTR end, size_t &value);
+    static HRESULT DecodeValue(LPCWSTR begin, LPCWSTR end, int &value);
+    static HRESULT DecodeValue(LPCWSTR begin, LPCWSTR end, long long &value);
+    static HRESULT DecodeValue(LPCWSTR begin, LPCWSTR end, bool &value);
+    static HRESULT DecodeValue(LPCWSTR begin, LPCWSTR end, std::wstring &value);
+    static HRESULT DecodeValue(LPCWSTR begin, LPCWSTR end, JsonValue &value);
+    static HRESULT NextElement(LPCWSTR &p, LPCWSTR end, LPCWSTR &elementBegin, LPCWSTR &elementEnd);
+
+    template<typename T> static HRESULT DecodeValue(LPCWSTR begin, LPCWSTR end, std::vector<T> &values)
+    {
+        values.clear();
+        LPCWSTR p = begin;
+        LPCWSTR elementBegin = nullptr;
+        LPCWSTR elementEnd = nullptr;
+        HRESULT hr;
+        while ((hr = NextElement(p, end, elementBegin, elementEnd)) == S_OK)
+        {
+            values.emplace_back();
+            RETURN_IF_FAILED(DecodeValue(elementBegin, elementEnd, values.back()));
+        }
+        return SUCCEEDED(hr) ? S_OK : hr;
+    }
+
+    // Nested objects are described by a Visit() like messages are
+    template<typename T> static HRESULT DecodeValue(LPCWSTR begin, LPCWSTR end, T &object)
+    {
+        LPCWSTR p = begin;
+        RETURN_IF_FAILED(SkipValue(p, end, object_only));
+        return ReadFields(begin, end, object);
+    }
+};
@@ -0,0 +1,99 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "MessageDispatcher.h"
+#include "Trace.h"
+
+void MessageDispatcher::Register(int message, InternalPage sender, Handler handler)
+{
+    if (message < 0 || message > MG_LAST)
+    {
+        OutputDebugString(L"Message code out of range\n");
+        return;
+    }
+
+    Entry& entry = m_entries[message];
+    entry.handler = std::move(handler);
+    entry.sender = sender;
+    entry.anySender = false;
+}
+
+void MessageDispatcher::RegisterForAnyPage(int message, Handler handler)
+{
+    Register(message, InternalPage::None, std::move(handler));
+    if (message >= 0 && message <= MG_LAST)
+    {
+        m_entries[message].anySender = true;
+    }
+}
+
+HRESULT MessageDispatcher::Dispatch(const MessageContext& context, InternalPage sender)
+{
+    int message = context.reader.GetMessageCode();
+    if (message < 0 || message > MG_LAST || !m_entries[message].handler)
+    {
+        OutputDebugString(L"Unexpected message\n");
+        return S_FALSE;
+    }
+
+    Entry& entry = m_entries[message];
+    if (!entry.anySender && entry.sender != sender)
+    {
+        return S_FALSE;
+    }
+
+    TRACE_SPAN(L"Dispatch", message);
+    ULONGLONG start = Trace::GetMicroseconds();
+    HRESULT hr = entry.handler(context);
+    ULONGLONG elapsed = Trace::GetMicroseconds() - start;
+
+    int bucket = 0;
+    while (bucket < c_bucketCount - 1 && (1ULL << bucket) <= elapsed)
+    {
+        ++bucket;
+    }
+    ++entry.buckets[bucket];
+    ++entry.count;
+    entry.totalMicroseconds += elapsed;
+    entry.maxMicroseconds = std::max(entry.maxMicroseconds, elapsed);
+
+    return hr;
+}
+
+void MessageDispatcher::DumpStatistics(LPCWSTR name) const
+{
+    WCHAR line[256];
+    StringCchPrintfW(line, _countof(line), L"%s message latency (us): code count mean max p50 p90 p99\n", name);
+    OutputDebugString(line);
+
+    for (int message = 0; message <= MG_LAST; ++message)
+    {
+        const Entry& entry = m_entries[message];
+        if (entry.count == 0)
+        {
+            continue;
+        }
+
+        StringCchPrintfW(line, _countof(line), L"%d %llu %llu %llu <%llu <%llu <%llu\n", message,
+            entry.count, entry.totalMicroseconds / entry.count, entry.maxMicroseconds,
+            GetPercentile(entry, 50), GetPercentile(entry, 90), GetPercentile(entry, 99));
+        OutputDebugString(line);
+    }
+}
+
+// Returns the upper bound of the bucket holding the given percentile
+ULONGLONG MessageDispatcher::GetPercentile(const Entry& entry, ULONGLONG percent)
+{
+    ULONGLONG threshold = (entry.count * percent + 99) / 100;
+    ULONGLONG seen = 0;
+    for (int bucket = 0; bucket < c_bucketCount; ++bucket)
+    {
+        seen += entry.buckets[bucket];
+        if (seen >= threshold)
+        {
+            return 1ULL << bucket;
+        }
+    }
+    return 1ULL << (c_bucketCount - 1);
+}
@@ -0,0 +1,87 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+#include "InternalPages.h"
+#include "MessageCodec.h"
+
+// What a handler gets to see of the message it is called for
+struct MessageContext
+{
+    const MessageReader &reader;
+    LPCWSTR json;   // The message as received
+    size_t tabId;   // The sending tab, INVALID_TAB_ID for the UI WebViews
+};
+
+// Routes received messages to the handler registered for their MG_* code.
+// Handlers live in a dense array indexed by the code, each entry also names
+// the page which is allowed to send the message and decodes the args into
+// the message struct, so a handler only runs on a permitted, well formed
+// message. The time spent in every handler is recorded in a per message
+// latency histogram.
+class MessageDispatcher
+{
+public:
+    typedef std::function<HRESULT(const MessageContext&)> Handler;
+
+    void Register(int message, InternalPage sender, Handler handler);
+
+    template<typename T> void Register(InternalPage sender, std::function<HRESULT(const T&, const MessageContext&)> handler)
+    {
+        Register<T>(T::c_message, sender, handler);
+    }
+
+    // For args structs which are shared by several message codes
+    template<typename T> void Register(int message, InternalPage sender, std::function<HRESULT(const T&, const MessageContext&)> handler)
+    {
+        Register(message, sender, Decode<T>(handler));
+    }
+
+    // For messages every page sends, like its metadata
+    void RegisterForAnyPage(int message, Handler handler);
+
+    template<typename T> void RegisterForAnyPage(std::function<HRESULT(const T&, const MessageContext&)> handler)
+    {
+        RegisterForAnyPage(T::c_message, Decode<T>(handler));
+    }
+
+    // Messages without a handler, or from any other page than the registered
+    // sender, are dropped and S_FALSE is returned.
+    HRESULT Dispatch(const MessageContext& context, InternalPage sender);
+
+    // Writes count, mean, maximum and percentiles per message code to the
+    // debugger output
+    void DumpStatistics(LPCWSTR name) const;
+
+private:
+    // Bucket i counts the dispatches which took less than 2^i microseconds
+    static const int c_bucketCount = 20;
+
+    struct Entry
+    {
+        Handler handler;
+        InternalPage sender = InternalPage::None;
+        bool anySender = false;
+        ULONGLONG count = 0;
+        ULONGLONG totalMicroseconds = 0;
+        ULONGLONG maxMicroseconds = 0;
+        ULONGLONG buckets[c_bucketCount] = {};
+    };
+
+    Entry m_entries[MG_LAST + 1];
+
+    template<typename T> static Handler Decode(std::function<HRESULT(const T&, const MessageContext&)> handler)
+    {
+        return [handler](const MessageContext& context) -> HRESULT
+        {
+            T args;
+            RETURN_IF_FAILED(context.reader.ReadArgs(args));
+            return handler(args, context);
+        };
+    }
+
+    static ULONGLONG GetPercentile(const Entry& entry, ULONGLONG percent);
+};
@@ -0,0 +1,101 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "MessageQueue.h"
+#include "Trace.h"
+
+MessageQueue::MessageQueue(std::function<void()> scheduleFlush) :
+    m_scheduleFlush(std::move(scheduleFlush))
+{
+}
+
+// Only messages which carry the complete state of something can replace each
+// other. Requests, toggles and commands must all be delivered.
+bool MessageQueue::IsStateUpdate(int message)
+{
+    switch (message)
+    {
+    case MG_UPDATE_URI:
+    case MG_NAV_STARTING:
+    case MG_NAV_COMPLETED:
+    case MG_SECURITY_UPDATE:
+    case MG_PAGE_METADATA:
+    case MG_BLOCKED_COUNT:
+        return true;
+    }
+    return false;
+}
+
+void MessageQueue::Enqueue(int message, size_t tabId, LPCWSTR json)
+{
+    if (tabId != INVALID_TAB_ID && IsStateUpdate(message))
+    {
+        ULONGLONG const key = (static_cast<ULONGLONG>(tabId) << 8) | static_cast<BYTE>(message);
+        auto it = m_pendingUpdates.find(key);
+        if (it != m_pendingUpdates.end())
+        {
+            // Keep the order of delivery: the newer update goes to the end
+            Entry &superseded = m_entries[it->second];
+            superseded.superseded = true;
+            superseded.json.clear();
+            it->second = m_entries.size();
+            ++m_coalescedCount;
+        }
+        else
+        {
+            m_pendingUpdates.emplace(key, m_entries.size());
+        }
+    }
+
+    m_entries.push_back({ false, json });
+
+    if (!m_flushScheduled)
+    {
+        m_flushScheduled = true;
+        m_scheduleFlush();
+    }
+}
+
+HRESULT MessageQueue::Flush(ICoreWebView2* webview)
+{
+    m_flushScheduled = false;
+
+    // Keep the messages until there is someone to deliver them to
+    if (!webview || m_entries.empty())
+    {
+        return S_OK;
+    }
+
+    TRACE_SPAN(L"MessageQueue::Flush", m_entries.size());
+    const Entry *single = nullptr;
+    size_t count = 0;
+
+    m_batch.assign(L"{\"message\":");
+    m_batch.append(std::to_wstring(MG_BATCH));
+    m_batch.append(L",\"args\":{\"messages\":[");
+    for (const Entry &entry : m_entries)
+    {
+        if (entry.superseded)
+        {
+            continue;
+        }
+        if (count++ != 0)
+        {
+            m_batch.push_back(L',');
+        }
+        m_batch.append(entry.json);
+        single = &entry;
+    }
+    m_batch.append(L"]}}");
+
+    // A lone message is delivered as is, it needs no unpacking
+    HRESULT hr = webview->PostWebMessageAsJson(count == 1 ? single->json.c_str() : m_batch.c_str());
+
+    m_flushedCount += count;
+    ++m_batchCount;
+    m_entries.clear();
+    m_pendingUpdates.clear();
+
+    return hr;
+}
@@ -0,0 +1,44 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Collects the messages posted to one WebView and delivers them as a single
+// MG_BATCH message once per message loop turn. A state update which is still
+// pending when a newer update of the same type arrives for the same tab is
+// dropped, only the latest one is delivered.
+class MessageQueue
+{
+public:
+    // scheduleFlush is called when the first message is queued after a flush
+    explicit MessageQueue(std::function<void()> scheduleFlush);
+
+    void Enqueue(int message, size_t tabId, LPCWSTR json);
+    HRESULT Flush(ICoreWebView2* webview);
+
+    size_t GetCoalescedCount() const { return m_coalescedCount; }
+    size_t GetFlushedCount() const { return m_flushedCount; }
+    size_t GetBatchCount() const { return m_batchCount; }
+
+private:
+    struct Entry
+    {
+        bool superseded;
+        std::wstring json;
+    };
+
+    std::function<void()> m_scheduleFlush;
+    std::vector<Entry> m_entries;
+    std::unordered_map<ULONGLONG, size_t> m_pendingUpdates;  // (tabId, message) -> index into m_entries
+    std::wstring m_batch;
+    bool m_flushScheduled = false;
+
+    size_t m_coalescedCount = 0;
+    size_t m_flushedCount = 0;
+    size_t m_batchCount = 0;
+
+    static bool IsStateUpdate(int message);
+};
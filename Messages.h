@@ -0,0 +1,658 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// A JSON value that is passed through verbatim, e.g. the security state
+// reported by the DevTools protocol.
+struct JsonValue
+{
+    std::wstring json;
+};
+
+// Extracts the tabId field of any message, INVALID_TAB_ID if it has none
+struct TabIdVisitor
+{
+    size_t tabId = INVALID_TAB_ID;
+
+    void operator()(LPCWSTR name, const size_t &value)
+    {
+        if (wcscmp(name, L"tabId") == 0)
+        {
+            tabId = value;
+        }
+    }
+
+    template<typename F> void operator()(LPCWSTR name, const F &value) {}
+};
+
+template<typename T> size_t GetTabId(const T &message)
+{
+    TabIdVisitor visitor;
+    T::Visit(message, visitor);
+    return visitor.tabId;
+}
+
+// One struct per MG_* message code describing its "args" object. Each struct
+// lists its fields once in Visit(), which MessageWriter and MessageReader use
+// to encode and decode the message without building an intermediate DOM.
+template<int M> struct EmptyMessage
+{
+    static const int c_message = M;
+
+    template<typename S, typename V> static void Visit(S &self, V &v) {}
+};
+
+typedef EmptyMessage<MG_GO_FORWARD> GoForwardMessage;
+typedef EmptyMessage<MG_GO_BACK> GoBackMessage;
+typedef EmptyMessage<MG_RELOAD> ReloadMessage;
+typedef EmptyMessage<MG_CANCEL> CancelMessage;
+typedef EmptyMessage<MG_CLOSE_WINDOW> CloseWindowMessage;
+typedef EmptyMessage<MG_SHOW_OPTIONS> ShowOptionsMessage;
+typedef EmptyMessage<MG_HIDE_OPTIONS> HideOptionsMessage;
+typedef EmptyMessage<MG_OPTIONS_LOST_FOCUS> OptionsLostFocusMessage;
+typedef EmptyMessage<MG_OPTION_SELECTED> OptionSelectedMessage;
+typedef EmptyMessage<MG_CLEAR_HISTORY> ClearHistoryMessage;
+
+struct NavigateMessage
+{
+    static const int c_message = MG_NAVIGATE;
+    std::wstring uri;
+    std::wstring encodedSearchURI;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"uri", self.uri);
+        v(L"encodedSearchURI", self.encodedSearchURI);
+    }
+};
+
+struct UpdateUriMessage
+{
+    static const int c_message = MG_UPDATE_URI;
+    size_t tabId = INVALID_TAB_ID;
+    std::wstring uri;
+    std::wstring uriToShow;
+    bool canGoBack = false;
+    bool canGoForward = false;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"uri", self.uri);
+        v(L"uriToShow", self.uriToShow);
+        v(L"canGoBack", self.canGoBack);
+        v(L"canGoForward", self.canGoForward);
+    }
+};
+
+struct NavStartingMessage
+{
+    static const int c_message = MG_NAV_STARTING;
+    size_t tabId = INVALID_TAB_ID;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+    }
+};
+
+struct NavCompletedMessage
+{
+    static const int c_message = MG_NAV_COMPLETED;
+    size_t tabId = INVALID_TAB_ID;
+    bool isError = false;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"isError", self.isError);
+    }
+};
+
+struct CreateTabMessage
+{
+    static const int c_message = MG_CREATE_TAB;
+    size_t tabId = INVALID_TAB_ID;
+    bool active = false;
+    std::wstring uri;  // Loaded when the tab is first shown, may be empty
+    int batchIndex = -1;  // Position in a list of URIs, which load in the background
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"active", self.active);
+        v(L"uri", self.uri);
+        v(L"batchIndex", self.batchIndex);
+    }
+};
+
+// A tab as SessionJournal keeps it between runs
+struct SessionTab
+{
+    size_t tabId = INVALID_TAB_ID;
+    std::wstring uri;
+    std::wstring title;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"uri", self.uri);
+        v(L"title", self.title);
+    }
+};
+
+// Requested by the controls UI when it starts. The host has created the tabs
+// of the previous session by then, the controls UI only shows them. openTab
+// asks for a new active tab as well, unless URIs are waiting to be opened.
+// The controls UI numbers its new tabs from tabIdBase on.
+struct SessionMessage
+{
+    static const int c_message = MG_RESTORE_SESSION;
+    std::vector<SessionTab> tabs;
+    size_t activeTabId = INVALID_TAB_ID;
+    bool openTab = true;
+    size_t tabIdBase = 0;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabs", self.tabs);
+        v(L"activeTabId", self.activeTabId);
+        v(L"openTab", self.openTab);
+        v(L"tabIdBase", self.tabIdBase);
+    }
+};
+
+// From the options menu. moveTab asks the controls UI to give up the active
+// tab first, the same way a tab is closed.
+struct NewWindowMessage
+{
+    static const int c_message = MG_NEW_WINDOW;
+    bool moveTab = false;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"moveTab", self.moveTab);
+    }
+};
+
+// Sent to the controls UI for the tab to take out, and back once it's gone
+struct MoveTabMessage
+{
+    static const int c_message = MG_MOVE_TAB;
+    size_t tabId = INVALID_TAB_ID;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+    }
+};
+
+// How far the tabs opened from lists of URIs got, see LoadScheduler
+struct LoadProgressMessage
+{
+    static const int c_message = MG_LOAD_PROGRESS;
+    size_t total = 0;
+    size_t finished = 0;
+    size_t failed = 0;
+    size_t loading = 0;
+    size_t queued = 0;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"total", self.total);
+        v(L"finished", self.finished);
+        v(L"failed", self.failed);
+        v(L"loading", self.loading);
+        v(L"queued", self.queued);
+    }
+};
+
+// The requests of the page in the tab which the request filter blocked
+struct BlockedCountMessage
+{
+    static const int c_message = MG_BLOCKED_COUNT;
+    size_t tabId = INVALID_TAB_ID;
+    size_t blocked = 0;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"blocked", self.blocked);
+    }
+};
+
+// Sent to the controls UI for a request of another instance of the app, and
+// back with the ids of the tabs it opened, in the order of the URIs
+struct OpenTabsMessage
+{
+    static const int c_message = MG_OPEN_TABS;
+    size_t requestId = 0;
+    std::vector<std::wstring> uris;
+    std::vector<size_t> tabIds;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"requestId", self.requestId);
+        v(L"uris", self.uris);
+        v(L"tabIds", self.tabIds);
+    }
+};
+
+// Sent by the metadata script in every page, the host adds the tab id and
+// forwards it to the controls UI
+struct PageMetadataMessage
+{
+    static const int c_message = MG_PAGE_METADATA;
+    size_t tabId = INVALID_TAB_ID;
+    std::wstring title;
+    std::wstring favicon;
+    std::wstring canonical;
+    std::wstring themeColor;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"title", self.title);
+        v(L"favicon", self.favicon);
+        v(L"canonical", self.canonical);
+        v(L"themeColor", self.themeColor);
+    }
+};
+
+struct SwitchTabMessage
+{
+    static const int c_message = MG_SWITCH_TAB;
+    size_t tabId = INVALID_TAB_ID;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+    }
+};
+
+struct CloseTabMessage
+{
+    static const int c_message = MG_CLOSE_TAB;
+    size_t tabId = INVALID_TAB_ID;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+    }
+};
+
+struct SecurityUpdateMessage
+{
+    static const int c_message = MG_SECURITY_UPDATE;
+    size_t tabId = INVALID_TAB_ID;
+    JsonValue state;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"state", self.state);
+    }
+};
+
+// The host answers MG_GET_SETTINGS and MG_GET_FAVORITES of the browser pages
+// itself, without asking the controls UI
+struct Settings
+{
+    bool scriptsEnabled = true;
+    bool blockPopups = true;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"scriptsEnabled", self.scriptsEnabled);
+        v(L"blockPopups", self.blockPopups);
+    }
+};
+
+// How much the response cache saved, see ResponseCache
+struct ResponseCacheSummary
+{
+    bool enabled = false;
+    long long hits = 0;  // Fresh, revalidated or stale
+    long long misses = 0;
+    long long bytesSaved = 0;
+    long long size = 0;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"enabled", self.enabled);
+        v(L"hits", self.hits);
+        v(L"misses", self.misses);
+        v(L"bytesSaved", self.bytesSaved);
+        v(L"size", self.size);
+    }
+};
+
+struct SettingsMessage
+{
+    static const int c_message = MG_GET_SETTINGS;
+    Settings settings;
+    ResponseCacheSummary responseCache;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"settings", self.settings);
+        v(L"responseCache", self.responseCache);
+    }
+};
+
+struct Favorite
+{
+    std::wstring uri;
+    std::wstring uriToShow;
+    std::wstring title;
+    std::wstring favicon;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"uri", self.uri);
+        v(L"uriToShow", self.uriToShow);
+        v(L"title", self.title);
+        v(L"favicon", self.favicon);
+    }
+};
+
+// Carries all favorites of the controls UI to the host when the controls UI
+// starts, and is how the host saves them
+struct FavoritesMessage
+{
+    static const int c_message = MG_GET_FAVORITES;
+    std::vector<Favorite> favorites;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"favorites", self.favorites);
+    }
+};
+
+// Answers the favorites page, which fetches the favorites from the bulk URI,
+// see BulkTransfer
+struct FavoritesBulkMessage
+{
+    static const int c_message = MG_GET_FAVORITES;
+    std::wstring bulk;
+    int count = 0;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"bulk", self.bulk);
+        v(L"count", self.count);
+    }
+};
+
+struct RemoveFavoriteMessage
+{
+    static const int c_message = MG_REMOVE_FAVORITE;
+    std::wstring uri;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"uri", self.uri);
+    }
+};
+
+struct ClearCacheMessage
+{
+    static const int c_message = MG_CLEAR_CACHE;
+    bool content = false;
+    bool controls = false;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"content", self.content);
+        v(L"controls", self.controls);
+    }
+};
+
+struct ClearCookiesMessage
+{
+    static const int c_message = MG_CLEAR_COOKIES;
+    bool content = false;
+    bool controls = false;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"content", self.content);
+        v(L"controls", self.controls);
+    }
+};
+
+struct GetHistoryMessage
+{
+    static const int c_message = MG_GET_HISTORY;
+    size_t tabId = INVALID_TAB_ID;
+    int from = 0;
+    int count = 0;
+    long long before = 0;  // If set, from becomes the first visit before it
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"from", self.from);
+        v(L"count", self.count);
+        v(L"before", self.before);
+    }
+};
+
+struct HistoryItemFields
+{
+    std::wstring uri;
+    std::wstring title;
+    std::wstring favicon;
+    long long timestamp = 0;  // Milliseconds since 1970
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"uri", self.uri);
+        v(L"title", self.title);
+        v(L"favicon", self.favicon);
+        v(L"timestamp", self.timestamp);
+    }
+};
+
+struct HistoryEntry
+{
+    int id = INVALID_HISTORY_ID;
+    HistoryItemFields item;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"id", self.id);
+        v(L"item", self.item);
+    }
+};
+
+// The host's answer to MG_GET_HISTORY
+struct HistoryPageMessage
+{
+    static const int c_message = MG_GET_HISTORY;
+    int from = 0;
+    int count = 0;
+    int total = 0;  // Visits in the history
+    std::vector<HistoryEntry> items;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"from", self.from);
+        v(L"count", self.count);
+        v(L"total", self.total);
+        v(L"items", self.items);
+    }
+};
+
+struct RemoveHistoryItemMessage
+{
+    static const int c_message = MG_REMOVE_HISTORY_ITEM;
+    int id = 0;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"id", self.id);
+    }
+};
+
+// Sent by the controls UI when a tab has navigated to a page which belongs
+// in the history, and when the title or favicon of that page change
+struct AddHistoryItemMessage
+{
+    static const int c_message = MG_ADD_HISTORY_ITEM;
+    size_t tabId = INVALID_TAB_ID;
+    std::wstring uri;
+    std::wstring title;
+    std::wstring favicon;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"uri", self.uri);
+        v(L"title", self.title);
+        v(L"favicon", self.favicon);
+    }
+};
+
+struct UpdateHistoryItemMessage
+{
+    static const int c_message = MG_UPDATE_HISTORY_ITEM;
+    size_t tabId = INVALID_TAB_ID;
+    std::wstring title;
+    std::wstring favicon;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"title", self.title);
+        v(L"favicon", self.favicon);
+    }
+};
+
+// A visit of the history the controls UI kept in IndexedDB before the host
+// kept it. day is the local date as yyyymmdd, see BrowserWindow::GetVisitTime.
+struct ImportedVisit
+{
+    std::wstring uri;
+    std::wstring title;
+    std::wstring favicon;
+    long long timestamp = 0;
+    int day = 0;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"uri", self.uri);
+        v(L"title", self.title);
+        v(L"favicon", self.favicon);
+        v(L"timestamp", self.timestamp);
+        v(L"day", self.day);
+    }
+};
+
+// Sent once by the controls UI, which then deletes its history store
+struct ImportHistoryMessage
+{
+    static const int c_message = MG_IMPORT_HISTORY;
+    std::vector<ImportedVisit> visits;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"visits", self.visits);
+    }
+};
+
+struct GetSuggestionsMessage
+{
+    static const int c_message = MG_GET_SUGGESTIONS;
+    std::wstring query;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"query", self.query);
+    }
+};
+
+struct Suggestion
+{
+    std::wstring uri;
+    std::wstring title;
+    bool isFavorite = false;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"uri", self.uri);
+        v(L"title", self.title);
+        v(L"isFavorite", self.isFavorite);
+    }
+};
+
+// A failure in the host, shown by the controls UI without blocking
+struct ErrorMessage
+{
+    static const int c_message = MG_ERROR;
+    std::wstring code;
+    std::wstring message;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"code", self.code);
+        v(L"message", self.message);
+    }
+};
+
+// The host's answer to MG_GET_SUGGESTIONS, query is echoed so stale answers
+// can be dropped
+struct SuggestionsMessage
+{
+    static const int c_message = MG_GET_SUGGESTIONS;
+    std::wstring query;
+    std::vector<Suggestion> suggestions;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"query", self.query);
+        v(L"suggestions", self.suggestions);
+    }
+};
+
+// Sent by the controls UI whenever a favorite is added or removed
+struct UpdateFavoriteMessage
+{
+    static const int c_message = MG_UPDATE_FAVORITE;
+    Favorite favorite;
+    bool isFavorite = false;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"favorite", self.favorite);
+        v(L"isFavorite", self.isFavorite);
+    }
+};
+
+// Parameters of the Security.visibleSecurityStateChanged DevTools event
+struct VisibleSecurityStateChangedEvent
+{
+    JsonValue visibleSecurityState;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"visibleSecurityState", self.visibleSecurityState);
+    }
+};
+
+// Result of the Runtime.getHeapUsage DevTools method
+struct HeapUsageResult
+{
+    size_t usedSize = 0;
+    size_t totalSize = 0;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"usedSize", self.usedSize);
+        v(L"totalSize", self.totalSize);
+    }
+};
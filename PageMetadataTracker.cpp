@@ -0,0 +1,213 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "PageMetadataTracker.h"
+
+LPCWSTR PageMetadataTracker::GetScript()
+{
+    // Built once, the message code is the only part which isn't literal
+    static const std::wstring script =
+        L"(() => {"
+        // Frames share the tab, only the top document describes it
+        L"    if (window !== window.top || !window.chrome || !window.chrome.webview) {"
+        L"        return;"
+        L"    }"
+        L"    const getTitle = () => {"
+        L"        if (document.title) {"
+        L"            return document.title;"
+        L"        }"
+        // No title, look for the file name, then for the hostname
+        L"        const filename = window.location.pathname.split('/').pop();"
+        L"        return filename || window.location.hostname;"
+        L"    };"
+        // href is resolved against the document, so relative links work
+        L"    const getLink = (rel) => {"
+        L"        for (const link of document.querySelectorAll('link[rel][href]')) {"
+        L"            if (link.rel.toLowerCase().split(/\\s+/).includes(rel)) {"
+        L"                return link.href;"
+        L"            }"
+        L"        }"
+        L"        return '';"
+        L"    };"
+        // Without a link browsers look for favicon.ico at the site root
+        L"    const getFavicon = () => {"
+        L"        const link = getLink('icon');"
+        L"        if (link || !/^https?:$/.test(window.location.protocol)) {"
+        L"            return link;"
+        L"        }"
+        L"        return window.location.origin + '/favicon.ico';"
+        L"    };"
+        L"    const getMeta = (name) => {"
+        L"        const meta = document.querySelector(`meta[name='${name}']`);"
+        L"        return meta ? meta.content : '';"
+        L"    };"
+        L"    let last = '';"
+        L"    let timer = 0;"
+        L"    const report = () => {"
+        L"        timer = 0;"
+        L"        const args = {"
+        L"            title: getTitle(),"
+        L"            favicon: getFavicon(),"
+        L"            canonical: getLink('canonical'),"
+        L"            themeColor: getMeta('theme-color')"
+        L"        };"
+        // Only changes are posted
+        L"        const json = JSON.stringify(args);"
+        L"        if (json != last) {"
+        L"            last = json;"
+        L"            window.chrome.webview.postMessage({ message: " + std::to_wstring(MG_PAGE_METADATA) + L", args: args });"
+        L"        }"
+        L"    };"
+        // Bursts of DOM changes are reported once
+        L"    const schedule = () => {"
+        L"        if (!timer) {"
+        L"            timer = setTimeout(report, 100);"
+        L"        }"
+        L"    };"
+        L"    const observe = () => {"
+        L"        new MutationObserver(schedule).observe(document.head || document.documentElement, {"
+        L"            childList: true, subtree: true, characterData: true,"
+        L"            attributes: true, attributeFilter: ['href', 'rel', 'content', 'name']"
+        L"        });"
+        L"        report();"
+        L"    };"
+        L"    if (document.readyState == 'loading') {"
+        L"        document.addEventListener('DOMContentLoaded', observe);"
+        L"    } else {"
+        L"        observe();"
+        L"    }"
+        L"})();";
+    return script.c_str();
+}
+
+bool PageMetadataTracker::Update(size_t tabId, PageMetadataMessage& metadata)
+{
+    metadata.tabId = tabId;
+    CleanTitle(metadata.title);
+    CleanUri(metadata.favicon, true);
+    CleanUri(metadata.canonical, false);
+    CleanColor(metadata.themeColor);
+
+    auto it = m_last.find(tabId);
+    if (it != m_last.end())
+    {
+        const PageMetadataMessage& last = it->second;
+        if (last.title == metadata.title && last.favicon == metadata.favicon &&
+            last.canonical == metadata.canonical && last.themeColor == metadata.themeColor)
+        {
+            return false;
+        }
+        it->second = metadata;
+    }
+    else
+    {
+        m_last.emplace(tabId, metadata);
+    }
+    return true;
+}
+
+bool PageMetadataTracker::GetLast(size_t tabId, PageMetadataMessage& metadata) const
+{
+    auto it = m_last.find(tabId);
+    if (it == m_last.end())
+    {
+        return false;
+    }
+    metadata = it->second;
+    return true;
+}
+
+void PageMetadataTracker::Forget(size_t tabId)
+{
+    m_last.erase(tabId);
+}
+
+// Runs of whitespace and control characters become a single space, and the
+// title is cut at c_maxTitleLength without splitting a surrogate pair
+void PageMetadataTracker::CleanTitle(std::wstring& title)
+{
+    size_t length = 0;
+    bool space = true;  // Drops the leading whitespace
+    for (wchar_t c : title)
+    {
+        if (c <= L' ' || c == 0x7F || c == 0xA0)
+        {
+            if (!space)
+            {
+                title[length++] = L' ';
+                space = true;
+            }
+        }
+        else
+        {
+            title[length++] = c;
+            space = false;
+        }
+    }
+    if (length > 0 && title[length - 1] == L' ')
+    {
+        --length;
+    }
+
+    if (length > c_maxTitleLength)
+    {
+        length = c_maxTitleLength;
+        if (IS_HIGH_SURROGATE(title[length - 1]))
+        {
+            --length;
+        }
+    }
+    title.resize(length);
+}
+
+// Only web and inline image URIs are kept, anything else or an overlong
+// URI is dropped so the controls UI falls back to its default
+void PageMetadataTracker::CleanUri(std::wstring& uri, bool allowDataImage)
+{
+    if (StartsWith(uri, L"http://") || StartsWith(uri, L"https://"))
+    {
+        if (uri.size() <= c_maxUriLength)
+        {
+            return;
+        }
+    }
+    else if (allowDataImage && StartsWith(uri, L"data:image/"))
+    {
+        if (uri.size() <= c_maxDataUriLength)
+        {
+            return;
+        }
+    }
+    uri.clear();
+}
+
+// Accepts the characters of color names, hex colors and color functions
+void PageMetadataTracker::CleanColor(std::wstring& color)
+{
+    size_t const begin = color.find_first_not_of(L' ');
+    size_t const end = color.find_last_not_of(L' ');
+    color = begin == std::wstring::npos ? std::wstring() : color.substr(begin, end - begin + 1);
+
+    if (color.size() > c_maxColorLength)
+    {
+        color.clear();
+        return;
+    }
+    for (wchar_t c : color)
+    {
+        if (!((c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z') || (c >= L'0' && c <= L'9') ||
+            (c != L'\0' && wcschr(L"#(),.%/- ", c))))
+        {
+            color.clear();
+            return;
+        }
+    }
+}
+
+// The scheme is case insensitive
+bool PageMetadataTracker::StartsWith(const std::wstring& text, LPCWSTR prefix)
+{
+    size_t const length = wcslen(prefix);
+    return text.size() >= length && _wcsnicmp(text.c_str(), prefix, length) == 0;
+}
@@ -0,0 +1,41 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+#include "Messages.h"
+
+// Every tab runs GetScript() in its documents. The script reports the title,
+// favicon, canonical URI and theme color of the page once its DOM is loaded,
+// and again whenever the head of the document changes them. Update() cleans
+// up what a page reported and tells whether it differs from what was last
+// forwarded for the tab, so the controls UI only hears about changes.
+class PageMetadataTracker
+{
+public:
+    static const size_t c_maxTitleLength = 512;
+    static const size_t c_maxUriLength = 2048;
+    static const size_t c_maxDataUriLength = 32 * 1024;  // Inline favicons
+    static const size_t c_maxColorLength = 64;
+
+    // Script to add with AddScriptToExecuteOnDocumentCreated
+    static LPCWSTR GetScript();
+
+    // Returns false when the cleaned up metadata is the same as the last one
+    // of the tab, metadata.tabId is set to tabId
+    bool Update(size_t tabId, PageMetadataMessage& metadata);
+    // The metadata last forwarded for the tab, before the host changes it
+    bool GetLast(size_t tabId, PageMetadataMessage& metadata) const;
+    // The tab navigates or is closed
+    void Forget(size_t tabId);
+
+private:
+    std::unordered_map<size_t, PageMetadataMessage> m_last;
+
+    static void CleanTitle(std::wstring& title);
+    static void CleanUri(std::wstring& uri, bool allowDataImage);
+    static void CleanColor(std::wstring& color);
+    static bool StartsWith(const std::wstring& text, LPCWSTR prefix);
+};
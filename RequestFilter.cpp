@@ -0,0 +1,958 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "RequestFilter.h"
+
+struct RequestFilter::Table
+{
+    UINT32 slots;      // Offset of the first slot
+    UINT32 slotCount;  // A power of 2, or 0 for an empty table
+};
+
+struct RequestFilter::Header
+{
+    UINT32 magic;
+    UINT32 version;
+    UINT64 sourceTime;
+    UINT64 sourceSize;
+    UINT32 size;  // Of the whole snapshot
+    UINT32 domainCount;
+    UINT32 domains;
+    UINT32 ruleCount;
+    UINT32 rules;
+    UINT32 postingCount;
+    UINT32 postings;
+    UINT32 stringSize;
+    UINT32 strings;
+    UINT32 reserved;
+    Table tables[4];
+};
+
+// Open addressing, a slot with no postings ends a probe sequence
+struct RequestFilter::Slot
+{
+    UINT64 key;
+    UINT32 postings;  // Index of the first posting
+    UINT32 count;
+};
+
+struct RequestFilter::Domain
+{
+    UINT64 hash;
+    UINT32 negated;
+    UINT32 reserved;
+};
+
+struct RequestFilter::Rule
+{
+    UINT32 pattern;  // Offset into the strings
+    UINT32 patternLength;
+    UINT32 flags;
+    UINT32 types;
+    UINT32 domains;  // Index of the first domain
+    UINT32 domainCount;
+};
+
+namespace
+{
+    enum RuleFlags : UINT32
+    {
+        c_exception = 0x01,
+        c_startAnchor = 0x02,  // |pattern
+        c_hostAnchor = 0x04,   // ||pattern
+        c_endAnchor = 0x08,    // pattern|
+        c_matchCase = 0x10,
+        c_thirdParty = 0x20,
+        c_firstParty = 0x40,
+        c_hostOnly = 0x80,     // ||host^, the pattern is the host
+    };
+
+    enum Tables : size_t
+    {
+        c_blockHosts,
+        c_blockTokens,
+        c_allowHosts,
+        c_allowTokens,
+        c_tableCount,
+    };
+
+    // Rules without a word are filed under this key
+    const UINT64 c_genericKey = 0;
+    const UINT32 c_allTypes = (1u << (static_cast<int>(ResourceType::Ping) + 1)) - 1;
+    const size_t c_maxSnapshotSize = 256 * 1024 * 1024;
+
+    // Words which occur in most addresses, a rule is filed under one of them
+    // only if it has no other word
+    const char* const c_commonTokens[] = { "http", "https", "www", "com", "net", "org", "html", "js", "php" };
+
+    const struct
+    {
+        const char* name;
+        ResourceType type;
+    } c_typeOptions[] =
+    {
+        { "script", ResourceType::Script },
+        { "image", ResourceType::Image },
+        { "stylesheet", ResourceType::Stylesheet },
+        { "font", ResourceType::Font },
+        { "media", ResourceType::Media },
+        { "xmlhttprequest", ResourceType::XmlHttpRequest },
+        { "subdocument", ResourceType::Subdocument },
+        { "websocket", ResourceType::WebSocket },
+        { "ping", ResourceType::Ping },
+        { "other", ResourceType::Other },
+        { "object", ResourceType::Other },
+        { "object-subrequest", ResourceType::Other },
+    };
+}
+
+// 64 bit FNV-1a, never the generic key
+static UINT64 Hash(const char* data, size_t size)
+{
+    UINT64 hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ static_cast<BYTE>(data[i])) * 0x100000001B3ULL;
+    }
+    return hash == c_genericKey ? 1 : hash;
+}
+
+static bool IsTokenChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '%';
+}
+
+static char ToLower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// What ^ matches: anything but a letter, a digit or one of _-.%
+static bool IsSeparator(char c)
+{
+    return static_cast<BYTE>(c) < 0x80 && !isalnum(static_cast<BYTE>(c)) &&
+        c != '_' && c != '-' && c != '.' && c != '%';
+}
+
+// The host of an absolute URI, without user name and port. Empty for URIs
+// without one, like data: URIs.
+static void FindHost(const std::string& uri, size_t& begin, size_t& end)
+{
+    begin = end = 0;
+    size_t const scheme = uri.find("://");
+    if (scheme == std::string::npos)
+    {
+        return;
+    }
+
+    begin = scheme + 3;
+    end = uri.find_first_of("/?#", begin);
+    if (end == std::string::npos)
+    {
+        end = uri.size();
+    }
+
+    size_t const at = uri.rfind('@', end);
+    if (at != std::string::npos && at >= begin)
+    {
+        begin = at + 1;
+    }
+    size_t const port = uri[begin] == '[' ? uri.find(']', begin) : uri.find(':', begin);
+    if (port != std::string::npos && port < end)
+    {
+        end = uri[begin] == '[' ? port + 1 : port;
+    }
+}
+
+// The hashes of host, and of every suffix of it which follows a dot
+static void HashHost(const char* host, size_t length, std::vector<UINT64>& hashes)
+{
+    hashes.clear();
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (i == 0 || host[i - 1] == '.')
+        {
+            hashes.push_back(Hash(host + i, length - i));
+        }
+    }
+}
+
+// The part of the host its owner registered, as far as it can be told
+// without the list of public suffixes: the last two labels, or three for
+// country code domains like co.uk and com.au. IP addresses are compared as
+// a whole.
+static size_t FindSiteBegin(const char* host, size_t length)
+{
+    if (length == 0 || host[0] == '[' || isdigit(static_cast<BYTE>(host[length - 1])))
+    {
+        return 0;
+    }
+
+    size_t labels[3];
+    size_t found = 0;
+    for (size_t i = length; i > 0 && found < 3; --i)
+    {
+        if (host[i - 1] == '.')
+        {
+            labels[found++] = i;
+        }
+    }
+    if (found < 2)
+    {
+        return 0;
+    }
+
+    size_t const topLength = length - labels[0];
+    size_t const secondLength = labels[0] - 1 - labels[1];
+    if (topLength == 2 && secondLength <= 3)
+    {
+        return found == 3 ? labels[2] : 0;
+    }
+    return labels[1];
+}
+
+// Matches a part of a pattern without wildcards at uri[position], and
+// returns where the match ends
+static bool MatchPart(const char* part, const char* partEnd, const std::string& uri, size_t position, size_t& end)
+{
+    for (; part != partEnd; ++part)
+    {
+        if (position == uri.size())
+        {
+            // The end of the address counts as a separator, as the last one
+            if (*part != '^' || part + 1 != partEnd)
+            {
+                return false;
+            }
+            break;
+        }
+        if (*part == '^' ? !IsSeparator(uri[position]) : uri[position] != *part)
+        {
+            return false;
+        }
+        ++position;
+    }
+    end = position;
+    return true;
+}
+
+// The parts between the wildcards are matched one after the other, each at
+// the first place it matches. That can't miss a match, as the wildcard
+// before the next part can take up whatever comes first.
+static bool MatchPattern(const char* pattern, const char* patternEnd, const std::string& uri, size_t begin, bool anchored, bool endAnchor)
+{
+    size_t position = begin;
+    for (;;)
+    {
+        const char* partEnd = static_cast<const char*>(memchr(pattern, '*', patternEnd - pattern));
+        bool const last = partEnd == nullptr;
+        if (last)
+        {
+            partEnd = patternEnd;
+        }
+
+        size_t end = 0;
+        bool matched = false;
+        if (anchored)
+        {
+            matched = MatchPart(pattern, partEnd, uri, position, end) && (!last || !endAnchor || end == uri.size());
+        }
+        else
+        {
+            for (size_t start = position; start <= uri.size() && !matched; ++start)
+            {
+                // Skips ahead to where the first character of the part occurs
+                if (pattern != partEnd && *pattern != '^')
+                {
+                    start = uri.find(*pattern, start);
+                    if (start == std::string::npos)
+                    {
+                        break;
+                    }
+                }
+                matched = MatchPart(pattern, partEnd, uri, start, end) && (!last || !endAnchor || end == uri.size());
+            }
+        }
+
+        if (!matched || last)
+        {
+            return matched;
+        }
+        position = end;
+        pattern = partEnd + 1;
+        anchored = false;
+    }
+}
+
+void FilterRequest::Set(const std::string& uri, const std::string& documentUri, ResourceType type)
+{
+    m_uri = uri;
+    m_lowerUri.resize(uri.size());
+    std::transform(uri.begin(), uri.end(), m_lowerUri.begin(), ToLower);
+    m_lowerDocumentUri.resize(documentUri.size());
+    std::transform(documentUri.begin(), documentUri.end(), m_lowerDocumentUri.begin(), ToLower);
+    m_type = 1u << static_cast<int>(type);
+
+    FindHost(m_lowerUri, m_hostBegin, m_hostEnd);
+    const char* const host = m_lowerUri.data() + m_hostBegin;
+    size_t const hostLength = m_hostEnd - m_hostBegin;
+    HashHost(host, hostLength, m_hostHashes);
+
+    size_t documentBegin;
+    size_t documentEnd;
+    FindHost(m_lowerDocumentUri, documentBegin, documentEnd);
+    const char* const documentHost = m_lowerDocumentUri.data() + documentBegin;
+    size_t const documentLength = documentEnd - documentBegin;
+    HashHost(documentHost, documentLength, m_documentHashes);
+
+    // Without a document the request is the page itself
+    m_thirdParty = false;
+    if (documentLength != 0)
+    {
+        size_t const site = FindSiteBegin(host, hostLength);
+        size_t const documentSite = FindSiteBegin(documentHost, documentLength);
+        m_thirdParty = hostLength - site != documentLength - documentSite ||
+            memcmp(host + site, documentHost + documentSite, hostLength - site) != 0;
+    }
+
+    m_tokens.clear();
+    for (size_t i = 0; i < m_lowerUri.size();)
+    {
+        if (!IsTokenChar(m_lowerUri[i]))
+        {
+            ++i;
+            continue;
+        }
+
+        size_t const begin = i;
+        while (i < m_lowerUri.size() && IsTokenChar(m_lowerUri[i]))
+        {
+            ++i;
+        }
+        m_tokens.push_back(Hash(m_lowerUri.data() + begin, i - begin));
+    }
+    std::sort(m_tokens.begin(), m_tokens.end());
+    m_tokens.erase(std::unique(m_tokens.begin(), m_tokens.end()), m_tokens.end());
+}
+
+void FilterCompiler::AddRules(const char* text, size_t size)
+{
+    size_t begin = 0;
+    while (begin < size)
+    {
+        const char* const end = static_cast<const char*>(memchr(text + begin, '\n', size - begin));
+        size_t const length = (end ? end - text : size) - begin;
+
+        ParsedRule rule;
+        if (ParseRule(text + begin, length, rule))
+        {
+            m_rules.push_back(std::move(rule));
+        }
+        begin += length + 1;
+    }
+}
+
+// False for comments and empty lines as well as for the rules which are
+// skipped, only the latter are counted
+bool FilterCompiler::ParseRule(const char* line, size_t length, ParsedRule& rule)
+{
+    while (length != 0 && isspace(static_cast<BYTE>(line[length - 1])))
+    {
+        --length;
+    }
+    while (length != 0 && isspace(static_cast<BYTE>(*line)))
+    {
+        ++line;
+        --length;
+    }
+    if (length == 0 || *line == '!' || *line == '[')
+    {
+        return false;
+    }
+
+    std::string text(line, length);
+    if (text.find("##") != std::string::npos || text.find("#@#") != std::string::npos ||
+        text.find("#?#") != std::string::npos || text.find("#$#") != std::string::npos)
+    {
+        ++m_statistics.skipped;
+        return false;
+    }
+
+    if (text.compare(0, 2, "@@") == 0)
+    {
+        rule.flags |= c_exception;
+        text.erase(0, 2);
+    }
+
+    rule.types = c_allTypes;
+    size_t const options = text.rfind('$');
+    if (options != std::string::npos)
+    {
+        if (!ParseOptions(text.substr(options + 1), rule))
+        {
+            ++m_statistics.skipped;
+            return false;
+        }
+        text.erase(options);
+    }
+
+    if (text.size() > 1 && text.front() == '/' && text.back() == '/')
+    {
+        ++m_statistics.skipped;
+        return false;
+    }
+
+    if (text.compare(0, 2, "||") == 0)
+    {
+        rule.flags |= c_hostAnchor;
+        text.erase(0, 2);
+    }
+    else if (text.compare(0, 1, "|") == 0)
+    {
+        rule.flags |= c_startAnchor;
+        text.erase(0, 1);
+    }
+    if (!text.empty() && text.back() == '|')
+    {
+        rule.flags |= c_endAnchor;
+        text.pop_back();
+    }
+
+    // Wildcards at either end add nothing but undo the anchor there
+    while (!text.empty() && text.front() == '*')
+    {
+        rule.flags &= ~(c_startAnchor | c_hostAnchor);
+        text.erase(0, 1);
+    }
+    while (!text.empty() && text.back() == '*')
+    {
+        rule.flags &= ~c_endAnchor;
+        text.pop_back();
+    }
+
+    if (!(rule.flags & c_matchCase))
+    {
+        std::transform(text.begin(), text.end(), text.begin(), ToLower);
+    }
+
+    // Most rules block a host and everything on it
+    if ((rule.flags & (c_hostAnchor | c_endAnchor)) == c_hostAnchor && text.size() > 1 && text.back() == '^' &&
+        std::all_of(text.begin(), text.end() - 1, [](char c) { return IsTokenChar(ToLower(c)) || c == '.' || c == '-'; }))
+    {
+        text.pop_back();
+        std::transform(text.begin(), text.end(), text.begin(), ToLower);
+        rule.flags |= c_hostOnly;
+    }
+
+    rule.pattern = std::move(text);
+    return true;
+}
+
+// False if the rule has an option which isn't supported
+bool FilterCompiler::ParseOptions(const std::string& options, ParsedRule& rule)
+{
+    UINT32 included = 0;
+    UINT32 excluded = 0;
+    size_t begin = 0;
+    while (begin <= options.size())
+    {
+        size_t end = options.find(',', begin);
+        if (end == std::string::npos)
+        {
+            end = options.size();
+        }
+        std::string option = options.substr(begin, end - begin);
+        begin = end + 1;
+
+        std::transform(option.begin(), option.end(), option.begin(), ToLower);
+        bool const negated = !option.empty() && option[0] == '~';
+        if (negated)
+        {
+            option.erase(0, 1);
+        }
+
+        auto type = std::find_if(std::begin(c_typeOptions), std::end(c_typeOptions),
+            [&option](const decltype(c_typeOptions[0])& entry) { return option == entry.name; });
+        if (type != std::end(c_typeOptions))
+        {
+            (negated ? excluded : included) |= 1u << static_cast<int>(type->type);
+        }
+        else if (option == "third-party" || option == "3p")
+        {
+            rule.flags |= negated ? c_firstParty : c_thirdParty;
+        }
+        else if (option == "first-party" || option == "1p")
+        {
+            rule.flags |= negated ? c_thirdParty : c_firstParty;
+        }
+        else if (option == "match-case" && !negated)
+        {
+            rule.flags |= c_matchCase;
+        }
+        else if (option == "important" && !negated)
+        {
+            // Exceptions win anyway
+        }
+        else if (option.compare(0, 7, "domain=") == 0 && !negated)
+        {
+            size_t domainBegin = 7;
+            while (domainBegin < option.size())
+            {
+                size_t domainEnd = option.find('|', domainBegin);
+                if (domainEnd == std::string::npos)
+                {
+                    domainEnd = option.size();
+                }
+
+                bool const negatedDomain = option[domainBegin] == '~';
+                size_t const first = domainBegin + (negatedDomain ? 1 : 0);
+                if (first < domainEnd)
+                {
+                    rule.domains.emplace_back(Hash(option.data() + first, domainEnd - first), negatedDomain);
+                }
+                domainBegin = domainEnd + 1;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    rule.types = (included ? included : c_allTypes) & ~excluded;
+    return rule.types != 0;
+}
+
+// The word of the pattern the fewest rules are filed under so far. A word
+// counts only if it is a whole word of every address the pattern matches,
+// so not next to a wildcard or an open end of the pattern.
+UINT64 FilterCompiler::ChooseToken(const ParsedRule& rule, const std::unordered_map<UINT64, UINT32>& counts)
+{
+    const std::string& pattern = rule.pattern;
+    UINT64 best = c_genericKey;
+    size_t bestCost = SIZE_MAX;
+    size_t bestLength = 0;
+    for (size_t i = 0; i < pattern.size();)
+    {
+        char const first = ToLower(pattern[i]);
+        if (!IsTokenChar(first))
+        {
+            ++i;
+            continue;
+        }
+
+        size_t const begin = i;
+        while (i < pattern.size() && IsTokenChar(ToLower(pattern[i])))
+        {
+            ++i;
+        }
+
+        bool const openBegin = begin == 0 ? !(rule.flags & (c_startAnchor | c_hostAnchor)) : pattern[begin - 1] == '*';
+        bool const openEnd = i == pattern.size() ? !(rule.flags & c_endAnchor) : pattern[i] == '*';
+        if (openBegin || openEnd)
+        {
+            continue;
+        }
+
+        std::string token(pattern, begin, i - begin);
+        std::transform(token.begin(), token.end(), token.begin(), ToLower);
+        UINT64 const key = Hash(token.data(), token.size());
+        auto count = counts.find(key);
+        size_t cost = count == counts.end() ? 0 : count->second;
+        if (std::any_of(std::begin(c_commonTokens), std::end(c_commonTokens), [&token](const char* common) { return token == common; }))
+        {
+            cost += 1 << 20;
+        }
+        if (cost < bestCost || (cost == bestCost && token.size() > bestLength))
+        {
+            best = key;
+            bestCost = cost;
+            bestLength = token.size();
+        }
+    }
+    return best;
+}
+
+// Places size bytes at the next multiple of 8
+static size_t Reserve(std::vector<BYTE>& snapshot, size_t size)
+{
+    size_t const offset = (snapshot.size() + 7) & ~static_cast<size_t>(7);
+    snapshot.resize(offset + size);
+    return offset;
+}
+
+HRESULT FilterCompiler::Build(UINT64 sourceTime, UINT64 sourceSize, std::vector<BYTE>& snapshot)
+{
+    struct Posting
+    {
+        size_t table;
+        UINT64 key;
+        UINT32 rule;
+
+        bool operator<(const Posting& other) const
+        {
+            return std::tie(table, key, rule) < std::tie(other.table, other.key, other.rule);
+        }
+    };
+
+    // File every rule under a host or a word
+    std::vector<Posting> postings;
+    postings.reserve(m_rules.size());
+    std::unordered_map<UINT64, UINT32> counts[c_tableCount];
+    size_t domainCount = 0;
+    size_t stringSize = 0;
+    m_statistics.hostRules = m_statistics.tokenRules = m_statistics.genericRules = m_statistics.exceptions = 0;
+    for (size_t i = 0; i < m_rules.size(); ++i)
+    {
+        const ParsedRule& rule = m_rules[i];
+        bool const exception = (rule.flags & c_exception) != 0;
+        Posting posting;
+        posting.rule = static_cast<UINT32>(i);
+        if (rule.flags & c_hostOnly)
+        {
+            posting.table = exception ? c_allowHosts : c_blockHosts;
+            posting.key = Hash(rule.pattern.data(), rule.pattern.size());
+            ++m_statistics.hostRules;
+        }
+        else
+        {
+            posting.table = exception ? c_allowTokens : c_blockTokens;
+            posting.key = ChooseToken(rule, counts[posting.table]);
+            ++(posting.key == c_genericKey ? m_statistics.genericRules : m_statistics.tokenRules);
+        }
+        if (exception)
+        {
+            ++m_statistics.exceptions;
+        }
+        ++counts[posting.table][posting.key];
+        postings.push_back(posting);
+        domainCount += rule.domains.size();
+        stringSize += rule.pattern.size();
+    }
+    std::sort(postings.begin(), postings.end());
+
+    size_t slotCounts[c_tableCount];
+    size_t slotTotal = 0;
+    for (size_t table = 0; table < c_tableCount; ++table)
+    {
+        // At most half full
+        size_t slotCount = counts[table].empty() ? 0 : 1;
+        while (slotCount != 0 && slotCount < 2 * counts[table].size())
+        {
+            slotCount *= 2;
+        }
+        slotCounts[table] = slotCount;
+        slotTotal += slotCount;
+    }
+
+    size_t const total = sizeof(RequestFilter::Header) + 8 * 5 + slotTotal * sizeof(RequestFilter::Slot) +
+        domainCount * sizeof(RequestFilter::Domain) + m_rules.size() * sizeof(RequestFilter::Rule) +
+        postings.size() * sizeof(UINT32) + stringSize;
+    if (total > c_maxSnapshotSize)
+    {
+        return HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW);
+    }
+
+    snapshot.clear();
+    snapshot.reserve(total);
+    Reserve(snapshot, sizeof(RequestFilter::Header));
+    RequestFilter::Header header = {};
+    header.magic = RequestFilter::c_magic;
+    header.version = RequestFilter::c_version;
+    header.sourceTime = sourceTime;
+    header.sourceSize = sourceSize;
+
+    for (size_t table = 0; table < c_tableCount; ++table)
+    {
+        header.tables[table].slotCount = static_cast<UINT32>(slotCounts[table]);
+        header.tables[table].slots = static_cast<UINT32>(Reserve(snapshot, slotCounts[table] * sizeof(RequestFilter::Slot)));
+    }
+
+    header.domainCount = static_cast<UINT32>(domainCount);
+    header.domains = static_cast<UINT32>(Reserve(snapshot, domainCount * sizeof(RequestFilter::Domain)));
+    header.ruleCount = static_cast<UINT32>(m_rules.size());
+    header.rules = static_cast<UINT32>(Reserve(snapshot, m_rules.size() * sizeof(RequestFilter::Rule)));
+    header.postingCount = static_cast<UINT32>(postings.size());
+    header.postings = static_cast<UINT32>(Reserve(snapshot, postings.size() * sizeof(UINT32)));
+    header.stringSize = static_cast<UINT32>(stringSize);
+    header.strings = static_cast<UINT32>(Reserve(snapshot, stringSize));
+    header.size = static_cast<UINT32>(snapshot.size());
+    memcpy(snapshot.data(), &header, sizeof(header));
+
+    size_t domainIndex = 0;
+    size_t stringOffset = 0;
+    for (size_t i = 0; i < m_rules.size(); ++i)
+    {
+        const ParsedRule& parsed = m_rules[i];
+        RequestFilter::Rule rule = {};
+        rule.pattern = static_cast<UINT32>(stringOffset);
+        rule.patternLength = static_cast<UINT32>(parsed.pattern.size());
+        rule.flags = parsed.flags;
+        rule.types = parsed.types;
+        rule.domains = static_cast<UINT32>(domainIndex);
+        rule.domainCount = static_cast<UINT32>(parsed.domains.size());
+        memcpy(snapshot.data() + header.rules + i * sizeof(rule), &rule, sizeof(rule));
+
+        memcpy(snapshot.data() + header.strings + stringOffset, parsed.pattern.data(), parsed.pattern.size());
+        stringOffset += parsed.pattern.size();
+
+        for (const auto& parsedDomain : parsed.domains)
+        {
+            RequestFilter::Domain domain = {};
+            domain.hash = parsedDomain.first;
+            domain.negated = parsedDomain.second ? 1 : 0;
+            memcpy(snapshot.data() + header.domains + domainIndex++ * sizeof(domain), &domain, sizeof(domain));
+        }
+    }
+
+    // Postings of the same key are next to each other after sorting
+    for (size_t begin = 0; begin < postings.size();)
+    {
+        size_t end = begin;
+        while (end < postings.size() && postings[end].table == postings[begin].table && postings[end].key == postings[begin].key)
+        {
+            UINT32 const rule = postings[end].rule;
+            memcpy(snapshot.data() + header.postings + end * sizeof(UINT32), &rule, sizeof(rule));
+            ++end;
+        }
+
+        const RequestFilter::Table& table = header.tables[postings[begin].table];
+        RequestFilter::Slot* const slots = reinterpret_cast<RequestFilter::Slot*>(snapshot.data() + table.slots);
+        size_t index = static_cast<size_t>(postings[begin].key) & (table.slotCount - 1);
+        while (slots[index].count != 0)
+        {
+            index = (index + 1) & (table.slotCount - 1);
+        }
+        slots[index].key = postings[begin].key;
+        slots[index].postings = static_cast<UINT32>(begin);
+        slots[index].count = static_cast<UINT32>(end - begin);
+        begin = end;
+    }
+    return S_OK;
+}
+
+// Whether the section of count elements of size at offset fits into the
+// snapshot, and is aligned for them
+static bool IsInBounds(size_t snapshotSize, UINT32 offset, UINT64 count, size_t size, size_t alignment)
+{
+    return offset % alignment == 0 && offset <= snapshotSize && count <= (snapshotSize - offset) / size;
+}
+
+HRESULT RequestFilter::Load(const BYTE* data, size_t size)
+{
+    static_assert(sizeof(Header) == 96 && sizeof(Slot) == 16 && sizeof(Domain) == 16 && sizeof(Rule) == 24,
+        "The layout of the snapshot changed, so has to c_version");
+
+    Unload();
+    const Header* const header = reinterpret_cast<const Header*>(data);
+    if (size < sizeof(Header) || reinterpret_cast<UINT_PTR>(data) % 8 != 0 ||
+        header->magic != c_magic || header->version != c_version || header->size != size ||
+        !IsInBounds(size, header->domains, header->domainCount, sizeof(Domain), 8) ||
+        !IsInBounds(size, header->rules, header->ruleCount, sizeof(Rule), 4) ||
+        !IsInBounds(size, header->postings, header->postingCount, sizeof(UINT32), 4) ||
+        !IsInBounds(size, header->strings, header->stringSize, 1, 1))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    const Rule* const rules = reinterpret_cast<const Rule*>(data + header->rules);
+    for (UINT32 i = 0; i < header->ruleCount; ++i)
+    {
+        if (rules[i].pattern > header->stringSize || rules[i].patternLength > header->stringSize - rules[i].pattern ||
+            rules[i].domains > header->domainCount || rules[i].domainCount > header->domainCount - rules[i].domains)
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+    }
+
+    const UINT32* const postings = reinterpret_cast<const UINT32*>(data + header->postings);
+    for (UINT32 i = 0; i < header->postingCount; ++i)
+    {
+        if (postings[i] >= header->ruleCount)
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+    }
+
+    for (size_t table = 0; table < c_tableCount; ++table)
+    {
+        const Table& bounds = header->tables[table];
+        if ((bounds.slotCount & (bounds.slotCount - 1)) != 0 ||
+            !IsInBounds(size, bounds.slots, bounds.slotCount, sizeof(Slot), 8))
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        // A full table would never end a probe sequence
+        const Slot* const slots = reinterpret_cast<const Slot*>(data + bounds.slots);
+        bool hasEmptySlot = bounds.slotCount == 0;
+        for (UINT32 i = 0; i < bounds.slotCount; ++i)
+        {
+            if (slots[i].postings > header->postingCount || slots[i].count > header->postingCount - slots[i].postings)
+            {
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+            hasEmptySlot = hasEmptySlot || slots[i].count == 0;
+        }
+        if (!hasEmptySlot)
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+        m_slots[table] = slots;
+    }
+
+    m_header = header;
+    m_domains = reinterpret_cast<const Domain*>(data + header->domains);
+    m_rules = rules;
+    m_postings = postings;
+    m_strings = reinterpret_cast<const char*>(data + header->strings);
+    return S_OK;
+}
+
+UINT64 RequestFilter::GetSourceTime() const
+{
+    return m_header ? m_header->sourceTime : 0;
+}
+
+UINT64 RequestFilter::GetSourceSize() const
+{
+    return m_header ? m_header->sourceSize : 0;
+}
+
+size_t RequestFilter::GetRuleCount() const
+{
+    return m_header ? m_header->ruleCount : 0;
+}
+
+bool RequestFilter::Match(const FilterRequest& request) const
+{
+    return m_header && FindRule(request, false) && !FindRule(request, true);
+}
+
+bool RequestFilter::FindRule(const FilterRequest& request, bool exception) const
+{
+    size_t const hosts = exception ? c_allowHosts : c_blockHosts;
+    for (UINT64 hash : request.m_hostHashes)
+    {
+        if (const Slot* slot = FindSlot(hosts, hash))
+        {
+            for (UINT32 i = 0; i < slot->count; ++i)
+            {
+                if (MatchRule(m_rules[m_postings[slot->postings + i]], request))
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    size_t const tokens = exception ? c_allowTokens : c_blockTokens;
+    auto matchSlot = [&](UINT64 key)
+    {
+        const Slot* slot = FindSlot(tokens, key);
+        if (slot)
+        {
+            for (UINT32 i = 0; i < slot->count; ++i)
+            {
+                if (MatchRule(m_rules[m_postings[slot->postings + i]], request))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+    if (matchSlot(c_genericKey))
+    {
+        return true;
+    }
+    for (UINT64 token : request.m_tokens)
+    {
+        if (matchSlot(token))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The options are checked first, they are cheaper than the pattern
+bool RequestFilter::MatchRule(const Rule& rule, const FilterRequest& request) const
+{
+    if (!(rule.types & request.m_type) ||
+        ((rule.flags & c_thirdParty) && !request.m_thirdParty) ||
+        ((rule.flags & c_firstParty) && request.m_thirdParty))
+    {
+        return false;
+    }
+
+    if (rule.domainCount != 0)
+    {
+        bool included = false;
+        bool hasIncluded = false;
+        for (UINT32 i = 0; i < rule.domainCount; ++i)
+        {
+            const Domain& domain = m_domains[rule.domains + i];
+            bool const matched = std::find(request.m_documentHashes.begin(), request.m_documentHashes.end(), domain.hash) != request.m_documentHashes.end();
+            if (domain.negated && matched)
+            {
+                return false;
+            }
+            hasIncluded = hasIncluded || !domain.negated;
+            included = included || (!domain.negated && matched);
+        }
+        if (hasIncluded && !included)
+        {
+            return false;
+        }
+    }
+
+    const char* const pattern = m_strings + rule.pattern;
+    size_t const hostLength = request.m_hostEnd - request.m_hostBegin;
+    if (rule.flags & c_hostOnly)
+    {
+        // The hash of a suffix found the rule, it may have been another one
+        size_t const begin = request.m_hostEnd - rule.patternLength;
+        return rule.patternLength <= hostLength &&
+            (begin == request.m_hostBegin || request.m_lowerUri[begin - 1] == '.') &&
+            memcmp(request.m_lowerUri.data() + begin, pattern, rule.patternLength) == 0;
+    }
+
+    const std::string& uri = (rule.flags & c_matchCase) ? request.m_uri : request.m_lowerUri;
+    const char* const patternEnd = pattern + rule.patternLength;
+    bool const endAnchor = (rule.flags & c_endAnchor) != 0;
+    if (rule.flags & c_hostAnchor)
+    {
+        // At the start of the host or of any of its labels
+        for (size_t begin = request.m_hostBegin; begin < request.m_hostEnd; ++begin)
+        {
+            if ((begin == request.m_hostBegin || uri[begin - 1] == '.') &&
+                MatchPattern(pattern, patternEnd, uri, begin, true, endAnchor))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    return MatchPattern(pattern, patternEnd, uri, 0, (rule.flags & c_startAnchor) != 0, endAnchor);
+}
+
+const RequestFilter::Slot* RequestFilter::FindSlot(size_t table, UINT64 key) const
+{
+    UINT32 const slotCount = m_header->tables[table].slotCount;
+    if (slotCount == 0)
+    {
+        return nullptr;
+    }
+
+    const Slot* const slots = m_slots[table];
+    for (size_t index = static_cast<size_t>(key) & (slotCount - 1); slots[index].count != 0; index = (index + 1) & (slotCount - 1))
+    {
+        if (slots[index].key == key)
+        {
+            return &slots[index];
+        }
+    }
+    return nullptr;
+}
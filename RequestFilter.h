@@ -0,0 +1,145 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// What a request loads, as the options of the filter rules name it
+enum class ResourceType
+{
+    Other,
+    Script,
+    Image,
+    Stylesheet,
+    Font,
+    Media,
+    XmlHttpRequest,
+    Subdocument,
+    WebSocket,
+    Ping,
+};
+
+// A request as RequestFilter matches it. Meant to be reused, so its buffers
+// are only allocated for the first few requests.
+class FilterRequest
+{
+public:
+    // UTF-8. documentUri is the page which makes the request, empty if there
+    // is none.
+    void Set(const std::string& uri, const std::string& documentUri, ResourceType type);
+
+private:
+    friend class RequestFilter;
+
+    std::string m_uri;
+    std::string m_lowerUri;
+    std::string m_lowerDocumentUri;
+    size_t m_hostBegin = 0;  // The host within the URI
+    size_t m_hostEnd = 0;
+    std::vector<UINT64> m_hostHashes;      // Of every suffix of the host which starts a label
+    std::vector<UINT64> m_documentHashes;  // The same for the host of the document
+    std::vector<UINT64> m_tokens;          // Hashes of the words of the URI, sorted
+    UINT32 m_type = 0;  // The bit of the resource type
+    bool m_thirdParty = false;
+};
+
+// Compiles filter lists in the EasyList syntax into a snapshot RequestFilter
+// can match against without parsing or allocating anything. Supported are
+// address patterns with the |, || and ^ anchors and * wildcards, exceptions,
+// and the resource type, third-party, domain and match-case options. Rules
+// which hide elements, regular expressions and rules with other options are
+// skipped, rather than applied more broadly than they were meant to.
+class FilterCompiler
+{
+public:
+    struct Statistics
+    {
+        size_t hostRules = 0;     // ||host^, found by the host of a request
+        size_t tokenRules = 0;    // Found by one of the words of their pattern
+        size_t genericRules = 0;  // Without a word, checked for every request
+        size_t exceptions = 0;    // Included in the above
+        size_t skipped = 0;
+    };
+
+    // UTF-8, one rule per line
+    void AddRules(const char* text, size_t size);
+    // sourceTime and sourceSize identify the lists, RequestFilter hands them
+    // back to tell whether the snapshot is still current
+    HRESULT Build(UINT64 sourceTime, UINT64 sourceSize, std::vector<BYTE>& snapshot);
+
+    const Statistics& GetStatistics() const { return m_statistics; }
+
+private:
+    struct ParsedRule
+    {
+        std::string pattern;  // The host alone for host rules
+        UINT32 flags = 0;
+        UINT32 types = 0;
+        std::vector<std::pair<UINT64, bool>> domains;  // Hash, negated
+    };
+
+    std::vector<ParsedRule> m_rules;
+    Statistics m_statistics;
+
+    bool ParseRule(const char* line, size_t length, ParsedRule& rule);
+    static bool ParseOptions(const std::string& options, ParsedRule& rule);
+    static UINT64 ChooseToken(const ParsedRule& rule, const std::unordered_map<UINT64, UINT32>& counts);
+};
+
+// Matches requests against a snapshot of FilterCompiler. The snapshot is
+// used in place, typically straight from a mapped file, and has to outlive
+// the filter. It is laid out as
+//   header
+//   4 hash tables   host and word hashes -> ranges of postings, separate
+//                   for the blocking rules and the exceptions
+//   domains         the hashes of the $domain= options
+//   rules           flags, types, the pattern and the domains of each rule
+//   postings        rule indexes
+//   strings         the patterns
+// Every section starts at a multiple of 8 bytes, integers are little endian.
+//
+// A request looks up the suffixes of its host in the host tables, one probe
+// per label as a trie of the domain names would, and each of its words in
+// the word tables. Only the rules found this way, and those without a word,
+// have their pattern compared with the address.
+class RequestFilter
+{
+public:
+    static const UINT32 c_magic = 0x31465257;  // "WRF1"
+    static const UINT32 c_version = 1;
+
+    // Checks the whole snapshot, a damaged one fails rather than being read
+    // out of bounds later
+    HRESULT Load(const BYTE* data, size_t size);
+    void Unload() { *this = RequestFilter(); }
+    bool IsLoaded() const { return m_header != nullptr; }
+
+    UINT64 GetSourceTime() const;
+    UINT64 GetSourceSize() const;
+    size_t GetRuleCount() const;
+
+    // True if a blocking rule matches and no exception does
+    bool Match(const FilterRequest& request) const;
+
+private:
+    friend class FilterCompiler;
+
+    struct Header;
+    struct Table;
+    struct Slot;
+    struct Domain;
+    struct Rule;
+
+    const Header* m_header = nullptr;
+    const Slot* m_slots[4] = {};
+    const Domain* m_domains = nullptr;
+    const Rule* m_rules = nullptr;
+    const UINT32* m_postings = nullptr;
+    const char* m_strings = nullptr;
+
+    bool FindRule(const FilterRequest& request, bool exception) const;
+    bool MatchRule(const Rule& rule, const FilterRequest& request) const;
+    const Slot* FindSlot(size_t table, UINT64 key) const;
+};
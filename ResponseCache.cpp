@@ -0,0 +1,1030 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ResponseCache.h"
+
+namespace
+{
+    enum EntryFlags : UINT32
+    {
+        c_noCache = 0x01,         // Revalidated every time
+        c_mustRevalidate = 0x02,  // Never served stale
+        c_validators = 0x04,      // Has an ETag or Last-Modified
+    };
+
+    // Delta seconds are capped at this, as RFC 9111 suggests
+    const LONGLONG c_maxDeltaSeconds = 2147483648LL;
+
+    // Headers which only describe one transfer, or which must not be sent
+    // again with a cached response. Bodies are kept decoded.
+    const char* const c_unstoredHeaders[] =
+    {
+        "age", "connection", "content-encoding", "content-length", "keep-alive", "proxy-connection",
+        "set-cookie", "te", "trailer", "transfer-encoding", "upgrade",
+    };
+
+    // Headers of a request which the conditional request of a revalidation
+    // doesn't take over. Its body isn't read, the host has to send its own,
+    // and the cookies the host sends come from the cookie store.
+    const char* const c_unsentHeaders[] =
+    {
+        "accept-encoding", "connection", "content-length", "cookie", "host", "keep-alive", "proxy-connection",
+        "te", "transfer-encoding", "upgrade",
+    };
+
+    // The page asks the server itself
+    const char* const c_conditionalHeaders[] =
+    {
+        "if-match", "if-modified-since", "if-none-match", "if-range", "if-unmodified-since", "range",
+    };
+
+    const char* const c_months[] = { "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec" };
+
+    struct Directives
+    {
+        bool noStore = false;
+        bool noCache = false;
+        bool mustRevalidate = false;
+        LONGLONG maxAge = -1;  // -1 when not given
+        LONGLONG minFresh = -1;
+    };
+
+    typedef std::vector<std::pair<std::string, std::string>> HeaderList;
+}
+
+static char ToLower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+static std::string ToLower(std::string text)
+{
+    std::transform(text.begin(), text.end(), text.begin(), [](char c) { return ToLower(c); });
+    return text;
+}
+
+static bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static std::string Trim(const std::string& text)
+{
+    size_t begin = 0;
+    size_t end = text.size();
+    while (begin < end && IsSpace(text[begin]))
+    {
+        ++begin;
+    }
+    while (end > begin && IsSpace(text[end - 1]))
+    {
+        --end;
+    }
+    return text.substr(begin, end - begin);
+}
+
+template<size_t N> static bool IsListed(const std::string& lowerName, const char* const (&names)[N])
+{
+    return std::any_of(names, names + N, [&](const char* name) { return lowerName == name; });
+}
+
+// The name of each pair is lowercase. Lines without a colon, like the status
+// line, are skipped.
+static void SplitHeaders(const std::string& headers, HeaderList& fields)
+{
+    size_t begin = 0;
+    while (begin < headers.size())
+    {
+        size_t end = headers.find('\n', begin);
+        if (end == std::string::npos)
+        {
+            end = headers.size();
+        }
+
+        size_t const colon = headers.find(':', begin);
+        if (colon < end)
+        {
+            std::string name = Trim(headers.substr(begin, colon - begin));
+            if (!name.empty())
+            {
+                fields.emplace_back(ToLower(std::move(name)), Trim(headers.substr(colon + 1, end - colon - 1)));
+            }
+        }
+        begin = end + 1;
+    }
+}
+
+static void AppendHeader(const std::string& name, const std::string& value, std::string& headers)
+{
+    headers += name;
+    headers += ": ";
+    headers += value;
+    headers += "\r\n";
+}
+
+// Leaves out the headers listed
+template<size_t N> static std::string CopyHeaders(const std::string& headers, const char* const (&skipped)[N])
+{
+    HeaderList fields;
+    SplitHeaders(headers, fields);
+
+    std::string copy;
+    for (const auto& field : fields)
+    {
+        if (!IsListed(field.first, skipped))
+        {
+            AppendHeader(field.first, field.second, copy);
+        }
+    }
+    return copy;
+}
+
+// The headers of a 304 replace those of the same name in the cached response
+static std::string MergeHeaders(const std::string& headers, const std::string& update)
+{
+    HeaderList fields;
+    HeaderList updated;
+    SplitHeaders(headers, fields);
+    SplitHeaders(update, updated);
+
+    std::string merged;
+    for (const auto& field : fields)
+    {
+        bool const replaced = std::any_of(updated.begin(), updated.end(),
+            [&](const std::pair<std::string, std::string>& other) { return other.first == field.first; });
+        if (!replaced)
+        {
+            AppendHeader(field.first, field.second, merged);
+        }
+    }
+    for (const auto& field : updated)
+    {
+        AppendHeader(field.first, field.second, merged);
+    }
+    return merged;
+}
+
+// The request headers named by the Vary header of a response, a cached
+// response is only used for requests with the same ones
+static std::string SelectVary(const std::string& vary, const std::string& requestHeaders)
+{
+    std::string selected;
+    size_t begin = 0;
+    while (begin < vary.size())
+    {
+        size_t end = vary.find(',', begin);
+        if (end == std::string::npos)
+        {
+            end = vary.size();
+        }
+
+        std::string const name = ToLower(Trim(vary.substr(begin, end - begin)));
+        if (!name.empty())
+        {
+            AppendHeader(name, ResponseCache::GetHeader(requestHeaders, name.c_str()), selected);
+        }
+        begin = end + 1;
+    }
+    return selected;
+}
+
+// -1 if the value isn't a number of seconds
+static LONGLONG ParseSeconds(const std::string& value)
+{
+    if (value.empty() || !std::all_of(value.begin(), value.end(), [](char c) { return c >= '0' && c <= '9'; }))
+    {
+        return -1;
+    }
+
+    LONGLONG seconds = 0;
+    for (char c : value)
+    {
+        seconds = std::min(seconds * 10 + (c - '0'), c_maxDeltaSeconds);
+    }
+    return seconds;
+}
+
+// Cache-Control, and Pragma where there is no Cache-Control
+static Directives ParseDirectives(const std::string& headers)
+{
+    Directives directives;
+    std::string const value = ResponseCache::GetHeader(headers, "cache-control");
+    if (value.empty())
+    {
+        directives.noCache = ToLower(ResponseCache::GetHeader(headers, "pragma")).find("no-cache") != std::string::npos;
+        return directives;
+    }
+
+    size_t begin = 0;
+    while (begin < value.size())
+    {
+        size_t end = value.find(',', begin);
+        if (end == std::string::npos)
+        {
+            end = value.size();
+        }
+
+        std::string directive = Trim(value.substr(begin, end - begin));
+        std::string argument;
+        size_t const equals = directive.find('=');
+        if (equals != std::string::npos)
+        {
+            argument = Trim(directive.substr(equals + 1));
+            if (argument.size() >= 2 && argument.front() == '"' && argument.back() == '"')
+            {
+                argument = argument.substr(1, argument.size() - 2);
+            }
+            directive = Trim(directive.substr(0, equals));
+        }
+        directive = ToLower(std::move(directive));
+
+        // A malformed age makes the response stale rather than fresh
+        if (directive == "no-store")
+        {
+            directives.noStore = true;
+        }
+        else if (directive == "no-cache")
+        {
+            directives.noCache = true;
+        }
+        else if (directive == "must-revalidate")
+        {
+            directives.mustRevalidate = true;
+        }
+        else if (directive == "max-age")
+        {
+            directives.maxAge = std::max<LONGLONG>(ParseSeconds(argument), 0);
+        }
+        else if (directive == "min-fresh")
+        {
+            directives.minFresh = std::max<LONGLONG>(ParseSeconds(argument), 0);
+        }
+        begin = end + 1;
+    }
+    return directives;
+}
+
+// Days since 1970-01-01 of a date of the proleptic Gregorian calendar
+static LONGLONG DaysFromCivil(LONGLONG year, int month, int day)
+{
+    year -= month <= 2 ? 1 : 0;
+    LONGLONG const era = (year >= 0 ? year : year - 399) / 400;
+    LONGLONG const yearOfEra = year - era * 400;
+    LONGLONG const dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    LONGLONG const dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+static std::string GetKey(const std::string& uri)
+{
+    return uri.substr(0, uri.find('#'));
+}
+
+// scheme://host[:port] in lowercase, without the default port
+static bool GetOrigin(const std::string& uri, std::string& origin)
+{
+    size_t const schemeEnd = uri.find("://");
+    if (schemeEnd == std::string::npos)
+    {
+        return false;
+    }
+    std::string const scheme = ToLower(uri.substr(0, schemeEnd));
+    if (scheme != "http" && scheme != "https")
+    {
+        return false;
+    }
+
+    size_t const begin = schemeEnd + 3;
+    size_t end = uri.find_first_of("/?#", begin);
+    if (end == std::string::npos)
+    {
+        end = uri.size();
+    }
+    std::string authority = ToLower(uri.substr(begin, end - begin));
+    if (authority.empty() || authority.find('@') != std::string::npos)
+    {
+        return false;
+    }
+
+    std::string const defaultPort = scheme == "http" ? ":80" : ":443";
+    if (authority.size() > defaultPort.size() &&
+        authority.compare(authority.size() - defaultPort.size(), defaultPort.size(), defaultPort) == 0)
+    {
+        authority.resize(authority.size() - defaultPort.size());
+    }
+    origin = scheme + "://" + authority;
+    return true;
+}
+
+// 64 bit FNV-1a of the bytes and their count, in hex
+static std::string GetBlobName(const BYTE* data, size_t size)
+{
+    UINT64 hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    }
+
+    char name[40];
+    StringCchPrintfA(name, _countof(name), "%016llx-%llx", hash, static_cast<unsigned long long>(size));
+    return name;
+}
+
+// Names come from the index as well, they must not lead out of the folder
+static bool IsValidBlobName(const std::string& name, UINT64 size)
+{
+    char suffix[24];
+    StringCchPrintfA(suffix, _countof(suffix), "-%llx", static_cast<unsigned long long>(size));
+    size_t const suffixLength = strlen(suffix);
+    return name.size() == 16 + suffixLength &&
+        std::all_of(name.begin(), name.begin() + 16, [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); }) &&
+        name.compare(16, suffixLength, suffix) == 0;
+}
+
+static bool IsValidBlobName(const std::string& name)
+{
+    size_t const dash = name.find('-');
+    if (dash != 16 || name.size() == 17 || name.size() > 33 ||
+        !std::all_of(name.begin() + 17, name.end(), [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); }))
+    {
+        return false;
+    }
+    return IsValidBlobName(name, std::stoull(name.substr(17), nullptr, 16));
+}
+
+static void AppendUInt32(std::vector<BYTE>& buffer, UINT32 value)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        buffer.push_back(static_cast<BYTE>(value >> shift));
+    }
+}
+
+static void AppendUInt64(std::vector<BYTE>& buffer, UINT64 value)
+{
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        buffer.push_back(static_cast<BYTE>(value >> shift));
+    }
+}
+
+static void AppendString(std::vector<BYTE>& buffer, const std::string& value)
+{
+    AppendUInt32(buffer, static_cast<UINT32>(value.size()));
+    buffer.insert(buffer.end(), value.begin(), value.end());
+}
+
+static bool ReadUInt32(const std::vector<BYTE>& buffer, size_t& offset, UINT32& value)
+{
+    if (buffer.size() - offset < 4)
+    {
+        return false;
+    }
+
+    value = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        value |= static_cast<UINT32>(buffer[offset++]) << (8 * i);
+    }
+    return true;
+}
+
+static bool ReadUInt64(const std::vector<BYTE>& buffer, size_t& offset, UINT64& value)
+{
+    if (buffer.size() - offset < 8)
+    {
+        return false;
+    }
+
+    value = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        value |= static_cast<UINT64>(buffer[offset++]) << (8 * i);
+    }
+    return true;
+}
+
+static bool ReadString(const std::vector<BYTE>& buffer, size_t& offset, std::string& value)
+{
+    UINT32 length = 0;
+    if (!ReadUInt32(buffer, offset, length) || buffer.size() - offset < length)
+    {
+        return false;
+    }
+
+    value.assign(reinterpret_cast<const char*>(buffer.data() + offset), length);
+    offset += length;
+    return true;
+}
+
+ResponseCache::ResponseCache(std::function<LONGLONG()> clock, std::function<void()> scheduleWrite) :
+    m_clock(std::move(clock)), m_scheduleWrite(std::move(scheduleWrite))
+{
+}
+
+HRESULT ResponseCache::Open(Storage* storage, UINT64 maxSize)
+{
+    m_entries.clear();
+    m_entriesByUri.clear();
+    m_blobs.clear();
+    m_size = 0;
+    m_maxSize = maxSize;
+
+    std::vector<std::string> names;
+    RETURN_IF_FAILED(storage->ListBlobs(names));
+    std::unordered_set<std::string> blobs(names.begin(), names.end());
+
+    std::vector<BYTE> index;
+    HRESULT hr = storage->ReadIndex(index);
+    if (FAILED(hr) && hr != HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND))
+    {
+        return hr;
+    }
+    m_storage = storage;
+    if (SUCCEEDED(hr) && FAILED(ReadIndex(index, blobs)))
+    {
+        m_entries.clear();
+        m_entriesByUri.clear();
+        m_blobs.clear();
+        m_size = 0;
+        ScheduleWrite();
+    }
+
+    // Bodies written before the index was, or whose entries went since
+    for (const std::string& name : names)
+    {
+        if (IsValidBlobName(name) && m_blobs.find(name) == m_blobs.end())
+        {
+            storage->RemoveBlob(name);
+        }
+    }
+
+    // The cache may have been larger before
+    size_t const count = m_entries.size();
+    Evict();
+    if (m_entries.size() != count)
+    {
+        ScheduleWrite();
+    }
+    return S_OK;
+}
+
+void ResponseCache::SetOrigins(const std::vector<std::string>& origins)
+{
+    m_origins.clear();
+    for (const std::string& uri : origins)
+    {
+        std::string origin;
+        if (GetOrigin(Trim(uri), origin) && std::find(m_origins.begin(), m_origins.end(), origin) == m_origins.end())
+        {
+            m_origins.push_back(std::move(origin));
+        }
+    }
+}
+
+bool ResponseCache::IsCachedOrigin(const std::string& uri) const
+{
+    std::string origin;
+    return GetOrigin(uri, origin) && std::find(m_origins.begin(), m_origins.end(), origin) != m_origins.end();
+}
+
+ResponseCache::Action ResponseCache::Lookup(const Request& request, Response& response, std::string& revalidationHeaders)
+{
+    revalidationHeaders.clear();
+    if (!IsOpen() || !IsCachedOrigin(request.uri))
+    {
+        return Action::Network;
+    }
+
+    // Requests which change what is behind the URI make the cached response
+    // obsolete
+    if (request.method != "GET")
+    {
+        if (request.method != "HEAD" && request.method != "OPTIONS")
+        {
+            Remove(request.uri);
+        }
+        return Action::Network;
+    }
+
+    Directives const directives = ParseDirectives(request.headers);
+    if (directives.noStore ||
+        std::any_of(std::begin(c_conditionalHeaders), std::end(c_conditionalHeaders),
+            [&](const char* name) { return !GetHeader(request.headers, name).empty(); }))
+    {
+        return Action::Network;
+    }
+
+    auto it = m_entriesByUri.find(GetKey(request.uri));
+    if (it == m_entriesByUri.end() ||
+        SelectVary(GetHeader(it->second->headers, "vary"), request.headers) != it->second->vary)
+    {
+        ++m_statistics.misses;
+        return Action::Network;
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    ScheduleWrite();
+    const Entry& entry = m_entries.front();
+
+    LONGLONG const age = entry.initialAge + std::max<LONGLONG>(m_clock() - entry.responseTime, 0);
+    bool fresh = !(entry.flags & c_noCache) && !directives.noCache && age < entry.lifetime;
+    // Reloads ask with max-age=0
+    if (directives.maxAge == 0 || (directives.maxAge > 0 && age > directives.maxAge))
+    {
+        fresh = false;
+    }
+    if (directives.minFresh >= 0 && entry.lifetime - age < directives.minFresh)
+    {
+        fresh = false;
+    }
+    if (fresh)
+    {
+        ++m_statistics.hits;
+        m_statistics.bytesSaved += entry.size;
+        Fill(entry, response);
+        return Action::Serve;
+    }
+
+    if (!(entry.flags & c_validators))
+    {
+        ++m_statistics.misses;
+        return Action::Network;
+    }
+
+    revalidationHeaders = CopyHeaders(request.headers, c_unsentHeaders);
+    std::string const etag = GetHeader(entry.headers, "etag");
+    if (!etag.empty())
+    {
+        AppendHeader("If-None-Match", etag, revalidationHeaders);
+    }
+    std::string const lastModified = GetHeader(entry.headers, "last-modified");
+    if (!lastModified.empty())
+    {
+        AppendHeader("If-Modified-Since", lastModified, revalidationHeaders);
+    }
+    return Action::Revalidate;
+}
+
+// A stale response is served when the server can't be reached, unless it
+// forbids it. Any answer but 304 replaces the cached response, the request
+// then goes to the network for it. So does a 304 which sets cookies, the
+// page wouldn't get them with the cached response, which stays stale.
+ResponseCache::Action ResponseCache::Revalidated(const Request& request, HRESULT result, int status,
+    const std::string& headers, Response& response)
+{
+    auto it = m_entriesByUri.find(GetKey(request.uri));
+    if (it == m_entriesByUri.end())
+    {
+        ++m_statistics.misses;
+        return Action::Network;
+    }
+    Entry& entry = *it->second;
+
+    if (FAILED(result))
+    {
+        if (entry.flags & (c_noCache | c_mustRevalidate))
+        {
+            ++m_statistics.misses;
+            return Action::Network;
+        }
+        ++m_statistics.staleHits;
+        m_statistics.bytesSaved += entry.size;
+        Fill(entry, response);
+        return Action::Serve;
+    }
+
+    if (status != 304)
+    {
+        Erase(it->second);
+        ScheduleWrite();
+        ++m_statistics.misses;
+        return Action::Network;
+    }
+
+    if (!GetHeader(headers, "set-cookie").empty())
+    {
+        ++m_statistics.misses;
+        return Action::Network;
+    }
+
+    std::string const merged = MergeHeaders(entry.headers, headers);
+    Describe(entry, merged, m_clock());
+    entry.headers = CopyHeaders(merged, c_unstoredHeaders);
+    ScheduleWrite();
+    ++m_statistics.revalidated;
+    m_statistics.bytesSaved += entry.size;
+    Fill(entry, response);
+    return Action::Serve;
+}
+
+// Only responses which can be fresh or revalidated are worth keeping
+bool ResponseCache::ShouldStore(const Request& request, int status, const std::string& headers) const
+{
+    if (!IsOpen() || request.method != "GET" || (status != 200 && status != 203) || !IsCachedOrigin(request.uri))
+    {
+        return false;
+    }
+
+    Directives const requestDirectives = ParseDirectives(request.headers);
+    Directives const directives = ParseDirectives(headers);
+    if (requestDirectives.noStore || directives.noStore ||
+        !GetHeader(request.headers, "range").empty() ||
+        !GetHeader(headers, "set-cookie").empty() ||
+        GetHeader(headers, "vary").find('*') != std::string::npos)
+    {
+        return false;
+    }
+    if (directives.maxAge < 0 && GetHeader(headers, "expires").empty() &&
+        GetHeader(headers, "last-modified").empty() && GetHeader(headers, "etag").empty())
+    {
+        return false;
+    }
+
+    // The cached response itself, served to the page
+    auto it = m_entriesByUri.find(GetKey(request.uri));
+    return it == m_entriesByUri.end() || it->second->status != status ||
+        it->second->headers != CopyHeaders(headers, c_unstoredHeaders) ||
+        it->second->vary != SelectVary(GetHeader(headers, "vary"), request.headers);
+}
+
+// The body is compared with the blob of the same name, if there is one, so a
+// hash collision can't serve the body of another response
+HRESULT ResponseCache::Store(const Request& request, int status, const std::string& reason, const std::string& headers,
+    const BYTE* body, size_t size)
+{
+    if (!ShouldStore(request, status, headers) || size > GetMaxBodySize())
+    {
+        return S_FALSE;
+    }
+
+    std::string blob = GetBlobName(body, size);
+    if (m_blobs.find(blob) == m_blobs.end())
+    {
+        RETURN_IF_FAILED(m_storage->WriteBlob(blob, body, size));
+    }
+    else
+    {
+        std::vector<BYTE> stored;
+        RETURN_IF_FAILED(m_storage->ReadBlob(blob, stored));
+        if (stored.size() != size || (size != 0 && memcmp(stored.data(), body, size) != 0))
+        {
+            return S_FALSE;
+        }
+    }
+
+    Entry entry;
+    entry.uri = GetKey(request.uri);
+    entry.vary = SelectVary(GetHeader(headers, "vary"), request.headers);
+    entry.status = status;
+    entry.reason = reason;
+    entry.blob = std::move(blob);
+    entry.size = size;
+    Describe(entry, headers, m_clock());
+    entry.headers = CopyHeaders(headers, c_unstoredHeaders);
+    Insert(std::move(entry));
+
+    ++m_statistics.stored;
+    Evict();
+    ScheduleWrite();
+    return S_OK;
+}
+
+void ResponseCache::Remove(const std::string& uri)
+{
+    auto it = m_entriesByUri.find(GetKey(uri));
+    if (it != m_entriesByUri.end())
+    {
+        Erase(it->second);
+        ScheduleWrite();
+    }
+}
+
+// Bodies no entry knows of go as well
+HRESULT ResponseCache::Clear()
+{
+    if (!IsOpen())
+    {
+        return S_OK;
+    }
+
+    while (!m_entries.empty())
+    {
+        Erase(m_entries.begin());
+    }
+
+    std::vector<std::string> names;
+    RETURN_IF_FAILED(m_storage->ListBlobs(names));
+    for (const std::string& name : names)
+    {
+        if (IsValidBlobName(name))
+        {
+            m_storage->RemoveBlob(name);
+        }
+    }
+
+    ScheduleWrite();
+    return WriteIndex();
+}
+
+// The index is written as
+//   magic, version, entry count                   3 x uint32
+//   per entry, most recently used first:
+//     URI, vary, reason, headers, blob             uint32 length, bytes each
+//     status                                       uint32
+//     size, response time, initial age, lifetime   4 x uint64
+//     flags                                        uint32
+// All integers are little endian.
+HRESULT ResponseCache::WriteIndex()
+{
+    if (!m_writeScheduled || !IsOpen())
+    {
+        return S_OK;
+    }
+    m_writeScheduled = false;
+
+    std::vector<BYTE> index;
+    AppendUInt32(index, c_magic);
+    AppendUInt32(index, c_version);
+    AppendUInt32(index, static_cast<UINT32>(m_entries.size()));
+    for (const Entry& entry : m_entries)
+    {
+        AppendString(index, entry.uri);
+        AppendString(index, entry.vary);
+        AppendString(index, entry.reason);
+        AppendString(index, entry.headers);
+        AppendString(index, entry.blob);
+        AppendUInt32(index, static_cast<UINT32>(entry.status));
+        AppendUInt64(index, entry.size);
+        AppendUInt64(index, static_cast<UINT64>(entry.responseTime));
+        AppendUInt64(index, static_cast<UINT64>(entry.initialAge));
+        AppendUInt64(index, static_cast<UINT64>(entry.lifetime));
+        AppendUInt32(index, entry.flags);
+    }
+    return m_storage->WriteIndex(index);
+}
+
+ResponseCache::Statistics ResponseCache::GetStatistics() const
+{
+    Statistics statistics = m_statistics;
+    statistics.entries = m_entries.size();
+    statistics.size = m_size;
+    return statistics;
+}
+
+std::string ResponseCache::GetHeader(const std::string& headers, const char* name)
+{
+    HeaderList fields;
+    SplitHeaders(headers, fields);
+
+    std::string const lowerName = ToLower(name);
+    std::string value;
+    for (const auto& field : fields)
+    {
+        if (field.first == lowerName)
+        {
+            if (!value.empty())
+            {
+                value += ", ";
+            }
+            value += field.second;
+        }
+    }
+    return value;
+}
+
+// Takes the day, month, year and time from wherever they are, which covers
+//   Sun, 06 Nov 1994 08:49:37 GMT    the format in use
+//   Sunday, 06-Nov-94 08:49:37 GMT   RFC 850
+//   Sun Nov  6 08:49:37 1994         asctime()
+bool ResponseCache::ParseHttpDate(const std::string& value, LONGLONG& time)
+{
+    int day = -1;
+    int month = -1;
+    int year = -1;
+    int hour = -1;
+    int minute = -1;
+    int second = -1;
+
+    size_t begin = 0;
+    while (begin < value.size())
+    {
+        size_t end = value.find_first_of(" ,-", begin);
+        if (end == std::string::npos)
+        {
+            end = value.size();
+        }
+        std::string const token = ToLower(value.substr(begin, end - begin));
+        begin = end + 1;
+        if (token.empty())
+        {
+            continue;
+        }
+
+        bool const digits = std::all_of(token.begin(), token.end(), [](char c) { return c >= '0' && c <= '9'; });
+        if (token.find(':') != std::string::npos)
+        {
+            if (token.size() != 8 || token[2] != ':' || token[5] != ':' ||
+                !std::all_of(token.begin(), token.end(), [](char c) { return (c >= '0' && c <= '9') || c == ':'; }))
+            {
+                return false;
+            }
+            hour = (token[0] - '0') * 10 + (token[1] - '0');
+            minute = (token[3] - '0') * 10 + (token[4] - '0');
+            second = (token[6] - '0') * 10 + (token[7] - '0');
+        }
+        else if (digits && token.size() <= 2 && day < 0)
+        {
+            day = std::stoi(token);
+        }
+        else if (digits && (token.size() == 2 || token.size() == 4) && year < 0)
+        {
+            year = std::stoi(token);
+            if (token.size() == 2)
+            {
+                year += year < 70 ? 2000 : 1900;
+            }
+        }
+        else if (token.size() >= 3 && month < 0)
+        {
+            for (int i = 0; i < 12; ++i)
+            {
+                if (token.compare(0, 3, c_months[i]) == 0)
+                {
+                    month = i + 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (day < 1 || day > 31 || month < 1 || year < 1601 || hour < 0 || hour > 23 || minute > 59 || second > 60)
+    {
+        return false;
+    }
+    time = ((DaysFromCivil(year, month, day) * 24 + hour) * 60 + minute) * 60 + second;
+    return true;
+}
+
+// Freshness as RFC 9111 computes it: the age the response had when it
+// arrived, and how long it is fresh, which Cache-Control max-age, Expires or
+// a tenth of the time since it was last modified tell
+void ResponseCache::Describe(Entry& entry, const std::string& headers, LONGLONG now) const
+{
+    Directives const directives = ParseDirectives(headers);
+
+    LONGLONG date = now;
+    if (!ParseHttpDate(GetHeader(headers, "date"), date))
+    {
+        date = now;
+    }
+    entry.responseTime = now;
+    entry.initialAge = std::max(std::max<LONGLONG>(now - date, 0), ParseSeconds(GetHeader(headers, "age")));
+
+    std::string const expires = GetHeader(headers, "expires");
+    LONGLONG time = 0;
+    if (directives.maxAge >= 0)
+    {
+        entry.lifetime = directives.maxAge;
+    }
+    else if (!expires.empty())
+    {
+        // An invalid date, like 0, means already expired
+        entry.lifetime = ParseHttpDate(expires, time) ? std::max<LONGLONG>(time - date, 0) : 0;
+    }
+    else if (ParseHttpDate(GetHeader(headers, "last-modified"), time) && time < date)
+    {
+        entry.lifetime = std::min<LONGLONG>((date - time) / 10, LONGLONG(c_maxHeuristicLifetime));
+    }
+    else
+    {
+        entry.lifetime = 0;
+    }
+
+    entry.flags = 0;
+    if (directives.noCache)
+    {
+        entry.flags |= c_noCache;
+    }
+    if (directives.mustRevalidate)
+    {
+        entry.flags |= c_mustRevalidate;
+    }
+    if (!GetHeader(headers, "etag").empty() || !GetHeader(headers, "last-modified").empty())
+    {
+        entry.flags |= c_validators;
+    }
+}
+
+void ResponseCache::Fill(const Entry& entry, Response& response) const
+{
+    response.status = entry.status;
+    response.reason = entry.reason;
+    response.headers = entry.headers;
+    response.blob = entry.blob;
+    response.size = entry.size;
+}
+
+// Entries whose blob is gone are dropped
+HRESULT ResponseCache::ReadIndex(const std::vector<BYTE>& data, const std::unordered_set<std::string>& blobs)
+{
+    size_t offset = 0;
+    UINT32 magic = 0;
+    UINT32 version = 0;
+    UINT32 count = 0;
+    if (!ReadUInt32(data, offset, magic) || magic != c_magic ||
+        !ReadUInt32(data, offset, version) || version != c_version ||
+        !ReadUInt32(data, offset, count))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    for (UINT32 i = 0; i < count; ++i)
+    {
+        Entry entry;
+        UINT32 status = 0;
+        UINT64 responseTime = 0;
+        UINT64 initialAge = 0;
+        UINT64 lifetime = 0;
+        if (!ReadString(data, offset, entry.uri) || !ReadString(data, offset, entry.vary) ||
+            !ReadString(data, offset, entry.reason) || !ReadString(data, offset, entry.headers) ||
+            !ReadString(data, offset, entry.blob) || !ReadUInt32(data, offset, status) ||
+            !ReadUInt64(data, offset, entry.size) || !ReadUInt64(data, offset, responseTime) ||
+            !ReadUInt64(data, offset, initialAge) || !ReadUInt64(data, offset, lifetime) ||
+            !ReadUInt32(data, offset, entry.flags))
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+        if (!IsValidBlobName(entry.blob, entry.size))
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+        if (blobs.find(entry.blob) == blobs.end() || m_entriesByUri.find(entry.uri) != m_entriesByUri.end())
+        {
+            continue;
+        }
+
+        entry.status = static_cast<int>(status);
+        entry.responseTime = static_cast<LONGLONG>(responseTime);
+        entry.initialAge = static_cast<LONGLONG>(initialAge);
+        entry.lifetime = static_cast<LONGLONG>(lifetime);
+        if (m_blobs[entry.blob]++ == 0)
+        {
+            m_size += entry.size;
+        }
+        m_entries.push_back(std::move(entry));
+        m_entriesByUri[m_entries.back().uri] = std::prev(m_entries.end());
+    }
+    return offset == data.size() ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+}
+
+// Replaces the entry of the same URI
+void ResponseCache::Insert(Entry entry)
+{
+    if (m_blobs[entry.blob]++ == 0)
+    {
+        m_size += entry.size;
+    }
+
+    auto it = m_entriesByUri.find(entry.uri);
+    if (it != m_entriesByUri.end())
+    {
+        Erase(it->second);
+    }
+    m_entries.push_front(std::move(entry));
+    m_entriesByUri[m_entries.front().uri] = m_entries.begin();
+}
+
+// The blob goes with the last entry using it. One which can't be removed
+// now is by the next Open().
+void ResponseCache::Erase(EntryList::iterator it)
+{
+    auto blob = m_blobs.find(it->blob);
+    if (--blob->second == 0)
+    {
+        m_size -= it->size;
+        m_storage->RemoveBlob(it->blob);
+        m_blobs.erase(blob);
+    }
+    m_entriesByUri.erase(it->uri);
+    m_entries.erase(it);
+}
+
+void ResponseCache::Evict()
+{
+    while (m_size > m_maxSize && !m_entries.empty())
+    {
+        Erase(std::prev(m_entries.end()));
+        ++m_statistics.evicted;
+    }
+}
+
+void ResponseCache::ScheduleWrite()
+{
+    if (!m_writeScheduled)
+    {
+        m_writeScheduled = true;
+        m_scheduleWrite();
+    }
+}
@@ -0,0 +1,168 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Keeps the responses of the origins the user names on disk, so pages which
+// are loaded again and again don't go to the network while their responses
+// are fresh, and only ask whether they changed once they are stale. Bodies
+// are named after a hash of their bytes, so a body served under several URIs
+// is stored once. An index of the responses, most recently used first, is
+// written whenever it changed, and the least recently used responses go once
+// the bodies exceed the size given.
+//
+// The cache follows HTTP caching as a private cache does: freshness comes
+// from Cache-Control max-age, Expires or, as a heuristic, Last-Modified, and
+// stale responses are revalidated with their ETag and Last-Modified. It only
+// decides, the owner carries the requests and responses and stores the files
+// through Storage. Everything runs on one thread. Strings are UTF-8, headers
+// a block of "Name: value\r\n" lines.
+class ResponseCache
+{
+public:
+    // Where the index and the bodies are kept, blob names are ASCII
+    class Storage
+    {
+    public:
+        virtual ~Storage() = default;
+
+        // ERROR_FILE_NOT_FOUND if there is none yet
+        virtual HRESULT ReadIndex(std::vector<BYTE>& data) = 0;
+        // Replaces the index as a whole
+        virtual HRESULT WriteIndex(const std::vector<BYTE>& data) = 0;
+        virtual HRESULT ListBlobs(std::vector<std::string>& names) = 0;
+        virtual HRESULT ReadBlob(const std::string& name, std::vector<BYTE>& data) = 0;
+        // A blob is either written completely or not at all
+        virtual HRESULT WriteBlob(const std::string& name, const BYTE* data, size_t size) = 0;
+        virtual HRESULT RemoveBlob(const std::string& name) = 0;
+    };
+
+    // What the owner does with a request
+    enum class Action
+    {
+        Network,     // Let it go to the network as usual
+        Serve,       // Answer it with the cached response
+        Revalidate,  // Ask the server with the headers given, see Revalidated()
+    };
+
+    struct Request
+    {
+        std::string method;
+        std::string uri;
+        std::string headers;
+    };
+
+    struct Response
+    {
+        int status = 0;
+        std::string reason;
+        std::string headers;
+        std::string blob;  // The body
+        UINT64 size = 0;
+    };
+
+    struct Statistics
+    {
+        ULONGLONG hits = 0;          // Served fresh
+        ULONGLONG revalidated = 0;   // Served once the server said it didn't change
+        ULONGLONG staleHits = 0;     // Served stale since the server couldn't be reached
+        ULONGLONG misses = 0;
+        ULONGLONG stored = 0;
+        ULONGLONG evicted = 0;
+        ULONGLONG bytesSaved = 0;    // Bodies served without loading them
+        size_t entries = 0;
+        UINT64 size = 0;             // Of the bodies
+    };
+
+    static const UINT32 c_magic = 0x31435257;  // "WRC1"
+    static const UINT32 c_version = 1;
+    static const UINT64 c_defaultMaxSize = 256 << 20;
+    // Larger bodies than this share of the cache aren't stored
+    static const UINT64 c_maxEntryShare = 8;
+    // Seconds a response is fresh at most when the server doesn't tell
+    static const LONGLONG c_maxHeuristicLifetime = 24 * 60 * 60;
+
+    // clock returns the seconds since 1970, scheduleWrite is called when the
+    // index changed and WriteIndex() has to run
+    ResponseCache(std::function<LONGLONG()> clock, std::function<void()> scheduleWrite);
+
+    // Reads the index and removes the bodies it doesn't know. A damaged
+    // index starts an empty cache. storage has to outlive the cache.
+    HRESULT Open(Storage* storage, UINT64 maxSize);
+    bool IsOpen() const { return m_storage != nullptr; }
+
+    // scheme://host[:port], others are ignored. Only their requests are cached.
+    void SetOrigins(const std::vector<std::string>& origins);
+    const std::vector<std::string>& GetOrigins() const { return m_origins; }
+    bool IsCachedOrigin(const std::string& uri) const;
+
+    // revalidationHeaders are those of the request with the validators of
+    // the cached response, for Revalidate. They leave out the cookies, the
+    // owner adds those of its cookie store.
+    Action Lookup(const Request& request, Response& response, std::string& revalidationHeaders);
+    // The answer of the server to Revalidate, result fails if it couldn't be
+    // reached. Returns Serve or Network.
+    Action Revalidated(const Request& request, HRESULT result, int status, const std::string& headers, Response& response);
+
+    // Whether Store() would keep the response, before its body is read.
+    // False as well for the response the cache has already.
+    bool ShouldStore(const Request& request, int status, const std::string& headers) const;
+    UINT64 GetMaxBodySize() const { return m_maxSize / c_maxEntryShare; }
+    // S_FALSE if the response isn't stored
+    HRESULT Store(const Request& request, int status, const std::string& reason, const std::string& headers,
+        const BYTE* body, size_t size);
+    // E.g. when its body can't be read anymore
+    void Remove(const std::string& uri);
+    HRESULT Clear();
+
+    // Writes the index if it changed
+    HRESULT WriteIndex();
+
+    Statistics GetStatistics() const;
+
+    // The value of a header, repeated ones joined by commas
+    static std::string GetHeader(const std::string& headers, const char* name);
+    // Any of the three formats of HTTP dates, to seconds since 1970
+    static bool ParseHttpDate(const std::string& value, LONGLONG& time);
+
+private:
+    struct Entry
+    {
+        std::string uri;
+        std::string vary;  // The request headers the response varies by
+        int status = 0;
+        std::string reason;
+        std::string headers;
+        std::string blob;
+        UINT64 size = 0;
+        LONGLONG responseTime = 0;  // When it was received or revalidated
+        LONGLONG initialAge = 0;    // Its age then
+        LONGLONG lifetime = 0;      // Seconds it is fresh for
+        UINT32 flags = 0;        // EntryFlags
+    };
+
+    typedef std::list<Entry> EntryList;
+
+    std::function<LONGLONG()> m_clock;
+    std::function<void()> m_scheduleWrite;
+    Storage* m_storage = nullptr;
+    UINT64 m_maxSize = c_defaultMaxSize;
+    std::vector<std::string> m_origins;
+    EntryList m_entries;  // Most recently used first
+    std::unordered_map<std::string, EntryList::iterator> m_entriesByUri;
+    std::unordered_map<std::string, size_t> m_blobs;  // Name -> entries using it
+    UINT64 m_size = 0;
+    bool m_writeScheduled = false;
+    Statistics m_statistics;
+
+    void Describe(Entry& entry, const std::string& headers, LONGLONG now) const;
+    void Fill(const Entry& entry, Response& response) const;
+    HRESULT ReadIndex(const std::vector<BYTE>& data, const std::unordered_set<std::string>& blobs);
+    void Insert(Entry entry);
+    void Erase(EntryList::iterator it);
+    void Evict();
+    void ScheduleWrite();
+};
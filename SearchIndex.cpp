@@ -0,0 +1,485 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "SearchIndex.h"
+#include "Utf.h"
+
+static const double c_noScore = -1e300;
+static const double c_favoriteBonus = 2.0;  // Favorites rank as if visited four times as often
+static const LONGLONG c_scoreEpoch = 1577836800000LL;  // 2020-01-01
+static const double c_halfLife = 30.0 * 24 * 60 * 60 * 1000;
+
+// A query word whose pages exceed this is answered by scanning in rank order
+static const size_t c_maxCandidates = 16384;
+// Postings which can be read in the time one page is checked while scanning
+static const size_t c_scanCost = 16;
+
+static std::string ToUtf8(const std::wstring& value)
+{
+    std::string result;
+    AppendUtf8(value.c_str(), value.size(), result);
+    return result;
+}
+
+// log2(2^a + 2^b) without leaving the logarithmic domain
+static double AddLog(double a, double b)
+{
+    if (a == c_noScore)
+    {
+        return b;
+    }
+    double const high = std::max(a, b);
+    return high + log2(1.0 + exp2(-fabs(a - b)));
+}
+
+// log2(2^a - 2^b), c_noScore if nothing is left
+static double SubtractLog(double a, double b)
+{
+    if (a == c_noScore || b >= a)
+    {
+        return c_noScore;
+    }
+    return a + log2(1.0 - exp2(b - a));
+}
+
+void SearchIndex::AddHistory(const HistoryStore& history)
+{
+    history.ForEach([this](const std::string& uri, const std::string& title, LONGLONG timestamp)
+    {
+        UINT32 id = GetDocument(uri, title);
+        SetTitle(id, title);
+        AddVisit(id, timestamp, true);
+    });
+}
+
+void SearchIndex::AddVisit(const std::wstring& uri, const std::wstring& title, LONGLONG timestamp, bool isNewEntry)
+{
+    std::string title8 = ToUtf8(title);
+    UINT32 id = GetDocument(ToUtf8(uri), title8);
+    SetTitle(id, title8);
+    AddVisit(id, timestamp, isNewEntry);
+}
+
+void SearchIndex::RemoveVisit(const std::wstring& uri, LONGLONG timestamp)
+{
+    UINT32 id;
+    if (!FindDocument(uri, &id))
+    {
+        return;
+    }
+
+    Document& document = m_documents[id];
+    if (document.entries == 0)
+    {
+        return;
+    }
+
+    --document.entries;
+    document.score = document.entries == 0 ? c_noScore : SubtractLog(document.score, GetVisitWeight(timestamp));
+    UpdateRank(id);
+    ReleaseIfUnused(id);
+}
+
+void SearchIndex::ClearHistory()
+{
+    std::vector<UINT32> ids;
+    ids.reserve(m_byUri.size());
+    for (const auto& entry : m_byUri)
+    {
+        ids.push_back(entry.second);
+    }
+
+    for (UINT32 id : ids)
+    {
+        Document& document = m_documents[id];
+        document.entries = 0;
+        document.score = c_noScore;
+        UpdateRank(id);
+        ReleaseIfUnused(id);
+    }
+}
+
+void SearchIndex::SetTitle(const std::wstring& uri, const std::wstring& title)
+{
+    UINT32 id;
+    if (FindDocument(uri, &id))
+    {
+        SetTitle(id, ToUtf8(title));
+    }
+}
+
+void SearchIndex::SetFavorite(const std::wstring& uri, const std::wstring& title, bool isFavorite, LONGLONG timestamp)
+{
+    UINT32 id;
+    if (!isFavorite)
+    {
+        if (FindDocument(uri, &id))
+        {
+            m_documents[id].favorite = false;
+            UpdateRank(id);
+            ReleaseIfUnused(id);
+        }
+        return;
+    }
+
+    std::string title8 = ToUtf8(title);
+    id = GetDocument(ToUtf8(uri), title8);
+    Document& document = m_documents[id];
+    if (document.title.empty())
+    {
+        SetTitle(id, title8);
+    }
+    if (!document.favorite)
+    {
+        // Adding a favorite counts like a visit which never expires
+        document.favoriteScore = GetVisitWeight(timestamp);
+    }
+    document.favorite = true;
+    UpdateRank(id);
+}
+
+HRESULT SearchIndex::Query(const std::wstring& query, std::vector<Suggestion>& suggestions)
+{
+    suggestions.clear();
+
+    std::vector<std::string> words;
+    Tokenize(ToUtf8(query), words);
+    words.erase(std::remove_if(words.begin(), words.end(), IsNoiseToken), words.end());
+    if (words.empty())
+    {
+        return S_OK;
+    }
+
+    // Find the token range of every word, most selective first
+    m_terms.clear();
+    for (std::string& word : words)
+    {
+        Term term;
+        term.prefix = std::move(word);
+        term.begin = m_tokenIds.lower_bound(term.prefix);
+        term.end = term.begin;
+        term.postings = 0;
+        // Stop counting once the word is too common to collect candidates for
+        while (term.end != m_tokenIds.end() && term.end->first.compare(0, term.prefix.size(), term.prefix) == 0 &&
+            term.postings <= c_maxCandidates)
+        {
+            term.postings += m_postings[term.end->second].size();
+            ++term.end;
+        }
+
+        if (term.begin == term.end)
+        {
+            return S_OK;
+        }
+        m_terms.push_back(std::move(term));
+    }
+    std::sort(m_terms.begin(), m_terms.end(), [](const Term& a, const Term& b) { return a.postings < b.postings; });
+
+    // Scanning in rank order finds common matches after a few steps. Give up
+    // on it once it cost about as much as collecting the candidates would.
+    bool const canCollect = m_terms[0].postings <= c_maxCandidates;
+    size_t budget = 0;
+    for (const Term& term : m_terms)
+    {
+        if (term.postings <= c_maxCandidates)
+        {
+            budget += term.postings / c_scanCost;
+        }
+    }
+
+    m_matches.clear();
+    bool complete = true;
+    for (auto it = m_ranking.rbegin(); it != m_ranking.rend() && m_matches.size() < c_maxSuggestions; ++it)
+    {
+        if (canCollect && budget-- == 0)
+        {
+            complete = false;
+            break;
+        }
+        if (Matches(m_documents[it->second]))
+        {
+            m_matches.push_back(*it);
+        }
+    }
+
+    if (!complete)
+    {
+        m_matches.clear();
+        if (m_seen.size() < m_documents.size())
+        {
+            m_seen.resize(m_documents.size(), 0);
+            m_hits.resize(m_documents.size(), 0);
+        }
+        if (++m_queryStamp == 0)
+        {
+            std::fill(m_seen.begin(), m_seen.end(), 0);
+            m_queryStamp = 1;
+        }
+
+        // Intersect the pages of the selective words. A page is a candidate
+        // while it was found for every word so far. Common words, and tokens
+        // a page no longer has, are checked by Matches() on what is left.
+        m_candidates.clear();
+        UINT32 level = 0;
+        for (const Term& term : m_terms)
+        {
+            if (term.postings > c_maxCandidates)
+            {
+                break;
+            }
+
+            for (auto token = term.begin; token != term.end; ++token)
+            {
+                for (UINT32 id : m_postings[token->second])
+                {
+                    if (level == 0)
+                    {
+                        if (m_seen[id] != m_queryStamp)
+                        {
+                            m_seen[id] = m_queryStamp;
+                            m_hits[id] = 1;
+                            m_candidates.push_back(id);
+                        }
+                    }
+                    else if (m_seen[id] == m_queryStamp && m_hits[id] == level)
+                    {
+                        m_hits[id] = level + 1;
+                    }
+                }
+            }
+            ++level;
+        }
+
+        for (UINT32 id : m_candidates)
+        {
+            const Document& document = m_documents[id];
+            if (m_hits[id] == level && document.rank != c_noScore && Matches(document))
+            {
+                m_matches.push_back(std::make_pair(document.rank, id));
+            }
+        }
+
+        size_t count = std::min(m_matches.size(), static_cast<size_t>(c_maxSuggestions));
+        std::partial_sort(m_matches.begin(), m_matches.begin() + count, m_matches.end(),
+            std::greater<std::pair<double, UINT32>>());
+        m_matches.resize(count);
+    }
+
+    suggestions.resize(m_matches.size());
+    for (size_t i = 0; i < m_matches.size(); ++i)
+    {
+        const Document& document = m_documents[m_matches[i].second];
+        Suggestion& suggestion = suggestions[i];
+        RETURN_IF_FAILED(AppendUtf16(document.uri.data(), document.uri.size(), suggestion.uri));
+        RETURN_IF_FAILED(AppendUtf16(document.title.data(), document.title.size(), suggestion.title));
+        suggestion.isFavorite = document.favorite;
+    }
+
+    return S_OK;
+}
+
+UINT32 SearchIndex::GetDocument(const std::string& uri, const std::string& title)
+{
+    auto it = m_byUri.find(uri);
+    if (it != m_byUri.end())
+    {
+        return it->second;
+    }
+
+    UINT32 id;
+    if (!m_freeDocuments.empty())
+    {
+        id = m_freeDocuments.back();
+        m_freeDocuments.pop_back();
+    }
+    else
+    {
+        id = static_cast<UINT32>(m_documents.size());
+        m_documents.emplace_back();
+    }
+
+    Document& document = m_documents[id];
+    document.uri = uri;
+    document.title = title;
+    document.tokens.clear();
+    document.score = c_noScore;
+    document.favoriteScore = c_noScore;
+    document.rank = c_noScore;
+    document.entries = 0;
+    document.favorite = false;
+
+    m_byUri.insert(std::make_pair(uri, id));
+    IndexTokens(id);
+    return id;
+}
+
+void SearchIndex::AddVisit(UINT32 id, LONGLONG timestamp, bool isNewEntry)
+{
+    Document& document = m_documents[id];
+    if (isNewEntry)
+    {
+        ++document.entries;
+    }
+    document.score = AddLog(document.score, GetVisitWeight(timestamp));
+    UpdateRank(id);
+}
+
+void SearchIndex::SetTitle(UINT32 id, const std::string& title)
+{
+    Document& document = m_documents[id];
+    if (document.title != title)
+    {
+        document.title = title;
+        IndexTokens(id);
+    }
+}
+
+void SearchIndex::UpdateRank(UINT32 id)
+{
+    Document& document = m_documents[id];
+    if (document.rank != c_noScore)
+    {
+        m_ranking.erase(std::make_pair(document.rank, id));
+    }
+
+    document.rank = document.score;
+    if (document.favorite)
+    {
+        document.rank = AddLog(document.rank, document.favoriteScore) + c_favoriteBonus;
+    }
+    if (document.rank != c_noScore)
+    {
+        m_ranking.insert(std::make_pair(document.rank, id));
+    }
+}
+
+// Documents which are neither visited nor a favorite are dropped. Their
+// postings stay behind, queries skip them since their rank is c_noScore and
+// a document reusing the id is checked with Matches().
+void SearchIndex::ReleaseIfUnused(UINT32 id)
+{
+    Document& document = m_documents[id];
+    if (document.entries != 0 || document.favorite)
+    {
+        return;
+    }
+
+    m_byUri.erase(document.uri);
+    std::string().swap(document.uri);
+    std::string().swap(document.title);
+    std::vector<UINT32>().swap(document.tokens);
+    m_freeDocuments.push_back(id);
+}
+
+// Adds the document to the postings of its tokens. Postings of tokens it no
+// longer has are left alone, Matches() rejects them.
+void SearchIndex::IndexTokens(UINT32 id)
+{
+    std::vector<std::string> words;
+    Tokenize(m_documents[id].uri, words);
+    Tokenize(m_documents[id].title, words);
+
+    std::vector<UINT32> tokens;
+    tokens.reserve(words.size());
+    for (const std::string& word : words)
+    {
+        if (IsNoiseToken(word))
+        {
+            continue;
+        }
+
+        auto it = m_tokenIds.find(word);
+        if (it == m_tokenIds.end())
+        {
+            UINT32 token = static_cast<UINT32>(m_tokens.size());
+            it = m_tokenIds.insert(std::make_pair(word, token)).first;
+            m_tokens.push_back(&it->first);
+            m_postings.emplace_back();
+        }
+        tokens.push_back(it->second);
+    }
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+
+    std::vector<UINT32>& previous = m_documents[id].tokens;
+    for (UINT32 token : tokens)
+    {
+        if (!std::binary_search(previous.begin(), previous.end(), token))
+        {
+            m_postings[token].push_back(id);
+        }
+    }
+    previous.swap(tokens);
+}
+
+bool SearchIndex::Matches(const Document& document) const
+{
+    for (const Term& term : m_terms)
+    {
+        bool found = false;
+        for (UINT32 token : document.tokens)
+        {
+            if (m_tokens[token]->compare(0, term.prefix.size(), term.prefix) == 0)
+            {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SearchIndex::FindDocument(const std::wstring& uri, UINT32* id) const
+{
+    auto it = m_byUri.find(ToUtf8(uri));
+    if (it == m_byUri.end())
+    {
+        return false;
+    }
+    *id = it->second;
+    return true;
+}
+
+// Splits at everything but letters and digits and lower cases ASCII. Bytes
+// of non-ASCII characters are kept as they are.
+void SearchIndex::Tokenize(const std::string& text, std::vector<std::string>& tokens)
+{
+    std::string token;
+    for (char c : text)
+    {
+        unsigned char const u = static_cast<unsigned char>(c);
+        if ((u >= 'a' && u <= 'z') || (u >= '0' && u <= '9') || u >= 0x80)
+        {
+            token.push_back(c);
+        }
+        else if (u >= 'A' && u <= 'Z')
+        {
+            token.push_back(static_cast<char>(u - 'A' + 'a'));
+        }
+        else if (!token.empty())
+        {
+            tokens.push_back(std::move(token));
+            token.clear();
+        }
+    }
+    if (!token.empty())
+    {
+        tokens.push_back(std::move(token));
+    }
+}
+
+// Parts of nearly every URI, indexing them would only cost memory
+bool SearchIndex::IsNoiseToken(const std::string& token)
+{
+    return token == "http" || token == "https" || token == "www";
+}
+
+double SearchIndex::GetVisitWeight(LONGLONG timestamp)
+{
+    return (timestamp - c_scoreEpoch) / c_halfLife;
+}
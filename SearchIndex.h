@@ -0,0 +1,92 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+#include "HistoryStore.h"
+#include "Messages.h"
+
+// Address bar suggestions over the URIs and titles of the history and the
+// favorites. Both are split into lower case tokens, every word of a query has
+// to be a prefix of one of the tokens of a page.
+//
+// Tokens are kept in a sorted map, so the tokens starting with a query word
+// form one range, and each token has the list of pages it occurs in. A query
+// collects candidates from the word with the fewest pages. When all words are
+// common, the pages are scanned in rank order instead, which finds the best
+// matches after a few steps.
+//
+// Pages are ranked by frecency: every visit contributes a weight which halves
+// every 30 days. The sum is kept as a base 2 logarithm relative to a fixed
+// epoch, so ranks only change when a page does, not as time passes.
+class SearchIndex
+{
+public:
+    static const size_t c_maxSuggestions = 8;
+
+    void AddHistory(const HistoryStore& history);
+    // isNewEntry is false when the visit only moved an existing history entry
+    void AddVisit(const std::wstring& uri, const std::wstring& title, LONGLONG timestamp, bool isNewEntry);
+    void RemoveVisit(const std::wstring& uri, LONGLONG timestamp);
+    void ClearHistory();
+    void SetTitle(const std::wstring& uri, const std::wstring& title);
+    void SetFavorite(const std::wstring& uri, const std::wstring& title, bool isFavorite, LONGLONG timestamp);
+
+    HRESULT Query(const std::wstring& query, std::vector<Suggestion>& suggestions);
+
+    size_t GetCount() const { return m_byUri.size(); }
+
+private:
+    struct Document
+    {
+        std::string uri;    // UTF-8
+        std::string title;
+        std::vector<UINT32> tokens;
+        double score;       // log2 of the visit weights, c_noScore without entries
+        double favoriteScore;
+        double rank;
+        UINT32 entries;     // History entries of the URI
+        bool favorite;
+    };
+
+    std::vector<Document> m_documents;
+    std::vector<UINT32> m_freeDocuments;
+    std::unordered_map<std::string, UINT32> m_byUri;
+    std::set<std::pair<double, UINT32>> m_ranking;
+
+    std::map<std::string, UINT32> m_tokenIds;
+    std::vector<const std::string*> m_tokens;     // Token id -> token
+    std::vector<std::vector<UINT32>> m_postings;  // Token id -> documents
+
+    // Marks the documents already collected by the current query, and for how
+    // many of its words
+    std::vector<UINT32> m_seen;
+    std::vector<UINT32> m_hits;
+    std::vector<UINT32> m_candidates;
+    UINT32 m_queryStamp = 0;
+
+    struct Term
+    {
+        std::string prefix;
+        std::map<std::string, UINT32>::const_iterator begin;
+        std::map<std::string, UINT32>::const_iterator end;
+        size_t postings;
+    };
+    std::vector<Term> m_terms;
+    std::vector<std::pair<double, UINT32>> m_matches;
+
+    UINT32 GetDocument(const std::string& uri, const std::string& title);
+    void AddVisit(UINT32 id, LONGLONG timestamp, bool isNewEntry);
+    void SetTitle(UINT32 id, const std::string& title);
+    void UpdateRank(UINT32 id);
+    void ReleaseIfUnused(UINT32 id);
+    void IndexTokens(UINT32 id);
+    bool Matches(const Document& document) const;
+    bool FindDocument(const std::wstring& uri, UINT32* id) const;
+
+    static void Tokenize(const std::string& text, std::vector<std::string>& tokens);
+    static bool IsNoiseToken(const std::string& token);
+    static double GetVisitWeight(LONGLONG timestamp);
+};
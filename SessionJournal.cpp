@@ -0,0 +1,509 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "SessionJournal.h"
+#include "Utf.h"
+
+// The journal is a header followed by records of the form
+// [payload length:4][checksum:4][kind:1][payload], where the checksum is the
+// 32 bit FNV-1a of kind and payload. Integers are little endian and strings
+// are stored as [length:4][UTF-8 bytes].
+static const char s_journalHeader[8] = { 'W', 'V', 'B', 'S', 'S', 'N', '0', '1' };
+static const size_t c_recordHeaderSize = 8;
+
+enum RecordKind
+{
+    c_recordCreate = 1,  // tabId, uri, title
+    c_recordClose = 2,   // tabId
+    c_recordSwitch = 3,  // tabId
+    c_recordUri = 4,     // tabId, uri
+    c_recordTitle = 5,   // tabId, title
+};
+
+static UINT32 GetChecksum(const char* data, size_t size)
+{
+    UINT32 hash = 0x811C9DC5;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x01000193;
+    }
+    return hash;
+}
+
+static void PutInteger(std::string& out, ULONGLONG value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+static void PutString(std::string& out, const std::wstring& value)
+{
+    size_t const start = out.size();
+    PutInteger(out, 0, 4);  // Patched below
+    if (FAILED(AppendUtf8(value.c_str(), value.size(), out)))
+    {
+        // Unpaired surrogates, which no page title or URI needs
+        out.resize(start + 4);
+    }
+    UINT32 const length = static_cast<UINT32>(out.size() - start - 4);
+    for (int i = 0; i < 4; ++i)
+    {
+        out[start + i] = static_cast<char>(length >> (8 * i));
+    }
+}
+
+static void BeginRecord(std::string& out, RecordKind kind, size_t tabId)
+{
+    out.clear();
+    PutInteger(out, 0, 8);  // Patched by EndRecord
+    out.push_back(static_cast<char>(kind));
+    PutInteger(out, tabId, 8);
+}
+
+static void EndRecord(std::string& out)
+{
+    UINT32 const length = static_cast<UINT32>(out.size() - c_recordHeaderSize);
+    UINT32 const checksum = GetChecksum(out.data() + c_recordHeaderSize, length);
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = static_cast<char>(length >> (8 * i));
+        out[4 + i] = static_cast<char>(checksum >> (8 * i));
+    }
+}
+
+struct JournalReader
+{
+    const BYTE* p;
+    const BYTE* end;
+    bool ok;
+
+    ULONGLONG GetInteger(int bytes)
+    {
+        ULONGLONG value = 0;
+        if (end - p < bytes)
+        {
+            ok = false;
+            return 0;
+        }
+        for (int i = 0; i < bytes; ++i)
+        {
+            value |= static_cast<ULONGLONG>(*p++) << (8 * i);
+        }
+        return value;
+    }
+
+    std::wstring GetString()
+    {
+        size_t const length = static_cast<size_t>(GetInteger(4));
+        std::wstring value;
+        if (!ok || static_cast<size_t>(end - p) < length ||
+            FAILED(AppendUtf16(reinterpret_cast<const char*>(p), length, value)))
+        {
+            ok = false;
+            return std::wstring();
+        }
+        p += length;
+        return value;
+    }
+};
+
+SessionJournal::SessionJournal(std::function<void()> scheduleWrite) :
+    m_scheduleWrite(std::move(scheduleWrite)),
+    m_writer(std::make_shared<Writer>())
+{
+}
+
+SessionJournal::~SessionJournal()
+{
+    Flush();
+}
+
+HRESULT SessionJournal::Open(LPCWSTR path)
+{
+    m_tabs.clear();
+    m_activeTabId = INVALID_TAB_ID;
+    m_maxTabId = INVALID_TAB_ID;
+    m_journalRecords = 0;
+    m_statistics = Statistics();
+
+    std::lock_guard<std::mutex> lock(m_writer->mutex);
+    m_writer->path = path;
+    m_writer->pending.clear();
+    m_writer->snapshot.clear();
+    m_writer->file.reset(CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!m_writer->file)
+    {
+        RETURN_LAST_ERROR();
+    }
+
+    LARGE_INTEGER size;
+    RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(m_writer->file.get(), &size));
+
+    // Only the valid records are copied out of the file, and there are only
+    // a few of them per tab after a compaction
+    size_t valid = 0;
+    if (size.QuadPart > 0)
+    {
+        wil::unique_handle mapping(CreateFileMappingW(m_writer->file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+        if (!mapping)
+        {
+            RETURN_LAST_ERROR();
+        }
+        wil::unique_mapview_ptr<BYTE> view(static_cast<BYTE*>(MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0)));
+        if (!view)
+        {
+            RETURN_LAST_ERROR();
+        }
+        valid = Replay(view.get(), static_cast<size_t>(size.QuadPart));
+    }
+    m_statistics.droppedBytes = static_cast<ULONGLONG>(size.QuadPart) - valid;
+
+    if (valid == 0)
+    {
+        // New or unreadable journal, start over
+        m_tabs.clear();
+        m_activeTabId = INVALID_TAB_ID;
+        m_writer->pending.assign(s_journalHeader, sizeof(s_journalHeader));
+    }
+
+    // Drop a record which was only partially written
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(valid);
+    RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(m_writer->file.get(), position, nullptr, FILE_BEGIN));
+    RETURN_IF_WIN32_BOOL_FALSE(SetEndOfFile(m_writer->file.get()));
+
+    if (m_journalRecords > m_tabs.size() + 1 + c_compactSlack)
+    {
+        Compact();
+    }
+    return m_writer->Write();
+}
+
+void SessionJournal::Create(size_t tabId, const std::wstring& uri)
+{
+    auto it = Find(tabId);
+    if (it != m_tabs.end())
+    {
+        m_tabs.erase(it);
+    }
+    SessionTab tab;
+    tab.tabId = tabId;
+    tab.uri = uri;
+    m_tabs.push_back(tab);
+    m_maxTabId = std::max(m_maxTabId, tabId);
+
+    BeginRecord(m_buffer, c_recordCreate, tabId);
+    PutString(m_buffer, uri);
+    PutString(m_buffer, std::wstring());
+    Queue();
+}
+
+void SessionJournal::Close(size_t tabId)
+{
+    auto it = Find(tabId);
+    if (it == m_tabs.end())
+    {
+        return;
+    }
+    m_tabs.erase(it);
+
+    BeginRecord(m_buffer, c_recordClose, tabId);
+    Queue();
+}
+
+void SessionJournal::Switch(size_t tabId)
+{
+    if (GetActiveTabId() == tabId || Find(tabId) == m_tabs.end())
+    {
+        return;
+    }
+    m_activeTabId = tabId;
+
+    BeginRecord(m_buffer, c_recordSwitch, tabId);
+    Queue();
+}
+
+void SessionJournal::SetUri(size_t tabId, const std::wstring& uri)
+{
+    auto it = Find(tabId);
+    if (it == m_tabs.end() || it->uri == uri)
+    {
+        return;
+    }
+    it->uri = uri;
+
+    BeginRecord(m_buffer, c_recordUri, tabId);
+    PutString(m_buffer, uri);
+    Queue();
+}
+
+void SessionJournal::SetTitle(size_t tabId, const std::wstring& title)
+{
+    auto it = Find(tabId);
+    if (it == m_tabs.end() || it->title == title)
+    {
+        return;
+    }
+    it->title = title;
+
+    BeginRecord(m_buffer, c_recordTitle, tabId);
+    PutString(m_buffer, title);
+    Queue();
+}
+
+size_t SessionJournal::GetActiveTabId() const
+{
+    if (Find(m_activeTabId) != m_tabs.end())
+    {
+        return m_activeTabId;
+    }
+    return m_tabs.empty() ? INVALID_TAB_ID : m_tabs.back().tabId;
+}
+
+std::function<HRESULT()> SessionJournal::TakeWrite()
+{
+    m_writeScheduled = false;
+    std::shared_ptr<Writer> writer = m_writer;
+    return [writer]() -> HRESULT
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        return writer->Write();
+    };
+}
+
+HRESULT SessionJournal::Flush()
+{
+    std::lock_guard<std::mutex> lock(m_writer->mutex);
+    return m_writer->Write();
+}
+
+SessionJournal::Statistics SessionJournal::GetStatistics() const
+{
+    Statistics statistics = m_statistics;
+    std::lock_guard<std::mutex> lock(m_writer->mutex);
+    statistics.writes = m_writer->writes;
+    statistics.bytesWritten = m_writer->bytesWritten;
+    return statistics;
+}
+
+// Applies the valid records and returns where they end, 0 if the header is
+// wrong
+size_t SessionJournal::Replay(const BYTE* data, size_t size)
+{
+    if (size < sizeof(s_journalHeader) || memcmp(data, s_journalHeader, sizeof(s_journalHeader)) != 0)
+    {
+        return 0;
+    }
+
+    size_t valid = sizeof(s_journalHeader);
+    while (size - valid >= c_recordHeaderSize)
+    {
+        JournalReader header = { data + valid, data + size, true };
+        size_t const length = static_cast<size_t>(header.GetInteger(4));
+        UINT32 const checksum = static_cast<UINT32>(header.GetInteger(4));
+        if (length == 0 || static_cast<size_t>(header.end - header.p) < length ||
+            GetChecksum(reinterpret_cast<const char*>(header.p), length) != checksum)
+        {
+            break;
+        }
+
+        JournalReader reader = { header.p + 1, header.p + length, true };
+        size_t const tabId = static_cast<size_t>(reader.GetInteger(8));
+        switch (*header.p)
+        {
+        case c_recordCreate:
+        {
+            SessionTab tab;
+            tab.tabId = tabId;
+            tab.uri = reader.GetString();
+            tab.title = reader.GetString();
+            if (reader.ok)
+            {
+                auto it = Find(tabId);
+                if (it != m_tabs.end())
+                {
+                    m_tabs.erase(it);
+                }
+                m_tabs.push_back(std::move(tab));
+                m_maxTabId = std::max(m_maxTabId, tabId);
+            }
+        }
+        break;
+        case c_recordClose:
+        {
+            auto it = Find(tabId);
+            if (reader.ok && it != m_tabs.end())
+            {
+                m_tabs.erase(it);
+            }
+        }
+        break;
+        case c_recordSwitch:
+            m_activeTabId = tabId;
+            break;
+        case c_recordUri:
+        case c_recordTitle:
+        {
+            std::wstring value = reader.GetString();
+            auto it = Find(tabId);
+            if (reader.ok && it != m_tabs.end())
+            {
+                (*header.p == c_recordUri ? it->uri : it->title) = std::move(value);
+            }
+        }
+        break;
+        default:
+            reader.ok = false;
+            break;
+        }
+
+        if (!reader.ok)
+        {
+            break;
+        }
+        ++m_journalRecords;
+        valid += c_recordHeaderSize + length;
+    }
+    return valid;
+}
+
+// The controls UI numbers new tabs upwards, and the records of a tab mostly
+// follow the one creating it
+std::vector<SessionTab>::iterator SessionJournal::Find(size_t tabId)
+{
+    if (tabId > m_maxTabId)
+    {
+        return m_tabs.end();
+    }
+    for (auto it = m_tabs.end(); it != m_tabs.begin();)
+    {
+        if ((--it)->tabId == tabId)
+        {
+            return it;
+        }
+    }
+    return m_tabs.end();
+}
+
+std::vector<SessionTab>::const_iterator SessionJournal::Find(size_t tabId) const
+{
+    return const_cast<SessionJournal*>(this)->Find(tabId);
+}
+
+// Queues the record in m_buffer, or a snapshot instead of it once the
+// journal is mostly obsolete
+void SessionJournal::Queue()
+{
+    EndRecord(m_buffer);
+    ++m_journalRecords;
+    ++m_statistics.records;
+    {
+        std::lock_guard<std::mutex> lock(m_writer->mutex);
+        if (m_journalRecords > m_tabs.size() + 1 + c_compactSlack)
+        {
+            // The snapshot covers everything which is still pending
+            m_writer->pending.clear();
+            Compact();
+        }
+        else
+        {
+            m_writer->pending.append(m_buffer);
+        }
+    }
+
+    if (!m_writeScheduled)
+    {
+        m_writeScheduled = true;
+        m_scheduleWrite();
+    }
+}
+
+// Queues a journal with one record per tab and the active tab, which
+// replaces the file. Called with the writer locked.
+void SessionJournal::Compact()
+{
+    std::string& snapshot = m_writer->snapshot;
+    snapshot.assign(s_journalHeader, sizeof(s_journalHeader));
+    for (const SessionTab& tab : m_tabs)
+    {
+        BeginRecord(m_buffer, c_recordCreate, tab.tabId);
+        PutString(m_buffer, tab.uri);
+        PutString(m_buffer, tab.title);
+        EndRecord(m_buffer);
+        snapshot.append(m_buffer);
+    }
+    m_journalRecords = m_tabs.size();
+    if (!m_tabs.empty())
+    {
+        BeginRecord(m_buffer, c_recordSwitch, GetActiveTabId());
+        EndRecord(m_buffer);
+        snapshot.append(m_buffer);
+        ++m_journalRecords;
+    }
+    ++m_statistics.compactions;
+}
+
+// Called with the writer locked
+HRESULT SessionJournal::Writer::Write()
+{
+    if (!snapshot.empty())
+    {
+        // Write the new journal next to the old one and swap them, so that a
+        // crash leaves one of the two intact
+        std::wstring const temporaryPath = path + L".tmp";
+        {
+            wil::unique_hfile temporaryFile(CreateFileW(temporaryPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+            if (!temporaryFile)
+            {
+                RETURN_LAST_ERROR();
+            }
+            DWORD written = 0;
+            RETURN_IF_WIN32_BOOL_FALSE(WriteFile(temporaryFile.get(), snapshot.data(), static_cast<DWORD>(snapshot.size()), &written, nullptr));
+            if (written != snapshot.size())
+            {
+                return E_FAIL;
+            }
+            RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(temporaryFile.get()));
+        }
+
+        file.reset();
+        RETURN_IF_WIN32_BOOL_FALSE(MoveFileExW(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING));
+        file.reset(CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file)
+        {
+            RETURN_LAST_ERROR();
+        }
+        LARGE_INTEGER end = {};
+        RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(file.get(), end, nullptr, FILE_END));
+
+        ++writes;
+        bytesWritten += snapshot.size();
+        snapshot.clear();
+    }
+
+    if (pending.empty())
+    {
+        return S_OK;
+    }
+    if (!file)
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    DWORD written = 0;
+    RETURN_IF_WIN32_BOOL_FALSE(WriteFile(file.get(), pending.data(), static_cast<DWORD>(pending.size()), &written, nullptr));
+    if (written != pending.size())
+    {
+        return E_FAIL;
+    }
+    ++writes;
+    bytesWritten += pending.size();
+    pending.clear();
+    return S_OK;
+}
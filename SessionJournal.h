@@ -0,0 +1,93 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+#include "Messages.h"
+
+// The open tabs, kept between runs. Every change is appended to a journal
+// file, which is read back through a file mapping on startup and rewritten
+// as a snapshot of the tabs once most of it is obsolete.
+//
+// Changes are recorded on the UI thread and only queued. The owner is told
+// when the first change is queued after a write, and runs the task from
+// TakeWrite() on any thread, so the changes of a busy period are written in
+// one go. Every record carries a checksum, a record which was only partially
+// written when the process ended is dropped on the next Open().
+class SessionJournal
+{
+public:
+    struct Statistics
+    {
+        ULONGLONG records = 0;       // Queued since Open()
+        ULONGLONG writes = 0;        // Batches written
+        ULONGLONG bytesWritten = 0;
+        ULONGLONG compactions = 0;
+        ULONGLONG droppedBytes = 0;  // Unreadable tail found by Open()
+    };
+
+    // Compact once the journal holds this many more records than a
+    // snapshot would
+    static const size_t c_compactSlack = 256;
+
+    explicit SessionJournal(std::function<void()> scheduleWrite);
+    ~SessionJournal();
+
+    // Restores the tabs of the previous run, or starts an empty journal
+    HRESULT Open(LPCWSTR path);
+
+    // Changes which don't change anything aren't recorded
+    void Create(size_t tabId, const std::wstring& uri);
+    void Close(size_t tabId);
+    void Switch(size_t tabId);
+    void SetUri(size_t tabId, const std::wstring& uri);
+    void SetTitle(size_t tabId, const std::wstring& title);
+
+    // In the order the tabs were created
+    const std::vector<SessionTab>& GetTabs() const { return m_tabs; }
+    // The last tab if the active one was closed
+    size_t GetActiveTabId() const;
+
+    // Writes the changes queued so far, safe to run on any thread and after
+    // the journal is gone
+    std::function<HRESULT()> TakeWrite();
+    // Writes the queued changes on this thread, e.g. when the window closes
+    HRESULT Flush();
+
+    Statistics GetStatistics() const;
+
+private:
+    // Shared with the write tasks
+    struct Writer
+    {
+        std::mutex mutex;
+        std::wstring path;
+        wil::unique_hfile file;
+        std::string pending;   // Records to append
+        std::string snapshot;  // Replaces the whole journal when not empty
+        ULONGLONG writes = 0;
+        ULONGLONG bytesWritten = 0;
+
+        HRESULT Write();
+    };
+
+    std::function<void()> m_scheduleWrite;
+    std::shared_ptr<Writer> m_writer;
+    bool m_writeScheduled = false;
+
+    std::vector<SessionTab> m_tabs;
+    size_t m_activeTabId = INVALID_TAB_ID;
+    size_t m_maxTabId = INVALID_TAB_ID;  // No tab has a larger id
+
+    std::string m_buffer;  // Record being encoded
+    size_t m_journalRecords = 0;  // In the journal and queued
+    Statistics m_statistics;
+
+    size_t Replay(const BYTE* data, size_t size);
+    std::vector<SessionTab>::iterator Find(size_t tabId);
+    std::vector<SessionTab>::const_iterator Find(size_t tabId) const;
+    void Queue();
+    void Compact();
+};
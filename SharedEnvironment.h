@@ -0,0 +1,79 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// A WebView2 environment the browser windows share. Only the first window
+// which asks creates it, the windows asking meanwhile wait for the same
+// creation and are all called back once it completes, in the order they
+// asked. A failed creation is tried again by the next window which asks.
+//
+// The environment is only created through the factory, this knows nothing
+// about WebView2.
+template<typename Environment>
+class SharedEnvironment
+{
+public:
+    typedef std::function<void(HRESULT, const Environment&)> Completion;
+    // Starts the creation and calls completed once it is done, or returns
+    // the error it couldn't be started with
+    typedef std::function<HRESULT(Completion completed)> Factory;
+
+    // create is called before this returns, done right away if the
+    // environment exists. done isn't called if create fails.
+    HRESULT Get(const Factory& create, Completion done)
+    {
+        if (m_created)
+        {
+            done(S_OK, m_env);
+            return S_OK;
+        }
+
+        m_waiters.push_back(std::move(done));
+        if (m_creating)
+        {
+            return S_OK;
+        }
+
+        m_creating = true;
+        HRESULT const hr = create([this](HRESULT result, const Environment& env) { Complete(result, env); });
+        if (FAILED(hr))
+        {
+            // Only the caller was waiting, it gets the error from the return
+            m_creating = false;
+            m_waiters.clear();
+        }
+        return hr;
+    }
+
+    bool IsCreated() const { return m_created; }
+    size_t GetWaitingCount() const { return m_waiters.size(); }
+
+private:
+    Environment m_env{};
+    bool m_created = false;
+    bool m_creating = false;
+    std::vector<Completion> m_waiters;
+
+    void Complete(HRESULT result, const Environment& env)
+    {
+        m_creating = false;
+        if (SUCCEEDED(result))
+        {
+            m_env = env;
+            m_created = true;
+        }
+
+        // A waiter may ask again, it then finds the environment or starts a
+        // new creation
+        std::vector<Completion> waiters;
+        waiters.swap(m_waiters);
+        for (const Completion& waiter : waiters)
+        {
+            waiter(result, env);
+        }
+    }
+};
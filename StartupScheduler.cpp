@@ -0,0 +1,188 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "StartupScheduler.h"
+#include "Trace.h"
+
+StartupScheduler::StartupScheduler(std::function<ULONGLONG()> getTime) :
+    m_getTime(std::move(getTime))
+{
+    m_origin = m_getTime();
+}
+
+StartupScheduler::Stage StartupScheduler::Add(LPCWSTR name, std::initializer_list<Stage> dependencies, std::function<HRESULT()> run)
+{
+    return AddStage(name, dependencies, std::move(run), false, false);
+}
+
+StartupScheduler::Stage StartupScheduler::AddAsync(LPCWSTR name, std::initializer_list<Stage> dependencies,
+    std::function<HRESULT()> start, bool onDemand)
+{
+    return AddStage(name, dependencies, std::move(start), true, onDemand);
+}
+
+// Dependencies have to be added first, so the stages can't form a cycle
+StartupScheduler::Stage StartupScheduler::AddStage(LPCWSTR name, std::initializer_list<Stage> dependencies,
+    std::function<HRESULT()> start, bool async, bool onDemand)
+{
+    Stage const stage = m_stages.size();
+
+    Entry entry;
+    entry.record.name = name;
+    entry.start = std::move(start);
+    entry.async = async;
+    entry.pending = 0;
+    entry.onDemand = onDemand;
+    entry.requested = false;
+
+    HRESULT failure = S_OK;
+    for (Stage dependency : dependencies)
+    {
+        const Record& record = m_stages.at(dependency).record;
+        if (record.state == StageState::Failed)
+        {
+            failure = record.result;
+        }
+        else if (record.state != StageState::Done)
+        {
+            ++entry.pending;
+            m_stages[dependency].dependents.push_back(stage);
+        }
+    }
+    m_stages.push_back(std::move(entry));
+
+    if (FAILED(failure))
+    {
+        Settle(stage, failure);
+    }
+    else
+    {
+        TryStart(stage);
+    }
+    return stage;
+}
+
+void StartupScheduler::Run()
+{
+    m_running = true;
+    for (Stage stage = 0; stage < m_stages.size(); ++stage)
+    {
+        TryStart(stage);
+    }
+}
+
+void StartupScheduler::Request(Stage stage)
+{
+    m_stages.at(stage).requested = true;
+    TryStart(stage);
+}
+
+void StartupScheduler::Complete(Stage stage, HRESULT result)
+{
+    // Late or repeated reports are ignored
+    if (m_stages.at(stage).record.state == StageState::Running)
+    {
+        Settle(stage, result);
+    }
+}
+
+void StartupScheduler::WhenDone(Stage stage, std::function<void(HRESULT)> f)
+{
+    Entry& entry = m_stages.at(stage);
+    if (entry.record.state == StageState::Done || entry.record.state == StageState::Failed)
+    {
+        f(entry.record.result);
+    }
+    else
+    {
+        entry.waiters.push_back(std::move(f));
+    }
+}
+
+void StartupScheduler::TryStart(Stage stage)
+{
+    Entry& entry = m_stages[stage];
+    if (!m_running || entry.record.state != StageState::Waiting || entry.pending != 0 ||
+        (entry.onDemand && !entry.requested))
+    {
+        return;
+    }
+
+    entry.record.state = StageState::Running;
+    entry.record.start = GetTime();
+    entry.record.started = true;
+    TRACE_ASYNC_BEGIN(entry.record.name, stage);
+    if (!entry.start)
+    {
+        Settle(stage, S_OK);
+        return;
+    }
+
+    // m_stages may grow while the stage starts, don't keep the reference
+    HRESULT hr = m_stages[stage].start();
+    if (FAILED(hr) || !m_stages[stage].async)
+    {
+        Complete(stage, hr);
+    }
+}
+
+// Stages waiting for a failed stage fail along with it, without starting
+void StartupScheduler::Settle(Stage stage, HRESULT result)
+{
+    Record& record = m_stages[stage].record;
+    record.state = SUCCEEDED(result) ? StageState::Done : StageState::Failed;
+    record.result = result;
+    record.done = GetTime();
+    if (record.started)
+    {
+        TRACE_ASYNC_END(record.name, stage);
+    }
+    Log(stage);
+
+    std::vector<std::function<void(HRESULT)>> waiters;
+    waiters.swap(m_stages[stage].waiters);
+    for (const auto& waiter : waiters)
+    {
+        waiter(result);
+    }
+
+    std::vector<Stage> dependents = m_stages[stage].dependents;
+    for (Stage dependent : dependents)
+    {
+        if (m_stages[dependent].record.state != StageState::Waiting)
+        {
+            continue;
+        }
+
+        if (FAILED(result))
+        {
+            Settle(dependent, result);
+        }
+        else
+        {
+            --m_stages[dependent].pending;
+            TryStart(dependent);
+        }
+    }
+}
+
+void StartupScheduler::Log(Stage stage) const
+{
+    const Record& record = m_stages[stage].record;
+
+    WCHAR line[256];
+    if (!record.started)
+    {
+        StringCchPrintfW(line, _countof(line), L"Startup: %s skipped at %llu.%03llu ms, a dependency failed with 0x%08X\n",
+            record.name, record.done / 1000, record.done % 1000, record.result);
+    }
+    else
+    {
+        ULONGLONG const duration = record.done - record.start;
+        StringCchPrintfW(line, _countof(line), L"Startup: %s %s at %llu.%03llu ms, took %llu.%03llu ms, 0x%08X\n",
+            record.name, record.state == StageState::Done ? L"done" : L"failed",
+            record.done / 1000, record.done % 1000, duration / 1000, duration % 1000, record.result);
+    }
+    OutputDebugString(line);
+}
@@ -0,0 +1,89 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+enum class StageState
+{
+    Waiting,   // Some dependency isn't done yet
+    Running,
+    Done,
+    Failed,    // The stage or one of its dependencies failed
+};
+
+// Runs the startup of the browser as a graph of stages, each of which starts
+// as soon as the stages it depends on are done. Independent stages, like the
+// creation of the two WebView environments, are in flight at the same time.
+// An on-demand stage only starts once it is requested, and its dependencies
+// are done.
+//
+// Knows nothing about WebView2, the start of an asynchronous stage begins its
+// work and Complete() reports the outcome, which may happen before start
+// returns.
+// Every stage is timestamped relative to the creation of the scheduler.
+class StartupScheduler
+{
+public:
+    typedef size_t Stage;
+
+    struct Record
+    {
+        LPCWSTR name;  // A string literal
+        StageState state = StageState::Waiting;
+        HRESULT result = S_OK;
+        ULONGLONG start = 0;  // Microseconds since the scheduler was created
+        bool started = false;
+        ULONGLONG done = 0;
+    };
+
+    // getTime returns microseconds
+    explicit StartupScheduler(std::function<ULONGLONG()> getTime);
+
+    // A stage which is done once run returns, right away without run
+    Stage Add(LPCWSTR name, std::initializer_list<Stage> dependencies, std::function<HRESULT()> run);
+    // A stage whose start only begins the work, its outcome is reported by
+    // Complete()
+    Stage AddAsync(LPCWSTR name, std::initializer_list<Stage> dependencies,
+        std::function<HRESULT()> start, bool onDemand = false);
+
+    // Starts every stage which doesn't wait for anything
+    void Run();
+    void Request(Stage stage);
+    void Complete(Stage stage, HRESULT result);
+
+    // Calls f with the outcome once the stage is done or has failed, right
+    // away if it already is
+    void WhenDone(Stage stage, std::function<void(HRESULT)> f);
+
+    bool IsDone(Stage stage) const { return m_stages[stage].record.state == StageState::Done; }
+    const Record& GetRecord(Stage stage) const { return m_stages[stage].record; }
+    size_t GetCount() const { return m_stages.size(); }
+    ULONGLONG GetTime() const { return m_getTime() - m_origin; }
+
+private:
+    struct Entry
+    {
+        Record record;
+        std::function<HRESULT()> start;
+        bool async;
+        std::vector<Stage> dependents;
+        std::vector<std::function<void(HRESULT)>> waiters;
+        size_t pending;  // Dependencies not done yet
+        bool onDemand;
+        bool requested;
+    };
+
+    std::function<ULONGLONG()> m_getTime;
+    ULONGLONG m_origin;
+    std::vector<Entry> m_stages;
+    bool m_running = false;
+
+    Stage AddStage(LPCWSTR name, std::initializer_list<Stage> dependencies,
+        std::function<HRESULT()> start, bool async, bool onDemand);
+    void TryStart(Stage stage);
+    void Settle(Stage stage, HRESULT result);
+    void Log(Stage stage) const;
+};
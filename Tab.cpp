@@ -3,101 +3,288 @@
 // found in the LICENSE file.
 
 #include "BrowserWindow.h"
+#include "BulkTransfer.h"
+#include "FaviconCache.h"
+#include "PageMetadataTracker.h"
 #include "Tab.h"
 
 using namespace Microsoft::WRL;
 
 LPCWSTR Tab::m_defaultDownloadFolderPath = nullptr;
 COREWEBVIEW2_PREFERRED_COLOR_SCHEME Tab::m_preferredColorScheme = COREWEBVIEW2_PREFERRED_COLOR_SCHEME_AUTO;
+size_t Tab::m_maxConcurrentLoads = 2;
+size_t Tab::m_memoryBudget = 2048;
+size_t Tab::m_maxBatchLoads = 4;
+LPCWSTR Tab::m_loadReportPath = nullptr;
 
-std::unique_ptr<Tab> Tab::CreateNewTab(HWND hWnd, ICoreWebView2Environment* env, size_t id, bool shouldBeActive)
+// Memory of a renderer besides its JavaScript heap
+static const ULONGLONG c_rendererOverhead = 40ULL << 20;
+
+// The window the tab is in, it may have been moved since its handlers were
+// added. None while the window is being destroyed.
+static BrowserWindow* GetBrowserWindow(HWND hWnd)
+{
+    return reinterpret_cast<BrowserWindow*>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
+}
+
+// The tab starts without a controller, see TabLoader
+std::unique_ptr<Tab> Tab::CreateNewTab(HWND hWnd, size_t id, const std::wstring& uri)
 {
     std::unique_ptr<Tab> tab = std::make_unique<Tab>();
 
     tab->m_parentHWnd = hWnd;
     tab->m_tabId = id;
+    tab->m_uri = uri;
     tab->SetMessageBroker();
-    tab->Init(env, shouldBeActive);
 
     return tab;
 }
 
-HRESULT Tab::Init(ICoreWebView2Environment* env, bool shouldBeActive)
+HRESULT Tab::Init(ICoreWebView2Environment* env)
 {
+    TRACE_SPAN(L"Tab::Init", m_tabId);
+
+    // The tab can be closed before the controller arrives, so the window
+    // looks it up again rather than the callback holding on to it
+    HWND hWnd = m_parentHWnd;
+    size_t tabId = m_tabId;
     return env->CreateCoreWebView2Controller(m_parentHWnd, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
-        [this, shouldBeActive](HRESULT result, ICoreWebView2Controller* host) -> HRESULT {
-        if (!SUCCEEDED(result))
+        [hWnd, tabId](HRESULT result, ICoreWebView2Controller* host) -> HRESULT {
+        BrowserWindow* browserWindow = GetBrowserWindow(hWnd);
+        if (!browserWindow)
         {
-            OutputDebugString(L"Tab WebView creation failed\n");
-            return result;
+            return S_OK;
         }
-        m_contentController = host;
-        BrowserWindow::CheckFailure(m_contentController->get_CoreWebView2(&m_contentWebView), L"");
-        BrowserWindow* browserWindow = reinterpret_cast<BrowserWindow*>(GetWindowLongPtr(m_parentHWnd, GWLP_USERDATA));
-        RETURN_IF_FAILED(m_contentWebView->add_WebMessageReceived(m_messageBroker.Get(), &m_messageBrokerToken));
+        return browserWindow->HandleTabCreated(tabId, result, host);
+    }).Get());
+}
 
-        // Register event handler for history change
-        RETURN_IF_FAILED(m_contentWebView->add_HistoryChanged(Callback<ICoreWebView2HistoryChangedEventHandler>(
-            [this, browserWindow](ICoreWebView2* webview, IUnknown* args) -> HRESULT
-        {
-            BrowserWindow::CheckFailure(browserWindow->HandleTabHistoryUpdate(m_tabId, webview), L"Can't update go back/forward buttons.");
+HRESULT Tab::Attach(ICoreWebView2Controller* host)
+{
+    // A tab which fails to attach is left without a controller, it can be
+    // loaded again
+    auto detach = wil::scope_exit([this]
+    {
+        m_contentController->Close();
+        m_securityStateChangedReceiver = nullptr;
+        m_contentWebView = nullptr;
+        m_contentController = nullptr;
+    });
+    m_contentController = host;
+    BrowserWindow::CheckFailure(m_contentController->get_CoreWebView2(&m_contentWebView), L"");
+    RETURN_IF_FAILED(m_contentWebView->add_WebMessageReceived(m_messageBroker.Get(), &m_messageBrokerToken));
 
+    // Register event handler for history change
+    RETURN_IF_FAILED(m_contentWebView->add_HistoryChanged(Callback<ICoreWebView2HistoryChangedEventHandler>(
+        [this](ICoreWebView2* webview, IUnknown* args) -> HRESULT
+    {
+        BrowserWindow* browserWindow = GetBrowserWindow(m_parentHWnd);
+        if (!browserWindow)
+        {
             return S_OK;
-        }).Get(), &m_historyUpdateForwarderToken));
+        }
+        BrowserWindow::CheckFailure(browserWindow->HandleTabURIUpdate(m_tabId, webview), L"Can't update go back/forward buttons.");
 
-        // Register event handler for source change
-        RETURN_IF_FAILED(m_contentWebView->add_SourceChanged(Callback<ICoreWebView2SourceChangedEventHandler>(
-            [this, browserWindow](ICoreWebView2* webview, ICoreWebView2SourceChangedEventArgs* args) -> HRESULT
-        {
-            BrowserWindow::CheckFailure(browserWindow->HandleTabURIUpdate(m_tabId, webview), L"Can't update address bar");
+        return S_OK;
+    }).Get(), &m_historyUpdateForwarderToken));
 
+    // Register event handler for source change
+    RETURN_IF_FAILED(m_contentWebView->add_SourceChanged(Callback<ICoreWebView2SourceChangedEventHandler>(
+        [this](ICoreWebView2* webview, ICoreWebView2SourceChangedEventArgs* args) -> HRESULT
+    {
+        BrowserWindow* browserWindow = GetBrowserWindow(m_parentHWnd);
+        if (!browserWindow)
+        {
             return S_OK;
-        }).Get(), &m_uriUpdateForwarderToken));
+        }
+        BrowserWindow::CheckFailure(browserWindow->HandleTabURIUpdate(m_tabId, webview), L"Can't update address bar");
 
-        RETURN_IF_FAILED(m_contentWebView->add_NavigationStarting(Callback<ICoreWebView2NavigationStartingEventHandler>(
-            [this, browserWindow](ICoreWebView2* webview, ICoreWebView2NavigationStartingEventArgs* args) -> HRESULT
-        {
-            BrowserWindow::CheckFailure(browserWindow->HandleTabNavStarting(m_tabId, webview), L"Can't update reload button");
+        return S_OK;
+    }).Get(), &m_uriUpdateForwarderToken));
 
+    RETURN_IF_FAILED(m_contentWebView->add_NavigationStarting(Callback<ICoreWebView2NavigationStartingEventHandler>(
+        [this](ICoreWebView2* webview, ICoreWebView2NavigationStartingEventArgs* args) -> HRESULT
+    {
+        BrowserWindow* browserWindow = GetBrowserWindow(m_parentHWnd);
+        if (!browserWindow)
+        {
             return S_OK;
-        }).Get(), &m_navStartingToken));
+        }
+        BrowserWindow::CheckFailure(browserWindow->HandleTabNavStarting(m_tabId, webview, args), L"Can't update reload button");
+
+        return S_OK;
+    }).Get(), &m_navStartingToken));
 
-        RETURN_IF_FAILED(m_contentWebView->add_NavigationCompleted(Callback<ICoreWebView2NavigationCompletedEventHandler>(
-            [this, browserWindow](ICoreWebView2* webview, ICoreWebView2NavigationCompletedEventArgs* args) -> HRESULT
+    RETURN_IF_FAILED(m_contentWebView->add_NavigationCompleted(Callback<ICoreWebView2NavigationCompletedEventHandler>(
+        [this](ICoreWebView2* webview, ICoreWebView2NavigationCompletedEventArgs* args) -> HRESULT
+    {
+        BrowserWindow* browserWindow = GetBrowserWindow(m_parentHWnd);
+        if (!browserWindow)
         {
-            BrowserWindow::CheckFailure(browserWindow->HandleTabNavCompleted(m_tabId, webview, args), L"Can't udpate reload button");
             return S_OK;
-        }).Get(), &m_navCompletedToken));
+        }
+        BrowserWindow::CheckFailure(browserWindow->HandleTabNavCompleted(m_tabId, webview, args), L"Can't udpate reload button");
+        return S_OK;
+    }).Get(), &m_navCompletedToken));
 
-        // Enable listening for security events to update secure icon
-        RETURN_IF_FAILED(m_contentWebView->CallDevToolsProtocolMethod(L"Security.enable", L"{}", nullptr));
+    // Enable listening for security events to update secure icon
+    RETURN_IF_FAILED(m_contentWebView->CallDevToolsProtocolMethod(L"Security.enable", L"{}", nullptr));
 
-        BrowserWindow::CheckFailure(m_contentWebView->GetDevToolsProtocolEventReceiver(L"Security.visibleSecurityStateChanged", &m_securityStateChangedReceiver), L"");
+    BrowserWindow::CheckFailure(m_contentWebView->GetDevToolsProtocolEventReceiver(L"Security.visibleSecurityStateChanged", &m_securityStateChangedReceiver), L"");
 
-        // Forward security status updates to browser
-        RETURN_IF_FAILED(m_securityStateChangedReceiver->add_DevToolsProtocolEventReceived(Callback<ICoreWebView2DevToolsProtocolEventReceivedEventHandler>(
-            [this, browserWindow](ICoreWebView2* webview, ICoreWebView2DevToolsProtocolEventReceivedEventArgs* args) -> HRESULT
+    // Forward security status updates to browser
+    RETURN_IF_FAILED(m_securityStateChangedReceiver->add_DevToolsProtocolEventReceived(Callback<ICoreWebView2DevToolsProtocolEventReceivedEventHandler>(
+        [this](ICoreWebView2* webview, ICoreWebView2DevToolsProtocolEventReceivedEventArgs* args) -> HRESULT
+    {
+        BrowserWindow* browserWindow = GetBrowserWindow(m_parentHWnd);
+        if (!browserWindow)
         {
-            BrowserWindow::CheckFailure(browserWindow->HandleTabSecurityUpdate(m_tabId, webview, args), L"Can't udpate security icon");
             return S_OK;
-        }).Get(), &m_securityUpdateToken));
+        }
+        BrowserWindow::CheckFailure(browserWindow->HandleTabSecurityUpdate(m_tabId, webview, args), L"Can't udpate security icon");
+        return S_OK;
+    }).Get(), &m_securityUpdateToken));
 
-        Microsoft::WRL::ComPtr<ICoreWebView2_13> contentWebView13;
-        if (SUCCEEDED(m_contentWebView.CopyTo(contentWebView13.GetAddressOf())))
+    Microsoft::WRL::ComPtr<ICoreWebView2_13> contentWebView13;
+    if (SUCCEEDED(m_contentWebView.CopyTo(contentWebView13.GetAddressOf())))
+    {
+        Microsoft::WRL::ComPtr<ICoreWebView2Profile> profile;
+        if (SUCCEEDED(contentWebView13->get_Profile(&profile)))
         {
-            Microsoft::WRL::ComPtr<ICoreWebView2Profile> profile;
-            if (SUCCEEDED(contentWebView13->get_Profile(&profile)))
+            if (m_defaultDownloadFolderPath)
             {
-                if (m_defaultDownloadFolderPath)
-                {
-                    profile->put_DefaultDownloadFolderPath(m_defaultDownloadFolderPath);
-                }
-                profile->put_PreferredColorScheme(m_preferredColorScheme);
+                profile->put_DefaultDownloadFolderPath(m_defaultDownloadFolderPath);
             }
+            profile->put_PreferredColorScheme(m_preferredColorScheme);
+        }
+    }
+
+    // Browser pages show the favicons from the cache, and fetch large lists
+    // from BulkTransfer
+    std::wstring faviconFilter = std::wstring(FaviconCache::c_uriPrefix) + L"*";
+    RETURN_IF_FAILED(m_contentWebView->AddWebResourceRequestedFilter(faviconFilter.c_str(), COREWEBVIEW2_WEB_RESOURCE_CONTEXT_IMAGE));
+    std::wstring bulkFilter = std::wstring(BulkTransfer::c_uriPrefix) + L"*";
+    RETURN_IF_FAILED(m_contentWebView->AddWebResourceRequestedFilter(bulkFilter.c_str(), COREWEBVIEW2_WEB_RESOURCE_CONTEXT_FETCH));
+    RETURN_IF_FAILED(m_contentWebView->add_WebResourceRequested(Callback<ICoreWebView2WebResourceRequestedEventHandler>(
+        [this](ICoreWebView2* webview, ICoreWebView2WebResourceRequestedEventArgs* args) -> HRESULT
+    {
+        BrowserWindow* browserWindow = GetBrowserWindow(m_parentHWnd);
+        if (!browserWindow)
+        {
+            return S_OK;
         }
+        BrowserWindow::CheckFailure(browserWindow->HandleTabWebResourceRequested(m_tabId, webview, args), L"Can't serve a browser page resource.");
+        return S_OK;
+    }).Get(), &m_webResourceRequestedToken));
+
+    // Tabs playing audio stay loaded in the background
+    Microsoft::WRL::ComPtr<ICoreWebView2_8> contentWebView8;
+    if (SUCCEEDED(m_contentWebView.CopyTo(contentWebView8.GetAddressOf())))
+    {
+        RETURN_IF_FAILED(contentWebView8->add_IsDocumentPlayingAudioChanged(Callback<ICoreWebView2IsDocumentPlayingAudioChangedEventHandler>(
+            [this](ICoreWebView2* webview, IUnknown* args) -> HRESULT
+        {
+            BrowserWindow* browserWindow = GetBrowserWindow(m_parentHWnd);
+            if (!browserWindow)
+            {
+                return S_OK;
+            }
+            BrowserWindow::CheckFailure(browserWindow->HandleTabAudioChanged(m_tabId, webview), L"");
+            return S_OK;
+        }).Get(), &m_audioChangedToken));
+    }
+
+    // Reports title, favicon and the like, see PageMetadataTracker
+    RETURN_IF_FAILED(m_contentWebView->AddScriptToExecuteOnDocumentCreated(PageMetadataTracker::GetScript(), nullptr));
+
+    if (!m_uri.empty())
+    {
+        RETURN_IF_FAILED(m_contentWebView->Navigate(m_uri.c_str()));
+    }
+
+    detach.release();
+    return S_OK;
+}
+
+HRESULT Tab::MoveToWindow(HWND hWnd)
+{
+    m_parentHWnd = hWnd;
+    if (!m_contentController)
+    {
+        return S_OK;
+    }
+    return m_contentController->put_ParentWindow(hWnd);
+}
+
+void Tab::Close()
+{
+    if (m_contentController)
+    {
+        m_contentController->Close();
+    }
+}
 
-        browserWindow->HandleTabCreated(m_tabId, shouldBeActive);
+HRESULT Tab::TrySuspend(std::function<void(bool)> done)
+{
+    Microsoft::WRL::ComPtr<ICoreWebView2_3> contentWebView3;
+    if (!m_contentWebView || FAILED(m_contentWebView.CopyTo(contentWebView3.GetAddressOf())))
+    {
+        done(false);
+        return S_OK;
+    }
 
+    HRESULT hr = contentWebView3->TrySuspend(Callback<ICoreWebView2TrySuspendCompletedHandler>(
+        [done](HRESULT errorCode, BOOL isSuccessful) -> HRESULT
+    {
+        done(SUCCEEDED(errorCode) && isSuccessful);
+        return S_OK;
+    }).Get());
+    if (FAILED(hr))
+    {
+        done(false);
+    }
+    return hr;
+}
+
+void Tab::Discard()
+{
+    if (!m_contentController)
+    {
+        return;
+    }
+
+    // The title and favicon stay with the controls UI, the back and forward
+    // list can't be restored
+    wil::unique_cotaskmem_string source;
+    if (SUCCEEDED(m_contentWebView->get_Source(&source)))
+    {
+        m_uri = source.get();
+    }
+
+    m_contentController->Close();
+    m_filtersRequests = false;
+    m_cachesResponses = false;
+    m_observesResponses = false;
+    m_securityStateChangedReceiver = nullptr;
+    m_contentWebView = nullptr;
+    m_contentController = nullptr;
+}
+
+HRESULT Tab::GetMemoryEstimate(std::function<void(ULONGLONG)> done)
+{
+    if (!m_contentWebView)
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    return m_contentWebView->CallDevToolsProtocolMethod(L"Runtime.getHeapUsage", L"{}", Callback<ICoreWebView2CallDevToolsProtocolMethodCompletedHandler>(
+        [done](HRESULT errorCode, LPCWSTR returnObjectAsJson) -> HRESULT
+    {
+        HeapUsageResult usage;
+        if (SUCCEEDED(errorCode) && SUCCEEDED(MessageReader::ReadObject(returnObjectAsJson, usage)))
+        {
+            done(c_rendererOverhead + usage.totalSize);
+        }
         return S_OK;
     }).Get());
 }
@@ -107,7 +294,11 @@ void Tab::SetMessageBroker()
     m_messageBroker = Callback<ICoreWebView2WebMessageReceivedEventHandler>(
         [this](ICoreWebView2* webview, ICoreWebView2WebMessageReceivedEventArgs* eventArgs) -> HRESULT
     {
-        BrowserWindow* browserWindow = reinterpret_cast<BrowserWindow*>(GetWindowLongPtr(m_parentHWnd, GWLP_USERDATA));
+        BrowserWindow* browserWindow = GetBrowserWindow(m_parentHWnd);
+        if (!browserWindow)
+        {
+            return S_OK;
+        }
         BrowserWindow::CheckFailure(browserWindow->HandleTabMessageReceived(m_tabId, webview, eventArgs), L"");
 
         return S_OK;
@@ -116,6 +307,12 @@ void Tab::SetMessageBroker()
 
 HRESULT Tab::ResizeWebView()
 {
+    // Sized when it's shown, once it has a controller
+    if (!m_contentController)
+    {
+        return S_OK;
+    }
+
     RECT bounds;
     GetClientRect(m_parentHWnd, &bounds);
 
@@ -124,3 +321,137 @@ HRESULT Tab::ResizeWebView()
 
     return m_contentController->put_Bounds(bounds);
 }
+
+HRESULT Tab::FilterRequests()
+{
+    if (m_filtersRequests || !m_contentWebView)
+    {
+        return S_OK;
+    }
+
+    RETURN_IF_FAILED(m_contentWebView->AddWebResourceRequestedFilter(L"*", COREWEBVIEW2_WEB_RESOURCE_CONTEXT_ALL));
+    m_filtersRequests = true;
+    return S_OK;
+}
+
+HRESULT Tab::CacheResponses(const std::vector<std::wstring>& origins)
+{
+    if (m_cachesResponses || !m_contentWebView)
+    {
+        return S_OK;
+    }
+
+    for (const std::wstring& origin : origins)
+    {
+        std::wstring const filter = origin + L"/*";
+        RETURN_IF_FAILED(m_contentWebView->AddWebResourceRequestedFilter(filter.c_str(), COREWEBVIEW2_WEB_RESOURCE_CONTEXT_ALL));
+    }
+    RETURN_IF_FAILED(ObserveResponses());
+    m_cachesResponses = true;
+    return S_OK;
+}
+
+HRESULT Tab::LoadFavicon(const std::wstring& uri)
+{
+    if (!m_contentWebView)
+    {
+        return E_NOT_VALID_STATE;
+    }
+    RETURN_IF_FAILED(ObserveResponses());
+
+    // The URI goes in escaped, whatever the page made it. The response is
+    // opaque to the page, the host reads it.
+    std::wstring script = L"fetch('";
+    for (wchar_t c : uri)
+    {
+        if ((c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z') || (c >= L'0' && c <= L'9') || wcschr(L":/.-_~?=&%#+", c))
+        {
+            script += c;
+        }
+        else
+        {
+            WCHAR escape[8];
+            StringCchPrintfW(escape, _countof(escape), L"\\u%04x", static_cast<unsigned int>(c));
+            script += escape;
+        }
+    }
+    script += L"', { mode: 'no-cors', credentials: 'include', cache: 'force-cache' }).catch(() => {});";
+    return m_contentWebView->ExecuteScript(script.c_str(), Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
+        [](HRESULT, LPCWSTR) -> HRESULT
+    {
+        return S_OK;
+    }).Get());
+}
+
+// Once for everything which wants the responses of the tab
+HRESULT Tab::ObserveResponses()
+{
+    if (m_observesResponses)
+    {
+        return S_OK;
+    }
+
+    ComPtr<ICoreWebView2_2> webview2;
+    RETURN_IF_FAILED(m_contentWebView.As(&webview2));
+    RETURN_IF_FAILED(webview2->add_WebResourceResponseReceived(Callback<ICoreWebView2WebResourceResponseReceivedEventHandler>(
+        [this](ICoreWebView2* webview, ICoreWebView2WebResourceResponseReceivedEventArgs* args) -> HRESULT
+    {
+        BrowserWindow* browserWindow = GetBrowserWindow(m_parentHWnd);
+        if (!browserWindow)
+        {
+            return S_OK;
+        }
+        BrowserWindow::CheckFailure(browserWindow->HandleTabWebResourceResponseReceived(m_tabId, args), L"Can't read a response.");
+        return S_OK;
+    }).Get(), &m_webResourceResponseReceivedToken));
+    m_observesResponses = true;
+    return S_OK;
+}
+
+void TabControllerFactory::Initialize(HWND hWnd, ICoreWebView2Environment* env)
+{
+    m_hWnd = hWnd;
+    m_env = env;
+}
+
+HRESULT TabControllerFactory::Create(std::function<void(HRESULT, const ComPtr<ICoreWebView2Controller>&)> done)
+{
+    if (!m_env)
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    HWND hWnd = m_hWnd;
+    return m_env->CreateCoreWebView2Controller(m_hWnd, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+        [hWnd, done](HRESULT result, ICoreWebView2Controller* host) -> HRESULT
+    {
+        ComPtr<ICoreWebView2Controller> controller = host;
+
+        // The pool went away with the window
+        if (!GetWindowLongPtr(hWnd, GWLP_USERDATA))
+        {
+            if (controller)
+            {
+                controller->Close();
+            }
+            return S_OK;
+        }
+
+        if (SUCCEEDED(result))
+        {
+            result = controller->put_IsVisible(FALSE);
+        }
+        done(result, controller);
+        return S_OK;
+    }).Get());
+}
+
+void TabControllerFactory::Destroy(const ComPtr<ICoreWebView2Controller>& controller)
+{
+    controller->Close();
+}
+
+ULONGLONG TabControllerFactory::GetTime()
+{
+    return GetTickCount64();
+}
@@ -5,19 +5,50 @@
 #pragma once
 
 #include "framework.h"
+#include "ControllerPool.h"
+
+typedef ControllerPool<Microsoft::WRL::ComPtr<ICoreWebView2Controller>> TabControllerPool;
 
 class Tab
 {
 public:
     static LPCWSTR m_defaultDownloadFolderPath;
     static COREWEBVIEW2_PREFERRED_COLOR_SCHEME m_preferredColorScheme;
+    static size_t m_maxConcurrentLoads;  // Controllers created at the same time
+    static size_t m_memoryBudget;        // MB for all tabs with a controller
+    static size_t m_maxBatchLoads;       // Tabs from lists of URIs loading at the same time
+    static LPCWSTR m_loadReportPath;     // Where the load times of those tabs are appended
 
     Microsoft::WRL::ComPtr<ICoreWebView2Controller> m_contentController;
     Microsoft::WRL::ComPtr<ICoreWebView2> m_contentWebView;
     Microsoft::WRL::ComPtr<ICoreWebView2DevToolsProtocolEventReceiver> m_securityStateChangedReceiver;
+    int m_historyItemId = INVALID_HISTORY_ID;  // History entry of the page shown
+    std::wstring m_uri;  // Page to load once the controller is created
+    std::wstring m_navigationUri;  // Of the last top level navigation, never blocked
+    size_t m_blockedCount = 0;     // Requests of the current page the filter blocked
 
-    static std::unique_ptr<Tab> CreateNewTab(HWND hWnd, ICoreWebView2Environment* env, size_t id, bool shouldBeActive);
+    static std::unique_ptr<Tab> CreateNewTab(HWND hWnd, size_t id, const std::wstring& uri);
+    HRESULT Init(ICoreWebView2Environment* env);
+    HRESULT Attach(ICoreWebView2Controller* host);
     HRESULT ResizeWebView();
+    // Hands every request of the tab to the request filter, until the
+    // controller is discarded
+    HRESULT FilterRequests();
+    // Hands the requests for the origins to the response cache, and the
+    // responses which arrive for them, until the controller is discarded
+    HRESULT CacheResponses(const std::vector<std::wstring>& origins);
+    // Loads an icon of the page the way the page would, with its cookies and
+    // from its cache, the response goes to HandleTabWebResourceResponseReceived
+    HRESULT LoadFavicon(const std::wstring& uri);
+    // Hands the tab, and its controller if it has one, to another window
+    HRESULT MoveToWindow(HWND hWnd);
+    void Close();
+
+    // Asks the runtime to suspend the hidden WebView, done(false) if it can't
+    HRESULT TrySuspend(std::function<void(bool)> done);
+    // Releases the controller, the current page is loaded again by Attach()
+    void Discard();
+    HRESULT GetMemoryEstimate(std::function<void(ULONGLONG)> done);
 protected:
     HWND m_parentHWnd = nullptr;
     size_t m_tabId = INVALID_TAB_ID;
@@ -26,9 +57,30 @@ protected:
     EventRegistrationToken m_navStartingToken = {};
     EventRegistrationToken m_navCompletedToken = {};
     EventRegistrationToken m_securityUpdateToken = {};
+    EventRegistrationToken m_audioChangedToken = {};
+    EventRegistrationToken m_webResourceRequestedToken = {};
+    EventRegistrationToken m_webResourceResponseReceivedToken = {};
     EventRegistrationToken m_messageBrokerToken = {};  // Message broker for browser pages loaded in a tab
     Microsoft::WRL::ComPtr<ICoreWebView2WebMessageReceivedEventHandler> m_messageBroker;
+    bool m_filtersRequests = false;
+    bool m_cachesResponses = false;
+    bool m_observesResponses = false;
 
-    HRESULT Init(ICoreWebView2Environment* env, bool shouldBeActive);
     void SetMessageBroker();
+    HRESULT ObserveResponses();
+};
+
+// Creates the hidden content controllers of the TabControllerPool
+class TabControllerFactory : public TabControllerPool::Factory
+{
+public:
+    void Initialize(HWND hWnd, ICoreWebView2Environment* env);
+
+    HRESULT Create(std::function<void(HRESULT, const Microsoft::WRL::ComPtr<ICoreWebView2Controller>&)> done) override;
+    void Destroy(const Microsoft::WRL::ComPtr<ICoreWebView2Controller>& controller) override;
+    ULONGLONG GetTime() override;
+
+private:
+    HWND m_hWnd = nullptr;
+    Microsoft::WRL::ComPtr<ICoreWebView2Environment> m_env;
 };
@@ -0,0 +1,155 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "TabEvictionPolicy.h"
+
+// A suspended renderer gives up most of its memory once the system needs it
+static const ULONGLONG c_suspendedShare = 4;
+
+TabEvictionPolicy::TabEvictionPolicy(ULONGLONG budget) :
+    m_budget(budget)
+{
+}
+
+void TabEvictionPolicy::Add(size_t tabId, ULONGLONG now)
+{
+    Entry& entry = m_entries[tabId];
+    entry.estimate = c_defaultEstimate;
+    entry.deactivated = now;
+    entry.foreground = false;
+    entry.audible = false;
+    entry.suspend = SuspendState::None;
+}
+
+void TabEvictionPolicy::Remove(size_t tabId)
+{
+    m_entries.erase(tabId);
+}
+
+void TabEvictionPolicy::Activate(size_t tabId)
+{
+    auto it = m_entries.find(tabId);
+    if (it != m_entries.end())
+    {
+        // Showing a suspended WebView resumes it
+        it->second.foreground = true;
+        if (it->second.suspend != SuspendState::Unsupported)
+        {
+            it->second.suspend = SuspendState::None;
+        }
+    }
+}
+
+void TabEvictionPolicy::Deactivate(size_t tabId, ULONGLONG now)
+{
+    auto it = m_entries.find(tabId);
+    if (it != m_entries.end())
+    {
+        it->second.foreground = false;
+        it->second.deactivated = now;
+    }
+}
+
+void TabEvictionPolicy::SetEstimate(size_t tabId, ULONGLONG bytes)
+{
+    auto it = m_entries.find(tabId);
+    if (it != m_entries.end())
+    {
+        it->second.estimate = bytes;
+    }
+}
+
+void TabEvictionPolicy::SetAudible(size_t tabId, bool audible)
+{
+    auto it = m_entries.find(tabId);
+    if (it != m_entries.end())
+    {
+        it->second.audible = audible;
+    }
+}
+
+void TabEvictionPolicy::Suspended(size_t tabId, bool succeeded)
+{
+    auto it = m_entries.find(tabId);
+    if (it != m_entries.end() && it->second.suspend == SuspendState::Pending)
+    {
+        it->second.suspend = succeeded ? SuspendState::Suspended : SuspendState::Unsupported;
+    }
+}
+
+ULONGLONG TabEvictionPolicy::GetCharge(const Entry& entry)
+{
+    bool const suspended = entry.suspend == SuspendState::Pending || entry.suspend == SuspendState::Suspended;
+    return suspended ? entry.estimate / c_suspendedShare : entry.estimate;
+}
+
+ULONGLONG TabEvictionPolicy::GetTotal() const
+{
+    ULONGLONG total = 0;
+    for (const auto& entry : m_entries)
+    {
+        total += GetCharge(entry.second);
+    }
+    return total;
+}
+
+void TabEvictionPolicy::Evaluate(ULONGLONG now, std::vector<Decision>& decisions)
+{
+    decisions.clear();
+
+    ULONGLONG total = GetTotal();
+    if (total <= m_budget)
+    {
+        return;
+    }
+
+    m_candidates.clear();
+    for (const auto& entry : m_entries)
+    {
+        const Entry& tab = entry.second;
+        if (!tab.foreground && !tab.audible && now - tab.deactivated >= c_gracePeriod)
+        {
+            // Memory in MB times minutes in the background
+            ULONGLONG const rank = ((tab.estimate >> 20) + 1) * ((now - tab.deactivated) / 60000 + 1);
+            m_candidates.push_back(std::make_pair(rank, entry.first));
+        }
+    }
+    std::sort(m_candidates.begin(), m_candidates.end(), std::greater<std::pair<ULONGLONG, size_t>>());
+
+    // Suspend first, it is cheap to undo
+    for (const auto& candidate : m_candidates)
+    {
+        if (total <= m_budget)
+        {
+            return;
+        }
+
+        Entry& tab = m_entries[candidate.second];
+        if (tab.suspend == SuspendState::None)
+        {
+            total -= tab.estimate - tab.estimate / c_suspendedShare;
+            tab.suspend = SuspendState::Pending;
+            decisions.push_back({ candidate.second, Action::Suspend });
+        }
+    }
+
+    for (const auto& candidate : m_candidates)
+    {
+        if (total <= m_budget)
+        {
+            return;
+        }
+
+        // Wait for the outcome of a suspend before discarding the tab
+        auto it = m_entries.find(candidate.second);
+        if (it->second.suspend == SuspendState::Pending)
+        {
+            continue;
+        }
+
+        total -= GetCharge(it->second);
+        m_entries.erase(it);
+        decisions.push_back({ candidate.second, Action::Discard });
+    }
+}
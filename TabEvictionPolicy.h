@@ -0,0 +1,77 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Keeps the memory of the tabs with a controller under a budget. Background
+// tabs are ranked by how long they have been in the background times their
+// estimated memory, the highest ranked are suspended first. A suspended tab
+// is counted with a fraction of its memory. Only when suspending isn't
+// enough, or isn't available, tabs are discarded in the same order. The tab
+// in the foreground, tabs playing audio and tabs in the grace period after
+// they were hidden are left alone.
+//
+// Pure bookkeeping: the caller passes the time, carries out the decisions
+// and reports how they went.
+class TabEvictionPolicy
+{
+public:
+    enum class Action
+    {
+        Suspend,
+        Discard,
+    };
+
+    struct Decision
+    {
+        size_t tabId;
+        Action action;
+    };
+
+    static const ULONGLONG c_defaultEstimate = 100ULL << 20;  // Until the tab is measured
+    static const ULONGLONG c_gracePeriod = 60 * 1000;          // Milliseconds a tab stays untouched in the background
+
+    explicit TabEvictionPolicy(ULONGLONG budget);
+
+    // now is in milliseconds on any monotonic clock
+    void Add(size_t tabId, ULONGLONG now);
+    void Remove(size_t tabId);
+    void Activate(size_t tabId);
+    void Deactivate(size_t tabId, ULONGLONG now);
+    void SetEstimate(size_t tabId, ULONGLONG bytes);
+    void SetAudible(size_t tabId, bool audible);
+    void Suspended(size_t tabId, bool succeeded);
+
+    // Tabs to discard are forgotten, Add() them again once they are reloaded
+    void Evaluate(ULONGLONG now, std::vector<Decision>& decisions);
+
+    ULONGLONG GetBudget() const { return m_budget; }
+    ULONGLONG GetTotal() const;
+
+private:
+    enum class SuspendState
+    {
+        None,
+        Pending,
+        Suspended,
+        Unsupported,  // TrySuspend failed, only discarding helps
+    };
+
+    struct Entry
+    {
+        ULONGLONG estimate;
+        ULONGLONG deactivated;  // When the tab was last in the foreground
+        bool foreground;
+        bool audible;
+        SuspendState suspend;
+    };
+
+    ULONGLONG m_budget;
+    std::unordered_map<size_t, Entry> m_entries;
+    std::vector<std::pair<ULONGLONG, size_t>> m_candidates;
+
+    static ULONGLONG GetCharge(const Entry& entry);
+};
@@ -0,0 +1,143 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "TabLoader.h"
+
+TabLoader::TabLoader(size_t maxInFlight, std::function<HRESULT(size_t tabId)> create) :
+    m_maxInFlight(std::max<size_t>(maxInFlight, 1)), m_create(std::move(create))
+{
+}
+
+void TabLoader::Add(size_t tabId)
+{
+    m_states[tabId] = TabState::Placeholder;
+}
+
+void TabLoader::Adopt(size_t tabId)
+{
+    m_states[tabId] = TabState::Ready;
+}
+
+void TabLoader::Remove(size_t tabId)
+{
+    auto it = m_states.find(tabId);
+    if (it == m_states.end())
+    {
+        return;
+    }
+
+    switch (it->second)
+    {
+    case TabState::Queued:
+        m_queue.erase(std::find(m_queue.begin(), m_queue.end(), tabId));
+        break;
+    case TabState::Creating:
+        // Keeps its slot until the creation completes
+        m_abandoned.insert(tabId);
+        break;
+    default:
+        break;
+    }
+    m_states.erase(it);
+}
+
+HRESULT TabLoader::Load(size_t tabId, bool urgent)
+{
+    auto it = m_states.find(tabId);
+    if (it == m_states.end())
+    {
+        return E_INVALIDARG;
+    }
+
+    switch (it->second)
+    {
+    case TabState::Placeholder:
+        it->second = TabState::Queued;
+        if (urgent)
+        {
+            m_queue.push_front(tabId);
+        }
+        else
+        {
+            m_queue.push_back(tabId);
+        }
+        break;
+    case TabState::Queued:
+        if (urgent && m_queue.front() != tabId)
+        {
+            m_queue.erase(std::find(m_queue.begin(), m_queue.end(), tabId));
+            m_queue.push_front(tabId);
+        }
+        break;
+    default:
+        return S_OK;
+    }
+
+    return Pump();
+}
+
+void TabLoader::Unload(size_t tabId)
+{
+    auto it = m_states.find(tabId);
+    if (it != m_states.end() && it->second == TabState::Ready)
+    {
+        it->second = TabState::Placeholder;
+    }
+}
+
+HRESULT TabLoader::SetPaused(bool paused)
+{
+    m_paused = paused;
+    return Pump();
+}
+
+bool TabLoader::Created(size_t tabId, bool succeeded)
+{
+    bool wanted = false;
+    if (m_abandoned.erase(tabId) == 0)
+    {
+        auto it = m_states.find(tabId);
+        if (it != m_states.end() && it->second == TabState::Creating)
+        {
+            // A failed tab can be loaded again
+            it->second = succeeded ? TabState::Ready : TabState::Placeholder;
+            wanted = succeeded;
+        }
+    }
+
+    if (m_inFlight > 0)
+    {
+        --m_inFlight;
+    }
+    Pump();
+    return wanted;
+}
+
+TabState TabLoader::GetState(size_t tabId) const
+{
+    auto it = m_states.find(tabId);
+    return it == m_states.end() ? TabState::Placeholder : it->second;
+}
+
+HRESULT TabLoader::Pump()
+{
+    HRESULT result = S_OK;
+    while (!m_paused && m_inFlight < m_maxInFlight && !m_queue.empty())
+    {
+        size_t tabId = m_queue.front();
+        m_queue.pop_front();
+
+        m_states[tabId] = TabState::Creating;
+        ++m_inFlight;
+        HRESULT hr = m_create(tabId);
+        if (FAILED(hr))
+        {
+            // Nothing is in flight, the completion won't come
+            --m_inFlight;
+            m_states[tabId] = TabState::Placeholder;
+            result = hr;
+        }
+    }
+    return result;
+}
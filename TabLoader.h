@@ -0,0 +1,62 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+enum class TabState
+{
+    Placeholder,  // No controller, only what the tab is meant to show
+    Queued,       // Waiting for a free creation slot
+    Creating,     // CreateCoreWebView2Controller is in flight
+    Ready,
+};
+
+// Decides when the controllers of tabs are created. A tab starts out as a
+// placeholder and only gets a controller, and a renderer, the first time it
+// is loaded. At most maxInFlight creations run at once, the other tabs wait
+// in line. A tab which is loaded to be shown goes to the front of the line.
+//
+// Knows nothing about WebView2, create is called for a queued tab and
+// Created() reports the outcome, which may happen before create returns.
+class TabLoader
+{
+public:
+    TabLoader(size_t maxInFlight, std::function<HRESULT(size_t tabId)> create);
+
+    void Add(size_t tabId);
+    // A tab which has its controller already, like one moved from another
+    // window
+    void Adopt(size_t tabId);
+    void Remove(size_t tabId);
+    HRESULT Load(size_t tabId, bool urgent);
+    void Unload(size_t tabId);  // The controller of a ready tab was released
+
+    // Loaded tabs are queued, but not created, while the loader is paused
+    HRESULT SetPaused(bool paused);
+
+    // Succeeded means the controller is attached, the tab is Ready from then
+    // on. Returns false if the tab was removed or reloaded meanwhile, the
+    // controller is then not needed anymore.
+    bool Created(size_t tabId, bool succeeded);
+
+    TabState GetState(size_t tabId) const;
+    // The tab was removed while Creating. The next completion for it is that
+    // creation's, even if the tab was added and loaded again meanwhile.
+    bool IsAbandoned(size_t tabId) const { return m_abandoned.count(tabId) != 0; }
+    size_t GetInFlightCount() const { return m_inFlight; }
+    size_t GetQueuedCount() const { return m_queue.size(); }
+
+private:
+    size_t m_maxInFlight;
+    std::function<HRESULT(size_t tabId)> m_create;
+    std::unordered_map<size_t, TabState> m_states;
+    std::deque<size_t> m_queue;
+    std::unordered_set<size_t> m_abandoned;  // Removed while Creating
+    size_t m_inFlight = 0;
+    bool m_paused = false;
+
+    HRESULT Pump();
+};
@@ -0,0 +1,305 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "Trace.h"
+#include "Utf.h"
+
+std::atomic<bool> Trace::s_enabled(false);
+std::wstring Trace::s_path;
+std::wstring Trace::s_summaryPath;
+LONGLONG Trace::s_origin = 0;
+std::mutex Trace::s_buffersLock;
+std::vector<std::unique_ptr<Trace::Buffer>> Trace::s_buffers;
+thread_local Trace::Buffer* Trace::t_buffer = nullptr;
+
+static LONGLONG ToMicroseconds(LONGLONG ticks, LONGLONG frequency)
+{
+    return ticks / frequency * 1000000 + ticks % frequency * 1000000 / frequency;
+}
+
+// Quotes, backslashes and control characters are ASCII, so they can be
+// escaped in UTF-8
+static void AppendJsonString(LPCWSTR value, std::string& json)
+{
+    std::string utf8;
+    AppendUtf8(value, wcslen(value), utf8);
+    json += '"';
+    for (char c : utf8)
+    {
+        if (c == '"' || c == '\\')
+        {
+            json += '\\';
+            json += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            StringCchPrintfA(escaped, _countof(escaped), "\\u%04x", static_cast<unsigned int>(c));
+            json += escaped;
+        }
+        else
+        {
+            json += c;
+        }
+    }
+    json += '"';
+}
+
+void Trace::Enable(LPCWSTR path)
+{
+    s_path = path;
+    if (!IsEnabled())
+    {
+        s_origin = Now();
+        s_enabled.store(true, std::memory_order_relaxed);
+    }
+}
+
+void Trace::EnableSummary(LPCWSTR path)
+{
+    s_summaryPath = path;
+    if (!IsEnabled())
+    {
+        s_origin = Now();
+        s_enabled.store(true, std::memory_order_relaxed);
+    }
+}
+
+ULONGLONG Trace::GetMicroseconds()
+{
+    static LONGLONG const frequency = []
+    {
+        LARGE_INTEGER value;
+        QueryPerformanceFrequency(&value);
+        return value.QuadPart;
+    }();
+    return static_cast<ULONGLONG>(ToMicroseconds(Now(), frequency));
+}
+
+void Trace::Record(Phase phase, LPCWSTR name, ULONGLONG id, LONGLONG start, LONGLONG end)
+{
+    Buffer* buffer = t_buffer;
+    if (!buffer)
+    {
+        buffer = t_buffer = CreateBuffer();
+    }
+
+    // Only this thread writes to the buffer
+    size_t const count = buffer->count.load(std::memory_order_relaxed);
+    Event& event = buffer->events[count % c_bufferSize];
+    event.name = name;
+    event.id = id;
+    event.start = start;
+    event.end = end;
+    event.phase = phase;
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+// Buffers outlive their threads, so the events of a finished thread can
+// still be exported
+Trace::Buffer* Trace::CreateBuffer()
+{
+    std::unique_ptr<Buffer> buffer = std::make_unique<Buffer>();
+    buffer->threadId = GetCurrentThreadId();
+    buffer->events.resize(c_bufferSize);
+    buffer->count.store(0, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(s_buffersLock);
+    s_buffers.push_back(std::move(buffer));
+    return s_buffers.back().get();
+}
+
+HRESULT Trace::Export()
+{
+    if (!IsEnabled())
+    {
+        return S_FALSE;
+    }
+
+    // The summary is still written when the trace can't be
+    HRESULT const hr = s_path.empty() ? S_FALSE : Export(s_path.c_str());
+    HRESULT const summaryHr = s_summaryPath.empty() ? S_FALSE : ExportSummary(s_summaryPath.c_str());
+    RETURN_IF_FAILED(hr);
+    RETURN_IF_FAILED(summaryHr);
+    return hr == S_OK || summaryHr == S_OK ? S_OK : S_FALSE;
+}
+
+HRESULT Trace::Export(LPCWSTR path)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    size_t const firstLength = json.size();
+    for (const std::pair<DWORD, Event>& event : CollectEvents())
+    {
+        if (json.size() != firstLength)
+        {
+            json += ',';
+        }
+        AppendEvent(event.second, event.first, frequency.QuadPart, json);
+    }
+    json += "]}\n";
+
+    return WriteText(path, json);
+}
+
+// Durations are in microseconds. An async span whose begin was overwritten
+// in the ring buffer isn't counted.
+HRESULT Trace::ExportSummary(LPCWSTR path)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    // Async spans may begin and end on different threads
+    std::vector<std::pair<DWORD, Event>> events = CollectEvents();
+    std::stable_sort(events.begin(), events.end(), [](const std::pair<DWORD, Event>& a, const std::pair<DWORD, Event>& b)
+    {
+        return a.second.start < b.second.start;
+    });
+
+    std::map<std::wstring, std::vector<LONGLONG>> durations;  // Ticks
+    std::map<std::wstring, ULONGLONG> instants;
+    std::map<std::pair<std::wstring, ULONGLONG>, LONGLONG> begun;  // Start of the open async spans
+    for (const std::pair<DWORD, Event>& entry : events)
+    {
+        const Event& event = entry.second;
+        switch (event.phase)
+        {
+        case Phase::Complete:
+            durations[event.name].push_back(event.end - event.start);
+            break;
+        case Phase::Instant:
+            ++instants[event.name];
+            break;
+        case Phase::AsyncBegin:
+            begun[std::make_pair(std::wstring(event.name), event.id)] = event.start;
+            break;
+        case Phase::AsyncEnd:
+        {
+            auto it = begun.find(std::make_pair(std::wstring(event.name), event.id));
+            if (it != begun.end())
+            {
+                durations[event.name].push_back(event.start - it->second);
+                begun.erase(it);
+            }
+            break;
+        }
+        }
+    }
+
+    std::string json = "{\"unit\":\"us\",\"spans\":[";
+    bool first = true;
+    for (auto& span : durations)
+    {
+        std::vector<LONGLONG>& ticks = span.second;
+        std::sort(ticks.begin(), ticks.end());
+        LONGLONG total = 0;
+        for (LONGLONG duration : ticks)
+        {
+            total += duration;
+        }
+        // Nearest rank
+        auto percentile = [&ticks](size_t percent)
+        {
+            return ticks[(ticks.size() * percent + 99) / 100 - 1];
+        };
+
+        if (!first)
+        {
+            json += ',';
+        }
+        first = false;
+        json += "{\"name\":";
+        AppendJsonString(span.first.c_str(), json);
+
+        char fields[192];
+        StringCchPrintfA(fields, _countof(fields),
+            ",\"count\":%zu,\"total\":%lld,\"mean\":%lld,\"p50\":%lld,\"p95\":%lld,\"max\":%lld}",
+            ticks.size(), ToMicroseconds(total, frequency.QuadPart),
+            ToMicroseconds(total / static_cast<LONGLONG>(ticks.size()), frequency.QuadPart),
+            ToMicroseconds(percentile(50), frequency.QuadPart),
+            ToMicroseconds(percentile(95), frequency.QuadPart),
+            ToMicroseconds(ticks.back(), frequency.QuadPart));
+        json += fields;
+    }
+
+    json += "],\"instants\":[";
+    first = true;
+    for (const auto& instant : instants)
+    {
+        if (!first)
+        {
+            json += ',';
+        }
+        first = false;
+        json += "{\"name\":";
+        AppendJsonString(instant.first.c_str(), json);
+
+        char fields[64];
+        StringCchPrintfA(fields, _countof(fields), ",\"count\":%llu}", instant.second);
+        json += fields;
+    }
+    json += "]}\n";
+
+    return WriteText(path, json);
+}
+
+// Thread by thread, each in the order recorded
+std::vector<std::pair<DWORD, Trace::Event>> Trace::CollectEvents()
+{
+    std::vector<std::pair<DWORD, Event>> events;
+    std::lock_guard<std::mutex> lock(s_buffersLock);
+    for (const std::unique_ptr<Buffer>& buffer : s_buffers)
+    {
+        size_t const count = buffer->count.load(std::memory_order_acquire);
+        size_t const first = count > c_bufferSize ? count - c_bufferSize : 0;
+        for (size_t i = first; i < count; ++i)
+        {
+            events.emplace_back(buffer->threadId, buffer->events[i % c_bufferSize]);
+        }
+    }
+    return events;
+}
+
+HRESULT Trace::WriteText(LPCWSTR path, const std::string& text)
+{
+    wil::unique_hfile file(CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file)
+    {
+        RETURN_LAST_ERROR();
+    }
+
+    DWORD written = 0;
+    RETURN_IF_WIN32_BOOL_FALSE(WriteFile(file.get(), text.data(), static_cast<DWORD>(text.size()), &written, nullptr));
+    return written == text.size() ? S_OK : E_FAIL;
+}
+
+void Trace::AppendEvent(const Event& event, DWORD threadId, LONGLONG frequency, std::string& json)
+{
+    json += "{\"name\":";
+    AppendJsonString(event.name, json);
+
+    // Timestamps are in microseconds since tracing was enabled
+    char fields[160];
+    StringCchPrintfA(fields, _countof(fields), ",\"cat\":\"browser\",\"ph\":\"%c\",\"ts\":%lld,\"pid\":%lu,\"tid\":%lu",
+        static_cast<char>(event.phase), ToMicroseconds(event.start - s_origin, frequency),
+        static_cast<unsigned long>(GetCurrentProcessId()), static_cast<unsigned long>(threadId));
+    json += fields;
+
+    switch (event.phase)
+    {
+    case Phase::Complete:
+        StringCchPrintfA(fields, _countof(fields), ",\"dur\":%lld,\"args\":{\"id\":%llu}}", ToMicroseconds(event.end - event.start, frequency), event.id);
+        break;
+    case Phase::Instant:
+        // Thread scoped, so it shows on the track of the thread
+        StringCchPrintfA(fields, _countof(fields), ",\"s\":\"t\",\"args\":{\"id\":%llu}}", event.id);
+        break;
+    default:
+        StringCchPrintfA(fields, _countof(fields), ",\"id\":%llu}", event.id);
+        break;
+    }
+    json += fields;
+}
@@ -0,0 +1,131 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Builds with BROWSER_TRACING=0 compile every trace point away
+#ifndef BROWSER_TRACING
+#define BROWSER_TRACING 1
+#endif
+
+// Spans and instant events recorded into a ring buffer per thread, so
+// recording takes no lock. When a buffer is full the oldest events are
+// overwritten. Export() writes them in the Chrome trace event format, which
+// chrome://tracing and https://ui.perfetto.dev can open.
+//
+// Tracing is off until Enable() is called, a trace point then costs a load
+// and a branch. Names have to be string literals, only the pointer is kept.
+// Async events with the same name and id form one span across callbacks,
+// like a navigation from NavigationStarting to NavigationCompleted.
+//
+// For comparing runs, the spans can also be summarized per name, with the
+// count, mean, percentiles and maximum of their durations as JSON.
+class Trace
+{
+public:
+    enum class Phase : char
+    {
+        Complete = 'X',
+        Instant = 'i',
+        AsyncBegin = 'b',
+        AsyncEnd = 'e',
+    };
+
+    static const size_t c_bufferSize = 1 << 15;  // Events per thread
+
+    // The trace is exported to path when the browser exits
+    static void Enable(LPCWSTR path);
+    // The summary is exported to path when the browser exits
+    static void EnableSummary(LPCWSTR path);
+    static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    static void Record(Phase phase, LPCWSTR name, ULONGLONG id, LONGLONG start, LONGLONG end);
+    static LONGLONG Now()
+    {
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return counter.QuadPart;
+    }
+    // Now() in microseconds, for measurements which aren't traced
+    static ULONGLONG GetMicroseconds();
+
+    // Events recorded by other threads during the export may be torn
+    static HRESULT Export();
+    static HRESULT Export(LPCWSTR path);
+    static HRESULT ExportSummary(LPCWSTR path);
+
+    class Span
+    {
+    public:
+        Span(LPCWSTR name, ULONGLONG id) : m_name(IsEnabled() ? name : nullptr), m_id(id)
+        {
+            if (m_name)
+            {
+                m_start = Now();
+            }
+        }
+        ~Span()
+        {
+            if (m_name)
+            {
+                Record(Phase::Complete, m_name, m_id, m_start, Now());
+            }
+        }
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        LPCWSTR m_name;
+        ULONGLONG m_id;
+        LONGLONG m_start = 0;
+    };
+
+private:
+    struct Event
+    {
+        LPCWSTR name;
+        ULONGLONG id;
+        LONGLONG start;  // QueryPerformanceCounter ticks
+        LONGLONG end;
+        Phase phase;
+    };
+
+    struct Buffer
+    {
+        DWORD threadId;
+        std::vector<Event> events;
+        std::atomic<size_t> count;  // Recorded so far, the last c_bufferSize are kept
+    };
+
+    static std::atomic<bool> s_enabled;
+    static std::wstring s_path;
+    static std::wstring s_summaryPath;
+    static LONGLONG s_origin;
+    static std::mutex s_buffersLock;
+    static std::vector<std::unique_ptr<Buffer>> s_buffers;
+    static thread_local Buffer* t_buffer;
+
+    static Buffer* CreateBuffer();
+    static std::vector<std::pair<DWORD, Event>> CollectEvents();
+    static HRESULT WriteText(LPCWSTR path, const std::string& text);
+    static void AppendEvent(const Event& event, DWORD threadId, LONGLONG frequency, std::string& json);
+};
+
+#if BROWSER_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Records the time until the end of the enclosing scope
+#define TRACE_SPAN(name, id) Trace::Span TRACE_CONCAT(traceSpan, __LINE__)(name, id)
+#define TRACE_EVENT(phase, name, id) \
+    do { if (Trace::IsEnabled()) { LONGLONG const traceNow = Trace::Now(); Trace::Record(phase, name, id, traceNow, traceNow); } } while (0)
+#else
+#define TRACE_SPAN(name, id) do {} while (0)
+#define TRACE_EVENT(phase, name, id) do {} while (0)
+#endif
+
+#define TRACE_INSTANT(name, id) TRACE_EVENT(Trace::Phase::Instant, name, id)
+#define TRACE_ASYNC_BEGIN(name, id) TRACE_EVENT(Trace::Phase::AsyncBegin, name, id)
+#define TRACE_ASYNC_END(name, id) TRACE_EVENT(Trace::Phase::AsyncEnd, name, id)
@@ -0,0 +1,355 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "Utf.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define UTF_SIMD 1
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#define UTF_INVALID HRESULT_FROM_WIN32(ERROR_NO_UNICODE_TRANSLATION)
+#define UTF_NO_ROOM HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER)
+
+#ifdef UTF_SIMD
+
+static bool DetectAvx2()
+{
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+
+    // The OS must save the YMM registers on context switches
+    __cpuid(info, 1);
+    bool const osxsave = (info[2] & (1 << 27)) != 0;
+    bool const avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+static const bool s_hasAvx2 = DetectAvx2();
+
+// Each kernel converts as many whole blocks of ASCII as fit and returns the
+// number of code units consumed (and produced, the two are equal for ASCII).
+
+static size_t NarrowAsciiAvx2(const WCHAR* src, size_t n, char* dst)
+{
+    __m256i const nonAscii = _mm256_set1_epi16(static_cast<short>(0xFF80));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i const v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        if (!_mm256_testz_si256(v, nonAscii))
+        {
+            break;
+        }
+        // packus works per 128 bit lane, gather the two low quadwords
+        __m256i const packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(packed));
+    }
+    return i;
+}
+
+static size_t NarrowAsciiSse2(const WCHAR* src, size_t n, char* dst)
+{
+    __m128i const nonAscii = _mm_set1_epi16(static_cast<short>(0xFF80));
+    __m128i const zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i const v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, nonAscii), zero)) != 0xFFFF)
+        {
+            break;
+        }
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(v, v));
+    }
+    return i;
+}
+
+static size_t WidenAsciiAvx2(const char* src, size_t n, WCHAR* dst)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i const v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        if (_mm256_movemask_epi8(v) != 0)
+        {
+            break;
+        }
+        __m256i const low = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+        __m256i const high = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 16), high);
+    }
+    return i;
+}
+
+static size_t WidenAsciiSse2(const char* src, size_t n, WCHAR* dst)
+{
+    __m128i const zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i const v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(v) != 0)
+        {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+    }
+    return i;
+}
+
+#endif
+
+static size_t NarrowAscii(const WCHAR* src, size_t n, char* dst)
+{
+    size_t i = 0;
+#ifdef UTF_SIMD
+    // Skip the kernels between the characters of non-ASCII text
+    if (n == 0 || src[0] >= 0x80)
+    {
+        return 0;
+    }
+    if (s_hasAvx2)
+    {
+        i = NarrowAsciiAvx2(src, n, dst);
+    }
+    i += NarrowAsciiSse2(src + i, n - i, dst + i);
+#endif
+    while (i < n && src[i] < 0x80)
+    {
+        dst[i] = static_cast<char>(src[i]);
+        ++i;
+    }
+    return i;
+}
+
+static size_t WidenAscii(const char* src, size_t n, WCHAR* dst)
+{
+    size_t i = 0;
+#ifdef UTF_SIMD
+    if (n == 0 || static_cast<unsigned char>(src[0]) >= 0x80)
+    {
+        return 0;
+    }
+    if (s_hasAvx2)
+    {
+        i = WidenAsciiAvx2(src, n, dst);
+    }
+    i += WidenAsciiSse2(src + i, n - i, dst + i);
+#endif
+    while (i < n && static_cast<unsigned char>(src[i]) < 0x80)
+    {
+        dst[i] = static_cast<WCHAR>(src[i]);
+        ++i;
+    }
+    return i;
+}
+
+HRESULT Utf16ToUtf8(const WCHAR* src, size_t srcLength, char* dst, size_t dstCapacity, size_t* written)
+{
+    size_t i = 0;
+    size_t o = 0;
+    HRESULT hr = S_OK;
+
+    while (i < srcLength)
+    {
+        size_t const ascii = NarrowAscii(src + i, std::min(srcLength - i, dstCapacity - o), dst + o);
+        i += ascii;
+        o += ascii;
+        if (i == srcLength)
+        {
+            break;
+        }
+
+        unsigned int c = src[i];
+        size_t consumed = 1;
+        size_t length;
+        if (c < 0x80)
+        {
+            length = 1;
+        }
+        else if (c < 0x800)
+        {
+            length = 2;
+        }
+        else if (c >= 0xD800 && c <= 0xDFFF)
+        {
+            // Must be a high surrogate followed by a low one
+            if (c > 0xDBFF || i + 1 == srcLength || src[i + 1] < 0xDC00 || src[i + 1] > 0xDFFF)
+            {
+                hr = UTF_INVALID;
+                break;
+            }
+            c = 0x10000 + ((c - 0xD800) << 10) + (src[i + 1] - 0xDC00);
+            consumed = 2;
+            length = 4;
+        }
+        else
+        {
+            length = 3;
+        }
+
+        if (dstCapacity - o < length)
+        {
+            hr = UTF_NO_ROOM;
+            break;
+        }
+
+        switch (length)
+        {
+        case 1:
+            dst[o] = static_cast<char>(c);
+            break;
+        case 2:
+            dst[o] = static_cast<char>(0xC0 | (c >> 6));
+            dst[o + 1] = static_cast<char>(0x80 | (c & 0x3F));
+            break;
+        case 3:
+            dst[o] = static_cast<char>(0xE0 | (c >> 12));
+            dst[o + 1] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            dst[o + 2] = static_cast<char>(0x80 | (c & 0x3F));
+            break;
+        default:
+            dst[o] = static_cast<char>(0xF0 | (c >> 18));
+            dst[o + 1] = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            dst[o + 2] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            dst[o + 3] = static_cast<char>(0x80 | (c & 0x3F));
+            break;
+        }
+        i += consumed;
+        o += length;
+    }
+
+    *written = o;
+    return hr;
+}
+
+HRESULT Utf8ToUtf16(const char* src, size_t srcLength, WCHAR* dst, size_t dstCapacity, size_t* written)
+{
+    const unsigned char* const s = reinterpret_cast<const unsigned char*>(src);
+    size_t i = 0;
+    size_t o = 0;
+    HRESULT hr = S_OK;
+
+    while (i < srcLength)
+    {
+        size_t const ascii = WidenAscii(src + i, std::min(srcLength - i, dstCapacity - o), dst + o);
+        i += ascii;
+        o += ascii;
+        if (i == srcLength)
+        {
+            break;
+        }
+
+        unsigned int c = s[i];
+        size_t length;
+        unsigned int min;
+        if (c < 0x80)
+        {
+            length = 1;
+            min = 0;
+        }
+        else if (c >= 0xC2 && c <= 0xDF)
+        {
+            length = 2;
+            min = 0x80;
+            c &= 0x1F;
+        }
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            length = 3;
+            min = 0x800;
+            c &= 0x0F;
+        }
+        else if (c >= 0xF0 && c <= 0xF4)
+        {
+            length = 4;
+            min = 0x10000;
+            c &= 0x07;
+        }
+        else
+        {
+            hr = UTF_INVALID;
+            break;
+        }
+
+        if (srcLength - i < length)
+        {
+            hr = UTF_INVALID;
+            break;
+        }
+
+        bool valid = true;
+        for (size_t k = 1; k < length; ++k)
+        {
+            unsigned int const b = s[i + k];
+            valid = valid && (b & 0xC0) == 0x80;
+            c = (c << 6) | (b & 0x3F);
+        }
+        // Reject overlong forms, surrogates and anything past U+10FFFF
+        if (!valid || c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+        {
+            hr = UTF_INVALID;
+            break;
+        }
+
+        size_t const units = c >= 0x10000 ? 2 : 1;
+        if (dstCapacity - o < units)
+        {
+            hr = UTF_NO_ROOM;
+            break;
+        }
+
+        if (units == 2)
+        {
+            c -= 0x10000;
+            dst[o] = static_cast<WCHAR>(0xD800 + (c >> 10));
+            dst[o + 1] = static_cast<WCHAR>(0xDC00 + (c & 0x3FF));
+        }
+        else
+        {
+            dst[o] = static_cast<WCHAR>(c);
+        }
+        i += length;
+        o += units;
+    }
+
+    *written = o;
+    return hr;
+}
+
+HRESULT AppendUtf8(const WCHAR* src, size_t srcLength, std::string& out)
+{
+    size_t const offset = out.size();
+    out.resize(offset + MaxUtf8Length(srcLength));
+
+    size_t written = 0;
+    HRESULT hr = Utf16ToUtf8(src, srcLength, &out[0] + offset, srcLength * 3, &written);
+    out.resize(offset + (SUCCEEDED(hr) ? written : 0));
+    return hr;
+}
+
+HRESULT AppendUtf16(const char* src, size_t srcLength, std::basic_string<WCHAR>& out)
+{
+    size_t const offset = out.size();
+    out.resize(offset + MaxUtf16Length(srcLength));
+
+    size_t written = 0;
+    HRESULT hr = Utf8ToUtf16(src, srcLength, &out[0] + offset, srcLength, &written);
+    out.resize(offset + (SUCCEEDED(hr) ? written : 0));
+    return hr;
+}
@@ -0,0 +1,28 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// UTF-8 <-> UTF-16 transcoding into caller supplied buffers. Runs of ASCII
+// are converted 16 or 32 characters at a time with SSE2/AVX2 where the CPU
+// supports it, everything else goes through a validating scalar path.
+//
+// Invalid input (lone surrogates, overlong or truncated sequences, code
+// points beyond U+10FFFF) fails with ERROR_NO_UNICODE_TRANSLATION and a
+// destination that is too small with ERROR_INSUFFICIENT_BUFFER. In both cases
+// *written tells how much of the output is valid.
+
+// Worst case output sizes, in code units
+inline size_t MaxUtf8Length(size_t utf16Length) { return utf16Length * 3; }
+inline size_t MaxUtf16Length(size_t utf8Length) { return utf8Length; }
+
+HRESULT Utf16ToUtf8(const WCHAR* src, size_t srcLength, char* dst, size_t dstCapacity, size_t* written);
+HRESULT Utf8ToUtf16(const char* src, size_t srcLength, WCHAR* dst, size_t dstCapacity, size_t* written);
+
+// Append to an existing string, reusing its capacity. WCHAR is the UTF-16
+// code unit, std::wstring on Windows.
+HRESULT AppendUtf8(const WCHAR* src, size_t srcLength, std::string& out);
+HRESULT AppendUtf16(const char* src, size_t srcLength, std::basic_string<WCHAR>& out);
@@ -5,12 +5,18 @@
 // WebViewBrowserApp.cpp : Defines the entry point for the application.
 //
 
+#include "ActivationChannel.h"
 #include "BrowserWindow.h"
+#include "Utf.h"
 #include "WebViewBrowserApp.h"
 
 using namespace Microsoft::WRL;
 
-void tryLaunchWindow(HINSTANCE hInstance, LPCWSTR lpCmdLine, int nCmdShow);
+static const int c_activationAttempts = 3;
+
+void tryLaunchWindow(WindowManager& windowManager, int nCmdShow);
+bool startActivationServer(ActivationServer& server, HINSTANCE hInstance, WindowManager& windowManager, const ActivationRequest& request);
+HRESULT readUriList(LPCWSTR path, std::vector<std::wstring>& uris);
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                       _In_opt_ HINSTANCE hPrevInstance,
@@ -21,6 +27,7 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 
     SetProcessDPIAware();
 
+    ActivationRequest request;
     while (*lpCmdLine == L'/')
     {
         LPWSTR const lpArgs = PathGetArgsW(lpCmdLine);
@@ -44,38 +51,76 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                     Tab::m_preferredColorScheme = COREWEBVIEW2_PREFERRED_COLOR_SCHEME_DARK;
                 }
             }
+            else if (StrCmpIW(lpCmdLine, L"/MaxTabLoads") == 0)
+            {
+                Tab::m_maxConcurrentLoads = std::max(StrToIntW(lpEquals), 1);
+            }
+            else if (StrCmpIW(lpCmdLine, L"/TabMemoryBudget") == 0)
+            {
+                Tab::m_memoryBudget = std::max(StrToIntW(lpEquals), 1);
+            }
+            else if (StrCmpIW(lpCmdLine, L"/TraceFile") == 0)
+            {
+                Trace::Enable(lpEquals);
+            }
+            else if (StrCmpIW(lpCmdLine, L"/TraceSummary") == 0)
+            {
+                Trace::EnableSummary(lpEquals);
+            }
+            else if (StrCmpIW(lpCmdLine, L"/UrlList") == 0)
+            {
+                if (FAILED(readUriList(lpEquals, request.uris)))
+                {
+                    OutputDebugString(L"Can't read the URL list\n");
+                }
+            }
+            else if (StrCmpIW(lpCmdLine, L"/MaxBatchLoads") == 0)
+            {
+                Tab::m_maxBatchLoads = std::max(StrToIntW(lpEquals), 1);
+            }
+            else if (StrCmpIW(lpCmdLine, L"/LoadReport") == 0)
+            {
+                Tab::m_loadReportPath = lpEquals;
+            }
         }
         lpCmdLine = lpArgs;
     }
 
-    // Allow only a single application instance
-    // (neglects occasional race conditions for simplicity)
-    COPYDATASTRUCT cds;
-    cds.dwData = 1;
-    cds.cbData = static_cast<DWORD>(wcslen(lpCmdLine)) * sizeof *lpCmdLine;
-    cds.lpData = lpCmdLine;
-    if (ATOM const atom = BrowserWindow::RegisterClass(hInstance, cds))
+    // Every other argument is a URI to open in a tab of its own
+    while (*lpCmdLine)
     {
-        if (HWND const hwnd = FindWindowW(reinterpret_cast<LPCWSTR>(atom), nullptr))
+        LPWSTR const lpArgs = PathGetArgsW(lpCmdLine);
+        PathRemoveArgsW(lpCmdLine);
+        PathUnquoteSpacesW(lpCmdLine);
+        if (*lpCmdLine)
         {
-            SetForegroundWindow(hwnd);
-            if (cds.cbData)
-            {
-                cds.cbData += sizeof *lpCmdLine; // Include the terminating zero
-                DWORD_PTR result = 0;
-                while (SendMessageTimeout(
-                    hwnd, WM_COPYDATA, 0, reinterpret_cast<LPARAM>(&cds),
-                    SMTO_ABORTIFHUNG | SMTO_NOTIMEOUTIFNOTHUNG, 1000, &result) &&
-                    result == IDRETRY)
-                {
-                    Sleep(100);
-                }
-            }
-            return 0;
+            request.uris.push_back(lpCmdLine);
         }
+        lpCmdLine = lpArgs;
+        while (*lpCmdLine == L' ')
+        {
+            ++lpCmdLine;
+        }
+    }
+
+    // Outlives the windows, which delete themselves before the loop ends
+    WindowManager windowManager(hInstance);
+
+    // Allow only a single application instance, a running one opens the URIs
+    ActivationServer activationServer;
+    if (!startActivationServer(activationServer, hInstance, windowManager, request))
+    {
+        return 0;
     }
 
-    tryLaunchWindow(hInstance, lpCmdLine, nCmdShow);
+    // Opened once the controls of the window are up
+    if (!request.uris.empty())
+    {
+        windowManager.Activate(std::move(request), [](const ActivationReply&) {});
+    }
+
+    BrowserWindow::RegisterClass(hInstance);
+    tryLaunchWindow(windowManager, nCmdShow);
 
     HACCEL hAccelTable = LoadAccelerators(hInstance, MAKEINTRESOURCE(IDC_WEBVIEWBROWSERAPP));
 
@@ -91,12 +136,105 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
         }
     }
 
+    if (FAILED(Trace::Export()))
+    {
+        OutputDebugString(L"Can't export the trace\n");
+    }
+
     return (int) msg.wParam;
 }
 
-void tryLaunchWindow(HINSTANCE hInstance, LPCWSTR lpCmdLine, int nCmdShow)
+// Returns false if a running instance took the request. An instance which
+// quits while the request is on its way answers with E_ABORT, or not at all,
+// and this one takes its place. So does one which doesn't answer in time,
+// this one then opens its own window without the activation server.
+bool startActivationServer(ActivationServer& server, HINSTANCE hInstance, WindowManager& windowManager, const ActivationRequest& request)
+{
+    for (int attempt = 0; attempt < c_activationAttempts; ++attempt)
+    {
+        HRESULT hr = server.Start(hInstance, [&windowManager](ActivationRequest request, ActivationQueue::ReplyCallback reply)
+        {
+            windowManager.Activate(std::move(request), std::move(reply));
+        });
+        if (hr != HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED))
+        {
+            if (FAILED(hr))
+            {
+                // Still runs, only other instances won't find this one
+                OutputDebugString(L"Can't start the activation server\n");
+            }
+            return true;
+        }
+
+        ActivationReply reply;
+        hr = ActivationServer::Send(request, reply);
+        if (SUCCEEDED(hr) && reply.result != E_ABORT)
+        {
+            return false;
+        }
+        if (hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT))
+        {
+            OutputDebugString(L"The running instance doesn't answer\n");
+            return true;
+        }
+    }
+    return true;
+}
+
+// One URI per line in UTF-8, empty lines and lines starting with # are
+// skipped. "-" reads the standard input.
+HRESULT readUriList(LPCWSTR path, std::vector<std::wstring>& uris)
+{
+    wil::unique_hfile file;
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    if (wcscmp(path, L"-") != 0)
+    {
+        file.reset(CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        input = file.get();
+    }
+    if (!input || input == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_HANDLE);
+    }
+
+    // A pipe ends with ERROR_BROKEN_PIPE rather than a read of 0 bytes
+    std::string text;
+    char buffer[4096];
+    DWORD read = 0;
+    while (ReadFile(input, buffer, sizeof(buffer), &read, nullptr) && read != 0)
+    {
+        text.append(buffer, read);
+    }
+
+    std::wstring lines;
+    RETURN_IF_FAILED(AppendUtf16(text.data(), text.size(), lines));
+    size_t begin = lines.compare(0, 1, L"\xFEFF") == 0 ? 1 : 0;
+    while (begin < lines.size())
+    {
+        size_t end = lines.find(L'\n', begin);
+        if (end == std::wstring::npos)
+        {
+            end = lines.size();
+        }
+
+        size_t const first = lines.find_first_not_of(L" \t\r", begin);
+        if (first < end && lines[first] != L'#')
+        {
+            size_t const last = lines.find_last_not_of(L" \t\r", end - 1);
+            uris.push_back(lines.substr(first, last - first + 1));
+        }
+        begin = end + 1;
+    }
+    return S_OK;
+}
+
+void tryLaunchWindow(WindowManager& windowManager, int nCmdShow)
 {
-    BOOL launched = BrowserWindow::LaunchWindow(hInstance, lpCmdLine, nCmdShow);
+    bool const launched = windowManager.OpenWindow(nCmdShow) != nullptr;
     if (!launched)
     {
         int msgboxID = MessageBox(NULL, L"Could not launch the browser", L"Error", MB_RETRYCANCEL);
@@ -104,7 +242,7 @@ void tryLaunchWindow(HINSTANCE hInstance, LPCWSTR lpCmdLine, int nCmdShow)
         switch (msgboxID)
         {
         case IDRETRY:
-            tryLaunchWindow(hInstance, lpCmdLine, nCmdShow);
+            tryLaunchWindow(windowManager, nCmdShow);
             break;
         case IDCANCEL:
         default:
@@ -0,0 +1,361 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "BrowserWindow.h"
+#include "WindowManager.h"
+#include "Utf.h"
+
+using namespace Microsoft::WRL;
+
+// Files larger than this aren't the cache's
+static const LONGLONG c_maxCacheFileSize = 1024 * 1024 * 1024;
+
+// The response cache in a folder of the app data: the index, and one file per
+// body named after it. Files are replaced as a whole, through a temporary
+// file next to them.
+class CacheFolder : public ResponseCache::Storage
+{
+public:
+    explicit CacheFolder(std::wstring folder) : m_folder(std::move(folder)) {}
+
+    HRESULT ReadIndex(std::vector<BYTE>& data) override
+    {
+        return ReadWholeFile(m_folder + L"\\Index", data);
+    }
+
+    HRESULT WriteIndex(const std::vector<BYTE>& data) override
+    {
+        return WriteWholeFile(m_folder + L"\\Index", data.data(), data.size());
+    }
+
+    HRESULT ListBlobs(std::vector<std::string>& names) override
+    {
+        WIN32_FIND_DATAW found;
+        wil::unique_hfind find(FindFirstFileW((m_folder + L"\\*").c_str(), &found));
+        if (!find)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        do
+        {
+            if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            {
+                names.emplace_back();
+                AppendUtf8(found.cFileName, wcslen(found.cFileName), names.back());
+            }
+        } while (FindNextFileW(find.get(), &found));
+        return S_OK;
+    }
+
+    HRESULT ReadBlob(const std::string& name, std::vector<BYTE>& data) override
+    {
+        return ReadWholeFile(GetPath(name), data);
+    }
+
+    HRESULT WriteBlob(const std::string& name, const BYTE* data, size_t size) override
+    {
+        return WriteWholeFile(GetPath(name), data, size);
+    }
+
+    HRESULT RemoveBlob(const std::string& name) override
+    {
+        if (!DeleteFileW(GetPath(name).c_str()) && GetLastError() != ERROR_FILE_NOT_FOUND)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        return S_OK;
+    }
+
+private:
+    std::wstring m_folder;
+
+    // Blob names are ASCII
+    std::wstring GetPath(const std::string& name) const
+    {
+        return m_folder + L"\\" + std::wstring(name.begin(), name.end());
+    }
+
+    static HRESULT ReadWholeFile(const std::wstring& path, std::vector<BYTE>& data)
+    {
+        wil::unique_hfile file(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        LARGE_INTEGER size;
+        RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(file.get(), &size));
+        if (size.QuadPart > c_maxCacheFileSize)
+        {
+            return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+        }
+
+        data.resize(static_cast<size_t>(size.QuadPart));
+        DWORD read = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(::ReadFile(file.get(), data.data(), static_cast<DWORD>(data.size()), &read, nullptr));
+        return read == data.size() ? S_OK : HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+    }
+
+    static HRESULT WriteWholeFile(const std::wstring& path, const BYTE* data, size_t size)
+    {
+        std::wstring const temporaryPath = path + L".tmp";
+        {
+            wil::unique_hfile file(CreateFileW(temporaryPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+            if (!file)
+            {
+                RETURN_LAST_ERROR();
+            }
+
+            DWORD written = 0;
+            RETURN_IF_WIN32_BOOL_FALSE(::WriteFile(file.get(), data, static_cast<DWORD>(size), &written, nullptr));
+            if (written != size)
+            {
+                return E_FAIL;
+            }
+        }
+        RETURN_IF_WIN32_BOOL_FALSE(MoveFileExW(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING));
+        return S_OK;
+    }
+};
+
+WindowManager::WindowManager(HINSTANCE hInstance) :
+    m_hInstance(hInstance)
+{
+}
+
+// Clients still waiting learn the instance is gone
+WindowManager::~WindowManager()
+{
+    m_activations.CancelAll(E_ABORT);
+}
+
+BrowserWindow* WindowManager::OpenWindow(int nCmdShow)
+{
+    return BrowserWindow::LaunchWindow(*this, m_hInstance, nCmdShow);
+}
+
+size_t WindowManager::Add(BrowserWindow* window)
+{
+    size_t const windowId = m_registry.AddWindow();
+    m_windows[windowId] = window;
+    return windowId;
+}
+
+// The tabs of a window which is closed while others stay open are gone for
+// good, those of the last window are restored on the next start
+bool WindowManager::Remove(size_t windowId)
+{
+    m_windows.erase(windowId);
+    m_activations.Cancel(windowId, E_ABORT);
+    std::vector<size_t> tabs = m_registry.RemoveWindow(windowId);
+    if (m_windows.empty())
+    {
+        return true;
+    }
+
+    for (size_t tabId : tabs)
+    {
+        m_session.Close(tabId);
+    }
+    return false;
+}
+
+BrowserWindow* WindowManager::GetWindow(size_t windowId) const
+{
+    auto it = m_windows.find(windowId);
+    return it == m_windows.end() ? nullptr : it->second;
+}
+
+HRESULT WindowManager::GetContentEnvironment(EnvironmentFactory create, EnvironmentCallback done)
+{
+    return GetEnvironment(m_contentEnv, std::move(create), std::move(done));
+}
+
+HRESULT WindowManager::GetUIEnvironment(EnvironmentFactory create, EnvironmentCallback done)
+{
+    return GetEnvironment(m_uiEnv, std::move(create), std::move(done));
+}
+
+bool WindowManager::TakeStoresOpening()
+{
+    bool const first = !m_storesOpened;
+    m_storesOpened = true;
+    return first;
+}
+
+bool WindowManager::TakeSessionRestore()
+{
+    bool const first = !m_sessionRestored;
+    m_sessionRestored = true;
+    return first;
+}
+
+void WindowManager::Activate(ActivationRequest request, ActivationQueue::ReplyCallback reply)
+{
+    m_activations.Submit(std::move(request), std::move(reply));
+    DispatchActivations();
+}
+
+// The active window opens the tabs, or any other whose controls are up
+void WindowManager::DispatchActivations()
+{
+    if (m_activations.GetWaitingCount() == 0)
+    {
+        return;
+    }
+
+    size_t windowId = m_registry.GetActiveWindow();
+    BrowserWindow* window = GetWindow(windowId);
+    if (!window || !window->CanOpenTabs())
+    {
+        window = nullptr;
+        for (const auto& entry : m_windows)
+        {
+            if (entry.second->CanOpenTabs())
+            {
+                windowId = entry.first;
+                window = entry.second;
+                break;
+            }
+        }
+        if (!window)
+        {
+            return;
+        }
+    }
+
+    size_t requestId = 0;
+    ActivationRequest request;
+    while (m_activations.Take(windowId, requestId, request))
+    {
+        window->OpenTabs(requestId, std::move(request.uris));
+    }
+}
+
+HRESULT WindowManager::LoadRequestFilter(const std::wstring& path, UINT64 sourceTime, UINT64 sourceSize)
+{
+    wil::unique_hfile file(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file.get(), &size))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    if (size.QuadPart == 0 || size.QuadPart > MAXDWORD)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    // The view keeps the file mapped once the handles are closed
+    wil::unique_handle mapping(CreateFileMappingW(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+    if (!mapping)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    wil::unique_mapview_ptr<BYTE> view(static_cast<BYTE*>(MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0)));
+    if (!view)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    RequestFilter filter;
+    RETURN_IF_FAILED(filter.Load(view.get(), static_cast<size_t>(size.QuadPart)));
+    if (filter.GetSourceTime() != sourceTime || filter.GetSourceSize() != sourceSize)
+    {
+        return S_FALSE;
+    }
+
+    // The filter points into the new view before the old one goes
+    m_requestFilter = filter;
+    m_requestFilterView = std::move(view);
+    for (const auto& entry : m_windows)
+    {
+        entry.second->FilterRequests();
+    }
+    return S_OK;
+}
+
+HRESULT WindowManager::OpenResponseCache(const std::wstring& folder, UINT64 maxSize, const std::vector<std::wstring>& origins)
+{
+    std::vector<std::string> utf8Origins;
+    for (const std::wstring& origin : origins)
+    {
+        utf8Origins.emplace_back();
+        RETURN_IF_FAILED(AppendUtf8(origin.c_str(), origin.size(), utf8Origins.back()));
+    }
+    m_responseCache.SetOrigins(utf8Origins);
+    if (m_responseCache.GetOrigins().empty())
+    {
+        return E_INVALIDARG;
+    }
+
+    std::unique_ptr<CacheFolder> storage(new CacheFolder(folder));
+    RETURN_IF_FAILED(m_responseCache.Open(storage.get(), maxSize));
+    m_responseCacheFolder = std::move(storage);
+    m_responseCachePath = folder;
+
+    // The tabs ask for the requests of these, in the form SetOrigins() made
+    m_cachedOrigins.clear();
+    for (const std::string& origin : m_responseCache.GetOrigins())
+    {
+        m_cachedOrigins.emplace_back();
+        RETURN_IF_FAILED(AppendUtf16(origin.c_str(), origin.size(), m_cachedOrigins.back()));
+    }
+    for (const auto& entry : m_windows)
+    {
+        entry.second->CacheResponses();
+    }
+    return S_OK;
+}
+
+std::wstring WindowManager::GetCachedBodyPath(const std::string& blob) const
+{
+    return m_responseCachePath + L"\\" + std::wstring(blob.begin(), blob.end());
+}
+
+HRESULT WindowManager::GetEnvironment(SharedWebViewEnvironment& shared, EnvironmentFactory create, EnvironmentCallback done)
+{
+    return shared.Get([&create](SharedWebViewEnvironment::Completion completed) -> HRESULT
+    {
+        return create(Callback<ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler>(
+            [completed](HRESULT result, ICoreWebView2Environment* env) -> HRESULT
+        {
+            completed(result, env);
+            return result;
+        }).Get());
+    },
+        [done](HRESULT result, const ComPtr<ICoreWebView2Environment>& env)
+    {
+        done(result, env.Get());
+    });
+}
+
+void WindowManager::ScheduleSessionWrite()
+{
+    if (BrowserWindow* window = GetActiveWindow())
+    {
+        window->ScheduleSessionWrite();
+    }
+}
+
+void WindowManager::ScheduleCacheWrite()
+{
+    if (BrowserWindow* window = GetActiveWindow())
+    {
+        window->ScheduleCacheWrite();
+    }
+}
+
+// HTTP dates count from 1970, file times from 1601
+LONGLONG WindowManager::GetUnixTime()
+{
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    ULONGLONG const ticks = (static_cast<ULONGLONG>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+    return static_cast<LONGLONG>((ticks - 116444736000000000ULL) / 10000000);
+}
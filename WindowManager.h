@@ -0,0 +1,117 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+#include "ActivationProtocol.h"
+#include "FavoritesStore.h"
+#include "HistoryStore.h"
+#include "RequestFilter.h"
+#include "ResponseCache.h"
+#include "SearchIndex.h"
+#include "SessionJournal.h"
+#include "SharedEnvironment.h"
+#include "WindowRegistry.h"
+
+class BrowserWindow;
+
+// The browser windows of the process. They share both WebView2 environments,
+// so a window after the first only adds its controllers to the browser
+// processes which are running already, and they share the history, the
+// favorites, the session and the response cache. The process quits once the
+// last window is gone.
+class WindowManager
+{
+public:
+    typedef std::function<HRESULT(ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler*)> EnvironmentFactory;
+    typedef std::function<void(HRESULT, ICoreWebView2Environment*)> EnvironmentCallback;
+
+    explicit WindowManager(HINSTANCE hInstance);
+    ~WindowManager();
+
+    // Returns nullptr if the window can't be created. The window deletes
+    // itself when it is destroyed.
+    BrowserWindow* OpenWindow(int nCmdShow);
+
+    // Called by the windows, returns the id of the window
+    size_t Add(BrowserWindow* window);
+    // Returns true if it was the last window
+    bool Remove(size_t windowId);
+    BrowserWindow* GetWindow(size_t windowId) const;
+    // The window which was activated last
+    BrowserWindow* GetActiveWindow() const { return GetWindow(m_registry.GetActiveWindow()); }
+
+    // Only the first window which asks calls create, the others wait for the
+    // same environment. A failed creation is tried again by the next window.
+    // create is called before these return, done right away once the
+    // environment exists.
+    HRESULT GetContentEnvironment(EnvironmentFactory create, EnvironmentCallback done);
+    HRESULT GetUIEnvironment(EnvironmentFactory create, EnvironmentCallback done);
+
+    // True for the first window only, which opens the stores while it starts
+    bool TakeStoresOpening();
+    // True for the first window which asks, whose controls show the tabs of
+    // the previous session
+    bool TakeSessionRestore();
+
+    // Requests of other instances of the app wait until a window can open
+    // tabs. A window which closes with requests of its own still open
+    // answers them with E_ABORT.
+    void Activate(ActivationRequest request, ActivationQueue::ReplyCallback reply);
+    // Called again whenever a window can open tabs
+    void DispatchActivations();
+    void CompleteActivation(size_t requestId, const ActivationReply& reply) { m_activations.Complete(requestId, reply); }
+    // The next window whose controls are up opens tabs for them
+    bool HasWaitingUris() const { return m_activations.GetWaitingUriCount() != 0; }
+
+    // Maps the snapshot of the request filter, S_FALSE if it wasn't compiled
+    // from the list with the time and size given. Every tab filters its
+    // requests from then on.
+    HRESULT LoadRequestFilter(const std::wstring& path, UINT64 sourceTime, UINT64 sourceSize);
+    const RequestFilter& GetRequestFilter() const { return m_requestFilter; }
+
+    // Keeps the responses of the origins given in folder, every tab serves
+    // them from there from then on
+    HRESULT OpenResponseCache(const std::wstring& folder, UINT64 maxSize, const std::vector<std::wstring>& origins);
+    ResponseCache& GetResponseCache() { return m_responseCache; }
+    const std::vector<std::wstring>& GetCachedOrigins() const { return m_cachedOrigins; }
+    std::wstring GetCachedBodyPath(const std::string& blob) const;
+
+    WindowRegistry& GetRegistry() { return m_registry; }
+    HistoryStore& GetHistory() { return m_history; }
+    FavoritesStore& GetFavorites() { return m_favorites; }
+    SearchIndex& GetSearch() { return m_search; }
+    SessionJournal& GetSession() { return m_session; }
+
+private:
+    typedef SharedEnvironment<Microsoft::WRL::ComPtr<ICoreWebView2Environment>> SharedWebViewEnvironment;
+
+    HINSTANCE m_hInstance;
+    WindowRegistry m_registry;
+    std::map<size_t, BrowserWindow*> m_windows;
+    SharedWebViewEnvironment m_contentEnv;
+    SharedWebViewEnvironment m_uiEnv;
+    bool m_storesOpened = false;
+    bool m_sessionRestored = false;
+    ActivationQueue m_activations;
+    RequestFilter m_requestFilter;
+    wil::unique_mapview_ptr<BYTE> m_requestFilterView;  // What m_requestFilter reads
+    std::unique_ptr<ResponseCache::Storage> m_responseCacheFolder;
+    std::wstring m_responseCachePath;
+    std::vector<std::wstring> m_cachedOrigins;
+    // The active window collects the changes for a while, like the session's
+    ResponseCache m_responseCache{ &WindowManager::GetUnixTime, [this]() { ScheduleCacheWrite(); } };
+
+    HistoryStore m_history;
+    FavoritesStore m_favorites;
+    SearchIndex m_search;
+    // The active window collects the changes for a while
+    SessionJournal m_session{ [this]() { ScheduleSessionWrite(); } };
+
+    static HRESULT GetEnvironment(SharedWebViewEnvironment& shared, EnvironmentFactory create, EnvironmentCallback done);
+    void ScheduleSessionWrite();
+    void ScheduleCacheWrite();
+    static LONGLONG GetUnixTime();
+};
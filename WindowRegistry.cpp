@@ -0,0 +1,102 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "WindowRegistry.h"
+
+size_t WindowRegistry::AddWindow()
+{
+    size_t const windowId = m_nextWindowId++;
+    m_windows[windowId];
+    m_activations.push_back(windowId);
+    return windowId;
+}
+
+std::vector<size_t> WindowRegistry::RemoveWindow(size_t windowId)
+{
+    std::vector<size_t> tabs;
+    auto it = m_windows.find(windowId);
+    if (it == m_windows.end())
+    {
+        return tabs;
+    }
+
+    tabs.swap(it->second);
+    m_windows.erase(it);
+    for (size_t tabId : tabs)
+    {
+        m_tabWindows.erase(tabId);
+    }
+    m_activations.erase(std::find(m_activations.begin(), m_activations.end(), windowId));
+    return tabs;
+}
+
+void WindowRegistry::ReserveTabIds(size_t maxTabId)
+{
+    m_nextWindowId = std::max(m_nextWindowId, maxTabId / c_tabIdBlock + 1);
+}
+
+void WindowRegistry::Activate(size_t windowId)
+{
+    auto it = std::find(m_activations.begin(), m_activations.end(), windowId);
+    if (it != m_activations.end())
+    {
+        m_activations.erase(it);
+        m_activations.push_back(windowId);
+    }
+}
+
+void WindowRegistry::AddTab(size_t windowId, size_t tabId)
+{
+    auto window = m_windows.find(windowId);
+    if (window == m_windows.end())
+    {
+        return;
+    }
+
+    RemoveTab(tabId);
+    window->second.push_back(tabId);
+    m_tabWindows[tabId] = windowId;
+}
+
+void WindowRegistry::RemoveTab(size_t tabId)
+{
+    auto it = m_tabWindows.find(tabId);
+    if (it == m_tabWindows.end())
+    {
+        return;
+    }
+
+    std::vector<size_t>& tabs = m_windows[it->second];
+    tabs.erase(std::find(tabs.begin(), tabs.end(), tabId));
+    m_tabWindows.erase(it);
+}
+
+bool WindowRegistry::MoveTab(size_t tabId, size_t windowId)
+{
+    if (m_tabWindows.count(tabId) == 0 || m_windows.count(windowId) == 0)
+    {
+        return false;
+    }
+
+    AddTab(windowId, tabId);
+    return true;
+}
+
+size_t WindowRegistry::GetWindow(size_t tabId) const
+{
+    auto it = m_tabWindows.find(tabId);
+    return it == m_tabWindows.end() ? c_noWindow : it->second;
+}
+
+const std::vector<size_t>& WindowRegistry::GetTabs(size_t windowId) const
+{
+    static const std::vector<size_t> s_none;
+    auto it = m_windows.find(windowId);
+    return it == m_windows.end() ? s_none : it->second;
+}
+
+size_t WindowRegistry::GetActiveWindow() const
+{
+    return m_activations.empty() ? c_noWindow : m_activations.back();
+}
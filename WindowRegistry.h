@@ -0,0 +1,51 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+// Which window shows which tab, for all the browser windows of the process.
+// Tab ids are unique across the windows, so a tab keeps its id when it moves
+// to another window: every window hands out ids from a block of its own,
+// which starts at GetTabIdBase(), and the blocks of ids which are in use
+// already, like those restored from the previous session, are never given to
+// a new window. Window ids aren't reused either.
+//
+// Knows nothing about windows or WebView2, a window is only its id.
+class WindowRegistry
+{
+public:
+    static const size_t c_noWindow = static_cast<size_t>(-1);
+    // Ids per window. Small enough for the ids of a few thousand windows to
+    // fit a 32 bit size_t, and to stay exact as JavaScript numbers.
+    static const size_t c_tabIdBlock = 1 << 20;
+
+    // The new window is the active one
+    size_t AddWindow();
+    // Returns the tabs the window still had, in the order they were added
+    std::vector<size_t> RemoveWindow(size_t windowId);
+    // No window gets a block with ids up to maxTabId
+    void ReserveTabIds(size_t maxTabId);
+    void Activate(size_t windowId);
+
+    // Adding a tab which belongs to another window moves it
+    void AddTab(size_t windowId, size_t tabId);
+    void RemoveTab(size_t tabId);
+    // Returns false if the tab or the window doesn't exist
+    bool MoveTab(size_t tabId, size_t windowId);
+
+    size_t GetTabIdBase(size_t windowId) const { return windowId * c_tabIdBlock; }
+    size_t GetWindow(size_t tabId) const;
+    const std::vector<size_t>& GetTabs(size_t windowId) const;
+    size_t GetWindowCount() const { return m_windows.size(); }
+    // The window which was activated last, c_noWindow if there is none
+    size_t GetActiveWindow() const;
+
+private:
+    std::map<size_t, std::vector<size_t>> m_windows;  // Tabs by window
+    std::unordered_map<size_t, size_t> m_tabWindows;  // Window by tab
+    std::vector<size_t> m_activations;  // Window ids, the active one last
+    size_t m_nextWindowId = 0;
+};
@@ -6,6 +6,7 @@
 
 #include "targetver.h"
 #define WIN32_LEAN_AND_MEAN  // Exclude rarely-used stuff from Windows headers
+#define NOMINMAX  // std::min and std::max instead of the macros
 // Windows Header Files
 #include <atlstr.h>
 #include <strsafe.h>
@@ -14,15 +15,24 @@
 #include <windows.h>
 #include <wrl.h>
 // C RunTime Header Files
-#include <nlohmann/json.hpp>
 #include <malloc.h>
 #include <memory.h>
 #include <memory>
 #include <stdlib.h>
 #include <tchar.h>
+#include <deque>
+#include <list>
 #include <map>
-#include <codecvt> // codecvt_utf8
-#include <locale>  // wstring_convert
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
 
 // App specific includes
 #include "resource.h"
@@ -33,7 +43,21 @@
 #define MIN_WINDOW_HEIGHT 75
 #define MAX_LOADSTRING 256
 
+// WM_DUMP_MESSAGE_STATISTICS and WM_EXPORT_TRACE come from outside the
+// browser, a profiling script posts them to a window of the WEBVIEWBROWSERAPP
+// class to look at a running session. See "Trace the browser" in README.md.
+#define WM_FLUSH_MESSAGES (WM_APP + 1)
+#define WM_DUMP_MESSAGE_STATISTICS (WM_APP + 2)
+#define WM_EVICT_TABS (WM_APP + 3)
+#define WM_EXPORT_TRACE (WM_APP + 4)
+#define WM_REPORT_ERRORS (WM_APP + 5)
+#define WM_FAVICON_FETCHED (WM_APP + 6)
+#define WM_ACTIVATION_REQUEST (WM_APP + 7)
+#define WM_FILTER_COMPILED (WM_APP + 8)
+#define WM_CACHE_REVALIDATED (WM_APP + 9)
+
 #define INVALID_TAB_ID 0
+#define INVALID_HISTORY_ID -1
 #define MG_NAVIGATE 1
 #define MG_UPDATE_URI 2
 #define MG_GO_FORWARD 3
@@ -52,7 +76,8 @@
 #define MG_OPTIONS_LOST_FOCUS 17
 #define MG_OPTION_SELECTED 18
 #define MG_SECURITY_UPDATE 19
-#define MG_UPDATE_FAVICON 20
+// 20 is reserved: the controls UI updates a favicon under that code on its
+// own, no message between the host and the UI carries it
 #define MG_GET_SETTINGS 21
 #define MG_GET_FAVORITES 22
 #define MG_REMOVE_FAVORITE 23
@@ -61,3 +86,18 @@
 #define MG_GET_HISTORY 26
 #define MG_REMOVE_HISTORY_ITEM 27
 #define MG_CLEAR_HISTORY 28
+#define MG_BATCH 29
+#define MG_ADD_HISTORY_ITEM 30
+#define MG_UPDATE_HISTORY_ITEM 31
+#define MG_GET_SUGGESTIONS 32
+#define MG_UPDATE_FAVORITE 33
+#define MG_ERROR 34
+#define MG_PAGE_METADATA 35
+#define MG_RESTORE_SESSION 36
+#define MG_NEW_WINDOW 37
+#define MG_MOVE_TAB 38
+#define MG_OPEN_TABS 39
+#define MG_LOAD_PROGRESS 40
+#define MG_BLOCKED_COUNT 41
+#define MG_IMPORT_HISTORY 42
+#define MG_LAST MG_IMPORT_HISTORY
@@ -0,0 +1,469 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests the activation protocol over Unix sockets, which like the named pipe
+// are a byte stream: requests and replies arrive however the writes split
+// them, malformed frames are refused, and a client which closes or goes
+// silent in the middle of a frame is dropped. Also tests that ActivationQueue
+// answers every request exactly once.
+
+#include "Check.h"
+#include "ActivationProtocol.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+
+static const int c_timeout = 5000;  // Milliseconds, for reads which should succeed
+
+class SocketPair
+{
+public:
+    SocketPair()
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, m_fds) != 0)
+        {
+            std::perror("socketpair");
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    ~SocketPair()
+    {
+        CloseClient();
+        CloseServer();
+    }
+    SocketPair(const SocketPair&) = delete;
+    SocketPair& operator=(const SocketPair&) = delete;
+
+    int Client() const { return m_fds[0]; }
+    int Server() const { return m_fds[1]; }
+    void CloseClient() { Close(m_fds[0]); }
+    void CloseServer() { Close(m_fds[1]); }
+
+private:
+    int m_fds[2] = { -1, -1 };
+
+    static void Close(int& fd)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+};
+
+// Writes the bytes chunk by chunk, 0 for all at once
+static bool WriteBytes(int fd, const std::vector<BYTE>& bytes, size_t chunk = 0)
+{
+    size_t offset = 0;
+    while (offset < bytes.size())
+    {
+        size_t const size = chunk ? std::min(chunk, bytes.size() - offset) : bytes.size() - offset;
+        ssize_t const written = send(fd, bytes.data() + offset, size, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            return false;
+        }
+        offset += static_cast<size_t>(written);
+    }
+    return true;
+}
+
+// What ActivationServer::ReadFrame does with the pipe, with poll() for the
+// timeout. The reader keeps what arrived after the frame for the next one.
+static HRESULT ReadFrame(int fd, FrameReader& reader, int timeout, std::vector<BYTE>& payload)
+{
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    BYTE buffer[4096];
+    HRESULT hr;
+    while ((hr = reader.Take(payload)) == S_FALSE)
+    {
+        pollfd entry = { fd, POLLIN, 0 };
+        int ready;
+        do
+        {
+            auto const now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+            {
+                return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+            }
+            // Rounded up, poll() may wake up a little early
+            auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1);
+            ready = poll(&entry, 1, static_cast<int>(left.count()));
+        } while (ready == 0 || (ready < 0 && errno == EINTR));
+        if (ready < 0)
+        {
+            return HRESULT_FROM_WIN32(ERROR_BROKEN_PIPE);
+        }
+
+        ssize_t const read = recv(fd, buffer, sizeof(buffer), 0);
+        if (read < 0)
+        {
+            return HRESULT_FROM_WIN32(ERROR_BROKEN_PIPE);
+        }
+        if (read == 0)
+        {
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        }
+        RETURN_IF_FAILED(reader.Append(buffer, static_cast<size_t>(read)));
+    }
+    return hr;
+}
+
+static HRESULT ReadFrame(int fd, int timeout, std::vector<BYTE>& payload)
+{
+    FrameReader reader;
+    return ReadFrame(fd, reader, timeout, payload);
+}
+
+static std::vector<BYTE> EncodeRequest(const std::vector<std::wstring>& uris)
+{
+    ActivationRequest request;
+    request.uris = uris;
+    std::vector<BYTE> frame;
+    CHECK_HR(S_OK, ActivationCodec::EncodeRequest(request, frame));
+    return frame;
+}
+
+static void AppendUInt32(std::vector<BYTE>& buffer, UINT32 value)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        buffer.push_back(static_cast<BYTE>(value >> shift));
+    }
+}
+
+// The frame's payload, without the length
+static std::vector<BYTE> GetPayload(const std::vector<BYTE>& frame)
+{
+    return std::vector<BYTE>(frame.begin() + 4, frame.end());
+}
+
+// A client writes its request a byte at a time, the server answers through
+// the queue the way a window does, the client reads the reply.
+static void TestRoundTrip()
+{
+    std::vector<std::wstring> const uris = {
+        L"https://example.com/",
+        L"https://example.com/café?q=日本",
+        // U+1F600 as a surrogate pair, the code units of a Windows string
+        std::wstring(L"https://example.com/") + wchar_t(0xD83D) + wchar_t(0xDE00),
+        L"",
+    };
+
+    SocketPair sockets;
+    HRESULT clientWrite = E_FAIL;
+    HRESULT clientRead = E_FAIL;
+    ActivationReply clientReply;
+    std::thread client([&]()
+    {
+        clientWrite = WriteBytes(sockets.Client(), EncodeRequest(uris), 1) ? S_OK : E_FAIL;
+        std::vector<BYTE> payload;
+        clientRead = ReadFrame(sockets.Client(), c_timeout, payload);
+        if (SUCCEEDED(clientRead))
+        {
+            clientRead = ActivationCodec::DecodeReply(payload, clientReply);
+        }
+    });
+
+    std::vector<BYTE> payload;
+    ActivationRequest request;
+    CHECK_HR(S_OK, ReadFrame(sockets.Server(), c_timeout, payload));
+    CHECK_HR(S_OK, ActivationCodec::DecodeRequest(payload, request));
+    CHECK(request.uris == uris);
+
+    ActivationQueue queue;
+    int replies = 0;
+    queue.Submit(request, [&](const ActivationReply& reply)
+    {
+        ++replies;
+        std::vector<BYTE> frame;
+        CHECK_HR(S_OK, ActivationCodec::EncodeReply(reply, frame));
+        CHECK(WriteBytes(sockets.Server(), frame, 3));
+    });
+
+    size_t requestId = 0;
+    ActivationRequest taken;
+    CHECK(queue.Take(1, requestId, taken));
+    CHECK(taken.uris == uris);
+
+    ActivationReply reply;
+    reply.tabIds = { 7, 8, SIZE_MAX, 0 };
+    queue.Complete(requestId, reply);
+    client.join();
+
+    CHECK(replies == 1);
+    CHECK_HR(S_OK, clientWrite);
+    CHECK_HR(S_OK, clientRead);
+    CHECK_HR(S_OK, clientReply.result);
+    CHECK(clientReply.tabIds == reply.tabIds);
+}
+
+// Frames written back to back in one go, read back in chunks which straddle
+// them
+static void TestPipelinedFrames()
+{
+    std::vector<BYTE> frames;
+    ActivationRequest request;
+    for (size_t i = 0; i < 50; ++i)
+    {
+        request.uris.push_back(L"https://example.com/" + std::to_wstring(i));
+        CHECK_HR(S_OK, ActivationCodec::EncodeRequest(request, frames));
+    }
+    ActivationReply reply;
+    reply.result = HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+    CHECK_HR(S_OK, ActivationCodec::EncodeReply(reply, frames));
+
+    SocketPair sockets;
+    std::thread client([&]() { WriteBytes(sockets.Client(), frames, 97); });
+
+    FrameReader reader;
+    std::vector<BYTE> payload;
+    for (size_t i = 0; i < 50; ++i)
+    {
+        ActivationRequest decoded;
+        if (!CHECK_HR(S_OK, ReadFrame(sockets.Server(), reader, c_timeout, payload)) ||
+            !CHECK_HR(S_OK, ActivationCodec::DecodeRequest(payload, decoded)))
+        {
+            break;
+        }
+        CHECK(decoded.uris.size() == i + 1);
+        CHECK(decoded.uris.back() == L"https://example.com/" + std::to_wstring(i));
+    }
+
+    ActivationReply decoded;
+    CHECK_HR(S_OK, ReadFrame(sockets.Server(), reader, c_timeout, payload));
+    CHECK_HR(S_OK, ActivationCodec::DecodeReply(payload, decoded));
+    CHECK_HR(HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED), decoded.result);
+    CHECK(decoded.tabIds.empty());
+    client.join();
+
+    // Nothing is left over
+    CHECK_HR(S_FALSE, reader.Take(payload));
+}
+
+static void TestMalformedFrames()
+{
+    HRESULT const invalid = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+    // A length above the limit is refused as soon as it arrives, without
+    // waiting for the bytes
+    {
+        SocketPair sockets;
+        std::vector<BYTE> header;
+        AppendUInt32(header, ActivationCodec::c_maxFrameSize + 1);
+        CHECK(WriteBytes(sockets.Client(), header));
+        std::vector<BYTE> payload;
+        CHECK_HR(HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW), ReadFrame(sockets.Server(), c_timeout, payload));
+    }
+
+    std::vector<BYTE> const request = GetPayload(EncodeRequest({ L"https://example.com/" }));
+    ActivationRequest decodedRequest;
+    CHECK_HR(S_OK, ActivationCodec::DecodeRequest(request, decodedRequest));
+
+    // Every truncation of a valid request
+    for (size_t size = 0; size < request.size(); ++size)
+    {
+        std::vector<BYTE> const truncated(request.begin(), request.begin() + size);
+        CHECK_HR(invalid, ActivationCodec::DecodeRequest(truncated, decodedRequest));
+    }
+
+    std::vector<BYTE> trailing = request;
+    trailing.push_back(0);
+    CHECK_HR(invalid, ActivationCodec::DecodeRequest(trailing, decodedRequest));
+
+    std::vector<BYTE> badMagic = request;
+    badMagic[0] ^= 1;
+    CHECK_HR(invalid, ActivationCodec::DecodeRequest(badMagic, decodedRequest));
+
+    // A reply is not a request, nor the other way round
+    ActivationReply reply;
+    reply.tabIds = { 1 };
+    std::vector<BYTE> replyFrame;
+    CHECK_HR(S_OK, ActivationCodec::EncodeReply(reply, replyFrame));
+    std::vector<BYTE> const replyPayload = GetPayload(replyFrame);
+    ActivationReply decodedReply;
+    CHECK_HR(invalid, ActivationCodec::DecodeRequest(replyPayload, decodedRequest));
+    CHECK_HR(invalid, ActivationCodec::DecodeReply(request, decodedReply));
+
+    // A URI longer than what is left, and more URIs than there are
+    std::vector<BYTE> longUri;
+    AppendUInt32(longUri, ActivationCodec::c_requestMagic);
+    AppendUInt32(longUri, 1);
+    AppendUInt32(longUri, UINT32_MAX);
+    CHECK_HR(invalid, ActivationCodec::DecodeRequest(longUri, decodedRequest));
+
+    std::vector<BYTE> manyUris;
+    AppendUInt32(manyUris, ActivationCodec::c_requestMagic);
+    AppendUInt32(manyUris, UINT32_MAX);
+    AppendUInt32(manyUris, 0);
+    CHECK_HR(invalid, ActivationCodec::DecodeRequest(manyUris, decodedRequest));
+
+    // A tab count the payload can't hold is refused before anything is
+    // reserved for it
+    std::vector<BYTE> manyTabs;
+    AppendUInt32(manyTabs, ActivationCodec::c_replyMagic);
+    AppendUInt32(manyTabs, S_OK);
+    AppendUInt32(manyTabs, UINT32_MAX);
+    manyTabs.resize(manyTabs.size() + 8);
+    CHECK_HR(invalid, ActivationCodec::DecodeReply(manyTabs, decodedReply));
+
+    std::vector<BYTE> trailingReply = replyPayload;
+    trailingReply.push_back(0);
+    CHECK_HR(invalid, ActivationCodec::DecodeReply(trailingReply, decodedReply));
+
+    // URIs which aren't UTF-8
+    std::vector<BYTE> notUtf8;
+    AppendUInt32(notUtf8, ActivationCodec::c_requestMagic);
+    AppendUInt32(notUtf8, 1);
+    AppendUInt32(notUtf8, 2);
+    notUtf8.push_back(0xC3);
+    notUtf8.push_back(0x28);
+    CHECK(FAILED(ActivationCodec::DecodeRequest(notUtf8, decodedRequest)));
+}
+
+static void TestOversizedRequest()
+{
+    std::vector<BYTE> frame = EncodeRequest({ L"https://example.com/" });
+    size_t const size = frame.size();
+
+    ActivationRequest request;
+    request.uris.push_back(L"https://example.com/");
+    request.uris.push_back(std::wstring(ActivationCodec::c_maxFrameSize / 2, L'a'));
+    request.uris.push_back(std::wstring(ActivationCodec::c_maxFrameSize / 2, L'b'));
+    CHECK_HR(HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW), ActivationCodec::EncodeRequest(request, frame));
+    // The frames before it are left as they were
+    CHECK(frame.size() == size);
+
+    request.uris.pop_back();
+    CHECK_HR(S_OK, ActivationCodec::EncodeRequest(request, frame));
+}
+
+// The client goes away in the middle of its request
+static void TestClientClosesMidFrame()
+{
+    std::vector<BYTE> const frame = EncodeRequest({ L"https://example.com/" });
+    for (size_t size : { size_t(0), size_t(2), size_t(4), frame.size() - 1 })
+    {
+        SocketPair sockets;
+        CHECK(WriteBytes(sockets.Client(), std::vector<BYTE>(frame.begin(), frame.begin() + size)));
+        sockets.CloseClient();
+
+        std::vector<BYTE> payload;
+        CHECK_HR(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), ReadFrame(sockets.Server(), c_timeout, payload));
+    }
+}
+
+// A client which connects and doesn't send its whole request doesn't hold
+// up the server past the timeout
+static void TestSilentClientTimesOut()
+{
+    static const int c_shortTimeout = 100;
+
+    std::vector<BYTE> const frame = EncodeRequest({ L"https://example.com/" });
+    for (size_t size : { size_t(0), size_t(3), frame.size() - 1 })
+    {
+        SocketPair sockets;
+        CHECK(WriteBytes(sockets.Client(), std::vector<BYTE>(frame.begin(), frame.begin() + size)));
+
+        auto const start = std::chrono::steady_clock::now();
+        std::vector<BYTE> payload;
+        CHECK_HR(HRESULT_FROM_WIN32(ERROR_TIMEOUT), ReadFrame(sockets.Server(), c_shortTimeout, payload));
+        double const elapsed = SecondsSince(start);
+        CHECK(elapsed >= c_shortTimeout / 1000.0);
+        CHECK(elapsed < c_timeout / 1000.0);
+    }
+
+    // Bytes which keep trickling in don't extend it either
+    SocketPair sockets;
+    std::atomic<bool> stop(false);
+    std::thread client([&]()
+    {
+        for (size_t i = 0; i + 1 < frame.size() && !stop; ++i)
+        {
+            WriteBytes(sockets.Client(), std::vector<BYTE>(1, frame[i]));
+            std::this_thread::sleep_for(std::chrono::milliseconds(c_shortTimeout / 4));
+        }
+    });
+    std::vector<BYTE> payload;
+    CHECK_HR(HRESULT_FROM_WIN32(ERROR_TIMEOUT), ReadFrame(sockets.Server(), c_shortTimeout, payload));
+    stop = true;
+    client.join();
+}
+
+static void TestQueue()
+{
+    ActivationQueue queue;
+    std::map<size_t, std::vector<ActivationReply>> replies;  // By request id
+    auto submit = [&](const std::wstring& uri)
+    {
+        ActivationRequest request;
+        request.uris = { uri, uri };
+        auto id = std::make_shared<size_t>(0);
+        *id = queue.Submit(request, [&replies, id](const ActivationReply& reply) { replies[*id].push_back(reply); });
+        return *id;
+    };
+
+    size_t const first = submit(L"https://a.example/");
+    size_t const second = submit(L"https://b.example/");
+    size_t const third = submit(L"https://c.example/");
+    size_t const fourth = submit(L"https://d.example/");
+    CHECK(queue.GetWaitingCount() == 4);
+    CHECK(queue.GetWaitingUriCount() == 8);
+
+    // Taken in the order they arrived
+    size_t requestId = 0;
+    ActivationRequest request;
+    CHECK(queue.Take(1, requestId, request) && requestId == first && request.uris[0] == L"https://a.example/");
+    CHECK(queue.Take(2, requestId, request) && requestId == second && request.uris[0] == L"https://b.example/");
+    CHECK(queue.Take(1, requestId, request) && requestId == third && request.uris[0] == L"https://c.example/");
+    CHECK(queue.GetWaitingCount() == 1);
+    CHECK(queue.GetWaitingUriCount() == 2);
+    CHECK(queue.GetTakenCount() == 3);
+
+    ActivationReply reply;
+    reply.tabIds = { 1, 2 };
+    queue.Complete(second, reply);
+    queue.Complete(second, reply);
+    CHECK(replies[second].size() == 1 && replies[second][0].tabIds == reply.tabIds);
+
+    // Target 1 closes: its requests fail, the completions which come late
+    // are ignored
+    queue.Cancel(1, E_ABORT);
+    CHECK(queue.GetTakenCount() == 0);
+    queue.Complete(first, reply);
+    CHECK(replies[first].size() == 1 && replies[first][0].result == E_ABORT && replies[first][0].tabIds.empty());
+    CHECK(replies[third].size() == 1 && replies[third][0].result == E_ABORT);
+
+    // Shutting down answers what is still waiting
+    CHECK(queue.Take(3, requestId, request) && requestId == fourth);
+    size_t const fifth = submit(L"https://e.example/");
+    queue.CancelAll(E_UNEXPECTED);
+    CHECK(replies[fourth].size() == 1 && replies[fourth][0].result == E_UNEXPECTED);
+    CHECK(replies[fifth].size() == 1 && replies[fifth][0].result == E_UNEXPECTED);
+    CHECK(queue.GetWaitingCount() == 0 && queue.GetTakenCount() == 0);
+    CHECK(!queue.Take(1, requestId, request));
+    CHECK(replies.size() == 5);
+
+    // A reply may submit the next request
+    size_t chained = 0;
+    ActivationRequest next;
+    queue.Submit(next, [&](const ActivationReply&) { chained = queue.Submit(next, [](const ActivationReply&) {}); });
+    CHECK(queue.Take(1, requestId, request));
+    queue.Complete(requestId, reply);
+    CHECK(chained != 0 && queue.GetWaitingCount() == 1);
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestPipelinedFrames();
+    TestMalformedFrames();
+    TestOversizedRequest();
+    TestClientClosesMidFrame();
+    TestSilentClientTimesOut();
+    TestQueue();
+    return CheckResult();
+}
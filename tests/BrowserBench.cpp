@@ -0,0 +1,1514 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Runs the tab, message and history code of the browser against the fake
+// WebView2 runtime. HeadlessBrowser wires TabLoader, ControllerPool,
+// LoadScheduler, MessageQueue and the message dispatchers together the way
+// BrowserWindow does, the scenarios then play the controls UI and the pages:
+//
+//   tab_creation_storm   a list of tabs opened at once and loaded in the background
+//   navigation_fanout    pages navigating over each other, updating the controls UI
+//   broker_throughput    pages and controls UI sending the messages the host serves
+//   history_queries      the history store and the address bar suggestions
+//   tab_host_channel     the favorites page asking the host, or the controls UI through it
+//   trace_overhead       the cost of a trace span with tracing off, then on
+//
+// Without arguments the scenarios run small and their outcome is checked.
+// With --bench they run at full size and print one JSON document. Virtual
+// times add up the latencies of the fake runtime's script, host times are
+// the time spent in the browser's own code. --iterations scales the message
+// and query counts, --trace-summary <path> also writes the trace summary.
+
+#include "Check.h"
+#include "FakeWebView2.h"
+#include "BulkTransfer.h"
+#include "ControllerPool.h"
+#include "FavoritesStore.h"
+#include "HistoryStore.h"
+#include "InternalPages.h"
+#include "LoadScheduler.h"
+#include "MessageDispatcher.h"
+#include "MessageQueue.h"
+#include "SearchIndex.h"
+#include "TabLoader.h"
+#include "Trace.h"
+
+using namespace Microsoft::WRL;
+
+typedef ControllerPool<ComPtr<ICoreWebView2Controller>> HeadlessControllerPool;
+
+static HWND const c_window = reinterpret_cast<HWND>(1);
+static LONGLONG const c_day = 24 * 60 * 60 * 1000;
+static LONGLONG const c_visitInterval = 5 * 60 * 1000;
+static LONGLONG const c_firstVisit = 1700000000000LL;  // Milliseconds since 1970
+
+static std::string s_directory;
+
+static std::wstring GetPath(const char* name)
+{
+    std::string const path = s_directory + "/" + name;
+    return std::wstring(path.begin(), path.end());
+}
+
+// As if the browser was installed in /opt/wvbrowser
+static std::wstring ResolvePath(LPCWSTR relativePath)
+{
+    std::wstring path = L"/opt/wvbrowser/";
+    for (LPCWSTR c = relativePath; *c; ++c)
+    {
+        path.push_back(*c == L'\\' ? L'/' : *c);
+    }
+    return path;
+}
+
+static std::wstring PathToUri(const std::wstring& path)
+{
+    return L"file://" + path;
+}
+
+static double Sum(const std::vector<double>& values)
+{
+    double sum = 0;
+    for (double value : values)
+    {
+        sum += value;
+    }
+    return sum;
+}
+
+// The args of the MG_BATCH message MessageQueue delivers
+struct BatchMessage
+{
+    std::vector<JsonValue> messages;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"messages", self.messages);
+    }
+};
+
+// What default.js answered the favorites and settings pages with, through the
+// host, before the host answered them itself
+struct RelayedFavoritesMessage
+{
+    static const int c_message = MG_GET_FAVORITES;
+    size_t tabId = INVALID_TAB_ID;
+    std::vector<Favorite> favorites;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"favorites", self.favorites);
+    }
+};
+
+struct RelayedSettingsMessage
+{
+    static const int c_message = MG_GET_SETTINGS;
+    size_t tabId = INVALID_TAB_ID;
+    Settings settings;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+        v(L"settings", self.settings);
+    }
+};
+
+// The args of a reply the host passes on to the tab which asked
+struct RelayedReply
+{
+    size_t tabId = INVALID_TAB_ID;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"tabId", self.tabId);
+    }
+};
+
+// Creates hidden controllers for the pool, like TabControllerFactory
+class HeadlessControllerFactory : public HeadlessControllerPool::Factory
+{
+public:
+    HeadlessControllerFactory(FakeRuntime& runtime, ICoreWebView2Environment* env) :
+        m_runtime(runtime), m_env(env)
+    {
+    }
+
+    HRESULT Create(std::function<void(HRESULT, const ComPtr<ICoreWebView2Controller>&)> done) override
+    {
+        return m_env->CreateCoreWebView2Controller(c_window, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+            [done](HRESULT result, ICoreWebView2Controller* host) -> HRESULT
+        {
+            ComPtr<ICoreWebView2Controller> controller = host;
+            if (SUCCEEDED(result))
+            {
+                result = controller->put_IsVisible(FALSE);
+            }
+            done(result, controller);
+            return S_OK;
+        }).Get());
+    }
+
+    void Destroy(const ComPtr<ICoreWebView2Controller>& controller) override
+    {
+        controller->Close();
+    }
+
+    ULONGLONG GetTime() override
+    {
+        return m_runtime.GetTime();
+    }
+
+private:
+    FakeRuntime& m_runtime;
+    ICoreWebView2Environment* m_env;
+};
+
+// BrowserWindow without a window. The runtime's callbacks stand in for the
+// window messages and the pool timer, the handlers are those of BrowserWindow
+// and Tab with everything but tabs, the controls UI, the history, favorites
+// and settings left out.
+class HeadlessBrowser
+{
+public:
+    struct Options
+    {
+        size_t maxConcurrentLoads = 2;  // Tab::m_maxConcurrentLoads
+        size_t maxBatchLoads = 4;       // Tab::m_maxBatchLoads
+        size_t poolSize = 2;
+        ULONGLONG poolRefillDelay = 1000;
+        bool decodeControls = false;  // Keep what the controls UI was told, for the checks
+        // The favorites and settings pages are answered by the controls UI,
+        // through the host, instead of by the host
+        bool relayToControls = false;
+    };
+
+    struct Statistics
+    {
+        std::vector<double> handlerMicroseconds;  // One per call from the runtime
+        ULONGLONG tabEvents = 0;
+        ULONGLONG controlsMessages = 0;  // Delivered to the controls UI, batches unpacked
+        ULONGLONG relayed = 0;           // Requests the controls UI answered
+        ULONGLONG dropped = 0;           // Turned down by the dispatchers
+        ULONGLONG failures = 0;          // Handlers which failed
+    };
+
+    // What the controls UI knows about a tab
+    struct ShownTab
+    {
+        UpdateUriMessage uri;
+        std::wstring title;
+        bool loading = false;
+        bool isError = false;
+    };
+
+    HeadlessBrowser(FakeRuntime& runtime, HistoryStore& history, SearchIndex& search, const Options& options) :
+        m_runtime(runtime), m_history(history), m_search(search), m_options(options),
+        m_env(runtime.CreateEnvironment()), m_controllerFactory(runtime, m_env.Get()),
+        m_tabLoader(options.maxConcurrentLoads, [this](size_t tabId) { return CreateTabController(tabId); }),
+        m_loadScheduler(options.maxBatchLoads, [this]() { return m_runtime.GetTime(); },
+            [this](size_t tabId) { return m_tabLoader.Load(tabId, false); }),
+        m_controllerPool(m_controllerFactory, [this]() { SchedulePoolRefill(); })
+    {
+    }
+
+    ~HeadlessBrowser()
+    {
+        for (auto& tab : m_tabs)
+        {
+            if (tab.second.controller)
+            {
+                tab.second.controller->Close();
+            }
+        }
+        if (m_controlsController)
+        {
+            m_controlsController->Close();
+        }
+        m_controllerPool.SetSize(0);
+    }
+
+    // Creates the controls WebView, runs until its page asked for the session
+    // and fills the controller pool
+    HRESULT Start()
+    {
+        RETURN_IF_FAILED(m_internalPages.Initialize(ResolvePath, PathToUri));
+        RegisterMessageHandlers();
+
+        HRESULT created = E_PENDING;
+        RETURN_IF_FAILED(m_env->CreateCoreWebView2Controller(c_window, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+            [this, &created](HRESULT result, ICoreWebView2Controller* host) -> HRESULT
+        {
+            created = SUCCEEDED(result) ? InitControlsWebView(host) : result;
+            return S_OK;
+        }).Get()));
+        m_runtime.Run();
+        RETURN_IF_FAILED(created);
+        RETURN_HR_IF(E_UNEXPECTED, !m_controlsReady);
+
+        m_controllerPool.SetSize(m_options.poolSize);
+        m_runtime.Run();
+        m_statistics = Statistics();
+        return S_OK;
+    }
+
+    FakeWebView* GetControlsPage() const { return FakeRuntime::GetFake(m_controlsWebView.Get()); }
+    // Null until the tab has a controller
+    FakeWebView* GetPage(size_t tabId) const
+    {
+        auto it = m_tabs.find(tabId);
+        return it == m_tabs.end() || !it->second.webview ? nullptr : FakeRuntime::GetFake(it->second.webview.Get());
+    }
+    std::wstring GetInternalPageUri(InternalPage page) const
+    {
+        return PathToUri(m_internalPages.GetFilePath(page));
+    }
+
+    TabLoader& GetTabLoader() { return m_tabLoader; }
+    LoadScheduler& GetLoadScheduler() { return m_loadScheduler; }
+    const HeadlessControllerPool& GetControllerPool() const { return m_controllerPool; }
+    const MessageQueue& GetControlsQueue() const { return m_controlsQueue; }
+    Statistics& GetStatistics() { return m_statistics; }
+    const std::unordered_map<size_t, ShownTab>& GetShownTabs() const { return m_shownTabs; }
+    // When each tab first completed a navigation, in virtual milliseconds
+    const std::unordered_map<size_t, ULONGLONG>& GetFirstCompletions() const { return m_firstCompletions; }
+    // The answers to the address bar, in order
+    const std::vector<SuggestionsMessage>& GetSuggestions() const { return m_suggestions; }
+    // The favorites as the controls UI keeps them, which it answers with when
+    // relaying
+    void SetControlsFavorites(std::vector<Favorite> favorites) { m_controlsFavorites = std::move(favorites); }
+    const FavoritesStore& GetFavorites() const { return m_favorites; }
+    // The favorites page's fetch of its bulk URI, which ServeBulk answers
+    HRESULT TakeBulk(LPCWSTR uri, std::vector<BYTE>& buffer) { return m_bulkTransfer.Take(uri, buffer); }
+
+private:
+    struct HeadlessTab
+    {
+        std::wstring uri;  // Navigated to once the controller is attached
+        ComPtr<ICoreWebView2Controller> controller;
+        ComPtr<ICoreWebView2> webview;
+    };
+
+    // Times a call from the runtime into the browser, calls made from within
+    // it count towards the outer one
+    class HostCall
+    {
+    public:
+        explicit HostCall(HeadlessBrowser& browser) : m_browser(browser), m_outer(browser.m_callDepth++ == 0)
+        {
+            if (m_outer)
+            {
+                m_start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~HostCall()
+        {
+            --m_browser.m_callDepth;
+            if (m_outer)
+            {
+                m_browser.m_statistics.handlerMicroseconds.push_back(
+                    std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_start).count());
+            }
+        }
+
+    private:
+        HeadlessBrowser& m_browser;
+        bool m_outer;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    FakeRuntime& m_runtime;
+    HistoryStore& m_history;
+    SearchIndex& m_search;
+    Options m_options;
+    ComPtr<ICoreWebView2Environment> m_env;
+    ComPtr<ICoreWebView2Controller> m_controlsController;
+    ComPtr<ICoreWebView2> m_controlsWebView;
+    ComPtr<ICoreWebView2WebMessageReceivedEventHandler> m_uiMessageBroker;
+    InternalPages m_internalPages;
+    std::unordered_map<size_t, HeadlessTab> m_tabs;
+    size_t m_activeTabId = INVALID_TAB_ID;
+    size_t m_pendingActiveTabId = INVALID_TAB_ID;  // Shown once its controller is created
+    bool m_controlsReady = false;
+    bool m_poolTimerSet = false;
+    int m_callDepth = 0;
+
+    MessageWriter m_messageWriter;
+    MessageDispatcher m_uiDispatcher;
+    MessageDispatcher m_tabDispatcher;
+    MessageQueue m_controlsQueue{ [this]() { m_runtime.Post(0, [this]() { FlushControls(); }); } };
+    HeadlessControllerFactory m_controllerFactory;
+    TabLoader m_tabLoader;
+    LoadScheduler m_loadScheduler;
+    HeadlessControllerPool m_controllerPool;
+
+    Statistics m_statistics;
+    std::unordered_map<size_t, ShownTab> m_shownTabs;
+    std::unordered_map<size_t, ULONGLONG> m_firstCompletions;
+    std::vector<SuggestionsMessage> m_suggestions;
+
+    FavoritesStore m_favorites;
+    BulkTransfer m_bulkTransfer;
+    Settings m_settings;
+    std::vector<Favorite> m_controlsFavorites;
+    MessageWriter m_controlsWriter;  // The controls UI's replies
+
+    void CheckFailure(HRESULT hr)
+    {
+        if (FAILED(hr))
+        {
+            ++m_statistics.failures;
+        }
+    }
+
+    template<typename T> void PostMessageToControls(const T& message)
+    {
+        m_controlsQueue.Enqueue(T::c_message, GetTabId(message), m_messageWriter.Write(message));
+    }
+
+    template<typename T> HRESULT PostMessageToWebView(const T& message, ICoreWebView2* webview)
+    {
+        TRACE_SPAN(L"PostMessageToWebView", T::c_message);
+        return webview->PostWebMessageAsJson(m_messageWriter.Write(message));
+    }
+
+    // WM_FLUSH_MESSAGES
+    void FlushControls()
+    {
+        HostCall call(*this);
+        CheckFailure(m_controlsQueue.Flush(m_controlsReady ? m_controlsWebView.Get() : nullptr));
+    }
+
+    // The pool timer, which only refills while no tab is being created
+    void SchedulePoolRefill()
+    {
+        if (m_poolTimerSet)
+        {
+            return;
+        }
+        m_poolTimerSet = true;
+        m_runtime.Post(m_options.poolRefillDelay, [this]()
+        {
+            HostCall call(*this);
+            m_poolTimerSet = false;
+            if (m_tabLoader.GetInFlightCount() != 0 || m_tabLoader.GetQueuedCount() != 0)
+            {
+                SchedulePoolRefill();
+                return;
+            }
+            CheckFailure(m_controllerPool.Refill());
+        });
+    }
+
+    HRESULT InitControlsWebView(ICoreWebView2Controller* host)
+    {
+        m_controlsController = host;
+        RETURN_IF_FAILED(m_controlsController->get_CoreWebView2(&m_controlsWebView));
+
+        EventRegistrationToken token;
+        RETURN_IF_FAILED(m_controlsWebView->add_WebMessageReceived(m_uiMessageBroker.Get(), &token));
+
+        // default.js asks for the session once it's loaded
+        FakeWebView* page = GetControlsPage();
+        RETURN_IF_FAILED(m_controlsWebView->add_NavigationCompleted(Callback<ICoreWebView2NavigationCompletedEventHandler>(
+            [page](ICoreWebView2*, ICoreWebView2NavigationCompletedEventArgs*) -> HRESULT
+        {
+            page->ReceiveMessage(L"{\"message\":" + std::to_wstring(MG_RESTORE_SESSION) + L",\"args\":{}}");
+            return S_OK;
+        }).Get(), &token));
+        page->SetPageScript([this](LPCWSTR json) { ReceiveInControls(json); });
+
+        return m_controlsWebView->Navigate(PathToUri(ResolvePath(L"wvbrowser_ui\\controls_ui\\default.html")).c_str());
+    }
+
+    // The part of default.js the checks and the relayed requests look at
+    void ReceiveInControls(LPCWSTR json)
+    {
+        if (!m_options.decodeControls && !m_options.relayToControls)
+        {
+            ++m_statistics.controlsMessages;
+            return;
+        }
+
+        MessageReader reader;
+        CheckFailure(reader.Parse(json));
+        BatchMessage batch;
+        if (reader.GetMessageCode() == MG_BATCH)
+        {
+            CheckFailure(reader.ReadArgs(batch));
+        }
+        else
+        {
+            batch.messages.push_back({ json });
+        }
+
+        for (const JsonValue& message : batch.messages)
+        {
+            ++m_statistics.controlsMessages;
+            CheckFailure(reader.Parse(message.json.c_str()));
+            switch (reader.GetMessageCode())
+            {
+            case MG_UPDATE_URI:
+            {
+                UpdateUriMessage args;
+                CheckFailure(reader.ReadArgs(args));
+                m_shownTabs[args.tabId].uri = args;
+                break;
+            }
+            case MG_NAV_STARTING:
+            {
+                NavStartingMessage args;
+                CheckFailure(reader.ReadArgs(args));
+                m_shownTabs[args.tabId].loading = true;
+                break;
+            }
+            case MG_NAV_COMPLETED:
+            {
+                NavCompletedMessage args;
+                CheckFailure(reader.ReadArgs(args));
+                m_shownTabs[args.tabId].loading = false;
+                m_shownTabs[args.tabId].isError = args.isError;
+                break;
+            }
+            case MG_PAGE_METADATA:
+            {
+                PageMetadataMessage args;
+                CheckFailure(reader.ReadArgs(args));
+                m_shownTabs[args.tabId].title = args.title;
+                break;
+            }
+            case MG_GET_SUGGESTIONS:
+            {
+                SuggestionsMessage args;
+                CheckFailure(reader.ReadArgs(args));
+                m_suggestions.push_back(std::move(args));
+                break;
+            }
+            case MG_GET_FAVORITES:
+            {
+                RelayedFavoritesMessage args;
+                CheckFailure(reader.ReadArgs(args));
+                args.favorites = m_controlsFavorites;
+                ++m_statistics.relayed;
+                GetControlsPage()->ReceiveMessage(m_controlsWriter.Write(args));
+                break;
+            }
+            case MG_GET_SETTINGS:
+            {
+                RelayedSettingsMessage args;
+                CheckFailure(reader.ReadArgs(args));
+                ++m_statistics.relayed;
+                GetControlsPage()->ReceiveMessage(m_controlsWriter.Write(args));
+                break;
+            }
+            }
+        }
+    }
+
+    void RegisterMessageHandlers()
+    {
+        m_uiMessageBroker = Callback<ICoreWebView2WebMessageReceivedEventHandler>(
+            [this](ICoreWebView2* webview, ICoreWebView2WebMessageReceivedEventArgs* eventArgs) -> HRESULT
+        {
+            HostCall call(*this);
+            wil::unique_cotaskmem_string jsonString;
+            CheckFailure(eventArgs->get_WebMessageAsJson(&jsonString));
+
+            MessageReader reader;
+            if (FAILED(reader.Parse(jsonString.get())))
+            {
+                return S_OK;
+            }
+
+            MessageContext context = { reader, jsonString.get(), INVALID_TAB_ID };
+            HRESULT const hr = m_uiDispatcher.Dispatch(context, InternalPage::None);
+            m_statistics.dropped += hr == S_FALSE;
+            CheckFailure(hr);
+            return S_OK;
+        });
+
+        m_uiDispatcher.Register(MG_RESTORE_SESSION, InternalPage::None, [this](const MessageContext&) -> HRESULT
+        {
+            m_controlsReady = true;
+            RETURN_IF_FAILED(m_controlsQueue.Flush(m_controlsWebView.Get()));
+            return PostMessageToWebView(SessionMessage(), m_controlsWebView.Get());
+        });
+        m_uiDispatcher.Register<CreateTabMessage>(InternalPage::None,
+            [this](const CreateTabMessage& args, const MessageContext&) -> HRESULT
+        {
+            RETURN_HR_IF(E_INVALIDARG, args.tabId == INVALID_TAB_ID || m_tabs.count(args.tabId) != 0);
+            m_tabs[args.tabId].uri = args.uri;
+            m_tabLoader.Add(args.tabId);
+
+            if (args.batchIndex >= 0)
+            {
+                RETURN_IF_FAILED(m_loadScheduler.Add(args.tabId, args.uri, static_cast<size_t>(args.batchIndex)));
+            }
+            if (args.active)
+            {
+                RETURN_IF_FAILED(SwitchToTab(args.tabId));
+            }
+            return S_OK;
+        });
+        m_uiDispatcher.Register<SwitchTabMessage>(InternalPage::None,
+            [this](const SwitchTabMessage& args, const MessageContext&) -> HRESULT
+        {
+            return SwitchToTab(args.tabId);
+        });
+        m_uiDispatcher.Register<CloseTabMessage>(InternalPage::None,
+            [this](const CloseTabMessage& args, const MessageContext&) -> HRESULT
+        {
+            auto it = m_tabs.find(args.tabId);
+            if (it == m_tabs.end())
+            {
+                return S_OK;
+            }
+            m_tabLoader.Remove(args.tabId);
+            RETURN_IF_FAILED(m_loadScheduler.Remove(args.tabId));
+            if (it->second.controller)
+            {
+                it->second.controller->Close();
+            }
+            m_tabs.erase(it);
+            if (m_pendingActiveTabId == args.tabId)
+            {
+                m_pendingActiveTabId = INVALID_TAB_ID;
+            }
+            return S_OK;
+        });
+        m_uiDispatcher.Register<GetSuggestionsMessage>(InternalPage::None,
+            [this](const GetSuggestionsMessage& args, const MessageContext&) -> HRESULT
+        {
+            SuggestionsMessage message;
+            message.query = args.query;
+            CheckFailure(m_search.Query(args.query, message.suggestions));
+            return PostMessageToWebView(message, m_controlsWebView.Get());
+        });
+        m_uiDispatcher.Register<FavoritesMessage>(InternalPage::None,
+            [this](const FavoritesMessage& args, const MessageContext&) -> HRESULT
+        {
+            std::vector<std::wstring> removed;
+            CheckFailure(m_favorites.Replace(args.favorites, removed));
+            return S_OK;
+        });
+
+        m_tabDispatcher.RegisterForAnyPage<PageMetadataMessage>(
+            [this](const PageMetadataMessage& args, const MessageContext& context) -> HRESULT
+        {
+            TRACE_INSTANT(L"Metadata", context.tabId);
+
+            PageMetadataMessage message = args;
+            message.tabId = context.tabId;
+            PostMessageToControls(message);
+            return S_OK;
+        });
+        m_tabDispatcher.Register<GetHistoryMessage>(InternalPage::History,
+            [this](const GetHistoryMessage& args, const MessageContext& context) -> HRESULT
+        {
+            TRACE_SPAN(L"GetHistory", args.count);
+            HistoryPageMessage message;
+            message.from = args.before != 0 ? static_cast<int>(m_history.GetCountSince(args.before)) : args.from;
+            message.count = args.count;
+            message.total = static_cast<int>(m_history.GetCount());
+            if (message.from >= 0 && args.count > 0)
+            {
+                CheckFailure(m_history.GetPage(message.from, args.count, message.items));
+            }
+
+            return PostMessageToWebView(message, m_tabs.at(context.tabId).webview.Get());
+        });
+
+        if (m_options.relayToControls)
+        {
+            // The page asks the host, the host the controls UI, which answers
+            // the host, which passes the answer on to the page
+            MessageDispatcher::Handler forwardToControls = [this](const MessageContext& context) -> HRESULT
+            {
+                m_controlsQueue.Enqueue(context.reader.GetMessageCode(), context.tabId,
+                    m_messageWriter.WriteForwarded(context.reader, context.tabId));
+                return S_OK;
+            };
+            m_tabDispatcher.Register(MG_GET_FAVORITES, InternalPage::Favorites, forwardToControls);
+            m_tabDispatcher.Register(MG_GET_SETTINGS, InternalPage::Settings, forwardToControls);
+
+            std::function<HRESULT(const RelayedReply&, const MessageContext&)> replyToTab =
+                [this](const RelayedReply& args, const MessageContext& context) -> HRESULT
+            {
+                auto it = m_tabs.find(args.tabId);
+                RETURN_HR_IF(E_INVALIDARG, it == m_tabs.end() || !it->second.webview);
+                return it->second.webview->PostWebMessageAsJson(context.json);
+            };
+            m_uiDispatcher.Register<RelayedReply>(MG_GET_FAVORITES, InternalPage::None, replyToTab);
+            m_uiDispatcher.Register<RelayedReply>(MG_GET_SETTINGS, InternalPage::None, replyToTab);
+            return;
+        }
+
+        m_tabDispatcher.Register(MG_GET_FAVORITES, InternalPage::Favorites, [this](const MessageContext& context) -> HRESULT
+        {
+            FavoritesBulkMessage message;
+            message.bulk = m_bulkTransfer.Add(m_favorites.GetBulk());
+            message.count = static_cast<int>(m_favorites.GetAll().size());
+            return PostMessageToWebView(message, m_tabs.at(context.tabId).webview.Get());
+        });
+        m_tabDispatcher.Register<SettingsMessage>(InternalPage::Settings,
+            [this](const SettingsMessage&, const MessageContext& context) -> HRESULT
+        {
+            SettingsMessage message;
+            message.settings = m_settings;
+            return PostMessageToWebView(message, m_tabs.at(context.tabId).webview.Get());
+        });
+    }
+
+    HRESULT SwitchToTab(size_t tabId)
+    {
+        RETURN_IF_FAILED(m_loadScheduler.Prioritize(tabId));
+
+        size_t const previousActiveTab = m_activeTabId;
+        m_activeTabId = tabId;
+
+        HRESULT result = S_OK;
+        if (m_tabLoader.GetState(tabId) != TabState::Ready)
+        {
+            m_pendingActiveTabId = tabId;
+            result = m_tabLoader.Load(tabId, true);
+        }
+        else
+        {
+            m_pendingActiveTabId = INVALID_TAB_ID;
+            RETURN_IF_FAILED(m_tabs.at(tabId).controller->put_IsVisible(TRUE));
+        }
+
+        if (previousActiveTab != INVALID_TAB_ID && previousActiveTab != m_activeTabId)
+        {
+            auto previous = m_tabs.find(previousActiveTab);
+            if (previous != m_tabs.end() && previous->second.controller)
+            {
+                RETURN_IF_FAILED(previous->second.controller->put_IsVisible(FALSE));
+            }
+        }
+        return result;
+    }
+
+    // A pooled controller completes the tab right away
+    HRESULT CreateTabController(size_t tabId)
+    {
+        HostCall call(*this);
+        TRACE_ASYNC_BEGIN(L"Tab creation", tabId);
+
+        ComPtr<ICoreWebView2Controller> controller;
+        if (m_controllerPool.Claim(controller))
+        {
+            CheckFailure(HandleTabCreated(tabId, S_OK, controller.Get()));
+            return S_OK;
+        }
+        return m_env->CreateCoreWebView2Controller(c_window, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+            [this, tabId](HRESULT result, ICoreWebView2Controller* host) -> HRESULT
+        {
+            HostCall call(*this);
+            CheckFailure(HandleTabCreated(tabId, result, host));
+            return S_OK;
+        }).Get());
+    }
+
+    HRESULT HandleTabCreated(size_t tabId, HRESULT result, ICoreWebView2Controller* host)
+    {
+        TRACE_SPAN(L"HandleTabCreated", tabId);
+        TRACE_ASYNC_END(L"Tab creation", tabId);
+
+        if (SUCCEEDED(result) && m_tabLoader.GetState(tabId) != TabState::Creating)
+        {
+            // The tab was closed meanwhile
+            m_tabLoader.Created(tabId, false);
+            return host->Close();
+        }
+
+        if (SUCCEEDED(result))
+        {
+            result = Attach(tabId, host);
+        }
+        m_tabLoader.Created(tabId, SUCCEEDED(result));
+        if (FAILED(result))
+        {
+            if (m_pendingActiveTabId == tabId)
+            {
+                m_pendingActiveTabId = INVALID_TAB_ID;
+            }
+            if (m_loadScheduler.IsScheduled(tabId))
+            {
+                CheckFailure(m_loadScheduler.Completed(tabId, false));
+            }
+            return result;
+        }
+
+        if (tabId == m_pendingActiveTabId)
+        {
+            CheckFailure(SwitchToTab(tabId));
+        }
+        return S_OK;
+    }
+
+    // Tab::Attach with the events the controls UI depends on. A tab which
+    // fails to attach is left without a controller.
+    HRESULT Attach(size_t tabId, ICoreWebView2Controller* host)
+    {
+        HeadlessTab& tab = m_tabs.at(tabId);
+        tab.controller = host;
+        HRESULT hr = AddTabHandlers(tabId, tab.controller.Get(), tab.webview);
+        if (SUCCEEDED(hr) && !tab.uri.empty())
+        {
+            hr = tab.webview->Navigate(tab.uri.c_str());
+        }
+        if (FAILED(hr))
+        {
+            tab.controller->Close();
+            tab.webview = nullptr;
+            tab.controller = nullptr;
+        }
+        return hr;
+    }
+
+    HRESULT AddTabHandlers(size_t tabId, ICoreWebView2Controller* controller, ComPtr<ICoreWebView2>& webview)
+    {
+        RETURN_IF_FAILED(controller->get_CoreWebView2(&webview));
+        ICoreWebView2* const contentWebView = webview.Get();
+
+        EventRegistrationToken token;
+        RETURN_IF_FAILED(contentWebView->add_WebMessageReceived(Callback<ICoreWebView2WebMessageReceivedEventHandler>(
+            [this, tabId](ICoreWebView2* webview, ICoreWebView2WebMessageReceivedEventArgs* eventArgs) -> HRESULT
+        {
+            HostCall call(*this);
+            CheckFailure(HandleTabMessageReceived(tabId, webview, eventArgs));
+            return S_OK;
+        }).Get(), &token));
+        RETURN_IF_FAILED(contentWebView->add_HistoryChanged(Callback<ICoreWebView2HistoryChangedEventHandler>(
+            [this, tabId](ICoreWebView2* webview, IUnknown* args) -> HRESULT
+        {
+            HostCall call(*this);
+            ++m_statistics.tabEvents;
+            CheckFailure(HandleTabURIUpdate(tabId, webview));
+            return S_OK;
+        }).Get(), &token));
+        RETURN_IF_FAILED(contentWebView->add_SourceChanged(Callback<ICoreWebView2SourceChangedEventHandler>(
+            [this, tabId](ICoreWebView2* webview, ICoreWebView2SourceChangedEventArgs* args) -> HRESULT
+        {
+            HostCall call(*this);
+            ++m_statistics.tabEvents;
+            CheckFailure(HandleTabURIUpdate(tabId, webview));
+            return S_OK;
+        }).Get(), &token));
+        RETURN_IF_FAILED(contentWebView->add_NavigationStarting(Callback<ICoreWebView2NavigationStartingEventHandler>(
+            [this, tabId](ICoreWebView2* webview, ICoreWebView2NavigationStartingEventArgs* args) -> HRESULT
+        {
+            HostCall call(*this);
+            ++m_statistics.tabEvents;
+            CheckFailure(HandleTabNavStarting(tabId, args));
+            return S_OK;
+        }).Get(), &token));
+        RETURN_IF_FAILED(contentWebView->add_NavigationCompleted(Callback<ICoreWebView2NavigationCompletedEventHandler>(
+            [this, tabId](ICoreWebView2* webview, ICoreWebView2NavigationCompletedEventArgs* args) -> HRESULT
+        {
+            HostCall call(*this);
+            ++m_statistics.tabEvents;
+            CheckFailure(HandleTabNavCompleted(tabId, args));
+            return S_OK;
+        }).Get(), &token));
+        return S_OK;
+    }
+
+    HRESULT HandleTabURIUpdate(size_t tabId, ICoreWebView2* webview)
+    {
+        TRACE_SPAN(L"HandleTabURIUpdate", tabId);
+
+        UpdateUriMessage message;
+        wil::unique_cotaskmem_string source;
+        RETURN_IF_FAILED(webview->get_Source(&source));
+        message.tabId = tabId;
+        message.uri = source.get();
+        InternalPage const page = m_internalPages.FromUri(source.get());
+        if (page != InternalPage::None)
+        {
+            message.uriToShow = m_internalPages.GetAlias(page);
+        }
+        BOOL canGoForward = FALSE;
+        RETURN_IF_FAILED(webview->get_CanGoForward(&canGoForward));
+        message.canGoForward = !!canGoForward;
+        BOOL canGoBack = FALSE;
+        RETURN_IF_FAILED(webview->get_CanGoBack(&canGoBack));
+        message.canGoBack = !!canGoBack;
+
+        PostMessageToControls(message);
+        return S_OK;
+    }
+
+    HRESULT HandleTabNavStarting(size_t tabId, ICoreWebView2NavigationStartingEventArgs* args)
+    {
+        TRACE_SPAN(L"HandleTabNavStarting", tabId);
+        TRACE_ASYNC_BEGIN(L"Navigation", tabId);
+
+        NavStartingMessage message;
+        message.tabId = tabId;
+        PostMessageToControls(message);
+        return S_OK;
+    }
+
+    HRESULT HandleTabNavCompleted(size_t tabId, ICoreWebView2NavigationCompletedEventArgs* args)
+    {
+        TRACE_SPAN(L"HandleTabNavCompleted", tabId);
+        TRACE_ASYNC_END(L"Navigation", tabId);
+
+        BOOL navigationSucceeded = FALSE;
+        RETURN_IF_FAILED(args->get_IsSuccess(&navigationSucceeded));
+        NavCompletedMessage message;
+        message.tabId = tabId;
+        message.isError = !navigationSucceeded;
+        PostMessageToControls(message);
+        m_firstCompletions.emplace(tabId, m_runtime.GetTime());
+
+        if (m_loadScheduler.IsScheduled(tabId))
+        {
+            RETURN_IF_FAILED(m_loadScheduler.Completed(tabId, !!navigationSucceeded));
+        }
+        return S_OK;
+    }
+
+    HRESULT HandleTabMessageReceived(size_t tabId, ICoreWebView2* webview, ICoreWebView2WebMessageReceivedEventArgs* eventArgs)
+    {
+        TRACE_SPAN(L"HandleTabMessageReceived", tabId);
+
+        wil::unique_cotaskmem_string jsonArgs;
+        RETURN_IF_FAILED(eventArgs->get_WebMessageAsJson(&jsonArgs));
+
+        MessageReader reader;
+        RETURN_IF_FAILED(reader.Parse(jsonArgs.get()));
+
+        wil::unique_cotaskmem_string sender;
+        RETURN_IF_FAILED(eventArgs->get_Source(&sender));
+        wil::unique_cotaskmem_string source;
+        RETURN_IF_FAILED(webview->get_Source(&source));
+        if (wcscmp(sender.get(), source.get()) != 0)
+        {
+            ++m_statistics.dropped;
+            return S_FALSE;
+        }
+
+        MessageContext context = { reader, jsonArgs.get(), tabId };
+        HRESULT const hr = m_tabDispatcher.Dispatch(context, m_internalPages.FromUri(sender.get()));
+        m_statistics.dropped += hr == S_FALSE;
+        return hr;
+    }
+};
+
+static std::wstring GetPageUri(size_t site, size_t page)
+{
+    return L"https://site" + std::to_wstring(site) + L".example.com/articles/" + std::to_wstring(page);
+}
+
+// A visit every few minutes, spread over a few hundred sites
+static void AddVisits(HistoryStore& history, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        LONGLONG const timestamp = c_firstVisit + static_cast<LONGLONG>(i) * c_visitInterval;
+        int id = INVALID_HISTORY_ID;
+        CHECK_HR(S_OK, history.Add(GetPageUri(i % 300, i), L"Article " + std::to_wstring(i) + L" of site " + std::to_wstring(i % 300),
+            L"", timestamp, static_cast<int>(timestamp / c_day), &id));
+    }
+}
+
+// Creates the tabs the way the controls UI asks for them, the one in the
+// middle shown
+static void CreateTabs(HeadlessBrowser& browser, size_t count, size_t activeTabId, std::function<std::wstring(size_t tabId)> getUri)
+{
+    MessageWriter writer;
+    for (size_t tabId = 1; tabId <= count; ++tabId)
+    {
+        CreateTabMessage message;
+        message.tabId = tabId;
+        message.active = tabId == activeTabId;
+        message.uri = getUri(tabId);
+        message.batchIndex = static_cast<int>(tabId - 1);
+        browser.GetControlsPage()->ReceiveMessage(writer.Write(message));
+    }
+}
+
+// A list of tabs opened at once, like a restored session or a folder of
+// favorites, with every 25th page unreachable
+static void RunTabCreationStorm(size_t tabCount, bool bench)
+{
+    FakeScript script;
+    script.creationSlots = 4;
+    script.jitter = 40;
+    script.failingUri = L"unreachable";
+    FakeRuntime runtime(script);
+    HistoryStore history;
+    SearchIndex search;
+    HeadlessBrowser::Options options;
+    options.decodeControls = !bench;
+    HeadlessBrowser browser(runtime, history, search, options);
+    CHECK_HR(S_OK, browser.Start());
+
+    size_t const activeTabId = tabCount / 2;
+    auto isFailing = [activeTabId](size_t tabId) { return tabId % 25 == 0 && tabId != activeTabId; };
+    CreateTabs(browser, tabCount, activeTabId, [&isFailing](size_t tabId)
+    {
+        return GetPageUri(tabId, 0) + (isFailing(tabId) ? L"/unreachable" : L"");
+    });
+    ULONGLONG const start = runtime.GetTime();
+    runtime.Run();
+
+    std::vector<LoadScheduler::Result> const results = browser.GetLoadScheduler().TakeResults();
+    std::vector<double> waited;
+    std::vector<double> loaded;
+    ULONGLONG finished = start;
+    size_t failed = 0;
+    for (const LoadScheduler::Result& result : results)
+    {
+        waited.push_back(static_cast<double>(result.started - result.added));
+        loaded.push_back(static_cast<double>(result.finished - result.started));
+        finished = std::max(finished, result.finished);
+        failed += result.outcome != LoadScheduler::Outcome::Succeeded;
+    }
+    auto const& completions = browser.GetFirstCompletions();
+    ULONGLONG const activeShown = completions.count(activeTabId) != 0 ? completions.at(activeTabId) - start : 0;
+    HeadlessBrowser::Statistics& statistics = browser.GetStatistics();
+    const MessageQueue& controlsQueue = browser.GetControlsQueue();
+
+    if (!bench)
+    {
+        CHECK(statistics.failures == 0);
+        CHECK(results.size() == tabCount);
+        CHECK(failed == tabCount / 25);
+        // The shown tab doesn't wait for the list, at most for a creation
+        // already in flight
+        CHECK(completions.count(activeTabId) == 1);
+        CHECK(activeShown <= 2 * (script.controllerLatency + script.jitter) + script.loadLatency + script.jitter);
+        CHECK(browser.GetControllerPool().GetStatistics().hits == options.poolSize);
+        for (size_t tabId = 1; tabId <= tabCount; ++tabId)
+        {
+            CHECK(browser.GetTabLoader().GetState(tabId) == TabState::Ready);
+            auto shown = browser.GetShownTabs().find(tabId);
+            if (CHECK(shown != browser.GetShownTabs().end()))
+            {
+                CHECK(!shown->second.loading);
+                CHECK(shown->second.isError == isFailing(tabId));
+                CHECK(shown->second.uri.uri.compare(0, GetPageUri(tabId, 0).size(), GetPageUri(tabId, 0)) == 0);
+            }
+        }
+        // Refilled once the list was loaded
+        CHECK(browser.GetControllerPool().GetCount() == options.poolSize);
+        return;
+    }
+
+    std::printf("{\"scenario\":\"tab_creation_storm\",\"tabs\":%zu,\"failed\":%zu,\"all_loaded_ms\":%llu,\"active_tab_ms\":%llu,"
+        "\"wait_ms_p50\":%.0f,\"wait_ms_p90\":%.0f,\"load_ms_p50\":%.0f,\"load_ms_p90\":%.0f,\"pool_hits\":%llu,"
+        "\"host_us_per_tab\":%.3f,\"controls_batches\":%zu,\"controls_messages\":%zu,\"coalesced\":%zu}",
+        tabCount, failed, static_cast<unsigned long long>(finished - start), static_cast<unsigned long long>(activeShown),
+        Percentile(waited, 50), Percentile(waited, 90), Percentile(loaded, 50), Percentile(loaded, 90),
+        static_cast<unsigned long long>(browser.GetControllerPool().GetStatistics().hits), Sum(statistics.handlerMicroseconds) / tabCount,
+        controlsQueue.GetBatchCount(), controlsQueue.GetFlushedCount(), controlsQueue.GetCoalescedCount());
+}
+
+// Loaded tabs whose pages navigate faster than they load, so navigations
+// cancel each other and updates to the controls UI pile up between flushes
+static void RunNavigationFanout(size_t tabCount, size_t navigations, bool bench)
+{
+    FakeScript script;
+    script.jitter = 20;
+    FakeRuntime runtime(script);
+    HistoryStore history;
+    SearchIndex search;
+    HeadlessBrowser::Options options;
+    options.maxBatchLoads = tabCount;
+    options.maxConcurrentLoads = tabCount;
+    options.decodeControls = !bench;
+    HeadlessBrowser browser(runtime, history, search, options);
+    CHECK_HR(S_OK, browser.Start());
+    CreateTabs(browser, tabCount, 1, [](size_t tabId) { return GetPageUri(tabId, 0); });
+    runtime.Run();
+
+    browser.GetStatistics() = HeadlessBrowser::Statistics();
+    FakeRuntime::Statistics const before = runtime.GetStatistics();
+    const MessageQueue& controlsQueue = browser.GetControlsQueue();
+    size_t const batchesBefore = controlsQueue.GetBatchCount();
+    size_t const flushedBefore = controlsQueue.GetFlushedCount();
+    size_t const coalescedBefore = controlsQueue.GetCoalescedCount();
+
+    ULONGLONG const interval = 100;
+    for (size_t navigation = 1; navigation <= navigations; ++navigation)
+    {
+        for (size_t tabId = 1; tabId <= tabCount; ++tabId)
+        {
+            FakeWebView* page = browser.GetPage(tabId);
+            std::wstring const uri = GetPageUri(tabId, navigation);
+            runtime.Post(navigation * interval + tabId % 7, [page, uri]() { page->Navigate(uri.c_str()); });
+        }
+    }
+    auto const start = std::chrono::steady_clock::now();
+    runtime.Run();
+    double const seconds = SecondsSince(start);
+
+    FakeRuntime::Statistics const& after = runtime.GetStatistics();
+    HeadlessBrowser::Statistics& statistics = browser.GetStatistics();
+    ULONGLONG const canceled = after.navigationsCanceled - before.navigationsCanceled;
+    size_t const batches = controlsQueue.GetBatchCount() - batchesBefore;
+    size_t const flushed = controlsQueue.GetFlushedCount() - flushedBefore;
+    size_t const coalesced = controlsQueue.GetCoalescedCount() - coalescedBefore;
+
+    if (!bench)
+    {
+        CHECK(statistics.failures == 0);
+        CHECK(canceled == tabCount * (navigations - 1));
+        CHECK(coalesced > 0);
+        CHECK(batches < flushed);
+        CHECK(statistics.controlsMessages == flushed);
+        for (size_t tabId = 1; tabId <= tabCount; ++tabId)
+        {
+            const HeadlessBrowser::ShownTab& shown = browser.GetShownTabs().at(tabId);
+            CHECK(shown.uri.uri == GetPageUri(tabId, navigations));
+            CHECK(shown.uri.canGoBack);
+            CHECK(!shown.uri.canGoForward);
+            CHECK(!shown.loading);
+            CHECK(!shown.isError);
+        }
+        return;
+    }
+
+    std::printf("{\"scenario\":\"navigation_fanout\",\"tabs\":%zu,\"navigations\":%zu,\"canceled\":%llu,\"events\":%llu,"
+        "\"controls_messages\":%zu,\"coalesced\":%zu,\"batches\":%zu,\"controls_bytes\":%llu,\"host_ns_per_event\":%.1f,"
+        "\"handler_us_p50\":%.3f,\"handler_us_p99\":%.3f,\"wall_ms\":%.3f}",
+        tabCount, tabCount * navigations, static_cast<unsigned long long>(canceled), static_cast<unsigned long long>(statistics.tabEvents), flushed, coalesced, batches,
+        static_cast<unsigned long long>(after.messageBytes - before.messageBytes), Sum(statistics.handlerMicroseconds) * 1000 / std::max<ULONGLONG>(statistics.tabEvents, 1),
+        Percentile(statistics.handlerMicroseconds, 50), Percentile(statistics.handlerMicroseconds, 99), seconds * 1000);
+}
+
+// Pages reporting their metadata, the history page paging through the
+// history, web pages asking for it and being turned down, and the address
+// bar asking for suggestions, interleaved
+static void RunBrokerThroughput(size_t tabCount, size_t rounds, size_t visits, bool bench)
+{
+    FakeScript script;
+    FakeRuntime runtime(script);
+    HistoryStore history;
+    CHECK_HR(S_OK, history.Open(GetPath("broker.log").c_str()));
+    AddVisits(history, visits);
+    SearchIndex search;
+    search.AddHistory(history);
+    HeadlessBrowser::Options options;
+    options.maxBatchLoads = tabCount + 1;
+    options.maxConcurrentLoads = tabCount + 1;
+    options.decodeControls = !bench;
+    HeadlessBrowser browser(runtime, history, search, options);
+    CHECK_HR(S_OK, browser.Start());
+
+    size_t const historyTabId = tabCount + 1;
+    std::wstring const historyUri = browser.GetInternalPageUri(InternalPage::History);
+    CreateTabs(browser, historyTabId, historyTabId, [historyTabId, &historyUri](size_t tabId)
+    {
+        return tabId == historyTabId ? historyUri : GetPageUri(tabId, 0);
+    });
+    runtime.Run();
+
+    std::vector<HistoryPageMessage> pages;
+    browser.GetPage(historyTabId)->SetPageScript([&pages](LPCWSTR json)
+    {
+        MessageReader reader;
+        HistoryPageMessage page;
+        if (CHECK(SUCCEEDED(reader.Parse(json))) && CHECK(reader.GetMessageCode() == MG_GET_HISTORY))
+        {
+            CHECK_HR(S_OK, reader.ReadArgs(page));
+            pages.push_back(std::move(page));
+        }
+    });
+    browser.GetStatistics() = HeadlessBrowser::Statistics();
+
+    static LPCWSTR const c_queries[] = { L"s", L"site1", L"article", L"article 12", L"site42.example", L"nothing here" };
+    MessageWriter writer;
+    size_t sent = 0;
+    size_t rejected = 0;
+    auto const start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        for (size_t tabId = 1; tabId <= tabCount; ++tabId)
+        {
+            PageMetadataMessage metadata;
+            metadata.title = L"Article " + std::to_wstring(round) + L" of tab " + std::to_wstring(tabId);
+            metadata.favicon = L"https://site" + std::to_wstring(tabId) + L".example.com/favicon.ico";
+            metadata.canonical = GetPageUri(tabId, 0);
+            metadata.themeColor = L"#336699";
+            browser.GetPage(tabId)->ReceiveMessage(writer.Write(metadata));
+            ++sent;
+        }
+
+        GetHistoryMessage page;
+        page.from = static_cast<int>(round * 50 % history.GetCount());
+        page.count = 50;
+        browser.GetPage(historyTabId)->ReceiveMessage(writer.Write(page));
+        browser.GetPage(1 + round % tabCount)->ReceiveMessage(writer.Write(page));
+        sent += 2;
+        ++rejected;
+
+        GetSuggestionsMessage query;
+        query.query = c_queries[round % _countof(c_queries)];
+        browser.GetControlsPage()->ReceiveMessage(writer.Write(query));
+        ++sent;
+
+        // A frame apart
+        runtime.RunUntil(runtime.GetTime() + 16);
+    }
+    runtime.Run();
+    double const seconds = SecondsSince(start);
+    HeadlessBrowser::Statistics& statistics = browser.GetStatistics();
+
+    if (!bench)
+    {
+        CHECK(statistics.failures == 0);
+        CHECK(statistics.dropped == rejected);
+        CHECK(pages.size() == rounds);
+        const std::vector<SuggestionsMessage>& suggestions = browser.GetSuggestions();
+        CHECK(suggestions.size() == rounds);
+        for (const HistoryPageMessage& page : pages)
+        {
+            CHECK(page.items.size() == 50);
+            CHECK(page.total == static_cast<int>(visits));
+        }
+        CHECK(!suggestions[1].suggestions.empty());
+        CHECK(suggestions[5].suggestions.empty());
+        for (size_t tabId = 1; tabId <= tabCount; ++tabId)
+        {
+            CHECK(browser.GetShownTabs().at(tabId).title == L"Article " + std::to_wstring(rounds - 1) + L" of tab " + std::to_wstring(tabId));
+        }
+        return;
+    }
+
+    std::printf("{\"scenario\":\"broker_throughput\",\"tabs\":%zu,\"messages\":%zu,\"dropped\":%llu,\"history_entries\":%zu,"
+        "\"messages_per_s\":%.0f,\"handler_us_p50\":%.3f,\"handler_us_p90\":%.3f,\"handler_us_p99\":%.3f,\"wall_ms\":%.3f}",
+        tabCount, sent, static_cast<unsigned long long>(statistics.dropped), history.GetCount(), sent / (Sum(statistics.handlerMicroseconds) / 1e6),
+        Percentile(statistics.handlerMicroseconds, 50), Percentile(statistics.handlerMicroseconds, 90),
+        Percentile(statistics.handlerMicroseconds, 99), seconds * 1000);
+}
+
+// The history page and the address bar, without the broker in between
+static void RunHistoryQueries(size_t visits, size_t queries, bool bench)
+{
+    std::wstring const path = GetPath("history.log");
+    auto start = std::chrono::steady_clock::now();
+    {
+        HistoryStore history;
+        CHECK_HR(S_OK, history.Open(path.c_str()));
+        AddVisits(history, visits);
+    }
+    double const addSeconds = SecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    HistoryStore history;
+    CHECK_HR(S_OK, history.Open(path.c_str()));
+    double const openSeconds = SecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    SearchIndex search;
+    search.AddHistory(history);
+    double const indexSeconds = SecondsSince(start);
+
+    static LPCWSTR const c_queries[] = { L"s", L"si", L"site", L"site12", L"article 7", L"example com", L"of site 3" };
+    std::mt19937 random(1);
+    std::vector<double> pageTimes;
+    std::vector<double> sinceTimes;
+    std::vector<double> queryTimes;
+    std::vector<HistoryEntry> entries;
+    std::vector<Suggestion> suggestions;
+    for (size_t i = 0; i < queries; ++i)
+    {
+        size_t const from = random() % visits;
+        start = std::chrono::steady_clock::now();
+        CHECK_HR(S_OK, history.GetPage(from, 50, entries));
+        pageTimes.push_back(SecondsSince(start) * 1e6);
+
+        LONGLONG const before = c_firstVisit + static_cast<LONGLONG>(random() % visits) * c_visitInterval;
+        start = std::chrono::steady_clock::now();
+        size_t const since = history.GetCountSince(before);
+        sinceTimes.push_back(SecondsSince(start) * 1e6);
+        CHECK(since <= visits);
+
+        start = std::chrono::steady_clock::now();
+        CHECK_HR(S_OK, search.Query(c_queries[i % _countof(c_queries)], suggestions));
+        queryTimes.push_back(SecondsSince(start) * 1e6);
+    }
+
+    if (!bench)
+    {
+        CHECK(history.GetCount() == visits);
+        CHECK_HR(S_OK, history.GetPage(0, 3, entries));
+        if (CHECK(entries.size() == 3))
+        {
+            CHECK(entries[0].item.uri == GetPageUri((visits - 1) % 300, visits - 1));
+            CHECK(entries[0].item.timestamp > entries[1].item.timestamp);
+        }
+        CHECK(history.GetCountSince(c_firstVisit + static_cast<LONGLONG>(visits - 10) * c_visitInterval) == 10);
+        // Every word is a prefix, site12 also finds site120 to site129
+        CHECK_HR(S_OK, search.Query(L"site12.example", suggestions));
+        CHECK(suggestions.size() == SearchIndex::c_maxSuggestions);
+        for (const Suggestion& suggestion : suggestions)
+        {
+            CHECK(suggestion.uri.compare(0, 14, L"https://site12") == 0);
+        }
+        return;
+    }
+
+    std::printf("{\"scenario\":\"history_queries\",\"visits\":%zu,\"queries\":%zu,\"add_us_per_visit\":%.3f,\"open_ms\":%.3f,"
+        "\"index_ms\":%.3f,\"page_us_p50\":%.3f,\"page_us_p99\":%.3f,\"count_since_us_p50\":%.3f,\"count_since_us_p99\":%.3f,"
+        "\"query_us_p50\":%.3f,\"query_us_p99\":%.3f}",
+        visits, queries, addSeconds * 1e6 / visits, openSeconds * 1000, indexSeconds * 1000,
+        Percentile(pageTimes, 50), Percentile(pageTimes, 99), Percentile(sinceTimes, 50), Percentile(sinceTimes, 99),
+        Percentile(queryTimes, 50), Percentile(queryTimes, 99));
+}
+
+static std::vector<Favorite> MakeFavorites(size_t count)
+{
+    std::vector<Favorite> favorites(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        favorites[i].uri = GetPageUri(i, i);
+        favorites[i].uriToShow = favorites[i].uri.substr(8);
+        favorites[i].title = L"Favorite article " + std::to_wstring(i) + L" of site " + std::to_wstring(i);
+        favorites[i].favicon = L"https://site" + std::to_wstring(i) + L".example.com/favicon.ico";
+    }
+    return favorites;
+}
+
+// The favorites page asking for the favorites, answered by the host from its
+// FavoritesStore with a bulk buffer, or with relay by the controls UI through
+// the host, as it was before. The settings page asks once, a web page asking
+// for the favorites is turned down.
+static void RunTabHostChannel(size_t favoriteCount, size_t requests, bool relay, bool bench)
+{
+    FakeScript script;
+    FakeRuntime runtime(script);
+    HistoryStore history;
+    SearchIndex search;
+    HeadlessBrowser::Options options;
+    options.maxBatchLoads = 3;
+    options.maxConcurrentLoads = 3;
+    options.relayToControls = relay;
+    HeadlessBrowser browser(runtime, history, search, options);
+    CHECK_HR(S_OK, browser.Start());
+
+    // default.js reports its favorites once it's started, unless it answers
+    // for them
+    std::vector<Favorite> const favorites = MakeFavorites(favoriteCount);
+    browser.SetControlsFavorites(favorites);
+    if (!relay)
+    {
+        FavoritesMessage reported;
+        reported.favorites = favorites;
+        MessageWriter writer;
+        browser.GetControlsPage()->ReceiveMessage(writer.Write(reported));
+    }
+
+    size_t const webTabId = 1;
+    size_t const favoritesTabId = 2;
+    size_t const settingsTabId = 3;
+    std::wstring const favoritesUri = browser.GetInternalPageUri(InternalPage::Favorites);
+    std::wstring const settingsUri = browser.GetInternalPageUri(InternalPage::Settings);
+    CreateTabs(browser, 3, favoritesTabId, [&](size_t tabId)
+    {
+        return tabId == favoritesTabId ? favoritesUri : tabId == settingsTabId ? settingsUri : GetPageUri(tabId, 0);
+    });
+    runtime.Run();
+    CHECK(browser.GetFavorites().GetAll().size() == (relay ? 0 : favoriteCount));
+
+    // favorites.js, which takes the first favorite it shows from the reply
+    size_t answered = 0;
+    std::wstring firstUri;
+    std::vector<double> pageTimes;
+    std::vector<BYTE> buffer;
+    browser.GetPage(favoritesTabId)->SetPageScript([&](LPCWSTR json)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        MessageReader reader;
+        if (!CHECK(SUCCEEDED(reader.Parse(json))) || !CHECK(reader.GetMessageCode() == MG_GET_FAVORITES))
+        {
+            return;
+        }
+        if (relay)
+        {
+            RelayedFavoritesMessage message;
+            CHECK_HR(S_OK, reader.ReadArgs(message));
+            CHECK(message.favorites.size() == favoriteCount);
+            firstUri = message.favorites.empty() ? std::wstring() : message.favorites.front().uri;
+        }
+        else
+        {
+            // bulk.js checks the header and reads rows in place
+            FavoritesBulkMessage message;
+            CHECK_HR(S_OK, reader.ReadArgs(message));
+            CHECK(message.count == static_cast<int>(favoriteCount));
+            UINT32 header[2] = {};
+            if (CHECK_HR(S_OK, browser.TakeBulk(message.bulk.c_str(), buffer)) && CHECK(buffer.size() >= sizeof(header)))
+            {
+                std::memcpy(header, buffer.data(), sizeof(header));
+                CHECK(header[0] == BulkEncoder::c_magic && header[1] == favoriteCount);
+            }
+            firstUri = browser.GetFavorites().GetAll().empty() ? std::wstring() : browser.GetFavorites().GetAll().front().uri;
+        }
+        pageTimes.push_back(SecondsSince(start) * 1e6);
+        ++answered;
+    });
+    size_t settingsAnswered = 0;
+    browser.GetPage(settingsTabId)->SetPageScript([&](LPCWSTR json)
+    {
+        MessageReader reader;
+        RelayedSettingsMessage message;
+        if (CHECK(SUCCEEDED(reader.Parse(json))) && CHECK(reader.GetMessageCode() == MG_GET_SETTINGS) &&
+            CHECK_HR(S_OK, reader.ReadArgs(message)))
+        {
+            CHECK(message.settings.scriptsEnabled && message.settings.blockPopups);
+            ++settingsAnswered;
+        }
+    });
+
+    browser.GetStatistics() = HeadlessBrowser::Statistics();
+    FakeRuntime::Statistics const before = runtime.GetStatistics();
+    std::wstring const getFavorites = L"{\"message\":" + std::to_wstring(MG_GET_FAVORITES) + L",\"args\":{}}";
+    auto const start = std::chrono::steady_clock::now();
+    for (size_t request = 0; request < requests; ++request)
+    {
+        browser.GetPage(favoritesTabId)->ReceiveMessage(getFavorites);
+        runtime.Run();
+    }
+    double const seconds = SecondsSince(start);
+    FakeRuntime::Statistics const after = runtime.GetStatistics();
+    HeadlessBrowser::Statistics& statistics = browser.GetStatistics();
+    double const hostMicroseconds = Sum(statistics.handlerMicroseconds);
+    // Into the host and out of it, the relayed answer goes through it twice
+    ULONGLONG const hops = after.messagesReceived - before.messagesReceived + after.messagesPosted - before.messagesPosted;
+    ULONGLONG const bytes = after.messageBytes - before.messageBytes;
+    size_t const bulkBytes = relay ? 0 : buffer.size();
+
+    if (!bench)
+    {
+        CHECK(statistics.failures == 0);
+        CHECK(answered == requests);
+        CHECK(statistics.relayed == (relay ? requests : 0));
+        CHECK(hops == requests * (relay ? 4 : 2));
+        CHECK(firstUri == GetPageUri(0, 0));
+
+        browser.GetPage(settingsTabId)->ReceiveMessage(L"{\"message\":" + std::to_wstring(MG_GET_SETTINGS) + L",\"args\":{}}");
+        browser.GetPage(webTabId)->ReceiveMessage(getFavorites);
+        runtime.Run();
+        CHECK(settingsAnswered == 1);
+        CHECK(answered == requests);
+        CHECK(statistics.dropped == 1);
+        CHECK(statistics.failures == 0);
+        return;
+    }
+
+    std::printf("{\"scenario\":\"tab_host_channel\",\"path\":\"%s\",\"favorites\":%zu,\"requests\":%zu,"
+        "\"host_us_per_request\":%.3f,\"page_us_p50\":%.3f,\"page_us_p99\":%.3f,\"hops_per_request\":%.1f,"
+        "\"message_bytes_per_request\":%.0f,\"bulk_bytes\":%zu,\"wall_ms\":%.3f}",
+        relay ? "relayed" : "direct", favoriteCount, requests, hostMicroseconds / requests,
+        Percentile(pageTimes, 50), Percentile(pageTimes, 99), static_cast<double>(hops) / requests,
+        static_cast<double>(bytes) / requests, bulkBytes, seconds * 1000);
+}
+
+// Runs last: once tracing is on it stays on. With --trace-summary it is on
+// from the start and the cost with tracing off isn't measured.
+static void RunTraceOverhead(size_t spans, bool bench)
+{
+    double disabledSeconds = -1;
+    if (!Trace::IsEnabled())
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < spans; ++i)
+        {
+            TRACE_SPAN(L"TraceOverhead", i);
+        }
+        disabledSeconds = SecondsSince(start);
+        Trace::Enable(GetPath("trace.json").c_str());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < spans; ++i)
+    {
+        TRACE_SPAN(L"TraceOverhead", i);
+    }
+    double const enabledSeconds = SecondsSince(start);
+
+    if (!bench)
+    {
+        CHECK_HR(S_OK, Trace::Export(GetPath("overhead.json").c_str()));
+        return;
+    }
+
+    char disabled[32] = "null";
+    if (disabledSeconds >= 0)
+    {
+        std::snprintf(disabled, sizeof(disabled), "%.3f", disabledSeconds * 1e9 / spans);
+    }
+    std::printf("{\"scenario\":\"trace_overhead\",\"spans\":%zu,\"disabled_ns_per_span\":%s,\"enabled_ns_per_span\":%.3f}",
+        spans, disabled, enabledSeconds * 1e9 / spans);
+}
+
+int main(int argc, char** argv)
+{
+    char directory[] = "/tmp/BrowserBench.XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    s_directory = directory;
+
+    BenchOptions const bench = ParseBenchOptions(argc, argv, 1000);
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--trace-summary") == 0)
+        {
+            std::string const path = argv[i + 1];
+            Trace::EnableSummary(std::wstring(path.begin(), path.end()).c_str());
+        }
+    }
+
+    if (bench.enabled)
+    {
+        size_t const iterations = static_cast<size_t>(bench.iterations);
+        std::printf("{\"benchmark\":\"browser\",\"iterations\":%d,\"results\":[", bench.iterations);
+        RunTabCreationStorm(500, true);
+        std::printf(",");
+        RunNavigationFanout(50, std::max<size_t>(iterations / 50, 2), true);
+        std::printf(",");
+        RunBrokerThroughput(20, iterations, 20000, true);
+        std::printf(",");
+        RunHistoryQueries(100000, iterations * 10, true);
+        std::printf(",");
+        for (size_t favoriteCount : { 20, 200, 2000 })
+        {
+            RunTabHostChannel(favoriteCount, iterations, true, true);
+            std::printf(",");
+            RunTabHostChannel(favoriteCount, iterations, false, true);
+            std::printf(",");
+        }
+        RunTraceOverhead(iterations * 10000, true);
+        std::printf("]}\n");
+    }
+    else
+    {
+        RunTabCreationStorm(60, false);
+        RunNavigationFanout(8, 5, false);
+        RunBrokerThroughput(4, 30, 500, false);
+        RunHistoryQueries(2000, 100, false);
+        RunTabHostChannel(50, 20, true, false);
+        RunTabHostChannel(50, 20, false, false);
+        RunTraceOverhead(1000, false);
+    }
+    CHECK(SUCCEEDED(Trace::Export()));
+
+    std::string const remove = "rm -rf '" + s_directory + "'";
+    if (std::system(remove.c_str()) != 0)
+    {
+        std::fprintf(stderr, "Can't remove %s\n", s_directory.c_str());
+    }
+    return CheckResult();
+}
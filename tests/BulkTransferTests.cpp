@@ -0,0 +1,430 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests that BulkEncoder lays records out the way wvbrowser_ui/bulk.js reads
+// them: the header, the column entries and names, every section aligned to 8
+// bytes, numbers as float64 and strings as offsets into UTF-8. A reader
+// written after bulk.js reads every buffer back. BulkTransfer hands a buffer
+// out once and keeps only the most recent ones. With --bench it encodes and
+// reads lists of 10k, 100k and a million records, and the same lists as the
+// JSON reply they replaced.
+
+#include "Check.h"
+#include "BulkTransfer.h"
+#include "MessageCodec.h"
+#include "Utf.h"
+
+// The fields of a favorite and a history entry, with every type the encoder
+// takes
+struct BulkRecord
+{
+    std::wstring uri;
+    std::wstring title;
+    int visits = 0;
+    long long timestamp = 0;
+    bool pinned = false;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"uri", self.uri);
+        v(L"title", self.title);
+        v(L"visits", self.visits);
+        v(L"timestamp", self.timestamp);
+        v(L"pinned", self.pinned);
+    }
+};
+
+// The records as the JSON reply carried them
+struct BulkRecordsMessage
+{
+    static const int c_message = MG_GET_FAVORITES;
+    std::vector<BulkRecord> records;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"records", self.records);
+    }
+};
+
+static UINT32 Load32(const std::vector<BYTE>& buffer, size_t offset)
+{
+    return buffer[offset] | buffer[offset + 1] << 8 | buffer[offset + 2] << 16 | static_cast<UINT32>(buffer[offset + 3]) << 24;
+}
+
+// BulkReader of bulk.js, which also checks what bulk.js takes for granted
+class BulkReader
+{
+public:
+    struct Column
+    {
+        UINT32 type = 0;
+        std::string name;
+        size_t offset = 0;
+        size_t size = 0;
+    };
+
+    bool Open(const std::vector<BYTE>& buffer)
+    {
+        m_buffer = &buffer;
+        m_columns.clear();
+        if (buffer.size() < 16 || buffer.size() % 8 != 0 || Load32(buffer, 0) != BulkEncoder::c_magic || Load32(buffer, 12) != 0)
+        {
+            return false;
+        }
+        m_count = Load32(buffer, 4);
+        size_t const columnCount = Load32(buffer, 8);
+        size_t nameOffset = 16 + columnCount * 16;
+        size_t end = nameOffset;
+        for (size_t i = 0; i < columnCount; ++i)
+        {
+            size_t const entry = 16 + i * 16;
+            if (entry + 16 > buffer.size())
+            {
+                return false;
+            }
+            Column column;
+            column.type = Load32(buffer, entry);
+            size_t const nameLength = Load32(buffer, entry + 4);
+            column.offset = Load32(buffer, entry + 8);
+            column.size = Load32(buffer, entry + 12);
+            if (nameOffset + nameLength > buffer.size())
+            {
+                return false;
+            }
+            column.name.assign(reinterpret_cast<const char*>(buffer.data()) + nameOffset, nameLength);
+            nameOffset += nameLength;
+
+            // The sections follow each other, each at a multiple of 8
+            size_t const expectedSize = column.type == BulkEncoder::c_number ? m_count * sizeof(double) :
+                (m_count + 1) * sizeof(UINT32) + (column.size >= (m_count + 1) * sizeof(UINT32) ?
+                    column.size - (m_count + 1) * sizeof(UINT32) : 0);
+            if ((column.type != BulkEncoder::c_number && column.type != BulkEncoder::c_string) ||
+                column.offset % 8 != 0 || column.offset < std::max(end, nameOffset) ||
+                column.offset + column.size > buffer.size() || column.size != expectedSize)
+            {
+                return false;
+            }
+            end = column.offset + column.size;
+            m_columns.push_back(column);
+        }
+        if (!m_columns.empty() && m_columns.front().offset < nameOffset)
+        {
+            return false;
+        }
+        return (end + 7) / 8 * 8 == buffer.size() && CheckOffsets();
+    }
+
+    size_t GetCount() const { return m_count; }
+    const std::vector<Column>& GetColumns() const { return m_columns; }
+
+    double GetNumber(size_t index, size_t column) const
+    {
+        double value;
+        std::memcpy(&value, m_buffer->data() + m_columns[column].offset + index * sizeof(double), sizeof(value));
+        return value;
+    }
+
+    std::wstring GetString(size_t index, size_t column) const
+    {
+        size_t const data = m_columns[column].offset;
+        size_t const bytes = data + (m_count + 1) * sizeof(UINT32);
+        size_t const begin = Load32(*m_buffer, data + index * 4);
+        size_t const end = Load32(*m_buffer, data + index * 4 + 4);
+        std::wstring value;
+        CHECK_HR(S_OK, AppendUtf16(reinterpret_cast<const char*>(m_buffer->data()) + bytes + begin, end - begin, value));
+        return value;
+    }
+
+    BulkRecord Get(size_t index) const
+    {
+        BulkRecord record;
+        record.uri = GetString(index, 0);
+        record.title = GetString(index, 1);
+        record.visits = static_cast<int>(GetNumber(index, 2));
+        record.timestamp = static_cast<long long>(GetNumber(index, 3));
+        record.pinned = GetNumber(index, 4) != 0;
+        return record;
+    }
+
+private:
+    const std::vector<BYTE>* m_buffer = nullptr;
+    size_t m_count = 0;
+    std::vector<Column> m_columns;
+
+    // String offsets start at 0, never go back and end at the last byte
+    bool CheckOffsets() const
+    {
+        for (const Column& column : m_columns)
+        {
+            if (column.type != BulkEncoder::c_string)
+            {
+                continue;
+            }
+            size_t const length = column.size - (m_count + 1) * sizeof(UINT32);
+            UINT32 previous = 0;
+            for (size_t i = 0; i <= m_count; ++i)
+            {
+                UINT32 const offset = Load32(*m_buffer, column.offset + i * 4);
+                if ((i == 0 && offset != 0) || offset < previous || offset > length)
+                {
+                    return false;
+                }
+                previous = offset;
+            }
+            if (previous != length)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+static bool SameRecord(const BulkRecord& a, const BulkRecord& b)
+{
+    return a.uri == b.uri && a.title == b.title && a.visits == b.visits && a.timestamp == b.timestamp && a.pinned == b.pinned;
+}
+
+static BulkRecord MakeRecord(size_t i)
+{
+    BulkRecord record;
+    record.uri = L"https://site" + std::to_wstring(i % 300) + L".example.com/articles/" + std::to_wstring(i);
+    record.title = L"Article " + std::to_wstring(i) + L" of site " + std::to_wstring(i % 300);
+    record.visits = static_cast<int>(i % 97);
+    record.timestamp = 1700000000000LL + static_cast<long long>(i) * 60000;
+    record.pinned = i % 5 == 0;
+    return record;
+}
+
+static std::vector<BulkRecord> MakeRecords(size_t count)
+{
+    std::vector<BulkRecord> records;
+    records.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        records.push_back(MakeRecord(i));
+    }
+    return records;
+}
+
+// A column of each type
+struct Pair
+{
+    std::wstring name;
+    int n = 0;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"name", self.name);
+        v(L"n", self.n);
+    }
+};
+
+// The smallest list, byte by byte
+static void TestLayout()
+{
+    Pair pair;
+    pair.name = L"a";
+    pair.n = 1;
+
+    BulkEncoder encoder;
+    std::vector<BYTE> buffer;
+    CHECK_HR(S_OK, encoder.Encode(std::vector<Pair>({ pair }), buffer));
+
+    // Header 16, two column entries 32, names 5, padding 3, the string column
+    // 2 offsets and a byte, padding 7, the number column 8
+    if (!CHECK(buffer.size() == 80))
+    {
+        return;
+    }
+    CHECK(Load32(buffer, 0) == BulkEncoder::c_magic);
+    CHECK(Load32(buffer, 4) == 1);
+    CHECK(Load32(buffer, 8) == 2);
+    CHECK(Load32(buffer, 12) == 0);
+    CHECK(Load32(buffer, 16) == BulkEncoder::c_string && Load32(buffer, 20) == 4 && Load32(buffer, 24) == 56 && Load32(buffer, 28) == 9);
+    CHECK(Load32(buffer, 32) == BulkEncoder::c_number && Load32(buffer, 36) == 1 && Load32(buffer, 40) == 72 && Load32(buffer, 44) == 8);
+    CHECK(std::memcmp(buffer.data() + 48, "namen", 5) == 0);
+    CHECK(Load32(buffer, 56) == 0 && Load32(buffer, 60) == 1 && buffer[64] == 'a');
+    double one = 0;
+    std::memcpy(&one, buffer.data() + 72, sizeof(one));
+    CHECK(one == 1);
+    for (size_t padding : { 53, 54, 55, 65, 66, 67, 68, 69, 70, 71 })
+    {
+        CHECK(buffer[padding] == 0);
+    }
+}
+
+// Every kind of value, strings from empty to non-BMP, read back as written
+static void TestRoundTrip()
+{
+    std::vector<BulkRecord> records = MakeRecords(100);
+    records[1].uri.clear();
+    records[1].title.clear();
+    records[2].title = L"Caf\x00E9 \x4E2D\x6587 \xD83D\xDE00";
+    records[3].uri = std::wstring(70000, L'x');
+    records[4].visits = -1;
+    records[4].timestamp = (1LL << 53) - 1;
+    records[5].pinned = true;
+
+    BulkEncoder encoder;
+    std::vector<BYTE> buffer;
+    CHECK_HR(S_OK, encoder.Encode(records, buffer));
+    BulkReader reader;
+    if (!CHECK(reader.Open(buffer)) || !CHECK(reader.GetCount() == records.size()) || !CHECK(reader.GetColumns().size() == 5))
+    {
+        return;
+    }
+    static char const* const c_names[] = { "uri", "title", "visits", "timestamp", "pinned" };
+    static UINT32 const c_types[] = { BulkEncoder::c_string, BulkEncoder::c_string, BulkEncoder::c_number, BulkEncoder::c_number, BulkEncoder::c_number };
+    for (size_t i = 0; i < 5; ++i)
+    {
+        CHECK(reader.GetColumns()[i].name == c_names[i]);
+        CHECK(reader.GetColumns()[i].type == c_types[i]);
+    }
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        if (!CHECK(SameRecord(reader.Get(i), records[i])))
+        {
+            break;
+        }
+    }
+
+    // The encoder starts over for the next list
+    std::vector<BYTE> again;
+    CHECK_HR(S_OK, encoder.Encode(std::vector<BulkRecord>(records.begin(), records.begin() + 3), again));
+    CHECK(reader.Open(again) && reader.GetCount() == 3 && SameRecord(reader.Get(2), records[2]));
+}
+
+// An empty list still declares its columns, so the page can read the names
+static void TestEmpty()
+{
+    BulkEncoder encoder;
+    std::vector<BYTE> buffer;
+    CHECK_HR(S_OK, encoder.Encode(std::vector<BulkRecord>(), buffer));
+    BulkReader reader;
+    if (CHECK(reader.Open(buffer)))
+    {
+        CHECK(reader.GetCount() == 0);
+        CHECK(reader.GetColumns().size() == 5);
+        CHECK(reader.GetColumns()[0].size == sizeof(UINT32));
+        CHECK(reader.GetColumns()[2].size == 0);
+    }
+}
+
+// A buffer is taken once, unknown URIs are refused, and only the most
+// recent c_maxBuffers wait
+static void TestTransfer()
+{
+    BulkTransfer transfer;
+    std::vector<std::wstring> uris;
+    for (size_t i = 0; i < BulkTransfer::c_maxBuffers + 2; ++i)
+    {
+        uris.push_back(transfer.Add(std::vector<BYTE>(i + 1, static_cast<BYTE>(i))));
+        CHECK(uris.back().compare(0, wcslen(BulkTransfer::c_uriPrefix), BulkTransfer::c_uriPrefix) == 0);
+    }
+    CHECK(uris[0] != uris[1]);
+
+    std::vector<BYTE> buffer;
+    CHECK(FAILED(transfer.Take(uris[0].c_str(), buffer)));
+    CHECK(FAILED(transfer.Take(uris[1].c_str(), buffer)));
+    CHECK_HR(S_OK, transfer.Take(uris[5].c_str(), buffer));
+    CHECK(buffer == std::vector<BYTE>(6, 5));
+    CHECK(FAILED(transfer.Take(uris[5].c_str(), buffer)));
+    CHECK(FAILED(transfer.Take(L"https://bulk.invalid/", buffer)));
+    CHECK(FAILED(transfer.Take(L"https://example.com/2", buffer)));
+    CHECK_HR(S_OK, transfer.Take(uris.back().c_str(), buffer));
+    CHECK(buffer.size() == uris.size());
+}
+
+// Encodes and reads a list of records each way. The JSON reply is written,
+// converted to UTF-8 as it goes to the page and parsed in full, like
+// JSON.parse() did. The bulk buffer is encoded, opened and read one screen
+// of rows, then every row.
+static void RunList(size_t count, size_t rounds)
+{
+    std::vector<BulkRecord> const records = MakeRecords(count);
+    BulkRecordsMessage message;
+    message.records = records;
+
+    MessageWriter writer;
+    double jsonWriteSeconds = 0;
+    double jsonParseSeconds = 0;
+    size_t jsonBytes = 0;
+    BulkEncoder encoder;
+    double encodeSeconds = 0;
+    double openSeconds = 0;
+    double readAllSeconds = 0;
+    size_t bulkBytes = 0;
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        auto start = std::chrono::steady_clock::now();
+        LPCWSTR const json = writer.Write(message);
+        std::string utf8;
+        CHECK_HR(S_OK, AppendUtf8(json, wcslen(json), utf8));
+        jsonWriteSeconds += SecondsSince(start);
+        jsonBytes = utf8.size();
+
+        start = std::chrono::steady_clock::now();
+        std::wstring received;
+        CHECK_HR(S_OK, AppendUtf16(utf8.data(), utf8.size(), received));
+        MessageReader reader;
+        BulkRecordsMessage parsed;
+        CHECK_HR(S_OK, reader.Parse(received.c_str()));
+        CHECK_HR(S_OK, reader.ReadArgs(parsed));
+        jsonParseSeconds += SecondsSince(start);
+        CHECK(parsed.records.size() == count);
+
+        start = std::chrono::steady_clock::now();
+        std::vector<BYTE> buffer;
+        CHECK_HR(S_OK, encoder.Encode(records, buffer));
+        encodeSeconds += SecondsSince(start);
+        bulkBytes = buffer.size();
+
+        start = std::chrono::steady_clock::now();
+        BulkReader bulk;
+        CHECK(bulk.Open(buffer));
+        for (size_t i = 0; i < std::min<size_t>(50, count); ++i)
+        {
+            bulk.Get(i);
+        }
+        openSeconds += SecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+        {
+            bulk.Get(i);
+        }
+        readAllSeconds += SecondsSince(start);
+        CHECK(SameRecord(bulk.Get(count - 1), records.back()));
+    }
+
+    std::printf("{\"records\":%zu,\"json_write_ms\":%.3f,\"json_parse_ms\":%.3f,\"json_bytes\":%zu,\"bulk_encode_ms\":%.3f,"
+        "\"bulk_open_50_rows_ms\":%.3f,\"bulk_read_all_ms\":%.3f,\"bulk_bytes\":%zu}",
+        count, jsonWriteSeconds * 1000 / rounds, jsonParseSeconds * 1000 / rounds, jsonBytes, encodeSeconds * 1000 / rounds,
+        openSeconds * 1000 / rounds, readAllSeconds * 1000 / rounds, bulkBytes);
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions const bench = ParseBenchOptions(argc, argv, 1000000);
+    if (bench.enabled)
+    {
+        size_t const largest = static_cast<size_t>(bench.iterations);
+        std::printf("{\"benchmark\":\"bulk_transfer\",\"results\":[");
+        RunList(std::max<size_t>(largest / 100, 1), 10);
+        std::printf(",");
+        RunList(std::max<size_t>(largest / 10, 1), 3);
+        std::printf(",");
+        RunList(largest, 1);
+        std::printf("]}\n");
+    }
+    else
+    {
+        TestLayout();
+        TestRoundTrip();
+        TestEmpty();
+        TestTransfer();
+    }
+    return CheckResult();
+}
@@ -0,0 +1,87 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Minimal test support: CHECK records a failure and carries on, main returns
+// CheckResult(). Benchmarks share the --bench and --iterations arguments and
+// print one JSON document on stdout.
+
+inline int& CheckFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+inline bool CheckImpl(bool condition, const char* expression, const char* file, int line)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "%s(%d): CHECK(%s) failed\n", file, line, expression);
+        ++CheckFailures();
+    }
+    return condition;
+}
+
+#define CHECK(condition) CheckImpl(!!(condition), #condition, __FILE__, __LINE__)
+#define CHECK_HR(expected, expr) CheckImpl((expr) == (expected), #expr " == " #expected, __FILE__, __LINE__)
+
+inline int CheckResult()
+{
+    if (CheckFailures() != 0)
+    {
+        std::fprintf(stderr, "%d check(s) failed\n", CheckFailures());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+struct BenchOptions
+{
+    bool enabled = false;
+    int iterations = 0;
+};
+
+inline BenchOptions ParseBenchOptions(int argc, char** argv, int defaultIterations)
+{
+    BenchOptions options;
+    options.iterations = defaultIterations;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--bench") == 0)
+        {
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+        {
+            options.iterations = std::max(1, std::atoi(argv[++i]));
+        }
+    }
+    return options;
+}
+
+inline double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The value below which percent of the values lie, 0 for none
+inline double Percentile(std::vector<double> values, double percent)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t const index = static_cast<size_t>(percent / 100 * (values.size() - 1));
+    return values[index];
+}
@@ -0,0 +1,332 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests ControllerPool against a fake factory and a fake clock: the refill
+// delay, claims on an exhausted pool, failed creations, and the window
+// closing while a controller is being created.
+
+#include "Check.h"
+#include "ControllerPool.h"
+
+// The pool and a factory creating numbered controllers after a latency. The
+// refill is scheduled like BrowserWindow does it, with a timer that each
+// request re-arms.
+class Harness : public ControllerPool<int>::Factory
+{
+public:
+    Harness(ULONGLONG refillDelay, ULONGLONG latency) :
+        m_refillDelay(refillDelay), m_latency(latency),
+        m_pool(new ControllerPool<int>(*this, [this]() { m_refillAt = m_now + m_refillDelay; }))
+    {
+    }
+
+    ~Harness()
+    {
+        Close();
+    }
+
+    ControllerPool<int>& operator*() { return *m_pool; }
+    ControllerPool<int>* operator->() { return m_pool.get(); }
+
+    // Runs the timer and the creations due until now + milliseconds
+    void Advance(ULONGLONG milliseconds)
+    {
+        ULONGLONG const end = m_now + milliseconds;
+        for (;;)
+        {
+            ULONGLONG next = end + 1;
+            if (m_refillAt != 0)
+            {
+                next = std::min(next, m_refillAt);
+            }
+            if (!m_creations.empty())
+            {
+                next = std::min(next, m_creations.front().completeAt);
+            }
+            if (next > end)
+            {
+                break;
+            }
+
+            m_now = next;
+            if (m_refillAt == next)
+            {
+                m_refillAt = 0;
+                m_refillResults.push_back(m_pool->Refill());
+            }
+            else
+            {
+                Creation creation = std::move(m_creations.front());
+                m_creations.pop_front();
+                Complete(creation);
+            }
+        }
+        m_now = end;
+    }
+
+    // The window closes, creations still in flight end up in the factory
+    void Close()
+    {
+        m_pool.reset();
+        m_refillAt = 0;
+    }
+
+    // The next creations fail with hr, synchronously or when they complete
+    void FailCreate(HRESULT hr) { m_createFailures.push_back(hr); }
+    void FailCompletion(HRESULT hr) { m_completionFailures.push_back(hr); }
+
+    // A claimed controller closed with its tab
+    void Release(int controller) { Destroy(controller); }
+
+    bool IsRefillScheduled() const { return m_refillAt != 0; }
+    size_t GetCreatingCount() const { return m_creations.size(); }
+    size_t GetLiveCount() const { return m_live.size(); }
+    int GetCreatedCount() const { return m_lastController; }
+    std::vector<HRESULT> TakeRefillResults()
+    {
+        std::vector<HRESULT> results;
+        results.swap(m_refillResults);
+        return results;
+    }
+
+    HRESULT Create(std::function<void(HRESULT, const int&)> done) override
+    {
+        if (!m_createFailures.empty())
+        {
+            HRESULT const hr = m_createFailures.front();
+            m_createFailures.pop_front();
+            return hr;
+        }
+
+        Creation creation;
+        creation.completeAt = m_now + m_latency;
+        creation.result = S_OK;
+        if (!m_completionFailures.empty())
+        {
+            creation.result = m_completionFailures.front();
+            m_completionFailures.pop_front();
+        }
+        creation.done = std::move(done);
+        m_creations.push_back(std::move(creation));
+        return S_OK;
+    }
+
+    void Destroy(const int& controller) override
+    {
+        CHECK(m_live.erase(controller) == 1);
+    }
+
+    ULONGLONG GetTime() override
+    {
+        return m_now;
+    }
+
+private:
+    struct Creation
+    {
+        ULONGLONG completeAt;
+        HRESULT result;
+        std::function<void(HRESULT, const int&)> done;
+    };
+
+    ULONGLONG m_now = 1000;
+    ULONGLONG m_refillAt = 0;
+    ULONGLONG m_refillDelay;
+    ULONGLONG m_latency;
+    std::unique_ptr<ControllerPool<int>> m_pool;
+    std::deque<Creation> m_creations;
+    std::deque<HRESULT> m_createFailures;
+    std::deque<HRESULT> m_completionFailures;
+    std::vector<HRESULT> m_refillResults;
+    std::set<int> m_live;
+    int m_lastController = 0;
+
+    void Complete(Creation& creation)
+    {
+        int controller = 0;
+        if (SUCCEEDED(creation.result))
+        {
+            controller = ++m_lastController;
+            m_live.insert(controller);
+        }
+
+        // Like TabControllerFactory once the window is gone
+        if (!m_pool)
+        {
+            if (SUCCEEDED(creation.result))
+            {
+                Destroy(controller);
+            }
+            return;
+        }
+        creation.done(creation.result, controller);
+    }
+};
+
+// Nothing is created until the pool went the refill delay without a claim, one
+// controller at a time
+static void TestRefillDelay()
+{
+    Harness harness(1000, 300);
+    harness->SetSize(2);
+    CHECK(harness.IsRefillScheduled());
+    harness.Advance(999);
+    CHECK(harness.GetCreatingCount() == 0);
+    harness.Advance(1);
+    CHECK(harness.GetCreatingCount() == 1);
+    harness.Advance(299);
+    CHECK(harness->GetCount() == 0);
+    harness.Advance(1);
+    CHECK(harness->GetCount() == 1);
+    CHECK(harness.GetCreatingCount() == 0);
+    harness.Advance(1300);
+    CHECK(harness->GetCount() == 2);
+    CHECK(!harness.IsRefillScheduled());
+
+    // Each claim pushes the refill back
+    int controller = 0;
+    CHECK(harness->Claim(controller));
+    CHECK(controller == 1);
+    harness.Advance(500);
+    CHECK(harness->Claim(controller));
+    CHECK(controller == 2);
+    harness.Advance(999);
+    CHECK(harness.GetCreatingCount() == 0);
+    harness.Advance(1);
+    CHECK(harness.GetCreatingCount() == 1);
+    harness.Advance(1600);
+    CHECK(harness->GetCount() == 2);
+    CHECK(harness.TakeRefillResults() == std::vector<HRESULT>(4, S_OK));
+
+    const ControllerPool<int>::Statistics& statistics = harness->GetStatistics();
+    CHECK(statistics.claims == 2);
+    CHECK(statistics.hits == 2);
+    CHECK(statistics.created == 4);
+    CHECK(statistics.failed == 0);
+    CHECK(statistics.creationMilliseconds == 4 * 300);
+    CHECK(harness->GetSavedMilliseconds() == 2 * 300);
+
+    harness.Release(1);
+    harness.Release(2);
+    harness.Close();
+    CHECK(harness.GetLiveCount() == 0);
+}
+
+// Claims on an empty pool miss, the pool never grows over its size, and
+// shrinking it destroys the extra controllers
+static void TestExhaustion()
+{
+    Harness harness(100, 1000);
+    int controller = 0;
+    CHECK(!harness->Claim(controller));
+    CHECK(!harness.IsRefillScheduled());
+
+    harness->SetSize(1);
+    harness.Advance(1100);
+    CHECK(harness->GetCount() == 1);
+    CHECK(harness->Claim(controller));
+    CHECK(!harness->Claim(controller));
+    CHECK(!harness->Claim(controller));
+    CHECK(controller == 1);
+
+    // Claims while the creation is in flight don't start a second one
+    harness.Advance(100);
+    CHECK(harness.GetCreatingCount() == 1);
+    CHECK(!harness->Claim(controller));
+    CHECK(!harness.IsRefillScheduled());
+    harness.Advance(1000);
+    CHECK(harness->GetCount() == 1);
+    CHECK(harness.GetCreatingCount() == 0);
+
+    // Completed after the pool shrank
+    CHECK(harness->Claim(controller));
+    harness.Advance(100);
+    harness->SetSize(0);
+    harness.Advance(1000);
+    CHECK(harness->GetCount() == 0);
+    CHECK(harness.GetLiveCount() == 2);
+    CHECK(!harness.IsRefillScheduled());
+
+    harness->SetSize(3);
+    harness.Advance(3300);
+    CHECK(harness->GetCount() == 3);
+    harness->SetSize(1);
+    CHECK(harness->GetCount() == 1);
+    CHECK(harness.GetLiveCount() == 3);
+
+    const ControllerPool<int>::Statistics& statistics = harness->GetStatistics();
+    CHECK(statistics.claims == 6);
+    CHECK(statistics.hits == 2);
+    CHECK(statistics.created == 6);
+
+    harness.Release(1);
+    harness.Release(2);
+    harness.Close();
+    CHECK(harness.GetLiveCount() == 0);
+}
+
+// A failed creation leaves the pool empty but working: the next claim
+// schedules another attempt
+static void TestFailure()
+{
+    Harness harness(100, 200);
+    harness.FailCreate(E_OUTOFMEMORY);
+    harness.FailCompletion(E_FAIL);
+    harness->SetSize(2);
+    harness.Advance(100);
+    CHECK(harness.TakeRefillResults() == std::vector<HRESULT>({ E_OUTOFMEMORY }));
+    CHECK(harness->GetStatistics().failed == 1);
+    CHECK(harness.GetCreatingCount() == 0);
+    CHECK(!harness.IsRefillScheduled());
+
+    int controller = 0;
+    CHECK(!harness->Claim(controller));
+    CHECK(harness.IsRefillScheduled());
+    harness.Advance(300);
+    CHECK(harness.TakeRefillResults() == std::vector<HRESULT>({ S_OK }));
+    CHECK(harness->GetCount() == 0);
+    CHECK(harness->GetStatistics().failed == 2);
+    CHECK(!harness.IsRefillScheduled());
+
+    CHECK(!harness->Claim(controller));
+    harness.Advance(700);
+    CHECK(harness->GetCount() == 2);
+    CHECK(harness.TakeRefillResults() == std::vector<HRESULT>(2, S_OK));
+
+    const ControllerPool<int>::Statistics& statistics = harness->GetStatistics();
+    CHECK(statistics.claims == 2);
+    CHECK(statistics.hits == 0);
+    CHECK(statistics.created == 2);
+    CHECK(statistics.failed == 2);
+    CHECK(statistics.creationMilliseconds == 2 * 200);
+    CHECK(harness->GetSavedMilliseconds() == 0);
+}
+
+// Closing the window destroys the pooled controllers, and the ones still
+// being created once they complete, without calling into the pool
+static void TestClose()
+{
+    Harness harness(100, 500);
+    harness->SetSize(2);
+    harness.Advance(700);
+    CHECK(harness->GetCount() == 1);
+    CHECK(harness.GetCreatingCount() == 1);
+    CHECK(harness.GetLiveCount() == 1);
+
+    harness.Close();
+    CHECK(harness.GetLiveCount() == 0);
+    harness.Advance(1000);
+    CHECK(harness.GetCreatingCount() == 0);
+    CHECK(harness.GetCreatedCount() == 2);
+    CHECK(harness.GetLiveCount() == 0);
+}
+
+int main()
+{
+    TestRefillDelay();
+    TestExhaustion();
+    TestFailure();
+    TestClose();
+    return CheckResult();
+}
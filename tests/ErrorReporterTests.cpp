@@ -0,0 +1,223 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Stress tests ErrorReporter with errors posted from many threads at once:
+// every error posted is either in the log exactly once or counted as
+// dropped, a full queue drops and counts the overflow, and the queue works
+// again once drained.
+
+#include "Check.h"
+#include "ErrorReporter.h"
+
+#include <fstream>
+#include <thread>
+
+static size_t const c_threads = 8;
+static ULONGLONG const c_now = 1700000000000ULL;
+
+static std::string s_directory;
+
+static std::wstring GetPath(const char* name)
+{
+    std::string const path = s_directory + "/" + name;
+    return std::wstring(path.begin(), path.end());
+}
+
+// Each thread posts errors no other thread posts, so every one is reported
+// as a first occurrence or summarized as suppressed on its own
+static HRESULT GetError(size_t thread, size_t index)
+{
+    return static_cast<HRESULT>(0x80000000u | static_cast<unsigned int>(thread) << 20 | static_cast<unsigned int>(index));
+}
+
+static LPCWSTR GetSite(size_t thread)
+{
+    static LPCWSTR const c_sites[c_threads] =
+    {
+        L"Thread 0", L"Thread 1", L"Thread \"2\"", L"Thread \\3",
+        L"Thread 4", L"Thread 5", L"Thread 6", L"Thread 7",
+    };
+    return c_sites[thread];
+}
+
+struct Log
+{
+    std::map<unsigned int, ULONGLONG> counts;  // Occurrences per HRESULT
+    ULONGLONG dropped = 0;
+    size_t droppedLines = 0;
+    size_t duplicates = 0;  // First occurrences logged more than once
+    size_t malformed = 0;
+};
+
+static Log ReadLog(const std::wstring& path)
+{
+    Log log;
+    std::set<unsigned int> firsts;
+    std::ifstream stream(PortablePath(path.c_str()));
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        unsigned long long time = 0;
+        unsigned int hr = 0;
+        unsigned long long count = 0;
+        char repeat[8] = {};
+        if (std::sscanf(line.c_str(), "{\"time\":%llu,\"hr\":\"0x%8X\",\"count\":%llu,\"repeat\":%5[a-z],", &time, &hr, &count, repeat) == 4)
+        {
+            log.counts[hr] += count;
+            if (std::strcmp(repeat, "false") == 0 && !firsts.insert(hr).second)
+            {
+                ++log.duplicates;
+            }
+        }
+        else if (std::sscanf(line.c_str(), "{\"time\":%llu,\"dropped\":%llu}", &time, &count) == 2)
+        {
+            log.dropped += count;
+            ++log.droppedLines;
+        }
+        else
+        {
+            ++log.malformed;
+        }
+    }
+    return log;
+}
+
+// Posts errors first to first + perThread - 1 from each thread at once, once
+// all threads are ready
+static void Post(ErrorReporter& reporter, size_t first, size_t perThread)
+{
+    std::atomic<size_t> ready(0);
+    std::vector<std::thread> threads;
+    for (size_t thread = 0; thread < c_threads; ++thread)
+    {
+        threads.emplace_back([&reporter, &ready, thread, first, perThread]()
+        {
+            ready.fetch_add(1);
+            while (ready.load() != c_threads)
+            {
+                std::this_thread::yield();
+            }
+            for (size_t i = first; i < first + perThread; ++i)
+            {
+                reporter.Post(GetError(thread, i), GetSite(thread));
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+// One thread drains while the others post: nothing is lost or logged twice
+static void TestConcurrentDrain()
+{
+    size_t const perThread = 1000;
+    std::atomic<size_t> scheduled(0);
+    ErrorReporter reporter([]() { return c_now; }, [&scheduled]() { scheduled.fetch_add(1); });
+    std::wstring const path = GetPath("concurrent.log");
+    CHECK_HR(S_OK, reporter.OpenLog(path.c_str()));
+
+    std::atomic<bool> posting(true);
+    size_t notified = 0;
+    std::thread drainer([&]()
+    {
+        auto notify = [&notified](const ErrorReporter::Report& report)
+        {
+            CHECK(report.count == 1 && !report.isRepeat);
+            ++notified;
+        };
+        while (posting.load())
+        {
+            reporter.Drain(notify);
+        }
+        reporter.Drain(notify);
+    });
+    Post(reporter, 0, perThread);
+    posting.store(false);
+    drainer.join();
+    reporter.Flush();
+
+    ErrorReporter::Statistics const statistics = reporter.GetStatistics();
+    CHECK(statistics.posted == c_threads * perThread);
+    CHECK(scheduled.load() >= 1);
+    Log const log = ReadLog(path);
+    // The clock stands still, the burst is all that is reported right away.
+    // When the drainer fell behind, each line about the errors dropped
+    // meanwhile took one of its reports.
+    CHECK(notified <= ErrorReporter::c_burst);
+    CHECK(notified + log.droppedLines >= ErrorReporter::c_burst);
+    CHECK(statistics.dropped != 0 || notified == ErrorReporter::c_burst);
+
+    CHECK(log.malformed == 0);
+    CHECK(log.duplicates == 0);
+    CHECK(log.dropped == statistics.dropped);
+    CHECK(log.counts.size() + statistics.dropped == statistics.posted);
+    for (const auto& error : log.counts)
+    {
+        if (!CHECK(error.second == 1))
+        {
+            break;
+        }
+    }
+    CHECK(statistics.reported == log.counts.size());
+    CHECK(statistics.suppressed == log.counts.size() - notified);
+}
+
+// Without a drain the queue takes c_queueSize errors and drops the rest, and
+// the drain is scheduled once for all of them
+static void TestOverflow()
+{
+    size_t const perThread = 500;
+    std::atomic<size_t> scheduled(0);
+    ErrorReporter reporter([]() { return c_now; }, [&scheduled]() { scheduled.fetch_add(1); });
+    std::wstring const path = GetPath("overflow.log");
+    CHECK_HR(S_OK, reporter.OpenLog(path.c_str()));
+
+    Post(reporter, 0, perThread);
+    ErrorReporter::Statistics statistics = reporter.GetStatistics();
+    CHECK(statistics.posted == c_threads * perThread);
+    CHECK(statistics.dropped == c_threads * perThread - ErrorReporter::c_queueSize);
+    CHECK(scheduled.load() == 1);
+
+    size_t notified = 0;
+    reporter.Drain([&notified](const ErrorReporter::Report&) { ++notified; });
+    CHECK(notified == ErrorReporter::c_burst);
+
+    // Drained, the queue takes errors again
+    Post(reporter, perThread, 10);
+    CHECK(scheduled.load() == 2);
+    reporter.Flush();
+    statistics = reporter.GetStatistics();
+    CHECK(statistics.posted == c_threads * (perThread + 10));
+    CHECK(statistics.dropped == c_threads * perThread - ErrorReporter::c_queueSize);
+
+    Log const log = ReadLog(path);
+    CHECK(log.malformed == 0);
+    CHECK(log.duplicates == 0);
+    CHECK(log.dropped == statistics.dropped);
+    CHECK(log.counts.size() == ErrorReporter::c_queueSize + c_threads * 10);
+    CHECK(statistics.reported == log.counts.size());
+}
+
+int main()
+{
+    char directory[] = "/tmp/ErrorReporterTests.XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    s_directory = directory;
+
+    TestConcurrentDrain();
+    TestOverflow();
+
+    std::string const remove = "rm -rf '" + s_directory + "'";
+    if (std::system(remove.c_str()) != 0)
+    {
+        std::fprintf(stderr, "Can't remove %s\n", s_directory.c_str());
+    }
+    return CheckResult();
+}
@@ -0,0 +1,631 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "FakeWebView2.h"
+
+using namespace Microsoft::WRL;
+
+// What the runtime returns for calls on a closed WebView or controller
+static const HRESULT c_closed = E_NOT_VALID_STATE;
+
+static HRESULT CopyString(const std::wstring& value, LPWSTR* result)
+{
+    if (!result)
+    {
+        return E_POINTER;
+    }
+    size_t const size = (value.size() + 1) * sizeof(WCHAR);
+    *result = static_cast<LPWSTR>(CoTaskMemAlloc(size));
+    if (!*result)
+    {
+        return E_OUTOFMEMORY;
+    }
+    std::memcpy(*result, value.c_str(), size);
+    return S_OK;
+}
+
+// Event args
+
+class FakeNavigationStartingEventArgs : public RuntimeClass<ICoreWebView2NavigationStartingEventArgs>
+{
+public:
+    FakeNavigationStartingEventArgs(const std::wstring& uri, UINT64 navigationId) :
+        m_uri(uri), m_navigationId(navigationId)
+    {
+    }
+
+    bool IsCanceled() const { return m_cancel; }
+
+    HRESULT get_Uri(LPWSTR* uri) override { return CopyString(m_uri, uri); }
+    HRESULT get_IsUserInitiated(BOOL* isUserInitiated) override { *isUserInitiated = FALSE; return S_OK; }
+    HRESULT get_IsRedirected(BOOL* isRedirected) override { *isRedirected = FALSE; return S_OK; }
+    HRESULT get_Cancel(BOOL* cancel) override { *cancel = m_cancel; return S_OK; }
+    HRESULT put_Cancel(BOOL cancel) override { m_cancel = !!cancel; return S_OK; }
+    HRESULT get_NavigationId(UINT64* navigationId) override { *navigationId = m_navigationId; return S_OK; }
+
+private:
+    std::wstring m_uri;
+    UINT64 m_navigationId;
+    bool m_cancel = false;
+};
+
+class FakeSourceChangedEventArgs : public RuntimeClass<ICoreWebView2SourceChangedEventArgs>
+{
+public:
+    HRESULT get_IsNewDocument(BOOL* isNewDocument) override { *isNewDocument = TRUE; return S_OK; }
+};
+
+class FakeNavigationCompletedEventArgs : public RuntimeClass<ICoreWebView2NavigationCompletedEventArgs>
+{
+public:
+    FakeNavigationCompletedEventArgs(UINT64 navigationId, bool succeeded, COREWEBVIEW2_WEB_ERROR_STATUS status) :
+        m_navigationId(navigationId), m_succeeded(succeeded), m_status(status)
+    {
+    }
+
+    HRESULT get_IsSuccess(BOOL* isSuccess) override { *isSuccess = m_succeeded; return S_OK; }
+    HRESULT get_WebErrorStatus(COREWEBVIEW2_WEB_ERROR_STATUS* webErrorStatus) override { *webErrorStatus = m_status; return S_OK; }
+    HRESULT get_NavigationId(UINT64* navigationId) override { *navigationId = m_navigationId; return S_OK; }
+
+private:
+    UINT64 m_navigationId;
+    bool m_succeeded;
+    COREWEBVIEW2_WEB_ERROR_STATUS m_status;
+};
+
+class FakeWebMessageReceivedEventArgs : public RuntimeClass<ICoreWebView2WebMessageReceivedEventArgs>
+{
+public:
+    FakeWebMessageReceivedEventArgs(const std::wstring& source, const std::wstring& json) :
+        m_source(source), m_json(json)
+    {
+    }
+
+    HRESULT get_Source(LPWSTR* source) override { return CopyString(m_source, source); }
+    HRESULT get_WebMessageAsJson(LPWSTR* webMessageAsJson) override { return CopyString(m_json, webMessageAsJson); }
+
+    // Escapes are left as they are
+    HRESULT TryGetWebMessageAsString(LPWSTR* webMessageAsString) override
+    {
+        if (m_json.size() < 2 || m_json.front() != L'"' || m_json.back() != L'"')
+        {
+            return E_INVALIDARG;
+        }
+        return CopyString(m_json.substr(1, m_json.size() - 2), webMessageAsString);
+    }
+
+private:
+    std::wstring m_source;
+    std::wstring m_json;
+};
+
+// FakeRuntime
+
+FakeRuntime::FakeRuntime(const FakeScript& script) :
+    m_script(script), m_random(script.seed)
+{
+}
+
+// The callbacks hold on to WebViews, which report to the runtime when they
+// go away
+FakeRuntime::~FakeRuntime()
+{
+    while (!m_callbacks.empty())
+    {
+        m_callbacks.pop();
+    }
+    m_waitingCreations.clear();
+}
+
+ComPtr<ICoreWebView2Environment> FakeRuntime::CreateEnvironment()
+{
+    return Make<FakeEnvironment>(*this);
+}
+
+FakeWebView* FakeRuntime::GetFake(ICoreWebView2* webview)
+{
+    return static_cast<FakeWebView*>(webview);
+}
+
+void FakeRuntime::Post(ULONGLONG delay, std::function<void()> f)
+{
+    m_callbacks.push({ m_now + delay, m_nextSequence++, std::move(f) });
+}
+
+size_t FakeRuntime::RunUntil(ULONGLONG time)
+{
+    size_t count = 0;
+    while (!m_callbacks.empty() && m_callbacks.top().time <= time)
+    {
+        // The order only depends on time and sequence, which moving keeps
+        Callback callback = std::move(const_cast<Callback&>(m_callbacks.top()));
+        m_callbacks.pop();
+        m_now = std::max(m_now, callback.time);
+        callback.f();
+        ++count;
+    }
+    if (time != ULLONG_MAX)
+    {
+        m_now = std::max(m_now, time);
+    }
+    m_statistics.callbacks += count;
+    return count;
+}
+
+ULONGLONG FakeRuntime::GetLatency(ULONGLONG latency)
+{
+    if (m_script.jitter == 0)
+    {
+        return latency;
+    }
+    return latency + std::uniform_int_distribution<ULONGLONG>(0, m_script.jitter)(m_random);
+}
+
+bool FakeRuntime::Fails(double rate)
+{
+    return rate > 0 && std::uniform_real_distribution<double>(0, 1)(m_random) < rate;
+}
+
+void FakeRuntime::CreateController(ComPtr<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler> handler, HWND parentWindow)
+{
+    Creation creation = { std::move(handler), parentWindow };
+    if (m_script.creationSlots != 0 && m_creating >= m_script.creationSlots)
+    {
+        m_waitingCreations.push_back(std::move(creation));
+        return;
+    }
+    StartCreation(std::move(creation));
+}
+
+// The next waiting creation starts before the handler runs, creations the
+// handler asks for line up behind it
+void FakeRuntime::StartCreation(Creation creation)
+{
+    ++m_creating;
+    bool const fails = Fails(m_script.controllerFailureRate);
+    Post(GetLatency(m_script.controllerLatency), [this, creation, fails]()
+    {
+        --m_creating;
+        if (!m_waitingCreations.empty() && (m_script.creationSlots == 0 || m_creating < m_script.creationSlots))
+        {
+            Creation next = std::move(m_waitingCreations.front());
+            m_waitingCreations.pop_front();
+            StartCreation(std::move(next));
+        }
+
+        if (fails)
+        {
+            ++m_statistics.controllerFailures;
+            creation.handler->Invoke(E_FAIL, nullptr);
+            return;
+        }
+        ++m_statistics.controllersCreated;
+        ComPtr<FakeController> controller = Make<FakeController>(*this, creation.parentWindow);
+        creation.handler->Invoke(S_OK, controller.Get());
+    });
+}
+
+// FakeWebView
+
+FakeWebView::FakeWebView(FakeRuntime& runtime) :
+    m_runtime(runtime)
+{
+    m_runtime.ObjectCreated();
+}
+
+FakeWebView::~FakeWebView()
+{
+    m_runtime.ObjectDestroyed();
+}
+
+void FakeWebView::ReceiveMessage(const std::wstring& json, ULONGLONG delay)
+{
+    ComPtr<FakeWebView> self(this);
+    std::wstring const source = m_source;
+    m_runtime.Post(delay, [self, source, json]()
+    {
+        if (self->m_closed)
+        {
+            return;
+        }
+        ++self->m_runtime.GetStatistics().messagesReceived;
+        ComPtr<FakeWebMessageReceivedEventArgs> args = Make<FakeWebMessageReceivedEventArgs>(source, json);
+        self->m_runtime.GetStatistics().eventsRaised += self->m_webMessageReceived.Raise(self.Get(), args.Get());
+    });
+}
+
+void FakeWebView::Close()
+{
+    Cancel();
+    m_closed = true;
+    m_pageScript = nullptr;
+    m_navigationStarting.Clear();
+    m_sourceChanged.Clear();
+    m_historyChanged.Clear();
+    m_navigationCompleted.Clear();
+    m_webMessageReceived.Clear();
+}
+
+HRESULT FakeWebView::Navigate(LPCWSTR uri)
+{
+    if (m_closed)
+    {
+        return c_closed;
+    }
+    if (!uri || !*uri)
+    {
+        return E_INVALIDARG;
+    }
+    return StartNavigation(uri, SIZE_MAX);
+}
+
+HRESULT FakeWebView::get_Source(LPWSTR* uri)
+{
+    return CopyString(m_source, uri);
+}
+
+HRESULT FakeWebView::Reload()
+{
+    if (m_closed)
+    {
+        return c_closed;
+    }
+    return StartNavigation(m_source, m_historyIndex);
+}
+
+HRESULT FakeWebView::Stop()
+{
+    Cancel();
+    return S_OK;
+}
+
+HRESULT FakeWebView::GoBack()
+{
+    if (m_closed)
+    {
+        return c_closed;
+    }
+    if (m_historyIndex == 0)
+    {
+        return S_OK;
+    }
+    return StartNavigation(m_history[m_historyIndex - 1], m_historyIndex - 1);
+}
+
+HRESULT FakeWebView::GoForward()
+{
+    if (m_closed)
+    {
+        return c_closed;
+    }
+    if (m_historyIndex + 1 >= m_history.size())
+    {
+        return S_OK;
+    }
+    return StartNavigation(m_history[m_historyIndex + 1], m_historyIndex + 1);
+}
+
+HRESULT FakeWebView::get_CanGoBack(BOOL* canGoBack)
+{
+    *canGoBack = m_historyIndex > 0;
+    return S_OK;
+}
+
+HRESULT FakeWebView::get_CanGoForward(BOOL* canGoForward)
+{
+    *canGoForward = m_historyIndex + 1 < m_history.size();
+    return S_OK;
+}
+
+HRESULT FakeWebView::get_DocumentTitle(LPWSTR* title)
+{
+    return CopyString(m_title, title);
+}
+
+// The page gets the message asynchronously, like from another process
+HRESULT FakeWebView::PostWebMessageAsJson(LPCWSTR webMessageAsJson)
+{
+    if (m_closed)
+    {
+        return c_closed;
+    }
+    size_t const length = wcslen(webMessageAsJson);
+    ++m_runtime.GetStatistics().messagesPosted;
+    m_runtime.GetStatistics().messageBytes += length * sizeof(char16_t);
+    if (m_pageScript)
+    {
+        ComPtr<FakeWebView> self(this);
+        std::wstring message(webMessageAsJson, length);
+        m_runtime.Post(0, [self, message]()
+        {
+            if (self->m_pageScript)
+            {
+                self->m_pageScript(message.c_str());
+            }
+        });
+    }
+    return S_OK;
+}
+
+HRESULT FakeWebView::PostWebMessageAsString(LPCWSTR webMessageAsString)
+{
+    return PostWebMessageAsJson((L"\"" + std::wstring(webMessageAsString) + L"\"").c_str());
+}
+
+HRESULT FakeWebView::add_NavigationStarting(ICoreWebView2NavigationStartingEventHandler* eventHandler, EventRegistrationToken* token)
+{
+    return m_closed ? c_closed : m_navigationStarting.Add(eventHandler, token);
+}
+
+HRESULT FakeWebView::remove_NavigationStarting(EventRegistrationToken token)
+{
+    return m_navigationStarting.Remove(token);
+}
+
+HRESULT FakeWebView::add_SourceChanged(ICoreWebView2SourceChangedEventHandler* eventHandler, EventRegistrationToken* token)
+{
+    return m_closed ? c_closed : m_sourceChanged.Add(eventHandler, token);
+}
+
+HRESULT FakeWebView::remove_SourceChanged(EventRegistrationToken token)
+{
+    return m_sourceChanged.Remove(token);
+}
+
+HRESULT FakeWebView::add_HistoryChanged(ICoreWebView2HistoryChangedEventHandler* eventHandler, EventRegistrationToken* token)
+{
+    return m_closed ? c_closed : m_historyChanged.Add(eventHandler, token);
+}
+
+HRESULT FakeWebView::remove_HistoryChanged(EventRegistrationToken token)
+{
+    return m_historyChanged.Remove(token);
+}
+
+HRESULT FakeWebView::add_NavigationCompleted(ICoreWebView2NavigationCompletedEventHandler* eventHandler, EventRegistrationToken* token)
+{
+    return m_closed ? c_closed : m_navigationCompleted.Add(eventHandler, token);
+}
+
+HRESULT FakeWebView::remove_NavigationCompleted(EventRegistrationToken token)
+{
+    return m_navigationCompleted.Remove(token);
+}
+
+HRESULT FakeWebView::add_WebMessageReceived(ICoreWebView2WebMessageReceivedEventHandler* handler, EventRegistrationToken* token)
+{
+    return m_closed ? c_closed : m_webMessageReceived.Add(handler, token);
+}
+
+HRESULT FakeWebView::remove_WebMessageReceived(EventRegistrationToken token)
+{
+    return m_webMessageReceived.Remove(token);
+}
+
+HRESULT FakeWebView::StartNavigation(const std::wstring& uri, size_t historyIndex)
+{
+    Cancel();
+
+    UINT64 const navigationId = ++m_lastNavigationId;
+    m_pending = navigationId;
+    ++m_runtime.GetStatistics().navigations;
+
+    const FakeScript& script = m_runtime.GetScript();
+    bool const fails = (!script.failingUri.empty() && uri.find(script.failingUri) != std::wstring::npos) ||
+        m_runtime.Fails(script.navigationFailureRate);
+    ULONGLONG const commit = m_runtime.GetLatency(script.commitLatency);
+    ULONGLONG const load = std::max(commit, m_runtime.GetLatency(script.loadLatency));
+
+    ComPtr<FakeWebView> self(this);
+    m_runtime.Post(0, [self, navigationId, uri, historyIndex, commit, load, fails]()
+    {
+        if (self->m_pending != navigationId)
+        {
+            return;
+        }
+        ComPtr<FakeNavigationStartingEventArgs> args = Make<FakeNavigationStartingEventArgs>(uri, navigationId);
+        self->m_runtime.GetStatistics().eventsRaised += self->m_navigationStarting.Raise(self.Get(), args.Get());
+
+        // A handler may have started another navigation, or stopped this one
+        if (self->m_pending != navigationId)
+        {
+            return;
+        }
+        if (args->IsCanceled())
+        {
+            ++self->m_runtime.GetStatistics().navigationsCanceled;
+            self->Complete(navigationId, false, COREWEBVIEW2_WEB_ERROR_STATUS_OPERATION_CANCELED);
+            return;
+        }
+
+        self->m_runtime.Post(commit, [self, navigationId, uri, historyIndex]()
+        {
+            self->Commit(navigationId, uri, historyIndex);
+        });
+        self->m_runtime.Post(load, [self, navigationId, fails]()
+        {
+            if (fails && self->m_pending == navigationId)
+            {
+                ++self->m_runtime.GetStatistics().navigationFailures;
+            }
+            self->Complete(navigationId, !fails, fails ? COREWEBVIEW2_WEB_ERROR_STATUS_CONNECTION_ABORTED : COREWEBVIEW2_WEB_ERROR_STATUS_UNKNOWN);
+        });
+    });
+    return S_OK;
+}
+
+// A failed navigation commits too, to the error page
+void FakeWebView::Commit(UINT64 navigationId, const std::wstring& uri, size_t historyIndex)
+{
+    if (m_pending != navigationId)
+    {
+        return;
+    }
+
+    m_source = uri;
+    m_title.clear();
+    if (historyIndex < m_history.size())
+    {
+        m_history[historyIndex] = uri;
+        m_historyIndex = historyIndex;
+    }
+    else
+    {
+        m_history.resize(m_historyIndex + 1);
+        m_history.push_back(uri);
+        m_historyIndex = m_history.size() - 1;
+    }
+
+    ComPtr<FakeSourceChangedEventArgs> args = Make<FakeSourceChangedEventArgs>();
+    FakeRuntime::Statistics& statistics = m_runtime.GetStatistics();
+    statistics.eventsRaised += m_sourceChanged.Raise(this, args.Get());
+    if (m_pending == navigationId)
+    {
+        statistics.eventsRaised += m_historyChanged.Raise(this, static_cast<IUnknown*>(nullptr));
+    }
+}
+
+void FakeWebView::Complete(UINT64 navigationId, bool succeeded, COREWEBVIEW2_WEB_ERROR_STATUS status)
+{
+    if (m_pending != navigationId)
+    {
+        return;
+    }
+
+    m_pending = 0;
+    RaiseCompleted(navigationId, succeeded, status);
+}
+
+void FakeWebView::RaiseCompleted(UINT64 navigationId, bool succeeded, COREWEBVIEW2_WEB_ERROR_STATUS status)
+{
+    ComPtr<FakeNavigationCompletedEventArgs> args = Make<FakeNavigationCompletedEventArgs>(navigationId, succeeded, status);
+    m_runtime.GetStatistics().eventsRaised += m_navigationCompleted.Raise(this, args.Get());
+}
+
+// The canceled navigation completes after the call which canceled it
+void FakeWebView::Cancel()
+{
+    if (m_pending == 0)
+    {
+        return;
+    }
+
+    UINT64 const navigationId = m_pending;
+    m_pending = 0;
+    ++m_runtime.GetStatistics().navigationsCanceled;
+    if (m_closed)
+    {
+        return;
+    }
+
+    ComPtr<FakeWebView> self(this);
+    m_runtime.Post(0, [self, navigationId]()
+    {
+        if (!self->m_closed)
+        {
+            self->RaiseCompleted(navigationId, false, COREWEBVIEW2_WEB_ERROR_STATUS_OPERATION_CANCELED);
+        }
+    });
+}
+
+// FakeController
+
+FakeController::FakeController(FakeRuntime& runtime, HWND parentWindow) :
+    m_runtime(runtime), m_webview(Make<FakeWebView>(runtime)), m_parentWindow(parentWindow)
+{
+    m_runtime.ObjectCreated();
+}
+
+FakeController::~FakeController()
+{
+    m_runtime.ObjectDestroyed();
+}
+
+HRESULT FakeController::get_IsVisible(BOOL* isVisible)
+{
+    *isVisible = m_visible;
+    return S_OK;
+}
+
+HRESULT FakeController::put_IsVisible(BOOL isVisible)
+{
+    if (m_closed)
+    {
+        return c_closed;
+    }
+    m_visible = !!isVisible;
+    return S_OK;
+}
+
+HRESULT FakeController::get_Bounds(RECT* bounds)
+{
+    *bounds = m_bounds;
+    return S_OK;
+}
+
+HRESULT FakeController::put_Bounds(RECT bounds)
+{
+    if (m_closed)
+    {
+        return c_closed;
+    }
+    m_bounds = bounds;
+    return S_OK;
+}
+
+HRESULT FakeController::get_ParentWindow(HWND* parentWindow)
+{
+    *parentWindow = m_parentWindow;
+    return S_OK;
+}
+
+HRESULT FakeController::put_ParentWindow(HWND parentWindow)
+{
+    if (m_closed)
+    {
+        return c_closed;
+    }
+    m_parentWindow = parentWindow;
+    return S_OK;
+}
+
+HRESULT FakeController::Close()
+{
+    if (m_closed)
+    {
+        return S_OK;
+    }
+    m_closed = true;
+    m_webview->Close();
+    ++m_runtime.GetStatistics().controllersClosed;
+    return S_OK;
+}
+
+HRESULT FakeController::get_CoreWebView2(ICoreWebView2** coreWebView2)
+{
+    if (m_closed)
+    {
+        *coreWebView2 = nullptr;
+        return c_closed;
+    }
+    *coreWebView2 = m_webview.Get();
+    (*coreWebView2)->AddRef();
+    return S_OK;
+}
+
+// FakeEnvironment
+
+HRESULT FakeEnvironment::CreateCoreWebView2Controller(HWND parentWindow, ICoreWebView2CreateCoreWebView2ControllerCompletedHandler* handler)
+{
+    if (!handler)
+    {
+        return E_POINTER;
+    }
+    if (!parentWindow)
+    {
+        return E_INVALIDARG;
+    }
+    m_runtime.CreateController(handler, parentWindow);
+    return S_OK;
+}
@@ -0,0 +1,269 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "framework.h"
+
+#include <climits>
+#include <queue>
+#include <random>
+
+// An in-process WebView2 runtime behind the interfaces of webview2.h. It runs
+// on one thread in virtual time: the runtime is the message loop, every
+// callback is posted to it with a delay and Run() calls them in time order,
+// those posted for the same time in the order they were posted.
+//
+// FakeScript decides how long controller creations and navigations take and
+// which of them fail. A navigation raises NavigationStarting right away,
+// SourceChanged and HistoryChanged once it commits and NavigationCompleted
+// once it loads. A newer navigation, Stop() and Close() cancel the pending
+// one, which then completes with OPERATION_CANCELED.
+
+struct FakeScript
+{
+    ULONGLONG controllerLatency = 120;  // Milliseconds per controller creation
+    size_t creationSlots = 0;           // Creations the runtime runs at once, 0 for any number
+    ULONGLONG commitLatency = 60;       // From NavigationStarting to SourceChanged
+    ULONGLONG loadLatency = 250;        // From NavigationStarting to NavigationCompleted
+    ULONGLONG jitter = 0;               // Up to this much is added to every latency
+    double controllerFailureRate = 0;
+    double navigationFailureRate = 0;
+    // Navigations to URIs containing this fail, whatever the rate
+    std::wstring failingUri;
+    unsigned int seed = 1;
+};
+
+class FakeWebView;
+
+class FakeRuntime
+{
+public:
+    struct Statistics
+    {
+        ULONGLONG callbacks = 0;  // Posted callbacks which ran
+        ULONGLONG controllersCreated = 0;
+        ULONGLONG controllerFailures = 0;
+        ULONGLONG controllersClosed = 0;
+        ULONGLONG navigations = 0;
+        ULONGLONG navigationFailures = 0;
+        ULONGLONG navigationsCanceled = 0;
+        ULONGLONG eventsRaised = 0;
+        ULONGLONG messagesPosted = 0;  // To pages, by PostWebMessageAs*
+        ULONGLONG messageBytes = 0;
+        ULONGLONG messagesReceived = 0;  // From pages
+    };
+
+    explicit FakeRuntime(const FakeScript& script);
+    ~FakeRuntime();
+    FakeRuntime(const FakeRuntime&) = delete;
+    FakeRuntime& operator=(const FakeRuntime&) = delete;
+
+    Microsoft::WRL::ComPtr<ICoreWebView2Environment> CreateEnvironment();
+    // Every ICoreWebView2 the runtime hands out is a FakeWebView
+    static FakeWebView* GetFake(ICoreWebView2* webview);
+
+    // f runs delay milliseconds from now
+    void Post(ULONGLONG delay, std::function<void()> f);
+    // Runs the callbacks due until time, or until there are none left.
+    // Returns how many ran.
+    size_t RunUntil(ULONGLONG time);
+    size_t Run() { return RunUntil(ULLONG_MAX); }
+    bool IsIdle() const { return m_callbacks.empty(); }
+    ULONGLONG GetTime() const { return m_now; }
+
+    FakeScript& GetScript() { return m_script; }
+    Statistics& GetStatistics() { return m_statistics; }
+    // WebViews and controllers which haven't been released yet
+    size_t GetLiveObjectCount() const { return m_liveObjects; }
+
+    // For the fakes
+    ULONGLONG GetLatency(ULONGLONG latency);
+    bool Fails(double rate);
+    void CreateController(Microsoft::WRL::ComPtr<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler> handler, HWND parentWindow);
+    void ObjectCreated() { ++m_liveObjects; }
+    void ObjectDestroyed() { --m_liveObjects; }
+
+private:
+    struct Callback
+    {
+        ULONGLONG time;
+        ULONGLONG sequence;
+        std::function<void()> f;
+
+        // For the priority queue, which puts the largest first
+        bool operator<(const Callback& other) const
+        {
+            return time != other.time ? time > other.time : sequence > other.sequence;
+        }
+    };
+
+    struct Creation
+    {
+        Microsoft::WRL::ComPtr<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler> handler;
+        HWND parentWindow;
+    };
+
+    FakeScript m_script;
+    std::mt19937 m_random;
+    std::priority_queue<Callback> m_callbacks;
+    ULONGLONG m_now = 0;
+    ULONGLONG m_nextSequence = 0;
+    std::deque<Creation> m_waitingCreations;
+    size_t m_creating = 0;
+    size_t m_liveObjects = 0;
+    Statistics m_statistics;
+
+    void StartCreation(Creation creation);
+};
+
+// Keeps the handlers of one event in the order they were added
+template<typename Handler>
+class FakeEvent
+{
+public:
+    HRESULT Add(Handler* handler, EventRegistrationToken* token)
+    {
+        if (!handler || !token)
+        {
+            return E_POINTER;
+        }
+        token->value = ++m_lastToken;
+        m_handlers.emplace_back(token->value, handler);
+        return S_OK;
+    }
+
+    HRESULT Remove(EventRegistrationToken token)
+    {
+        m_handlers.erase(std::remove_if(m_handlers.begin(), m_handlers.end(),
+            [&token](const Entry& entry) { return entry.first == token.value; }), m_handlers.end());
+        return S_OK;
+    }
+
+    void Clear() { m_handlers.clear(); }
+
+    // Handlers may add or remove handlers, those the event started with are
+    // called
+    template<typename... Args> size_t Raise(Args... args)
+    {
+        std::vector<Entry> handlers = m_handlers;
+        for (Entry& entry : handlers)
+        {
+            entry.second->Invoke(args...);
+        }
+        return handlers.size();
+    }
+
+private:
+    typedef std::pair<LONGLONG, Microsoft::WRL::ComPtr<Handler>> Entry;
+
+    std::vector<Entry> m_handlers;
+    LONGLONG m_lastToken = 0;
+};
+
+class FakeWebView : public Microsoft::WRL::RuntimeClass<ICoreWebView2>
+{
+public:
+    explicit FakeWebView(FakeRuntime& runtime);
+    ~FakeWebView();
+
+    // What the page would do: post a message to the host. It arrives after
+    // delay, with the URI of the document which posted it.
+    void ReceiveMessage(const std::wstring& json, ULONGLONG delay = 0);
+    // Called with every message the host posts to the page
+    void SetPageScript(std::function<void(LPCWSTR json)> script) { m_pageScript = std::move(script); }
+    void SetTitle(const std::wstring& title) { m_title = title; }
+    bool IsNavigating() const { return m_pending != 0; }
+    bool IsClosed() const { return m_closed; }
+    // Cancels the pending navigation and drops every handler
+    void Close();
+
+    // ICoreWebView2
+    HRESULT Navigate(LPCWSTR uri) override;
+    HRESULT get_Source(LPWSTR* uri) override;
+    HRESULT Reload() override;
+    HRESULT Stop() override;
+    HRESULT GoBack() override;
+    HRESULT GoForward() override;
+    HRESULT get_CanGoBack(BOOL* canGoBack) override;
+    HRESULT get_CanGoForward(BOOL* canGoForward) override;
+    HRESULT get_DocumentTitle(LPWSTR* title) override;
+    HRESULT PostWebMessageAsJson(LPCWSTR webMessageAsJson) override;
+    HRESULT PostWebMessageAsString(LPCWSTR webMessageAsString) override;
+
+    HRESULT add_NavigationStarting(ICoreWebView2NavigationStartingEventHandler* eventHandler, EventRegistrationToken* token) override;
+    HRESULT remove_NavigationStarting(EventRegistrationToken token) override;
+    HRESULT add_SourceChanged(ICoreWebView2SourceChangedEventHandler* eventHandler, EventRegistrationToken* token) override;
+    HRESULT remove_SourceChanged(EventRegistrationToken token) override;
+    HRESULT add_HistoryChanged(ICoreWebView2HistoryChangedEventHandler* eventHandler, EventRegistrationToken* token) override;
+    HRESULT remove_HistoryChanged(EventRegistrationToken token) override;
+    HRESULT add_NavigationCompleted(ICoreWebView2NavigationCompletedEventHandler* eventHandler, EventRegistrationToken* token) override;
+    HRESULT remove_NavigationCompleted(EventRegistrationToken token) override;
+    HRESULT add_WebMessageReceived(ICoreWebView2WebMessageReceivedEventHandler* handler, EventRegistrationToken* token) override;
+    HRESULT remove_WebMessageReceived(EventRegistrationToken token) override;
+
+private:
+    FakeRuntime& m_runtime;
+    std::wstring m_source = L"about:blank";
+    std::wstring m_title;
+    std::vector<std::wstring> m_history{ L"about:blank" };
+    size_t m_historyIndex = 0;
+    UINT64 m_lastNavigationId = 0;
+    UINT64 m_pending = 0;  // Id of the navigation in flight, 0 for none
+    bool m_closed = false;
+    std::function<void(LPCWSTR)> m_pageScript;
+
+    FakeEvent<ICoreWebView2NavigationStartingEventHandler> m_navigationStarting;
+    FakeEvent<ICoreWebView2SourceChangedEventHandler> m_sourceChanged;
+    FakeEvent<ICoreWebView2HistoryChangedEventHandler> m_historyChanged;
+    FakeEvent<ICoreWebView2NavigationCompletedEventHandler> m_navigationCompleted;
+    FakeEvent<ICoreWebView2WebMessageReceivedEventHandler> m_webMessageReceived;
+
+    // historyIndex is where the page goes in the history, SIZE_MAX for a new
+    // entry after the current one
+    HRESULT StartNavigation(const std::wstring& uri, size_t historyIndex);
+    void Commit(UINT64 navigationId, const std::wstring& uri, size_t historyIndex);
+    void Complete(UINT64 navigationId, bool succeeded, COREWEBVIEW2_WEB_ERROR_STATUS status);
+    void RaiseCompleted(UINT64 navigationId, bool succeeded, COREWEBVIEW2_WEB_ERROR_STATUS status);
+    void Cancel();
+};
+
+class FakeController : public Microsoft::WRL::RuntimeClass<ICoreWebView2Controller>
+{
+public:
+    FakeController(FakeRuntime& runtime, HWND parentWindow);
+    ~FakeController();
+
+    bool IsClosed() const { return m_closed; }
+
+    // ICoreWebView2Controller
+    HRESULT get_IsVisible(BOOL* isVisible) override;
+    HRESULT put_IsVisible(BOOL isVisible) override;
+    HRESULT get_Bounds(RECT* bounds) override;
+    HRESULT put_Bounds(RECT bounds) override;
+    HRESULT get_ParentWindow(HWND* parentWindow) override;
+    HRESULT put_ParentWindow(HWND parentWindow) override;
+    HRESULT Close() override;
+    HRESULT get_CoreWebView2(ICoreWebView2** coreWebView2) override;
+
+private:
+    FakeRuntime& m_runtime;
+    Microsoft::WRL::ComPtr<FakeWebView> m_webview;
+    HWND m_parentWindow;
+    RECT m_bounds = {};
+    bool m_visible = true;
+    bool m_closed = false;
+};
+
+class FakeEnvironment : public Microsoft::WRL::RuntimeClass<ICoreWebView2Environment>
+{
+public:
+    explicit FakeEnvironment(FakeRuntime& runtime) : m_runtime(runtime) {}
+
+    // ICoreWebView2Environment
+    HRESULT CreateCoreWebView2Controller(HWND parentWindow, ICoreWebView2CreateCoreWebView2ControllerCompletedHandler* handler) override;
+
+private:
+    FakeRuntime& m_runtime;
+};
@@ -0,0 +1,317 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests that the fake WebView2 runtime raises the events of a navigation in
+// the order and at the times its script says, cancels and fails them like
+// the runtime does, and releases every object.
+
+#include "Check.h"
+#include "FakeWebView2.h"
+
+using namespace Microsoft::WRL;
+
+static HWND const c_window = reinterpret_cast<HWND>(1);
+
+static ComPtr<ICoreWebView2Controller> CreateController(FakeRuntime& runtime, HRESULT* result = nullptr)
+{
+    ComPtr<ICoreWebView2Controller> controller;
+    HRESULT created = E_PENDING;
+    ComPtr<ICoreWebView2Environment> env = runtime.CreateEnvironment();
+    CHECK_HR(S_OK, env->CreateCoreWebView2Controller(c_window, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+        [&](HRESULT errorCode, ICoreWebView2Controller* host) -> HRESULT
+    {
+        created = errorCode;
+        controller = host;
+        return S_OK;
+    }).Get()));
+    runtime.Run();
+    if (result)
+    {
+        *result = created;
+    }
+    return controller;
+}
+
+// The events of a WebView as "<time> <event> <detail>" lines
+class EventLog
+{
+public:
+    EventLog(FakeRuntime& runtime, ICoreWebView2* webview) : m_runtime(runtime)
+    {
+        EventRegistrationToken token;
+        CHECK_HR(S_OK, webview->add_NavigationStarting(Callback<ICoreWebView2NavigationStartingEventHandler>(
+            [this](ICoreWebView2*, ICoreWebView2NavigationStartingEventArgs* args) -> HRESULT
+        {
+            wil::unique_cotaskmem_string uri;
+            args->get_Uri(&uri);
+            Add(L"starting " + std::wstring(uri.get()));
+            if (m_cancelNext)
+            {
+                m_cancelNext = false;
+                args->put_Cancel(TRUE);
+            }
+            return S_OK;
+        }).Get(), &token));
+        CHECK_HR(S_OK, webview->add_SourceChanged(Callback<ICoreWebView2SourceChangedEventHandler>(
+            [this](ICoreWebView2* sender, ICoreWebView2SourceChangedEventArgs*) -> HRESULT
+        {
+            wil::unique_cotaskmem_string source;
+            sender->get_Source(&source);
+            Add(L"source " + std::wstring(source.get()));
+            return S_OK;
+        }).Get(), &token));
+        CHECK_HR(S_OK, webview->add_HistoryChanged(Callback<ICoreWebView2HistoryChangedEventHandler>(
+            [this](ICoreWebView2* sender, IUnknown*) -> HRESULT
+        {
+            BOOL canGoBack = FALSE;
+            sender->get_CanGoBack(&canGoBack);
+            Add(canGoBack ? L"history back" : L"history");
+            return S_OK;
+        }).Get(), &token));
+        CHECK_HR(S_OK, webview->add_NavigationCompleted(Callback<ICoreWebView2NavigationCompletedEventHandler>(
+            [this](ICoreWebView2*, ICoreWebView2NavigationCompletedEventArgs* args) -> HRESULT
+        {
+            BOOL succeeded = FALSE;
+            COREWEBVIEW2_WEB_ERROR_STATUS status;
+            args->get_IsSuccess(&succeeded);
+            args->get_WebErrorStatus(&status);
+            Add(L"completed " + std::to_wstring(succeeded) + L" " + std::to_wstring(status));
+            return S_OK;
+        }).Get(), &token));
+    }
+
+    void CancelNext() { m_cancelNext = true; }
+    std::vector<std::wstring> Take() { return std::move(m_lines); }
+
+private:
+    FakeRuntime& m_runtime;
+    std::vector<std::wstring> m_lines;
+    bool m_cancelNext = false;
+
+    void Add(const std::wstring& line)
+    {
+        m_lines.push_back(std::to_wstring(m_runtime.GetTime()) + L" " + line);
+    }
+};
+
+static void TestControllerCreation()
+{
+    FakeScript script;
+    script.controllerLatency = 100;
+    script.creationSlots = 2;
+    FakeRuntime runtime(script);
+    ComPtr<ICoreWebView2Environment> env = runtime.CreateEnvironment();
+
+    std::vector<ULONGLONG> times;
+    std::vector<ComPtr<ICoreWebView2Controller>> controllers;
+    for (int i = 0; i < 3; ++i)
+    {
+        CHECK_HR(S_OK, env->CreateCoreWebView2Controller(c_window, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+            [&](HRESULT errorCode, ICoreWebView2Controller* host) -> HRESULT
+        {
+            CHECK_HR(S_OK, errorCode);
+            times.push_back(runtime.GetTime());
+            controllers.push_back(host);
+            return S_OK;
+        }).Get()));
+    }
+    ComPtr<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler> ignore = Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+        [](HRESULT, ICoreWebView2Controller*) -> HRESULT { return S_OK; });
+    CHECK_HR(E_INVALIDARG, env->CreateCoreWebView2Controller(nullptr, ignore.Get()));
+    runtime.Run();
+    // Two slots: the third creation waits for the first two
+    CHECK(times == std::vector<ULONGLONG>({ 100, 100, 200 }));
+    CHECK(runtime.GetStatistics().controllersCreated == 3);
+
+    ComPtr<ICoreWebView2> webview;
+    CHECK_HR(S_OK, controllers[0]->get_CoreWebView2(&webview));
+    CHECK(webview);
+    CHECK_HR(S_OK, controllers[0]->Close());
+    CHECK_HR(E_NOT_VALID_STATE, controllers[0]->put_IsVisible(FALSE));
+    CHECK_HR(E_NOT_VALID_STATE, webview->Navigate(L"https://example.com/"));
+
+    runtime.GetScript().controllerFailureRate = 1;
+    HRESULT result = S_OK;
+    CHECK(!CreateController(runtime, &result));
+    CHECK_HR(E_FAIL, result);
+    CHECK(runtime.GetStatistics().controllerFailures == 1);
+}
+
+static void TestNavigation()
+{
+    FakeScript script;
+    script.commitLatency = 50;
+    script.loadLatency = 200;
+    script.failingUri = L"fails.example";
+    FakeRuntime runtime(script);
+    ComPtr<ICoreWebView2Controller> controller = CreateController(runtime);
+    ComPtr<ICoreWebView2> webview;
+    CHECK_HR(S_OK, controller->get_CoreWebView2(&webview));
+    ULONGLONG const start = runtime.GetTime();
+    EventLog log(runtime, webview.Get());
+
+    CHECK_HR(S_OK, webview->Navigate(L"https://a.example/"));
+    runtime.Run();
+    CHECK_HR(S_OK, webview->Navigate(L"https://b.example/"));
+    runtime.Run();
+    std::vector<std::wstring> expected = {
+        std::to_wstring(start) + L" starting https://a.example/",
+        std::to_wstring(start + 50) + L" source https://a.example/",
+        std::to_wstring(start + 50) + L" history back",
+        std::to_wstring(start + 200) + L" completed 1 0",
+        std::to_wstring(start + 200) + L" starting https://b.example/",
+        std::to_wstring(start + 250) + L" source https://b.example/",
+        std::to_wstring(start + 250) + L" history back",
+        std::to_wstring(start + 400) + L" completed 1 0",
+    };
+    CHECK(log.Take() == expected);
+
+    // Back to a, forward to b, and a failed navigation which still commits
+    CHECK_HR(S_OK, webview->GoBack());
+    runtime.Run();
+    BOOL canGoForward = FALSE;
+    CHECK_HR(S_OK, webview->get_CanGoForward(&canGoForward));
+    CHECK(canGoForward);
+    wil::unique_cotaskmem_string source;
+    CHECK_HR(S_OK, webview->get_Source(&source));
+    CHECK(std::wstring(source.get()) == L"https://a.example/");
+    CHECK_HR(S_OK, webview->GoForward());
+    runtime.Run();
+    CHECK_HR(S_OK, webview->Navigate(L"https://fails.example/"));
+    runtime.Run();
+    std::vector<std::wstring> lines = log.Take();
+    CHECK(lines.size() == 12);
+    CHECK(lines.back() == std::to_wstring(runtime.GetTime()) + L" completed 0 " + std::to_wstring(COREWEBVIEW2_WEB_ERROR_STATUS_CONNECTION_ABORTED));
+    CHECK(runtime.GetStatistics().navigationFailures == 1);
+    CHECK_HR(S_OK, webview->get_CanGoForward(&canGoForward));
+    CHECK(!canGoForward);
+}
+
+static void TestCancel()
+{
+    FakeRuntime runtime(FakeScript{});
+    ComPtr<ICoreWebView2Controller> controller = CreateController(runtime);
+    ComPtr<ICoreWebView2> webview;
+    CHECK_HR(S_OK, controller->get_CoreWebView2(&webview));
+    std::wstring const now = std::to_wstring(runtime.GetTime());
+    EventLog log(runtime, webview.Get());
+
+    // A newer navigation cancels the pending one, which completes first
+    CHECK_HR(S_OK, webview->Navigate(L"https://a.example/"));
+    CHECK_HR(S_OK, webview->Navigate(L"https://b.example/"));
+    runtime.RunUntil(runtime.GetTime());
+    std::vector<std::wstring> expected = {
+        now + L" completed 0 " + std::to_wstring(COREWEBVIEW2_WEB_ERROR_STATUS_OPERATION_CANCELED),
+        now + L" starting https://b.example/",
+    };
+    CHECK(log.Take() == expected);
+
+    // Stopped after it started
+    CHECK_HR(S_OK, webview->Stop());
+    runtime.Run();
+    std::vector<std::wstring> lines = log.Take();
+    CHECK(lines.size() == 1 && lines[0].find(L"completed 0") != std::wstring::npos);
+
+    // Canceled by the NavigationStarting handler, it never commits
+    log.CancelNext();
+    CHECK_HR(S_OK, webview->Navigate(L"https://c.example/"));
+    runtime.Run();
+    lines = log.Take();
+    CHECK(lines.size() == 2 && lines[1].find(L"completed 0") != std::wstring::npos);
+    wil::unique_cotaskmem_string source;
+    CHECK_HR(S_OK, webview->get_Source(&source));
+    CHECK(std::wstring(source.get()) == L"about:blank");
+
+    // Closing cancels without events
+    CHECK_HR(S_OK, webview->Navigate(L"https://d.example/"));
+    CHECK_HR(S_OK, controller->Close());
+    runtime.Run();
+    CHECK(log.Take().empty());
+}
+
+static void TestMessages()
+{
+    FakeRuntime runtime(FakeScript{});
+    ComPtr<ICoreWebView2Controller> controller = CreateController(runtime);
+    ComPtr<ICoreWebView2> webview;
+    CHECK_HR(S_OK, controller->get_CoreWebView2(&webview));
+    CHECK_HR(S_OK, webview->Navigate(L"file:///page.html"));
+    runtime.Run();
+
+    // The page answers every message it gets
+    FakeWebView* page = FakeRuntime::GetFake(webview.Get());
+    std::vector<std::wstring> delivered;
+    page->SetPageScript([&](LPCWSTR json)
+    {
+        delivered.push_back(json);
+        page->ReceiveMessage(L"{\"echo\":" + std::wstring(json) + L"}");
+    });
+    std::vector<std::wstring> received;
+    EventRegistrationToken token;
+    CHECK_HR(S_OK, webview->add_WebMessageReceived(Callback<ICoreWebView2WebMessageReceivedEventHandler>(
+        [&](ICoreWebView2*, ICoreWebView2WebMessageReceivedEventArgs* args) -> HRESULT
+    {
+        wil::unique_cotaskmem_string source;
+        wil::unique_cotaskmem_string json;
+        args->get_Source(&source);
+        args->get_WebMessageAsJson(&json);
+        received.push_back(std::wstring(source.get()) + L" " + json.get());
+        return S_OK;
+    }).Get(), &token));
+
+    CHECK_HR(S_OK, webview->PostWebMessageAsJson(L"1"));
+    CHECK_HR(S_OK, webview->PostWebMessageAsJson(L"2"));
+    CHECK(delivered.empty());
+    runtime.Run();
+    CHECK(delivered == std::vector<std::wstring>({ L"1", L"2" }));
+    CHECK(received == std::vector<std::wstring>({ L"file:///page.html {\"echo\":1}", L"file:///page.html {\"echo\":2}" }));
+    CHECK(runtime.GetStatistics().messagesPosted == 2);
+    CHECK(runtime.GetStatistics().messageBytes == 4);
+
+    CHECK_HR(S_OK, webview->remove_WebMessageReceived(token));
+    CHECK_HR(S_OK, webview->PostWebMessageAsJson(L"3"));
+    runtime.Run();
+    CHECK(received.size() == 2);
+    CHECK_HR(S_OK, controller->Close());
+    CHECK_HR(E_NOT_VALID_STATE, webview->PostWebMessageAsJson(L"4"));
+}
+
+// Nothing is kept alive by the runtime once callbacks have run
+static void TestLifetime()
+{
+    FakeRuntime runtime(FakeScript{});
+    {
+        ComPtr<ICoreWebView2Controller> controller = CreateController(runtime);
+        ComPtr<ICoreWebView2> webview;
+        CHECK_HR(S_OK, controller->get_CoreWebView2(&webview));
+        CHECK(runtime.GetLiveObjectCount() == 2);
+        CHECK_HR(S_OK, webview->Navigate(L"https://example.com/"));
+        CHECK_HR(S_OK, controller->Close());
+    }
+    runtime.Run();
+    CHECK(runtime.GetLiveObjectCount() == 0);
+
+    // Or when the runtime goes away with callbacks pending
+    {
+        FakeRuntime other(FakeScript{});
+        ComPtr<ICoreWebView2Controller> controller = CreateController(other);
+        ComPtr<ICoreWebView2> webview;
+        CHECK_HR(S_OK, controller->get_CoreWebView2(&webview));
+        CHECK_HR(S_OK, webview->Navigate(L"https://example.com/"));
+        controller = nullptr;
+        webview = nullptr;
+        // The navigation's callbacks hold on to the WebView
+        CHECK(other.GetLiveObjectCount() == 1);
+    }
+}
+
+int main()
+{
+    TestControllerCreation();
+    TestNavigation();
+    TestCancel();
+    TestMessages();
+    TestLifetime();
+    return CheckResult();
+}
@@ -0,0 +1,455 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests FaviconCodec against the icons in fixtures/, and against damaged
+// copies of them: truncated at every length, chunks whose length runs past
+// the file, dimensions over c_maxDimension and ICO directories pointing out
+// of the file. The damaged copies are exactly as long as their bytes, so
+// AddressSanitizer catches any read past them.
+//
+//   rgba16.png   16x16 8 bit RGBA, rows cycling through the five filters,
+//                the compressed data split over two IDAT chunks
+//   palette.png  8x8 with a 4 bit palette of 6 colors, the first one
+//                transparent
+//   favicon.ico  16x16 32 bit BMP, 32x32 PNG and 48x48 24 bit BMP whose
+//                mask makes the 8 left columns transparent
+//
+// With --bench, times decoding, resizing to the sizes FaviconCache keeps and
+// encoding the result.
+
+#include "Check.h"
+#include "FaviconCodec.h"
+
+#include <fstream>
+
+typedef std::vector<BYTE> Bytes;
+
+static Bytes ReadFixture(const char* name)
+{
+    std::ifstream stream(std::string(FIXTURE_DIR "/") + name, std::ios::binary);
+    Bytes data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    if (data.empty())
+    {
+        std::fprintf(stderr, "Can't read the fixture %s\n", name);
+        std::exit(EXIT_FAILURE);
+    }
+    return data;
+}
+
+static HRESULT Decode(const Bytes& data, UINT preferredSize, IconBitmap& bitmap)
+{
+    return FaviconCodec::Decode(data.data(), data.size(), preferredSize, bitmap);
+}
+
+static void WriteBigEndian32(Bytes& data, size_t offset, UINT value)
+{
+    data[offset] = static_cast<BYTE>(value >> 24);
+    data[offset + 1] = static_cast<BYTE>(value >> 16);
+    data[offset + 2] = static_cast<BYTE>(value >> 8);
+    data[offset + 3] = static_cast<BYTE>(value);
+}
+
+static void WriteLittleEndian32(Bytes& data, size_t offset, UINT value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        data[offset + i] = static_cast<BYTE>(value >> (i * 8));
+    }
+}
+
+static UINT ReadLittleEndian32(const Bytes& data, size_t offset)
+{
+    return data[offset] | data[offset + 1] << 8 | data[offset + 2] << 16 | static_cast<UINT>(data[offset + 3]) << 24;
+}
+
+// Offset of the first chunk of the type, the signature is 8 bytes
+static size_t FindChunk(const Bytes& png, const char* type)
+{
+    size_t position = 8;
+    while (position + 8 <= png.size())
+    {
+        UINT const length = png[position] << 24 | png[position + 1] << 16 | png[position + 2] << 8 | png[position + 3];
+        if (memcmp(png.data() + position + 4, type, 4) == 0)
+        {
+            return position;
+        }
+        position += 12 + static_cast<size_t>(length);
+    }
+    return 0;
+}
+
+static bool IsPixel(const IconBitmap& bitmap, UINT x, UINT y, BYTE r, BYTE g, BYTE b, BYTE a)
+{
+    const BYTE* pixel = bitmap.pixels.data() + (static_cast<size_t>(y) * bitmap.width + x) * 4;
+    return pixel[0] == r && pixel[1] == g && pixel[2] == b && pixel[3] == a;
+}
+
+// The pixels every fixture was written with
+static bool IsRgba16(const IconBitmap& bitmap)
+{
+    if (bitmap.width != 16 || bitmap.height != 16 || bitmap.pixels.size() != 16 * 16 * 4)
+    {
+        return false;
+    }
+    for (UINT y = 0; y < 16; ++y)
+    {
+        for (UINT x = 0; x < 16; ++x)
+        {
+            if (!IsPixel(bitmap, x, y, static_cast<BYTE>(x * 16), static_cast<BYTE>(y * 16), static_cast<BYTE>(x * y), static_cast<BYTE>(255 - 8 * x)))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// PNGs with every filter, split IDAT chunks and a palette with transparency
+static void TestPng()
+{
+    IconBitmap bitmap;
+    CHECK_HR(S_OK, Decode(ReadFixture("rgba16.png"), 16, bitmap));
+    CHECK(IsRgba16(bitmap));
+
+    CHECK_HR(S_OK, Decode(ReadFixture("palette.png"), 16, bitmap));
+    static const BYTE c_palette[6][4] =
+    {
+        { 0, 0, 0, 0 }, { 255, 0, 0, 255 }, { 0, 255, 0, 255 },
+        { 0, 0, 255, 255 }, { 255, 255, 0, 255 }, { 255, 255, 255, 255 },
+    };
+    if (CHECK(bitmap.width == 8 && bitmap.height == 8))
+    {
+        bool matches = true;
+        for (UINT y = 0; y < 8; ++y)
+        {
+            for (UINT x = 0; x < 8; ++x)
+            {
+                const BYTE* color = c_palette[(x + y) % 6];
+                matches = matches && IsPixel(bitmap, x, y, color[0], color[1], color[2], color[3]);
+            }
+        }
+        CHECK(matches);
+    }
+    CHECK(FaviconCodec::IsPng(ReadFixture("rgba16.png").data(), 8));
+    CHECK(!FaviconCodec::IsPng(ReadFixture("favicon.ico").data(), 8));
+}
+
+// The image picked from the ICO depends on the size asked for
+static void TestIco()
+{
+    Bytes const ico = ReadFixture("favicon.ico");
+    IconBitmap bitmap;
+    CHECK_HR(S_OK, Decode(ico, 16, bitmap));
+    CHECK(IsRgba16(bitmap));
+
+    CHECK_HR(S_OK, Decode(ico, 20, bitmap));
+    if (CHECK(bitmap.width == 32 && bitmap.height == 32))
+    {
+        CHECK(IsPixel(bitmap, 0, 0, 0, 0, 128, 255));
+        CHECK(IsPixel(bitmap, 31, 5, 248, 40, 128, 255));
+    }
+
+    // Nothing large enough, the largest then
+    CHECK_HR(S_OK, Decode(ico, 64, bitmap));
+    if (CHECK(bitmap.width == 48 && bitmap.height == 48))
+    {
+        CHECK(IsPixel(bitmap, 7, 3, 35, 15, 0, 0));
+        CHECK(IsPixel(bitmap, 8, 3, 40, 15, 0, 255));
+        CHECK(IsPixel(bitmap, 47, 47, 235, 235, 0, 255));
+    }
+}
+
+// A file cut anywhere fails, or for an ICO gives the same image when what
+// is cut off isn't used
+static void TestTruncated()
+{
+    static const char* const c_fixtures[] = { "rgba16.png", "palette.png", "favicon.ico" };
+    for (const char* name : c_fixtures)
+    {
+        Bytes const data = ReadFixture(name);
+        IconBitmap complete;
+        CHECK_HR(S_OK, Decode(data, 16, complete));
+        size_t decoded = 0;
+        for (size_t size = 0; size < data.size(); ++size)
+        {
+            Bytes const truncated(data.begin(), data.begin() + size);
+            IconBitmap bitmap;
+            HRESULT const hr = FaviconCodec::Decode(size ? truncated.data() : nullptr, size, 16, bitmap);
+            if (SUCCEEDED(hr))
+            {
+                ++decoded;
+                if (!CHECK(bitmap.pixels == complete.pixels))
+                {
+                    std::fprintf(stderr, "  %s cut to %zu bytes\n", name, size);
+                    break;
+                }
+            }
+        }
+        // Only the ICO holds images past the one it picks
+        CHECK(decoded == 0 || strcmp(name, "favicon.ico") == 0);
+    }
+}
+
+// Chunk lengths running past the file or into the next chunk
+static void TestBadChunkLengths()
+{
+    Bytes const png = ReadFixture("rgba16.png");
+    size_t const idat = FindChunk(png, "IDAT");
+    size_t const iend = FindChunk(png, "IEND");
+    CHECK(idat != 0 && iend != 0);
+
+    static const UINT c_lengths[] = { 0xFFFFFFFFu, 0x80000000u, 0x7FFFFFFFu, 1 << 20 };
+    for (UINT length : c_lengths)
+    {
+        Bytes damaged = png;
+        WriteBigEndian32(damaged, idat, length);
+        IconBitmap bitmap;
+        CHECK_HR(E_INVALIDARG, Decode(damaged, 16, bitmap));
+        damaged = png;
+        WriteBigEndian32(damaged, iend, length);
+        CHECK_HR(E_INVALIDARG, Decode(damaged, 16, bitmap));
+    }
+
+    // Off by one either way, the next chunk type is read from the wrong place
+    for (int delta : { -1, 1, 12 })
+    {
+        Bytes damaged = png;
+        UINT const length = damaged[idat] << 24 | damaged[idat + 1] << 16 | damaged[idat + 2] << 8 | damaged[idat + 3];
+        WriteBigEndian32(damaged, idat, length + delta);
+        IconBitmap bitmap;
+        CHECK(FAILED(Decode(damaged, 16, bitmap)));
+    }
+
+    // An IHDR too short for the header
+    Bytes damaged = png;
+    WriteBigEndian32(damaged, 8, 12);
+    IconBitmap bitmap;
+    CHECK_HR(E_INVALIDARG, Decode(damaged, 16, bitmap));
+
+    // The palette shorter than the indices used
+    Bytes palette = ReadFixture("palette.png");
+    size_t const plte = FindChunk(palette, "PLTE");
+    WriteBigEndian32(palette, plte, 3);
+    CHECK(FAILED(Decode(palette, 16, bitmap)));
+}
+
+// Dimensions of 0 or over c_maxDimension are rejected before anything is
+// allocated
+static void TestHugeDimensions()
+{
+    Bytes const png = ReadFixture("rgba16.png");
+    static const UINT c_dimensions[] = { 0, FaviconCodec::c_maxDimension + 1, 0x7FFFFFFFu, 0xFFFFFFFFu };
+    for (UINT dimension : c_dimensions)
+    {
+        for (size_t field : { 16, 20 })
+        {
+            Bytes damaged = png;
+            WriteBigEndian32(damaged, field, dimension);
+            IconBitmap bitmap;
+            CHECK_HR(E_INVALIDARG, Decode(damaged, 16, bitmap));
+        }
+    }
+
+    // At the limit the header passes, the data then doesn't match it
+    Bytes damaged = png;
+    WriteBigEndian32(damaged, 16, FaviconCodec::c_maxDimension);
+    WriteBigEndian32(damaged, 20, FaviconCodec::c_maxDimension);
+    IconBitmap bitmap;
+    CHECK_HR(E_INVALIDARG, Decode(damaged, 16, bitmap));
+
+    // The BMP in the ICO, its height counts the mask too
+    Bytes const ico = ReadFixture("favicon.ico");
+    size_t const dib = ReadLittleEndian32(ico, 6 + 12);
+    for (int dimension : { 0, -16, static_cast<int>(FaviconCodec::c_maxDimension) + 1, 0x7FFFFFFF })
+    {
+        for (size_t field : { 4, 8 })
+        {
+            Bytes damagedIco = ico;
+            WriteLittleEndian32(damagedIco, dib + field, static_cast<UINT>(dimension));
+            CHECK_HR(E_INVALIDARG, Decode(damagedIco, 16, bitmap));
+        }
+    }
+    Bytes damagedIco = ico;
+    WriteLittleEndian32(damagedIco, dib + 4, 256);
+    CHECK_HR(E_INVALIDARG, Decode(damagedIco, 16, bitmap));
+}
+
+// Directory entries whose image lies outside the file, or which run past
+// the directory itself
+static void TestIcoOutOfRange()
+{
+    Bytes const ico = ReadFixture("favicon.ico");
+    UINT const size = static_cast<UINT>(ico.size());
+    size_t const entry = 6;  // The 16x16 image, picked for size 16
+    UINT const imageSize = ReadLittleEndian32(ico, entry + 8);
+    UINT const offset = ReadLittleEndian32(ico, entry + 12);
+
+    struct Range
+    {
+        UINT size;
+        UINT offset;
+    };
+    Range const c_ranges[] =
+    {
+        { imageSize, size },
+        { imageSize, size - 1 },
+        { imageSize, 0xFFFFFFFFu },
+        { 0xFFFFFFFFu, offset },
+        { size - offset + 1, offset },
+        { 0u - offset, offset },  // offset + size wraps to 0
+        { imageSize, size - imageSize + 1 },
+    };
+    for (const Range& range : c_ranges)
+    {
+        Bytes damaged = ico;
+        WriteLittleEndian32(damaged, entry + 8, range.size);
+        WriteLittleEndian32(damaged, entry + 12, range.offset);
+        IconBitmap bitmap;
+        if (!CHECK(FAILED(Decode(damaged, 16, bitmap))))
+        {
+            std::fprintf(stderr, "  size %u at %u\n", range.size, range.offset);
+        }
+    }
+
+    // Pointing into the directory, or at a size too small for the header
+    Bytes damaged = ico;
+    WriteLittleEndian32(damaged, entry + 12, 0);
+    IconBitmap bitmap;
+    CHECK(FAILED(Decode(damaged, 16, bitmap)));
+    damaged = ico;
+    WriteLittleEndian32(damaged, entry + 8, 39);
+    CHECK_HR(E_INVALIDARG, Decode(damaged, 16, bitmap));
+
+    // More entries than the file holds
+    damaged = ico;
+    damaged[4] = 0xFF;
+    damaged[5] = 0xFF;
+    CHECK_HR(E_INVALIDARG, Decode(damaged, 16, bitmap));
+    damaged = ico;
+    damaged[4] = 0;
+    damaged[5] = 0;
+    CHECK_HR(E_INVALIDARG, Decode(damaged, 16, bitmap));
+}
+
+// Resizing averages the covered pixels, and what EncodePng writes decodes
+// to the same pixels
+static void TestResizeAndEncode()
+{
+    IconBitmap decoded;
+    CHECK_HR(S_OK, Decode(ReadFixture("rgba16.png"), 16, decoded));
+
+    IconBitmap same;
+    FaviconCodec::Resize(decoded, 16, same);
+    CHECK(same.pixels == decoded.pixels);
+
+    IconBitmap larger;
+    FaviconCodec::Resize(decoded, 32, larger);
+    CHECK(larger.width == 32 && larger.height == 32);
+    CHECK(IsPixel(larger, 5, 9, 32, 64, 8, 239));
+
+    // A wide image is centered, with transparent bars above and below
+    IconBitmap wide;
+    wide.width = 4;
+    wide.height = 2;
+    wide.pixels.assign(4 * 2 * 4, 255);
+    IconBitmap fitted;
+    FaviconCodec::Resize(wide, 16, fitted);
+    CHECK(IsPixel(fitted, 8, 0, 0, 0, 0, 0));
+    CHECK(IsPixel(fitted, 8, 4, 255, 255, 255, 255));
+    CHECK(IsPixel(fitted, 8, 11, 255, 255, 255, 255));
+    CHECK(IsPixel(fitted, 8, 12, 0, 0, 0, 0));
+
+    // Transparent pixels don't darken their neighbours
+    IconBitmap half;
+    half.width = 2;
+    half.height = 1;
+    half.pixels = { 200, 100, 50, 255, 0, 0, 0, 0 };
+    IconBitmap averaged;
+    FaviconCodec::Resize(half, 1, averaged);
+    CHECK(IsPixel(averaged, 0, 0, 200, 100, 50, 128));
+
+    std::vector<BYTE> png;
+    FaviconCodec::EncodePng(larger, png);
+    IconBitmap roundTrip;
+    CHECK_HR(S_OK, FaviconCodec::Decode(png.data(), png.size(), 32, roundTrip));
+    CHECK(roundTrip.width == 32 && roundTrip.height == 32 && roundTrip.pixels == larger.pixels);
+}
+
+// What FaviconCache::Process does with every icon, timed per fixture and for
+// a 256x256 icon
+static void RunBenchmark(int iterations)
+{
+    IconBitmap large;
+    large.width = large.height = 256;
+    large.pixels.resize(256 * 256 * 4);
+    for (size_t i = 0; i < large.pixels.size(); ++i)
+    {
+        large.pixels[i] = static_cast<BYTE>(i * 7 + i / 1024);
+    }
+    Bytes largePng;
+    FaviconCodec::EncodePng(large, largePng);
+
+    struct Input
+    {
+        const char* name;
+        Bytes data;
+    };
+    std::vector<Input> inputs;
+    inputs.push_back({ "rgba16_png", ReadFixture("rgba16.png") });
+    inputs.push_back({ "palette8_png", ReadFixture("palette.png") });
+    inputs.push_back({ "three_image_ico", ReadFixture("favicon.ico") });
+    inputs.push_back({ "rgba256_png", largePng });
+
+    static const UINT c_sizes[] = { 16, 32 };
+    std::printf("{\"benchmark\":\"favicon_codec\",\"iterations\":%d", iterations);
+    for (const Input& input : inputs)
+    {
+        std::vector<double> decode;
+        std::vector<double> resizeAndEncode;
+        size_t encodedBytes = 0;
+        for (int i = 0; i < iterations; ++i)
+        {
+            for (UINT size : c_sizes)
+            {
+                auto start = std::chrono::steady_clock::now();
+                IconBitmap bitmap;
+                CHECK_HR(S_OK, Decode(input.data, size, bitmap));
+                decode.push_back(SecondsSince(start) * 1e6);
+
+                start = std::chrono::steady_clock::now();
+                IconBitmap resized;
+                FaviconCodec::Resize(bitmap, size, resized);
+                std::vector<BYTE> png;
+                FaviconCodec::EncodePng(resized, png);
+                resizeAndEncode.push_back(SecondsSince(start) * 1e6);
+                encodedBytes = png.size();
+            }
+        }
+        std::printf(",\"%s\":{\"bytes\":%zu,\"decode_us_p50\":%.2f,\"decode_us_p99\":%.2f,"
+            "\"resize_encode_us_p50\":%.2f,\"resize_encode_us_p99\":%.2f,\"encoded_bytes_32\":%zu}",
+            input.name, input.data.size(), Percentile(decode, 50), Percentile(decode, 99),
+            Percentile(resizeAndEncode, 50), Percentile(resizeAndEncode, 99), encodedBytes);
+    }
+    std::printf("}\n");
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions const bench = ParseBenchOptions(argc, argv, 2000);
+    if (bench.enabled)
+    {
+        RunBenchmark(bench.iterations);
+    }
+    else
+    {
+        TestPng();
+        TestIco();
+        TestTruncated();
+        TestBadChunkLengths();
+        TestHugeDimensions();
+        TestIcoOutOfRange();
+        TestResizeAndEncode();
+    }
+    return CheckResult();
+}
@@ -0,0 +1,639 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests HistoryStore: visits of a URI on the same day share an entry, the
+// log restores what was written, after a crash at any byte the state of the
+// last complete record, and compaction and the import of the old IndexedDB
+// history keep the visits in time order. With --bench it writes, replays,
+// compacts and imports a history of a million visits, and times pages and
+// counts of a history of a million visits with dead slots in it.
+
+#include "Check.h"
+#include "HistoryStore.h"
+
+#include <fstream>
+#include <iterator>
+#include <random>
+
+static LONGLONG const c_day = 24 * 60 * 60 * 1000;
+static LONGLONG const c_firstVisit = 1700000000000;
+
+static std::string s_directory;
+
+static std::wstring GetPath(const char* name)
+{
+    std::string const path = s_directory + "/" + name;
+    return std::wstring(path.begin(), path.end());
+}
+
+static std::string ReadFileBytes(const std::wstring& path)
+{
+    std::ifstream stream(PortablePath(path.c_str()), std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+static void WriteFileBytes(const std::wstring& path, const std::string& bytes)
+{
+    std::ofstream stream(PortablePath(path.c_str()), std::ios::binary | std::ios::trunc);
+    stream.write(bytes.data(), bytes.size());
+}
+
+static int GetDay(LONGLONG timestamp)
+{
+    return static_cast<int>(timestamp / c_day);
+}
+
+static int Add(HistoryStore& history, const std::wstring& uri, LONGLONG timestamp, const std::wstring& title = L"")
+{
+    int id = INVALID_HISTORY_ID;
+    CHECK_HR(S_OK, history.Add(uri, title, L"", timestamp, GetDay(timestamp), &id));
+    return id;
+}
+
+// All entries, most recent first
+static std::vector<HistoryEntry> GetAll(const HistoryStore& history)
+{
+    std::vector<HistoryEntry> all;
+    std::vector<HistoryEntry> page;
+    while (all.size() < history.GetCount())
+    {
+        if (!CHECK_HR(S_OK, history.GetPage(all.size(), HistoryStore::c_maxPageCount, page)) || page.empty())
+        {
+            break;
+        }
+        all.insert(all.end(), page.begin(), page.end());
+    }
+    return all;
+}
+
+static std::vector<std::wstring> GetUris(const HistoryStore& history)
+{
+    std::vector<std::wstring> uris;
+    for (const HistoryEntry& entry : GetAll(history))
+    {
+        uris.push_back(entry.item.uri);
+    }
+    return uris;
+}
+
+static bool SameEntries(const std::vector<HistoryEntry>& a, const std::vector<HistoryEntry>& b, bool compareIds)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if ((compareIds && a[i].id != b[i].id) || a[i].item.uri != b[i].item.uri || a[i].item.title != b[i].item.title ||
+            a[i].item.favicon != b[i].item.favicon || a[i].item.timestamp != b[i].item.timestamp)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool Restores(const std::wstring& path, const std::vector<HistoryEntry>& expected)
+{
+    HistoryStore history;
+    return SUCCEEDED(history.Open(path.c_str())) && history.GetCount() == expected.size() &&
+        SameEntries(GetAll(history), expected, true);
+}
+
+// A visit on the day of an entry for the same URI moves that entry to the
+// front, a visit on another day adds one
+static void TestDedupByUriAndDay()
+{
+    HistoryStore history;
+    CHECK_HR(S_OK, history.Open(GetPath("dedup.log").c_str()));
+
+    LONGLONG const morning = c_firstVisit - c_firstVisit % c_day + c_day / 4;
+    int const a = Add(history, L"https://a.example/", morning, L"A");
+    int const b = Add(history, L"https://b.example/", morning + 1000);
+    CHECK(Add(history, L"https://a.example/", morning + 2000) == a);
+    CHECK(history.GetCount() == 2);
+    CHECK(GetUris(history) == std::vector<std::wstring>({ L"https://a.example/", L"https://b.example/" }));
+
+    // The revisit keeps the title and takes the new time
+    HistoryItemFields item;
+    CHECK_HR(S_OK, history.GetItem(a, item));
+    CHECK(item.title == L"A");
+    CHECK(item.timestamp == morning + 2000);
+
+    // URIs are compared exactly
+    CHECK(Add(history, L"https://a.example", morning + 3000) != a);
+    CHECK(history.GetCount() == 3);
+
+    int const nextDay = Add(history, L"https://a.example/", morning + c_day);
+    CHECK(nextDay != a && nextDay != b);
+    CHECK(history.GetCount() == 4);
+    CHECK(Add(history, L"https://b.example/", morning + c_day + 1000) != b);
+    CHECK(Add(history, L"https://a.example/", morning + c_day + 2000) == nextDay);
+    CHECK(GetUris(history) == std::vector<std::wstring>({
+        L"https://a.example/", L"https://b.example/", L"https://a.example", L"https://a.example/", L"https://b.example/" }));
+}
+
+// Update, Remove and Clear change entries by id, an unknown or removed id
+// is refused
+static void TestUpdateRemoveClear()
+{
+    std::wstring const path = GetPath("update.log");
+    HistoryStore history;
+    CHECK_HR(S_OK, history.Open(path.c_str()));
+
+    int const a = Add(history, L"https://a.example/", c_firstVisit, L"A");
+    int const b = Add(history, L"https://b.example/", c_firstVisit + 1);
+    int const c = Add(history, L"https://c.example/", c_firstVisit + 2);
+
+    CHECK_HR(S_OK, history.Update(b, L"Caf\x00E9 \xD83D\xDE00", L"https://b.example/favicon.ico"));
+    HistoryItemFields item;
+    CHECK_HR(S_OK, history.GetItem(b, item));
+    CHECK(item.title == L"Caf\x00E9 \xD83D\xDE00");
+    CHECK(item.favicon == L"https://b.example/favicon.ico");
+
+    // An update which changes nothing isn't written
+    size_t const size = ReadFileBytes(path).size();
+    CHECK_HR(S_OK, history.Update(a, L"A", L""));
+    CHECK(ReadFileBytes(path).size() == size);
+
+    CHECK_HR(S_OK, history.Remove(b));
+    CHECK(history.GetCount() == 2);
+    CHECK_HR(E_INVALIDARG, history.GetItem(b, item));
+    CHECK_HR(E_INVALIDARG, history.Remove(b));
+    CHECK_HR(E_INVALIDARG, history.Update(b, L"B", L""));
+    CHECK_HR(E_INVALIDARG, history.Remove(0));
+    CHECK_HR(E_INVALIDARG, history.Remove(c + 1));
+    CHECK(GetUris(history) == std::vector<std::wstring>({ L"https://c.example/", L"https://a.example/" }));
+    CHECK(Restores(path, GetAll(history)));
+
+    // A removed entry isn't revisited, the URI gets a new one
+    CHECK(Add(history, L"https://b.example/", c_firstVisit + 3) > c);
+
+    CHECK_HR(S_OK, history.Clear());
+    CHECK(history.GetCount() == 0);
+    CHECK_HR(E_INVALIDARG, history.GetItem(a, item));
+    CHECK(Restores(path, std::vector<HistoryEntry>()));
+    CHECK(Add(history, L"https://a.example/", c_firstVisit + 4) == 1);
+}
+
+struct State
+{
+    std::vector<HistoryEntry> entries;
+    size_t fileSize = 0;  // Of the log holding this state
+};
+
+// A history with every kind of record and the state after each one
+static std::vector<State> WriteHistory(const std::wstring& path)
+{
+    std::vector<State> states;
+    HistoryStore history;
+    CHECK_HR(S_OK, history.Open(path.c_str()));
+
+    auto record = [&]()
+    {
+        State state;
+        state.entries = GetAll(history);
+        state.fileSize = ReadFileBytes(path).size();
+        states.push_back(state);
+    };
+
+    record();
+    for (int i = 0; i < 4; ++i)
+    {
+        Add(history, L"https://example.com/" + std::to_wstring(i), c_firstVisit + i * 1000, L"Page " + std::to_wstring(i));
+        record();
+    }
+    Add(history, L"https://example.com/1", c_firstVisit + 5000);
+    record();
+    CHECK_HR(S_OK, history.Update(3, L"\x4E2D\x6587", L"https://example.com/favicon.ico"));
+    record();
+    CHECK_HR(S_OK, history.Remove(1));
+    record();
+
+    ImportedVisit visit;
+    visit.uri = L"https://old.example/";
+    visit.title = L"Old";
+    visit.timestamp = c_firstVisit - c_day;
+    visit.day = GetDay(visit.timestamp);
+    CHECK_HR(S_OK, history.Import(std::vector<ImportedVisit>({ visit })));
+    record();
+    Add(history, L"https://example.com/4", c_firstVisit + 6000);
+    record();
+    return states;
+}
+
+static void TestRoundTrip()
+{
+    std::wstring const path = GetPath("round-trip.log");
+    std::vector<State> const states = WriteHistory(path);
+    CHECK(states.back().entries.size() == 5);
+    CHECK(Restores(path, states.back().entries));
+
+    // A file which isn't a history log is replaced by an empty one
+    WriteFileBytes(path, "not a history log");
+    CHECK(Restores(path, std::vector<HistoryEntry>()));
+}
+
+// Every length the file could have been cut to
+static void TestTruncatedTail()
+{
+    std::wstring const source = GetPath("complete.log");
+    std::vector<State> const states = WriteHistory(source);
+    std::string const bytes = ReadFileBytes(source);
+    CHECK(bytes.size() == states.back().fileSize);
+
+    std::wstring const path = GetPath("truncated.log");
+    for (size_t length = 0; length <= bytes.size(); ++length)
+    {
+        WriteFileBytes(path, bytes.substr(0, length));
+
+        State expected;
+        for (const State& state : states)
+        {
+            if (state.fileSize <= length)
+            {
+                expected = state;
+            }
+        }
+
+        HistoryStore history;
+        if (!CHECK_HR(S_OK, history.Open(path.c_str())))
+        {
+            continue;
+        }
+        CHECK(SameEntries(GetAll(history), expected.entries, true));
+
+        // The partial record is gone, what is written next follows the last
+        // complete one
+        size_t const kept = std::max(expected.fileSize, states.front().fileSize);
+        CHECK(ReadFileBytes(path).size() == kept);
+        Add(history, L"https://example.net/", c_firstVisit + 10 * c_day);
+        CHECK(Restores(path, GetAll(history)));
+    }
+}
+
+// Once most of the log is obsolete it is rewritten on startup with one
+// record per entry, in the same order
+static void TestCompact()
+{
+    std::wstring const path = GetPath("compact.log");
+    std::vector<HistoryEntry> expected;
+    size_t size = 0;
+    {
+        HistoryStore history;
+        CHECK_HR(S_OK, history.Open(path.c_str()));
+        for (int i = 0; i < 100; ++i)
+        {
+            Add(history, L"https://example.com/" + std::to_wstring(i), c_firstVisit + i, L"Page " + std::to_wstring(i));
+        }
+        // Revisits and removals, each of them a record
+        for (int i = 0; i < 5000; ++i)
+        {
+            Add(history, L"https://example.com/" + std::to_wstring(i % 50), c_firstVisit + 100 + i);
+        }
+        for (int id = 51; id <= 100; id += 2)
+        {
+            CHECK_HR(S_OK, history.Remove(id));
+        }
+        expected = GetAll(history);
+        size = ReadFileBytes(path).size();
+    }
+    CHECK(expected.size() == 75);
+
+    // Ids are renumbered in time order
+    HistoryStore history;
+    CHECK_HR(S_OK, history.Open(path.c_str()));
+    std::vector<HistoryEntry> const entries = GetAll(history);
+    CHECK(SameEntries(entries, expected, false));
+    CHECK(ReadFileBytes(path).size() < size / 10);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        CHECK(entries[i].id == static_cast<int>(entries.size() - i));
+    }
+    CHECK(Restores(path, entries));
+
+    // Revisits on the same day still find their entry
+    int const id = entries.front().id;
+    CHECK(Add(history, entries.front().item.uri, entries.front().item.timestamp + 1) == id);
+    CHECK(history.GetCount() == expected.size());
+}
+
+// Imported visits take their place in time, ids of the entries already there
+// stay the same
+static void TestImport()
+{
+    std::wstring const path = GetPath("import.log");
+    HistoryStore history;
+    CHECK_HR(S_OK, history.Open(path.c_str()));
+    LONGLONG const today = c_firstVisit - c_firstVisit % c_day;
+    int const a = Add(history, L"https://a.example/", today + 2000, L"A");
+    int const b = Add(history, L"https://b.example/", today + 4000, L"B");
+
+    std::vector<ImportedVisit> visits;
+    auto addVisit = [&visits](LPCWSTR uri, LONGLONG timestamp)
+    {
+        ImportedVisit visit;
+        visit.uri = uri;
+        visit.title = std::wstring(L"Old ") + uri;
+        visit.timestamp = timestamp;
+        visit.day = GetDay(timestamp);
+        visits.push_back(visit);
+    };
+    // IndexedDB returns them in key order, which isn't time order
+    addVisit(L"https://c.example/", today + 3000);
+    addVisit(L"https://d.example/", today - c_day);
+    addVisit(L"https://e.example/", today + 1000);
+    addVisit(L"https://d.example/", today - 2 * c_day);
+    CHECK_HR(S_OK, history.Import(visits));
+    CHECK_HR(S_OK, history.Import(std::vector<ImportedVisit>()));
+
+    std::vector<std::wstring> const order = {
+        L"https://b.example/", L"https://c.example/", L"https://a.example/", L"https://e.example/",
+        L"https://d.example/", L"https://d.example/" };
+    CHECK(history.GetCount() == 6);
+    CHECK(GetUris(history) == order);
+    HistoryItemFields itemA;
+    CHECK_HR(S_OK, history.GetItem(a, itemA));
+    CHECK(itemA.uri == L"https://a.example/");
+    HistoryItemFields itemB;
+    CHECK_HR(S_OK, history.GetItem(b, itemB));
+    CHECK(itemB.uri == L"https://b.example/");
+    CHECK(history.GetCountSince(today) == 4);
+
+    std::vector<HistoryEntry> const entries = GetAll(history);
+    CHECK(Restores(path, entries));
+
+    // Imported visits of today are revisited like the others
+    int const c = entries[1].id;
+    CHECK(Add(history, L"https://c.example/", today + 5000) == c);
+    CHECK(GetUris(history).front() == L"https://c.example/");
+    HistoryItemFields itemC;
+    CHECK_HR(S_OK, history.GetItem(c, itemC));
+    CHECK(itemC.title == L"Old https://c.example/");
+    CHECK(Restores(path, GetAll(history)));
+}
+
+// Entries by id and time, oldest first, what the store should return
+typedef std::vector<std::pair<int, LONGLONG>> Visits;
+
+static void Erase(Visits& visits, int id)
+{
+    visits.erase(std::find_if(visits.begin(), visits.end(),
+        [id](const std::pair<int, LONGLONG>& visit) { return visit.first == id; }));
+}
+
+static void CheckRanges(const HistoryStore& history, const Visits& visits)
+{
+    CHECK(history.GetCount() == visits.size());
+    std::vector<HistoryEntry> page;
+    for (size_t from = 0; from <= visits.size(); ++from)
+    {
+        size_t const count = from % 2 == 0 ? 7 : HistoryStore::c_maxPageCount;
+        if (!CHECK_HR(S_OK, history.GetPage(from, count, page)) ||
+            !CHECK(page.size() == std::min(count, visits.size() - from)))
+        {
+            return;
+        }
+        for (size_t i = 0; i < page.size(); ++i)
+        {
+            const std::pair<int, LONGLONG>& visit = visits[visits.size() - 1 - from - i];
+            if (!CHECK(page[i].id == visit.first && page[i].item.timestamp == visit.second))
+            {
+                return;
+            }
+        }
+    }
+    for (size_t i = 0; i < visits.size(); ++i)
+    {
+        // Each visit is one millisecond or more after the one before it
+        size_t const since = visits.size() - i;
+        if (!CHECK(history.GetCountSince(visits[i].second) == since) ||
+            !CHECK(history.GetCountSince(visits[i].second + 1) == since - 1))
+        {
+            return;
+        }
+    }
+    CHECK(history.GetCountSince(0) == visits.size());
+}
+
+// Pages and counts skip the slots of moved and removed visits, in runs short
+// enough to scan and longer, and stay right once the slots are rebuilt
+static void TestDeadSlots()
+{
+    std::wstring const path = GetPath("dead-slots.log");
+    HistoryStore history;
+    CHECK_HR(S_OK, history.Open(path.c_str()));
+
+    LONGLONG const today = c_firstVisit - c_firstVisit % c_day;
+    LONGLONG timestamp = today;
+    Visits visits;
+    for (int i = 0; i < 3000; ++i)
+    {
+        timestamp += 1 + i % 3;
+        visits.emplace_back(Add(history, L"https://example.com/" + std::to_wstring(i), timestamp), timestamp);
+    }
+    auto remove = [&](int id)
+    {
+        CHECK_HR(S_OK, history.Remove(id));
+        Erase(visits, id);
+    };
+
+    // Short runs of dead slots, then one longer than GetPage scans
+    for (int id = 1; id <= 900; id += 3)
+    {
+        remove(id);
+    }
+    for (int id = 1001; id <= 1200; ++id)
+    {
+        remove(id);
+    }
+    // Revisits move their entry to the front and leave a dead slot behind
+    for (int i = 2000; i < 2100; ++i)
+    {
+        timestamp += 1;
+        int const id = Add(history, L"https://example.com/" + std::to_wstring(i), timestamp);
+        CHECK(id == i + 1);
+        Erase(visits, id);
+        visits.emplace_back(id, timestamp);
+    }
+    CheckRanges(history, visits);
+    CHECK(Restores(path, GetAll(history)));
+
+    // Past 1024 dead slots and half of all of them the slots are rebuilt
+    for (int id = 1201; id <= 2000; ++id)
+    {
+        remove(id);
+    }
+    for (int id = 2101; id <= 2400; ++id)
+    {
+        remove(id);
+    }
+    CheckRanges(history, visits);
+    CHECK(Restores(path, GetAll(history)));
+
+    // The rebuilt slots take new visits and revisits
+    timestamp += 1;
+    visits.emplace_back(Add(history, L"https://example.net/", timestamp), timestamp);
+    timestamp += 1;
+    int const id = Add(history, L"https://example.com/2999", timestamp);
+    CHECK(id == 3000);
+    Erase(visits, id);
+    visits.emplace_back(id, timestamp);
+    CheckRanges(history, visits);
+    CHECK(Restores(path, GetAll(history)));
+}
+
+static std::wstring GetPageUri(size_t i)
+{
+    return L"https://site" + std::to_wstring(i % 300) + L".example/article/" + std::to_wstring(i);
+}
+
+// Writes visits one every ten minutes, replays the log, compacts it after
+// half of the entries were removed and imports older visits
+static void RunHistoryLog(size_t visits)
+{
+    std::wstring const path = GetPath("bench.log");
+    LONGLONG const interval = 10 * 60 * 1000;
+    auto start = std::chrono::steady_clock::now();
+    {
+        HistoryStore history;
+        CHECK_HR(S_OK, history.Open(path.c_str()));
+        for (size_t i = 0; i < visits; ++i)
+        {
+            Add(history, GetPageUri(i), c_firstVisit + static_cast<LONGLONG>(i) * interval,
+                L"Article " + std::to_wstring(i) + L" of site " + std::to_wstring(i % 300));
+        }
+    }
+    double const addSeconds = SecondsSince(start);
+    size_t const logBytes = ReadFileBytes(path).size();
+
+    double openSeconds = 0;
+    double removeSeconds = 0;
+    {
+        start = std::chrono::steady_clock::now();
+        HistoryStore history;
+        CHECK_HR(S_OK, history.Open(path.c_str()));
+        openSeconds = SecondsSince(start);
+        CHECK(history.GetCount() == visits);
+
+        start = std::chrono::steady_clock::now();
+        for (int id = 1; id <= static_cast<int>(visits); id += 2)
+        {
+            CHECK_HR(S_OK, history.Remove(id));
+        }
+        removeSeconds = SecondsSince(start);
+    }
+
+    start = std::chrono::steady_clock::now();
+    HistoryStore history;
+    CHECK_HR(S_OK, history.Open(path.c_str()));
+    double const compactSeconds = SecondsSince(start);
+    size_t const compactedBytes = ReadFileBytes(path).size();
+    CHECK(history.GetCount() == visits / 2);
+
+    std::vector<ImportedVisit> imported(visits / 10);
+    for (size_t i = 0; i < imported.size(); ++i)
+    {
+        imported[i].uri = GetPageUri(i);
+        imported[i].title = L"Imported " + std::to_wstring(i);
+        imported[i].timestamp = c_firstVisit - static_cast<LONGLONG>(i + 1) * interval;
+        imported[i].day = GetDay(imported[i].timestamp);
+    }
+    start = std::chrono::steady_clock::now();
+    CHECK_HR(S_OK, history.Import(imported));
+    double const importSeconds = SecondsSince(start);
+    CHECK(history.GetCount() == visits / 2 + imported.size());
+
+    std::printf("{\"scenario\":\"history_log\",\"visits\":%zu,\"add_us_per_visit\":%.3f,\"log_bytes\":%zu,\"open_ms\":%.3f,"
+        "\"remove_us_per_entry\":%.3f,\"compact_open_ms\":%.3f,\"compacted_bytes\":%zu,\"imported\":%zu,\"import_ms\":%.3f}",
+        visits, addSeconds * 1e6 / visits, logBytes, openSeconds * 1000, removeSeconds * 1e6 / (visits / 2),
+        compactSeconds * 1000, compactedBytes, imported.size(), importSeconds * 1000);
+}
+
+// Times pages at random offsets and counts since random times in a history
+// where a quarter of the visits were removed, leaving their slots dead
+static void RunRangeQueries(size_t visits)
+{
+    std::wstring const path = GetPath("range.log");
+    LONGLONG const interval = 10 * 60 * 1000;
+    HistoryStore history;
+    CHECK_HR(S_OK, history.Open(path.c_str()));
+    for (size_t i = 0; i < visits; ++i)
+    {
+        Add(history, GetPageUri(i), c_firstVisit + static_cast<LONGLONG>(i) * interval, L"Article " + std::to_wstring(i));
+    }
+    for (int id = 1; id <= static_cast<int>(visits); id += 4)
+    {
+        CHECK_HR(S_OK, history.Remove(id));
+    }
+    size_t const count = history.GetCount();
+
+    size_t const queries = 100000;
+    std::mt19937 random(1);
+    std::vector<double> pageTimes;
+    std::vector<double> fullPageTimes;
+    std::vector<double> sinceTimes;
+    std::vector<HistoryEntry> entries;
+    for (size_t i = 0; i < queries; ++i)
+    {
+        size_t const from = random() % count;
+        auto start = std::chrono::steady_clock::now();
+        CHECK_HR(S_OK, history.GetPage(from, 50, entries));
+        pageTimes.push_back(SecondsSince(start) * 1e6);
+
+        start = std::chrono::steady_clock::now();
+        CHECK_HR(S_OK, history.GetPage(from, HistoryStore::c_maxPageCount, entries));
+        fullPageTimes.push_back(SecondsSince(start) * 1e6);
+
+        LONGLONG const since = c_firstVisit + static_cast<LONGLONG>(random() % visits) * interval;
+        start = std::chrono::steady_clock::now();
+        CHECK(history.GetCountSince(since) <= count);
+        sinceTimes.push_back(SecondsSince(start) * 1e6);
+    }
+
+    std::printf("{\"scenario\":\"range_queries\",\"visits\":%zu,\"live\":%zu,\"queries\":%zu,\"page_50_us_p50\":%.3f,"
+        "\"page_50_us_p99\":%.3f,\"page_%zu_us_p50\":%.3f,\"page_%zu_us_p99\":%.3f,\"count_since_us_p50\":%.3f,"
+        "\"count_since_us_p99\":%.3f}",
+        visits, count, queries, Percentile(pageTimes, 50), Percentile(pageTimes, 99),
+        HistoryStore::c_maxPageCount, Percentile(fullPageTimes, 50), HistoryStore::c_maxPageCount, Percentile(fullPageTimes, 99),
+        Percentile(sinceTimes, 50), Percentile(sinceTimes, 99));
+}
+
+int main(int argc, char** argv)
+{
+    char directory[] = "/tmp/HistoryStoreTests.XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    s_directory = directory;
+
+    BenchOptions const bench = ParseBenchOptions(argc, argv, 1000000);
+    if (bench.enabled)
+    {
+        std::printf("{\"benchmark\":\"history_store\",\"results\":[");
+        RunHistoryLog(static_cast<size_t>(bench.iterations));
+        std::printf(",");
+        RunRangeQueries(static_cast<size_t>(bench.iterations));
+        std::printf("]}\n");
+    }
+    else
+    {
+        TestDedupByUriAndDay();
+        TestUpdateRemoveClear();
+        TestRoundTrip();
+        TestTruncatedTail();
+        TestCompact();
+        TestImport();
+        TestDeadSlots();
+    }
+
+    std::string const remove = "rm -rf '" + s_directory + "'";
+    if (std::system(remove.c_str()) != 0)
+    {
+        std::fprintf(stderr, "Can't remove %s\n", s_directory.c_str());
+    }
+    return CheckResult();
+}
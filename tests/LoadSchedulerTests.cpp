@@ -0,0 +1,361 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests LoadScheduler against a fake clock: the order tabs start in, the
+// limit on tabs loading at once, shown tabs jumping the queue, timeouts, and
+// the progress and results it reports.
+
+#include "Check.h"
+#include "LoadScheduler.h"
+
+// The scheduler with a clock the test moves, and the tabs it started in
+// order
+class Harness
+{
+public:
+    explicit Harness(size_t maxLoading) :
+        m_scheduler(maxLoading, [this]() { return m_now; }, [this](size_t tabId) { return OnStart(tabId); })
+    {
+    }
+
+    LoadScheduler& operator*() { return m_scheduler; }
+    LoadScheduler* operator->() { return &m_scheduler; }
+
+    void Advance(ULONGLONG milliseconds) { m_now += milliseconds; }
+    ULONGLONG GetTime() const { return m_now; }
+
+    // Tab ids, in the order they were started, since the last call
+    std::vector<size_t> TakeStarted()
+    {
+        std::vector<size_t> started;
+        started.swap(m_started);
+        return started;
+    }
+
+    // Starting the tab returns hr
+    void FailStart(size_t tabId, HRESULT hr) { m_failures[tabId] = hr; }
+    // Starting the tab reports it finished before start returns
+    void CompleteOnStart(size_t tabId, bool succeeded) { m_completions[tabId] = succeeded; }
+
+private:
+    ULONGLONG m_now = 1000;
+    LoadScheduler m_scheduler;
+    std::vector<size_t> m_started;
+    std::map<size_t, HRESULT> m_failures;
+    std::map<size_t, bool> m_completions;
+
+    HRESULT OnStart(size_t tabId)
+    {
+        m_started.push_back(tabId);
+        auto completion = m_completions.find(tabId);
+        if (completion != m_completions.end())
+        {
+            m_scheduler.Completed(tabId, completion->second);
+        }
+        auto failure = m_failures.find(tabId);
+        return failure != m_failures.end() ? failure->second : S_OK;
+    }
+};
+
+static bool ProgressIs(const LoadScheduler::Progress& progress, size_t total, size_t finished, size_t failed, size_t loading, size_t queued)
+{
+    return progress.total == total && progress.finished == finished && progress.failed == failed &&
+        progress.loading == loading && progress.queued == queued;
+}
+
+static std::wstring GetUri(size_t tabId)
+{
+    return L"https://example.com/" + std::to_wstring(tabId);
+}
+
+// Lower priorities first, then in the order added: two lists opened at once
+// take turns
+static void TestPriorityOrder()
+{
+    Harness harness(1);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        CHECK_HR(S_OK, harness->Add(10 + i, GetUri(10 + i), i));
+    }
+    for (size_t i = 0; i < 3; ++i)
+    {
+        CHECK_HR(S_OK, harness->Add(20 + i, GetUri(20 + i), i));
+    }
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 10 }));
+
+    std::vector<size_t> order = { 10 };
+    while (!harness->IsIdle())
+    {
+        harness->Completed(order.back(), true);
+        std::vector<size_t> const started = harness.TakeStarted();
+        if (!started.empty())
+        {
+            CHECK(started.size() == 1);
+            order.push_back(started[0]);
+        }
+    }
+    CHECK(order == std::vector<size_t>({ 10, 20, 11, 21, 12, 22 }));
+
+    // The results come in the order the tabs finished
+    std::vector<LoadScheduler::Result> const results = harness->TakeResults();
+    CHECK(results.size() == order.size());
+    for (size_t i = 0; i < results.size() && i < order.size(); ++i)
+    {
+        CHECK(results[i].tabId == order[i]);
+        CHECK(results[i].uri == GetUri(order[i]));
+        CHECK(results[i].outcome == LoadScheduler::Outcome::Succeeded);
+    }
+    CHECK(harness->TakeResults().empty());
+}
+
+static void TestConcurrencyLimit()
+{
+    Harness harness(3);
+    for (size_t tabId = 1; tabId <= 10; ++tabId)
+    {
+        harness->Add(tabId, GetUri(tabId), tabId);
+    }
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 1, 2, 3 }));
+    CHECK(ProgressIs(harness->GetProgress(), 10, 0, 0, 3, 7));
+
+    // Every tab which finishes lets in the next one
+    harness->Completed(2, true);
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 4 }));
+    harness->Completed(1, false);
+    harness->Completed(3, true);
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 5, 6 }));
+    CHECK(ProgressIs(harness->GetProgress(), 10, 3, 1, 3, 4));
+
+    for (size_t tabId = 4; tabId <= 10; ++tabId)
+    {
+        harness->Completed(tabId, true);
+        CHECK(harness->GetProgress().loading <= 3);
+    }
+    CHECK(harness->IsIdle());
+    CHECK(ProgressIs(harness->GetProgress(), 10, 10, 1, 0, 0));
+
+    // No limit of 0, one tab loads at least
+    Harness single(0);
+    single->Add(1, GetUri(1), 0);
+    single->Add(2, GetUri(2), 0);
+    CHECK(single.TakeStarted() == std::vector<size_t>({ 1 }));
+}
+
+// A shown tab starts right away, over the limit
+static void TestPrioritize()
+{
+    Harness harness(2);
+    for (size_t tabId = 1; tabId <= 5; ++tabId)
+    {
+        harness->Add(tabId, GetUri(tabId), tabId);
+    }
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 1, 2 }));
+
+    CHECK_HR(S_OK, harness->Prioritize(5));
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 5 }));
+    CHECK(ProgressIs(harness->GetProgress(), 5, 0, 0, 3, 2));
+
+    // Loading and unknown tabs are ignored
+    CHECK_HR(S_OK, harness->Prioritize(5));
+    CHECK_HR(S_OK, harness->Prioritize(1));
+    CHECK_HR(S_OK, harness->Prioritize(42));
+    CHECK(harness.TakeStarted().empty());
+
+    // Nothing new starts until the tabs loading are below the limit again
+    harness->Completed(1, true);
+    CHECK(harness.TakeStarted().empty());
+    harness->Completed(5, true);
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 3 }));
+    CHECK(ProgressIs(harness->GetProgress(), 5, 2, 0, 2, 1));
+}
+
+static void TestCompleted()
+{
+    Harness harness(1);
+    harness->Add(1, GetUri(1), 0);
+    harness.Advance(10);
+    harness->Add(2, GetUri(2), 0);
+    harness.Advance(100);
+    harness->Completed(1, false);
+    harness.Advance(250);
+    harness->Completed(2, true);
+
+    std::vector<LoadScheduler::Result> const results = harness->TakeResults();
+    if (CHECK(results.size() == 2))
+    {
+        CHECK(results[0].tabId == 1 && results[0].outcome == LoadScheduler::Outcome::Failed);
+        CHECK(results[0].added == 1000 && results[0].started == 1000 && results[0].finished == 1110);
+        CHECK(results[1].tabId == 2 && results[1].outcome == LoadScheduler::Outcome::Succeeded);
+        CHECK(results[1].added == 1010 && results[1].started == 1110 && results[1].finished == 1360);
+    }
+
+    // Queued, unknown and finished tabs are ignored
+    harness->Add(3, GetUri(3), 0);
+    harness->Add(4, GetUri(4), 0);
+    harness.TakeStarted();
+    CHECK_HR(S_OK, harness->Completed(4, true));
+    CHECK_HR(S_OK, harness->Completed(42, true));
+    CHECK(harness->IsScheduled(4));
+    CHECK(ProgressIs(harness->GetProgress(), 2, 0, 0, 1, 1));
+    harness->Completed(3, true);
+    CHECK_HR(S_OK, harness->Completed(3, false));
+    CHECK(harness->TakeResults().size() == 1);
+    CHECK(ProgressIs(harness->GetProgress(), 2, 1, 0, 1, 0));
+}
+
+// A closed tab frees its slot and leaves no result
+static void TestRemove()
+{
+    Harness harness(1);
+    harness->Add(1, GetUri(1), 0);
+    harness->Add(2, GetUri(2), 0);
+    harness->Add(3, GetUri(3), 0);
+    harness.TakeStarted();
+
+    CHECK_HR(S_OK, harness->Remove(2));
+    CHECK(!harness->IsScheduled(2));
+    CHECK(ProgressIs(harness->GetProgress(), 2, 0, 0, 1, 1));
+
+    CHECK_HR(S_OK, harness->Remove(1));
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 3 }));
+    CHECK(ProgressIs(harness->GetProgress(), 1, 0, 0, 1, 0));
+    CHECK_HR(S_OK, harness->Remove(42));
+
+    // Adding a tab again replaces it
+    harness->Add(3, GetUri(30), 5);
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 3 }));
+    CHECK(ProgressIs(harness->GetProgress(), 1, 0, 0, 1, 0));
+    harness->Completed(3, true);
+    std::vector<LoadScheduler::Result> const results = harness->TakeResults();
+    CHECK(results.size() == 1 && results[0].uri == GetUri(30));
+    CHECK(harness->IsIdle());
+}
+
+static void TestExpire()
+{
+    Harness harness(2);
+    harness->Add(1, GetUri(1), 0);
+    harness.Advance(1000);
+    harness->Add(2, GetUri(2), 0);
+    harness->Add(3, GetUri(3), 0);
+    harness.TakeStarted();
+
+    // Tab 1 started a second before tab 2
+    harness.Advance(LoadScheduler::c_loadTimeout - 1001);
+    CHECK_HR(S_OK, harness->Expire());
+    CHECK(harness.TakeStarted().empty());
+    harness.Advance(1);
+    CHECK_HR(S_OK, harness->Expire());
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 3 }));
+    CHECK(ProgressIs(harness->GetProgress(), 3, 1, 1, 2, 0));
+
+    ULONGLONG const expired = harness.GetTime();
+    harness.Advance(1000);
+    harness->Expire();
+    harness.Advance(LoadScheduler::c_loadTimeout);
+    harness->Expire();
+    CHECK(harness->IsIdle());
+
+    std::vector<LoadScheduler::Result> const results = harness->TakeResults();
+    if (CHECK(results.size() == 3))
+    {
+        CHECK(results[0].tabId == 1 && results[0].outcome == LoadScheduler::Outcome::TimedOut);
+        CHECK(results[0].finished - results[0].started == LoadScheduler::c_loadTimeout);
+        CHECK(results[1].tabId == 2 && results[1].outcome == LoadScheduler::Outcome::TimedOut);
+        CHECK(results[2].tabId == 3 && results[2].outcome == LoadScheduler::Outcome::TimedOut);
+        CHECK(results[2].started == expired);
+    }
+    CHECK(ProgressIs(harness->GetProgress(), 3, 3, 3, 0, 0));
+}
+
+// A start which fails counts as a failed load and lets the next tab in, as
+// does one which reports its navigation before it returns
+static void TestStartFailure()
+{
+    Harness harness(1);
+    harness.FailStart(1, E_FAIL);
+    harness.CompleteOnStart(2, true);
+    CHECK_HR(E_FAIL, harness->Add(1, GetUri(1), 0));
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 1 }));
+    CHECK(harness->IsIdle());
+
+    harness->Add(3, GetUri(3), 0);
+    harness->Add(1, GetUri(1), 1);
+    harness->Add(2, GetUri(2), 2);
+    CHECK_HR(E_FAIL, harness->Completed(3, true));
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 3, 1, 2 }));
+
+    std::vector<LoadScheduler::Result> const results = harness->TakeResults();
+    if (CHECK(results.size() == 4))
+    {
+        CHECK(results[0].tabId == 1 && results[0].outcome == LoadScheduler::Outcome::Failed);
+        CHECK(results[1].tabId == 3 && results[1].outcome == LoadScheduler::Outcome::Succeeded);
+        CHECK(results[2].tabId == 1 && results[2].outcome == LoadScheduler::Outcome::Failed);
+        CHECK(results[3].tabId == 2 && results[3].outcome == LoadScheduler::Outcome::Succeeded);
+    }
+    CHECK(ProgressIs(harness->GetProgress(), 3, 3, 1, 0, 0));
+    CHECK(harness->IsIdle());
+}
+
+// The progress counts the tabs added since the scheduler was last idle
+static void TestProgress()
+{
+    Harness harness(1);
+    harness->Add(1, GetUri(1), 0);
+    harness->Add(2, GetUri(2), 0);
+    harness->Completed(1, false);
+    CHECK(ProgressIs(harness->GetProgress(), 2, 1, 1, 1, 0));
+    harness->Add(3, GetUri(3), 0);
+    CHECK(ProgressIs(harness->GetProgress(), 3, 1, 1, 1, 1));
+    harness->Completed(2, true);
+    harness->Completed(3, true);
+    CHECK(ProgressIs(harness->GetProgress(), 3, 3, 1, 0, 0));
+
+    harness->Add(4, GetUri(4), 0);
+    CHECK(ProgressIs(harness->GetProgress(), 1, 0, 0, 1, 0));
+}
+
+static void TestReport()
+{
+    std::vector<LoadScheduler::Result> results(3);
+    results[0].tabId = 1;
+    results[0].uri = L"https://example.com/\"quoted\"\\path";
+    results[0].added = 100;
+    results[0].started = 150;
+    results[0].finished = 400;
+    results[1].tabId = 2;
+    results[1].uri = L"https://example.com/café\n";
+    results[1].outcome = LoadScheduler::Outcome::Failed;
+    results[1].added = 100;
+    results[1].started = 100;
+    results[1].finished = 100;
+    results[2].tabId = 3;
+    results[2].uri = L"https://example.com/";
+    results[2].outcome = LoadScheduler::Outcome::TimedOut;
+    results[2].added = 0;
+    results[2].started = 10;
+    results[2].finished = 10 + LoadScheduler::c_loadTimeout;
+
+    std::string report = "first line\n";
+    LoadScheduler::AppendReport(results, report);
+    CHECK(report ==
+        "first line\n"
+        "{\"uri\":\"https://example.com/\\\"quoted\\\"\\\\path\",\"tabId\":1,\"outcome\":\"succeeded\",\"waited\":50,\"loaded\":250}\n"
+        "{\"uri\":\"https://example.com/caf\xC3\xA9\\u000a\",\"tabId\":2,\"outcome\":\"failed\",\"waited\":0,\"loaded\":0}\n"
+        "{\"uri\":\"https://example.com/\",\"tabId\":3,\"outcome\":\"timedOut\",\"waited\":10,\"loaded\":60000}\n");
+}
+
+int main()
+{
+    TestPriorityOrder();
+    TestConcurrencyLimit();
+    TestPrioritize();
+    TestCompleted();
+    TestRemove();
+    TestExpire();
+    TestStartFailure();
+    TestProgress();
+    TestReport();
+    return CheckResult();
+}
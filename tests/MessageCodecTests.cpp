@@ -0,0 +1,585 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests that MessageWriter and MessageReader round-trip the typed messages,
+// escape what JSON needs escaped, and turn down malformed input, numbers out
+// of range and nesting beyond the limit. With --bench it encodes and decodes
+// the navigation traffic to the controls UI, and when built with nlohmann
+// json, does the same the way BrowserWindow did before the codec: a json
+// tree, dump() and a wstring_convert to UTF-16.
+
+#ifdef HAVE_NLOHMANN_JSON
+#include <codecvt>
+#include <locale>
+#include <nlohmann/json.hpp>
+#endif
+
+#include "Check.h"
+#include "MessageCodec.h"
+
+#include <climits>
+
+// Every integer type the codec decodes
+struct NumbersMessage
+{
+    static const int c_message = MG_ERROR;
+    size_t size = 7;
+    int integer = 7;
+    long long timestamp = 7;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"size", self.size);
+        v(L"integer", self.integer);
+        v(L"timestamp", self.timestamp);
+    }
+};
+
+static std::wstring MakeMessage(int message, const std::wstring& args)
+{
+    return L"{\"message\":" + std::to_wstring(message) + L",\"args\":" + args + L"}";
+}
+
+template<typename T> static HRESULT Decode(const std::wstring& json, T& message)
+{
+    MessageReader reader;
+    RETURN_IF_FAILED(reader.Parse(json.c_str()));
+    RETURN_HR_IF(E_INVALIDARG, reader.GetMessageCode() != T::c_message);
+    return reader.ReadArgs(message);
+}
+
+static void TestRoundTrip()
+{
+    MessageWriter writer;
+    UpdateUriMessage uri;
+    uri.tabId = 42;
+    uri.uri = L"https://example.com/search?q=\"quoted\"&path=C:\\temp\\file";
+    uri.uriToShow = L"browser://history";
+    uri.canGoBack = true;
+    std::wstring const json = writer.Write(uri);
+    CHECK(json == L"{\"message\":" + std::to_wstring(MG_UPDATE_URI) + L",\"args\":{\"tabId\":42,"
+        L"\"uri\":\"https://example.com/search?q=\\\"quoted\\\"&path=C:\\\\temp\\\\file\","
+        L"\"uriToShow\":\"browser://history\",\"canGoBack\":true,\"canGoForward\":false}}");
+
+    UpdateUriMessage decoded;
+    CHECK_HR(S_OK, Decode(json, decoded));
+    CHECK(decoded.tabId == uri.tabId);
+    CHECK(decoded.uri == uri.uri);
+    CHECK(decoded.uriToShow == uri.uriToShow);
+    CHECK(decoded.canGoBack && !decoded.canGoForward);
+
+    // Arrays of nested objects
+    HistoryPageMessage page;
+    page.from = 10;
+    page.count = 2;
+    page.total = 1000;
+    for (int i = 0; i < 2; ++i)
+    {
+        HistoryEntry entry;
+        entry.id = i + 1;
+        entry.item.uri = L"https://example.com/" + std::to_wstring(i);
+        entry.item.title = L"Title {" + std::to_wstring(i) + L"}, [with] \"brackets\"";
+        entry.item.timestamp = 1700000000000LL + i;
+        page.items.push_back(entry);
+    }
+    HistoryPageMessage decodedPage;
+    CHECK_HR(S_OK, Decode(writer.Write(page), decodedPage));
+    CHECK(decodedPage.from == 10 && decodedPage.count == 2 && decodedPage.total == 1000);
+    if (CHECK(decodedPage.items.size() == 2))
+    {
+        for (size_t i = 0; i < 2; ++i)
+        {
+            CHECK(decodedPage.items[i].id == page.items[i].id);
+            CHECK(decodedPage.items[i].item.uri == page.items[i].item.uri);
+            CHECK(decodedPage.items[i].item.title == page.items[i].item.title);
+            CHECK(decodedPage.items[i].item.favicon.empty());
+            CHECK(decodedPage.items[i].item.timestamp == page.items[i].item.timestamp);
+        }
+    }
+
+    SuggestionsMessage suggestions;
+    suggestions.query = L"exa";
+    CHECK_HR(S_OK, Decode(writer.Write(suggestions), suggestions));
+    CHECK(suggestions.query == L"exa" && suggestions.suggestions.empty());
+
+    // JSON values pass through verbatim, an empty one is null
+    SecurityUpdateMessage security;
+    security.tabId = 3;
+    security.state.json = L"{\"securityState\":\"secure\",\"certificate\":[1,2,{\"a\":null}]}";
+    SecurityUpdateMessage decodedSecurity;
+    CHECK_HR(S_OK, Decode(writer.Write(security), decodedSecurity));
+    CHECK(decodedSecurity.state.json == security.state.json);
+    security.state.json.clear();
+    CHECK(std::wstring(writer.Write(security)).find(L"\"state\":null") != std::wstring::npos);
+}
+
+static void TestEscaping()
+{
+    MessageWriter writer;
+    ErrorMessage error;
+    error.code = std::wstring(L"a\"b\\c\b\f\n\r\t") + wchar_t(0x01) + wchar_t(0x1F) + L" /";
+    std::wstring const json = writer.Write(error);
+    CHECK(json.find(L"\"code\":\"a\\\"b\\\\c\\b\\f\\n\\r\\t\\u0001\\u001f /\"") != std::wstring::npos);
+
+    ErrorMessage decoded;
+    CHECK_HR(S_OK, Decode(json, decoded));
+    CHECK(decoded.code == error.code);
+
+    // Escapes the writer doesn't produce, in either case
+    CHECK_HR(S_OK, Decode(MakeMessage(MG_ERROR, L"{\"code\":\"\\/\\u00e9\\u00C9\\u0041\"}"), decoded));
+    CHECK(decoded.code == std::wstring(L"/") + wchar_t(0xE9) + wchar_t(0xC9) + L"A");
+
+    static LPCWSTR const c_badStrings[] = {
+        L"\"\\u00e\"", L"\"\\u00eg\"", L"\"\\uZZZZ\"", L"\"abc\\\"", L"\"abc",
+    };
+    for (LPCWSTR value : c_badStrings)
+    {
+        CHECK(FAILED(Decode(MakeMessage(MG_ERROR, std::wstring(L"{\"code\":") + value + L"}"), decoded)));
+    }
+
+    // An escaped member name still matches
+    CHECK_HR(S_OK, Decode(MakeMessage(MG_ERROR, L"{\"\\u0063ode\":\"escaped\"}"), decoded));
+    CHECK(decoded.code == L"escaped");
+}
+
+// JSON escapes are UTF-16 code units, and so are the strings of the host:
+// a surrogate pair is two units either way, and isn't escaped on output
+static void TestSurrogatePairs()
+{
+    std::wstring const pair = std::wstring() + wchar_t(0xD83D) + wchar_t(0xDE00);
+
+    MessageWriter writer;
+    ErrorMessage error;
+    error.message = L"smile " + pair + L"!";
+    std::wstring const json = writer.Write(error);
+    CHECK(json.find(L"\"message\":\"smile " + pair + L"!\"") != std::wstring::npos);
+
+    ErrorMessage decoded;
+    CHECK_HR(S_OK, Decode(json, decoded));
+    CHECK(decoded.message == error.message);
+
+    CHECK_HR(S_OK, Decode(MakeMessage(MG_ERROR, L"{\"message\":\"\\ud83d\\uDE00 and \\ud83d\"}"), decoded));
+    CHECK(decoded.message == pair + L" and " + wchar_t(0xD83D));
+}
+
+static std::wstring Nested(size_t depth)
+{
+    return std::wstring(depth, L'[') + std::wstring(depth, L']');
+}
+
+// The message object is level 0, its args level 1
+static void TestNestingLimit()
+{
+    ErrorMessage decoded;
+    CHECK_HR(S_OK, Decode(MakeMessage(MG_ERROR, L"{\"deep\":" + Nested(62) + L",\"code\":\"x\"}"), decoded));
+    CHECK(decoded.code == L"x");
+    CHECK_HR(E_INVALIDARG, Decode(MakeMessage(MG_ERROR, L"{\"deep\":" + Nested(63) + L",\"code\":\"x\"}"), decoded));
+
+    // Far beyond the limit, without running out of stack
+    CHECK_HR(E_INVALIDARG, Decode(MakeMessage(MG_ERROR, L"{\"deep\":" + Nested(1000000) + L"}"), decoded));
+    std::wstring objects;
+    for (int i = 0; i < 100000; ++i)
+    {
+        objects += L"{\"a\":";
+    }
+    CHECK_HR(E_INVALIDARG, Decode(MakeMessage(MG_ERROR, L"{\"deep\":" + objects + L"}"), decoded));
+
+    SecurityUpdateMessage security;
+    CHECK_HR(E_INVALIDARG, Decode(MakeMessage(MG_SECURITY_UPDATE, L"{\"state\":" + Nested(70) + L"}"), security));
+
+    VisibleSecurityStateChangedEvent event;
+    CHECK_HR(S_OK, MessageReader::ReadObject((L"{\"visibleSecurityState\":" + Nested(62) + L"}").c_str(), event));
+    CHECK(event.visibleSecurityState.json == Nested(62));
+    CHECK_HR(E_INVALIDARG, MessageReader::ReadObject((L"{\"visibleSecurityState\":" + Nested(64) + L"}").c_str(), event));
+}
+
+// Numbers a page posts have to fit the field they are decoded into
+static void TestIntegerRanges()
+{
+    struct Case
+    {
+        LPCWSTR field;
+        LPCWSTR value;
+        bool valid;
+    };
+    static Case const c_cases[] = {
+        { L"size", L"0", true },
+        { L"size", L"18446744073709549568", true },  // The largest double below 2^64
+        { L"size", L"18446744073709551616", false },  // 2^64
+        { L"size", L"-1", false },
+        { L"size", L"1.5", false },
+        { L"size", L"1e3", true },
+        { L"size", L"1e999", false },
+        { L"size", L"\"1\"", false },
+        { L"size", L"true", false },
+        { L"size", L"null", false },
+        { L"integer", L"2147483647", true },
+        { L"integer", L"-2147483648", true },
+        { L"integer", L"2147483648", false },
+        { L"integer", L"-2147483649", false },
+        { L"integer", L"-0", true },
+        { L"timestamp", L"9007199254740992", true },
+        { L"timestamp", L"-9223372036854775808", true },
+        { L"timestamp", L"9223372036854775808", false },
+        { L"timestamp", L"1e300", false },
+        { L"timestamp", L"-1e300", false },
+        { L"timestamp", L"12abc", false },
+    };
+
+    for (const Case& test : c_cases)
+    {
+        NumbersMessage message;
+        HRESULT const hr = Decode(MakeMessage(MG_ERROR, std::wstring(L"{\"") + test.field + L"\":" + test.value + L"}"), message);
+        if (!CHECK(SUCCEEDED(hr) == test.valid))
+        {
+            std::fprintf(stderr, "  %ls: %ls\n", test.field, test.value);
+        }
+    }
+
+    NumbersMessage message;
+    CHECK_HR(S_OK, Decode(MakeMessage(MG_ERROR, L"{\"size\":18446744073709549568,\"integer\":-2147483648,\"timestamp\":-9007199254740992}"), message));
+    CHECK(message.size == 18446744073709549568ULL);
+    CHECK(message.integer == INT_MIN);
+    CHECK(message.timestamp == -9007199254740992LL);
+
+    // The writer's extremes read back
+    MessageWriter writer;
+    message.integer = INT_MIN;
+    message.timestamp = -9007199254740992LL;
+    message.size = 0;
+    NumbersMessage decoded;
+    CHECK_HR(S_OK, Decode(writer.Write(message), decoded));
+    CHECK(decoded.integer == INT_MIN && decoded.timestamp == message.timestamp && decoded.size == 0);
+}
+
+static void TestMalformedMessages()
+{
+    static LPCWSTR const c_messages[] = {
+        L"",
+        L"[]",
+        L"{}",
+        L"{\"message\":1}",
+        L"{\"args\":{}}",
+        L"{\"message\":\"1\",\"args\":{}}",
+        L"{\"message\":1.5,\"args\":{}}",
+        L"{\"message\":1,\"args\":{},}",
+        L"{\"message\":1,\"args\":{}",
+        L"{\"message\":1,\"args\":{\"a\":}}",
+        L"{\"message\":1,\"args\":{\"a\" 1}}",
+        L"{\"message\":1,\"args\":{\"a\":1 \"b\":2}}",
+        L"{\"message\":1,\"args\":{\"a\":[1,2}}",
+        L"{\"message\":1,\"args\":{\"a\":\"unterminated}}",
+        L"{\"message\":1,\"args\":{\"a\":tru}}",
+        L"{\"message\":1 \"args\":{}}",
+        L"{message:1,\"args\":{}}",
+    };
+    for (LPCWSTR json : c_messages)
+    {
+        MessageReader reader;
+        if (!CHECK(FAILED(reader.Parse(json))))
+        {
+            std::fprintf(stderr, "  %ls\n", json);
+        }
+    }
+
+    // Wrong types for the fields, or args which aren't an object, fail the
+    // read, not the parse. The reader points into the JSON it parsed.
+    MessageReader reader;
+    std::wstring json = MakeMessage(MG_UPDATE_URI, L"{\"uri\":42}");
+    CHECK_HR(S_OK, reader.Parse(json.c_str()));
+    UpdateUriMessage uri;
+    CHECK_HR(E_INVALIDARG, reader.ReadArgs(uri));
+    json = MakeMessage(MG_UPDATE_URI, L"{\"canGoBack\":1}");
+    CHECK_HR(S_OK, reader.Parse(json.c_str()));
+    CHECK_HR(E_INVALIDARG, reader.ReadArgs(uri));
+    json = MakeMessage(MG_GET_HISTORY, L"{\"items\":{}}");
+    CHECK_HR(S_OK, reader.Parse(json.c_str()));
+    HistoryPageMessage page;
+    CHECK_HR(E_INVALIDARG, reader.ReadArgs(page));
+    json = MakeMessage(MG_UPDATE_URI, L"\"https://example.com/\"");
+    CHECK_HR(S_OK, reader.Parse(json.c_str()));
+    CHECK_HR(E_INVALIDARG, reader.ReadArgs(uri));
+    json = MakeMessage(MG_UPDATE_URI, L"null");
+    CHECK_HR(S_OK, reader.Parse(json.c_str()));
+    CHECK_HR(E_INVALIDARG, reader.ReadArgs(uri));
+}
+
+// Unknown fields are skipped, missing ones keep their default, whitespace
+// is allowed anywhere JSON allows it
+static void TestUnknownAndMissingFields()
+{
+    UpdateUriMessage uri;
+    CHECK_HR(S_OK, Decode(L" \r\n{ \"extra\" : [ { \"tabId\" : 1 } ] ,\t\"args\" : { \"other\" : { \"uri\" : \"nested\" } ,"
+        L" \"uri\" : \"https://example.com/\" } , \"message\" : " + std::to_wstring(MG_UPDATE_URI) + L" } ", uri));
+    CHECK(uri.uri == L"https://example.com/");
+    CHECK(uri.tabId == INVALID_TAB_ID);
+    CHECK(uri.uriToShow.empty() && !uri.canGoBack);
+
+    // The first of duplicate members wins
+    CHECK_HR(S_OK, Decode(MakeMessage(MG_UPDATE_URI, L"{\"uri\":\"first\",\"uri\":\"second\"}"), uri));
+    CHECK(uri.uri == L"first");
+}
+
+// The tab's message reaches the controls UI with its args as they were and
+// the tabId added
+static void TestForwarded()
+{
+    MessageReader reader;
+    MessageWriter writer;
+    std::wstring json = MakeMessage(MG_ADD_HISTORY_ITEM, L"{ \"uri\":\"https://example.com/\", \"title\":\"a\\\"b\", \"extra\":[1,{}] }");
+    CHECK_HR(S_OK, reader.Parse(json.c_str()));
+    std::wstring const forwarded = writer.WriteForwarded(reader, 9);
+    CHECK(forwarded == MakeMessage(MG_ADD_HISTORY_ITEM, L"{\"uri\":\"https://example.com/\", \"title\":\"a\\\"b\", \"extra\":[1,{}] ,\"tabId\":9}"));
+
+    AddHistoryItemMessage item;
+    CHECK_HR(S_OK, Decode(forwarded, item));
+    CHECK(item.tabId == 9 && item.title == L"a\"b");
+
+    json = MakeMessage(MG_NAV_STARTING, L"{ }");
+    CHECK_HR(S_OK, reader.Parse(json.c_str()));
+    CHECK(std::wstring(writer.WriteForwarded(reader, 3)) == MakeMessage(MG_NAV_STARTING, L"{\"tabId\":3}"));
+}
+
+// The navigation traffic of one tab: what HandleTabURIUpdate,
+// HandleTabNavStarting, HandleTabNavCompleted and HandleTabSecurityUpdate
+// post to the controls UI
+struct Navigation
+{
+    size_t tabId;
+    std::wstring uri;
+    std::wstring securityEvent;  // As the DevTools protocol reports it
+};
+
+static std::vector<Navigation> MakeNavigations(size_t count)
+{
+    std::vector<Navigation> navigations;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Navigation navigation;
+        navigation.tabId = i % 50 + 1;
+        navigation.uri = L"https://www.example.com/articles/" + std::to_wstring(i) + L"?utm_source=feed&utm_medium=rss&ref=caf\u00e9";
+        navigation.securityEvent = L"{\"visibleSecurityState\":{\"securityState\":\"secure\",\"securityStateIssueIds\":[],"
+            L"\"certificateSecurityState\":{\"protocol\":\"TLS 1.3\",\"keyExchange\":\"\",\"keyExchangeGroup\":\"X25519\","
+            L"\"cipher\":\"AES_128_GCM\",\"certificate\":[\"MIIB\"],\"subjectName\":\"www.example.com\",\"issuer\":\"Example CA\","
+            L"\"validFrom\":1700000000,\"validTo\":1800000000,\"certificateHasWeakSignature\":false}}}";
+        navigations.push_back(std::move(navigation));
+    }
+    return navigations;
+}
+
+struct BenchResult
+{
+    double encodeNsPerMessage;
+    double decodeNsPerMessage;
+    size_t bytes;
+};
+
+static BenchResult RunCodec(const std::vector<Navigation>& navigations, int iterations)
+{
+    MessageWriter writer;
+    std::vector<std::wstring> wire;
+    size_t bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        wire.clear();
+        for (const Navigation& navigation : navigations)
+        {
+            UpdateUriMessage uri;
+            uri.tabId = navigation.tabId;
+            uri.uri = navigation.uri;
+            uri.canGoBack = true;
+            wire.emplace_back(writer.Write(uri));
+
+            NavStartingMessage starting;
+            starting.tabId = navigation.tabId;
+            wire.emplace_back(writer.Write(starting));
+
+            NavCompletedMessage completed;
+            completed.tabId = navigation.tabId;
+            wire.emplace_back(writer.Write(completed));
+
+            VisibleSecurityStateChangedEvent event;
+            CHECK_HR(S_OK, MessageReader::ReadObject(navigation.securityEvent.c_str(), event));
+            SecurityUpdateMessage security;
+            security.tabId = navigation.tabId;
+            security.state = std::move(event.visibleSecurityState);
+            wire.emplace_back(writer.Write(security));
+        }
+    }
+    double const encodeSeconds = SecondsSince(start);
+    for (const std::wstring& message : wire)
+    {
+        bytes += message.size() * sizeof(char16_t);
+    }
+
+    // What default.js sends back, decoded like the UI message broker does
+    size_t tabIds = 0;
+    start = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        for (const std::wstring& message : wire)
+        {
+            MessageReader reader;
+            CHECK_HR(S_OK, reader.Parse(message.c_str()));
+            switch (reader.GetMessageCode())
+            {
+            case MG_UPDATE_URI:
+            {
+                UpdateUriMessage args;
+                CHECK_HR(S_OK, reader.ReadArgs(args));
+                tabIds += args.tabId;
+                break;
+            }
+            case MG_SECURITY_UPDATE:
+            {
+                SecurityUpdateMessage args;
+                CHECK_HR(S_OK, reader.ReadArgs(args));
+                tabIds += args.tabId;
+                break;
+            }
+            default:
+            {
+                NavCompletedMessage args;
+                CHECK_HR(S_OK, reader.ReadArgs(args));
+                tabIds += args.tabId;
+                break;
+            }
+            }
+        }
+    }
+    double const decodeSeconds = SecondsSince(start);
+    CHECK(tabIds != 0);
+
+    double const messages = static_cast<double>(wire.size()) * iterations;
+    return { encodeSeconds * 1e9 / messages, decodeSeconds * 1e9 / messages, bytes };
+}
+
+#ifdef HAVE_NLOHMANN_JSON
+// BrowserWindow::PostJsonToWebView and the broker before the codec
+static std::wstring_convert<std::codecvt_utf8<wchar_t>> s_utf8;
+static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> s_utf8Utf16;
+
+static std::wstring DumpToWString(const nlohmann::json& json)
+{
+    std::string const dump = json.dump();
+    return s_utf8Utf16.from_bytes(dump);
+}
+
+static BenchResult RunNlohmannJson(const std::vector<Navigation>& navigations, int iterations)
+{
+    std::vector<std::wstring> wire;
+    size_t bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        wire.clear();
+        for (const Navigation& navigation : navigations)
+        {
+            nlohmann::json uri;
+            uri["message"] = MG_UPDATE_URI;
+            uri["args"]["tabId"] = navigation.tabId;
+            uri["args"]["uri"] = s_utf8.to_bytes(navigation.uri);
+            uri["args"]["canGoForward"] = false;
+            uri["args"]["canGoBack"] = true;
+            wire.push_back(DumpToWString(uri));
+
+            nlohmann::json starting;
+            starting["message"] = MG_NAV_STARTING;
+            starting["args"]["tabId"] = navigation.tabId;
+            wire.push_back(DumpToWString(starting));
+
+            nlohmann::json completed;
+            completed["message"] = MG_NAV_COMPLETED;
+            completed["args"]["tabId"] = navigation.tabId;
+            completed["args"]["isError"] = false;
+            wire.push_back(DumpToWString(completed));
+
+            nlohmann::json event = nlohmann::json::parse(navigation.securityEvent);
+            nlohmann::json security;
+            security["message"] = MG_SECURITY_UPDATE;
+            security["args"]["tabId"] = navigation.tabId;
+            security["args"]["state"] = event["visibleSecurityState"];
+            wire.push_back(DumpToWString(security));
+        }
+    }
+    double const encodeSeconds = SecondsSince(start);
+    for (const std::wstring& message : wire)
+    {
+        bytes += message.size() * sizeof(char16_t);
+    }
+
+    size_t tabIds = 0;
+    start = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        for (const std::wstring& message : wire)
+        {
+            nlohmann::json json = nlohmann::json::parse(message);
+            if (!json.contains("message") || !json.contains("args"))
+            {
+                continue;
+            }
+            int const code = json["message"];
+            size_t const tabId = json["args"]["tabId"];
+            tabIds += tabId;
+            if (code == MG_UPDATE_URI)
+            {
+                std::wstring const uri = s_utf8Utf16.from_bytes(json["args"]["uri"].get<std::string>());
+                tabIds += uri.empty();
+            }
+        }
+    }
+    double const decodeSeconds = SecondsSince(start);
+    CHECK(tabIds != 0);
+
+    double const messages = static_cast<double>(wire.size()) * iterations;
+    return { encodeSeconds * 1e9 / messages, decodeSeconds * 1e9 / messages, bytes };
+}
+#endif
+
+static void RunBenchmark(int iterations)
+{
+    std::vector<Navigation> const navigations = MakeNavigations(1000);
+    BenchResult const codec = RunCodec(navigations, iterations);
+    std::printf("{\"benchmark\":\"message_codec\",\"messages\":%zu,\"iterations\":%d,\"results\":["
+        "{\"path\":\"codec\",\"encode_ns_per_message\":%.1f,\"decode_ns_per_message\":%.1f,\"utf16_bytes\":%zu}",
+        navigations.size() * 4, iterations, codec.encodeNsPerMessage, codec.decodeNsPerMessage, codec.bytes);
+#ifdef HAVE_NLOHMANN_JSON
+    BenchResult const json = RunNlohmannJson(navigations, iterations);
+    std::printf(",{\"path\":\"nlohmann_json\",\"encode_ns_per_message\":%.1f,\"decode_ns_per_message\":%.1f,\"utf16_bytes\":%zu,"
+        "\"encode_speedup\":%.2f,\"decode_speedup\":%.2f}",
+        json.encodeNsPerMessage, json.decodeNsPerMessage, json.bytes,
+        json.encodeNsPerMessage / codec.encodeNsPerMessage, json.decodeNsPerMessage / codec.decodeNsPerMessage);
+#endif
+    std::printf("]}\n");
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions const bench = ParseBenchOptions(argc, argv, 20);
+    if (bench.enabled)
+    {
+        RunBenchmark(bench.iterations);
+    }
+    else
+    {
+        TestRoundTrip();
+        TestEscaping();
+        TestSurrogatePairs();
+        TestNestingLimit();
+        TestIntegerRanges();
+        TestMalformedMessages();
+        TestUnknownAndMissingFields();
+        TestForwarded();
+        // Both paths have to agree on the traffic the benchmark times
+        RunCodec(MakeNavigations(10), 1);
+#ifdef HAVE_NLOHMANN_JSON
+        RunNlohmannJson(MakeNavigations(10), 1);
+#endif
+    }
+    return CheckResult();
+}
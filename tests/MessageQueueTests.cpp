@@ -0,0 +1,297 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests MessageQueue against a fake controls WebView, with the flush posted
+// to the fake runtime the way BrowserWindow posts WM_FLUSH_MESSAGES: which
+// updates replace each other, that a turn of the message loop delivers one
+// MG_BATCH, a lone message unwrapped, and that messages are held until the
+// controls page is ready for them.
+
+#include "Check.h"
+#include "FakeWebView2.h"
+#include "MessageCodec.h"
+#include "MessageQueue.h"
+
+using namespace Microsoft::WRL;
+
+static HWND const c_window = reinterpret_cast<HWND>(1);
+
+// The args of MG_BATCH
+struct BatchMessage
+{
+    std::vector<JsonValue> messages;
+
+    template<typename S, typename V> static void Visit(S &self, V &v)
+    {
+        v(L"messages", self.messages);
+    }
+};
+
+// The controls WebView and its queue. The page unpacks batches like
+// default.js does and keeps what it was sent.
+class Harness
+{
+public:
+    Harness() : m_runtime(FakeScript()), m_queue([this]() { ScheduleFlush(); })
+    {
+        ComPtr<ICoreWebView2Environment> env = m_runtime.CreateEnvironment();
+        CHECK_HR(S_OK, env->CreateCoreWebView2Controller(c_window, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+            [this](HRESULT errorCode, ICoreWebView2Controller* host) -> HRESULT
+        {
+            CHECK_HR(S_OK, errorCode);
+            m_controller = host;
+            return S_OK;
+        }).Get()));
+        m_runtime.Run();
+        CHECK_HR(S_OK, m_controller->get_CoreWebView2(&m_webview));
+        FakeRuntime::GetFake(m_webview.Get())->SetPageScript([this](LPCWSTR json) { Receive(json); });
+    }
+
+    ~Harness()
+    {
+        m_controller->Close();
+    }
+
+    MessageQueue& GetQueue() { return m_queue; }
+    ICoreWebView2* GetWebView() const { return m_webview.Get(); }
+    FakeRuntime& GetRuntime() { return m_runtime; }
+    // Until then flushes keep the messages
+    void SetReady(bool ready) { m_ready = ready; }
+
+    template<typename T> void Enqueue(const T& message)
+    {
+        m_queue.Enqueue(T::c_message, GetTabId(message), m_writer.Write(message));
+    }
+
+    // Runs the loop, returns the posts the page received
+    size_t Run()
+    {
+        size_t const posts = m_posts;
+        m_runtime.Run();
+        return m_posts - posts;
+    }
+
+    size_t GetScheduledCount() const { return m_scheduled; }
+    size_t GetBatchesReceived() const { return m_batches; }
+    std::vector<std::wstring> TakeReceived()
+    {
+        std::vector<std::wstring> received;
+        received.swap(m_received);
+        return received;
+    }
+
+private:
+    FakeRuntime m_runtime;
+    MessageQueue m_queue;
+    MessageWriter m_writer;
+    ComPtr<ICoreWebView2Controller> m_controller;
+    ComPtr<ICoreWebView2> m_webview;
+    bool m_ready = true;
+    size_t m_scheduled = 0;
+    size_t m_posts = 0;
+    size_t m_batches = 0;
+    std::vector<std::wstring> m_received;
+
+    void ScheduleFlush()
+    {
+        ++m_scheduled;
+        m_runtime.Post(0, [this]() { CHECK_HR(S_OK, m_queue.Flush(m_ready ? m_webview.Get() : nullptr)); });
+    }
+
+    void Receive(LPCWSTR json)
+    {
+        ++m_posts;
+        MessageReader reader;
+        if (!CHECK_HR(S_OK, reader.Parse(json)))
+        {
+            return;
+        }
+        if (reader.GetMessageCode() != MG_BATCH)
+        {
+            m_received.push_back(json);
+            return;
+        }
+
+        ++m_batches;
+        BatchMessage batch;
+        CHECK_HR(S_OK, reader.ReadArgs(batch));
+        CHECK(batch.messages.size() > 1);
+        for (const JsonValue& message : batch.messages)
+        {
+            m_received.push_back(message.json);
+        }
+    }
+};
+
+static UpdateUriMessage MakeUri(size_t tabId, const std::wstring& uri)
+{
+    UpdateUriMessage message;
+    message.tabId = tabId;
+    message.uri = uri;
+    return message;
+}
+
+static NavCompletedMessage MakeCompleted(size_t tabId, bool isError)
+{
+    NavCompletedMessage message;
+    message.tabId = tabId;
+    message.isError = isError;
+    return message;
+}
+
+template<typename T> static std::wstring Encode(const T& message)
+{
+    MessageWriter writer;
+    return writer.Write(message);
+}
+
+// The latest state update of a type per tab is delivered, where the last one
+// was queued. Other messages are all delivered in order.
+static void TestCoalescing()
+{
+    Harness harness;
+    NavStartingMessage starting;
+    starting.tabId = 1;
+    ErrorMessage error;
+    error.code = L"E_FAIL";
+    LoadProgressMessage progress;
+    progress.total = 3;
+
+    harness.Enqueue(MakeUri(1, L"https://a.example/"));
+    harness.Enqueue(starting);
+    harness.Enqueue(MakeUri(1, L"https://b.example/"));
+    harness.Enqueue(MakeUri(2, L"https://other.example/"));
+    harness.Enqueue(MakeCompleted(1, true));
+    harness.Enqueue(error);
+    harness.Enqueue(progress);  // Not per tab, never replaced
+    harness.Enqueue(MakeUri(1, L"https://c.example/"));
+    harness.Enqueue(MakeCompleted(1, false));
+    harness.Enqueue(error);
+    harness.Enqueue(progress);
+
+    CHECK(harness.Run() == 1);
+    CHECK(harness.GetBatchesReceived() == 1);
+    std::vector<std::wstring> const expected = {
+        Encode(starting),
+        Encode(MakeUri(2, L"https://other.example/")),
+        Encode(error),
+        Encode(progress),
+        Encode(MakeUri(1, L"https://c.example/")),
+        Encode(MakeCompleted(1, false)),
+        Encode(error),
+        Encode(progress),
+    };
+    CHECK(harness.TakeReceived() == expected);
+
+    const MessageQueue& queue = harness.GetQueue();
+    CHECK(queue.GetCoalescedCount() == 3);
+    CHECK(queue.GetFlushedCount() == expected.size());
+    CHECK(queue.GetBatchCount() == 1);
+
+    // Each flush starts over, an update is only replaced within one batch
+    harness.Enqueue(MakeUri(1, L"https://d.example/"));
+    harness.Enqueue(MakeUri(3, L"https://e.example/"));
+    CHECK(harness.Run() == 1);
+    CHECK(harness.TakeReceived() == std::vector<std::wstring>({ Encode(MakeUri(1, L"https://d.example/")), Encode(MakeUri(3, L"https://e.example/")) }));
+    CHECK(queue.GetCoalescedCount() == 3);
+    CHECK(queue.GetBatchCount() == 2);
+}
+
+// A batch of one is delivered as the message itself
+static void TestSingleMessageUnwrapped()
+{
+    Harness harness;
+    harness.Enqueue(MakeUri(1, L"https://a.example/"));
+    CHECK(harness.Run() == 1);
+    CHECK(harness.GetBatchesReceived() == 0);
+    CHECK(harness.TakeReceived() == std::vector<std::wstring>({ Encode(MakeUri(1, L"https://a.example/")) }));
+
+    // Also when the others were replaced
+    for (int i = 0; i < 5; ++i)
+    {
+        harness.Enqueue(MakeUri(1, L"https://b.example/" + std::to_wstring(i)));
+    }
+    CHECK(harness.Run() == 1);
+    CHECK(harness.GetBatchesReceived() == 0);
+    CHECK(harness.TakeReceived() == std::vector<std::wstring>({ Encode(MakeUri(1, L"https://b.example/4")) }));
+    CHECK(harness.GetQueue().GetCoalescedCount() == 4);
+    CHECK(harness.GetQueue().GetBatchCount() == 2);
+
+    // An empty flush posts nothing
+    CHECK_HR(S_OK, harness.GetQueue().Flush(harness.GetWebView()));
+    CHECK(harness.Run() == 0);
+    CHECK(harness.GetQueue().GetBatchCount() == 2);
+}
+
+// Whatever is queued in one turn of the loop goes out in one post, and a
+// flush is only scheduled for the first message after the last flush
+static void TestOneFlushPerTurn()
+{
+    Harness harness;
+    for (size_t tabId = 1; tabId <= 100; ++tabId)
+    {
+        harness.Enqueue(MakeUri(tabId, L"https://a.example/"));
+        harness.Enqueue(MakeCompleted(tabId, false));
+    }
+    CHECK(harness.GetScheduledCount() == 1);
+    CHECK(harness.Run() == 1);
+    CHECK(harness.TakeReceived().size() == 200);
+
+    // Callbacks due at the same time share a flush, a later one gets its own
+    FakeRuntime& runtime = harness.GetRuntime();
+    runtime.Post(5, [&harness]() { harness.Enqueue(MakeUri(1, L"https://b.example/")); });
+    runtime.Post(5, [&harness]() { harness.Enqueue(MakeUri(2, L"https://b.example/")); });
+    runtime.Post(10, [&harness]() { harness.Enqueue(MakeUri(3, L"https://b.example/")); });
+    CHECK(harness.Run() == 2);
+    CHECK(harness.GetScheduledCount() == 3);
+    CHECK(harness.GetBatchesReceived() == 2);
+    CHECK(harness.TakeReceived().size() == 3);
+}
+
+// Until the controls page has loaded the queue is flushed without a WebView,
+// and keeps everything for the flush which has one. Updates held that long
+// still replace each other.
+static void TestHoldUntilReady()
+{
+    Harness harness;
+    harness.SetReady(false);
+    harness.Enqueue(MakeUri(1, L"https://a.example/"));
+    harness.Enqueue(MakeCompleted(1, true));
+    CHECK(harness.Run() == 0);
+    CHECK(harness.GetQueue().GetBatchCount() == 0);
+
+    // A later turn schedules another flush, which keeps them as well
+    harness.Enqueue(MakeUri(1, L"https://b.example/"));
+    harness.Enqueue(MakeUri(2, L"https://c.example/"));
+    CHECK(harness.GetScheduledCount() == 2);
+    CHECK(harness.Run() == 0);
+    CHECK(harness.GetQueue().GetFlushedCount() == 0);
+
+    // MG_RESTORE_SESSION flushes with the WebView right away
+    harness.SetReady(true);
+    CHECK_HR(S_OK, harness.GetQueue().Flush(harness.GetWebView()));
+    CHECK(harness.Run() == 1);
+    std::vector<std::wstring> const expected = {
+        Encode(MakeCompleted(1, true)),
+        Encode(MakeUri(1, L"https://b.example/")),
+        Encode(MakeUri(2, L"https://c.example/")),
+    };
+    CHECK(harness.TakeReceived() == expected);
+    CHECK(harness.GetQueue().GetCoalescedCount() == 1);
+    CHECK(harness.GetQueue().GetFlushedCount() == 3);
+
+    harness.Enqueue(MakeUri(1, L"https://d.example/"));
+    CHECK(harness.GetScheduledCount() == 3);
+    CHECK(harness.Run() == 1);
+    CHECK(harness.TakeReceived().size() == 1);
+}
+
+int main()
+{
+    TestCoalescing();
+    TestSingleMessageUnwrapped();
+    TestOneFlushPerTurn();
+    TestHoldUntilReady();
+    return CheckResult();
+}
@@ -0,0 +1,342 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests PageMetadataTracker with canned reports of the metadata script,
+// posted by a page of the fake runtime and routed to the tracker the way
+// BrowserWindow routes them: only changes are forwarded, the metadata is
+// cleaned up, malformed reports and missing fields, and reports which arrive
+// after the tab navigated away.
+
+#include "Check.h"
+#include "FakeWebView2.h"
+#include "MessageCodec.h"
+#include "MessageDispatcher.h"
+#include "PageMetadataTracker.h"
+
+using namespace Microsoft::WRL;
+
+static HWND const c_window = reinterpret_cast<HWND>(1);
+static size_t const c_tabId = 7;
+
+// One tab and the tracker, wired like BrowserWindow wires them
+class Harness
+{
+public:
+    Harness() : m_runtime(FakeScript())
+    {
+        ComPtr<ICoreWebView2Environment> env = m_runtime.CreateEnvironment();
+        CHECK_HR(S_OK, env->CreateCoreWebView2Controller(c_window, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+            [this](HRESULT errorCode, ICoreWebView2Controller* host) -> HRESULT
+        {
+            CHECK_HR(S_OK, errorCode);
+            m_controller = host;
+            return S_OK;
+        }).Get()));
+        m_runtime.Run();
+        CHECK_HR(S_OK, m_controller->get_CoreWebView2(&m_webview));
+
+        CHECK_HR(S_OK, m_webview->add_NavigationStarting(Callback<ICoreWebView2NavigationStartingEventHandler>(
+            [this](ICoreWebView2*, ICoreWebView2NavigationStartingEventArgs*) -> HRESULT
+        {
+            // The new document reports its metadata even if it is the same
+            m_tracker.Forget(c_tabId);
+            return S_OK;
+        }).Get(), &m_navigationStartingToken));
+        CHECK_HR(S_OK, m_webview->add_WebMessageReceived(Callback<ICoreWebView2WebMessageReceivedEventHandler>(
+            [this](ICoreWebView2* webview, ICoreWebView2WebMessageReceivedEventArgs* args) -> HRESULT
+        {
+            m_results.push_back(HandleMessage(webview, args));
+            return S_OK;
+        }).Get(), &m_messageToken));
+
+        m_dispatcher.RegisterForAnyPage<PageMetadataMessage>(
+            [this](const PageMetadataMessage& args, const MessageContext& context) -> HRESULT
+        {
+            PageMetadataMessage message = args;
+            if (m_tracker.Update(context.tabId, message))
+            {
+                m_forwarded.push_back(message);
+            }
+            return S_OK;
+        });
+    }
+
+    ~Harness()
+    {
+        m_controller->Close();
+    }
+
+    PageMetadataTracker& operator*() { return m_tracker; }
+    PageMetadataTracker* operator->() { return &m_tracker; }
+
+    // Navigates and waits until the page has loaded
+    void Load(LPCWSTR uri)
+    {
+        CHECK_HR(S_OK, m_webview->Navigate(uri));
+        m_runtime.Run();
+    }
+
+    void Navigate(LPCWSTR uri) { CHECK_HR(S_OK, m_webview->Navigate(uri)); }
+    void RunUntil(ULONGLONG time) { m_runtime.RunUntil(time); }
+    ULONGLONG GetTime() const { return m_runtime.GetTime(); }
+
+    // What the script posts, args is the JSON of the args object
+    void Report(const std::wstring& args, ULONGLONG delay = 0)
+    {
+        Post(L"{\"message\":" + std::to_wstring(MG_PAGE_METADATA) + L",\"args\":" + args + L"}", delay);
+    }
+    void Post(const std::wstring& json, ULONGLONG delay = 0)
+    {
+        FakeRuntime::GetFake(m_webview.Get())->ReceiveMessage(json, delay);
+    }
+    void Run() { m_runtime.Run(); }
+
+    std::vector<PageMetadataMessage> TakeForwarded()
+    {
+        std::vector<PageMetadataMessage> forwarded;
+        forwarded.swap(m_forwarded);
+        return forwarded;
+    }
+
+    // What handling each message returned
+    std::vector<HRESULT> TakeResults()
+    {
+        std::vector<HRESULT> results;
+        results.swap(m_results);
+        return results;
+    }
+
+private:
+    FakeRuntime m_runtime;
+    ComPtr<ICoreWebView2Controller> m_controller;
+    ComPtr<ICoreWebView2> m_webview;
+    EventRegistrationToken m_navigationStartingToken = {};
+    EventRegistrationToken m_messageToken = {};
+    MessageDispatcher m_dispatcher;
+    PageMetadataTracker m_tracker;
+    std::vector<PageMetadataMessage> m_forwarded;
+    std::vector<HRESULT> m_results;
+
+    // BrowserWindow::HandleTabMessageReceived
+    HRESULT HandleMessage(ICoreWebView2* webview, ICoreWebView2WebMessageReceivedEventArgs* eventArgs)
+    {
+        wil::unique_cotaskmem_string jsonArgs;
+        RETURN_IF_FAILED(eventArgs->get_WebMessageAsJson(&jsonArgs));
+
+        MessageReader reader;
+        RETURN_IF_FAILED(reader.Parse(jsonArgs.get()));
+
+        wil::unique_cotaskmem_string sender;
+        RETURN_IF_FAILED(eventArgs->get_Source(&sender));
+        wil::unique_cotaskmem_string source;
+        RETURN_IF_FAILED(webview->get_Source(&source));
+        if (wcscmp(sender.get(), source.get()) != 0)
+        {
+            return S_FALSE;
+        }
+
+        MessageContext context = { reader, jsonArgs.get(), c_tabId };
+        return m_dispatcher.Dispatch(context, InternalPage::None);
+    }
+};
+
+static bool Is(const PageMetadataMessage& metadata, LPCWSTR title, LPCWSTR favicon, LPCWSTR canonical, LPCWSTR themeColor)
+{
+    return metadata.tabId == c_tabId && metadata.title == title && metadata.favicon == favicon &&
+        metadata.canonical == canonical && metadata.themeColor == themeColor;
+}
+
+// Reports are forwarded when they differ from the last one of the tab
+static void TestChanges()
+{
+    Harness harness;
+    harness.Load(L"https://example.com/");
+    harness.Report(L"{\"title\":\"Example\",\"favicon\":\"https://example.com/favicon.ico\","
+        L"\"canonical\":\"https://example.com/\",\"themeColor\":\"#336699\"}");
+    harness.Report(L"{\"title\":\"Example\",\"favicon\":\"https://example.com/favicon.ico\","
+        L"\"canonical\":\"https://example.com/\",\"themeColor\":\"#336699\"}");
+    harness.Report(L"{\"title\":\" Example \\n\",\"favicon\":\"https://example.com/favicon.ico\","
+        L"\"canonical\":\"https://example.com/\",\"themeColor\":\" #336699 \"}");
+    harness.Report(L"{\"title\":\"Inbox (1)\",\"favicon\":\"https://example.com/favicon.ico\","
+        L"\"canonical\":\"https://example.com/\",\"themeColor\":\"#336699\"}");
+    harness.Run();
+    CHECK(harness.TakeResults() == std::vector<HRESULT>(4, S_OK));
+    std::vector<PageMetadataMessage> forwarded = harness.TakeForwarded();
+    if (CHECK(forwarded.size() == 2))
+    {
+        CHECK(Is(forwarded[0], L"Example", L"https://example.com/favicon.ico", L"https://example.com/", L"#336699"));
+        CHECK(Is(forwarded[1], L"Inbox (1)", L"https://example.com/favicon.ico", L"https://example.com/", L"#336699"));
+    }
+
+    PageMetadataMessage last;
+    CHECK(harness->GetLast(c_tabId, last));
+    CHECK(last.title == L"Inbox (1)");
+    CHECK(!harness->GetLast(c_tabId + 1, last));
+
+    // Reloading reports again, even the same metadata
+    harness.Load(L"https://example.com/");
+    CHECK(!harness->GetLast(c_tabId, last));
+    harness.Report(L"{\"title\":\"Inbox (1)\",\"favicon\":\"https://example.com/favicon.ico\","
+        L"\"canonical\":\"https://example.com/\",\"themeColor\":\"#336699\"}");
+    harness.Run();
+    CHECK(harness.TakeForwarded().size() == 1);
+}
+
+// What a page reports is cleaned up before it gets to the controls UI
+static void TestCleanup()
+{
+    Harness harness;
+    harness.Load(L"https://example.com/");
+    harness.Report(L"{\"title\":\"\\t A\\u00a0\\u0001 title  \",\"favicon\":\"javascript:alert(1)\","
+        L"\"canonical\":\"data:image/png;base64,AAAA\",\"themeColor\":\"red; background: url(x)\"}");
+    harness.Run();
+    std::vector<PageMetadataMessage> forwarded = harness.TakeForwarded();
+    if (CHECK(forwarded.size() == 1))
+    {
+        CHECK(Is(forwarded[0], L"A title", L"", L"", L""));
+    }
+
+    // Inline favicons are kept, up to a size
+    std::wstring const icon = L"data:image/png;base64," + std::wstring(100, L'A');
+    harness.Report(L"{\"title\":\"A title\",\"favicon\":\"" + icon + L"\",\"themeColor\":\"rgb(10, 20, 30)\"}");
+    harness.Report(L"{\"title\":\"A title\",\"favicon\":\"data:image/png;base64," +
+        std::wstring(PageMetadataTracker::c_maxDataUriLength, L'A') + L"\",\"themeColor\":\"rgb(10, 20, 30)\"}");
+    harness.Run();
+    forwarded = harness.TakeForwarded();
+    if (CHECK(forwarded.size() == 2))
+    {
+        CHECK(Is(forwarded[0], L"A title", icon.c_str(), L"", L"rgb(10, 20, 30)"));
+        CHECK(Is(forwarded[1], L"A title", L"", L"", L"rgb(10, 20, 30)"));
+    }
+
+    // Long titles are cut without splitting a surrogate pair, which is two
+    // escapes in JSON
+    std::wstring title;
+    for (size_t i = 0; i + 1 < PageMetadataTracker::c_maxTitleLength; ++i)
+    {
+        title += L'x';
+    }
+    harness.Report(L"{\"title\":\"" + title + L"\\ud83d\\ude80\"}");
+    harness.Run();
+    forwarded = harness.TakeForwarded();
+    if (CHECK(forwarded.size() == 1))
+    {
+        CHECK(forwarded[0].title == title);
+    }
+}
+
+// Reports the codec can't read are dropped without touching the last
+// metadata of the tab
+static void TestMalformed()
+{
+    Harness harness;
+    harness.Load(L"https://example.com/");
+    harness.Report(L"{\"title\":\"Example\"}");
+    harness.Run();
+    CHECK(harness.TakeForwarded().size() == 1);
+    harness.TakeResults();
+
+    std::wstring const code = std::to_wstring(MG_PAGE_METADATA);
+    static LPCWSTR const c_malformed[] =
+    {
+        L"",
+        L"{",
+        L"\"Example\"",
+        L"{\"message\":",
+        L"{\"message\":\"metadata\",\"args\":{}}",
+        L"{\"args\":{\"title\":\"Other\"}}",
+    };
+    for (LPCWSTR json : c_malformed)
+    {
+        harness.Post(json);
+    }
+    harness.Post(L"{\"message\":" + code + L",\"args\":{\"title\":\"Other\"");
+    harness.Post(L"{\"message\":" + code + L",\"args\":\"Other\"}");
+    harness.Report(L"{\"title\":5}");
+    harness.Report(L"{\"title\":\"Other\",\"favicon\":[\"https://example.com/a.ico\"]}");
+    harness.Report(L"{\"title\":\"Other\\u12\"}");
+    harness.Report(L"{\"title\":\"Other\",\"themeColor\":null}");
+    harness.Run();
+
+    std::vector<HRESULT> const results = harness.TakeResults();
+    if (CHECK(results.size() == _countof(c_malformed) + 6))
+    {
+        for (HRESULT result : results)
+        {
+            CHECK(result != S_OK);
+        }
+    }
+    CHECK(harness.TakeForwarded().empty());
+    PageMetadataMessage last;
+    CHECK(harness->GetLast(c_tabId, last) && last.title == L"Example");
+}
+
+// Fields the page leaves out are empty, unknown ones are skipped, and the
+// page can't pick the tab
+static void TestMissingFields()
+{
+    Harness harness;
+    harness.Load(L"https://example.com/docs/");
+    harness.Report(L"{}");
+    harness.Report(L"{\"title\":\"Docs\",\"tabId\":1,\"unknown\":{\"nested\":[1,2]}}");
+    harness.Report(L"{\"favicon\":\"https://example.com/favicon.ico\",\"title\":\"Docs\"}");
+    harness.Report(L"{\"favicon\":\"https://example.com/favicon.ico\",\"title\":\"Docs\",\"canonical\":\"\"}");
+    harness.Run();
+    CHECK(harness.TakeResults() == std::vector<HRESULT>(4, S_OK));
+    std::vector<PageMetadataMessage> forwarded = harness.TakeForwarded();
+    if (CHECK(forwarded.size() == 3))
+    {
+        CHECK(Is(forwarded[0], L"", L"", L"", L""));
+        CHECK(Is(forwarded[1], L"Docs", L"", L"", L""));
+        CHECK(Is(forwarded[2], L"Docs", L"https://example.com/favicon.ico", L"", L""));
+    }
+}
+
+// A report of the old document arriving once the tab shows the new one is
+// dropped. Until the new document commits the old one is still shown, and
+// its reports count.
+static void TestNavigatedAway()
+{
+    Harness harness;
+    harness.Load(L"https://old.example/");
+    harness.Report(L"{\"title\":\"Old\"}");
+    harness.Run();
+    CHECK(harness.TakeForwarded().size() == 1);
+    harness.TakeResults();
+
+    // Commits after FakeScript::commitLatency
+    ULONGLONG const start = harness.GetTime();
+    harness.Report(L"{\"title\":\"Old, still loading\"}", 10);
+    harness.Report(L"{\"title\":\"Old, late\"}", 100);
+    harness.Navigate(L"https://new.example/");
+    harness.RunUntil(start + 50);
+    std::vector<PageMetadataMessage> forwarded = harness.TakeForwarded();
+    if (CHECK(forwarded.size() == 1))
+    {
+        CHECK(forwarded[0].title == L"Old, still loading");
+    }
+
+    harness.Run();
+    CHECK(harness.TakeForwarded().empty());
+    CHECK(harness.TakeResults() == std::vector<HRESULT>({ S_OK, S_FALSE }));
+
+    // The new document reports its own
+    harness.Report(L"{\"title\":\"New\"}");
+    harness.Run();
+    forwarded = harness.TakeForwarded();
+    if (CHECK(forwarded.size() == 1))
+    {
+        CHECK(forwarded[0].title == L"New");
+    }
+}
+
+int main()
+{
+    TestChanges();
+    TestCleanup();
+    TestMalformed();
+    TestMissingFields();
+    TestNavigatedAway();
+    return CheckResult();
+}
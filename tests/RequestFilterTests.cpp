@@ -0,0 +1,541 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests FilterCompiler and RequestFilter: which lines become rules and which
+// are skipped, the |, || and ^ anchors and wildcards, the resource type,
+// $third-party and $domain= options with their negations, and exceptions
+// winning over blocking rules. RequestFilter::Load has to reject damaged
+// snapshots: truncated ones, headers and rules pointing out of the snapshot,
+// and every single flipped byte either fails to load or still matches
+// without reading out of bounds. With --bench it compiles 50k rules shaped
+// like those of EasyList and reports the match latencies.
+
+#include "Check.h"
+#include "RequestFilter.h"
+
+#include <random>
+
+typedef std::vector<BYTE> Bytes;
+
+// The offsets of the fields of RequestFilter::Header a test damages
+static const size_t c_sizeOffset = 24;
+static const size_t c_domainsOffset = 32;
+static const size_t c_ruleCountOffset = 36;
+static const size_t c_rulesOffset = 40;
+static const size_t c_postingsOffset = 48;
+static const size_t c_stringSizeOffset = 52;
+static const size_t c_stringsOffset = 56;
+static const size_t c_tablesOffset = 64;
+static const size_t c_ruleSize = 24;
+static const size_t c_slotSize = 16;
+
+static UINT32 Read32(const Bytes& data, size_t offset)
+{
+    UINT32 value;
+    memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
+}
+
+static void Write32(Bytes& data, size_t offset, UINT32 value)
+{
+    memcpy(data.data() + offset, &value, sizeof(value));
+}
+
+static Bytes Compile(const std::string& rules, FilterCompiler::Statistics* statistics = nullptr)
+{
+    FilterCompiler compiler;
+    compiler.AddRules(rules.data(), rules.size());
+    Bytes snapshot;
+    CHECK_HR(S_OK, compiler.Build(1234, 5678, snapshot));
+    if (statistics)
+    {
+        *statistics = compiler.GetStatistics();
+    }
+    return snapshot;
+}
+
+// Compiles and loads the rules, the snapshot has to outlive the filter
+class Filter
+{
+public:
+    explicit Filter(const std::string& rules) : m_snapshot(Compile(rules))
+    {
+        CHECK_HR(S_OK, m_filter.Load(m_snapshot.data(), m_snapshot.size()));
+    }
+
+    bool Blocks(const std::string& uri, const std::string& document = "http://page.test/", ResourceType type = ResourceType::Script)
+    {
+        m_request.Set(uri, document, type);
+        return m_filter.Match(m_request);
+    }
+
+private:
+    Bytes m_snapshot;
+    RequestFilter m_filter;
+    FilterRequest m_request;
+};
+
+// Comments, element hiding, regular expressions and unsupported options
+// don't become rules, each rule is filed under its host, a word or nothing.
+// A pattern between slashes is a regular expression, /path/* is not.
+static void TestParsing()
+{
+    FilterCompiler::Statistics statistics;
+    Bytes snapshot = Compile(
+        "[Adblock Plus 2.0]\n"
+        "! A comment\n"
+        "\n"
+        "   \r\n"
+        "example.com##.advert\n"
+        "example.com#@#.advert\n"
+        "/banner[0-9]+\\.gif/\n"
+        "/adframe/\n"
+        "||popups.test^$popup\n"
+        "/everything/$~script,~image,~stylesheet,~font,~media,~xmlhttprequest,~subdocument,~websocket,~ping,~other\n"
+        "||ads.example.com^\r\n"
+        "  ||Tracker.Example.NET^$third-party  \n"
+        "/adserver/*\n"
+        "&ad_type=\n"
+        "adframe\n"
+        "@@||ads.example.com/allowed^\n",
+        &statistics);
+    CHECK(statistics.hostRules == 2);
+    CHECK(statistics.tokenRules == 3);
+    CHECK(statistics.genericRules == 1);
+    CHECK(statistics.exceptions == 1);
+    CHECK(statistics.skipped == 6);
+
+    RequestFilter filter;
+    CHECK_HR(S_OK, filter.Load(snapshot.data(), snapshot.size()));
+    CHECK(filter.IsLoaded());
+    CHECK(filter.GetRuleCount() == 6);
+    CHECK(filter.GetSourceTime() == 1234);
+    CHECK(filter.GetSourceSize() == 5678);
+
+    // Hosts are compared in lower case, the skipped rules block nothing
+    FilterRequest request;
+    request.Set("http://tracker.example.net/p.gif", "http://news.test/", ResourceType::Image);
+    CHECK(filter.Match(request));
+    request.Set("http://popups.test/", "http://news.test/", ResourceType::Other);
+    CHECK(!filter.Match(request));
+    request.Set("http://a.test/everything/", "http://news.test/", ResourceType::Script);
+    CHECK(!filter.Match(request));
+    request.Set("http://a.test/banner12.gif", "http://news.test/", ResourceType::Image);
+    CHECK(!filter.Match(request));
+
+    // An empty list is a valid snapshot which blocks nothing
+    Bytes const empty = Compile("! Nothing\n");
+    CHECK_HR(S_OK, filter.Load(empty.data(), empty.size()));
+    CHECK(filter.GetRuleCount() == 0);
+    CHECK(!filter.Match(request));
+    filter.Unload();
+    CHECK(!filter.IsLoaded());
+    CHECK(!filter.Match(request));
+}
+
+// || matches at the start of the host or of one of its labels, | at the
+// start or end of the address, ^ a separator or the end of the address
+static void TestAnchors()
+{
+    Filter filter(
+        "||ads.example.com^\n"
+        "||example.org/banner^\n"
+        "|http://start.test/\n"
+        "end.js|\n"
+        "/pixel^\n"
+        "/adx*/img/*\n"
+        "BigBanner$match-case\n"
+        "MixedCase\n");
+
+    CHECK(filter.Blocks("http://ads.example.com/x.js"));
+    CHECK(filter.Blocks("https://cdn.ads.example.com/"));
+    CHECK(filter.Blocks("http://ads.example.com"));
+    CHECK(filter.Blocks("http://user@ads.example.com:8080/"));
+    CHECK(!filter.Blocks("http://badads.example.com/"));
+    CHECK(!filter.Blocks("http://ads.example.com.evil.test/"));
+    CHECK(!filter.Blocks("http://other.test/?u=ads.example.com"));
+
+    CHECK(filter.Blocks("http://example.org/banner"));
+    CHECK(filter.Blocks("http://www.example.org/banner/1"));
+    CHECK(filter.Blocks("http://example.org/banner?size=2"));
+    CHECK(!filter.Blocks("http://example.org/banners"));
+    CHECK(!filter.Blocks("http://notexample.org/banner"));
+    CHECK(!filter.Blocks("http://other.test/example.org/banner"));
+
+    CHECK(filter.Blocks("http://start.test/a"));
+    CHECK(!filter.Blocks("https://other.test/?r=http://start.test/"));
+
+    CHECK(filter.Blocks("http://a.test/lib/end.js"));
+    CHECK(!filter.Blocks("http://a.test/lib/end.js?v=1"));
+
+    CHECK(filter.Blocks("http://a.test/pixel"));
+    CHECK(filter.Blocks("http://a.test/pixel?id=1"));
+    CHECK(filter.Blocks("http://a.test/pixel/"));
+    CHECK(!filter.Blocks("http://a.test/pixels"));
+    CHECK(!filter.Blocks("http://a.test/pixel.gif"));
+    CHECK(!filter.Blocks("http://a.test/pixel-1"));
+
+    CHECK(filter.Blocks("http://a.test/adx/img/1.png"));
+    CHECK(filter.Blocks("http://a.test/adx-large/thumbs/img/1.png"));
+    CHECK(!filter.Blocks("http://a.test/img/adx/1.png"));
+
+    CHECK(filter.Blocks("http://a.test/BigBanner.png"));
+    CHECK(!filter.Blocks("http://a.test/bigbanner.png"));
+    CHECK(filter.Blocks("http://a.test/MIXEDcase.png"));
+
+    // Addresses without a host only match rules which don't need one
+    CHECK(!filter.Blocks("data:text/plain,ads.example.com"));
+    CHECK(filter.Blocks("data:text/plain,mixedcase"));
+    CHECK(!filter.Blocks(""));
+}
+
+// $third-party compares the sites of the request and the page, the last two
+// labels of the host or three for country code domains
+static void TestThirdParty()
+{
+    Filter filter(
+        "||track.com^$third-party\n"
+        "/own-stats/*$~third-party\n"
+        "/widget.js$3p,script\n");
+
+    CHECK(filter.Blocks("http://cdn.track.com/p.js", "http://news.test/"));
+    CHECK(!filter.Blocks("http://cdn.track.com/p.js", "https://www.track.com/"));
+    CHECK(!filter.Blocks("http://cdn.track.com/p.js", ""));
+
+    CHECK(filter.Blocks("http://news.example.co.uk/own-stats/", "http://www.example.co.uk/"));
+    CHECK(!filter.Blocks("http://news.example.co.uk/own-stats/", "http://www.other.co.uk/"));
+    CHECK(filter.Blocks("http://10.0.0.1/own-stats/", "http://10.0.0.1/"));
+    CHECK(!filter.Blocks("http://10.0.0.1/own-stats/", "http://10.0.0.2/"));
+
+    CHECK(filter.Blocks("http://w.test/widget.js", "http://page.test/", ResourceType::Script));
+    CHECK(!filter.Blocks("http://w.test/widget.js", "http://page.test/", ResourceType::Image));
+    CHECK(!filter.Blocks("http://w.test/widget.js", "http://www.w.test/", ResourceType::Script));
+}
+
+// $domain= lists the pages a rule applies on and their subdomains, ~ the
+// pages it doesn't. A page which matches a ~ entry is never blocked by the
+// rule, whatever the order of the entries.
+static void TestDomains()
+{
+    Filter filter(
+        "/promo/*$domain=shop.com|~blog.shop.com\n"
+        "/survey/*$domain=~news.com\n"
+        "/coupon/*$domain=~deals.shop.com|shop.com|other.com\n");
+
+    CHECK(filter.Blocks("http://cdn.test/promo/1", "http://shop.com/"));
+    CHECK(filter.Blocks("http://cdn.test/promo/1", "https://www.shop.com/cart"));
+    CHECK(!filter.Blocks("http://cdn.test/promo/1", "http://blog.shop.com/"));
+    CHECK(!filter.Blocks("http://cdn.test/promo/1", "http://sub.blog.shop.com/"));
+    CHECK(!filter.Blocks("http://cdn.test/promo/1", "http://myshop.com/"));
+    CHECK(!filter.Blocks("http://cdn.test/promo/1", ""));
+
+    CHECK(filter.Blocks("http://cdn.test/survey/", "http://other.com/"));
+    CHECK(filter.Blocks("http://cdn.test/survey/", ""));
+    CHECK(!filter.Blocks("http://cdn.test/survey/", "http://news.com/"));
+    CHECK(!filter.Blocks("http://cdn.test/survey/", "http://www.news.com/"));
+
+    CHECK(filter.Blocks("http://cdn.test/coupon/", "http://other.com/"));
+    CHECK(filter.Blocks("http://cdn.test/coupon/", "http://shop.com/"));
+    CHECK(!filter.Blocks("http://cdn.test/coupon/", "http://deals.shop.com/"));
+}
+
+// An exception which matches allows the request, even over $important
+static void TestExceptions()
+{
+    Filter filter(
+        "||ads.example.com^$important\n"
+        "@@||ads.example.com/allowed/\n"
+        "@@||ads.example.com^$domain=partner.com\n"
+        "/adframe/*\n"
+        "@@/adframe/*$image\n"
+        "@@||cdn.test/adframe/$~third-party\n");
+
+    CHECK(filter.Blocks("http://ads.example.com/banner.js"));
+    CHECK(!filter.Blocks("http://ads.example.com/allowed/banner.js"));
+    CHECK(!filter.Blocks("http://ads.example.com/banner.js", "http://www.partner.com/"));
+
+    CHECK(filter.Blocks("http://a.test/adframe/1", "http://page.test/", ResourceType::Subdocument));
+    CHECK(!filter.Blocks("http://a.test/adframe/1", "http://page.test/", ResourceType::Image));
+    CHECK(filter.Blocks("http://cdn.test/adframe/1", "http://page.test/", ResourceType::Script));
+    CHECK(!filter.Blocks("http://cdn.test/adframe/1", "http://www.cdn.test/", ResourceType::Script));
+
+    // An exception without a blocking rule changes nothing
+    Filter allowOnly("@@||ads.example.com^\n");
+    CHECK(!allowOnly.Blocks("http://ads.example.com/"));
+}
+
+// Loads a copy of exactly size bytes, so AddressSanitizer catches any read
+// past it, and matches a few requests if it loads
+static HRESULT LoadCopy(const Bytes& snapshot, size_t size)
+{
+    Bytes copy(snapshot.begin(), snapshot.begin() + size);
+    RequestFilter filter;
+    HRESULT const hr = filter.Load(copy.data(), copy.size());
+    CHECK(filter.IsLoaded() == SUCCEEDED(hr));
+    if (SUCCEEDED(hr))
+    {
+        FilterRequest request;
+        static const char* const c_uris[] = {
+            "http://ads.example.com/banner.js", "http://a.test/adframe/1?x=2", "http://cdn.test/promo/pixel^", "data:," };
+        for (const char* uri : c_uris)
+        {
+            request.Set(uri, "http://shop.com/", ResourceType::Script);
+            filter.Match(request);
+        }
+    }
+    return hr;
+}
+
+static HRESULT LoadDamaged(Bytes snapshot, size_t offset, UINT32 value)
+{
+    Write32(snapshot, offset, value);
+    return LoadCopy(snapshot, snapshot.size());
+}
+
+// Damaged snapshots fail to load with ERROR_INVALID_DATA, and leave the
+// filter unloaded
+static void TestDamagedSnapshots()
+{
+    Bytes const snapshot = Compile(
+        "||ads.example.com^\n"
+        "@@||ads.example.com/allowed/\n"
+        "/adframe/*$domain=shop.com|~blog.shop.com\n"
+        "@@/adframe/*$image\n"
+        "/pixel^\n"
+        "adframe\n");
+    HRESULT const invalid = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    CHECK_HR(S_OK, LoadCopy(snapshot, snapshot.size()));
+
+    for (size_t size = 0; size < snapshot.size(); ++size)
+    {
+        CHECK_HR(invalid, LoadCopy(snapshot, size));
+    }
+
+    // Also with a size field which claims the shorter length
+    for (size_t size = 96; size < snapshot.size(); size += 4)
+    {
+        Bytes truncated(snapshot.begin(), snapshot.begin() + size);
+        Write32(truncated, c_sizeOffset, static_cast<UINT32>(size));
+        CHECK_HR(invalid, LoadCopy(truncated, size));
+    }
+
+    UINT32 const size = static_cast<UINT32>(snapshot.size());
+    CHECK_HR(invalid, LoadDamaged(snapshot, 0, RequestFilter::c_magic + 1));
+    CHECK_HR(invalid, LoadDamaged(snapshot, 4, RequestFilter::c_version + 1));
+    CHECK_HR(invalid, LoadDamaged(snapshot, c_sizeOffset, size + 8));
+    CHECK_HR(invalid, LoadDamaged(snapshot, c_domainsOffset, size + 8));
+    CHECK_HR(invalid, LoadDamaged(snapshot, c_domainsOffset, Read32(snapshot, c_domainsOffset) + 4));
+    CHECK_HR(invalid, LoadDamaged(snapshot, c_ruleCountOffset, 0x10000000));
+    CHECK_HR(invalid, LoadDamaged(snapshot, c_rulesOffset, Read32(snapshot, c_rulesOffset) + 2));
+    CHECK_HR(invalid, LoadDamaged(snapshot, c_postingsOffset, size));
+    CHECK_HR(invalid, LoadDamaged(snapshot, c_stringsOffset, size + 1));
+
+    // A rule whose pattern or domains run past their sections
+    UINT32 const rules = Read32(snapshot, c_rulesOffset);
+    CHECK_HR(invalid, LoadDamaged(snapshot, rules + 4, Read32(snapshot, c_stringSizeOffset) + 1));
+    CHECK_HR(invalid, LoadDamaged(snapshot, rules + 2 * c_ruleSize + 20, 100));
+
+    // A posting of a rule which doesn't exist
+    CHECK_HR(invalid, LoadDamaged(snapshot, Read32(snapshot, c_postingsOffset), Read32(snapshot, c_ruleCountOffset)));
+
+    // Tables which aren't a power of 2, run out of the snapshot, point past
+    // the postings or have no empty slot to end a probe
+    CHECK_HR(invalid, LoadDamaged(snapshot, c_tablesOffset + 4, 3));
+    CHECK_HR(invalid, LoadDamaged(snapshot, c_tablesOffset + 4, 0x1000));
+    UINT32 const slots = Read32(snapshot, c_tablesOffset);
+    UINT32 const slotCount = Read32(snapshot, c_tablesOffset + 4);
+    CHECK(slotCount != 0);
+    CHECK_HR(invalid, LoadDamaged(snapshot, slots + 8, 0x7FFFFFFF));
+    Bytes full = snapshot;
+    for (UINT32 i = 0; i < slotCount; ++i)
+    {
+        Write32(full, slots + i * c_slotSize + 12, 1);
+    }
+    CHECK_HR(invalid, LoadCopy(full, full.size()));
+
+    // A snapshot which isn't aligned to 8 bytes
+    Bytes shifted(snapshot.size() + 8);
+    memcpy(shifted.data() + 4, snapshot.data(), snapshot.size());
+    RequestFilter filter;
+    CHECK_HR(invalid, filter.Load(shifted.data() + 4, snapshot.size()));
+    CHECK(!filter.IsLoaded());
+
+    // Every byte flipped either fails or loads a filter which matches within
+    // bounds
+    size_t loaded = 0;
+    for (size_t offset = 0; offset < snapshot.size(); ++offset)
+    {
+        for (BYTE mask : { 0x01, 0x80, 0xFF })
+        {
+            Bytes flipped = snapshot;
+            flipped[offset] ^= mask;
+            loaded += SUCCEEDED(LoadCopy(flipped, flipped.size())) ? 1 : 0;
+        }
+    }
+    CHECK(loaded != 0);
+}
+
+// Rules shaped like those of EasyList: mostly hosts, a few with
+// $third-party, paths and query parameters, some with $domain= or a resource
+// type, and a few exceptions and rules without a word. hosts gets the hosts
+// the rules block.
+static std::string GenerateRules(size_t count, std::vector<std::string>& hosts)
+{
+    static const char* const c_tlds[] = { "com", "net", "org", "io", "co.uk", "de" };
+    std::mt19937 random(1);
+    std::string rules;
+    char line[256];
+    char host[128];
+    for (size_t i = 0; i < count; ++i)
+    {
+        unsigned const kind = random() % 1000;
+        const char* const tld = c_tlds[random() % _countof(c_tlds)];
+        if (kind < 600)
+        {
+            snprintf(host, sizeof(host), "ads%zu.tracker%u.%s", i, static_cast<unsigned>(random() % 5000), tld);
+            snprintf(line, sizeof(line), "||%s^\n", host);
+            hosts.push_back(host);
+        }
+        else if (kind < 700)
+        {
+            snprintf(line, sizeof(line), "||metrics%zu.%s^$third-party\n", i, tld);
+        }
+        else if (kind < 800)
+        {
+            snprintf(line, sizeof(line), "/banner%zu/*\n", i);
+        }
+        else if (kind < 870)
+        {
+            snprintf(line, sizeof(line), "&adid%zu=\n", i);
+        }
+        else if (kind < 920)
+        {
+            snprintf(line, sizeof(line), "/promo%zu.js$script,domain=site%u.%s|~blog.site%u.%s\n",
+                i, static_cast<unsigned>(i % 300), tld, static_cast<unsigned>(i % 300), tld);
+        }
+        else if (kind < 960)
+        {
+            snprintf(line, sizeof(line), "||cdn%zu.%s/ads/*.gif$image\n", i, tld);
+        }
+        else if (kind < 997)
+        {
+            snprintf(line, sizeof(line), "@@||%s/allowed/\n", hosts.empty() ? "none.test" : hosts.back().c_str());
+        }
+        else
+        {
+            snprintf(line, sizeof(line), "advert%zu_\n", i);
+        }
+        rules += line;
+    }
+    return rules;
+}
+
+// An eighth of the requests go to hosts of the list, some to paths it
+// blocks, the rest to pages and resources no rule blocks
+static void GenerateRequests(size_t count, const std::vector<std::string>& hosts, std::vector<std::pair<std::string, std::string>>& requests)
+{
+    std::mt19937 random(2);
+    char uri[256];
+    char document[128];
+    requests.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        unsigned const site = static_cast<unsigned>(random() % 300);
+        snprintf(document, sizeof(document), "https://www.site%u.com/articles/%u", site, static_cast<unsigned>(random() % 1000));
+        switch (random() % 8)
+        {
+        case 0:
+            snprintf(uri, sizeof(uri), "https://%s/serve?slot=%u", hosts[random() % hosts.size()].c_str(),
+                static_cast<unsigned>(random() % 100));
+            break;
+        case 1:
+            snprintf(uri, sizeof(uri), "https://static.site%u.com/banner%u/top.png", site, static_cast<unsigned>(random() % 50000));
+            break;
+        case 2:
+        case 3:
+            snprintf(uri, sizeof(uri), "https://static.site%u.com/js/app.%u.js?v=%u", site,
+                static_cast<unsigned>(random() % 1000), static_cast<unsigned>(random()));
+            break;
+        case 4:
+        case 5:
+            snprintf(uri, sizeof(uri), "https://images.cdn%u.net/photos/2024/%u/large.jpg", static_cast<unsigned>(random() % 100),
+                static_cast<unsigned>(random()));
+            break;
+        default:
+            snprintf(uri, sizeof(uri), "https://api.site%u.com/v2/comments?article=%u&page=%u", site,
+                static_cast<unsigned>(random() % 1000), static_cast<unsigned>(random() % 10));
+            break;
+        }
+        requests.emplace_back(uri, document);
+    }
+}
+
+static void RunMatches(size_t ruleCount, size_t requestCount)
+{
+    std::vector<std::string> hosts;
+    std::string const rules = GenerateRules(ruleCount, hosts);
+    auto start = std::chrono::steady_clock::now();
+    FilterCompiler compiler;
+    compiler.AddRules(rules.data(), rules.size());
+    Bytes snapshot;
+    CHECK_HR(S_OK, compiler.Build(0, rules.size(), snapshot));
+    double const compileSeconds = SecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    RequestFilter filter;
+    CHECK_HR(S_OK, filter.Load(snapshot.data(), snapshot.size()));
+    double const loadSeconds = SecondsSince(start);
+
+    std::vector<std::pair<std::string, std::string>> requests;
+    GenerateRequests(requestCount, hosts, requests);
+    std::vector<double> setTimes;
+    std::vector<double> matchTimes;
+    setTimes.reserve(requests.size());
+    matchTimes.reserve(requests.size());
+    FilterRequest request;
+    size_t blocked = 0;
+    auto const total = std::chrono::steady_clock::now();
+    for (const auto& entry : requests)
+    {
+        start = std::chrono::steady_clock::now();
+        request.Set(entry.first, entry.second, ResourceType::Image);
+        auto const set = std::chrono::steady_clock::now();
+        blocked += filter.Match(request) ? 1 : 0;
+        auto const matched = std::chrono::steady_clock::now();
+        setTimes.push_back(std::chrono::duration<double>(set - start).count() * 1e6);
+        matchTimes.push_back(std::chrono::duration<double>(matched - set).count() * 1e6);
+    }
+    double const totalSeconds = SecondsSince(total);
+    CHECK(blocked != 0 && blocked < requests.size());
+
+    const FilterCompiler::Statistics& statistics = compiler.GetStatistics();
+    std::printf("{\"scenario\":\"match\",\"rules\":%zu,\"host_rules\":%zu,\"token_rules\":%zu,\"generic_rules\":%zu,"
+        "\"exceptions\":%zu,\"compile_ms\":%.3f,\"snapshot_kb\":%.1f,\"load_us\":%.3f,\"requests\":%zu,\"blocked\":%zu,"
+        "\"set_us_p50\":%.3f,\"set_us_p99\":%.3f,\"match_us_p50\":%.3f,\"match_us_p99\":%.3f,\"match_us_max\":%.3f,"
+        "\"requests_per_second\":%.0f}",
+        filter.GetRuleCount(), statistics.hostRules, statistics.tokenRules, statistics.genericRules, statistics.exceptions,
+        compileSeconds * 1000, snapshot.size() / 1024.0, loadSeconds * 1e6, requests.size(), blocked,
+        Percentile(setTimes, 50), Percentile(setTimes, 99), Percentile(matchTimes, 50), Percentile(matchTimes, 99),
+        Percentile(matchTimes, 100), requests.size() / totalSeconds);
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions const bench = ParseBenchOptions(argc, argv, 100000);
+    if (bench.enabled)
+    {
+        std::printf("{\"benchmark\":\"request_filter\",\"results\":[");
+        RunMatches(50000, static_cast<size_t>(bench.iterations));
+        std::printf("]}\n");
+        return CheckResult();
+    }
+
+    TestParsing();
+    TestAnchors();
+    TestThirdParty();
+    TestDomains();
+    TestExceptions();
+    TestDamagedSnapshots();
+    return CheckResult();
+}
@@ -0,0 +1,746 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests ResponseCache against a stub HTTP server on the loopback interface,
+// with a client which plays the part of BrowserWindow: it asks the cache
+// first, sends the conditional requests to the server and stores what the
+// server answers. The clock of the cache and the Date of the server are
+// faked. Covers freshness from max-age, Age, Expires and the Last-Modified
+// heuristic, revalidation with ETag and Last-Modified ending in a 304 or a
+// new response, stale responses when the server is gone, Vary, the
+// responses which aren't stored, least recently used eviction and the index
+// read back by another cache.
+
+#include "Check.h"
+#include "ResponseCache.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+
+static LONGLONG const c_start = 1700000000;
+static LONGLONG const c_day = 24 * 60 * 60;
+
+static std::string FormatHttpDate(LONGLONG time)
+{
+    time_t const seconds = static_cast<time_t>(time);
+    struct tm parts;
+    gmtime_r(&seconds, &parts);
+    char date[64];
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    return date;
+}
+
+static bool SendAll(int fd, const std::string& data)
+{
+    size_t offset = 0;
+    while (offset < data.size())
+    {
+        ssize_t const written = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            return false;
+        }
+        offset += static_cast<size_t>(written);
+    }
+    return true;
+}
+
+// Serves what the handler answers, one request per connection, on a port of
+// its own. Stop() refuses later connections, like a server which is gone.
+class StubServer
+{
+public:
+    struct Reply
+    {
+        int status = 200;
+        std::string headers;  // "Name: value\r\n" lines
+        std::string body;
+    };
+
+    // Called on the thread of the server with the path and the headers of
+    // the request, the client waits meanwhile
+    typedef std::function<Reply(const std::string& path, const std::string& headers)> Handler;
+
+    explicit StubServer(Handler handler) : m_handler(std::move(handler))
+    {
+        m_listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (m_listener == -1 || bind(m_listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(m_listener, 16) != 0 || getsockname(m_listener, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+        {
+            std::perror("stub server");
+            std::exit(EXIT_FAILURE);
+        }
+        m_port = ntohs(address.sin_port);
+        m_thread = std::thread([this]() { Serve(); });
+    }
+    ~StubServer()
+    {
+        Stop();
+    }
+    StubServer(const StubServer&) = delete;
+    StubServer& operator=(const StubServer&) = delete;
+
+    int GetPort() const { return m_port; }
+    std::string GetOrigin() const { return "http://127.0.0.1:" + std::to_string(m_port); }
+    size_t GetRequestCount() const { return m_requests; }
+    // Of the last request
+    const std::string& GetHeaders() const { return m_headers; }
+
+    void Stop()
+    {
+        if (m_thread.joinable())
+        {
+            shutdown(m_listener, SHUT_RDWR);
+            m_thread.join();
+            close(m_listener);
+        }
+    }
+
+private:
+    Handler m_handler;
+    int m_listener = -1;
+    int m_port = 0;
+    std::thread m_thread;
+    size_t m_requests = 0;
+    std::string m_headers;
+
+    void Serve()
+    {
+        for (;;)
+        {
+            int const client = accept(m_listener, nullptr, nullptr);
+            if (client == -1)
+            {
+                return;
+            }
+
+            std::string request;
+            char buffer[4096];
+            while (request.find("\r\n\r\n") == std::string::npos)
+            {
+                ssize_t const received = recv(client, buffer, sizeof(buffer), 0);
+                if (received <= 0)
+                {
+                    break;
+                }
+                request.append(buffer, static_cast<size_t>(received));
+            }
+
+            size_t const lineEnd = request.find("\r\n");
+            size_t const pathBegin = request.find(' ');
+            size_t const pathEnd = request.find(' ', pathBegin + 1);
+            if (lineEnd != std::string::npos && pathEnd < lineEnd)
+            {
+                ++m_requests;
+                m_headers = request.substr(lineEnd + 2);
+                Reply const reply = m_handler(request.substr(pathBegin + 1, pathEnd - pathBegin - 1), m_headers);
+                std::string response = "HTTP/1.1 " + std::to_string(reply.status) + (reply.status == 304 ? " Not Modified" : " OK") + "\r\n";
+                response += reply.headers;
+                response += "Content-Length: " + std::to_string(reply.body.size()) + "\r\nConnection: close\r\n\r\n";
+                response += reply.body;
+                SendAll(client, response);
+            }
+            close(client);
+        }
+    }
+};
+
+struct HttpResponse
+{
+    int status = 0;
+    std::string reason;
+    std::string headers;  // Without the status line, as WinHttp hands them out
+    std::string body;
+};
+
+static HRESULT HttpGet(int port, const std::string& path, const std::string& headers, HttpResponse& response)
+{
+    int const fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if (fd == -1 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        !SendAll(fd, "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n" + headers + "\r\n"))
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return E_FAIL;
+    }
+
+    std::string data;
+    char buffer[4096];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+    {
+        data.append(buffer, static_cast<size_t>(received));
+    }
+    close(fd);
+
+    size_t const lineEnd = data.find("\r\n");
+    size_t const headersEnd = data.find("\r\n\r\n");
+    if (lineEnd == std::string::npos || headersEnd == std::string::npos || data.compare(0, 9, "HTTP/1.1 ") != 0)
+    {
+        return E_FAIL;
+    }
+    response.status = std::atoi(data.c_str() + 9);
+    response.reason = data.substr(13, lineEnd - 13);
+    response.headers = data.substr(lineEnd + 2, headersEnd + 2 - (lineEnd + 2));
+    response.body = data.substr(headersEnd + 4);
+    return S_OK;
+}
+
+// The index and the bodies in memory
+class MemoryStorage : public ResponseCache::Storage
+{
+public:
+    std::map<std::string, std::vector<BYTE>> blobs;
+    std::vector<BYTE> index;
+    bool hasIndex = false;
+
+    HRESULT ReadIndex(std::vector<BYTE>& data) override
+    {
+        data = index;
+        return hasIndex ? S_OK : HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
+    HRESULT WriteIndex(const std::vector<BYTE>& data) override
+    {
+        index = data;
+        hasIndex = true;
+        return S_OK;
+    }
+    HRESULT ListBlobs(std::vector<std::string>& names) override
+    {
+        for (const auto& blob : blobs)
+        {
+            names.push_back(blob.first);
+        }
+        return S_OK;
+    }
+    HRESULT ReadBlob(const std::string& name, std::vector<BYTE>& data) override
+    {
+        auto it = blobs.find(name);
+        if (it == blobs.end())
+        {
+            return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+        }
+        data = it->second;
+        return S_OK;
+    }
+    HRESULT WriteBlob(const std::string& name, const BYTE* data, size_t size) override
+    {
+        blobs[name].assign(data, data + size);
+        return S_OK;
+    }
+    HRESULT RemoveBlob(const std::string& name) override
+    {
+        blobs.erase(name);
+        return S_OK;
+    }
+};
+
+// Where a response came from
+enum class Source
+{
+    Cache,        // Fresh
+    Revalidated,  // After a 304
+    Stale,        // The server couldn't be reached
+    Network,
+    Failed,       // The server couldn't be reached either
+};
+
+struct Load
+{
+    Source source = Source::Failed;
+    std::string body;
+    std::string headers;
+};
+
+// Does with the cache what BrowserWindow does for a tab's request, the
+// revalidation going to the same server as the request
+class Browser
+{
+public:
+    Browser(MemoryStorage& storage, const StubServer& server, UINT64 maxSize = ResponseCache::c_defaultMaxSize) :
+        cache([this]() { return now; }, [this]() { ++scheduledWrites; }), m_storage(storage), m_port(server.GetPort())
+    {
+        CHECK_HR(S_OK, cache.Open(&storage, maxSize));
+        cache.SetOrigins({ server.GetOrigin() });
+        m_origin = server.GetOrigin();
+    }
+
+    ResponseCache cache;
+    LONGLONG now = c_start;
+    size_t scheduledWrites = 0;
+
+    Load Get(const std::string& path, const std::string& headers = std::string())
+    {
+        ResponseCache::Request request;
+        request.method = "GET";
+        request.uri = m_origin + path;
+        request.headers = headers;
+
+        Load load;
+        ResponseCache::Response response;
+        std::string revalidationHeaders;
+        ResponseCache::Action action = cache.Lookup(request, response, revalidationHeaders);
+        if (action == ResponseCache::Action::Serve)
+        {
+            Serve(response, Source::Cache, load);
+            return load;
+        }
+
+        if (action == ResponseCache::Action::Revalidate)
+        {
+            HttpResponse answer;
+            HRESULT const hr = HttpGet(m_port, path, revalidationHeaders, answer);
+            if (cache.Revalidated(request, hr, answer.status, answer.headers, response) == ResponseCache::Action::Serve)
+            {
+                Serve(response, SUCCEEDED(hr) ? Source::Revalidated : Source::Stale, load);
+                return load;
+            }
+        }
+
+        HttpResponse answer;
+        if (FAILED(HttpGet(m_port, path, headers, answer)))
+        {
+            return load;
+        }
+        load.source = Source::Network;
+        load.body = answer.body;
+        load.headers = answer.headers;
+        if (cache.ShouldStore(request, answer.status, answer.headers))
+        {
+            cache.Store(request, answer.status, answer.reason, answer.headers,
+                reinterpret_cast<const BYTE*>(answer.body.data()), answer.body.size());
+        }
+        return load;
+    }
+
+private:
+    MemoryStorage& m_storage;
+    int m_port;
+    std::string m_origin;
+
+    void Serve(const ResponseCache::Response& response, Source source, Load& load)
+    {
+        std::vector<BYTE> body;
+        CHECK_HR(S_OK, m_storage.ReadBlob(response.blob, body));
+        CHECK(body.size() == response.size);
+        load.source = source;
+        load.body.assign(body.begin(), body.end());
+        load.headers = response.headers;
+    }
+};
+
+// The server sends its clock as Date
+static StubServer::Reply Reply(const Browser& browser, const std::string& headers, const std::string& body, int status = 200)
+{
+    StubServer::Reply reply;
+    reply.status = status;
+    reply.headers = "Date: " + FormatHttpDate(browser.now) + "\r\n" + headers;
+    reply.body = body;
+    return reply;
+}
+
+// A response is fresh for max-age less the Age it arrived with, until
+// Expires, or for a tenth of the time since Last-Modified. A stale one
+// without validators is loaded again.
+static void TestFreshness()
+{
+    MemoryStorage storage;
+    Browser* client = nullptr;
+    StubServer server([&](const std::string& path, const std::string& headers)
+    {
+        Browser& browser = *client;
+        if (path == "/max-age")
+        {
+            return Reply(browser, "Cache-Control: max-age=60\r\n", "max-age");
+        }
+        if (path == "/age")
+        {
+            return Reply(browser, "Cache-Control: max-age=60\r\nAge: 50\r\n", "age");
+        }
+        if (path == "/expires")
+        {
+            return Reply(browser, "Expires: " + FormatHttpDate(browser.now + 120) + "\r\n", "expires");
+        }
+        if (path == "/expired")
+        {
+            return Reply(browser, "Expires: 0\r\n", "expired");
+        }
+        if (path == "/old")
+        {
+            return Reply(browser, "Last-Modified: " + FormatHttpDate(c_start - 100 * c_day) + "\r\n", "old");
+        }
+
+        // Modified two hours ago, so fresh for 12 minutes
+        std::string const lastModified = FormatHttpDate(c_start - 2 * 60 * 60);
+        if (ResponseCache::GetHeader(headers, "if-modified-since") == lastModified)
+        {
+            return Reply(browser, "", "", 304);
+        }
+        return Reply(browser, "Last-Modified: " + lastModified + "\r\n", "heuristic");
+    });
+    Browser browser(storage, server);
+    client = &browser;
+
+    CHECK(browser.Get("/max-age").source == Source::Network);
+    browser.now += 59;
+    Load load = browser.Get("/max-age");
+    CHECK(load.source == Source::Cache && load.body == "max-age");
+    browser.now += 2;
+    CHECK(browser.Get("/max-age").source == Source::Network);
+    CHECK(browser.Get("/max-age").source == Source::Cache);
+    // A reload asks with max-age=0
+    CHECK(browser.Get("/max-age", "Cache-Control: max-age=0\r\n").source == Source::Network);
+    CHECK(browser.Get("/max-age", "Cache-Control: no-cache\r\n").source == Source::Network);
+    CHECK(server.GetRequestCount() == 4);
+
+    browser.now = c_start;
+    CHECK(browser.Get("/age").source == Source::Network);
+    browser.now += 9;
+    CHECK(browser.Get("/age").source == Source::Cache);
+    browser.now += 2;
+    CHECK(browser.Get("/age").source == Source::Network);
+
+    browser.now = c_start;
+    CHECK(browser.Get("/expires").source == Source::Network);
+    browser.now += 119;
+    CHECK(browser.Get("/expires").source == Source::Cache);
+    browser.now += 2;
+    CHECK(browser.Get("/expires").source == Source::Network);
+
+    // An invalid Expires means already expired
+    CHECK(browser.Get("/expired").source == Source::Network);
+    CHECK(browser.Get("/expired").source == Source::Network);
+
+    browser.now = c_start;
+    CHECK(browser.Get("/heuristic").source == Source::Network);
+    browser.now += 11 * 60;
+    CHECK(browser.Get("/heuristic").source == Source::Cache);
+    browser.now += 2 * 60;
+    load = browser.Get("/heuristic");
+    CHECK(load.source == Source::Revalidated && load.body == "heuristic");
+    CHECK(ResponseCache::GetHeader(server.GetHeaders(), "If-Modified-Since") == FormatHttpDate(c_start - 2 * 60 * 60));
+    browser.now += 60;
+    CHECK(browser.Get("/heuristic").source == Source::Cache);
+
+    // The heuristic gives a day at most
+    browser.now = c_start;
+    CHECK(browser.Get("/old").source == Source::Network);
+    browser.now += ResponseCache::c_maxHeuristicLifetime - 1;
+    CHECK(browser.Get("/old").source == Source::Cache);
+    browser.now += 2;
+    CHECK(browser.Get("/old").source == Source::Network);
+
+    ResponseCache::Statistics statistics = browser.cache.GetStatistics();
+    CHECK(statistics.hits == 7);
+    CHECK(statistics.revalidated == 1);
+    CHECK(statistics.entries == 6);
+    CHECK(browser.scheduledWrites == 1);
+    CHECK_HR(S_OK, browser.cache.WriteIndex());
+    CHECK(storage.hasIndex);
+}
+
+// A stale response with an ETag or Last-Modified is asked for with
+// If-None-Match or If-Modified-Since, and served again after a 304. A new
+// response replaces it. When the server is gone it is served stale, unless
+// it must be revalidated.
+static void TestRevalidation()
+{
+    MemoryStorage storage;
+    Browser* client = nullptr;
+    std::string version = "v1";
+    bool setCookie = false;
+    StubServer server([&](const std::string& path, const std::string& headers)
+    {
+        Browser& browser = *client;
+        if (path == "/etag")
+        {
+            std::string const etag = "\"" + version + "\"";
+            if (ResponseCache::GetHeader(headers, "if-none-match") == etag)
+            {
+                return Reply(browser, setCookie ? "Set-Cookie: session=2\r\n" : "", "", 304);
+            }
+            return Reply(browser, "Cache-Control: no-cache\r\nETag: " + etag + "\r\n", "body " + version);
+        }
+        if (path == "/modified")
+        {
+            std::string const lastModified = FormatHttpDate(c_start - c_day);
+            if (ResponseCache::GetHeader(headers, "if-modified-since") == lastModified)
+            {
+                return Reply(browser, "", "", 304);
+            }
+            return Reply(browser, "Cache-Control: max-age=0\r\nLast-Modified: " + lastModified + "\r\n", "modified");
+        }
+        if (path == "/lenient")
+        {
+            return Reply(browser, "Cache-Control: max-age=1\r\nETag: \"l\"\r\n", "lenient");
+        }
+        return Reply(browser, "Cache-Control: max-age=1, must-revalidate\r\nETag: \"s\"\r\n", "strict");
+    });
+    Browser browser(storage, server);
+    client = &browser;
+
+    CHECK(browser.Get("/etag").source == Source::Network);
+    std::string const requestHeaders = "Accept-Language: en\r\nCookie: session=1\r\nAccept-Encoding: gzip\r\n";
+    Load load = browser.Get("/etag", requestHeaders);
+    CHECK(load.source == Source::Revalidated && load.body == "body v1");
+    CHECK(ResponseCache::GetHeader(server.GetHeaders(), "if-none-match") == "\"v1\"");
+    CHECK(ResponseCache::GetHeader(server.GetHeaders(), "accept-language") == "en");
+    // The owner adds the cookies of its store, the body comes decoded
+    CHECK(ResponseCache::GetHeader(server.GetHeaders(), "cookie").empty());
+    CHECK(ResponseCache::GetHeader(server.GetHeaders(), "accept-encoding").empty());
+    // The stored headers leave out those of the transfer
+    CHECK(ResponseCache::GetHeader(load.headers, "etag") == "\"v1\"");
+    CHECK(ResponseCache::GetHeader(load.headers, "content-length").empty());
+    CHECK(ResponseCache::GetHeader(load.headers, "connection").empty());
+
+    // The page asks the server itself
+    CHECK(browser.Get("/etag", "If-None-Match: \"v0\"\r\n").source == Source::Network);
+
+    // The cookies of a 304 don't get to the page with the cached response
+    setCookie = true;
+    size_t requests = server.GetRequestCount();
+    load = browser.Get("/etag");
+    CHECK(load.source == Source::Network && load.body == "body v1");
+    CHECK(server.GetRequestCount() == requests + 2);
+    CHECK(browser.cache.GetStatistics().entries == 1);
+    setCookie = false;
+
+    version = "v2";
+    requests = server.GetRequestCount();
+    load = browser.Get("/etag");
+    CHECK(load.source == Source::Network && load.body == "body v2");
+    CHECK(server.GetRequestCount() == requests + 2);
+    CHECK(ResponseCache::GetHeader(server.GetHeaders(), "if-none-match").empty());
+    load = browser.Get("/etag");
+    CHECK(load.source == Source::Revalidated && load.body == "body v2");
+    CHECK(storage.blobs.size() == 1);
+
+    CHECK(browser.Get("/modified").source == Source::Network);
+    browser.now += 1;
+    load = browser.Get("/modified");
+    CHECK(load.source == Source::Revalidated && load.body == "modified");
+    CHECK(ResponseCache::GetHeader(server.GetHeaders(), "if-none-match").empty());
+
+    CHECK(browser.Get("/lenient").source == Source::Network);
+    CHECK(browser.Get("/strict").source == Source::Network);
+    browser.now += 10;
+    server.Stop();
+    load = browser.Get("/lenient");
+    CHECK(load.source == Source::Stale && load.body == "lenient");
+    CHECK(browser.Get("/strict").source == Source::Failed);
+    CHECK(browser.Get("/etag").source == Source::Failed);
+
+    ResponseCache::Statistics const statistics = browser.cache.GetStatistics();
+    CHECK(statistics.revalidated == 3);
+    CHECK(statistics.staleHits == 1);
+    CHECK(statistics.entries == 4);
+}
+
+// A response which varies is only served to requests with the same values
+// of the headers it names, the last one replaces the others
+static void TestVary()
+{
+    MemoryStorage storage;
+    Browser* client = nullptr;
+    StubServer server([&](const std::string& path, const std::string& headers)
+    {
+        if (path == "/any")
+        {
+            return Reply(*client, "Cache-Control: max-age=60\r\nVary: *\r\n", "any");
+        }
+        return Reply(*client, "Cache-Control: max-age=60\r\nVary: Accept-Language, DNT\r\n",
+            "in " + ResponseCache::GetHeader(headers, "accept-language"));
+    });
+    Browser browser(storage, server);
+    client = &browser;
+
+    std::string const english = "Accept-Language: en\r\n";
+    std::string const german = "Accept-Language: de\r\n";
+    CHECK(browser.Get("/vary", english).source == Source::Network);
+    Load load = browser.Get("/vary", english);
+    CHECK(load.source == Source::Cache && load.body == "in en");
+    CHECK(browser.Get("/vary", "accept-language: en\r\n").source == Source::Cache);
+    CHECK(browser.Get("/vary", english + "DNT: 1\r\n").source == Source::Network);
+    CHECK(browser.Get("/vary", german).source == Source::Network);
+    load = browser.Get("/vary", german);
+    CHECK(load.source == Source::Cache && load.body == "in de");
+    CHECK(browser.Get("/vary", english).source == Source::Network);
+    CHECK(browser.cache.GetStatistics().entries == 1);
+
+    CHECK(browser.Get("/any").source == Source::Network);
+    CHECK(browser.Get("/any").source == Source::Network);
+    CHECK(browser.cache.GetStatistics().entries == 1);
+}
+
+// no-store either way, Set-Cookie, responses which can't be fresh or
+// revalidated, other statuses, ranges and other origins aren't stored. A
+// request which changes the resource drops it.
+static void TestNotStored()
+{
+    MemoryStorage storage;
+    Browser* client = nullptr;
+    StubServer server([&](const std::string& path, const std::string& headers)
+    {
+        Browser& browser = *client;
+        if (path == "/no-store")
+        {
+            return Reply(browser, "Cache-Control: max-age=60, no-store\r\n", "no-store");
+        }
+        if (path == "/cookie")
+        {
+            return Reply(browser, "Cache-Control: max-age=60\r\nSet-Cookie: id=1\r\n", "cookie");
+        }
+        if (path == "/plain")
+        {
+            return Reply(browser, "Content-Type: text/plain\r\n", "plain");
+        }
+        if (path == "/missing")
+        {
+            return Reply(browser, "Cache-Control: max-age=60\r\n", "missing", 404);
+        }
+        return Reply(browser, "Cache-Control: max-age=60\r\n", "stored");
+    });
+    Browser browser(storage, server);
+    client = &browser;
+
+    static const char* const c_paths[] = { "/no-store", "/cookie", "/plain", "/missing" };
+    for (const char* path : c_paths)
+    {
+        CHECK(browser.Get(path).source == Source::Network);
+        CHECK(browser.Get(path).source == Source::Network);
+    }
+    CHECK(browser.Get("/stored", "Cache-Control: no-store\r\n").source == Source::Network);
+    CHECK(browser.Get("/stored", "Range: bytes=0-1\r\n").source == Source::Network);
+    CHECK(browser.cache.GetStatistics().entries == 0);
+    CHECK(storage.blobs.empty());
+
+    CHECK(browser.Get("/stored").source == Source::Network);
+    CHECK(browser.Get("/stored").source == Source::Cache);
+    CHECK(browser.Get("/stored", "Cache-Control: no-store\r\n").source == Source::Network);
+    CHECK(browser.Get("/stored#fragment").source == Source::Cache);
+
+    ResponseCache::Request request;
+    request.method = "GET";
+    request.uri = "http://127.0.0.1:1/stored";
+    CHECK(!browser.cache.IsCachedOrigin(request.uri));
+    CHECK(browser.cache.IsCachedOrigin(server.GetOrigin() + "/other"));
+    CHECK(!browser.cache.ShouldStore(request, 200, "Cache-Control: max-age=60\r\n"));
+
+    // HEAD leaves it, POST drops it
+    ResponseCache::Response response;
+    std::string revalidationHeaders;
+    request.uri = server.GetOrigin() + "/stored";
+    request.method = "HEAD";
+    CHECK(browser.cache.Lookup(request, response, revalidationHeaders) == ResponseCache::Action::Network);
+    CHECK(browser.cache.GetStatistics().entries == 1);
+    request.method = "POST";
+    CHECK(browser.cache.Lookup(request, response, revalidationHeaders) == ResponseCache::Action::Network);
+    CHECK(browser.cache.GetStatistics().entries == 0);
+    CHECK(storage.blobs.empty());
+}
+
+// The least recently used responses go once the bodies exceed the size, a
+// body shared by two URIs counts once, and another cache reads the index
+// back with the same order
+static void TestEviction()
+{
+    MemoryStorage storage;
+    Browser* client = nullptr;
+    StubServer server([&](const std::string& path, const std::string& headers)
+    {
+        // 100 bytes each, the same for the copies
+        std::string const name = path.compare(0, 5, "/copy") == 0 ? "/copy" : path;
+        std::string body = name;
+        body.resize(100, '.');
+        return Reply(*client, "Cache-Control: max-age=600\r\n", path == "/large" ? std::string(200, 'l') : body);
+    });
+    Browser browser(storage, server, 1000);
+    client = &browser;
+    CHECK(browser.cache.GetMaxBodySize() == 1000 / ResponseCache::c_maxEntryShare);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        CHECK(browser.Get("/" + std::to_string(i)).source == Source::Network);
+    }
+    CHECK(browser.cache.GetStatistics().size == 1000);
+    CHECK(browser.Get("/0").source == Source::Cache);
+
+    CHECK(browser.Get("/10").source == Source::Network);
+    ResponseCache::Statistics statistics = browser.cache.GetStatistics();
+    CHECK(statistics.evicted == 1);
+    CHECK(statistics.entries == 10);
+    CHECK(browser.Get("/0").source == Source::Cache);
+    CHECK(browser.Get("/2").source == Source::Cache);
+    CHECK(browser.Get("/1").source == Source::Network);
+    CHECK(browser.Get("/3").source == Source::Network);
+    CHECK(storage.blobs.size() == 10);
+
+    // Too large for the cache
+    CHECK(browser.Get("/large").source == Source::Network);
+    CHECK(browser.Get("/large").source == Source::Network);
+
+    // Stored once, so the second URI takes no room. The first one takes the
+    // place of /5, the least recently used.
+    CHECK(browser.Get("/copy-a").source == Source::Network);
+    CHECK(browser.Get("/5").source == Source::Network);
+    CHECK(browser.Get("/copy-b").source == Source::Network);
+    CHECK(browser.Get("/copy-b").source == Source::Cache);
+    statistics = browser.cache.GetStatistics();
+    CHECK(statistics.evicted == 5);
+    CHECK(statistics.entries == 11);
+    CHECK(statistics.size == 1000);
+    CHECK(storage.blobs.size() == 10);
+
+    // Another cache reads the order back, /8 is used least recently
+    CHECK(browser.Get("/7").source == Source::Cache);
+    CHECK_HR(S_OK, browser.cache.WriteIndex());
+    Browser reopened(storage, server, 1000);
+    client = &reopened;
+    reopened.now = browser.now;
+    statistics = reopened.cache.GetStatistics();
+    CHECK(statistics.entries == 11);
+    CHECK(statistics.size == 1000);
+    CHECK(reopened.Get("/11").source == Source::Network);
+    CHECK(reopened.cache.GetStatistics().evicted == 1);
+    CHECK(reopened.Get("/8").source == Source::Network);
+    CHECK(reopened.Get("/7").source == Source::Cache);
+    CHECK(reopened.Get("/copy-a").source == Source::Cache);
+
+    // A smaller cache evicts on open, a damaged index starts an empty one
+    // and removes the bodies
+    CHECK_HR(S_OK, reopened.cache.WriteIndex());
+    Browser smaller(storage, server, 300);
+    client = &smaller;
+    smaller.now = reopened.now;
+    CHECK(smaller.cache.GetStatistics().entries == 3);
+    CHECK(storage.blobs.size() == 3);
+    CHECK(smaller.scheduledWrites == 1);
+
+    storage.index.resize(storage.index.size() - 1);
+    Browser damaged(storage, server, 1000);
+    CHECK(damaged.cache.GetStatistics().entries == 0);
+    CHECK(storage.blobs.empty());
+}
+
+int main()
+{
+    TestFreshness();
+    TestRevalidation();
+    TestVary();
+    TestNotStored();
+    TestEviction();
+    return CheckResult();
+}
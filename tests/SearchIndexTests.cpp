@@ -0,0 +1,298 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests the address bar suggestions of SearchIndex: every word of a query is
+// a prefix of a token of the page, pages rank by frecency with a bonus for
+// favorites, and scanning in rank order finds what collecting candidates
+// finds. With --bench it indexes a million pages and reports the query
+// latencies and the memory of the index.
+
+#include "Check.h"
+#include "SearchIndex.h"
+
+#include <fstream>
+#include <random>
+
+static LONGLONG const c_day = 24 * 60 * 60 * 1000;
+static LONGLONG const c_firstVisit = 1700000000000;
+
+static std::vector<std::wstring> Query(SearchIndex& search, const std::wstring& query)
+{
+    std::vector<Suggestion> suggestions;
+    CHECK_HR(S_OK, search.Query(query, suggestions));
+    std::vector<std::wstring> uris;
+    for (const Suggestion& suggestion : suggestions)
+    {
+        uris.push_back(suggestion.uri);
+    }
+    return uris;
+}
+
+// Words match the start of the tokens of the URI or the title, in any order
+// and case. All words have to match.
+static void TestPrefixMatching()
+{
+    SearchIndex search;
+    search.AddVisit(L"https://www.example.com/news/Today", L"Breaking News Today", c_firstVisit, true);
+    search.AddVisit(L"https://docs.example.org/guide", L"User Guide", c_firstVisit + 1, true);
+    search.AddVisit(L"https://xn--caf-dma.example/", L"Caf\x00E9 au lait", c_firstVisit + 2, true);
+    CHECK(search.GetCount() == 3);
+
+    std::vector<std::wstring> const news = { L"https://www.example.com/news/Today" };
+    std::vector<std::wstring> const guide = { L"https://docs.example.org/guide" };
+    CHECK(Query(search, L"exa") == std::vector<std::wstring>({ L"https://xn--caf-dma.example/", guide[0], news[0] }));
+    CHECK(Query(search, L"NEWS tod") == news);
+    CHECK(Query(search, L"tod  news") == news);
+    CHECK(Query(search, L"breaking") == news);
+    CHECK(Query(search, L"example.org") == guide);
+    CHECK(Query(search, L"docs/gui") == guide);
+    CHECK(Query(search, L"news guide").empty());
+    CHECK(Query(search, L"xample").empty());
+    CHECK(Query(search, L"newsy").empty());
+
+    // Non-ASCII letters are kept as they are
+    CHECK(Query(search, L"caf\x00E9") == std::vector<std::wstring>({ L"https://xn--caf-dma.example/" }));
+    CHECK(Query(search, L"cafe").empty());
+
+    // Parts of every URI aren't indexed
+    CHECK(Query(search, L"https://www.").empty());
+    CHECK(Query(search, L"").empty());
+    CHECK(Query(search, L"  ").empty());
+}
+
+// A visit counts twice as much as one 30 days older, a favorite counts like
+// four visits at the time it was added
+static void TestRanking()
+{
+    SearchIndex search;
+    LONGLONG const t0 = c_firstVisit;
+    for (int i = 0; i < 3; ++i)
+    {
+        search.AddVisit(L"https://three.example/", L"Page three", t0, true);
+    }
+    search.AddVisit(L"https://newer.example/", L"Page newer", t0 + 60 * c_day, true);
+    search.AddVisit(L"https://later.example/", L"Page later", t0 + 30 * c_day, true);
+    search.AddVisit(L"https://once.example/", L"Page once", t0, true);
+    search.SetFavorite(L"https://favorite.example/", L"Page favorite", true, t0 + 30 * c_day);
+
+    std::vector<Suggestion> suggestions;
+    CHECK_HR(S_OK, search.Query(L"page", suggestions));
+    std::vector<std::wstring> const order = {
+        L"https://favorite.example/", L"https://newer.example/", L"https://three.example/", L"https://later.example/",
+        L"https://once.example/" };
+    if (CHECK(suggestions.size() == order.size()))
+    {
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            CHECK(suggestions[i].uri == order[i]);
+            CHECK(suggestions[i].isFavorite == (i == 0));
+        }
+        CHECK(suggestions[0].title == L"Page favorite");
+    }
+
+    // A visit which only moved an entry adds weight but no entry
+    search.AddVisit(L"https://once.example/", L"Page once", t0 + 60 * c_day, false);
+    CHECK(Query(search, L"page")[1] == L"https://once.example/");
+    // Removing its only entry drops the page
+    search.RemoveVisit(L"https://once.example/", t0 + 60 * c_day);
+    CHECK(Query(search, L"once").empty());
+    CHECK(search.GetCount() == 4);
+
+    // Favoriting a visited page adds to its visits
+    search.SetFavorite(L"https://three.example/", L"Ignored", true, t0 + 30 * c_day);
+    CHECK(Query(search, L"page")[0] == L"https://three.example/");
+    CHECK(Query(search, L"ignored").empty());
+    search.SetFavorite(L"https://three.example/", L"", false, t0);
+    CHECK(Query(search, L"page")[2] == L"https://three.example/");
+
+    // At most c_maxSuggestions, the best ones
+    for (int i = 0; i < 20; ++i)
+    {
+        search.AddVisit(L"https://more.example/" + std::to_wstring(i), L"Page", t0 + i * c_day, true);
+    }
+    std::vector<std::wstring> const uris = Query(search, L"more page");
+    if (CHECK(uris.size() == SearchIndex::c_maxSuggestions))
+    {
+        for (size_t i = 0; i < uris.size(); ++i)
+        {
+            CHECK(uris[i] == L"https://more.example/" + std::to_wstring(19 - i));
+        }
+    }
+}
+
+// Pages without visits are dropped unless they are favorites, and a page
+// which reuses their slot doesn't match their words
+static void TestRemoveAndClear()
+{
+    SearchIndex search;
+    search.AddVisit(L"https://a.example/", L"Alpha", c_firstVisit, true);
+    search.AddVisit(L"https://a.example/", L"Alpha", c_firstVisit + c_day, true);
+    search.AddVisit(L"https://b.example/", L"Bravo", c_firstVisit, true);
+    search.SetFavorite(L"https://c.example/", L"Charlie", true, c_firstVisit);
+    CHECK(search.GetCount() == 3);
+
+    search.RemoveVisit(L"https://a.example/", c_firstVisit + c_day);
+    CHECK(Query(search, L"alpha") == std::vector<std::wstring>({ L"https://a.example/" }));
+    search.RemoveVisit(L"https://a.example/", c_firstVisit);
+    CHECK(Query(search, L"alpha").empty());
+    CHECK(search.GetCount() == 2);
+    // Unknown pages and pages without entries are ignored
+    search.RemoveVisit(L"https://a.example/", c_firstVisit);
+    search.RemoveVisit(L"https://nothing.example/", c_firstVisit);
+    search.SetTitle(L"https://nothing.example/", L"Nothing");
+    CHECK(search.GetCount() == 2);
+
+    search.AddVisit(L"https://d.example/", L"Delta", c_firstVisit, true);
+    CHECK(Query(search, L"alpha").empty());
+    CHECK(Query(search, L"a.example").empty());
+    CHECK(Query(search, L"delta") == std::vector<std::wstring>({ L"https://d.example/" }));
+
+    // A new title replaces the words of the old one
+    search.SetTitle(L"https://d.example/", L"Echo");
+    CHECK(Query(search, L"delta").empty());
+    CHECK(Query(search, L"echo") == std::vector<std::wstring>({ L"https://d.example/" }));
+    search.SetTitle(L"https://d.example/", L"Delta");
+    CHECK(Query(search, L"delta") == std::vector<std::wstring>({ L"https://d.example/" }));
+    CHECK(Query(search, L"echo").empty());
+
+    search.ClearHistory();
+    CHECK(search.GetCount() == 1);
+    CHECK(Query(search, L"example") == std::vector<std::wstring>({ L"https://c.example/" }));
+    search.SetFavorite(L"https://c.example/", L"", false, c_firstVisit);
+    CHECK(search.GetCount() == 0);
+    CHECK(Query(search, L"example").empty());
+}
+
+static std::wstring GetPageUri(size_t i)
+{
+    return L"https://site" + std::to_wstring(i % 300) + L".example/article/" + std::to_wstring(i);
+}
+
+static std::wstring GetPageTitle(size_t i)
+{
+    return L"Article " + std::to_wstring(i) + L" of site " + std::to_wstring(i % 300);
+}
+
+// Lower cased words of a URI or title, like the index splits them
+static void SplitWords(const std::wstring& text, std::vector<std::wstring>& words)
+{
+    std::wstring word;
+    for (wchar_t c : text + L" ")
+    {
+        if (iswalnum(c))
+        {
+            word.push_back(towlower(c));
+        }
+        else if (!word.empty())
+        {
+            words.push_back(word);
+            word.clear();
+        }
+    }
+}
+
+// Pages with one visit each, newer pages rank higher. Common words are
+// answered by scanning in rank order, rare ones by collecting candidates,
+// both have to find what checking every page finds.
+static void TestMatchesEveryPage()
+{
+    size_t const pages = 20000;
+    SearchIndex search;
+    std::vector<std::vector<std::wstring>> words(pages);
+    for (size_t i = 0; i < pages; ++i)
+    {
+        search.AddVisit(GetPageUri(i), GetPageTitle(i), c_firstVisit + static_cast<LONGLONG>(i) * 600000, true);
+        SplitWords(GetPageUri(i), words[i]);
+        SplitWords(GetPageTitle(i), words[i]);
+    }
+
+    static LPCWSTR const c_queries[] = {
+        L"article", L"s", L"article 12", L"12 article", L"site1 of", L"example 199", L"site42 7", L"19999",
+        L"site299.example/article/299", L"of of", L"article 1 site2", L"nothing", L"site3000" };
+    for (LPCWSTR query : c_queries)
+    {
+        std::vector<std::wstring> queryWords;
+        SplitWords(query, queryWords);
+        std::vector<std::wstring> expected;
+        for (size_t i = pages; i-- > 0 && expected.size() < SearchIndex::c_maxSuggestions;)
+        {
+            bool matches = true;
+            for (const std::wstring& queryWord : queryWords)
+            {
+                matches = matches && std::any_of(words[i].begin(), words[i].end(), [&queryWord](const std::wstring& word)
+                {
+                    return word.compare(0, queryWord.size(), queryWord) == 0;
+                });
+            }
+            if (matches)
+            {
+                expected.push_back(GetPageUri(i));
+            }
+        }
+        if (!CHECK(Query(search, query) == expected))
+        {
+            std::fprintf(stderr, "  for %ls\n", query);
+        }
+    }
+}
+
+static size_t GetResidentBytes()
+{
+    std::ifstream stream("/proc/self/statm");
+    size_t size = 0;
+    size_t resident = 0;
+    stream >> size >> resident;
+    return resident * 4096;
+}
+
+// A million pages with one visit each
+static void RunQueries(size_t pages, size_t queries)
+{
+    size_t const residentBefore = GetResidentBytes();
+    auto start = std::chrono::steady_clock::now();
+    SearchIndex search;
+    for (size_t i = 0; i < pages; ++i)
+    {
+        search.AddVisit(GetPageUri(i), GetPageTitle(i), c_firstVisit + static_cast<LONGLONG>(i) * 600000, true);
+    }
+    double const indexSeconds = SecondsSince(start);
+    size_t const indexBytes = GetResidentBytes() - residentBefore;
+
+    static LPCWSTR const c_queries[] = {
+        L"s", L"si", L"site", L"site12", L"article 7", L"example com", L"of site 3", L"article 123456", L"site42 of 99",
+        L"nothing here" };
+    std::mt19937 random(1);
+    std::vector<double> times;
+    std::vector<Suggestion> suggestions;
+    for (size_t i = 0; i < queries; ++i)
+    {
+        LPCWSTR const query = c_queries[random() % _countof(c_queries)];
+        start = std::chrono::steady_clock::now();
+        CHECK_HR(S_OK, search.Query(query, suggestions));
+        times.push_back(SecondsSince(start) * 1e6);
+    }
+
+    std::printf("{\"scenario\":\"queries\",\"pages\":%zu,\"queries\":%zu,\"index_ms\":%.3f,\"index_mb\":%.1f,"
+        "\"bytes_per_page\":%.0f,\"query_us_p50\":%.3f,\"query_us_p99\":%.3f,\"query_us_max\":%.3f}",
+        pages, queries, indexSeconds * 1000, indexBytes / 1048576.0, static_cast<double>(indexBytes) / pages,
+        Percentile(times, 50), Percentile(times, 99), Percentile(times, 100));
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions const bench = ParseBenchOptions(argc, argv, 10000);
+    if (bench.enabled)
+    {
+        std::printf("{\"benchmark\":\"search_index\",\"results\":[");
+        RunQueries(1000000, static_cast<size_t>(bench.iterations));
+        std::printf("]}\n");
+        return CheckResult();
+    }
+
+    TestPrefixMatching();
+    TestRanking();
+    TestRemoveAndClear();
+    TestMatchesEveryPage();
+    return CheckResult();
+}
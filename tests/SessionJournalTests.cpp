@@ -0,0 +1,351 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests that SessionJournal restores what was written, and after a crash at
+// any byte the state of the last complete record. With --bench it restores a
+// session of 500 tabs.
+
+#include "Check.h"
+#include "SessionJournal.h"
+
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+struct State
+{
+    std::vector<SessionTab> tabs;
+    size_t activeTabId = INVALID_TAB_ID;
+    size_t fileSize = 0;  // Of the journal holding this state
+};
+
+static std::string s_directory;
+
+static std::wstring GetPath(const char* name)
+{
+    std::string const path = s_directory + "/" + name;
+    return std::wstring(path.begin(), path.end());
+}
+
+static std::string ReadFileBytes(const std::wstring& path)
+{
+    std::ifstream stream(PortablePath(path.c_str()), std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+static void WriteFileBytes(const std::wstring& path, const std::string& bytes)
+{
+    std::ofstream stream(PortablePath(path.c_str()), std::ios::binary | std::ios::trunc);
+    stream.write(bytes.data(), bytes.size());
+}
+
+static bool SameTabs(const std::vector<SessionTab>& a, const std::vector<SessionTab>& b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if (a[i].tabId != b[i].tabId || a[i].uri != b[i].uri || a[i].title != b[i].title)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool Restores(const std::wstring& path, const State& expected)
+{
+    SessionJournal journal([] {});
+    bool const opened = SUCCEEDED(journal.Open(path.c_str()));
+    return opened && SameTabs(journal.GetTabs(), expected.tabs) && journal.GetActiveTabId() == expected.activeTabId;
+}
+
+// A session with every kind of record, flushed after each change, and the
+// state after each one
+static std::vector<State> WriteSession(const std::wstring& path)
+{
+    std::vector<State> states;
+    SessionJournal journal([] {});
+    CHECK_HR(S_OK, journal.Open(path.c_str()));
+
+    auto record = [&]()
+    {
+        CHECK_HR(S_OK, journal.Flush());
+        State state;
+        state.tabs = journal.GetTabs();
+        state.activeTabId = journal.GetActiveTabId();
+        state.fileSize = ReadFileBytes(path).size();
+        states.push_back(state);
+    };
+
+    record();
+    for (size_t tabId = 1; tabId <= 6; ++tabId)
+    {
+        journal.Create(tabId, L"https://example.com/" + std::to_wstring(tabId));
+        record();
+        // The emoji as a surrogate pair, wchar_t is UTF-32 here
+        journal.SetTitle(tabId, L"Caf\x00E9 \x4E2D\x6587 \xD83D\xDE00 " + std::to_wstring(tabId));
+        record();
+    }
+    journal.Switch(3);
+    record();
+    journal.SetUri(3, L"https://example.org/a/longer/path?query=1");
+    record();
+    journal.Close(2);
+    record();
+    journal.Close(3);
+    record();
+    journal.Create(7, std::wstring());
+    record();
+    journal.Switch(5);
+    record();
+    journal.SetTitle(5, std::wstring());
+    record();
+    CHECK(journal.GetStatistics().compactions == 0);
+    return states;
+}
+
+static void TestRoundTrip()
+{
+    std::wstring const path = GetPath("round-trip.bin");
+    std::vector<State> const states = WriteSession(path);
+    CHECK(Restores(path, states.back()));
+
+    SessionJournal journal([] {});
+    CHECK_HR(S_OK, journal.Open(path.c_str()));
+    CHECK(journal.GetStatistics().droppedBytes == 0);
+    CHECK(journal.GetTabs().size() == 5);
+    CHECK(journal.GetActiveTabId() == 5);
+
+    // Changes which change nothing aren't written
+    size_t const size = ReadFileBytes(path).size();
+    journal.Switch(5);
+    journal.SetUri(4, journal.GetTabs()[1].uri);
+    journal.Close(42);
+    CHECK_HR(S_OK, journal.Flush());
+    CHECK(ReadFileBytes(path).size() == size);
+}
+
+// Every length the file could have been cut to
+static void TestTruncatedTail()
+{
+    std::wstring const source = GetPath("complete.bin");
+    std::vector<State> const states = WriteSession(source);
+    std::string const bytes = ReadFileBytes(source);
+    CHECK(bytes.size() == states.back().fileSize);
+
+    std::wstring const path = GetPath("truncated.bin");
+    for (size_t length = 0; length <= bytes.size(); ++length)
+    {
+        WriteFileBytes(path, bytes.substr(0, length));
+
+        State expected;
+        for (const State& state : states)
+        {
+            if (state.fileSize <= length)
+            {
+                expected = state;
+            }
+        }
+
+        SessionJournal journal([] {});
+        if (!CHECK_HR(S_OK, journal.Open(path.c_str())))
+        {
+            continue;
+        }
+        CHECK(SameTabs(journal.GetTabs(), expected.tabs));
+        CHECK(journal.GetActiveTabId() == expected.activeTabId);
+        CHECK(journal.GetStatistics().droppedBytes == length - expected.fileSize);
+
+        // The partial record is gone from the file, what is written next
+        // follows the last complete one. A file without a whole header starts
+        // over with a new one.
+        size_t const kept = std::max(expected.fileSize, states.front().fileSize);
+        CHECK(ReadFileBytes(path).size() == kept);
+        journal.Create(100, L"https://example.net/");
+        CHECK_HR(S_OK, journal.Flush());
+
+        expected.tabs = journal.GetTabs();
+        expected.activeTabId = journal.GetActiveTabId();
+        CHECK(Restores(path, expected));
+    }
+}
+
+// A damaged record and everything after it is dropped
+static void TestCorruptRecord()
+{
+    std::wstring const source = GetPath("corrupt-source.bin");
+    std::vector<State> const states = WriteSession(source);
+    std::string const bytes = ReadFileBytes(source);
+
+    std::wstring const path = GetPath("corrupt.bin");
+    for (size_t i = 1; i < states.size(); ++i)
+    {
+        // A byte of the payload of the record which led to states[i]
+        size_t const offset = (states[i - 1].fileSize + states[i].fileSize) / 2;
+        if (states[i].fileSize == states[i - 1].fileSize)
+        {
+            continue;
+        }
+        std::string damaged = bytes;
+        damaged[offset] = static_cast<char>(damaged[offset] ^ 0x20);
+        WriteFileBytes(path, damaged);
+        CHECK(Restores(path, states[i - 1]));
+    }
+
+    // A file which isn't a journal is replaced by an empty one
+    WriteFileBytes(path, "not a session journal");
+    CHECK(Restores(path, states.front()));
+    CHECK(ReadFileBytes(path) == bytes.substr(0, states.front().fileSize));
+}
+
+// Compaction replaces the file through a temporary one, a crash before the
+// rename leaves the old journal, and a stale temporary file does no harm
+static void TestCompaction()
+{
+    std::wstring const path = GetPath("compact.bin");
+    State expected;
+    {
+        SessionJournal journal([] {});
+        CHECK_HR(S_OK, journal.Open(path.c_str()));
+        for (size_t tabId = 1; tabId <= 20; ++tabId)
+        {
+            journal.Create(tabId, L"about:blank");
+        }
+        for (int i = 0; i < 2000; ++i)
+        {
+            journal.SetUri(1 + i % 20, L"https://example.com/page/" + std::to_wstring(i));
+            if (i % 100 == 0)
+            {
+                CHECK_HR(S_OK, journal.Flush());
+            }
+        }
+        journal.Switch(7);
+        CHECK_HR(S_OK, journal.Flush());
+        CHECK(journal.GetStatistics().compactions >= 2000 / SessionJournal::c_compactSlack);
+        expected.tabs = journal.GetTabs();
+        expected.activeTabId = journal.GetActiveTabId();
+    }
+    CHECK(Restores(path, expected));
+    // One record per tab, the active tab and at most the slack on top
+    CHECK(ReadFileBytes(path).size() < (20 + 1 + SessionJournal::c_compactSlack) * 128);
+
+    WriteFileBytes(path + L".tmp", "partial snapshot");
+    CHECK(Restores(path, expected));
+}
+
+// The write task runs on another thread, and after the journal is gone
+static void TestWriteOnAnotherThread()
+{
+    std::wstring const path = GetPath("threads.bin");
+    int scheduled = 0;
+    std::function<HRESULT()> write;
+    State expected;
+    {
+        SessionJournal journal([&] { ++scheduled; });
+        CHECK_HR(S_OK, journal.Open(path.c_str()));
+        journal.Create(1, L"https://example.com/");
+        journal.Create(2, L"https://example.org/");
+        CHECK(scheduled == 1);
+        write = journal.TakeWrite();
+        journal.SetTitle(2, L"Example");
+        CHECK(scheduled == 2);
+
+        HRESULT result = E_FAIL;
+        std::thread thread([&] { result = write(); });
+        thread.join();
+        CHECK_HR(S_OK, result);
+        write = journal.TakeWrite();
+        expected.tabs = journal.GetTabs();
+        expected.activeTabId = journal.GetActiveTabId();
+    }
+    CHECK_HR(S_OK, write());
+    CHECK(Restores(path, expected));
+}
+
+// Benchmark
+
+// 500 tabs with a few navigations each, written like the browser does, then
+// opened again the way startup does
+static void RunBenchmark(int iterations)
+{
+    size_t const tabCount = 500;
+    std::wstring const path = GetPath("bench.bin");
+
+    auto start = std::chrono::steady_clock::now();
+    ULONGLONG records;
+    {
+        SessionJournal journal([] {});
+        CHECK_HR(S_OK, journal.Open(path.c_str()));
+        for (size_t tabId = 1; tabId <= tabCount; ++tabId)
+        {
+            journal.Create(tabId, L"about:blank");
+        }
+        for (int navigation = 0; navigation < 10; ++navigation)
+        {
+            for (size_t tabId = 1; tabId <= tabCount; ++tabId)
+            {
+                journal.SetUri(tabId, L"https://www.example.com/articles/" + std::to_wstring(navigation) + L"/" + std::to_wstring(tabId));
+                journal.SetTitle(tabId, L"Article " + std::to_wstring(navigation) + L" of tab " + std::to_wstring(tabId));
+            }
+            CHECK_HR(S_OK, journal.Flush());
+        }
+        journal.Switch(tabCount / 2);
+        CHECK_HR(S_OK, journal.Flush());
+        records = journal.GetStatistics().records;
+    }
+    double const recordSeconds = SecondsSince(start);
+    size_t const fileSize = ReadFileBytes(path).size();
+
+    std::vector<double> openTimes;
+    size_t restored = 0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        start = std::chrono::steady_clock::now();
+        SessionJournal journal([] {});
+        CHECK_HR(S_OK, journal.Open(path.c_str()));
+        openTimes.push_back(SecondsSince(start) * 1000);
+        restored = journal.GetTabs().size();
+    }
+    CHECK(restored == tabCount);
+
+    std::printf("{\"benchmark\":\"session_restore\",\"tabs\":%zu,\"records\":%llu,\"record_and_write_us_per_change\":%.3f,"
+        "\"journal_bytes\":%zu,\"iterations\":%d,\"open_ms_p50\":%.3f,\"open_ms_p90\":%.3f,\"open_ms_max\":%.3f}\n",
+        tabCount, static_cast<unsigned long long>(records), recordSeconds * 1e6 / records, fileSize, iterations,
+        Percentile(openTimes, 50), Percentile(openTimes, 90), Percentile(openTimes, 100));
+}
+
+int main(int argc, char** argv)
+{
+    char directory[] = "/tmp/SessionJournalTests.XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    s_directory = directory;
+
+    BenchOptions const bench = ParseBenchOptions(argc, argv, 100);
+    if (bench.enabled)
+    {
+        RunBenchmark(bench.iterations);
+    }
+    else
+    {
+        TestRoundTrip();
+        TestTruncatedTail();
+        TestCorruptRecord();
+        TestCompaction();
+        TestWriteOnAnotherThread();
+    }
+
+    std::string const remove = "rm -rf '" + s_directory + "'";
+    if (std::system(remove.c_str()) != 0)
+    {
+        std::fprintf(stderr, "Can't remove %s\n", s_directory.c_str());
+    }
+    return CheckResult();
+}
@@ -0,0 +1,248 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests StartupScheduler with fake asynchronous stages the test completes:
+// stages start once their dependencies are done, whatever order those
+// complete in, failures skip everything depending on them, and on-demand
+// stages wait to be requested.
+
+#include "Check.h"
+#include "StartupScheduler.h"
+
+typedef StartupScheduler::Stage Stage;
+
+// The scheduler with a clock the test moves, and the stages it started in
+// order
+class Harness
+{
+public:
+    Harness() : m_scheduler([this]() { return m_now; })
+    {
+    }
+
+    StartupScheduler& operator*() { return m_scheduler; }
+    StartupScheduler* operator->() { return &m_scheduler; }
+
+    void Advance(ULONGLONG microseconds) { m_now += microseconds; }
+
+    // A stage whose start returns hr, the test completes it
+    Stage AddAsync(LPCWSTR name, std::initializer_list<Stage> dependencies, HRESULT hr = S_OK, bool onDemand = false)
+    {
+        return m_scheduler.AddAsync(name, dependencies, [this, name, hr]()
+        {
+            m_started.push_back(name);
+            return hr;
+        }, onDemand);
+    }
+
+    Stage Add(LPCWSTR name, std::initializer_list<Stage> dependencies, HRESULT hr = S_OK)
+    {
+        return m_scheduler.Add(name, dependencies, [this, name, hr]()
+        {
+            m_started.push_back(name);
+            return hr;
+        });
+    }
+
+    // Names of the stages, in the order they were started, since the last
+    // call
+    std::vector<std::wstring> TakeStarted()
+    {
+        std::vector<std::wstring> started;
+        started.swap(m_started);
+        return started;
+    }
+
+private:
+    ULONGLONG m_now = 5000;
+    StartupScheduler m_scheduler;
+    std::vector<std::wstring> m_started;
+};
+
+static std::vector<std::wstring> Names(std::initializer_list<LPCWSTR> names)
+{
+    return std::vector<std::wstring>(names.begin(), names.end());
+}
+
+// The browser's graph: nothing starts before Run, then every stage starts
+// as soon as the last of its dependencies is done
+static void TestDependencyOrder()
+{
+    Harness harness;
+    Stage const content = harness.AddAsync(L"Content", {});
+    Stage const ui = harness.AddAsync(L"UI", {});
+    Stage const history = harness.Add(L"History", {});
+    Stage const controls = harness.AddAsync(L"Controls", { ui });
+    Stage const pool = harness.Add(L"Pool", { content });
+    Stage const tabs = harness.Add(L"Tabs", { content, controls });
+    CHECK(harness.TakeStarted().empty());
+    CHECK(harness->GetRecord(tabs).state == StageState::Waiting);
+
+    harness.Advance(100);
+    harness->Run();
+    CHECK(harness.TakeStarted() == Names({ L"Content", L"UI", L"History" }));
+    CHECK(harness->IsDone(history));
+    CHECK(harness->GetRecord(content).state == StageState::Running);
+    CHECK(harness->GetRecord(content).start == 100);
+    CHECK(harness->GetRecord(controls).state == StageState::Waiting);
+
+    harness.Advance(200);
+    harness->Complete(ui, S_OK);
+    CHECK(harness.TakeStarted() == Names({ L"Controls" }));
+    CHECK(harness->GetRecord(ui).done == 300);
+
+    harness.Advance(300);
+    harness->Complete(content, S_OK);
+    CHECK(harness.TakeStarted() == Names({ L"Pool" }));
+    CHECK(harness->IsDone(pool));
+    CHECK(!harness->IsDone(tabs));
+
+    harness.Advance(400);
+    harness->Complete(controls, S_OK);
+    CHECK(harness.TakeStarted() == Names({ L"Tabs" }));
+    CHECK(harness->IsDone(tabs));
+    CHECK(harness->GetRecord(tabs).start == 1000);
+    CHECK(harness->GetRecord(tabs).done == 1000);
+    CHECK(harness->GetRecord(controls).start == 300);
+    CHECK(harness->GetRecord(controls).done == 1000);
+
+    // Stages added later start right away once their dependencies are done
+    harness.Add(L"Late", { tabs, history });
+    CHECK(harness.TakeStarted() == Names({ L"Late" }));
+    CHECK(harness->GetCount() == 7);
+}
+
+// Stages completing in any order, before their start returned, or twice
+static void TestOutOfOrder()
+{
+    Harness harness;
+    Stage const a = harness.AddAsync(L"A", {});
+    Stage const b = harness.AddAsync(L"B", { a });
+    Stage const c = harness.AddAsync(L"C", { a });
+    Stage const d = harness.AddAsync(L"D", { b, c });
+    harness->Run();
+    harness->Complete(a, S_OK);
+    CHECK(harness.TakeStarted() == Names({ L"A", L"B", L"C" }));
+
+    harness->Complete(c, S_OK);
+    CHECK(harness.TakeStarted().empty());
+    harness->Complete(b, S_OK);
+    CHECK(harness.TakeStarted() == Names({ L"D" }));
+
+    // Only the first outcome counts
+    harness->Complete(c, E_FAIL);
+    CHECK(harness->IsDone(c));
+    harness->Complete(d, E_ABORT);
+    harness->Complete(d, S_OK);
+    CHECK(harness->GetRecord(d).state == StageState::Failed);
+    CHECK(harness->GetRecord(d).result == E_ABORT);
+
+    // A stage reporting before its start returned, which starts the next one
+    Stage const g = harness.AddAsync(L"G", {});
+    Stage e = 0;
+    e = harness->AddAsync(L"E", { g }, [&]()
+    {
+        harness->Complete(e, S_OK);
+        return S_OK;
+    });
+    Stage const f = harness.AddAsync(L"F", { e });
+    CHECK(harness.TakeStarted() == Names({ L"G" }));
+    harness->Complete(g, S_OK);
+    CHECK(harness->IsDone(e));
+    CHECK(harness.TakeStarted() == Names({ L"F" }));
+    CHECK(harness->GetRecord(f).state == StageState::Running);
+}
+
+// A failure is the outcome of everything depending on it, directly or not,
+// and none of those start. Independent stages go on.
+static void TestFailure()
+{
+    Harness harness;
+    Stage const content = harness.AddAsync(L"Content", {});
+    Stage const ui = harness.AddAsync(L"UI", {});
+    Stage const controls = harness.AddAsync(L"Controls", { ui });
+    Stage const tabs = harness.Add(L"Tabs", { content, controls });
+    Stage const pool = harness.Add(L"Pool", { content });
+
+    std::vector<HRESULT> outcomes;
+    harness->WhenDone(tabs, [&](HRESULT result) { outcomes.push_back(result); });
+    harness->Run();
+    harness.TakeStarted();
+
+    harness->Complete(ui, HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND));
+    CHECK(harness.TakeStarted().empty());
+    CHECK(harness->GetRecord(controls).state == StageState::Failed);
+    CHECK(!harness->GetRecord(controls).started);
+    CHECK(harness->GetRecord(tabs).result == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND));
+    CHECK(outcomes == std::vector<HRESULT>({ HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) }));
+
+    harness->Complete(content, S_OK);
+    CHECK(harness.TakeStarted() == Names({ L"Pool" }));
+    CHECK(harness->IsDone(pool));
+    CHECK(harness->GetRecord(tabs).state == StageState::Failed);
+
+    // Stages added after the failure fail right away, waiters are called
+    // right away
+    Stage const late = harness.Add(L"Late", { pool, controls });
+    CHECK(harness.TakeStarted().empty());
+    CHECK(harness->GetRecord(late).result == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND));
+    harness->WhenDone(late, [&](HRESULT result) { outcomes.push_back(result); });
+    CHECK(outcomes.size() == 2);
+
+    // Failing to start, synchronously or not
+    Stage const start = harness.AddAsync(L"Start", { pool }, E_ACCESSDENIED);
+    Stage const run = harness.Add(L"Run", { pool }, E_INVALIDARG);
+    Stage const after = harness.Add(L"After", { start });
+    CHECK(harness.TakeStarted() == Names({ L"Start", L"Run" }));
+    CHECK(harness->GetRecord(start).result == E_ACCESSDENIED);
+    CHECK(harness->GetRecord(run).result == E_INVALIDARG);
+    CHECK(harness->GetRecord(after).result == E_ACCESSDENIED);
+}
+
+// On-demand stages start once requested and their dependencies are done,
+// in either order
+static void TestOnDemand()
+{
+    Harness harness;
+    Stage const ui = harness.AddAsync(L"UI", {});
+    Stage const options = harness.AddAsync(L"Options", { ui }, S_OK, true);
+    Stage const settings = harness.AddAsync(L"Settings", { ui }, S_OK, true);
+    harness->Run();
+    harness->Complete(ui, S_OK);
+    CHECK(harness.TakeStarted() == Names({ L"UI" }));
+
+    std::vector<HRESULT> outcomes;
+    harness->Request(options);
+    harness->Request(options);
+    harness->WhenDone(options, [&](HRESULT result) { outcomes.push_back(result); });
+    CHECK(harness.TakeStarted() == Names({ L"Options" }));
+    harness->Complete(options, S_OK);
+    CHECK(outcomes == std::vector<HRESULT>({ S_OK }));
+    CHECK(harness->GetRecord(settings).state == StageState::Waiting);
+
+    // Requested before its dependency is done
+    Stage const env = harness.AddAsync(L"Env", {});
+    Stage const page = harness.AddAsync(L"Page", { env }, S_OK, true);
+    harness->Request(page);
+    CHECK(harness.TakeStarted() == Names({ L"Env" }));
+    harness->Complete(env, S_OK);
+    CHECK(harness.TakeStarted() == Names({ L"Page" }));
+
+    // Failed along with a dependency without ever being requested
+    Stage const broken = harness.AddAsync(L"Broken", {});
+    Stage const help = harness.AddAsync(L"Help", { broken }, S_OK, true);
+    harness->Complete(broken, E_FAIL);
+    CHECK(harness->GetRecord(help).state == StageState::Failed);
+    harness->Request(help);
+    CHECK(harness.TakeStarted() == Names({ L"Broken" }));
+}
+
+int main()
+{
+    TestDependencyOrder();
+    TestOutOfOrder();
+    TestFailure();
+    TestOnDemand();
+    return CheckResult();
+}
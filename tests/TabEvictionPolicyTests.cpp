@@ -0,0 +1,236 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests TabEvictionPolicy against a fake clock: nothing happens within the
+// budget, background tabs are suspended and then discarded in rank order,
+// and the tab in the foreground, tabs playing audio and tabs in the grace
+// period are left alone.
+
+#include "Check.h"
+#include "TabEvictionPolicy.h"
+
+typedef TabEvictionPolicy::Action Action;
+
+static ULONGLONG const c_mb = 1ULL << 20;
+static ULONGLONG const c_minute = 60 * 1000;
+
+// The policy with a clock the test moves
+class Harness
+{
+public:
+    explicit Harness(ULONGLONG budget) : m_policy(budget)
+    {
+    }
+
+    TabEvictionPolicy& operator*() { return m_policy; }
+    TabEvictionPolicy* operator->() { return &m_policy; }
+
+    void Advance(ULONGLONG milliseconds) { m_now += milliseconds; }
+    ULONGLONG GetTime() const { return m_now; }
+
+    // A tab with a controller, in the background since now
+    void Add(size_t tabId, ULONGLONG megabytes)
+    {
+        m_policy.Add(tabId, m_now);
+        m_policy.SetEstimate(tabId, megabytes * c_mb);
+    }
+
+    void Deactivate(size_t tabId) { m_policy.Deactivate(tabId, m_now); }
+
+    std::vector<std::pair<size_t, Action>> Evaluate()
+    {
+        std::vector<TabEvictionPolicy::Decision> decisions;
+        m_policy.Evaluate(m_now, decisions);
+        std::vector<std::pair<size_t, Action>> result;
+        for (const TabEvictionPolicy::Decision& decision : decisions)
+        {
+            result.push_back(std::make_pair(decision.tabId, decision.action));
+        }
+        return result;
+    }
+
+private:
+    ULONGLONG m_now = 1000;
+    TabEvictionPolicy m_policy;
+};
+
+typedef std::vector<std::pair<size_t, Action>> Decisions;
+
+static Decisions Suspend(std::initializer_list<size_t> tabIds)
+{
+    Decisions decisions;
+    for (size_t tabId : tabIds)
+    {
+        decisions.push_back(std::make_pair(tabId, Action::Suspend));
+    }
+    return decisions;
+}
+
+static Decisions Discard(std::initializer_list<size_t> tabIds)
+{
+    Decisions decisions;
+    for (size_t tabId : tabIds)
+    {
+        decisions.push_back(std::make_pair(tabId, Action::Discard));
+    }
+    return decisions;
+}
+
+// Tabs up to the budget are left alone, one byte more and the policy acts
+static void TestBudget()
+{
+    Harness harness(300 * c_mb);
+    harness.Add(1, 100);
+    harness.Add(2, 200);
+    harness.Advance(10 * c_minute);
+    CHECK(harness->GetTotal() == 300 * c_mb);
+    CHECK(harness.Evaluate().empty());
+
+    harness->SetEstimate(1, 100 * c_mb + 1);
+    CHECK(harness.Evaluate() == Suspend({ 2 }));
+    CHECK(harness->GetTotal() == 100 * c_mb + 1 + 50 * c_mb);
+    CHECK(harness.Evaluate().empty());
+
+    // Tabs which weren't measured yet count as c_defaultEstimate
+    harness->Add(3, harness.GetTime());
+    CHECK(harness->GetTotal() == 150 * c_mb + 1 + TabEvictionPolicy::c_defaultEstimate);
+    harness->Remove(3);
+    harness->Remove(3);
+    CHECK(harness->GetTotal() == 150 * c_mb + 1);
+}
+
+// Tabs rank by memory times minutes in the background. They are suspended
+// in that order until the tabs fit, and discarded in that order once
+// suspending isn't enough or failed.
+static void TestOrder()
+{
+    Harness harness(300 * c_mb);
+    harness.Add(1, 100);
+    harness.Add(2, 200);
+    harness.Add(3, 50);
+    harness.Add(4, 100);
+    harness->Activate(4);
+    harness->Activate(1);
+    harness->Activate(2);
+    harness.Advance(50 * c_minute);
+    harness.Deactivate(1);
+    harness.Deactivate(2);
+    harness.Advance(10 * c_minute);
+
+    // 3 has 51 MB for 61 minutes, 2 201 MB for 11 and 1 101 MB for 11
+    CHECK(harness->GetTotal() == 450 * c_mb);
+    CHECK(harness.Evaluate() == Suspend({ 3, 2 }));
+    CHECK(harness->GetTotal() == 100 * c_mb + 50 * c_mb + 12 * c_mb + c_mb / 2 + 100 * c_mb);
+    CHECK(harness.Evaluate().empty());
+
+    // Pending suspensions count as done, and aren't discarded
+    harness->SetEstimate(4, 200 * c_mb);
+    CHECK(harness.Evaluate() == Suspend({ 1 }));
+    harness->Suspended(1, false);
+    CHECK(harness.Evaluate() == Discard({ 1 }));
+    CHECK(harness->GetTotal() == 200 * c_mb + 50 * c_mb + 12 * c_mb + c_mb / 2);
+
+    // The discarded tab is forgotten, outcomes for it are ignored
+    harness->Suspended(1, true);
+    harness->SetEstimate(1, 1000 * c_mb);
+    CHECK(harness->GetTotal() == 200 * c_mb + 50 * c_mb + 12 * c_mb + c_mb / 2);
+
+    harness->Suspended(2, true);
+    harness->Suspended(3, true);
+    harness->SetEstimate(4, 400 * c_mb);
+    CHECK(harness.Evaluate() == Discard({ 3, 2 }));
+    CHECK(harness->GetTotal() == 400 * c_mb);
+
+    // The tab in the foreground is never evicted, even over the budget
+    harness.Advance(60 * c_minute);
+    CHECK(harness.Evaluate().empty());
+}
+
+// A tab stays untouched for c_gracePeriod after it was hidden, and while it
+// is shown. Showing a suspended tab resumes it.
+static void TestForegroundAndGracePeriod()
+{
+    Harness harness(100 * c_mb);
+    harness.Add(1, 100);
+    harness.Add(2, 100);
+    harness->Activate(2);
+    harness.Advance(TabEvictionPolicy::c_gracePeriod - 1);
+    CHECK(harness.Evaluate().empty());
+    harness.Advance(1);
+    CHECK(harness.Evaluate() == Suspend({ 1 }));
+    harness->Suspended(1, true);
+
+    harness->Activate(1);
+    harness.Deactivate(2);
+    CHECK(harness->GetTotal() == 200 * c_mb);
+    harness.Advance(TabEvictionPolicy::c_gracePeriod - 1);
+    CHECK(harness.Evaluate().empty());
+    harness.Advance(1);
+    CHECK(harness.Evaluate() == Suspend({ 2 }));
+
+    // A tab whose suspension failed stays out of the suspension pass
+    harness->Suspended(2, false);
+    harness->Activate(2);
+    harness->Activate(1);
+    harness.Deactivate(1);
+    harness.Deactivate(2);
+    harness.Advance(TabEvictionPolicy::c_gracePeriod);
+    Decisions expected = Suspend({ 1 });
+    expected.push_back(std::make_pair(size_t(2), Action::Discard));
+    CHECK(harness.Evaluate() == expected);
+    CHECK(harness->GetTotal() == 25 * c_mb);
+}
+
+// Tabs playing audio are left alone until they stop
+static void TestAudible()
+{
+    Harness harness(100 * c_mb);
+    harness.Add(1, 300);
+    harness.Add(2, 100);
+    harness->SetAudible(1, true);
+    harness.Advance(30 * c_minute);
+    CHECK(harness.Evaluate() == Suspend({ 2 }));
+    harness->Suspended(2, true);
+    CHECK(harness.Evaluate() == Discard({ 2 }));
+    CHECK(harness->GetTotal() == 300 * c_mb);
+    CHECK(harness.Evaluate().empty());
+
+    harness->SetAudible(1, false);
+    CHECK(harness.Evaluate() == Suspend({ 1 }));
+    harness->Suspended(1, true);
+    CHECK(harness.Evaluate().empty());
+
+    // Reloaded tabs start out silent
+    harness.Add(1, 300);
+    harness->SetAudible(1, true);
+    harness->Remove(1);
+    harness.Add(1, 300);
+    harness.Advance(TabEvictionPolicy::c_gracePeriod);
+    CHECK(harness.Evaluate() == Suspend({ 1 }));
+}
+
+// Calls for tabs the policy doesn't know change nothing
+static void TestUnknownTabs()
+{
+    Harness harness(100 * c_mb);
+    harness.Add(1, 50);
+    harness->Activate(7);
+    harness->Deactivate(7, harness.GetTime());
+    harness->SetEstimate(7, 1000 * c_mb);
+    harness->SetAudible(7, true);
+    harness->Suspended(7, true);
+    harness->Remove(7);
+    CHECK(harness->GetTotal() == 50 * c_mb);
+    CHECK(harness->GetBudget() == 100 * c_mb);
+}
+
+int main()
+{
+    TestBudget();
+    TestOrder();
+    TestForegroundAndGracePeriod();
+    TestAudible();
+    TestUnknownTabs();
+    return CheckResult();
+}
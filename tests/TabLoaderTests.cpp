@@ -0,0 +1,341 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests the TabLoader state machine with controllers from the fake runtime:
+// placeholder to queued, creating and ready, the limit on creations in
+// flight, shown tabs jumping the line, tabs closed or loaded again while
+// their controller is created, and failed creations.
+
+#include "Check.h"
+#include "FakeWebView2.h"
+#include "TabLoader.h"
+
+using namespace Microsoft::WRL;
+
+static HWND const c_window = reinterpret_cast<HWND>(1);
+
+// The loader and the controllers of its tabs, created and completed the way
+// BrowserWindow does it
+class Harness
+{
+public:
+    Harness(size_t maxInFlight, const FakeScript& script = FakeScript()) :
+        m_runtime(script), m_loader(maxInFlight, [this](size_t tabId) { return Create(tabId); })
+    {
+        m_environment = m_runtime.CreateEnvironment();
+    }
+
+    ~Harness()
+    {
+        for (auto& tab : m_controllers)
+        {
+            tab.second->Close();
+        }
+    }
+
+    TabLoader& operator*() { return m_loader; }
+    TabLoader* operator->() { return &m_loader; }
+    FakeRuntime& GetRuntime() { return m_runtime; }
+
+    // Tab ids, in the order their creations started, since the last call
+    std::vector<size_t> TakeStarted()
+    {
+        std::vector<size_t> started;
+        started.swap(m_started);
+        return started;
+    }
+
+    // The tab's creation fails before it starts
+    void FailStart(size_t tabId, HRESULT hr) { m_failures[tabId] = hr; }
+    // The tab takes a controller which is already there, like one from the
+    // pool, and completes before create returns
+    void CompleteOnStart(size_t tabId) { m_completeOnStart.insert(tabId); }
+
+    bool HasController(size_t tabId) const { return m_controllers.count(tabId) != 0; }
+    size_t GetControllerCount() const { return m_controllers.size(); }
+    // Controllers which were created for a tab which didn't need them anymore
+    size_t GetDiscardedCount() const { return m_discarded; }
+
+private:
+    FakeRuntime m_runtime;
+    TabLoader m_loader;
+    ComPtr<ICoreWebView2Environment> m_environment;
+    std::map<size_t, ComPtr<ICoreWebView2Controller>> m_controllers;
+    std::vector<size_t> m_started;
+    std::map<size_t, HRESULT> m_failures;
+    std::set<size_t> m_completeOnStart;
+    size_t m_discarded = 0;
+
+    HRESULT Create(size_t tabId)
+    {
+        m_started.push_back(tabId);
+        auto failure = m_failures.find(tabId);
+        if (failure != m_failures.end())
+        {
+            return failure->second;
+        }
+        if (m_completeOnStart.count(tabId) != 0)
+        {
+            ComPtr<FakeController> controller = Make<FakeController>(m_runtime, c_window);
+            Completed(tabId, S_OK, controller.Get());
+            return S_OK;
+        }
+
+        return m_environment->CreateCoreWebView2Controller(c_window, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+            [this, tabId](HRESULT errorCode, ICoreWebView2Controller* host) -> HRESULT
+        {
+            Completed(tabId, errorCode, host);
+            return S_OK;
+        }).Get());
+    }
+
+    void Completed(size_t tabId, HRESULT result, ICoreWebView2Controller* host)
+    {
+        if (SUCCEEDED(result) && (m_loader.GetState(tabId) != TabState::Creating || m_loader.IsAbandoned(tabId)))
+        {
+            CHECK(!m_loader.Created(tabId, false));
+            host->Close();
+            ++m_discarded;
+            return;
+        }
+
+        bool const wanted = m_loader.Created(tabId, SUCCEEDED(result));
+        CHECK(wanted == SUCCEEDED(result));
+        if (wanted)
+        {
+            CHECK(!HasController(tabId));
+            m_controllers[tabId] = host;
+        }
+    }
+};
+
+// A tab gets its controller the first time it is loaded
+static void TestLifecycle()
+{
+    Harness harness(2);
+    harness->Add(1);
+    CHECK(harness->GetState(1) == TabState::Placeholder);
+    CHECK(harness.TakeStarted().empty());
+
+    CHECK_HR(S_OK, harness->Load(1, false));
+    CHECK(harness->GetState(1) == TabState::Creating);
+    CHECK(harness->GetInFlightCount() == 1);
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 1 }));
+    CHECK(!harness.HasController(1));
+
+    harness.GetRuntime().Run();
+    CHECK(harness->GetState(1) == TabState::Ready);
+    CHECK(harness->GetInFlightCount() == 0);
+    CHECK(harness.HasController(1));
+
+    // Loading a ready tab does nothing
+    CHECK_HR(S_OK, harness->Load(1, true));
+    CHECK(harness.TakeStarted().empty());
+
+    // A tab whose controller was released starts over
+    harness->Unload(1);
+    CHECK(harness->GetState(1) == TabState::Placeholder);
+    harness->Unload(1);
+    CHECK(harness->GetState(1) == TabState::Placeholder);
+
+    // A tab moved from another window comes with its controller
+    harness->Adopt(2);
+    CHECK(harness->GetState(2) == TabState::Ready);
+    CHECK_HR(S_OK, harness->Load(2, true));
+    CHECK(harness.TakeStarted().empty());
+
+    // Unknown tabs aren't loaded
+    CHECK_HR(E_INVALIDARG, harness->Load(3, false));
+    CHECK(harness->GetState(3) == TabState::Placeholder);
+    harness->Remove(3);
+}
+
+// At most maxInFlight creations at once, the tab to be shown goes first
+static void TestQueue()
+{
+    Harness harness(2);
+    for (size_t tabId = 1; tabId <= 6; ++tabId)
+    {
+        harness->Add(tabId);
+        CHECK_HR(S_OK, harness->Load(tabId, false));
+    }
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 1, 2 }));
+    CHECK(harness->GetState(3) == TabState::Queued);
+    CHECK(harness->GetQueuedCount() == 4);
+
+    CHECK_HR(S_OK, harness->Load(5, true));
+    CHECK_HR(S_OK, harness->Load(6, false));
+    CHECK(harness->GetQueuedCount() == 4);
+    harness->Remove(4);
+    CHECK(harness->GetQueuedCount() == 3);
+
+    harness.GetRuntime().Run();
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 5, 3, 6 }));
+    CHECK(harness.GetControllerCount() == 5);
+    CHECK(!harness.HasController(4));
+    CHECK(harness->GetInFlightCount() == 0);
+    CHECK(harness->GetQueuedCount() == 0);
+}
+
+// Showing a tab twice while its controller is created creates one
+static void TestLoadedTwice()
+{
+    Harness harness(1);
+    harness->Add(1);
+    harness->Add(2);
+    CHECK_HR(S_OK, harness->Load(1, true));
+    CHECK_HR(S_OK, harness->Load(1, true));
+    CHECK_HR(S_OK, harness->Load(1, false));
+    CHECK(harness->GetInFlightCount() == 1);
+
+    CHECK_HR(S_OK, harness->Load(2, true));
+    CHECK_HR(S_OK, harness->Load(2, true));
+    CHECK(harness->GetQueuedCount() == 1);
+
+    harness.GetRuntime().Run();
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 1, 2 }));
+    CHECK(harness->GetState(1) == TabState::Ready);
+    CHECK(harness->GetState(2) == TabState::Ready);
+    CHECK(harness.GetDiscardedCount() == 0);
+}
+
+// A tab closed while Creating keeps its slot until the creation completes,
+// and its controller is closed then
+static void TestClosedWhileCreating()
+{
+    Harness harness(1);
+    harness->Add(1);
+    harness->Add(2);
+    CHECK_HR(S_OK, harness->Load(1, false));
+    CHECK_HR(S_OK, harness->Load(2, false));
+    harness->Remove(1);
+    CHECK(harness->IsAbandoned(1));
+    CHECK(harness->GetInFlightCount() == 1);
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 1 }));
+
+    harness.GetRuntime().Run();
+    CHECK(!harness->IsAbandoned(1));
+    CHECK(harness.GetDiscardedCount() == 1);
+    CHECK(!harness.HasController(1));
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 2 }));
+    CHECK(harness->GetState(2) == TabState::Ready);
+
+    // Also when the tab is loaded again meanwhile, under the same id
+    harness->Add(3);
+    CHECK_HR(S_OK, harness->Load(3, false));
+    harness->Remove(3);
+    harness->Add(3);
+    CHECK_HR(S_OK, harness->Load(3, false));
+    CHECK(harness->GetState(3) == TabState::Queued);
+    harness.GetRuntime().Run();
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 3, 3 }));
+    CHECK(harness->GetState(3) == TabState::Ready);
+    CHECK(harness.GetDiscardedCount() == 2);
+    CHECK(harness.GetControllerCount() == 2);
+}
+
+// A tab created again with the same id while the old creation is still in
+// flight, and the new one too, takes one controller
+static void TestRecreatedWhileCreating()
+{
+    Harness harness(2);
+    harness->Add(1);
+    CHECK_HR(S_OK, harness->Load(1, false));
+    harness->Remove(1);
+    harness->Add(1);
+    CHECK_HR(S_OK, harness->Load(1, false));
+    CHECK(harness->GetState(1) == TabState::Creating);
+    CHECK(harness->IsAbandoned(1));
+    CHECK(harness->GetInFlightCount() == 2);
+
+    harness.GetRuntime().Run();
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 1, 1 }));
+    CHECK(harness->GetState(1) == TabState::Ready);
+    CHECK(harness.GetControllerCount() == 1);
+    CHECK(harness.GetDiscardedCount() == 1);
+    CHECK(harness->GetInFlightCount() == 0);
+}
+
+// A failed tab is a placeholder again and is loaded the next time it's shown
+static void TestFailures()
+{
+    FakeScript script;
+    script.controllerFailureRate = 1;
+    Harness harness(1, script);
+    harness->Add(1);
+    harness->Add(2);
+    CHECK_HR(S_OK, harness->Load(1, false));
+    CHECK_HR(S_OK, harness->Load(2, false));
+    harness.GetRuntime().Run();
+    CHECK(harness->GetState(1) == TabState::Placeholder);
+    CHECK(harness->GetState(2) == TabState::Placeholder);
+    CHECK(harness->GetInFlightCount() == 0);
+
+    harness.GetRuntime().GetScript().controllerFailureRate = 0;
+    CHECK_HR(S_OK, harness->Load(2, true));
+    harness.GetRuntime().Run();
+    CHECK(harness->GetState(2) == TabState::Ready);
+
+    // A creation which can't start returns its error and frees the slot
+    harness.FailStart(1, E_OUTOFMEMORY);
+    harness->Add(3);
+    CHECK_HR(S_OK, harness->SetPaused(true));
+    CHECK_HR(S_OK, harness->Load(1, false));
+    CHECK_HR(S_OK, harness->Load(3, false));
+    CHECK_HR(E_OUTOFMEMORY, harness->SetPaused(false));
+    CHECK(harness->GetState(1) == TabState::Placeholder);
+    CHECK(harness->GetState(3) == TabState::Creating);
+    harness.GetRuntime().Run();
+    CHECK(harness->GetState(3) == TabState::Ready);
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 1, 2, 2, 1, 3 }));
+}
+
+// A controller from the pool completes the creation before create returns
+static void TestCompletedOnStart()
+{
+    Harness harness(1);
+    for (size_t tabId = 1; tabId <= 3; ++tabId)
+    {
+        harness->Add(tabId);
+        harness.CompleteOnStart(tabId);
+        CHECK_HR(S_OK, harness->Load(tabId, false));
+        CHECK(harness->GetState(tabId) == TabState::Ready);
+    }
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 1, 2, 3 }));
+    CHECK(harness->GetInFlightCount() == 0);
+    CHECK(harness.GetControllerCount() == 3);
+}
+
+// While paused, loaded tabs line up and start together once resumed
+static void TestPaused()
+{
+    Harness harness(2);
+    CHECK_HR(S_OK, harness->SetPaused(true));
+    for (size_t tabId = 1; tabId <= 3; ++tabId)
+    {
+        harness->Add(tabId);
+        CHECK_HR(S_OK, harness->Load(tabId, tabId == 3));
+    }
+    CHECK(harness.TakeStarted().empty());
+    CHECK(harness->GetQueuedCount() == 3);
+
+    CHECK_HR(S_OK, harness->SetPaused(false));
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 3, 1 }));
+    harness.GetRuntime().Run();
+    CHECK(harness.TakeStarted() == std::vector<size_t>({ 2 }));
+    CHECK(harness.GetControllerCount() == 3);
+}
+
+int main()
+{
+    TestLifecycle();
+    TestQueue();
+    TestLoadedTwice();
+    TestClosedWhileCreating();
+    TestRecreatedWhileCreating();
+    TestFailures();
+    TestCompletedOnStart();
+    TestPaused();
+    return CheckResult();
+}
@@ -0,0 +1,690 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests that the exported trace is well formed JSON in the Chrome trace event
+// format, with names that need escaping, events from several threads and a
+// ring buffer that wrapped around, and that the summary is well formed too.
+
+#include "Check.h"
+#include "Trace.h"
+
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+static std::string s_directory;
+
+static std::wstring GetPath(const char* name)
+{
+    std::string const path = s_directory + "/" + name;
+    return std::wstring(path.begin(), path.end());
+}
+
+static std::string ReadFileBytes(const std::wstring& path)
+{
+    std::ifstream stream(PortablePath(path.c_str()), std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+struct JsonNode
+{
+    enum class Kind
+    {
+        Null,
+        Boolean,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    Kind kind = Kind::Null;
+    double number = 0;
+    std::string text;  // UTF-8
+    std::vector<JsonNode> items;
+    std::vector<std::pair<std::string, JsonNode>> members;
+
+    const JsonNode* Find(const char* name, Kind expected) const
+    {
+        for (const auto& member : members)
+        {
+            if (member.first == name)
+            {
+                return member.second.kind == expected ? &member.second : nullptr;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// A strict RFC 8259 parser: no trailing commas, no raw control characters or
+// invalid UTF-8 in strings, no duplicate names, nothing after the value
+class JsonParser
+{
+public:
+    static bool Parse(const std::string& json, JsonNode& node)
+    {
+        JsonParser parser(json);
+        if (!parser.ParseValue(node, 0))
+        {
+            return false;
+        }
+        parser.SkipSpace();
+        return parser.m_next == parser.m_end;
+    }
+
+private:
+    static const int c_maxDepth = 64;
+
+    const char* m_next;
+    const char* m_end;
+
+    explicit JsonParser(const std::string& json) : m_next(json.data()), m_end(json.data() + json.size())
+    {
+    }
+
+    void SkipSpace()
+    {
+        while (m_next != m_end && (*m_next == ' ' || *m_next == '\t' || *m_next == '\n' || *m_next == '\r'))
+        {
+            ++m_next;
+        }
+    }
+
+    bool Consume(char c)
+    {
+        SkipSpace();
+        if (m_next != m_end && *m_next == c)
+        {
+            ++m_next;
+            return true;
+        }
+        return false;
+    }
+
+    bool ConsumeWord(const char* word)
+    {
+        size_t const length = std::strlen(word);
+        if (static_cast<size_t>(m_end - m_next) < length || std::memcmp(m_next, word, length) != 0)
+        {
+            return false;
+        }
+        m_next += length;
+        return true;
+    }
+
+    bool ParseValue(JsonNode& node, int depth)
+    {
+        SkipSpace();
+        if (m_next == m_end || depth > c_maxDepth)
+        {
+            return false;
+        }
+
+        switch (*m_next)
+        {
+        case '{':
+            return ParseObject(node, depth);
+        case '[':
+            return ParseArray(node, depth);
+        case '"':
+            node.kind = JsonNode::Kind::String;
+            return ParseString(node.text);
+        case 't':
+            node.kind = JsonNode::Kind::Boolean;
+            node.number = 1;
+            return ConsumeWord("true");
+        case 'f':
+            node.kind = JsonNode::Kind::Boolean;
+            return ConsumeWord("false");
+        case 'n':
+            return ConsumeWord("null");
+        default:
+            node.kind = JsonNode::Kind::Number;
+            return ParseNumber(node.number);
+        }
+    }
+
+    bool ParseObject(JsonNode& node, int depth)
+    {
+        node.kind = JsonNode::Kind::Object;
+        ++m_next;
+        if (Consume('}'))
+        {
+            return true;
+        }
+        do
+        {
+            SkipSpace();
+            std::string name;
+            if (m_next == m_end || *m_next != '"' || !ParseString(name) || !Consume(':'))
+            {
+                return false;
+            }
+            for (const auto& member : node.members)
+            {
+                if (member.first == name)
+                {
+                    return false;
+                }
+            }
+            node.members.emplace_back(std::move(name), JsonNode());
+            if (!ParseValue(node.members.back().second, depth + 1))
+            {
+                return false;
+            }
+        } while (Consume(','));
+        return Consume('}');
+    }
+
+    bool ParseArray(JsonNode& node, int depth)
+    {
+        node.kind = JsonNode::Kind::Array;
+        ++m_next;
+        if (Consume(']'))
+        {
+            return true;
+        }
+        do
+        {
+            node.items.emplace_back();
+            if (!ParseValue(node.items.back(), depth + 1))
+            {
+                return false;
+            }
+        } while (Consume(','));
+        return Consume(']');
+    }
+
+    bool ParseDigits()
+    {
+        const char* const first = m_next;
+        while (m_next != m_end && *m_next >= '0' && *m_next <= '9')
+        {
+            ++m_next;
+        }
+        return m_next != first;
+    }
+
+    bool ParseNumber(double& number)
+    {
+        const char* const first = m_next;
+        if (m_next != m_end && *m_next == '-')
+        {
+            ++m_next;
+        }
+        // No leading zeros
+        if (m_next != m_end && *m_next == '0')
+        {
+            ++m_next;
+        }
+        else if (!ParseDigits())
+        {
+            return false;
+        }
+        if (m_next != m_end && *m_next == '.')
+        {
+            ++m_next;
+            if (!ParseDigits())
+            {
+                return false;
+            }
+        }
+        if (m_next != m_end && (*m_next == 'e' || *m_next == 'E'))
+        {
+            ++m_next;
+            if (m_next != m_end && (*m_next == '+' || *m_next == '-'))
+            {
+                ++m_next;
+            }
+            if (!ParseDigits())
+            {
+                return false;
+            }
+        }
+        number = std::strtod(std::string(first, m_next).c_str(), nullptr);
+        return true;
+    }
+
+    bool ParseHex(unsigned int& value)
+    {
+        value = 0;
+        for (int i = 0; i < 4; ++i, ++m_next)
+        {
+            if (m_next == m_end)
+            {
+                return false;
+            }
+            char const c = *m_next;
+            unsigned int const digit = c >= '0' && c <= '9' ? c - '0' :
+                c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                c >= 'A' && c <= 'F' ? c - 'A' + 10 : 16;
+            if (digit == 16)
+            {
+                return false;
+            }
+            value = value * 16 + digit;
+        }
+        return true;
+    }
+
+    static void AppendCodePoint(unsigned int codePoint, std::string& text)
+    {
+        if (codePoint < 0x80)
+        {
+            text += static_cast<char>(codePoint);
+        }
+        else if (codePoint < 0x800)
+        {
+            text += static_cast<char>(0xC0 | codePoint >> 6);
+            text += static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else if (codePoint < 0x10000)
+        {
+            text += static_cast<char>(0xE0 | codePoint >> 12);
+            text += static_cast<char>(0x80 | (codePoint >> 6 & 0x3F));
+            text += static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else
+        {
+            text += static_cast<char>(0xF0 | codePoint >> 18);
+            text += static_cast<char>(0x80 | (codePoint >> 12 & 0x3F));
+            text += static_cast<char>(0x80 | (codePoint >> 6 & 0x3F));
+            text += static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+    }
+
+    // Copies one UTF-8 sequence, rejecting overlong forms and surrogates
+    bool CopyUtf8(std::string& text)
+    {
+        unsigned char const lead = static_cast<unsigned char>(*m_next);
+        size_t length = 0;
+        unsigned int codePoint = 0;
+        if (lead >= 0xC2 && lead <= 0xDF)
+        {
+            length = 2;
+            codePoint = lead & 0x1F;
+        }
+        else if (lead >= 0xE0 && lead <= 0xEF)
+        {
+            length = 3;
+            codePoint = lead & 0x0F;
+        }
+        else if (lead >= 0xF0 && lead <= 0xF4)
+        {
+            length = 4;
+            codePoint = lead & 0x07;
+        }
+        if (length == 0 || static_cast<size_t>(m_end - m_next) < length)
+        {
+            return false;
+        }
+        for (size_t i = 1; i < length; ++i)
+        {
+            unsigned char const trail = static_cast<unsigned char>(m_next[i]);
+            if ((trail & 0xC0) != 0x80)
+            {
+                return false;
+            }
+            codePoint = codePoint << 6 | (trail & 0x3F);
+        }
+        static unsigned int const c_minimum[] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (codePoint < c_minimum[length] || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+        {
+            return false;
+        }
+        text.append(m_next, length);
+        m_next += length;
+        return true;
+    }
+
+    bool ParseString(std::string& text)
+    {
+        ++m_next;
+        while (m_next != m_end)
+        {
+            unsigned char const c = static_cast<unsigned char>(*m_next);
+            if (c == '"')
+            {
+                ++m_next;
+                return true;
+            }
+            if (c < 0x20)
+            {
+                return false;
+            }
+            if (c >= 0x80)
+            {
+                if (!CopyUtf8(text))
+                {
+                    return false;
+                }
+                continue;
+            }
+            ++m_next;
+            if (c != '\\')
+            {
+                text += static_cast<char>(c);
+                continue;
+            }
+
+            if (m_next == m_end)
+            {
+                return false;
+            }
+            char const escape = *m_next++;
+            switch (escape)
+            {
+            case '"': text += '"'; break;
+            case '\\': text += '\\'; break;
+            case '/': text += '/'; break;
+            case 'b': text += '\b'; break;
+            case 'f': text += '\f'; break;
+            case 'n': text += '\n'; break;
+            case 'r': text += '\r'; break;
+            case 't': text += '\t'; break;
+            case 'u':
+            {
+                unsigned int codePoint = 0;
+                if (!ParseHex(codePoint))
+                {
+                    return false;
+                }
+                if (codePoint >= 0xD800 && codePoint <= 0xDBFF)
+                {
+                    unsigned int low = 0;
+                    if (!ConsumeWord("\\u") || !ParseHex(low) || low < 0xDC00 || low > 0xDFFF)
+                    {
+                        return false;
+                    }
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                else if (codePoint >= 0xDC00 && codePoint <= 0xDFFF)
+                {
+                    return false;
+                }
+                AppendCodePoint(codePoint, text);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+};
+
+static bool ParseFile(const std::wstring& path, JsonNode& root)
+{
+    std::string const json = ReadFileBytes(path);
+    return CHECK(!json.empty()) && CHECK(JsonParser::Parse(json, root)) && CHECK(root.kind == JsonNode::Kind::Object);
+}
+
+// The events of an exported trace, after checking each has the fields its
+// phase needs
+static std::vector<const JsonNode*> GetEvents(const JsonNode& root)
+{
+    std::vector<const JsonNode*> events;
+    const JsonNode* unit = root.Find("displayTimeUnit", JsonNode::Kind::String);
+    const JsonNode* traceEvents = root.Find("traceEvents", JsonNode::Kind::Array);
+    if (!CHECK(unit && unit->text == "ms") || !CHECK(traceEvents))
+    {
+        return events;
+    }
+
+    for (const JsonNode& event : traceEvents->items)
+    {
+        if (!CHECK(event.kind == JsonNode::Kind::Object))
+        {
+            continue;
+        }
+        const JsonNode* name = event.Find("name", JsonNode::Kind::String);
+        const JsonNode* category = event.Find("cat", JsonNode::Kind::String);
+        const JsonNode* phase = event.Find("ph", JsonNode::Kind::String);
+        const JsonNode* timestamp = event.Find("ts", JsonNode::Kind::Number);
+        CHECK(name && category && category->text == "browser");
+        CHECK(timestamp && timestamp->number >= 0);
+        CHECK(event.Find("pid", JsonNode::Kind::Number) && event.Find("tid", JsonNode::Kind::Number));
+        if (!CHECK(phase && phase->text.size() == 1))
+        {
+            continue;
+        }
+
+        const JsonNode* args = event.Find("args", JsonNode::Kind::Object);
+        switch (phase->text[0])
+        {
+        case 'X':
+        {
+            const JsonNode* duration = event.Find("dur", JsonNode::Kind::Number);
+            CHECK(duration && duration->number >= 0);
+            CHECK(args && args->Find("id", JsonNode::Kind::Number));
+            break;
+        }
+        case 'i':
+        {
+            const JsonNode* scope = event.Find("s", JsonNode::Kind::String);
+            CHECK(scope && scope->text == "t");
+            CHECK(args && args->Find("id", JsonNode::Kind::Number));
+            break;
+        }
+        case 'b':
+        case 'e':
+            CHECK(event.Find("id", JsonNode::Kind::Number));
+            break;
+        default:
+            CHECK(!"Unknown phase");
+            break;
+        }
+        events.push_back(&event);
+    }
+    return events;
+}
+
+static std::vector<const JsonNode*> FindEvents(const std::vector<const JsonNode*>& events, const std::string& name)
+{
+    std::vector<const JsonNode*> found;
+    for (const JsonNode* event : events)
+    {
+        if (event->Find("name", JsonNode::Kind::String)->text == name)
+        {
+            found.push_back(event);
+        }
+    }
+    return found;
+}
+
+static double GetNumber(const JsonNode* node, const char* name)
+{
+    const JsonNode* value = node->Find(name, JsonNode::Kind::Number);
+    return value ? value->number : -1;
+}
+
+// Nothing is recorded until tracing is enabled, the export is still valid
+static void TestDisabled()
+{
+    CHECK(!Trace::IsEnabled());
+    {
+        TRACE_SPAN(L"Disabled span", 1);
+        TRACE_INSTANT(L"Disabled instant", 2);
+    }
+    CHECK_HR(S_FALSE, Trace::Export());
+
+    std::wstring const path = GetPath("disabled.json");
+    CHECK_HR(S_OK, Trace::Export(path.c_str()));
+    JsonNode root;
+    if (ParseFile(path, root))
+    {
+        CHECK(GetEvents(root).empty());
+    }
+}
+
+// Every kind of event, from two threads, under names JSON has to escape
+static void TestEvents()
+{
+    std::wstring const path = GetPath("trace.json");
+    Trace::Enable(path.c_str());
+    {
+        TRACE_SPAN(L"Span", 1);
+        TRACE_INSTANT(L"Instant", 2);
+        TRACE_INSTANT(L"Quote \" and \\ backslash", 3);
+        TRACE_INSTANT(L"Line\nbreak\ttab\x01", 4);
+        // A surrogate pair, wchar_t holds UTF-16 units on Windows
+        TRACE_INSTANT(L"Caf\x00e9 \xd83d\xde80", 5);
+        TRACE_ASYNC_BEGIN(L"Async", 6);
+    }
+    std::thread([]()
+    {
+        TRACE_ASYNC_END(L"Async", 6);
+    }).join();
+    CHECK_HR(S_OK, Trace::Export());
+
+    JsonNode root;
+    if (!ParseFile(path, root))
+    {
+        return;
+    }
+    std::vector<const JsonNode*> const events = GetEvents(root);
+    CHECK(events.size() == 7);
+
+    std::vector<const JsonNode*> const spans = FindEvents(events, "Span");
+    if (CHECK(spans.size() == 1))
+    {
+        CHECK(spans[0]->Find("ph", JsonNode::Kind::String)->text == "X");
+        CHECK(GetNumber(spans[0]->Find("args", JsonNode::Kind::Object), "id") == 1);
+    }
+    CHECK(FindEvents(events, "Instant").size() == 1);
+    CHECK(FindEvents(events, "Quote \" and \\ backslash").size() == 1);
+    CHECK(FindEvents(events, "Line\nbreak\ttab\x01").size() == 1);
+    CHECK(FindEvents(events, "Caf\xc3\xa9 \xf0\x9f\x9a\x80").size() == 1);
+
+    std::vector<const JsonNode*> const async = FindEvents(events, "Async");
+    if (CHECK(async.size() == 2))
+    {
+        CHECK(async[0]->Find("ph", JsonNode::Kind::String)->text == "b");
+        CHECK(async[1]->Find("ph", JsonNode::Kind::String)->text == "e");
+        CHECK(GetNumber(async[0], "id") == 6 && GetNumber(async[1], "id") == 6);
+        CHECK(GetNumber(async[0], "tid") != GetNumber(async[1], "tid"));
+        CHECK(GetNumber(async[0], "ts") <= GetNumber(async[1], "ts"));
+    }
+}
+
+// A thread which recorded more than its buffer holds exports its newest
+// events, in order
+static void TestWrapped()
+{
+    std::thread([]()
+    {
+        for (size_t i = 0; i < Trace::c_bufferSize + 100; ++i)
+        {
+            TRACE_INSTANT(L"Wrapped", i);
+        }
+    }).join();
+
+    std::wstring const path = GetPath("wrapped.json");
+    CHECK_HR(S_OK, Trace::Export(path.c_str()));
+    JsonNode root;
+    if (!ParseFile(path, root))
+    {
+        return;
+    }
+    std::vector<const JsonNode*> const wrapped = FindEvents(GetEvents(root), "Wrapped");
+    if (CHECK(wrapped.size() == Trace::c_bufferSize))
+    {
+        for (size_t i = 0; i < wrapped.size(); ++i)
+        {
+            if (!CHECK(GetNumber(wrapped[i]->Find("args", JsonNode::Kind::Object), "id") == static_cast<double>(i + 100)))
+            {
+                break;
+            }
+        }
+    }
+}
+
+// The summary counts spans and instants per name
+static void TestSummary()
+{
+    std::wstring const path = GetPath("summary.json");
+    CHECK_HR(S_OK, Trace::ExportSummary(path.c_str()));
+    JsonNode root;
+    if (!ParseFile(path, root))
+    {
+        return;
+    }
+
+    const JsonNode* unit = root.Find("unit", JsonNode::Kind::String);
+    const JsonNode* spans = root.Find("spans", JsonNode::Kind::Array);
+    const JsonNode* instants = root.Find("instants", JsonNode::Kind::Array);
+    if (!CHECK(unit && unit->text == "us") || !CHECK(spans && instants))
+    {
+        return;
+    }
+
+    std::map<std::string, double> spanCounts;
+    for (const JsonNode& span : spans->items)
+    {
+        const JsonNode* name = span.Find("name", JsonNode::Kind::String);
+        if (CHECK(name))
+        {
+            spanCounts[name->text] = GetNumber(&span, "count");
+        }
+        for (const char* field : { "total", "mean", "p50", "p95", "max" })
+        {
+            CHECK(GetNumber(&span, field) >= 0);
+        }
+        CHECK(GetNumber(&span, "p50") <= GetNumber(&span, "p95") && GetNumber(&span, "p95") <= GetNumber(&span, "max"));
+    }
+    CHECK(spanCounts == (std::map<std::string, double>{ { "Span", 1 }, { "Async", 1 } }));
+
+    std::map<std::string, double> instantCounts;
+    for (const JsonNode& instant : instants->items)
+    {
+        const JsonNode* name = instant.Find("name", JsonNode::Kind::String);
+        if (CHECK(name))
+        {
+            instantCounts[name->text] = GetNumber(&instant, "count");
+        }
+    }
+    CHECK(instantCounts.size() == 5);
+    CHECK(instantCounts["Wrapped"] == Trace::c_bufferSize);
+    CHECK(instantCounts["Caf\xc3\xa9 \xf0\x9f\x9a\x80"] == 1);
+}
+
+// The parser itself rejects what Chrome's trace viewer would
+static void TestParser()
+{
+    JsonNode node;
+    CHECK(JsonParser::Parse("{\"a\":[1,-2.5e3,true,false,null,\"\\u00e9\\ud83d\\ude80\"]}", node));
+    for (const char* invalid : { "", "{", "{\"a\":1,}", "[1,]", "{\"a\":1,\"a\":2}", "\"\x01\"", "\"\\x\"", "01",
+        "1.", "\"\\ud83d\"", "\"\xc3\"", "\"\xc0\xaf\"", "{} {}", "[\"a\" \"b\"]" })
+    {
+        if (!CHECK(!JsonParser::Parse(invalid, node)))
+        {
+            std::fprintf(stderr, "Accepted %s\n", invalid);
+        }
+    }
+}
+
+int main()
+{
+    char directory[] = "/tmp/TraceTests.XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    s_directory = directory;
+
+    TestParser();
+    TestDisabled();
+    TestEvents();
+    TestWrapped();
+    TestSummary();
+
+    std::string const remove = "rm -rf '" + s_directory + "'";
+    if (std::system(remove.c_str()) != 0)
+    {
+        std::fprintf(stderr, "Can't remove %s\n", s_directory.c_str());
+    }
+    return CheckResult();
+}
@@ -0,0 +1,551 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests Utf.cpp against a straightforward reference transcoder: known
+// vectors, every invalid lead and continuation byte, every code point, short
+// destination buffers and random (mostly ASCII) input around the SIMD block
+// sizes. With --bench it reports the throughput per direction and text kind.
+
+#include "Check.h"
+#include "Utf.h"
+
+#include <random>
+
+#ifndef UTF_TEST_VARIANT
+#define UTF_TEST_VARIANT "scalar"
+#endif
+
+#define UTF_INVALID HRESULT_FROM_WIN32(ERROR_NO_UNICODE_TRANSLATION)
+#define UTF_NO_ROOM HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER)
+
+typedef std::basic_string<WCHAR> Utf16String;
+
+// Reference implementation
+
+struct Reference
+{
+    HRESULT hr = S_OK;
+    // Output up to the first invalid sequence
+    std::string utf8;
+    Utf16String utf16;
+    // Output length after each complete code point, starting with 0
+    std::vector<size_t> boundaries{ 0 };
+};
+
+static void AppendCodePointUtf8(uint32_t c, std::string& out)
+{
+    if (c < 0x80)
+    {
+        out += static_cast<char>(c);
+    }
+    else if (c < 0x800)
+    {
+        out += static_cast<char>(0xC0 | (c >> 6));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else if (c < 0x10000)
+    {
+        out += static_cast<char>(0xE0 | (c >> 12));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else
+    {
+        out += static_cast<char>(0xF0 | (c >> 18));
+        out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+}
+
+static void AppendCodePointUtf16(uint32_t c, Utf16String& out)
+{
+    if (c < 0x10000)
+    {
+        out += static_cast<WCHAR>(c);
+    }
+    else
+    {
+        out += static_cast<WCHAR>(0xD800 + ((c - 0x10000) >> 10));
+        out += static_cast<WCHAR>(0xDC00 + ((c - 0x10000) & 0x3FF));
+    }
+}
+
+// Well-formed UTF-8 byte sequences, as in table 3-7 of the Unicode standard
+static Reference ReferenceUtf8ToUtf16(const std::string& src)
+{
+    Reference result;
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(src.data());
+    size_t const n = src.size();
+    size_t i = 0;
+    while (i < n)
+    {
+        unsigned char const b0 = s[i];
+        uint32_t c;
+        size_t length;
+        unsigned char low = 0x80;
+        unsigned char high = 0xBF;
+        if (b0 < 0x80)
+        {
+            c = b0;
+            length = 1;
+        }
+        else if (b0 >= 0xC2 && b0 <= 0xDF)
+        {
+            c = b0 & 0x1F;
+            length = 2;
+        }
+        else if (b0 >= 0xE0 && b0 <= 0xEF)
+        {
+            c = b0 & 0x0F;
+            length = 3;
+            low = b0 == 0xE0 ? 0xA0 : 0x80;
+            high = b0 == 0xED ? 0x9F : 0xBF;
+        }
+        else if (b0 >= 0xF0 && b0 <= 0xF4)
+        {
+            c = b0 & 0x07;
+            length = 4;
+            low = b0 == 0xF0 ? 0x90 : 0x80;
+            high = b0 == 0xF4 ? 0x8F : 0xBF;
+        }
+        else
+        {
+            result.hr = UTF_INVALID;
+            return result;
+        }
+
+        if (n - i < length)
+        {
+            result.hr = UTF_INVALID;
+            return result;
+        }
+        for (size_t k = 1; k < length; ++k)
+        {
+            unsigned char const b = s[i + k];
+            if (b < (k == 1 ? low : 0x80) || b > (k == 1 ? high : 0xBF))
+            {
+                result.hr = UTF_INVALID;
+                return result;
+            }
+            c = (c << 6) | (b & 0x3F);
+        }
+        AppendCodePointUtf16(c, result.utf16);
+        result.boundaries.push_back(result.utf16.size());
+        i += length;
+    }
+    return result;
+}
+
+static Reference ReferenceUtf16ToUtf8(const Utf16String& src)
+{
+    Reference result;
+    size_t i = 0;
+    while (i < src.size())
+    {
+        uint32_t c = src[i];
+        if (c >= 0xDC00 && c <= 0xDFFF)
+        {
+            result.hr = UTF_INVALID;
+            return result;
+        }
+        if (c >= 0xD800 && c <= 0xDBFF)
+        {
+            if (i + 1 == src.size() || src[i + 1] < 0xDC00 || src[i + 1] > 0xDFFF)
+            {
+                result.hr = UTF_INVALID;
+                return result;
+            }
+            c = 0x10000 + ((c - 0xD800) << 10) + (src[i + 1] - 0xDC00);
+            ++i;
+        }
+        AppendCodePointUtf8(c, result.utf8);
+        result.boundaries.push_back(result.utf8.size());
+        ++i;
+    }
+    return result;
+}
+
+// Comparisons against the reference
+
+static bool ExpectUtf16(const std::string& src, int line)
+{
+    Reference const expected = ReferenceUtf8ToUtf16(src);
+    Utf16String dst(MaxUtf16Length(src.size()) + 1, WCHAR('?'));
+    size_t written = ~size_t(0);
+    HRESULT const hr = Utf8ToUtf16(src.data(), src.size(), &dst[0], MaxUtf16Length(src.size()), &written);
+    bool const ok = hr == expected.hr && written == expected.utf16.size() &&
+        dst.compare(0, written, expected.utf16) == 0;
+    if (!ok)
+    {
+        std::fprintf(stderr, "line %d: Utf8ToUtf16 of %zu bytes returned 0x%08X, %zu units (expected 0x%08X, %zu)\n",
+            line, src.size(), static_cast<unsigned>(hr), written, static_cast<unsigned>(expected.hr),
+            expected.utf16.size());
+    }
+    return ok;
+}
+
+static bool ExpectUtf8(const Utf16String& src, int line)
+{
+    Reference const expected = ReferenceUtf16ToUtf8(src);
+    std::string dst(MaxUtf8Length(src.size()) + 1, '?');
+    size_t written = ~size_t(0);
+    HRESULT const hr = Utf16ToUtf8(src.data(), src.size(), &dst[0], MaxUtf8Length(src.size()), &written);
+    bool const ok = hr == expected.hr && written == expected.utf8.size() &&
+        dst.compare(0, written, expected.utf8) == 0;
+    if (!ok)
+    {
+        std::fprintf(stderr, "line %d: Utf16ToUtf8 of %zu units returned 0x%08X, %zu bytes (expected 0x%08X, %zu)\n",
+            line, src.size(), static_cast<unsigned>(hr), written, static_cast<unsigned>(expected.hr),
+            expected.utf8.size());
+    }
+    return ok;
+}
+
+#define EXPECT_UTF16(src) CHECK(ExpectUtf16((src), __LINE__))
+#define EXPECT_UTF8(src) CHECK(ExpectUtf8((src), __LINE__))
+
+// Every destination size below the required one must fail with
+// ERROR_INSUFFICIENT_BUFFER after writing the code points that fit.
+static void CheckShortBuffers(const std::string& utf8)
+{
+    Reference const toUtf16 = ReferenceUtf8ToUtf16(utf8);
+    CHECK(SUCCEEDED(toUtf16.hr));
+    for (size_t capacity = 0; capacity < toUtf16.utf16.size(); ++capacity)
+    {
+        Utf16String dst(capacity + 1, WCHAR('?'));
+        size_t written = ~size_t(0);
+        CHECK_HR(UTF_NO_ROOM, Utf8ToUtf16(utf8.data(), utf8.size(), &dst[0], capacity, &written));
+        size_t const fits = *(std::upper_bound(toUtf16.boundaries.begin(), toUtf16.boundaries.end(), capacity) - 1);
+        CHECK(written == fits);
+        CHECK(dst.compare(0, fits, toUtf16.utf16, 0, fits) == 0);
+        CHECK(dst[capacity] == WCHAR('?'));
+    }
+
+    Utf16String const utf16 = toUtf16.utf16;
+    Reference const toUtf8 = ReferenceUtf16ToUtf8(utf16);
+    for (size_t capacity = 0; capacity < toUtf8.utf8.size(); ++capacity)
+    {
+        std::string dst(capacity + 1, '?');
+        size_t written = ~size_t(0);
+        CHECK_HR(UTF_NO_ROOM, Utf16ToUtf8(utf16.data(), utf16.size(), &dst[0], capacity, &written));
+        size_t const fits = *(std::upper_bound(toUtf8.boundaries.begin(), toUtf8.boundaries.end(), capacity) - 1);
+        CHECK(written == fits);
+        CHECK(dst.compare(0, fits, toUtf8.utf8, 0, fits) == 0);
+        CHECK(dst[capacity] == '?');
+    }
+}
+
+static Utf16String U16(std::initializer_list<unsigned> units)
+{
+    Utf16String s;
+    for (unsigned u : units)
+    {
+        s += static_cast<WCHAR>(u);
+    }
+    return s;
+}
+
+// Tests
+
+static void TestKnownVectors()
+{
+    // "aé€😀"
+    std::string const utf8 = "a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80";
+    Utf16String const utf16 = U16({ 0x61, 0xE9, 0x20AC, 0xD83D, 0xDE00 });
+
+    Utf16String wide;
+    CHECK_HR(S_OK, AppendUtf16(utf8.data(), utf8.size(), wide));
+    CHECK(wide == utf16);
+
+    std::string narrow = "prefix ";
+    CHECK_HR(S_OK, AppendUtf8(utf16.data(), utf16.size(), narrow));
+    CHECK(narrow == "prefix " + utf8);
+
+    // A failed append leaves the string as it was
+    std::string kept = "kept";
+    Utf16String const lone = U16({ 0x61, 0xD800 });
+    CHECK_HR(UTF_INVALID, AppendUtf8(lone.data(), lone.size(), kept));
+    CHECK(kept == "kept");
+
+    size_t written = ~size_t(0);
+    CHECK_HR(S_OK, Utf8ToUtf16(nullptr, 0, nullptr, 0, &written));
+    CHECK(written == 0);
+    CHECK_HR(S_OK, Utf16ToUtf8(nullptr, 0, nullptr, 0, &written));
+    CHECK(written == 0);
+
+    // Boundaries of each sequence length
+    for (uint32_t c : { 0x0u, 0x7Fu, 0x80u, 0x7FFu, 0x800u, 0xD7FFu, 0xE000u, 0xFFFDu, 0xFFFFu, 0x10000u, 0x10FFFFu })
+    {
+        std::string s;
+        AppendCodePointUtf8(c, s);
+        EXPECT_UTF16(s);
+        Utf16String w;
+        AppendCodePointUtf16(c, w);
+        EXPECT_UTF8(w);
+    }
+}
+
+static void TestInvalidUtf8()
+{
+    // Lead bytes that never start a sequence
+    for (unsigned b = 0x80; b <= 0xFF; ++b)
+    {
+        if (b >= 0xC2 && b <= 0xF4)
+        {
+            continue;
+        }
+        std::string const s = std::string("ok") + static_cast<char>(b) + "\xC2\xA9";
+        CHECK(FAILED(ReferenceUtf8ToUtf16(s).hr));
+        EXPECT_UTF16(s);
+    }
+
+    // Every second byte after every lead byte, followed by enough valid
+    // continuation bytes: covers overlong forms, encoded surrogates, code
+    // points above U+10FFFF and missing continuation bytes.
+    for (unsigned lead = 0xC2; lead <= 0xF4; ++lead)
+    {
+        for (unsigned second = 0; second <= 0xFF; ++second)
+        {
+            std::string s = "x";
+            s += static_cast<char>(lead);
+            s += static_cast<char>(second);
+            s += "\x80\x80";
+            EXPECT_UTF16(s);
+        }
+    }
+
+    // Truncated sequences at the end of the input
+    for (const char* s : { "\xC3", "\xE2\x82", "\xF0\x9F\x98", "abc\xF0\x9F", "\xE2" })
+    {
+        CHECK(FAILED(ReferenceUtf8ToUtf16(s).hr));
+        EXPECT_UTF16(std::string(s));
+    }
+
+    // Explicit cases, so a bug shared with the reference still shows up
+    size_t written;
+    WCHAR dst[8];
+    CHECK_HR(UTF_INVALID, Utf8ToUtf16("\xC0\xAF", 2, dst, 8, &written));
+    CHECK_HR(UTF_INVALID, Utf8ToUtf16("\xE0\x80\xAF", 3, dst, 8, &written));
+    CHECK_HR(UTF_INVALID, Utf8ToUtf16("\xED\xA0\x80", 3, dst, 8, &written));
+    CHECK_HR(UTF_INVALID, Utf8ToUtf16("\xF4\x90\x80\x80", 4, dst, 8, &written));
+    CHECK_HR(UTF_INVALID, Utf8ToUtf16("ab\xF5\x80\x80\x80", 6, dst, 8, &written));
+    CHECK(written == 2);
+}
+
+static void TestInvalidUtf16()
+{
+    CHECK(FAILED(ReferenceUtf16ToUtf8(U16({ 0xDC00 })).hr));
+    for (const Utf16String& s : { U16({ 0xD800 }), U16({ 0xDBFF, 0x41 }), U16({ 0x41, 0xDC00, 0xD800 }),
+             U16({ 0xD800, 0xD800, 0xDC00 }), U16({ 0x41, 0x42, 0xDFFF }) })
+    {
+        EXPECT_UTF8(s);
+    }
+
+    size_t written;
+    char dst[16];
+    Utf16String const s = U16({ 0x61, 0x62, 0xDC00 });
+    CHECK_HR(UTF_INVALID, Utf16ToUtf8(s.data(), s.size(), dst, sizeof(dst), &written));
+    CHECK(written == 2);
+}
+
+static void TestAllCodePoints()
+{
+    std::string utf8;
+    Utf16String utf16;
+    for (uint32_t c = 0; c <= 0x10FFFF; ++c)
+    {
+        if (c >= 0xD800 && c <= 0xDFFF)
+        {
+            continue;
+        }
+        AppendCodePointUtf8(c, utf8);
+        AppendCodePointUtf16(c, utf16);
+    }
+
+    Utf16String wide;
+    CHECK_HR(S_OK, AppendUtf16(utf8.data(), utf8.size(), wide));
+    CHECK(wide == utf16);
+    std::string narrow;
+    CHECK_HR(S_OK, AppendUtf8(utf16.data(), utf16.size(), narrow));
+    CHECK(narrow == utf8);
+
+    // Every lone surrogate, between ASCII so the SIMD kernels run into it
+    for (unsigned u = 0xD800; u <= 0xDFFF; ++u)
+    {
+        Utf16String s(40, WCHAR('a'));
+        s[35] = static_cast<WCHAR>(u);
+        EXPECT_UTF8(s);
+    }
+}
+
+static void TestShortBuffers()
+{
+    CheckShortBuffers("a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80z");
+    // ASCII runs longer than a SIMD block with wider characters in between
+    CheckShortBuffers(std::string(37, 'a') + "\xF0\x9F\x98\x80" + std::string(70, 'b') + "\xC3\xA9");
+}
+
+// Mostly ASCII with runs of every length around the block sizes, plus other
+// code points, then randomly damaged.
+static uint32_t RandomCodePoint(std::mt19937& random)
+{
+    switch (random() % 8)
+    {
+    case 0:
+        return 0x80 + random() % (0x800 - 0x80);
+    case 1:
+        return 0x800 + random() % (0xD800 - 0x800);
+    case 2:
+        return 0xE000 + random() % (0x10000 - 0xE000);
+    case 3:
+        return 0x10000 + random() % (0x110000 - 0x10000);
+    default:
+        return random() % 0x80;
+    }
+}
+
+static void TestFuzz(int iterations)
+{
+    std::mt19937 random(20240613);
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        std::string utf8;
+        Utf16String utf16;
+        size_t const pieces = random() % 12;
+        for (size_t p = 0; p < pieces; ++p)
+        {
+            size_t const ascii = random() % 80;
+            for (size_t k = 0; k < ascii; ++k)
+            {
+                uint32_t const c = 0x20 + random() % 0x5F;
+                AppendCodePointUtf8(c, utf8);
+                AppendCodePointUtf16(c, utf16);
+            }
+            size_t const other = random() % 4;
+            for (size_t k = 0; k < other; ++k)
+            {
+                uint32_t const c = RandomCodePoint(random);
+                AppendCodePointUtf8(c, utf8);
+                AppendCodePointUtf16(c, utf16);
+            }
+        }
+
+        EXPECT_UTF16(utf8);
+        EXPECT_UTF8(utf16);
+
+        // Damage a few units: random bytes, truncation or a lone surrogate
+        if (!utf8.empty())
+        {
+            std::string damaged = utf8;
+            size_t const changes = 1 + random() % 3;
+            for (size_t k = 0; k < changes; ++k)
+            {
+                damaged[random() % damaged.size()] = static_cast<char>(random());
+            }
+            EXPECT_UTF16(damaged);
+            EXPECT_UTF16(utf8.substr(0, random() % utf8.size()));
+        }
+        if (!utf16.empty())
+        {
+            Utf16String damaged = utf16;
+            damaged[random() % damaged.size()] = static_cast<WCHAR>(0xD800 + random() % 0x800);
+            EXPECT_UTF8(damaged);
+            EXPECT_UTF8(utf16.substr(0, random() % utf16.size()));
+        }
+
+        // Unaligned starts and ends inside the string
+        if (utf16.size() > 2)
+        {
+            size_t const offset = random() % utf16.size();
+            EXPECT_UTF8(utf16.substr(offset, random() % (utf16.size() - offset)));
+        }
+    }
+}
+
+// Benchmark
+
+static std::string MakeText(const char* kind, size_t bytes)
+{
+    std::mt19937 random(1);
+    std::string text;
+    while (text.size() < bytes)
+    {
+        uint32_t c;
+        if (std::strcmp(kind, "ascii") == 0)
+        {
+            c = 0x20 + random() % 0x5F;
+        }
+        else if (std::strcmp(kind, "latin") == 0)
+        {
+            // Mostly ASCII, like URIs and page titles
+            c = random() % 16 == 0 ? 0xC0 + random() % 0x40 : 0x20 + random() % 0x5F;
+        }
+        else if (std::strcmp(kind, "cjk") == 0)
+        {
+            c = 0x4E00 + random() % 0x5000;
+        }
+        else
+        {
+            c = 0x1F600 + random() % 0x50;
+        }
+        AppendCodePointUtf8(c, text);
+    }
+    return text;
+}
+
+static void RunBenchmark(int iterations)
+{
+    size_t const bytes = 1 << 20;
+    std::printf("{\"benchmark\":\"utf\",\"variant\":\"%s\",\"iterations\":%d,\"results\":[", UTF_TEST_VARIANT, iterations);
+    bool first = true;
+    for (const char* kind : { "ascii", "latin", "cjk", "emoji" })
+    {
+        std::string const utf8 = MakeText(kind, bytes);
+        Utf16String utf16;
+        AppendUtf16(utf8.data(), utf8.size(), utf16);
+
+        Utf16String wide(MaxUtf16Length(utf8.size()), WCHAR());
+        std::string narrow(MaxUtf8Length(utf16.size()), '\0');
+        size_t written = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            Utf8ToUtf16(utf8.data(), utf8.size(), &wide[0], wide.size(), &written);
+        }
+        double const toUtf16 = SecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            Utf16ToUtf8(utf16.data(), utf16.size(), &narrow[0], narrow.size(), &written);
+        }
+        double const toUtf8 = SecondsSince(start);
+
+        double const megabytes = static_cast<double>(utf8.size()) * iterations / (1 << 20);
+        std::printf("%s{\"text\":\"%s\",\"utf8_bytes\":%zu,\"utf8_to_utf16_mb_per_s\":%.1f,\"utf16_to_utf8_mb_per_s\":%.1f}",
+            first ? "" : ",", kind, utf8.size(), megabytes / toUtf16, megabytes / toUtf8);
+        first = false;
+    }
+    std::printf("]}\n");
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions const bench = ParseBenchOptions(argc, argv, 200);
+    if (bench.enabled)
+    {
+        RunBenchmark(bench.iterations);
+        return EXIT_SUCCESS;
+    }
+
+    TestKnownVectors();
+    TestInvalidUtf8();
+    TestInvalidUtf16();
+    TestAllCodePoints();
+    TestShortBuffers();
+    TestFuzz(20000);
+    return CheckResult();
+}
@@ -0,0 +1,244 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests WindowRegistry, which window shows which tab: windows closing down
+// to the last one, tabs moving between windows and keeping their ids, and
+// the tab ids of restored sessions never given to a new window. Then
+// SharedEnvironment, the environment the windows share: windows asking while
+// it is being created all wait for the one creation, and a failure is
+// passed to every one of them and tried again by the next window.
+
+#include "Check.h"
+#include "SharedEnvironment.h"
+#include "WindowRegistry.h"
+
+typedef std::vector<size_t> Tabs;
+
+// Closing windows hands back their tabs, once the last one is closed there
+// is no active window, and no id comes back
+static void TestLastWindowClosing()
+{
+    WindowRegistry registry;
+    size_t const first = registry.AddWindow();
+    size_t const second = registry.AddWindow();
+    CHECK(first != second);
+    CHECK(registry.GetActiveWindow() == second);
+    size_t const a = registry.GetTabIdBase(first) + 1;
+    size_t const b = registry.GetTabIdBase(first) + 2;
+    size_t const c = registry.GetTabIdBase(second) + 1;
+    registry.AddTab(first, b);
+    registry.AddTab(first, a);
+    registry.AddTab(second, c);
+
+    registry.Activate(first);
+    CHECK(registry.RemoveWindow(first) == Tabs({ b, a }));
+    CHECK(registry.GetWindowCount() == 1);
+    CHECK(registry.GetActiveWindow() == second);
+    CHECK(registry.GetWindow(a) == WindowRegistry::c_noWindow);
+    CHECK(registry.GetTabs(first).empty());
+    CHECK(registry.RemoveWindow(first).empty());
+
+    CHECK(registry.RemoveWindow(second) == Tabs({ c }));
+    CHECK(registry.GetWindowCount() == 0);
+    CHECK(registry.GetActiveWindow() == WindowRegistry::c_noWindow);
+    CHECK(registry.GetWindow(c) == WindowRegistry::c_noWindow);
+
+    // A window opened afterwards gets ids of its own
+    size_t const third = registry.AddWindow();
+    CHECK(third != first && third != second);
+    CHECK(registry.GetTabIdBase(third) > registry.GetTabIdBase(second));
+    CHECK(registry.GetActiveWindow() == third);
+    CHECK(registry.GetTabs(third).empty());
+}
+
+// A moved tab keeps its id and goes to the end of the other window's tabs
+static void TestMoveTab()
+{
+    WindowRegistry registry;
+    size_t const left = registry.AddWindow();
+    size_t const right = registry.AddWindow();
+    size_t const base = registry.GetTabIdBase(left);
+    for (size_t tabId = base + 1; tabId <= base + 3; ++tabId)
+    {
+        registry.AddTab(left, tabId);
+    }
+    registry.AddTab(right, registry.GetTabIdBase(right) + 1);
+
+    CHECK(registry.MoveTab(base + 2, right));
+    CHECK(registry.GetWindow(base + 2) == right);
+    CHECK(registry.GetTabs(left) == Tabs({ base + 1, base + 3 }));
+    CHECK(registry.GetTabs(right) == Tabs({ registry.GetTabIdBase(right) + 1, base + 2 }));
+
+    // Unknown tabs and windows are refused and nothing changes
+    CHECK(!registry.MoveTab(base + 2, right + 1));
+    CHECK(!registry.MoveTab(base + 4, right));
+    CHECK(registry.GetWindow(base + 2) == right);
+
+    // Adding it again moves it back, moving it where it is keeps it once
+    registry.AddTab(left, base + 2);
+    CHECK(registry.GetTabs(left) == Tabs({ base + 1, base + 3, base + 2 }));
+    CHECK(registry.GetTabs(right) == Tabs({ registry.GetTabIdBase(right) + 1 }));
+    CHECK(registry.MoveTab(base + 2, left));
+    CHECK(registry.GetTabs(left) == Tabs({ base + 1, base + 3, base + 2 }));
+
+    // The window it came from closes, the moved tab stays with the other
+    CHECK(registry.MoveTab(base + 1, right));
+    CHECK(registry.RemoveWindow(left) == Tabs({ base + 3, base + 2 }));
+    CHECK(registry.GetWindow(base + 1) == right);
+    registry.RemoveTab(base + 1);
+    CHECK(registry.GetWindow(base + 1) == WindowRegistry::c_noWindow);
+    CHECK(registry.GetTabs(right) == Tabs({ registry.GetTabIdBase(right) + 1 }));
+    registry.RemoveTab(base + 1);
+}
+
+// The restored tabs keep their ids, a new window gets a block above them
+static void TestReservedTabIds()
+{
+    WindowRegistry registry;
+    size_t const restored = 3 * WindowRegistry::c_tabIdBlock + 17;
+    registry.ReserveTabIds(restored);
+    size_t const window = registry.AddWindow();
+    CHECK(registry.GetTabIdBase(window) > restored);
+    registry.AddTab(window, restored);
+    CHECK(registry.GetWindow(restored) == window);
+
+    // Reserving less changes nothing
+    registry.ReserveTabIds(1);
+    CHECK(registry.AddWindow() == window + 1);
+}
+
+// Environments are numbered, the creations complete when the test says so
+class Factory
+{
+public:
+    typedef SharedEnvironment<int> Shared;
+
+    size_t GetCreations() const { return m_creations; }
+
+    Shared::Factory Create(HRESULT result = S_OK)
+    {
+        return [this, result](Shared::Completion completed) -> HRESULT
+        {
+            ++m_creations;
+            if (SUCCEEDED(result))
+            {
+                m_pending.push_back(std::move(completed));
+            }
+            return result;
+        };
+    }
+
+    void Complete(HRESULT result)
+    {
+        Shared::Completion completed = std::move(m_pending.front());
+        m_pending.erase(m_pending.begin());
+        completed(result, SUCCEEDED(result) ? static_cast<int>(m_creations) : 0);
+    }
+
+private:
+    size_t m_creations = 0;
+    std::vector<Shared::Completion> m_pending;
+};
+
+struct Waiter
+{
+    HRESULT result = E_PENDING;
+    int env = -1;
+    size_t order = 0;
+};
+
+// Windows opened while the environment is created wait for that creation,
+// and are called back in the order they asked
+static void TestEnvironmentFanOut()
+{
+    Factory factory;
+    Factory::Shared shared;
+    std::vector<Waiter> waiters(4);
+    size_t calls = 0;
+    auto wait = [&](size_t window)
+    {
+        return [&, window](HRESULT result, const int& env)
+        {
+            waiters[window].result = result;
+            waiters[window].env = env;
+            waiters[window].order = ++calls;
+        };
+    };
+
+    for (size_t window = 0; window < 3; ++window)
+    {
+        CHECK_HR(S_OK, shared.Get(factory.Create(), wait(window)));
+    }
+    CHECK(factory.GetCreations() == 1);
+    CHECK(shared.GetWaitingCount() == 3);
+    CHECK(calls == 0 && !shared.IsCreated());
+
+    factory.Complete(S_OK);
+    CHECK(shared.IsCreated());
+    CHECK(shared.GetWaitingCount() == 0);
+    for (size_t window = 0; window < 3; ++window)
+    {
+        CHECK(waiters[window].result == S_OK);
+        CHECK(waiters[window].env == 1);
+        CHECK(waiters[window].order == window + 1);
+    }
+
+    // A window opened later gets it right away
+    CHECK_HR(S_OK, shared.Get(factory.Create(), wait(3)));
+    CHECK(factory.GetCreations() == 1);
+    CHECK(waiters[3].result == S_OK && waiters[3].env == 1);
+}
+
+// A failed creation fails every window waiting for it, the next window which
+// asks starts another one. A creation which can't start only fails its
+// caller.
+static void TestEnvironmentFailure()
+{
+    Factory factory;
+    Factory::Shared shared;
+    std::vector<HRESULT> results;
+    auto wait = [&results](HRESULT result, const int&) { results.push_back(result); };
+
+    CHECK_HR(S_OK, shared.Get(factory.Create(), wait));
+    CHECK_HR(S_OK, shared.Get(factory.Create(), wait));
+    factory.Complete(E_ACCESSDENIED);
+    CHECK(results == std::vector<HRESULT>({ E_ACCESSDENIED, E_ACCESSDENIED }));
+    CHECK(!shared.IsCreated());
+
+    results.clear();
+    CHECK_HR(E_OUTOFMEMORY, shared.Get(factory.Create(E_OUTOFMEMORY), wait));
+    CHECK(factory.GetCreations() == 2);
+    CHECK(results.empty());
+    CHECK(shared.GetWaitingCount() == 0);
+
+    // A window whose creation failed asks again from its callback
+    bool retried = false;
+    CHECK_HR(S_OK, shared.Get(factory.Create(), [&](HRESULT result, const int&)
+    {
+        results.push_back(result);
+        if (FAILED(result))
+        {
+            retried = true;
+            CHECK_HR(S_OK, shared.Get(factory.Create(), wait));
+        }
+    }));
+    CHECK_HR(S_OK, shared.Get(factory.Create(), wait));
+    factory.Complete(E_FAIL);
+    CHECK(retried);
+    CHECK(factory.GetCreations() == 4);
+    CHECK(results == std::vector<HRESULT>({ E_FAIL, E_FAIL }));
+    factory.Complete(S_OK);
+    CHECK(results == std::vector<HRESULT>({ E_FAIL, E_FAIL, S_OK }));
+    CHECK(shared.IsCreated());
+}
+
+int main()
+{
+    TestLastWindowClosing();
+    TestMoveTab();
+    TestReservedTabIds();
+    TestEnvironmentFanOut();
+    TestEnvironmentFailure();
+    return CheckResult();
+}
@@ -0,0 +1,510 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// Stand-in for framework.h when building the platform independent sources on
+// Linux. Provides the Windows types, error codes, Win32 calls and WIL helpers
+// they use, and nothing else. wrl.h and webview2.h next to it declare the
+// subset of WRL and WebView2 they use. Message and window message ids are
+// extracted from the real framework.h into framework_ids.h by CMake.
+
+// C RunTime Header Files
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <memory>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// Types
+
+// wchar_t is 32 bit on Linux. Code that cares about UTF-16 (the transcoder)
+// is built with char16_t instead, the rest keeps wchar_t for L"" literals.
+#ifdef PORTABLE_CHAR16_WCHAR
+typedef char16_t WCHAR;
+#else
+typedef wchar_t WCHAR;
+#endif
+typedef WCHAR* LPWSTR;
+typedef const WCHAR* LPCWSTR;
+typedef const WCHAR* PCWSTR;
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned int UINT;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef uintptr_t UINT_PTR;
+typedef int32_t HRESULT;
+
+typedef struct PortableWindow* HWND;
+
+struct RECT
+{
+    LONG left;
+    LONG top;
+    LONG right;
+    LONG bottom;
+};
+
+#define TRUE 1
+#define FALSE 0
+
+// Error codes
+
+#define ERROR_FILE_NOT_FOUND 2L
+#define ERROR_INVALID_DATA 13L
+#define ERROR_HANDLE_EOF 38L
+#define ERROR_BROKEN_PIPE 109L
+#define ERROR_BUFFER_OVERFLOW 111L
+#define ERROR_INSUFFICIENT_BUFFER 122L
+#define ERROR_NO_UNICODE_TRANSLATION 1113L
+#define ERROR_TIMEOUT 1460L
+
+#define S_OK ((HRESULT)0L)
+#define S_FALSE ((HRESULT)1L)
+#define E_NOTIMPL ((HRESULT)0x80004001L)
+#define E_NOINTERFACE ((HRESULT)0x80004002L)
+#define E_POINTER ((HRESULT)0x80004003L)
+#define E_ABORT ((HRESULT)0x80004004L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_PENDING ((HRESULT)0x8000000AL)
+#define E_UNEXPECTED ((HRESULT)0x8000FFFFL)
+#define E_ACCESSDENIED ((HRESULT)0x80070005L)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define E_INVALIDARG ((HRESULT)0x80070057L)
+#define E_NOT_VALID_STATE ((HRESULT)0x8007139FL)
+#define STRSAFE_E_INSUFFICIENT_BUFFER ((HRESULT)0x8007007AL)
+
+#define HRESULT_FROM_WIN32(x) \
+    ((HRESULT)(x) <= 0 ? (HRESULT)(x) : (HRESULT)(((x) & 0x0000FFFF) | 0x80070000))
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+// Files, on top of POSIX. A file handle is its descriptor plus one, so that
+// null stays invalid for mappings.
+
+typedef void* HANDLE;
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+
+union LARGE_INTEGER
+{
+    LONGLONG QuadPart;
+};
+
+#define GENERIC_READ 0x80000000u
+#define GENERIC_WRITE 0x40000000u
+#define FILE_SHARE_READ 0x1
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+#define OPEN_ALWAYS 4
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define FILE_BEGIN SEEK_SET
+#define FILE_CURRENT SEEK_CUR
+#define FILE_END SEEK_END
+#define MOVEFILE_REPLACE_EXISTING 0x1
+#define PAGE_READONLY 0x02
+#define FILE_MAP_READ 0x0004
+
+#define ERROR_ACCESS_DENIED 5L
+#define ERROR_GEN_FAILURE 31L
+
+inline DWORD GetLastError()
+{
+    switch (errno)
+    {
+    case ENOENT:
+        return ERROR_FILE_NOT_FOUND;
+    case EACCES:
+        return ERROR_ACCESS_DENIED;
+    default:
+        return ERROR_GEN_FAILURE;
+    }
+}
+
+inline std::string PortablePath(const wchar_t* path)
+{
+    std::string narrow;
+    for (; *path; ++path)
+    {
+        narrow += static_cast<char>(*path);
+    }
+    return narrow;
+}
+
+inline int PortableDescriptor(HANDLE handle)
+{
+    return static_cast<int>(reinterpret_cast<intptr_t>(handle)) - 1;
+}
+
+inline HANDLE CreateFileW(const wchar_t* path, DWORD access, DWORD, void*, DWORD disposition, DWORD, HANDLE)
+{
+    int flags = (access & GENERIC_READ) ? ((access & GENERIC_WRITE) ? O_RDWR : O_RDONLY) : O_WRONLY;
+    if (disposition == OPEN_ALWAYS)
+    {
+        flags |= O_CREAT;
+    }
+    else if (disposition == CREATE_ALWAYS)
+    {
+        flags |= O_CREAT | O_TRUNC;
+    }
+    int const fd = open(PortablePath(path).c_str(), flags | O_CLOEXEC, 0644);
+    return fd < 0 ? INVALID_HANDLE_VALUE : reinterpret_cast<HANDLE>(static_cast<intptr_t>(fd) + 1);
+}
+
+inline BOOL CloseHandle(HANDLE handle)
+{
+    return close(PortableDescriptor(handle)) == 0;
+}
+
+inline BOOL GetFileSizeEx(HANDLE file, LARGE_INTEGER* size)
+{
+    struct stat status;
+    if (fstat(PortableDescriptor(file), &status) != 0)
+    {
+        return FALSE;
+    }
+    size->QuadPart = status.st_size;
+    return TRUE;
+}
+
+inline BOOL ReadFile(HANDLE file, void* buffer, DWORD size, DWORD* read, void*)
+{
+    ssize_t const result = ::read(PortableDescriptor(file), buffer, size);
+    if (result < 0)
+    {
+        return FALSE;
+    }
+    *read = static_cast<DWORD>(result);
+    return TRUE;
+}
+
+inline BOOL WriteFile(HANDLE file, const void* buffer, DWORD size, DWORD* written, void*)
+{
+    ssize_t const result = ::write(PortableDescriptor(file), buffer, size);
+    if (result < 0)
+    {
+        return FALSE;
+    }
+    *written = static_cast<DWORD>(result);
+    return TRUE;
+}
+
+inline BOOL SetFilePointerEx(HANDLE file, LARGE_INTEGER distance, LARGE_INTEGER* position, DWORD method)
+{
+    off_t const result = lseek(PortableDescriptor(file), distance.QuadPart, static_cast<int>(method));
+    if (result < 0)
+    {
+        return FALSE;
+    }
+    if (position)
+    {
+        position->QuadPart = result;
+    }
+    return TRUE;
+}
+
+inline BOOL SetEndOfFile(HANDLE file)
+{
+    int const fd = PortableDescriptor(file);
+    off_t const position = lseek(fd, 0, SEEK_CUR);
+    return position >= 0 && ftruncate(fd, position) == 0;
+}
+
+inline BOOL FlushFileBuffers(HANDLE file)
+{
+    return fsync(PortableDescriptor(file)) == 0;
+}
+
+inline BOOL MoveFileExW(const wchar_t* from, const wchar_t* to, DWORD)
+{
+    return rename(PortablePath(from).c_str(), PortablePath(to).c_str()) == 0;
+}
+
+inline BOOL DeleteFileW(const wchar_t* path)
+{
+    return unlink(PortablePath(path).c_str()) == 0;
+}
+
+// A mapping is a duplicate of the file's descriptor, views remember their
+// size for munmap
+inline HANDLE CreateFileMappingW(HANDLE file, void*, DWORD, DWORD, DWORD, const wchar_t*)
+{
+    int const fd = dup(PortableDescriptor(file));
+    return fd < 0 ? nullptr : reinterpret_cast<HANDLE>(static_cast<intptr_t>(fd) + 1);
+}
+
+inline std::map<const void*, size_t>& PortableViews(std::mutex*& lock)
+{
+    static std::mutex viewsLock;
+    static std::map<const void*, size_t> views;
+    lock = &viewsLock;
+    return views;
+}
+
+inline void* MapViewOfFile(HANDLE mapping, DWORD, DWORD, DWORD, size_t)
+{
+    int const fd = PortableDescriptor(mapping);
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0)
+    {
+        return nullptr;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    std::mutex* lock;
+    std::map<const void*, size_t>& views = PortableViews(lock);
+    std::lock_guard<std::mutex> guard(*lock);
+    views[view] = static_cast<size_t>(status.st_size);
+    return view;
+}
+
+inline BOOL UnmapViewOfFile(const void* view)
+{
+    std::mutex* lock;
+    std::map<const void*, size_t>& views = PortableViews(lock);
+    std::lock_guard<std::mutex> guard(*lock);
+    auto it = views.find(view);
+    if (it == views.end())
+    {
+        return FALSE;
+    }
+    munmap(const_cast<void*>(it->first), it->second);
+    views.erase(it);
+    return TRUE;
+}
+
+// Time and threads
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER* counter)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    counter->QuadPart = static_cast<LONGLONG>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    return TRUE;
+}
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency)
+{
+    frequency->QuadPart = 1000000000;
+    return TRUE;
+}
+
+inline ULONGLONG GetTickCount64()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return static_cast<ULONGLONG>(counter.QuadPart / 1000000);
+}
+
+inline DWORD GetCurrentThreadId()
+{
+    return static_cast<DWORD>(syscall(SYS_gettid));
+}
+
+inline DWORD GetCurrentProcessId()
+{
+    return static_cast<DWORD>(getpid());
+}
+
+// Strings. The Windows wide printf functions take %s for a wide string, glibc
+// wants %ls.
+
+inline HRESULT StringCchPrintfA(char* buffer, size_t size, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int const length = vsnprintf(buffer, size, format, args);
+    va_end(args);
+    return length >= 0 && static_cast<size_t>(length) < size ? S_OK : STRSAFE_E_INSUFFICIENT_BUFFER;
+}
+
+inline HRESULT StringCchPrintfW(wchar_t* buffer, size_t size, const wchar_t* format, ...)
+{
+    std::wstring portableFormat;
+    for (const wchar_t* c = format; *c; ++c)
+    {
+        portableFormat.push_back(*c);
+        if (*c == L'%' && c[1] == L'%')
+        {
+            portableFormat.push_back(*++c);
+        }
+        else if (*c == L'%')
+        {
+            while (c[1] && wcschr(L"-+ #0123456789.", c[1]))
+            {
+                portableFormat.push_back(*++c);
+            }
+            if (c[1] == L's')
+            {
+                portableFormat.push_back(L'l');
+            }
+        }
+    }
+
+    va_list args;
+    va_start(args, format);
+    int const length = vswprintf(buffer, size, portableFormat.c_str(), args);
+    va_end(args);
+    return length >= 0 ? S_OK : STRSAFE_E_INSUFFICIENT_BUFFER;
+}
+
+#define IS_HIGH_SURROGATE(c) ((c) >= 0xD800 && (c) <= 0xDBFF)
+#define IS_LOW_SURROGATE(c) ((c) >= 0xDC00 && (c) <= 0xDFFF)
+
+inline int _wcsnicmp(const wchar_t* left, const wchar_t* right, size_t count)
+{
+    return wcsncasecmp(left, right, count);
+}
+
+// Bitmaps
+
+#define BI_RGB 0L
+
+// Debugger output goes to stderr, as ASCII
+inline void OutputDebugString(const wchar_t* text)
+{
+    std::string narrow;
+    for (; *text; ++text)
+    {
+        narrow += *text < 0x80 ? static_cast<char>(*text) : '?';
+    }
+    std::fputs(narrow.c_str(), stderr);
+}
+
+// COM. Objects are only ever used through the interface they were created
+// for, QueryInterface is left out.
+
+struct IUnknown
+{
+    virtual ULONG AddRef() = 0;
+    virtual ULONG Release() = 0;
+};
+
+inline void* CoTaskMemAlloc(size_t size)
+{
+    return std::malloc(size);
+}
+
+inline void CoTaskMemFree(void* memory)
+{
+    std::free(memory);
+}
+
+// WIL
+
+#define RETURN_IF_FAILED(expr) \
+    do { HRESULT const __hr = (expr); if (FAILED(__hr)) { return __hr; } } while (0)
+#define RETURN_HR_IF(hr, condition) \
+    do { if (condition) { return (hr); } } while (0)
+#define RETURN_LAST_ERROR() \
+    return HRESULT_FROM_WIN32(GetLastError())
+#define RETURN_IF_WIN32_BOOL_FALSE(expr) \
+    do { if (!(expr)) { RETURN_LAST_ERROR(); } } while (0)
+
+namespace wil
+{
+    struct portable_handle_traits
+    {
+        static HANDLE invalid() { return nullptr; }
+    };
+    struct portable_file_traits
+    {
+        static HANDLE invalid() { return INVALID_HANDLE_VALUE; }
+    };
+
+    template<typename Traits>
+    class portable_unique_handle
+    {
+    public:
+        portable_unique_handle() = default;
+        explicit portable_unique_handle(HANDLE handle) : m_handle(handle) {}
+        ~portable_unique_handle() { reset(); }
+        portable_unique_handle(const portable_unique_handle&) = delete;
+        portable_unique_handle& operator=(const portable_unique_handle&) = delete;
+
+        void reset(HANDLE handle = Traits::invalid())
+        {
+            if (m_handle != Traits::invalid())
+            {
+                CloseHandle(m_handle);
+            }
+            m_handle = handle;
+        }
+        HANDLE get() const { return m_handle; }
+        explicit operator bool() const { return m_handle != Traits::invalid(); }
+
+    private:
+        HANDLE m_handle = Traits::invalid();
+    };
+
+    typedef portable_unique_handle<portable_handle_traits> unique_handle;
+    typedef portable_unique_handle<portable_file_traits> unique_hfile;
+
+    struct portable_unmap_view
+    {
+        void operator()(void* view) const { UnmapViewOfFile(view); }
+    };
+    template<typename T>
+    using unique_mapview_ptr = std::unique_ptr<T, portable_unmap_view>;
+
+    // Strings returned by WebView2 getters
+    class unique_cotaskmem_string
+    {
+    public:
+        unique_cotaskmem_string() = default;
+        ~unique_cotaskmem_string() { CoTaskMemFree(m_string); }
+        unique_cotaskmem_string(const unique_cotaskmem_string&) = delete;
+        unique_cotaskmem_string& operator=(const unique_cotaskmem_string&) = delete;
+
+        WCHAR* get() const { return m_string; }
+        WCHAR** operator&()
+        {
+            CoTaskMemFree(m_string);
+            m_string = nullptr;
+            return &m_string;
+        }
+
+    private:
+        WCHAR* m_string = nullptr;
+    };
+}
+
+#define _countof(a) (sizeof(a) / sizeof((a)[0]))
+
+// App specific includes
+#include "wrl.h"
+#include "webview2.h"
+#include "framework_ids.h"
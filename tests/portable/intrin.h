@@ -0,0 +1,46 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// The MSVC CPUID intrinsics on top of GCC's <cpuid.h>. Defining
+// PORTABLE_HIDE_AVX2 reports a CPU without AVX2 to test the SSE2 fallbacks.
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+// Newer GCCs declare __cpuidex and _xgetbv with other signatures, the MSVC
+// ones are macros for functions of our own.
+inline void PortableCpuidex(int info[4], int leaf, int subleaf)
+{
+    unsigned int a, b, c, d;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+#ifdef PORTABLE_HIDE_AVX2
+    if (leaf == 7)
+    {
+        b &= ~(1u << 5);
+    }
+#endif
+    info[0] = static_cast<int>(a);
+    info[1] = static_cast<int>(b);
+    info[2] = static_cast<int>(c);
+    info[3] = static_cast<int>(d);
+}
+
+inline void PortableCpuid(int info[4], int leaf)
+{
+    PortableCpuidex(info, leaf, 0);
+}
+
+inline unsigned long long PortableXgetbv(unsigned int index)
+{
+    unsigned int low, high;
+    __asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(index));
+    return (static_cast<unsigned long long>(high) << 32) | low;
+}
+
+#undef __cpuid
+#define __cpuid PortableCpuid
+#define __cpuidex PortableCpuidex
+#define _xgetbv PortableXgetbv
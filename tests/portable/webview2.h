@@ -0,0 +1,138 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// The subset of the WebView2 SDK the browser's tabs and message brokers use:
+// creating controllers, navigating, the navigation and message events, and
+// posting messages. The methods keep the signatures of the SDK, so code built
+// against them builds against the real webview2.h unchanged. Anything which
+// isn't declared here, like settings, DevTools or resource requests, is
+// Windows only. tests/FakeWebView2.h implements the interfaces.
+
+struct EventRegistrationToken
+{
+    LONGLONG value;
+};
+
+typedef enum COREWEBVIEW2_WEB_ERROR_STATUS
+{
+    COREWEBVIEW2_WEB_ERROR_STATUS_UNKNOWN = 0,
+    COREWEBVIEW2_WEB_ERROR_STATUS_SERVER_UNREACHABLE = 6,
+    COREWEBVIEW2_WEB_ERROR_STATUS_TIMEOUT = 7,
+    COREWEBVIEW2_WEB_ERROR_STATUS_CONNECTION_ABORTED = 9,
+    COREWEBVIEW2_WEB_ERROR_STATUS_HOST_NAME_NOT_RESOLVED = 13,
+    COREWEBVIEW2_WEB_ERROR_STATUS_OPERATION_CANCELED = 14,
+} COREWEBVIEW2_WEB_ERROR_STATUS;
+
+struct ICoreWebView2;
+struct ICoreWebView2Controller;
+
+// Event args
+
+struct ICoreWebView2NavigationStartingEventArgs : public IUnknown
+{
+    virtual HRESULT get_Uri(LPWSTR* uri) = 0;
+    virtual HRESULT get_IsUserInitiated(BOOL* isUserInitiated) = 0;
+    virtual HRESULT get_IsRedirected(BOOL* isRedirected) = 0;
+    virtual HRESULT get_Cancel(BOOL* cancel) = 0;
+    virtual HRESULT put_Cancel(BOOL cancel) = 0;
+    virtual HRESULT get_NavigationId(UINT64* navigationId) = 0;
+};
+
+struct ICoreWebView2SourceChangedEventArgs : public IUnknown
+{
+    virtual HRESULT get_IsNewDocument(BOOL* isNewDocument) = 0;
+};
+
+struct ICoreWebView2NavigationCompletedEventArgs : public IUnknown
+{
+    virtual HRESULT get_IsSuccess(BOOL* isSuccess) = 0;
+    virtual HRESULT get_WebErrorStatus(COREWEBVIEW2_WEB_ERROR_STATUS* webErrorStatus) = 0;
+    virtual HRESULT get_NavigationId(UINT64* navigationId) = 0;
+};
+
+struct ICoreWebView2WebMessageReceivedEventArgs : public IUnknown
+{
+    virtual HRESULT get_Source(LPWSTR* source) = 0;
+    virtual HRESULT get_WebMessageAsJson(LPWSTR* webMessageAsJson) = 0;
+    virtual HRESULT TryGetWebMessageAsString(LPWSTR* webMessageAsString) = 0;
+};
+
+// Handlers
+
+struct ICoreWebView2NavigationStartingEventHandler : public IUnknown
+{
+    virtual HRESULT Invoke(ICoreWebView2* sender, ICoreWebView2NavigationStartingEventArgs* args) = 0;
+};
+
+struct ICoreWebView2SourceChangedEventHandler : public IUnknown
+{
+    virtual HRESULT Invoke(ICoreWebView2* sender, ICoreWebView2SourceChangedEventArgs* args) = 0;
+};
+
+struct ICoreWebView2HistoryChangedEventHandler : public IUnknown
+{
+    virtual HRESULT Invoke(ICoreWebView2* sender, IUnknown* args) = 0;
+};
+
+struct ICoreWebView2NavigationCompletedEventHandler : public IUnknown
+{
+    virtual HRESULT Invoke(ICoreWebView2* sender, ICoreWebView2NavigationCompletedEventArgs* args) = 0;
+};
+
+struct ICoreWebView2WebMessageReceivedEventHandler : public IUnknown
+{
+    virtual HRESULT Invoke(ICoreWebView2* sender, ICoreWebView2WebMessageReceivedEventArgs* args) = 0;
+};
+
+struct ICoreWebView2CreateCoreWebView2ControllerCompletedHandler : public IUnknown
+{
+    virtual HRESULT Invoke(HRESULT errorCode, ICoreWebView2Controller* result) = 0;
+};
+
+// WebView, controller and environment
+
+struct ICoreWebView2 : public IUnknown
+{
+    virtual HRESULT Navigate(LPCWSTR uri) = 0;
+    virtual HRESULT get_Source(LPWSTR* uri) = 0;
+    virtual HRESULT Reload() = 0;
+    virtual HRESULT Stop() = 0;
+    virtual HRESULT GoBack() = 0;
+    virtual HRESULT GoForward() = 0;
+    virtual HRESULT get_CanGoBack(BOOL* canGoBack) = 0;
+    virtual HRESULT get_CanGoForward(BOOL* canGoForward) = 0;
+    virtual HRESULT get_DocumentTitle(LPWSTR* title) = 0;
+    virtual HRESULT PostWebMessageAsJson(LPCWSTR webMessageAsJson) = 0;
+    virtual HRESULT PostWebMessageAsString(LPCWSTR webMessageAsString) = 0;
+
+    virtual HRESULT add_NavigationStarting(ICoreWebView2NavigationStartingEventHandler* eventHandler, EventRegistrationToken* token) = 0;
+    virtual HRESULT remove_NavigationStarting(EventRegistrationToken token) = 0;
+    virtual HRESULT add_SourceChanged(ICoreWebView2SourceChangedEventHandler* eventHandler, EventRegistrationToken* token) = 0;
+    virtual HRESULT remove_SourceChanged(EventRegistrationToken token) = 0;
+    virtual HRESULT add_HistoryChanged(ICoreWebView2HistoryChangedEventHandler* eventHandler, EventRegistrationToken* token) = 0;
+    virtual HRESULT remove_HistoryChanged(EventRegistrationToken token) = 0;
+    virtual HRESULT add_NavigationCompleted(ICoreWebView2NavigationCompletedEventHandler* eventHandler, EventRegistrationToken* token) = 0;
+    virtual HRESULT remove_NavigationCompleted(EventRegistrationToken token) = 0;
+    virtual HRESULT add_WebMessageReceived(ICoreWebView2WebMessageReceivedEventHandler* handler, EventRegistrationToken* token) = 0;
+    virtual HRESULT remove_WebMessageReceived(EventRegistrationToken token) = 0;
+};
+
+struct ICoreWebView2Controller : public IUnknown
+{
+    virtual HRESULT get_IsVisible(BOOL* isVisible) = 0;
+    virtual HRESULT put_IsVisible(BOOL isVisible) = 0;
+    virtual HRESULT get_Bounds(RECT* bounds) = 0;
+    virtual HRESULT put_Bounds(RECT bounds) = 0;
+    virtual HRESULT get_ParentWindow(HWND* parentWindow) = 0;
+    virtual HRESULT put_ParentWindow(HWND parentWindow) = 0;
+    virtual HRESULT Close() = 0;
+    virtual HRESULT get_CoreWebView2(ICoreWebView2** coreWebView2) = 0;
+};
+
+struct ICoreWebView2Environment : public IUnknown
+{
+    virtual HRESULT CreateCoreWebView2Controller(HWND parentWindow, ICoreWebView2CreateCoreWebView2ControllerCompletedHandler* handler) = 0;
+};
@@ -0,0 +1,136 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// The part of WRL the browser uses: ComPtr, Callback and Make, with
+// RuntimeClass for the objects they create.
+
+namespace Microsoft
+{
+namespace WRL
+{
+    template<typename T>
+    class ComPtr
+    {
+    public:
+        ComPtr() = default;
+        ComPtr(std::nullptr_t) {}
+        ComPtr(T* pointer) : m_pointer(pointer) { InternalAddRef(); }
+        ComPtr(const ComPtr& other) : ComPtr(other.m_pointer) {}
+        template<typename U> ComPtr(const ComPtr<U>& other) : ComPtr(other.Get()) {}
+        ComPtr(ComPtr&& other) : m_pointer(other.m_pointer) { other.m_pointer = nullptr; }
+        ~ComPtr() { InternalRelease(); }
+
+        ComPtr& operator=(ComPtr other)
+        {
+            std::swap(m_pointer, other.m_pointer);
+            return *this;
+        }
+
+        T* Get() const { return m_pointer; }
+        T* operator->() const { return m_pointer; }
+        explicit operator bool() const { return m_pointer != nullptr; }
+
+        // For out parameters, whatever was held is released first
+        T** operator&()
+        {
+            InternalRelease();
+            return &m_pointer;
+        }
+        T* const* GetAddressOf() const { return &m_pointer; }
+        T** GetAddressOf() { return &m_pointer; }
+
+        void Reset() { InternalRelease(); }
+        T* Detach()
+        {
+            T* pointer = m_pointer;
+            m_pointer = nullptr;
+            return pointer;
+        }
+
+    private:
+        T* m_pointer = nullptr;
+
+        void InternalAddRef()
+        {
+            if (m_pointer)
+            {
+                m_pointer->AddRef();
+            }
+        }
+        void InternalRelease()
+        {
+            T* pointer = m_pointer;
+            m_pointer = nullptr;
+            if (pointer)
+            {
+                pointer->Release();
+            }
+        }
+    };
+
+    // Implements AddRef and Release for every interface it derives from
+    template<typename... Interfaces>
+    class RuntimeClass : public Interfaces...
+    {
+    public:
+        RuntimeClass() = default;
+        RuntimeClass(const RuntimeClass&) = delete;
+        RuntimeClass& operator=(const RuntimeClass&) = delete;
+        virtual ~RuntimeClass() {}
+
+        ULONG AddRef() override
+        {
+            return ++m_references;
+        }
+        ULONG Release() override
+        {
+            ULONG const references = --m_references;
+            if (references == 0)
+            {
+                delete this;
+            }
+            return references;
+        }
+
+    private:
+        std::atomic<ULONG> m_references{ 0 };
+    };
+
+    template<typename T, typename... Args>
+    ComPtr<T> Make(Args&&... args)
+    {
+        return ComPtr<T>(new T(std::forward<Args>(args)...));
+    }
+
+    namespace Details
+    {
+        // Invoke is implemented with the signature of the interface's
+        template<typename Interface, typename F, typename Method>
+        class CallbackImpl;
+
+        template<typename Interface, typename F, typename Class, typename... Args>
+        class CallbackImpl<Interface, F, HRESULT (Class::*)(Args...)> : public RuntimeClass<Interface>
+        {
+        public:
+            explicit CallbackImpl(F f) : m_f(std::move(f)) {}
+
+            HRESULT Invoke(Args... args) override
+            {
+                return m_f(args...);
+            }
+
+        private:
+            F m_f;
+        };
+    }
+
+    template<typename Interface, typename F>
+    ComPtr<Interface> Callback(F f)
+    {
+        return Make<Details::CallbackImpl<Interface, F, decltype(&Interface::Invoke)>>(std::move(f));
+    }
+}
+}
@@ -0,0 +1,80 @@
+const BULK_MAGIC = 0x31425657;
+const BULK_NUMBER = 1;
+const BULK_STRING = 2;
+const bulkTextDecoder = new TextDecoder('utf-8');
+
+// Reads the lists the host encodes with BulkEncoder (see BulkTransfer.h) in
+// place. Nothing is decoded until a record or a single value is asked for,
+// so a long list is ready as soon as it is fetched.
+class BulkReader {
+    constructor(buffer) {
+        let view = new DataView(buffer);
+        if (buffer.byteLength < 16 || view.getUint32(0, true) != BULK_MAGIC) {
+            throw new Error('Not a bulk buffer');
+        }
+
+        this.count = view.getUint32(4, true);
+        this.columns = new Map();
+
+        let columnCount = view.getUint32(8, true);
+        let nameOffset = 16 + columnCount * 16;
+        for (let i = 0; i < columnCount; ++i) {
+            let entry = 16 + i * 16;
+            let type = view.getUint32(entry, true);
+            let nameLength = view.getUint32(entry + 4, true);
+            let dataOffset = view.getUint32(entry + 8, true);
+            let dataLength = view.getUint32(entry + 12, true);
+            if (dataOffset + dataLength > buffer.byteLength) {
+                throw new Error('Truncated bulk buffer');
+            }
+
+            let name = bulkTextDecoder.decode(new Uint8Array(buffer, nameOffset, nameLength));
+            nameOffset += nameLength;
+
+            // The host writes little endian, like every machine it runs on
+            if (type == BULK_NUMBER) {
+                this.columns.set(name, {
+                    type: type,
+                    values: new Float64Array(buffer, dataOffset, this.count)
+                });
+            } else if (type == BULK_STRING) {
+                let offsetsLength = (this.count + 1) * 4;
+                this.columns.set(name, {
+                    type: type,
+                    offsets: new Uint32Array(buffer, dataOffset, this.count + 1),
+                    bytes: new Uint8Array(buffer, dataOffset + offsetsLength, dataLength - offsetsLength)
+                });
+            }
+        }
+    }
+
+    getValue(index, name) {
+        let column = this.columns.get(name);
+        if (!column || index < 0 || index >= this.count) {
+            return undefined;
+        }
+
+        if (column.type == BULK_NUMBER) {
+            return column.values[index];
+        }
+        return bulkTextDecoder.decode(column.bytes.subarray(column.offsets[index], column.offsets[index + 1]));
+    }
+
+    get(index) {
+        let record = {};
+        for (let name of this.columns.keys()) {
+            record[name] = this.getValue(index, name);
+        }
+        return record;
+    }
+}
+
+// Fetches the buffer behind a bulk URI the host sent, which can be done once
+function fetchBulk(uri) {
+    return fetch(uri).then(response => {
+        if (!response.ok) {
+            throw new Error(`Can't fetch ${uri}: ${response.status}`);
+        }
+        return response.arrayBuffer();
+    }).then(buffer => new BulkReader(buffer));
+}
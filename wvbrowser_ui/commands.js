@@ -25,5 +25,19 @@ const commands = {
     MG_CLEAR_COOKIES: 25,
     MG_GET_HISTORY: 26,
     MG_REMOVE_HISTORY_ITEM: 27,
-    MG_CLEAR_HISTORY: 28
+    MG_CLEAR_HISTORY: 28,
+    MG_BATCH: 29,
+    MG_ADD_HISTORY_ITEM: 30,
+    MG_UPDATE_HISTORY_ITEM: 31,
+    MG_GET_SUGGESTIONS: 32,
+    MG_UPDATE_FAVORITE: 33,
+    MG_ERROR: 34,
+    MG_PAGE_METADATA: 35,
+    MG_RESTORE_SESSION: 36,
+    MG_NEW_WINDOW: 37,
+    MG_MOVE_TAB: 38,
+    MG_OPEN_TABS: 39,
+    MG_LOAD_PROGRESS: 40,
+    MG_BLOCKED_COUNT: 41,
+    MG_IMPORT_HISTORY: 42
 };
@@ -4,7 +4,10 @@ const messageHandler = event => {
 
     switch (message) {
         case commands.MG_GET_FAVORITES:
-            loadFavorites(args.favorites);
+            // The favorites come as one buffer, see bulk.js
+            fetchBulk(args.bulk).then(loadFavorites).catch(error => {
+                console.log(`Can't load the favorites: ${error}`);
+            });
             break;
         default:
             console.log(`Unexpected message: ${JSON.stringify(event.data)}`);
@@ -32,15 +35,16 @@ function removeFavorite(uri) {
     window.chrome.webview.postMessage(message);
 }
 
-function loadFavorites(payload) {
+function loadFavorites(favorites) {
     let fragment = document.createDocumentFragment();
 
-    if (payload.length > 0) {
+    if (favorites.count > 0) {
         let container = document.getElementById('entries-container');
         container.textContent = '';
     }
 
-    payload.map(favorite => {
+    for (let i = 0; i < favorites.count; ++i) {
+        let favorite = favorites.get(i);
         let favoriteContainer = document.createElement('div');
         favoriteContainer.className = 'item-container';
         let favoriteElement = document.createElement('div');
@@ -81,7 +85,7 @@ function loadFavorites(payload) {
 
         favoriteContainer.appendChild(favoriteElement);
         fragment.appendChild(favoriteContainer);
-    });
+    }
 
     let container = document.getElementById('entries-container');
     container.appendChild(fragment);
@@ -1,9 +1,22 @@
-const DEFAULT_HISTORY_ITEM_COUNT = 20;
+const BLOCK_SIZE = 50;
 const EMPTY_HISTORY_MESSAGE = `You haven't visited any sites yet.`;
-let requestedTop = 0;
-let lastRequestSize = 0;
 let itemHeight = 48;
 
+// Chromium lays out no more than about 33.5 million pixels. A longer list
+// gets a spacer of this height, and the scroll position maps to the items in
+// proportion.
+const MAX_SPACER_HEIGHT = 10000000;
+
+// Only the rows in view exist. The host is asked for the blocks of items
+// around them, so the page stays as fast at the end of a long history as at
+// its beginning.
+let total = -1;                // Items in the history, -1 until it is known
+let blocks = new Map();        // Block index -> items, null while requested
+let rowElements = new Map();   // Item index -> row element in view
+let renderScheduled = false;
+let pendingRequests = 0;
+let staleResponses = 0;        // Answers to requests made before a removal
+
 const dateStringFormat = new Intl.DateTimeFormat('default', {
     weekday: 'long',
     year: 'numeric',
@@ -22,20 +35,26 @@ const messageHandler = event => {
 
     switch (message) {
         case commands.MG_GET_HISTORY:
-            let entriesContainer = document.getElementById('entries-container');
-            if (args.from == 0 && args.items.length) {
-                entriesContainer.textContent = '';
+            // The host answers in order
+            --pendingRequests;
+            if (staleResponses > 0) {
+                --staleResponses;
+                break;
+            }
 
-                let clearButton = document.getElementById('btn-clear');
-                clearButton.classList.remove('hidden');
+            if (args.total != total) {
+                // Items were added or removed, the cached blocks are off
+                blocks.clear();
+                setTotal(args.total);
             }
 
-            loadItems(args.items);
-            if (args.items.length == lastRequestSize) {
-                document.addEventListener('scroll', requestTrigger);
-            } else if (entriesContainer.childElementCount == 0) {
-                loadUIForEmptyHistory();
+            if (args.count == 0) {
+                // Answer to a jump to a date
+                scrollToItem(args.from);
+            } else {
+                blocks.set(Math.floor(args.from / BLOCK_SIZE), args.items);
             }
+            scheduleRender();
             break;
         default:
             console.log(`Unexpected message: ${JSON.stringify(event.data)}`);
@@ -43,26 +62,26 @@ const messageHandler = event => {
     }
 };
 
-const requestTrigger = function(event) {
-    let triggerRange = 50;
-    let element = document.body;
-
-    if (element.scrollTop + element.clientHeight >= element.scrollHeight - triggerRange) {
-        getMoreHistoryItems();
-        event.target.removeEventListener('scroll', requestTrigger);
-    }
-};
-
-function requestHistoryItems(from, count) {
+function requestHistoryItems(from, count, before) {
     let message = {
         message: commands.MG_GET_HISTORY,
         args: {
             from: from,
-            count: count || DEFAULT_HISTORY_ITEM_COUNT
+            count: count,
+            before: before || 0
         }
     };
 
     window.chrome.webview.postMessage(message);
+    ++pendingRequests;
+}
+
+// The items below move up, the host tells what is there now
+function invalidateItems(count) {
+    staleResponses = pendingRequests;
+    blocks.clear();
+    setTotal(count);
+    scheduleRender();
 }
 
 function removeItem(id) {
@@ -76,9 +95,147 @@ function removeItem(id) {
     window.chrome.webview.postMessage(message);
 }
 
-function createItemElement(item, id, date) {
+// Requests the blocks holding the items from first to last, and forgets the
+// blocks further away
+function requestBlocks(first, last) {
+    let firstBlock = Math.floor(first / BLOCK_SIZE);
+    let lastBlock = Math.floor(Math.max(first, last - 1) / BLOCK_SIZE);
+
+    for (let block of blocks.keys()) {
+        if (block < firstBlock - 1 || block > lastBlock + 1) {
+            blocks.delete(block);
+        }
+    }
+
+    for (let block = firstBlock; block <= lastBlock; ++block) {
+        if (!blocks.has(block)) {
+            blocks.set(block, null);
+            requestHistoryItems(block * BLOCK_SIZE, BLOCK_SIZE);
+        }
+    }
+}
+
+function getEntry(index) {
+    let items = blocks.get(Math.floor(index / BLOCK_SIZE));
+    return items ? items[index % BLOCK_SIZE] : undefined;
+}
+
+function setTotal(count) {
+    total = count;
+
+    let entriesContainer = document.getElementById('entries-container');
+    let clearButton = document.getElementById('btn-clear');
+    let dateInput = document.getElementById('input-date');
+    for (let element of rowElements.values()) {
+        element.remove();
+    }
+    rowElements.clear();
+
+    if (total == 0) {
+        loadUIForEmptyHistory();
+        return;
+    }
+
+    entriesContainer.textContent = '';
+    entriesContainer.style.height = `${Math.min(total * itemHeight, MAX_SPACER_HEIGHT)}px`;
+    clearButton.classList.remove('hidden');
+    dateInput.classList.remove('hidden');
+}
+
+// How far the rows are moved up in the spacer, which is the part of the list
+// that doesn't fit in it times the fraction scrolled
+function getScrollShift() {
+    let entriesContainer = document.getElementById('entries-container');
+    let scroller = document.scrollingElement;
+    let excess = total * itemHeight - entriesContainer.offsetHeight;
+    let range = scroller.scrollHeight - scroller.clientHeight;
+    if (excess <= 0 || range <= 0) {
+        return 0;
+    }
+
+    return Math.round(Math.min(1, scroller.scrollTop / range) * excess);
+}
+
+function scheduleRender() {
+    if (!renderScheduled) {
+        renderScheduled = true;
+        window.requestAnimationFrame(render);
+    }
+}
+
+function render() {
+    renderScheduled = false;
+    if (total <= 0) {
+        return;
+    }
+
+    // The date header sticks to the top and covers the items below it
+    let entriesContainer = document.getElementById('entries-container');
+    let dateHeader = document.getElementById('header-date');
+    let shift = getScrollShift();
+    let top = dateHeader.offsetHeight - entriesContainer.getBoundingClientRect().top + shift;
+    let first = Math.min(total - 1, Math.max(0, Math.floor(top / itemHeight)));
+    let last = Math.min(total, Math.ceil((top + window.innerHeight) / itemHeight));
+
+    // One window is fetched ahead in both directions
+    let windowSize = Math.max(1, last - first);
+    requestBlocks(Math.max(0, first - windowSize), Math.min(total, last + windowSize));
+
+    for (let [index, element] of rowElements) {
+        if (index < first || index >= last) {
+            element.remove();
+            rowElements.delete(index);
+        }
+    }
+
+    for (let index = first; index < last; ++index) {
+        let entry = getEntry(index);
+        let element = rowElements.get(index);
+        let id = entry ? entry.id : 0;
+        if (!element || element.historyId != id) {
+            if (element) {
+                element.remove();
+            }
+            element = entry ? createItemElement(entry.item, entry.id) : createPlaceholderElement();
+            element.historyId = id;
+            entriesContainer.append(element);
+            rowElements.set(index, element);
+        }
+        // The shift changes with every scroll of a long list
+        element.style.top = `${index * itemHeight - shift}px`;
+    }
+
+    let entry = getEntry(first);
+    dateHeader.textContent = entry ? dateStringFormat.format(new Date(entry.item.timestamp)) : '';
+}
+
+// Solves the mapping of render() for the scroll position which puts the
+// item at the top
+function scrollToItem(index) {
+    let entriesContainer = document.getElementById('entries-container');
+    let dateHeader = document.getElementById('header-date');
+    let scroller = document.scrollingElement;
+    // Where the list is at the top of the view when scrolled to 0
+    let origin = dateHeader.offsetHeight - entriesContainer.getBoundingClientRect().top - scroller.scrollTop;
+    let excess = Math.max(0, total * itemHeight - entriesContainer.offsetHeight);
+    let range = Math.max(1, scroller.scrollHeight - scroller.clientHeight);
+    scroller.scrollTop = (index * itemHeight - origin) / (1 + excess / range);
+}
+
+// Asks the host where the visits of the chosen day begin
+function jumpToDate(value) {
+    let parts = value.split('-');
+    if (parts.length != 3) {
+        return;
+    }
+
+    let nextDay = new Date(parseInt(parts[0]), parseInt(parts[1]) - 1, parseInt(parts[2]) + 1);
+    requestHistoryItems(0, 0, nextDay.getTime());
+}
+
+function createItemElement(item, id) {
+    let date = new Date(item.timestamp);
     let itemContainer = document.createElement('div');
-    itemContainer.id = id;
     itemContainer.className = 'item-container';
 
     let itemElement = document.createElement('div');
@@ -115,6 +272,7 @@ function createItemElement(item, id, date) {
     let timeLabel = document.createElement('div');
     timeLabel.className = 'label-time';
     let timeText = document.createElement('p');
+    timeText.title = dateStringFormat.format(date);
     timeText.textContent = timeStringFormat.format(date);
     timeLabel.append(timeText);
     itemElement.append(timeLabel);
@@ -123,17 +281,8 @@ function createItemElement(item, id, date) {
     let closeButton = document.createElement('div');
     closeButton.className = 'btn-close';
     closeButton.addEventListener('click', function(e) {
-        if (itemContainer.parentNode.children.length <= 2) {
-            itemContainer.parentNode.remove();
-        } else {
-            itemContainer.remove();
-        }
-
-        let entriesContainer = document.getElementById('entries-container');
-        if (entriesContainer.childElementCount == 0) {
-            loadUIForEmptyHistory();
-        }
-        removeItem(parseInt(id.split('-')[1]));
+        removeItem(id);
+        invalidateItems(total - 1);
     });
     itemElement.append(closeButton);
     itemContainer.append(itemElement);
@@ -141,75 +290,16 @@ function createItemElement(item, id, date) {
     return itemContainer;
 }
 
-function createDateContainer(id, date) {
-    let dateContainer = document.createElement('div');
-    dateContainer.id = id;
-
-    let dateLabel = document.createElement('h3');
-    dateLabel.className = 'header-date';
-    dateLabel.textContent = dateStringFormat.format(date);
-    dateContainer.append(dateLabel);
-
-    return dateContainer;
-}
-
-function loadItems(items) {
-    let dateContainer;
-    let fragment;
-
-    items.map((entry) => {
-        let id = entry.id;
-        let item = entry.item;
-        let itemContainerId = `item-${id}`;
-
-        // Skip the item if already loaded. This could happen if the user
-        // visits an item for the current date again before requesting more
-        // history items.
-        let itemContainer = document.getElementById(itemContainerId);
-        if (itemContainer) {
-            return;
-        }
-
-        let date = new Date(item.timestamp);
-        let day = date.getDate();
-        let month = date.getMonth();
-        let year = date.getFullYear();
-        let dateContainerId = `entries-${month}-${day}-${year}`;
-
-        // If entry belongs to a new date, append buffered items for previous
-        // date.
-        if (dateContainer && dateContainer.id != dateContainerId) {
-            dateContainer.append(fragment);
-        }
-
-        dateContainer = document.getElementById(dateContainerId);
-        if (!dateContainer) {
-            dateContainer = createDateContainer(dateContainerId, date);
-            fragment = document.createDocumentFragment();
-
-            let entriesContainer = document.getElementById('entries-container');
-            entriesContainer.append(dateContainer);
-        } else if (!fragment) {
-            fragment = document.createDocumentFragment();
-        }
-
-        itemContainer = createItemElement(item, itemContainerId, date);
-        fragment.append(itemContainer);
-    });
-
-    // Append remaining items in buffer
-    if (fragment) {
-        dateContainer.append(fragment);
-    }
-}
+// Shown until the host sends the item
+function createPlaceholderElement() {
+    let itemContainer = document.createElement('div');
+    itemContainer.className = 'item-container';
 
-function getMoreHistoryItems(n) {
-    n = n ? n : DEFAULT_HISTORY_ITEM_COUNT;
+    let itemElement = document.createElement('div');
+    itemElement.className = 'item placeholder';
+    itemContainer.append(itemElement);
 
-    requestHistoryItems(requestedTop, n);
-    requestedTop += n;
-    lastRequestSize = n;
-    document.removeEventListener('scroll', requestTrigger);
+    return itemContainer;
 }
 
 function addUIListeners() {
@@ -235,6 +325,14 @@ function addUIListeners() {
 
     let clearButton = document.getElementById('btn-clear');
     clearButton.addEventListener('click', toggleClearPrompt);
+
+    let dateInput = document.getElementById('input-date');
+    dateInput.addEventListener('change', function(event) {
+        jumpToDate(dateInput.value);
+    });
+
+    document.addEventListener('scroll', scheduleRender);
+    window.addEventListener('resize', scheduleRender);
 }
 
 function toggleClearPrompt() {
@@ -245,14 +343,21 @@ function toggleClearPrompt() {
 function loadUIForEmptyHistory() {
     let entriesContainer = document.getElementById('entries-container');
     entriesContainer.textContent = EMPTY_HISTORY_MESSAGE;
+    entriesContainer.style.height = '';
+
+    let dateHeader = document.getElementById('header-date');
+    dateHeader.textContent = '';
 
     let clearButton = document.getElementById('btn-clear');
     clearButton.classList.add('hidden');
+
+    let dateInput = document.getElementById('input-date');
+    dateInput.classList.add('hidden');
 }
 
 function clearHistory() {
     toggleClearPrompt();
-    loadUIForEmptyHistory();
+    invalidateItems(0);
 
     let message = {
         message: commands.MG_CLEAR_HISTORY,
@@ -265,9 +370,8 @@ function clearHistory() {
 function init() {
     window.chrome.webview.addEventListener('message', messageHandler);
 
-    let viewportItemsCapacity = Math.round(window.innerHeight / itemHeight);
     addUIListeners();
-    getMoreHistoryItems(viewportItemsCapacity);
+    requestBlocks(0, BLOCK_SIZE);
 }
 
 init();
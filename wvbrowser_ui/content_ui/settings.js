@@ -5,6 +5,7 @@ const messageHandler = event => {
     switch (message) {
         case commands.MG_GET_SETTINGS:
             loadSettings(args.settings);
+            loadResponseCache(args.responseCache);
             break;
         case commands.MG_CLEAR_CACHE:
             if (args.content && args.controls) {
@@ -12,6 +13,8 @@ const messageHandler = event => {
             } else {
                 updateLabelForEntry('entry-cache', 'Try again');
             }
+            // The response cache is cleared as well
+            requestBrowserSettings();
             break;
         case commands.MG_CLEAR_COOKIES:
             if (args.content && args.controls) {
@@ -81,6 +84,19 @@ function loadSettings(settings) {
     }
 }
 
+function loadResponseCache(responseCache) {
+    let entryElement = document.getElementById('entry-response-cache');
+    if (!responseCache.enabled) {
+        entryElement.style.display = 'none';
+        return;
+    }
+
+    entryElement.style.display = 'block';
+    let megabytesSaved = (responseCache.bytesSaved / (1024 * 1024)).toFixed(1);
+    updateLabelForEntry('entry-response-cache',
+        `${responseCache.hits} hits, ${responseCache.misses} misses, ${megabytesSaved} MB saved`);
+}
+
 function updateLabelForEntry(elementId, label) {
     let entryElement = document.getElementById(elementId);
     if (!entryElement) {
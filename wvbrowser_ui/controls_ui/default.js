@@ -2,11 +2,6 @@ const WORD_REGEX = /^[^//][^.]*$/;
 const VALID_URI_REGEX = /^[-:.&#+()[\]$'*;@~!,?%=\/\w]+$/; // Will check that only RFC3986 allowed characters are included
 const SCHEMED_URI_REGEX = /^\w+:.+$/;
 
-let settings = {
-    scriptsEnabled: true,
-    blockPopups: true
-};
-
 const messageHandler = event => {
     var message = event.data.message;
     var args = event.data.args;
@@ -40,18 +35,17 @@ const messageHandler = event => {
 
                 // Filter URIs that should not appear in history
                 if (!tab.uri || tab.uri == 'about:blank') {
-                    tab.historyItemId = INVALID_HISTORY_ID;
+                    tab.inHistory = false;
                     break;
                 }
 
                 if (tab.uriToShow && tab.uriToShow.substring(0, 10) == 'browser://') {
-                    tab.historyItemId = INVALID_HISTORY_ID;
+                    tab.inHistory = false;
                     break;
                 }
 
-                addHistoryItem(historyItemFromTab(args.tabId), (id) => {
-                    tab.historyItemId = id;
-                });
+                addHistoryItem(args.tabId);
+                tab.inHistory = true;
             }
             break;
         case commands.MG_NAV_STARTING:
@@ -76,28 +70,14 @@ const messageHandler = event => {
                 }
             }
             break;
-        case commands.MG_UPDATE_TAB:
+        case commands.MG_PAGE_METADATA:
             if (isValidTabId(args.tabId)) {
                 const tab = tabs.get(args.tabId);
-                const tabElement = document.getElementById(`tab-${args.tabId}`);
+                tab.canonical = args.canonical;
+                tab.themeColor = args.themeColor;
 
-                if (!tabElement) {
-                    refreshTabs();
-                    return;
-                }
-
-                // Update tab label
-                // Use given title or fall back to a generic tab title
-                tab.title = args.title || 'Tab';
-                const tabLabel = tabElement.firstChild;
-                const tabLabelSpan = tabLabel.firstChild;
-                tabLabelSpan.textContent = tab.title;
-
-                // Update title in history item
-                // Browser pages will keep an invalid history ID
-                if (tab.historyItemId != INVALID_HISTORY_ID) {
-                    updateHistoryItem(tab.historyItemId, historyItemFromTab(args.tabId));
-                }
+                updateTabTitle(args.tabId, args.title);
+                updateFaviconURI(args.tabId, args.favicon);
             }
             break;
         case commands.MG_OPTIONS_LOST_FOCUS:
@@ -118,9 +98,14 @@ const messageHandler = event => {
                 }
             }
             break;
-        case commands.MG_UPDATE_FAVICON:
+        case commands.MG_BLOCKED_COUNT:
             if (isValidTabId(args.tabId)) {
-                updateFaviconURI(args.tabId, args.uri);
+                const tab = tabs.get(args.tabId);
+                tab.blocked = args.blocked;
+
+                if (args.tabId == activeTabId) {
+                    updateNavigationUI(message);
+                }
             }
             break;
         case commands.MG_CLOSE_WINDOW:
@@ -131,36 +116,33 @@ const messageHandler = event => {
                 closeTab(args.tabId);
             }
             break;
-        case commands.MG_GET_FAVORITES:
-            if (isValidTabId(args.tabId)) {
-                getFavoritesAsJson((payload) => {
-                    args.favorites = payload;
-                    window.chrome.webview.postMessage(event.data);
-                });
-            }
+        case commands.MG_MOVE_TAB:
+            moveTab(args.tabId);
+            break;
+        case commands.MG_OPEN_TABS:
+            openTabs(args.requestId, args.uris);
             break;
         case commands.MG_REMOVE_FAVORITE:
-            removeFavorite(args.uri);
+            // Removed in the favorites page
+            removeFavorite(args.uri, updateFavoriteIcon);
             break;
-        case commands.MG_GET_SETTINGS:
-            if (isValidTabId(args.tabId)) {
-                args.settings = settings;
-                window.chrome.webview.postMessage(event.data);
-            }
+        case commands.MG_GET_SUGGESTIONS:
+            updateSuggestions(args);
             break;
-        case commands.MG_GET_HISTORY:
-            if (isValidTabId(args.tabId)) {
-                getHistoryItems(args.from, args.count, (payload) => {
-                    args.items = payload;
-                    window.chrome.webview.postMessage(event.data);
-                });
-            }
+        case commands.MG_ERROR:
+            showError(args);
+            break;
+        case commands.MG_LOAD_PROGRESS:
+            updateLoadProgress(args);
             break;
-        case commands.MG_REMOVE_HISTORY_ITEM:
-            removeHistoryItem(args.id);
+        case commands.MG_RESTORE_SESSION:
+            restoreSession(args);
             break;
-        case commands.MG_CLEAR_HISTORY:
-            clearHistory();
+        case commands.MG_BATCH:
+            // Updates coalesced by the host, handle them in order
+            args.messages.forEach((batchedMessage) => {
+                messageHandler({ data: batchedMessage });
+            });
             break;
         default:
             console.log(`Received unexpected message: ${JSON.stringify(event.data)}`);
@@ -354,6 +336,23 @@ function updateLockIcon() {
     }
 }
 
+// Requests of the active tab's page which the host blocked
+function updateBlockedCount() {
+    if (activeTabId == INVALID_TAB_ID) {
+        return;
+    }
+
+    let blockedElement = document.getElementById('blocked-count');
+    if (!blockedElement) {
+        return;
+    }
+
+    const blocked = tabs.get(activeTabId).blocked;
+    blockedElement.textContent = blocked;
+    blockedElement.title = `${blocked} ${blocked == 1 ? 'request' : 'requests'} blocked on this page`;
+    blockedElement.className = blocked > 0 ? 'visible' : '';
+}
+
 // Update favorite status for the active tab
 function updateFavoriteIcon() {
     if (activeTabId == INVALID_TAB_ID) {
@@ -393,6 +392,9 @@ function updateNavigationUI(reason) {
         case commands.MG_SECURITY_UPDATE:
             updateLockIcon();
             break;
+        case commands.MG_BLOCKED_COUNT:
+            updateBlockedCount();
+            break;
         case commands.MG_UPDATE_FAVICON:
             updateFavicon();
             break;
@@ -402,6 +404,7 @@ function updateNavigationUI(reason) {
         case commands.MG_SWITCH_TAB:
             updateURI();
             updateLockIcon();
+            updateBlockedCount();
             updateFavicon();
             updateFavoriteIcon();
             updateReloadButton();
@@ -535,12 +538,21 @@ function refreshControls() {
     addressInput.placeholder = 'Search or enter web address';
     addressInput.type = 'text';
     addressInput.spellcheck = false;
+    addressInput.setAttribute('list', 'address-suggestions');
     addressBar.append(addressInput);
 
+    let suggestionsList = document.createElement('datalist');
+    suggestionsList.id = 'address-suggestions';
+    addressBar.append(suggestionsList);
+
     let clearButton = document.createElement('button');
     clearButton.id = 'btn-clear';
     addressBar.append(clearButton);
 
+    let blockedCount = document.createElement('div');
+    blockedCount.id = 'blocked-count';
+    addressBar.append(blockedCount);
+
     let favoriteButton = document.createElement('div');
     favoriteButton.className = 'icn';
     favoriteButton.id = 'btn-fav';
@@ -552,6 +564,15 @@ function refreshControls() {
     manageControls.className = 'controls-group';
     manageControls.id = 'manage-controls-container';
 
+    let loadProgress = document.createElement('div');
+    loadProgress.id = 'load-progress';
+    manageControls.append(loadProgress);
+
+    let errorNotice = document.createElement('div');
+    errorNotice.id = 'error-notice';
+    errorNotice.addEventListener('click', hideError);
+    manageControls.append(errorNotice);
+
     let optionsButton = document.createElement('div');
     optionsButton.className = 'btn';
     optionsButton.id = 'btn-options';
@@ -614,6 +635,73 @@ function toggleFavorite() {
     }
 }
 
+function requestSuggestions(query) {
+    var message = {
+        message: commands.MG_GET_SUGGESTIONS,
+        args: {
+            query: query
+        }
+    };
+
+    window.chrome.webview.postMessage(message);
+}
+
+function updateSuggestions(args) {
+    // Drop answers to queries the user has typed past
+    if (args.query !== document.querySelector('#address-field').value) {
+        return;
+    }
+
+    let suggestionsList = document.getElementById('address-suggestions');
+    suggestionsList.textContent = '';
+    args.suggestions.map((suggestion) => {
+        let option = document.createElement('option');
+        option.value = suggestion.uri;
+        option.label = suggestion.isFavorite ? `\u2605 ${suggestion.title}` : suggestion.title;
+        suggestionsList.append(option);
+    });
+}
+
+// Errors in the host are shown for a few seconds, next to the options
+let errorTimeout = null;
+
+function showError(args) {
+    let errorNotice = document.getElementById('error-notice');
+    if (!errorNotice) {
+        return;
+    }
+
+    errorNotice.textContent = args.message;
+    errorNotice.title = `${args.message} (${args.code})`;
+    errorNotice.className = 'visible';
+
+    clearTimeout(errorTimeout);
+    errorTimeout = setTimeout(hideError, 8000);
+}
+
+function hideError() {
+    let errorNotice = document.getElementById('error-notice');
+    if (errorNotice) {
+        errorNotice.className = '';
+    }
+}
+
+// The tabs opened from a list of URIs which are loaded already
+function updateLoadProgress(args) {
+    let loadProgress = document.getElementById('load-progress');
+    if (!loadProgress) {
+        return;
+    }
+
+    if (args.total > 1 && args.loading + args.queued > 0) {
+        loadProgress.textContent = `${args.finished} / ${args.total}`;
+        loadProgress.title = `${args.failed} failed, ${args.loading} loading, ${args.queued} waiting`;
+        loadProgress.className = 'visible';
+    } else {
+        loadProgress.className = '';
+    }
+}
+
 function addControlsListeners() {
     let inputField = document.querySelector('#address-field');
     let clearButton = document.querySelector('#btn-clear');
@@ -626,6 +714,10 @@ function addControlsListeners() {
         }
     });
 
+    inputField.addEventListener('input', function(e) {
+        requestSuggestions(inputField.value);
+    });
+
     inputField.addEventListener('focus', function(e) {
         e.target.select();
     });
@@ -732,7 +824,8 @@ function init() {
     refreshControls();
     refreshTabs();
 
-    createNewTab(true);
+    requestSession();
+    syncFavorites();
 }
 
 init();
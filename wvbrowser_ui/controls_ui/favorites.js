@@ -26,6 +26,7 @@ function addFavorite(favorite, callback) {
         };
 
         addFavoriteRequest.onsuccess = function(event) {
+            postFavoriteUpdate(favorite, true);
             if (callback) {
                 callback();
             }
@@ -45,6 +46,7 @@ function removeFavorite(key, callback) {
         };
 
         removeFavoriteRequest.onsuccess = function(event) {
+            postFavoriteUpdate({ uri: key }, false);
             if (callback) {
                 callback();
             }
@@ -70,3 +72,30 @@ function getFavoritesAsJson(callback) {
         };
     });
 }
+
+// The host serves the favorites page and suggests favorites in the address
+// bar
+function postFavoriteUpdate(favorite, isFavorite) {
+    let message = {
+        message: commands.MG_UPDATE_FAVORITE,
+        args: {
+            favorite: favorite,
+            isFavorite: isFavorite
+        }
+    };
+
+    window.chrome.webview.postMessage(message);
+}
+
+function syncFavorites() {
+    getFavoritesAsJson((favorites) => {
+        let message = {
+            message: commands.MG_GET_FAVORITES,
+            args: {
+                favorites: favorites
+            }
+        };
+
+        window.chrome.webview.postMessage(message);
+    });
+}
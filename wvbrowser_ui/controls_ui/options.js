@@ -9,6 +9,17 @@ function navigateToBrowserPage(path) {
     window.chrome.webview.postMessage(navMessage);
 }
 
+function openNewWindow(moveTab) {
+    const windowMessage = {
+        message: commands.MG_NEW_WINDOW,
+        args: {
+            moveTab: moveTab
+        }
+    };
+
+    window.chrome.webview.postMessage(windowMessage);
+}
+
 // Add listener for the options menu entries
 function addItemsListeners() {
 
@@ -34,6 +45,12 @@ function addItemsListeners() {
                         navigateToBrowserPage(entry);
                     });
                     break;
+                case 'newwindow':
+                case 'movetab':
+                    item.addEventListener('click', function(e) {
+                        openNewWindow(entry == 'movetab');
+                    });
+                    break;
             }
         });
     })();
@@ -1,3 +1,6 @@
+// Version 2 dropped the history store, the history is kept by the host
+const DB_VERSION = 2;
+
 function handleUpgradeEvent(event) {
     console.log('Creating DB');
     let newDB = event.target.result;
@@ -7,29 +10,52 @@ function handleUpgradeEvent(event) {
         console.log(event);
     };
 
-    let newFavoritesStore = newDB.createObjectStore('favorites', {
-        keyPath: 'uri'
-    });
+    if (!newDB.objectStoreNames.contains('favorites')) {
+        let newFavoritesStore = newDB.createObjectStore('favorites', {
+            keyPath: 'uri'
+        });
 
-    newFavoritesStore.transaction.oncomplete = function(event) {
-        console.log('Object stores created');
-    };
+        newFavoritesStore.transaction.oncomplete = function(event) {
+            console.log('Object stores created');
+        };
+    }
 
-    let newHistoryStore = newDB.createObjectStore('history', {
-        autoIncrement: true
-    });
+    if (newDB.objectStoreNames.contains('history')) {
+        importHistory(event.target.transaction);
+    }
+}
 
-    newHistoryStore.createIndex('timestamp', 'timestamp', {
-        unique: false
-    });
+// Hands the history of version 1 to the host and deletes it. This runs in
+// the upgrade transaction, so it happens once.
+function importHistory(transaction) {
+    let request = transaction.objectStore('history').getAll();
 
-    newHistoryStore.createIndex('stampedURI', ['uri', 'timestamp'], {
-        unique: false
-    });
+    request.onsuccess = function(event) {
+        let visits = event.target.result.map((item) => {
+            let date = new Date(item.timestamp);
+            return {
+                uri: item.uri,
+                title: item.title || '',
+                favicon: item.favicon || '',
+                timestamp: date.getTime(),
+                day: date.getFullYear() * 10000 + (date.getMonth() + 1) * 100 + date.getDate()
+            };
+        });
+
+        let message = {
+            message: commands.MG_IMPORT_HISTORY,
+            args: {
+                visits: visits
+            }
+        };
+
+        window.chrome.webview.postMessage(message);
+        transaction.db.deleteObjectStore('history');
+    };
 }
 
 function queryDB(query) {
-    let request = window.indexedDB.open('WVBrowser');
+    let request = window.indexedDB.open('WVBrowser', DB_VERSION);
 
     request.onerror = function(event) {
         console.log('Failed to open database');
@@ -11,40 +11,94 @@ function isValidTabId(tabId) {
     return tabId != INVALID_TAB_ID && tabs.has(tabId);
 }
 
-function createNewTab(shouldBeActive) {
+// A tab opened in the background with a uri only loads it once it is shown,
+// unless it has a batchIndex, its position in a list of URIs the host loads
+// a few at a time
+function createNewTab(shouldBeActive, uri, batchIndex) {
     const tabId = getNewTabId();
 
     var message = {
         message: commands.MG_CREATE_TAB,
         args: {
             tabId: parseInt(tabId),
-            active: shouldBeActive || false
+            active: shouldBeActive || false,
+            uri: uri || '',
+            batchIndex: batchIndex === undefined ? -1 : batchIndex
         }
     };
 
     window.chrome.webview.postMessage(message);
 
+    addTab(tabId, uri, uri);
+
+    if (shouldBeActive) {
+        switchToTab(tabId, false);
+    }
+
+    return tabId;
+}
+
+function addTab(tabId, uri, title) {
     tabs.set(parseInt(tabId), {
-        title: 'New Tab',
-        uri: '',
-        uriToShow: '',
+        title: title || 'New Tab',
+        uri: uri || '',
+        uriToShow: uri || '',
         favicon: 'img/favicon.png',
         isFavorite: false,
         isLoading: false,
         canGoBack: false,
         canGoForward: false,
         securityState: 'unknown',
-        historyItemId: INVALID_HISTORY_ID
+        blocked: 0,
+        inHistory: false
     });
 
     loadTabUI(tabId);
+}
 
-    if (shouldBeActive) {
-        switchToTab(tabId, false);
+function requestSession() {
+    var message = {
+        message: commands.MG_RESTORE_SESSION,
+        args: {}
+    };
+
+    window.chrome.webview.postMessage(message);
+}
+
+// The host has created the tabs of the previous session already, and loads
+// them when they are shown. A tab moved in from another window keeps its id,
+// the ids of this window's new tabs start at tabIdBase.
+function restoreSession(session) {
+    tabIdCounter = Math.max(tabIdCounter, session.tabIdBase || 0);
+    session.tabs.map(savedTab => {
+        tabIdCounter = Math.max(tabIdCounter, savedTab.tabId);
+        addTab(savedTab.tabId, savedTab.uri, savedTab.title || savedTab.uri);
+    });
+
+    if (session.openTab) {
+        createNewTab(true);
+    } else {
+        switchToTab(session.activeTabId, false);
     }
 }
 
-function switchToTab(id, updateOnHost) {
+// Asked for by another instance of the app, or the command line. The first
+// tab is shown, the others load in the background in the order of the list.
+function openTabs(requestId, uris) {
+    const tabIds = uris.map((uri, index) => createNewTab(index == 0, uri, index));
+
+    var message = {
+        message: commands.MG_OPEN_TABS,
+        args: {
+            requestId: requestId,
+            tabIds: tabIds
+        }
+    };
+
+    window.chrome.webview.postMessage(message);
+}
+
+
     if (!id) {
         console.log('ID not provided');
         return;
@@ -115,6 +169,28 @@ function closeTab(id) {
         switchToTab(lastEntry[0], true);
     }
 
+    removeTab(id, commands.MG_CLOSE_TAB);
+}
+
+// The host opens a new window for the tab, which keeps its page
+function moveTab(id) {
+    if (!isValidTabId(id) || tabs.size == 1) {
+        return;
+    }
+
+    if (id == activeTabId) {
+        var tabsEntries = Array.from(tabs.entries());
+        var lastEntry = tabsEntries.pop();
+        if (lastEntry[0] == id) {
+            lastEntry = tabsEntries.pop();
+        }
+        switchToTab(lastEntry[0], true);
+    }
+
+    removeTab(id, commands.MG_MOVE_TAB);
+}
+
+function removeTab(id, command) {
     // Remove tab element
     var tabElement = document.getElementById(`tab-${id}`);
     if (tabElement) {
@@ -124,7 +200,7 @@ function closeTab(id) {
     tabs.delete(id);
 
     var message = {
-        message: commands.MG_CLOSE_TAB,
+        message: command,
         args: {
             tabId: id
         }
@@ -133,7 +209,32 @@ function closeTab(id) {
     window.chrome.webview.postMessage(message);
 }
 
+function updateTabTitle(tabId, title) {
+    const tab = tabs.get(tabId);
+    const tabElement = document.getElementById(`tab-${tabId}`);
+
+    if (!tabElement) {
+        refreshTabs();
+        return;
+    }
+
+    // Update tab label
+    // Use given title or fall back to a generic tab title
+    tab.title = title || 'Tab';
+    const tabLabel = tabElement.firstChild;
+    const tabLabelSpan = tabLabel.firstChild;
+    tabLabelSpan.textContent = tab.title;
+
+    // Update title in history item
+    // Browser pages are not in the history
+    if (tab.inHistory) {
+        updateHistoryItem(tabId);
+    }
+}
+
 function updateFaviconURI(tabId, src) {
+    // The host already looked for the site's favicon.ico, see FaviconCache
+    src = src || 'img/favicon.png';
     let tab = tabs.get(tabId);
     if (tab.favicon != src) {
         let img = new Image();
@@ -148,27 +249,11 @@ function updateFaviconURI(tabId, src) {
             }
         };
 
-        if (src) {
-            // Try load from root on failed load
-            img.onerror = () => {
-                console.log('Cannot load favicon from link, trying with root');
-                updateFaviconURI(tabId, '');
-            };
-        } else {
-            // No link for favicon, try loading from root
-            try {
-                let tabURI = new URL(tab.uri);
-                src = `${tabURI.origin}/favicon.ico`;
-            } catch(e) {
-                console.log(`Could not parse tab ${tabId} URI`);
-            }
-
-            img.onerror = () => {
-                console.log('No favicon in site root. Using default favicon.');
-                tab.favicon = 'img/favicon.png';
-                updatedFaviconURIHandler(tabId, tab);
-            };
-        }
+        img.onerror = () => {
+            console.log('Cannot load favicon. Using default favicon.');
+            tab.favicon = 'img/favicon.png';
+            updatedFaviconURIHandler(tabId, tab);
+        };
 
         img.src = src;
     }
@@ -178,8 +263,8 @@ function updatedFaviconURIHandler(tabId, tab) {
     updateNavigationUI(commands.MG_UPDATE_FAVICON);
 
     // Update favicon in history item
-    if (tab.historyItemId != INVALID_HISTORY_ID) {
-        updateHistoryItem(tab.historyItemId, historyItemFromTab(tabId));
+    if (tab.inHistory) {
+        updateHistoryItem(tabId);
     }
 }
 
@@ -210,7 +295,6 @@ function historyItemFromTab(tabId) {
     return {
         uri: tab.uri,
         title: tab.title,
-        favicon: favicon,
-        timestamp: new Date()
+        favicon: favicon
     }
 }